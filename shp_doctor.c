@@ -32,9 +32,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <float.h>
 #include <errno.h>
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 #if defined(_WIN32) && !defined(__MINGW32__)
 #include "config-msvc.h"
 #else
@@ -50,13 +55,333 @@
 #include <spatialite/gaiageo.h>
 #include <spatialite.h>
 
+#include "shp_reader.h"
+
 #define ARG_NONE		0
 #define ARG_IN_PATH		1
+#define ARG_THREADS		2
 
 #if defined(_WIN32) && !defined(__MINGW32__)
 #define strcasecmp	_stricmp
 #endif /* not WIN32 */
 
+static int
+check_parts (const unsigned char *buf, int buf_len, int endian_arch)
+{
+/*
+ * checking that a polyline/polygon payload [parts count, points count,
+ * parts index and points] fits within the SHP record
+*/
+    int n;
+    int n1;
+    int ind;
+    int end;
+    if (buf_len < 8)
+	return 0;
+    n = gaiaImport32 (buf, GAIA_LITTLE_ENDIAN, endian_arch);
+    n1 = gaiaImport32 (buf + 4, GAIA_LITTLE_ENDIAN, endian_arch);
+    if (n < 0 || n1 < 0)
+	return 0;
+    if ((8.0 + ((double) n * 4.0) + ((double) n1 * 16.0)) > (double) buf_len)
+	return 0;
+    for (ind = 1; ind < n; ind++)
+      {
+	  /* each part must start within the points array */
+	  end = gaiaImport32 (buf + 8 + (ind * 4), GAIA_LITTLE_ENDIAN,
+			      endian_arch);
+	  if (end < 0 || end > n1)
+	      return 0;
+      }
+    return 1;
+}
+
+/*
+ * bulk decoding and block scans of the SHP vertices
+ *
+ * each entity's X,Y pairs are decoded at once into native doubles,
+ * then scanned COORDS_BLOCK vertices at a time
+*/
+#define COORDS_BLOCK	16
+
+struct shp_coords
+{
+/* the vertices of the current entity, decoded as native doubles */
+    double *xy;
+    int max_points;
+};
+
+static const double *
+decode_coords (struct shp_coords *coords, const unsigned char *buf,
+	       int points, int endian_arch)
+{
+/*
+ * bulk decoding an array of little-endian X,Y pairs
+ *
+ * on little-endian CPUs this simply is a single copy [the SHP
+ * doubles aren't necessarily aligned within the record]
+*/
+    int i;
+    int j;
+    if (coords->xy == NULL || points > coords->max_points)
+      {
+	  int max = coords->max_points * 2;
+	  if (max < 1024)
+	      max = 1024;
+	  while (max < points)
+	      max *= 2;
+	  if (coords->xy != NULL)
+	      free (coords->xy);
+	  coords->xy = malloc (sizeof (double) * 2 * max);
+	  coords->max_points = max;
+      }
+    if (endian_arch)
+	memcpy (coords->xy, buf, (size_t) points * 16);
+    else
+      {
+	  /* big-endian CPU: swapping the bytes of each double */
+	  unsigned char *out = (unsigned char *) (coords->xy);
+	  for (i = 0; i < points * 2; i++)
+	    {
+		for (j = 0; j < 8; j++)
+		    out[(i * 8) + j] = buf[(i * 8) + 7 - j];
+	    }
+      }
+    return coords->xy;
+}
+
+static int
+find_outside_extent (const double *xy, int points, double minx, double miny,
+		     double maxx, double maxy)
+{
+/*
+ * returning the index of the first vertex falling outside the extent
+ * or -1 if all vertices are inside
+ *
+ * the MBR of each block of vertices is computed by a branchless
+ * min/max reduction [vectorized by the compiler]; only a block whose
+ * MBR exceeds the extent is then scanned vertex by vertex
+ * NaN coords never are outside, exactly as in plain comparisons
+*/
+    int ib;
+    int iv;
+    int end;
+    double x;
+    double y;
+    double bminx;
+    double bminy;
+    double bmaxx;
+    double bmaxy;
+    for (ib = 0; ib < points; ib += COORDS_BLOCK)
+      {
+	  end = ib + COORDS_BLOCK;
+	  if (end > points)
+	      end = points;
+	  bminx = DBL_MAX;
+	  bminy = DBL_MAX;
+	  bmaxx = -DBL_MAX;
+	  bmaxy = -DBL_MAX;
+	  for (iv = ib; iv < end; iv++)
+	    {
+		x = xy[iv * 2];
+		y = xy[(iv * 2) + 1];
+		bminx = (x < bminx) ? x : bminx;
+		bmaxx = (x > bmaxx) ? x : bmaxx;
+		bminy = (y < bminy) ? y : bminy;
+		bmaxy = (y > bmaxy) ? y : bmaxy;
+	    }
+	  if (bminx < minx || bmaxx > maxx || bminy < miny || bmaxy > maxy)
+	    {
+		for (iv = ib; iv < end; iv++)
+		  {
+		      x = xy[iv * 2];
+		      y = xy[(iv * 2) + 1];
+		      if (x < minx || x > maxx || y < miny || y > maxy)
+			  return iv;
+		  }
+	    }
+      }
+    return -1;
+}
+
+static int
+has_repeated_vertices (const double *xy, int points)
+{
+/*
+ * checking for consecutive repeated vertices
+ *
+ * each block of vertices is tested by a branchless equality scan
+ * [vectorized by the compiler], stopping at the first hit
+*/
+    int ib;
+    int iv;
+    int end;
+    int repeated;
+    for (ib = 1; ib < points; ib += COORDS_BLOCK)
+      {
+	  end = ib + COORDS_BLOCK;
+	  if (end > points)
+	      end = points;
+	  repeated = 0;
+	  for (iv = ib; iv < end; iv++)
+	      repeated |= (xy[iv * 2] == xy[(iv - 1) * 2])
+		  & (xy[(iv * 2) + 1] == xy[((iv - 1) * 2) + 1]);
+	  if (repeated)
+	      return 1;
+      }
+    return 0;
+}
+
+static int
+check_extent (const double *xy, int points, const double *extent,
+	      int current_row)
+{
+/*
+ * warning about the first vertex outside the Shapefile's extent
+ * returns 1 if a warning was printed
+*/
+    int iv;
+    if (extent == NULL)
+	return 0;
+    iv = find_outside_extent (xy, points, extent[0], extent[1], extent[2],
+			      extent[3]);
+    if (iv < 0)
+	return 0;
+    printf ("WARNING: coords outside shp-extent (entity #%d)\n",
+	    current_row + 1);
+    printf ("\tx=%1.6f y=%1.6f\n", xy[iv * 2], xy[(iv * 2) + 1]);
+    return 1;
+}
+
+static int
+check_polyline (const unsigned char *buf, struct shp_coords *coords,
+		const double *extent, int current_row, int endian_arch)
+{
+/*
+ * checking the parts of some polyline [already validated by check_parts]
+ * EXTENT is NULL when the extent check is disabled
+ * returns 1 if some invalid geometry was found
+*/
+    int n = gaiaImport32 (buf, GAIA_LITTLE_ENDIAN, endian_arch);
+    int n1 = gaiaImport32 (buf + 4, GAIA_LITTLE_ENDIAN, endian_arch);
+    const double *xy = decode_coords (coords, buf + 8 + (n * 4), n1,
+				      endian_arch);
+    int err_geo = 0;
+    int ind;
+    int start = 0;
+    int end;
+    int points;
+    for (ind = 0; ind < n; ind++)
+      {
+	  if (ind < (n - 1))
+	      end =
+		  gaiaImport32 (buf + 8 + ((ind + 1) * 4),
+				GAIA_LITTLE_ENDIAN, endian_arch);
+	  else
+	      end = n1;
+	  points = (end > start) ? end - start : 0;
+	  if (check_extent (xy + (start * 2), points, extent, current_row))
+	      extent = NULL;	/* warning only once per entity */
+	  if (points < 2)
+	    {
+		printf
+		    ("ERROR: illegal polyline [%d vertices] (entity #%d)\n",
+		     points, current_row + 1);
+		err_geo = 1;
+	    }
+	  if (has_repeated_vertices (xy + (start * 2), points))
+	    {
+		printf ("WARNING: repeated vertices (entity #%d)\n",
+			current_row + 1);
+		err_geo = 1;
+	    }
+	  start += points;
+      }
+    return err_geo;
+}
+
+static int
+check_polygon (const unsigned char *buf, struct shp_coords *coords,
+	       const double *extent, int current_row, int endian_arch)
+{
+/*
+ * checking the rings of some polygon [already validated by check_parts]
+ * EXTENT is NULL when the extent check is disabled
+ * returns 1 if some invalid geometry was found
+*/
+    int n = gaiaImport32 (buf, GAIA_LITTLE_ENDIAN, endian_arch);
+    int n1 = gaiaImport32 (buf + 4, GAIA_LITTLE_ENDIAN, endian_arch);
+    const double *xy = decode_coords (coords, buf + 8 + (n * 4), n1,
+				      endian_arch);
+    const double *ring;
+    int err_geo = 0;
+    int repeated = 0;
+    int ind;
+    int start = 0;
+    int end;
+    int points;
+    for (ind = 0; ind < n; ind++)
+      {
+	  if (ind < (n - 1))
+	      end =
+		  gaiaImport32 (buf + 8 + ((ind + 1) * 4),
+				GAIA_LITTLE_ENDIAN, endian_arch);
+	  else
+	      end = n1;
+	  points = (end > start) ? end - start : 0;
+	  ring = xy + (start * 2);
+	  if (check_extent (ring, points, extent, current_row))
+	      extent = NULL;	/* warning only once per entity */
+	  /* once found, repeated vertices are reported for any further ring */
+	  if (has_repeated_vertices (ring, points))
+	      repeated = 1;
+	  if (points < 3)
+	    {
+		printf
+		    ("ERROR: illegal ring [%d vertices] (entity #%d)\n",
+		     points, current_row + 1);
+		err_geo = 1;
+	    }
+	  else
+	    {
+		if (ring[0] == ring[(points - 1) * 2]
+		    && ring[1] == ring[((points - 1) * 2) + 1])
+		  {
+		      if (points < 4)
+			{
+			    printf
+				("ERROR: illegal ring [%d vertices] (entity #%d)\n",
+				 points, current_row + 1);
+			    err_geo = 1;
+			}
+		  }
+		else
+		  {
+		      printf ("WARNING: unclosed ring (entity #%d)\n",
+			      current_row + 1);
+		      err_geo = 1;
+		  }
+	    }
+	  if (repeated)
+	    {
+		printf ("WARNING: repeated vertices (entity #%d)\n",
+			current_row + 1);
+		err_geo = 1;
+	    }
+	  start += points;
+      }
+    return err_geo;
+}
+
+static void
+check_multipoint (const unsigned char *buf, struct shp_coords *coords,
+		  const double *extent, int current_row, int endian_arch)
+{
+/* checking the points of some multipoint [already validated] */
+    int n = gaiaImport32 (buf, GAIA_LITTLE_ENDIAN, endian_arch);
+    const double *xy = decode_coords (coords, buf + 4, n, endian_arch);
+    check_extent (xy, n, extent, current_row);
+}
+
 static void
 do_analyze (char *base_path, int ignore_shape, int ignore_extent)
 {
@@ -72,40 +397,32 @@ do_analyze (char *base_path, int ignore_shape, int ignore_extent)
     int shape;
     int x_shape;
     unsigned char bf[1024];
-    unsigned char *buf_dbf = NULL;
+    struct shp_reader reader;
+    int mapped = 0;
+    const unsigned char *record;
+    const unsigned char *buf;
+    int rec_len;
+    int buf_len;
     int dbf_size;
     int dbf_reclen = 0;
     int dbf_recno;
     int off_dbf;
     int current_row;
-    int skpos;
-    int offset;
-    int off_shp;
-    int sz;
+    size_t off_shp;
     int ind;
     double x;
     double y;
-    int points;
     int n;
-    int n1;
-    int base;
-    int start;
-    int end;
-    int iv;
-    double first_x;
-    double first_y;
-    double last_x;
-    double last_y;
-    int repeated;
     double shp_minx;
     double shp_miny;
     double shp_maxx;
     double shp_maxy;
+    double extent[4];
+    struct shp_coords coords;
     int err_dbf = 0;
     int err_geo = 0;
     char field_name[16];
     char *sys_err;
-    int first_coord_err;
     char *err_open = "ERROR: unable to open '%s' for reading: %s\n";
     char *err_header = "Invalid %s header\n";
     char *err_read = "ERROR: invalid read on %s (entity #%d)\n";
@@ -113,6 +430,8 @@ do_analyze (char *base_path, int ignore_shape, int ignore_extent)
 	"ERROR: invalid shape-type=%d [expected %d] (entity #%d)\n";
     char *null_shape = "WARNING: NULL shape (entity #%d)\n";
     int endian_arch = gaiaEndianArch ();
+    coords.xy = NULL;
+    coords.max_points = 0;
     printf ("\nshp_doctor\n\n");
     printf
 	("==================================================================\n");
@@ -219,6 +538,10 @@ do_analyze (char *base_path, int ignore_shape, int ignore_extent)
     shp_miny = gaiaImport64 (buf_shp + 44, GAIA_LITTLE_ENDIAN, endian_arch);
     shp_maxx = gaiaImport64 (buf_shp + 52, GAIA_LITTLE_ENDIAN, endian_arch);
     shp_maxy = gaiaImport64 (buf_shp + 60, GAIA_LITTLE_ENDIAN, endian_arch);
+    extent[0] = shp_minx;
+    extent[1] = shp_miny;
+    extent[2] = shp_maxx;
+    extent[3] = shp_maxy;
     if (!ignore_extent)
       {
 	  printf ("shape-extent:\tMIN(x=%1.6f y=%1.6f)\n", shp_minx, shp_miny);
@@ -301,8 +624,13 @@ do_analyze (char *base_path, int ignore_shape, int ignore_extent)
 	    };
 	  off_dbf += *(bf + 16);
       }
-    buf_dbf = malloc (sizeof (unsigned char) * dbf_reclen);
-    buf_shp = malloc (sizeof (unsigned char) * buf_size);
+    if (!shp_reader_open
+	(&reader, fl_shx, fl_shp, fl_dbf, dbf_size + 1, dbf_reclen))
+      {
+	  printf ("ERROR: unable to map the Shapefile into memory\n");
+	  goto error;
+      }
+    mapped = 1;
     printf ("\nTesting SHP entities:\n");
     printf ("========================================\n");
     current_row = 0;
@@ -310,45 +638,23 @@ do_analyze (char *base_path, int ignore_shape, int ignore_extent)
       {
 	  /* reading entities from shapefile */
 
-	  /* positioning and reading the SHX file */
-	  offset = 100 + (current_row * 8);	/* 100 bytes for the header + current row displacement; each SHX row = 8 bytes */
-	  skpos = fseek (fl_shx, offset, SEEK_SET);
-	  if (skpos != 0)
+	  /* fetching the SHX index entry */
+	  if (!shp_reader_shx_offset (&reader, current_row, &off_shp))
 	      goto eof;
-	  rd = fread (bf, sizeof (unsigned char), 8, fl_shx);
-	  if (rd != 8)
-	      goto eof;
-	  off_shp = gaiaImport32 (bf, GAIA_BIG_ENDIAN, endian_arch);
-	  /* positioning and reading the DBF file */
-	  offset = dbf_size + (current_row * dbf_reclen);
-	  skpos = fseek (fl_dbf, offset, SEEK_SET);
-	  if (skpos != 0)
+	  /* fetching the DBF record */
+	  if (shp_reader_dbf_record (&reader, current_row) == NULL)
 	    {
 		printf (err_read, "DBF", current_row + 1);
 		goto error;
 	    }
-	  rd = fread (buf_dbf, sizeof (unsigned char), dbf_reclen, fl_dbf);
-	  if (rd != dbf_reclen)
-	    {
-		printf (err_read, "DBF", current_row + 1);
-		goto error;
-	    }
-	  /* positioning and reading corresponding SHP entity - geometry */
-	  offset = off_shp * 2;
-	  skpos = fseek (fl_shp, offset, SEEK_SET);
-	  if (skpos != 0)
+	  /* fetching the corresponding SHP entity - geometry */
+	  if (!shp_reader_record (&reader, off_shp, &record, &rec_len)
+	      || rec_len < 4)
 	    {
 		printf (err_read, "SHP", current_row + 1);
 		goto error;
 	    }
-	  rd = fread (buf_shp, sizeof (unsigned char), 12, fl_shp);
-	  if (rd != 12)
-	    {
-		printf (err_read, "SHP", current_row + 1);
-		goto error;
-	    }
-	  sz = gaiaImport32 (buf_shp + 4, GAIA_BIG_ENDIAN, endian_arch);
-	  shape = gaiaImport32 (buf_shp + 8, GAIA_LITTLE_ENDIAN, endian_arch);
+	  shape = gaiaImport32 (record, GAIA_LITTLE_ENDIAN, endian_arch);
 	  if (ignore_shape)
 	      shape = x_shape;
 	  if (shape != x_shape)
@@ -361,25 +667,20 @@ do_analyze (char *base_path, int ignore_shape, int ignore_extent)
 		      err_geo = 1;
 		  }
 	    }
-	  if ((sz * 2) > buf_size)
-	    {
-		/* current buffer is too small; we need to allocate a bigger buffer */
-		free (buf_shp);
-		buf_size = sz * 2;
-		buf_shp = malloc (sizeof (unsigned char) * buf_size);
-	    }
+	  /* skipping the shape-type and the BBOX */
+	  buf = record + 36;
+	  buf_len = rec_len - 36;
 	  if (shape == GAIA_SHP_POINT || shape == GAIA_SHP_POINTZ
 	      || shape == GAIA_SHP_POINTM)
 	    {
 		/* shape point */
-		rd = fread (buf_shp, sizeof (unsigned char), 16, fl_shp);
-		if (rd != 16)
+		if (rec_len < 20)
 		  {
 		      printf (err_read, "SHP point-entity", current_row + 1);
 		      goto error;
 		  }
-		x = gaiaImport64 (buf_shp, GAIA_LITTLE_ENDIAN, endian_arch);
-		y = gaiaImport64 (buf_shp + 8, GAIA_LITTLE_ENDIAN, endian_arch);
+		x = gaiaImport64 (record + 4, GAIA_LITTLE_ENDIAN, endian_arch);
+		y = gaiaImport64 (record + 12, GAIA_LITTLE_ENDIAN, endian_arch);
 		if (!ignore_extent)
 		  {
 		      if (x < shp_minx || x > shp_maxx || y < shp_miny
@@ -396,221 +697,49 @@ do_analyze (char *base_path, int ignore_shape, int ignore_extent)
 	      || shape == GAIA_SHP_POLYLINEM)
 	    {
 		/* shape polyline */
-		rd = fread (buf_shp, sizeof (unsigned char), 32, fl_shp);
-		if (rd != 32)
-		  {
-		      printf (err_read, "SHP polyline-entity", current_row + 1);
-		      goto error;
-		  }
-		rd = fread (buf_shp, sizeof (unsigned char), (sz * 2) - 36,
-			    fl_shp);
-		if (rd != (sz * 2) - 36)
+		if (!check_parts (buf, buf_len, endian_arch))
 		  {
 		      printf (err_read, "SHP polyline-entity", current_row + 1);
 		      goto error;
 		  }
-		n = gaiaImport32 (buf_shp, GAIA_LITTLE_ENDIAN, endian_arch);
-		n1 = gaiaImport32 (buf_shp + 4, GAIA_LITTLE_ENDIAN,
-				   endian_arch);
-		base = 8 + (n * 4);
-		start = 0;
-		first_coord_err = 1;
-		for (ind = 0; ind < n; ind++)
-		  {
-		      if (ind < (n - 1))
-			  end =
-			      gaiaImport32 (buf_shp + 8 + ((ind + 1) * 4),
-					    GAIA_LITTLE_ENDIAN, endian_arch);
-		      else
-			  end = n1;
-		      points = end - start;
-		      points = 0;
-		      repeated = 0;
-		      for (iv = start; iv < end; iv++)
-			{
-			    x = gaiaImport64 (buf_shp + base + (iv * 16),
-					      GAIA_LITTLE_ENDIAN, endian_arch);
-			    y = gaiaImport64 (buf_shp + base + (iv * 16) + 8,
-					      GAIA_LITTLE_ENDIAN, endian_arch);
-			    if (points != 0)
-			      {
-				  if (last_x == x && last_y == y)
-				      repeated = 1;
-			      }
-			    last_x = x;
-			    last_y = y;
-			    if (!ignore_extent && first_coord_err)
-			      {
-				  if (x < shp_minx || x > shp_maxx
-				      || y < shp_miny || y > shp_maxy)
-				    {
-					printf
-					    ("WARNING: coords outside shp-extent (entity #%d)\n",
-					     current_row + 1);
-					printf ("\tx=%1.6f y=%1.6f\n", x, y);
-					first_coord_err = 0;
-				    }
-			      }
-			    start++;
-			    points++;
-			}
-		      if (points < 2)
-			{
-			    printf
-				("ERROR: illegal polyline [%d vertices] (entity #%d)\n",
-				 points, current_row + 1);
-			    err_geo = 1;
-			}
-		      if (repeated)
-			{
-			    printf ("WARNING: repeated vertices (entity #%d)\n",
-				    current_row + 1);
-			    err_geo = 1;
-			}
-		  }
+		if (check_polyline
+		    (buf, &coords, ignore_extent ? NULL : extent, current_row,
+		     endian_arch))
+		    err_geo = 1;
 	    }
 	  if (shape == GAIA_SHP_POLYGON || shape == GAIA_SHP_POLYGONZ
 	      || shape == GAIA_SHP_POLYGONM)
 	    {
 		/* shape polygon */
-		rd = fread (buf_shp, sizeof (unsigned char), 32, fl_shp);
-		if (rd != 32)
-		  {
-		      printf (err_read, "SHP polygon-entity", current_row + 1);
-		      goto error;
-		  }
-		rd = fread (buf_shp, sizeof (unsigned char), (sz * 2) - 36,
-			    fl_shp);
-		if (rd != (sz * 2) - 36)
+		if (!check_parts (buf, buf_len, endian_arch))
 		  {
 		      printf (err_read, "SHP polygon-entity", current_row + 1);
 		      goto error;
 		  }
-		n = gaiaImport32 (buf_shp, GAIA_LITTLE_ENDIAN, endian_arch);
-		n1 = gaiaImport32 (buf_shp + 4, GAIA_LITTLE_ENDIAN,
-				   endian_arch);
-		base = 8 + (n * 4);
-		start = 0;
-		first_coord_err = 1;
-		repeated = 0;
-		for (ind = 0; ind < n; ind++)
-		  {
-		      if (ind < (n - 1))
-			  end =
-			      gaiaImport32 (buf_shp + 8 + ((ind + 1) * 4),
-					    GAIA_LITTLE_ENDIAN, endian_arch);
-		      else
-			  end = n1;
-		      points = end - start;
-		      points = 0;
-		      for (iv = start; iv < end; iv++)
-			{
-			    x = gaiaImport64 (buf_shp + base + (iv * 16),
-					      GAIA_LITTLE_ENDIAN, endian_arch);
-			    y = gaiaImport64 (buf_shp + base + (iv * 16) + 8,
-					      GAIA_LITTLE_ENDIAN, endian_arch);
-			    if (points == 0)
-			      {
-				  first_x = x;
-				  first_y = y;
-			      }
-			    else
-			      {
-				  if (last_x == x && last_y == y)
-				      repeated = 1;
-			      }
-			    last_x = x;
-			    last_y = y;
-			    if (!ignore_extent && first_coord_err)
-			      {
-				  if (x < shp_minx || x > shp_maxx
-				      || y < shp_miny || y > shp_maxy)
-				    {
-					printf
-					    ("WARNING: coords outside shp-extent (entity #%d)\n",
-					     current_row + 1);
-					printf ("\tx=%1.6f y=%1.6f\n", x, y);
-					first_coord_err = 0;
-				    }
-			      }
-			    start++;
-			    points++;
-			}
-		      if (points < 3)
-			{
-			    printf
-				("ERROR: illegal ring [%d vertices] (entity #%d)\n",
-				 points, current_row + 1);
-			    err_geo = 1;
-			}
-		      else
-			{
-			    if (first_x == last_x && first_y == last_y)
-			      {
-				  if (points < 4)
-				    {
-					printf
-					    ("ERROR: illegal ring [%d vertices] (entity #%d)\n",
-					     points, current_row + 1);
-					err_geo = 1;
-				    }
-			      }
-			    else
-			      {
-				  printf
-				      ("WARNING: unclosed ring (entity #%d)\n",
-				       current_row + 1);
-				  err_geo = 1;
-			      }
-			}
-		      if (repeated)
-			{
-			    printf ("WARNING: repeated vertices (entity #%d)\n",
-				    current_row + 1);
-			    err_geo = 1;
-			}
-		  }
+		if (check_polygon
+		    (buf, &coords, ignore_extent ? NULL : extent, current_row,
+		     endian_arch))
+		    err_geo = 1;
 	    }
 	  if (shape == GAIA_SHP_MULTIPOINT || shape == GAIA_SHP_MULTIPOINTZ
 	      || shape == GAIA_SHP_MULTIPOINTM)
 	    {
 		/* shape multipoint */
-		rd = fread (buf_shp, sizeof (unsigned char), 32, fl_shp);
-		if (rd != 32)
+		if (buf_len < 4)
 		  {
 		      printf (err_read, "SHP multipoint-entity",
 			      current_row + 1);
 		      goto error;
 		  }
-		rd = fread (buf_shp, sizeof (unsigned char), (sz * 2) - 36,
-			    fl_shp);
-		if (rd != (sz * 2) - 36)
+		n = gaiaImport32 (buf, GAIA_LITTLE_ENDIAN, endian_arch);
+		if (n < 0 || (4 + ((double) n * 16.0)) > (double) buf_len)
 		  {
 		      printf (err_read, "SHP multipoint-entity",
 			      current_row + 1);
 		      goto error;
 		  }
-		n = gaiaImport32 (buf_shp, GAIA_LITTLE_ENDIAN, endian_arch);
-		first_coord_err = 1;
-		for (iv = 0; iv < n; iv++)
-		  {
-		      x = gaiaImport64 (buf_shp + 4 + (iv * 16),
-					GAIA_LITTLE_ENDIAN, endian_arch);
-		      y = gaiaImport64 (buf_shp + 4 + (iv * 16) + 8,
-					GAIA_LITTLE_ENDIAN, endian_arch);
-		      if (!ignore_extent && first_coord_err)
-			{
-			    if (x < shp_minx || x > shp_maxx || y < shp_miny
-				|| y > shp_maxy)
-			      {
-				  printf
-				      ("WARNING: coords outside shp-extent (entity #%d)\n",
-				       current_row + 1);
-				  printf ("\tx=%1.6f y=%1.6f\n", x, y);
-				  first_coord_err = 0;
-			      }
-			}
-		  }
+		check_multipoint (buf, &coords, ignore_extent ? NULL : extent,
+				  current_row, endian_arch);
 	    }
 	  current_row++;
       }
@@ -633,16 +762,17 @@ do_analyze (char *base_path, int ignore_shape, int ignore_extent)
       }
     if (!err_dbf && !err_geo)
 	printf ("\nValidation passed: no problem found\n");
+    shp_reader_close (&reader);
     if (fl_shx)
 	fclose (fl_shx);
     if (fl_shp)
 	fclose (fl_shp);
     if (fl_dbf)
 	fclose (fl_dbf);
-    if (buf_dbf)
-	free (buf_dbf);
     if (buf_shp)
 	free (buf_shp);
+    if (coords.xy != NULL)
+	free (coords.xy);
     return;
   no_file:
 /* one of shapefile's files can't be accessed */
@@ -653,37 +783,35 @@ do_analyze (char *base_path, int ignore_shape, int ignore_extent)
 	fclose (fl_shp);
     if (fl_dbf)
 	fclose (fl_dbf);
-    if (buf_dbf)
-	free (buf_dbf);
     if (buf_shp)
 	free (buf_shp);
+    if (coords.xy != NULL)
+	free (coords.xy);
     return;
   error:
 /* the shapefile is invalid or corrupted */
     printf ("\nThis Shapefile is corrupted / has an invalid format");
-    if (buf_shp)
-	free (buf_shp);
+    if (mapped)
+	shp_reader_close (&reader);
     fclose (fl_shx);
     fclose (fl_shp);
     fclose (fl_dbf);
-    if (buf_dbf)
-	free (buf_dbf);
     if (buf_shp)
 	free (buf_shp);
+    if (coords.xy != NULL)
+	free (coords.xy);
     return;
   unsupported:
 /* the shapefile has an unrecognized shape type */
     printf ("\nshape-type=%d is not supported", shape);
-    if (buf_shp)
-	free (buf_shp);
     fclose (fl_shx);
     fclose (fl_shp);
     if (fl_dbf)
 	fclose (fl_dbf);
-    if (buf_dbf)
-	free (buf_dbf);
     if (buf_shp)
 	free (buf_shp);
+    if (coords.xy != NULL)
+	free (coords.xy);
     return;
 }
 
@@ -713,26 +841,16 @@ do_analyze_no_shx (char *base_path, int ignore_shape, int ignore_extent)
     int ind;
     double x;
     double y;
-    int points;
     int n;
-    int n1;
-    int base;
-    int start;
-    int end;
-    int iv;
-    double first_x;
-    double first_y;
-    double last_x;
-    double last_y;
-    int repeated;
     double shp_minx;
     double shp_miny;
     double shp_maxx;
     double shp_maxy;
+    double extent[4];
+    struct shp_coords coords;
     int err_dbf = 0;
     int err_geo = 0;
     char field_name[16];
-    int first_coord_err;
     char *sys_err;
     char *err_open = "ERROR: unable to open '%s' for reading: %s\n";
     char *err_header = "Invalid %s header\n";
@@ -741,6 +859,8 @@ do_analyze_no_shx (char *base_path, int ignore_shape, int ignore_extent)
 	"ERROR: invalid shape-type=%d [expected %d] (entity #%d)\n";
     char *null_shape = "WARNING: NULL shape (entity #%d)\n";
     int endian_arch = gaiaEndianArch ();
+    coords.xy = NULL;
+    coords.max_points = 0;
     printf ("\nshp_doctor\n\n");
     printf
 	("==================================================================\n");
@@ -829,6 +949,10 @@ do_analyze_no_shx (char *base_path, int ignore_shape, int ignore_extent)
     shp_miny = gaiaImport64 (buf_shp + 44, GAIA_LITTLE_ENDIAN, endian_arch);
     shp_maxx = gaiaImport64 (buf_shp + 52, GAIA_LITTLE_ENDIAN, endian_arch);
     shp_maxy = gaiaImport64 (buf_shp + 60, GAIA_LITTLE_ENDIAN, endian_arch);
+    extent[0] = shp_minx;
+    extent[1] = shp_miny;
+    extent[2] = shp_maxx;
+    extent[3] = shp_maxy;
     if (!ignore_extent)
       {
 	  printf ("shape-extent:\tMIN(x=%1.6f y=%1.6f)\n", shp_minx, shp_miny);
@@ -1008,70 +1132,16 @@ do_analyze_no_shx (char *base_path, int ignore_shape, int ignore_extent)
 		  }
 		rd = fread (buf_shp, sizeof (unsigned char), (sz * 2) - 36,
 			    fl_shp);
-		if (rd != (sz * 2) - 36)
+		if (rd != (sz * 2) - 36
+		    || !check_parts (buf_shp, (sz * 2) - 36, endian_arch))
 		  {
 		      printf (err_read, "SHP polyline-entity", current_row + 1);
 		      goto error;
 		  }
-		n = gaiaImport32 (buf_shp, GAIA_LITTLE_ENDIAN, endian_arch);
-		n1 = gaiaImport32 (buf_shp + 4, GAIA_LITTLE_ENDIAN,
-				   endian_arch);
-		base = 8 + (n * 4);
-		start = 0;
-		first_coord_err = 1;
-		for (ind = 0; ind < n; ind++)
-		  {
-		      if (ind < (n - 1))
-			  end =
-			      gaiaImport32 (buf_shp + 8 + ((ind + 1) * 4),
-					    GAIA_LITTLE_ENDIAN, endian_arch);
-		      else
-			  end = n1;
-		      points = end - start;
-		      points = 0;
-		      repeated = 0;
-		      for (iv = start; iv < end; iv++)
-			{
-			    x = gaiaImport64 (buf_shp + base + (iv * 16),
-					      GAIA_LITTLE_ENDIAN, endian_arch);
-			    y = gaiaImport64 (buf_shp + base + (iv * 16) + 8,
-					      GAIA_LITTLE_ENDIAN, endian_arch);
-			    if (points != 0)
-			      {
-				  if (last_x == x && last_y == y)
-				      repeated = 1;
-			      }
-			    last_x = x;
-			    last_y = y;
-			    if (!ignore_extent && first_coord_err)
-			      {
-				  if (x < shp_minx || x > shp_maxx
-				      || y < shp_miny || y > shp_maxy)
-				    {
-					printf
-					    ("WARNING: coords outside shp-extent (entity #%d)\n",
-					     current_row + 1);
-					printf ("\tx=%1.6f y=%1.6f\n", x, y);
-					first_coord_err = 0;
-				    }
-			      }
-			    start++;
-			    points++;
-			}
-		      if (points < 2)
-			{
-			    printf
-				("ERROR: illegal polyline [%d vertices] (entity #%d)\n",
-				 points, current_row + 1);
-			    err_geo = 1;
-			}
-		      if (repeated)
-			{
-			    printf ("WARNING: repeated vertices (entity #%d)\n",
-				    current_row + 1);
-			    err_geo = 1;
-			}
-		  }
+		if (check_polyline
+		    (buf_shp, &coords, ignore_extent ? NULL : extent, current_row,
+		     endian_arch))
+		    err_geo = 1;
 	    }
 	  if (shape == GAIA_SHP_POLYGON || shape == GAIA_SHP_POLYGONZ
 	      || shape == GAIA_SHP_POLYGONM)
@@ -1085,102 +1155,23 @@ do_analyze_no_shx (char *base_path, int ignore_shape, int ignore_extent)
 		  }
 		rd = fread (buf_shp, sizeof (unsigned char), (sz * 2) - 36,
 			    fl_shp);
-		if (rd != (sz * 2) - 36)
+		if (rd != (sz * 2) - 36
+		    || !check_parts (buf_shp, (sz * 2) - 36, endian_arch))
 		  {
 		      printf (err_read, "SHP polygon-entity", current_row + 1);
 		      goto error;
 		  }
-		n = gaiaImport32 (buf_shp, GAIA_LITTLE_ENDIAN, endian_arch);
-		n1 = gaiaImport32 (buf_shp + 4, GAIA_LITTLE_ENDIAN,
-				   endian_arch);
-		base = 8 + (n * 4);
-		start = 0;
-		first_coord_err = 1;
-		repeated = 0;
-		for (ind = 0; ind < n; ind++)
-		  {
-		      if (ind < (n - 1))
-			  end =
-			      gaiaImport32 (buf_shp + 8 + ((ind + 1) * 4),
-					    GAIA_LITTLE_ENDIAN, endian_arch);
-		      else
-			  end = n1;
-		      points = end - start;
-		      points = 0;
-		      for (iv = start; iv < end; iv++)
-			{
-			    x = gaiaImport64 (buf_shp + base + (iv * 16),
-					      GAIA_LITTLE_ENDIAN, endian_arch);
-			    y = gaiaImport64 (buf_shp + base + (iv * 16) + 8,
-					      GAIA_LITTLE_ENDIAN, endian_arch);
-			    if (points == 0)
-			      {
-				  first_x = x;
-				  first_y = y;
-			      }
-			    else
-			      {
-				  if (last_x == x && last_y == y)
-				      repeated = 1;
-			      }
-			    last_x = x;
-			    last_y = y;
-			    if (!ignore_extent && first_coord_err)
-			      {
-				  if (x < shp_minx || x > shp_maxx
-				      || y < shp_miny || y > shp_maxy)
-				    {
-					printf
-					    ("WARNING: coords outside shp-extent (entity #%d)\n",
-					     current_row + 1);
-					printf ("\tx=%1.6f y=%1.6f\n", x, y);
-					first_coord_err = 0;
-				    }
-			      }
-			    start++;
-			    points++;
-			}
-		      if (points < 3)
-			{
-			    printf
-				("ERROR: illegal ring [%d vertices] (entity #%d)\n",
-				 points, current_row + 1);
-			    err_geo = 1;
-			}
-		      else
-			{
-			    if (first_x == last_x && first_y == last_y)
-			      {
-				  if (points < 4)
-				    {
-					printf
-					    ("ERROR: illegal ring [%d vertices] (entity #%d)\n",
-					     points, current_row + 1);
-					err_geo = 1;
-				    }
-			      }
-			    else
-			      {
-				  printf
-				      ("WARNING: unclosed ring (entity #%d)\n",
-				       current_row + 1);
-				  err_geo = 1;
-			      }
-			}
-		      if (repeated)
-			{
-			    printf ("WARNING: repeated vertices (entity #%d)\n",
-				    current_row + 1);
-			    err_geo = 1;
-			}
-		  }
-	    }
-	  if (shape == GAIA_SHP_MULTIPOINT || shape == GAIA_SHP_MULTIPOINTZ
-	      || shape == GAIA_SHP_MULTIPOINTM)
-	    {
-		/* shape multipoint */
-		rd = fread (buf_shp, sizeof (unsigned char), 32, fl_shp);
-		if (rd != 32)
+		if (check_polygon
+		    (buf_shp, &coords, ignore_extent ? NULL : extent, current_row,
+		     endian_arch))
+		    err_geo = 1;
+	    }
+	  if (shape == GAIA_SHP_MULTIPOINT || shape == GAIA_SHP_MULTIPOINTZ
+	      || shape == GAIA_SHP_MULTIPOINTM)
+	    {
+		/* shape multipoint */
+		rd = fread (buf_shp, sizeof (unsigned char), 32, fl_shp);
+		if (rd != 32)
 		  {
 		      printf (err_read, "SHP multipoint-entity",
 			      current_row + 1);
@@ -1195,26 +1186,14 @@ do_analyze_no_shx (char *base_path, int ignore_shape, int ignore_extent)
 		      goto error;
 		  }
 		n = gaiaImport32 (buf_shp, GAIA_LITTLE_ENDIAN, endian_arch);
-		first_coord_err = 1;
-		for (iv = 0; iv < n; iv++)
+		if (n < 0 || (4 + ((double) n * 16.0)) > (double) ((sz * 2) - 36))
 		  {
-		      x = gaiaImport64 (buf_shp + 4 + (iv * 16),
-					GAIA_LITTLE_ENDIAN, endian_arch);
-		      y = gaiaImport64 (buf_shp + 4 + (iv * 16) + 8,
-					GAIA_LITTLE_ENDIAN, endian_arch);
-		      if (!ignore_extent && first_coord_err)
-			{
-			    if (x < shp_minx || x > shp_maxx || y < shp_miny
-				|| y > shp_maxy)
-			      {
-				  printf
-				      ("WARNING: coords outside shp-extent (entity #%d)\n",
-				       current_row + 1);
-				  printf ("\tx=%1.6f y=%1.6f\n", x, y);
-				  first_coord_err = 0;
-			      }
-			}
+		      printf (err_read, "SHP multipoint-entity",
+			      current_row + 1);
+		      goto error;
 		  }
+		check_multipoint (buf_shp, &coords, ignore_extent ? NULL : extent,
+				  current_row, endian_arch);
 	    }
 	  current_row++;
       }
@@ -1245,6 +1224,8 @@ do_analyze_no_shx (char *base_path, int ignore_shape, int ignore_extent)
 	free (buf_dbf);
     if (buf_shp)
 	free (buf_shp);
+    if (coords.xy != NULL)
+	free (coords.xy);
     return;
   no_file:
 /* one of shapefile's files can't be accessed */
@@ -1257,6 +1238,8 @@ do_analyze_no_shx (char *base_path, int ignore_shape, int ignore_extent)
 	free (buf_dbf);
     if (buf_shp)
 	free (buf_shp);
+    if (coords.xy != NULL)
+	free (coords.xy);
     return;
   error:
 /* the shapefile is invalid or corrupted */
@@ -1269,6 +1252,8 @@ do_analyze_no_shx (char *base_path, int ignore_shape, int ignore_extent)
 	free (buf_dbf);
     if (buf_shp)
 	free (buf_shp);
+    if (coords.xy != NULL)
+	free (coords.xy);
     return;
   unsupported:
 /* the shapefile has an unrecognized shape type */
@@ -1283,25 +1268,530 @@ do_analyze_no_shx (char *base_path, int ignore_shape, int ignore_extent)
 	free (buf_dbf);
     if (buf_shp)
 	free (buf_shp);
+    if (coords.xy != NULL)
+	free (coords.xy);
     return;
 }
 
+#define DBF_CHUNK_ROWS	4096
+
+struct dbf_field
+{
+/* a DBF field definition */
+    char name[12];
+    char type;
+    int offset;			/* from the record start [deletion flag included] */
+    int length;
+    int decimals;
+};
+
+struct dbf_field_stats
+{
+/* per-field statistics collected while scanning the DBF rows */
+    sqlite3_int64 blanks;
+    sqlite3_int64 failures;
+    int first_failure;		/* row number, -1 if none */
+    int max_width;
+};
+
+struct dbf_charset_stats
+{
+/* byte statistics collected on CHARACTER fields [charset sniffing] */
+    sqlite3_int64 ascii;
+    sqlite3_int64 high;
+    sqlite3_int64 utf8_valid;
+    sqlite3_int64 utf8_invalid;
+    sqlite3_int64 c1_controls;	/* 0x80-0x9F */
+    sqlite3_int64 cp1252_undefined;	/* 0x81, 0x8D, 0x8F, 0x90, 0x9D */
+    sqlite3_int64 box_drawing;	/* DOS graphics in 0xB0-0xDF */
+    sqlite3_int64 lower_half;	/* 0x80-0xAF */
+    sqlite3_int64 upper_half;	/* 0xC0-0xFF */
+    sqlite3_int64 high_runs;	/* high bytes following another high byte */
+};
+
+struct dbf_chunk
+{
+/* a range of [at most DBF_CHUNK_ROWS] DBF rows */
+    const unsigned char *records;
+    int reclen;
+    int first_row;
+    int count_rows;
+    const struct dbf_field *fields;
+    int count_fields;
+    int deleted;
+    struct dbf_field_stats *stats;
+    struct dbf_charset_stats charset;
+};
+
+struct dbf_chunk_queue
+{
+/* the chunks still to be scanned, handed out in row order */
+    struct dbf_chunk *chunks;
+    int count_chunks;
+    int next;
+#ifndef _WIN32
+    pthread_mutex_t mutex;
+#endif
+};
+
+static int
+is_dbf_blank (const unsigned char *p, int len)
+{
+/* checking for an empty value [spaces or NUL bytes only] */
+    int i;
+    for (i = 0; i < len; i++)
+      {
+	  if (p[i] != ' ' && p[i] != '\0')
+	      return 0;
+      }
+    return 1;
+}
+
+static int
+is_dbf_number (const unsigned char *p, int len, int exponent)
+{
+/*
+ * checking for a well-formed DBF number [already trimmed]:
+ * optional sign, digits, optional decimal point and digits,
+ * and an optional exponent for FLOAT fields
+*/
+    int i = 0;
+    int digits = 0;
+    if (i < len && (p[i] == '-' || p[i] == '+'))
+	i++;
+    while (i < len && p[i] >= '0' && p[i] <= '9')
+      {
+	  i++;
+	  digits++;
+      }
+    if (i < len && p[i] == '.')
+      {
+	  i++;
+	  while (i < len && p[i] >= '0' && p[i] <= '9')
+	    {
+		i++;
+		digits++;
+	    }
+      }
+    if (digits == 0)
+	return 0;
+    if (exponent && i < len && (p[i] == 'e' || p[i] == 'E'))
+      {
+	  i++;
+	  if (i < len && (p[i] == '-' || p[i] == '+'))
+	      i++;
+	  digits = 0;
+	  while (i < len && p[i] >= '0' && p[i] <= '9')
+	    {
+		i++;
+		digits++;
+	    }
+	  if (digits == 0)
+	      return 0;
+      }
+    return (i == len) ? 1 : 0;
+}
+
+static int
+is_dbf_value_valid (const struct dbf_field *fld, const unsigned char *p,
+		    int len)
+{
+/* checking a (not blank, already trimmed) value against the field type */
+    int i;
+    switch (fld->type)
+      {
+      case 'N':
+	  return is_dbf_number (p, len, 0);
+      case 'F':
+	  return is_dbf_number (p, len, 1);
+      case 'L':
+	  if (len != 1)
+	      return 0;
+	  return (strchr ("YyNnTtFf?", *p) != NULL) ? 1 : 0;
+      case 'D':
+	  if (len != 8)
+	      return 0;
+	  for (i = 0; i < 8; i++)
+	    {
+		if (p[i] < '0' || p[i] > '9')
+		    return 0;
+	    }
+	  return 1;
+      };
+    return 1;
+}
+
 static void
-do_analyze_dbf (char *base_path)
+sniff_charset (struct dbf_charset_stats *cs, const unsigned char *p, int len)
+{
+/* collecting byte statistics on some text value */
+    int i = 0;
+    int prev_high = 0;
+    int pending = 0;		/* UTF-8 continuation bytes still expected */
+    unsigned char c;
+    while (i < len)
+      {
+	  if (pending == 0 && i + 8 <= len)
+	    {
+		/* fast path: eight ASCII bytes at once */
+		uint64_t word;
+		memcpy (&word, p + i, 8);
+		if ((word & 0x8080808080808080ULL) == 0)
+		  {
+		      cs->ascii += 8;
+		      prev_high = 0;
+		      i += 8;
+		      continue;
+		  }
+	    }
+	  c = p[i++];
+	  if (c < 0x80)
+	    {
+		if (pending)
+		    cs->utf8_invalid++;
+		pending = 0;
+		cs->ascii++;
+		prev_high = 0;
+		continue;
+	    }
+	  /* single-byte code page plausibility */
+	  cs->high++;
+	  if (prev_high)
+	      cs->high_runs++;
+	  prev_high = 1;
+	  if (c <= 0x9F)
+	    {
+		cs->c1_controls++;
+		if (c == 0x81 || c == 0x8D || c == 0x8F || c == 0x90
+		    || c == 0x9D)
+		    cs->cp1252_undefined++;
+	    }
+	  if (c <= 0xAF)
+	      cs->lower_half++;
+	  if (c >= 0xC0)
+	      cs->upper_half++;
+	  if ((c >= 0xB0 && c <= 0xB4) || (c >= 0xB9 && c <= 0xBC)
+	      || (c >= 0xBF && c <= 0xC5) || (c >= 0xC8 && c <= 0xCE)
+	      || (c >= 0xD9 && c <= 0xDC) || c == 0xDF)
+	      cs->box_drawing++;
+	  /* UTF-8 well-formedness */
+	  if (pending)
+	    {
+		if ((c & 0xC0) == 0x80)
+		  {
+		      pending--;
+		      if (pending == 0)
+			  cs->utf8_valid++;
+		      continue;
+		  }
+		/* a truncated sequence: C could start a new one */
+		cs->utf8_invalid++;
+		pending = 0;
+	    }
+	  if (c >= 0xC2 && c <= 0xDF)
+	      pending = 1;
+	  else if (c >= 0xE0 && c <= 0xEF)
+	      pending = 2;
+	  else if (c >= 0xF0 && c <= 0xF4)
+	      pending = 3;
+	  else
+	      cs->utf8_invalid++;
+      }
+    if (pending)
+	cs->utf8_invalid++;
+}
+
+static void
+scan_dbf_chunk (struct dbf_chunk *chunk)
+{
+/* scanning a range of DBF rows */
+    int row;
+    int ifld;
+    for (row = 0; row < chunk->count_rows; row++)
+      {
+	  const unsigned char *rec =
+	      chunk->records + ((size_t) row * chunk->reclen);
+	  if (*rec == '*')
+	    {
+		/* deleted rows are ignored */
+		chunk->deleted++;
+		continue;
+	    }
+	  for (ifld = 0; ifld < chunk->count_fields; ifld++)
+	    {
+		const struct dbf_field *fld = chunk->fields + ifld;
+		struct dbf_field_stats *st = chunk->stats + ifld;
+		const unsigned char *p = rec + fld->offset;
+		int len = fld->length;
+		if (is_dbf_blank (p, len))
+		  {
+		      st->blanks++;
+		      continue;
+		  }
+		/* trimming */
+		while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\0'))
+		    len--;
+		if (fld->type != 'C')
+		  {
+		      while (len > 0 && *p == ' ')
+			{
+			    p++;
+			    len--;
+			}
+		  }
+		if (len > st->max_width)
+		    st->max_width = len;
+		if (fld->type == 'C')
+		    sniff_charset (&(chunk->charset), p, len);
+		else if (!is_dbf_value_valid (fld, p, len))
+		  {
+		      if (st->failures == 0)
+			  st->first_failure = chunk->first_row + row;
+		      st->failures++;
+		  }
+	    }
+      }
+}
+
+static void *
+dbf_chunk_worker (void *arg)
+{
+/* thread entry point: scanning chunks until the queue is empty */
+    struct dbf_chunk_queue *queue = (struct dbf_chunk_queue *) arg;
+    int ic;
+    while (1)
+      {
+#ifndef _WIN32
+	  pthread_mutex_lock (&(queue->mutex));
+#endif
+	  ic = queue->next;
+	  if (ic < queue->count_chunks)
+	      queue->next += 1;
+#ifndef _WIN32
+	  pthread_mutex_unlock (&(queue->mutex));
+#endif
+	  if (ic >= queue->count_chunks)
+	      break;
+	  scan_dbf_chunk (queue->chunks + ic);
+      }
+    return NULL;
+}
+
+static void
+scan_dbf_rows (const unsigned char *records, int reclen, int count_rows,
+	       const struct dbf_field *fields, int count_fields, int threads,
+	       int *deleted, struct dbf_field_stats *stats,
+	       struct dbf_charset_stats *charset)
+{
+/*
+ * scanning all DBF rows
+ *
+ * records are fixed-length, so the rows are split into chunks of
+ * DBF_CHUNK_ROWS contiguous rows; the threads take the next chunk
+ * from a shared queue as soon as they are done with the previous
+ * one, so a slow range of rows doesn't hold up the others.
+ * The partial statistics are then merged in row order
+*/
+    struct dbf_chunk *chunks;
+    struct dbf_chunk_queue queue;
+    int count_chunks;
+    int ic;
+    int ifld;
+#ifndef _WIN32
+    pthread_t *tids;
+    int count_threads;
+    int it;
+#endif
+
+    if (threads < 1)
+	threads = 1;
+    count_chunks = (count_rows + DBF_CHUNK_ROWS - 1) / DBF_CHUNK_ROWS;
+    if (count_chunks < 1)
+	count_chunks = 1;
+    chunks = malloc (sizeof (struct dbf_chunk) * count_chunks);
+    for (ic = 0; ic < count_chunks; ic++)
+      {
+	  struct dbf_chunk *chunk = chunks + ic;
+	  chunk->first_row = ic * DBF_CHUNK_ROWS;
+	  chunk->count_rows = DBF_CHUNK_ROWS;
+	  if (chunk->first_row + chunk->count_rows > count_rows)
+	      chunk->count_rows = count_rows - chunk->first_row;
+	  if (chunk->count_rows < 0)
+	      chunk->count_rows = 0;
+	  chunk->records = records + ((size_t) chunk->first_row * reclen);
+	  chunk->reclen = reclen;
+	  chunk->fields = fields;
+	  chunk->count_fields = count_fields;
+	  chunk->deleted = 0;
+	  chunk->stats =
+	      malloc (sizeof (struct dbf_field_stats) * (count_fields + 1));
+	  for (ifld = 0; ifld < count_fields; ifld++)
+	    {
+		chunk->stats[ifld].blanks = 0;
+		chunk->stats[ifld].failures = 0;
+		chunk->stats[ifld].first_failure = -1;
+		chunk->stats[ifld].max_width = 0;
+	    }
+	  memset (&(chunk->charset), 0, sizeof (struct dbf_charset_stats));
+      }
+
+    queue.chunks = chunks;
+    queue.count_chunks = count_chunks;
+    queue.next = 0;
+#ifndef _WIN32
+    pthread_mutex_init (&(queue.mutex), NULL);
+    if (threads > count_chunks)
+	threads = count_chunks;
+    tids = malloc (sizeof (pthread_t) * threads);
+    count_threads = 0;
+    for (it = 1; it < threads; it++)
+      {
+	  if (pthread_create
+	      (tids + count_threads, NULL, dbf_chunk_worker, &queue) != 0)
+	      break;
+	  count_threads++;
+      }
+    /* the main thread takes its share of the queue as well */
+    dbf_chunk_worker (&queue);
+    for (it = 0; it < count_threads; it++)
+	pthread_join (tids[it], NULL);
+    free (tids);
+    pthread_mutex_destroy (&(queue.mutex));
+#else
+    dbf_chunk_worker (&queue);
+#endif
+
+/* merging the partial statistics */
+    *deleted = 0;
+    memset (charset, 0, sizeof (struct dbf_charset_stats));
+    for (ifld = 0; ifld < count_fields; ifld++)
+      {
+	  stats[ifld].blanks = 0;
+	  stats[ifld].failures = 0;
+	  stats[ifld].first_failure = -1;
+	  stats[ifld].max_width = 0;
+      }
+    for (ic = 0; ic < count_chunks; ic++)
+      {
+	  struct dbf_chunk *chunk = chunks + ic;
+	  *deleted += chunk->deleted;
+	  for (ifld = 0; ifld < count_fields; ifld++)
+	    {
+		struct dbf_field_stats *in = chunk->stats + ifld;
+		struct dbf_field_stats *out = stats + ifld;
+		out->blanks += in->blanks;
+		if (out->first_failure < 0)
+		    out->first_failure = in->first_failure;
+		out->failures += in->failures;
+		if (in->max_width > out->max_width)
+		    out->max_width = in->max_width;
+	    }
+	  charset->ascii += chunk->charset.ascii;
+	  charset->high += chunk->charset.high;
+	  charset->utf8_valid += chunk->charset.utf8_valid;
+	  charset->utf8_invalid += chunk->charset.utf8_invalid;
+	  charset->c1_controls += chunk->charset.c1_controls;
+	  charset->cp1252_undefined += chunk->charset.cp1252_undefined;
+	  charset->box_drawing += chunk->charset.box_drawing;
+	  charset->lower_half += chunk->charset.lower_half;
+	  charset->upper_half += chunk->charset.upper_half;
+	  charset->high_runs += chunk->charset.high_runs;
+	  free (chunk->stats);
+      }
+    free (chunks);
+}
+
+static const char *
+dbf_language_driver (int ldid)
+{
+/* decoding the most common DBF language driver IDs */
+    switch (ldid)
+      {
+      case 0x01:
+	  return "CP437";
+      case 0x02:
+	  return "CP850";
+      case 0x03:
+      case 0x57:
+	  return "CP1252";
+      case 0x13:
+	  return "CP932";
+      case 0x26:
+      case 0x65:
+	  return "CP866";
+      case 0x4D:
+	  return "CP936";
+      case 0x4E:
+	  return "CP949";
+      case 0x4F:
+	  return "CP950";
+      case 0x64:
+	  return "CP852";
+      case 0xC8:
+	  return "CP1250";
+      case 0xC9:
+	  return "CP1251";
+      case 0xCB:
+	  return "CP1253";
+      };
+    return NULL;
+}
+
+static const char *
+guess_charset (const struct dbf_charset_stats *cs)
+{
+/*
+ * proposing the most plausible charset for CHARACTER fields
+ *
+ * - no byte above 0x7F: plain ASCII, any charset will do [NULL]
+ * - (almost) only well-formed UTF-8 sequences: UTF-8
+ * - otherwise some single-byte code page:
+ *   runs of high bytes mean a non-Latin alphabet [Cyrillic], found
+ *   in 0x80-0xAF on DOS (CP866) and in 0xC0-0xFF on Windows (CP1251);
+ *   Latin DOS code pages (CP850) put accented letters in 0x80-0xAF,
+ *   Windows/ISO ones in 0xC0-0xFF, and ISO-8859-1 has nothing but
+ *   control codes in 0x80-0x9F
+*/
+    if (cs->high == 0)
+	return NULL;
+    if (cs->utf8_invalid == 0 || cs->utf8_invalid * 50 < cs->utf8_valid)
+	return "UTF-8";
+    if (cs->high_runs * 2 > cs->high)
+	return (cs->lower_half > cs->upper_half) ? "CP866" : "CP1251";
+    if (cs->cp1252_undefined > 0
+	|| (cs->lower_half > cs->upper_half && cs->box_drawing * 4 < cs->high))
+	return "CP850";
+    if (cs->c1_controls == 0)
+	return "ISO-8859-1";
+    return "CP1252";
+}
+
+static void
+do_analyze_dbf (char *base_path, int threads)
 {
 /* analyzing a DBF */
     FILE *fl_dbf = NULL;
+    FILE *fl_cpg;
     char path[1024];
     int rd;
     unsigned char bf[1024];
-    unsigned char *buf_dbf = NULL;
+    struct shp_mapped_file map;
+    int mapped = 0;
+    struct dbf_field *fields = NULL;
+    struct dbf_field_stats *stats = NULL;
+    struct dbf_charset_stats charset;
+    int count_fields = 0;
+    int ldid;
+    const char *charset_name;
+    const char *declared;
+    char cpg[64];
+    int len;
     int dbf_size;
     int dbf_reclen = 0;
     int dbf_recno;
     int off_dbf;
     int current_row;
-    int skpos;
-    int offset;
+    size_t available;
     int ind;
     int err_dbf = 0;
     int err_geo = 0;
@@ -1343,6 +1833,7 @@ do_analyze_dbf (char *base_path)
     dbf_recno = gaiaImport32 (bf + 4, GAIA_LITTLE_ENDIAN, endian_arch);
     dbf_size = gaiaImport16 (bf + 8, GAIA_LITTLE_ENDIAN, endian_arch);
     dbf_reclen = gaiaImport16 (bf + 10, GAIA_LITTLE_ENDIAN, endian_arch);
+    ldid = *(bf + 29);
     printf ("DBF header summary:\n");
     printf ("========================================\n");
     printf ("    # records = %d\n", dbf_recno);
@@ -1351,6 +1842,8 @@ do_analyze_dbf (char *base_path)
     printf ("========================================\n");
     dbf_size--;
     off_dbf = 0;
+    if (dbf_size > 32)
+	fields = malloc (sizeof (struct dbf_field) * ((dbf_size - 32) / 32 + 1));
     for (ind = 32; ind < dbf_size; ind += 32)
       {
 	  /* fetches DBF fields definitions */
@@ -1361,6 +1854,12 @@ do_analyze_dbf (char *base_path)
 	  field_name[11] = '\0';
 	  printf ("name=%-10s offset=%4d type=%c size=%3d decimals=%2d",
 		  field_name, off_dbf, *(bf + 11), *(bf + 16), *(bf + 17));
+	  strcpy (fields[count_fields].name, field_name);
+	  fields[count_fields].type = *(bf + 11);
+	  fields[count_fields].offset = off_dbf + 1;	/* skipping the deletion flag */
+	  fields[count_fields].length = *(bf + 16);
+	  fields[count_fields].decimals = *(bf + 17);
+	  count_fields++;
 	  switch (*(bf + 11))
 	    {
 	    case 'C':
@@ -1405,35 +1904,97 @@ do_analyze_dbf (char *base_path)
 	    };
 	  off_dbf += *(bf + 16);
       }
-    buf_dbf = malloc (sizeof (unsigned char) * dbf_reclen);
-    current_row = 0;
-/* positioning the DBF file on first entity */
-    offset = dbf_size;
-    skpos = fseek (fl_dbf, offset, SEEK_SET);
-    if (skpos != 0)
+/* mapping the DBF: records are fixed-length and follow the header */
+    if (!shp_map_file (&map, fl_dbf))
       {
-	  printf (err_read, "DBF", current_row + 1);
+	  printf (err_read, "DBF", 1);
+	  goto error;
+      }
+    mapped = 1;
+    if (dbf_reclen < 1 || off_dbf + 1 > dbf_reclen)
+      {
+	  printf (err_header, "DBF");
+	  goto error;
+      }
+    available = 0;
+    if (map.size > (size_t) dbf_size + 1)
+	available = (map.size - ((size_t) dbf_size + 1)) / dbf_reclen;
+    if (dbf_recno < 0 || available < (size_t) dbf_recno)
+      {
+	  printf (err_read, "DBF", (int) available + 1);
 	  goto error;
       }
     printf ("\nTesting DBF rows:\n");
     printf ("========================================\n");
-    while (1)
+    stats = malloc (sizeof (struct dbf_field_stats) * (count_fields + 1));
+    current_row = dbf_recno;
+    if (dbf_recno > 0)
+	scan_dbf_rows (map.base + dbf_size + 1, dbf_reclen, dbf_recno, fields,
+		       count_fields, threads, &deleted_rows, stats, &charset);
+    else
+	memset (&charset, 0, sizeof (struct dbf_charset_stats));
+    for (ind = 0; ind < count_fields; ind++)
       {
-	  /* reading entities from DBF */
-	  if (current_row == dbf_recno)
-	      goto eof;
-	  /* sequentially reading the DBF file */
-	  rd = fread (buf_dbf, sizeof (unsigned char), dbf_reclen, fl_dbf);
-	  if (rd != dbf_reclen)
+	  /* reporting the per-field statistics */
+	  struct dbf_field *fld = fields + ind;
+	  struct dbf_field_stats *st = stats + ind;
+	  if (dbf_recno == 0)
+	      break;
+	  printf ("name=%-10s blank=%-8lld max-width=%3d [size=%3d]\n",
+		  fld->name, (long long) (st->blanks), st->max_width,
+		  fld->length);
+	  if (st->failures > 0)
+	      printf
+		  ("\t\tWARNING: %lld invalid value%s for type %c (first one at row #%d)\n",
+		   (long long) (st->failures), (st->failures > 1) ? "s" : "",
+		   fld->type, st->first_failure + 1);
+      }
+
+/* guessing the charset of CHARACTER fields */
+    printf ("\nDBF charset detection:\n");
+    printf ("========================================\n");
+    declared = dbf_language_driver (ldid);
+    if (ldid == 0)
+	printf ("language driver: none declared\n");
+    else
+	printf ("language driver: 0x%02x [%s]\n", ldid,
+		(declared != NULL) ? declared : "unknown");
+    len = strlen (base_path);
+    if (len > 4 && len < 1000 && strcasecmp (base_path + len - 4, ".dbf") == 0)
+      {
+	  /* checking for a .cpg file declaring the code page */
+	  strcpy (path, base_path);
+	  strcpy (path + len - 4, ".cpg");
+	  fl_cpg = fopen (path, "rb");
+	  if (fl_cpg)
 	    {
-		printf (err_read, "DBF", current_row + 1);
-		goto error;
+		rd = fread (cpg, sizeof (char), sizeof (cpg) - 1, fl_cpg);
+		fclose (fl_cpg);
+		cpg[rd] = '\0';
+		rd = strcspn (cpg, "\r\n");
+		cpg[rd] = '\0';
+		printf (".cpg file: %s\n", cpg);
 	    }
-	  current_row++;
-	  if (*buf_dbf == '*')
-	      deleted_rows++;
       }
-  eof:
+    printf ("text bytes: %lld ASCII / %lld non-ASCII\n",
+	    (long long) (charset.ascii), (long long) (charset.high));
+    if (charset.high > 0)
+	printf ("UTF-8 sequences: %lld valid / %lld invalid\n",
+		(long long) (charset.utf8_valid),
+		(long long) (charset.utf8_invalid));
+    charset_name = guess_charset (&charset);
+    if (charset_name == NULL)
+	printf ("most likely charset: plain ASCII [any charset will do]\n");
+    else
+      {
+	  printf ("most likely charset: %s\n", charset_name);
+	  if (declared != NULL && strcmp (declared, charset_name) != 0
+	      && !(strcmp (declared, "CP1252") == 0
+		   && strcmp (charset_name, "ISO-8859-1") == 0))
+	      /* CP1252 being a superset of ISO-8859-1 */
+	      printf ("\t\tWARNING: the language driver declares %s\n",
+		      declared);
+      }
     printf ("\nDBF contains %d entities [%d valid / %d deleted]\n", current_row,
 	    current_row - deleted_rows, deleted_rows);
     if (err_dbf)
@@ -1446,29 +2007,305 @@ do_analyze_dbf (char *base_path)
       }
     if (!err_geo)
 	printf ("\nValidation passed: no problem found\n");
+    if (mapped)
+	shp_unmap_file (&map);
     if (fl_dbf)
 	fclose (fl_dbf);
-    if (buf_dbf)
-	free (buf_dbf);
+    if (fields)
+	free (fields);
+    if (stats)
+	free (stats);
     return;
   no_file:
 /* the DBF file can't be accessed */
     printf ("\nUnable to analyze this DBF: file not existing\n");
+    if (mapped)
+	shp_unmap_file (&map);
     if (fl_dbf)
 	fclose (fl_dbf);
-    if (buf_dbf)
-	free (buf_dbf);
+    if (fields)
+	free (fields);
+    if (stats)
+	free (stats);
     return;
   error:
 /* the DBF is invalid or corrupted */
     printf ("\nThis DBF is corrupted / has an invalid format");
+    if (mapped)
+	shp_unmap_file (&map);
     if (fl_dbf)
 	fclose (fl_dbf);
-    if (buf_dbf)
-	free (buf_dbf);
+    if (fields)
+	free (fields);
+    if (stats)
+	free (stats);
     return;
 }
 
+static int
+copy_rebuilt_file (FILE * in, size_t offset, size_t length, FILE * out)
+{
+/* copying [a range of] some file into the rebuilt Shapefile */
+    unsigned char buf[65536];
+    size_t len;
+    if (fseek (in, (long) offset, SEEK_SET) != 0)
+	return 0;
+    while (length > 0)
+      {
+	  len = (length < sizeof (buf)) ? length : sizeof (buf);
+	  if (fread (buf, 1, len, in) != len)
+	      return 0;
+	  if (fwrite (buf, 1, len, out) != len)
+	      return 0;
+	  length -= len;
+      }
+    return 1;
+}
+
+static int
+write_rebuilt_shapefile (const char *base_path, const char *tmp_shx,
+			 FILE * fl_shp, const unsigned char *shp_header,
+			 const struct shp_index_summary *summary)
+{
+/*
+ * writing the rebuilt Shapefile as <base>_rebuilt.*
+ *
+ * the original files are left untouched: the SHP is copied up to the
+ * last valid record under the fixed header, the DBF [if any] as it is
+*/
+    char path[1024];
+    FILE *out;
+    FILE *fl_dbf;
+    long dbf_size;
+    int ok;
+    sprintf (path, "%s_rebuilt.shx", base_path);
+    remove (path);
+    if (rename (tmp_shx, path) != 0)
+	return 0;
+    sprintf (path, "%s_rebuilt.shp", base_path);
+    out = fopen (path, "wb");
+    if (!out)
+	return 0;
+    ok = (fwrite (shp_header, 1, 100, out) == 100);
+    if (ok)
+	ok = copy_rebuilt_file (fl_shp, 100, summary->content_length - 100,
+				out);
+    if (fclose (out) != 0)
+	ok = 0;
+    if (!ok)
+	return 0;
+    sprintf (path, "%s.dbf", base_path);
+    fl_dbf = fopen (path, "rb");
+    if (!fl_dbf)
+	return 1;
+    sprintf (path, "%s_rebuilt.dbf", base_path);
+    out = fopen (path, "wb");
+    if (!out)
+      {
+	  fclose (fl_dbf);
+	  return 0;
+      }
+    ok = (fseek (fl_dbf, 0, SEEK_END) == 0);
+    dbf_size = ftell (fl_dbf);
+    if (ok && dbf_size >= 0)
+	ok = copy_rebuilt_file (fl_dbf, 0, (size_t) dbf_size, out);
+    else
+	ok = 0;
+    fclose (fl_dbf);
+    if (fclose (out) != 0)
+	ok = 0;
+    return ok;
+}
+
+static int
+do_rebuild_shx (char *base_path, int force)
+{
+/*
+ * rebuilding the SHX file [and fixing the SHP header]
+ *
+ * the SHP is sequentially walked just once, without parsing any
+ * geometry; the fresh SHX is first written into a temporary file
+ * and then replaces the original one [kept as .shx.bak]
+ *
+ * when the walk stopped before the end of the SHP, found no record
+ * at all, or the DBF doesn't match, the original files are left
+ * untouched [unless FORCE] and <base>_rebuilt.* is written instead
+*/
+    FILE *fl_shp = NULL;
+    FILE *fl_shx = NULL;
+    FILE *fl_dbf;
+    char path[1024];
+    char tmp_path[1024];
+    char bak_path[1024];
+    unsigned char hdr[100];
+    unsigned char bf[32];
+    struct shp_mapped_file map;
+    int mapped = 0;
+    struct shp_index_summary summary;
+    int dbf_recno = -1;
+    int doubtful = 0;
+    int ret;
+    char *sys_err;
+    char *err_open = "ERROR: unable to open '%s' for reading: %s\n";
+    char *err_create = "ERROR: unable to create '%s': %s\n";
+    char *err_write = "ERROR: unable to write '%s': %s\n";
+    int endian_arch = gaiaEndianArch ();
+    printf ("\nshp_doctor\n\n");
+    printf
+	("==================================================================\n");
+    printf ("input SHP base-path: %s\n", base_path);
+    printf ("-option: rebuilding the SHX file\n");
+    if (force)
+	printf ("-option: forcing the SHP header to be patched\n");
+    printf
+	("==================================================================\n\n");
+/* mapping the SHP file */
+    sprintf (path, "%s.shp", base_path);
+    fl_shp = fopen (path, "rb");
+    if (!fl_shp)
+      {
+	  sys_err = strerror (errno);
+	  printf (err_open, path, sys_err);
+	  goto stop;
+      }
+    if (!shp_map_file (&map, fl_shp))
+      {
+	  printf ("ERROR: unable to map '%s'\n", path);
+	  goto stop;
+      }
+    mapped = 1;
+    if (map.size < 100)
+      {
+	  printf ("Invalid %s header\n", "SHP");
+	  goto stop;
+      }
+/* writing the fresh SHX into a temporary file */
+    sprintf (tmp_path, "%s.shx.tmp", base_path);
+    fl_shx = fopen (tmp_path, "wb");
+    if (!fl_shx)
+      {
+	  sys_err = strerror (errno);
+	  printf (err_create, tmp_path, sys_err);
+	  goto stop;
+      }
+    ret = shp_rebuild_index (&map, fl_shx, hdr, &summary);
+    if (fclose (fl_shx) != 0)
+	ret = 0;
+    fl_shx = NULL;
+    shp_unmap_file (&map);
+    mapped = 0;
+    if (!ret)
+      {
+	  sys_err = strerror (errno);
+	  printf (err_write, tmp_path, sys_err);
+	  remove (tmp_path);
+	  goto stop;
+      }
+
+    printf ("SHX summary:\n");
+    printf ("========================================\n");
+    printf ("shape-type=%d\n", summary.shape);
+    printf ("   # records = %d [%d NULL shapes]\n", summary.records,
+	    summary.null_shapes);
+    printf ("extent: minx=%1.6f miny=%1.6f maxx=%1.6f maxy=%1.6f\n",
+	    summary.minx, summary.miny, summary.maxx, summary.maxy);
+    if (summary.trailing > 0)
+      {
+	  printf
+	      ("WARNING: %llu trailing bytes not containing any valid SHP record\n",
+	       (unsigned long long) (summary.trailing));
+	  doubtful = 1;
+      }
+    if (summary.records == 0)
+      {
+	  printf ("WARNING: no valid SHP record found\n");
+	  doubtful = 1;
+      }
+/* checking the DBF for a 1:1 correspondence */
+    sprintf (path, "%s.dbf", base_path);
+    fl_dbf = fopen (path, "rb");
+    if (fl_dbf)
+      {
+	  if (fread (bf, sizeof (unsigned char), 32, fl_dbf) == 32)
+	    {
+		dbf_recno =
+		    gaiaImport32 (bf + 4, GAIA_LITTLE_ENDIAN, endian_arch);
+		if (dbf_recno != summary.records)
+		  {
+		      printf
+			  ("WARNING: the DBF contains %d entities [%d SHP records]\n",
+			   dbf_recno, summary.records);
+		      doubtful = 1;
+		  }
+	    }
+	  fclose (fl_dbf);
+      }
+
+    if (doubtful && !force)
+      {
+	  /* never overwriting the only copy of some damaged Shapefile */
+	  if (!write_rebuilt_shapefile
+	      (base_path, tmp_path, fl_shp, hdr, &summary))
+	    {
+		sys_err = strerror (errno);
+		printf ("ERROR: unable to write '%s_rebuilt': %s\n",
+			base_path, sys_err);
+		remove (tmp_path);
+		goto stop;
+	    }
+	  fclose (fl_shp);
+	  printf
+	      ("\nthe original files have been left untouched; the rebuilt\n"
+	       "Shapefile has been written as '%s_rebuilt'\n"
+	       "[use -force to patch the original SHP header anyway]\n",
+	       base_path);
+	  printf ("\nUnable to safely rebuild the SHX file\n");
+	  return 0;
+      }
+    fclose (fl_shp);
+    fl_shp = NULL;
+
+/* replacing the SHX, the previous one being kept as a backup */
+    sprintf (path, "%s.shx", base_path);
+    sprintf (bak_path, "%s.shx.bak", base_path);
+    remove (bak_path);
+    rename (path, bak_path);
+    if (rename (tmp_path, path) != 0)
+      {
+	  sys_err = strerror (errno);
+	  printf (err_create, path, sys_err);
+	  goto stop;
+      }
+/* patching the SHP header: file length and extent */
+    sprintf (path, "%s.shp", base_path);
+    fl_shp = fopen (path, "rb+");
+    if (!fl_shp)
+      {
+	  sys_err = strerror (errno);
+	  printf (err_open, path, sys_err);
+	  goto stop;
+      }
+    if (fwrite (hdr, sizeof (unsigned char), 100, fl_shp) != 100
+	|| fclose (fl_shp) != 0)
+      {
+	  fl_shp = NULL;
+	  sys_err = strerror (errno);
+	  printf (err_write, path, sys_err);
+	  goto stop;
+      }
+    fl_shp = NULL;
+    printf ("\nSHX successfully rebuilt%s\n", doubtful ? " [forced]" : "");
+    return 1;
+
+  stop:
+    if (mapped)
+	shp_unmap_file (&map);
+    if (fl_shp)
+	fclose (fl_shp);
+    printf ("\nUnable to rebuild the SHX file\n");
+    return 0;
+}
+
 static void
 do_version ()
 {
@@ -1503,6 +2340,17 @@ do_help ()
     fprintf (stderr, "--ignore-extent           ignore coord consistency\n");
     fprintf (stderr, "--ignore-shx              ignore the SHX file\n");
     fprintf (stderr, "-dbf or --bare-dbf        bare DBF check\n");
+    fprintf (stderr,
+	     "-threads or --threads num scanning DBF rows by using <num>\n"
+	     "                          parallel threads [-dbf]\n");
+    fprintf (stderr,
+	     "--rebuild-shx             rebuild the SHX file [and the SHP\n"
+	     "                          header] without parsing geometries;\n"
+	     "                          a doubtful result is written as\n"
+	     "                          <path>_rebuilt.* instead\n");
+    fprintf (stderr,
+	     "-force or --force         patch the original SHP header even\n"
+	     "                          when records are lost [--rebuild-shx]\n");
 }
 
 int
@@ -1517,6 +2365,9 @@ main (int argc, char *argv[])
     int ignore_extent = 0;
     int ignore_shx = 0;
     int bare_dbf = 0;
+    int rebuild_shx = 0;
+    int force = 0;
+    int threads = 1;
     int error = 0;
     for (i = 1; i < argc; i++)
       {
@@ -1528,6 +2379,9 @@ main (int argc, char *argv[])
 		  case ARG_IN_PATH:
 		      in_path = argv[i];
 		      break;
+		  case ARG_THREADS:
+		      threads = atoi (argv[i]);
+		      break;
 		  };
 		next_arg = ARG_NONE;
 		continue;
@@ -1584,6 +2438,23 @@ main (int argc, char *argv[])
 		bare_dbf = 1;
 		continue;
 	    }
+	  if (strcasecmp (argv[i], "-threads") == 0
+	      || strcasecmp (argv[i], "--threads") == 0)
+	    {
+		next_arg = ARG_THREADS;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--rebuild-shx") == 0)
+	    {
+		rebuild_shx = 1;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "-force") == 0
+	      || strcasecmp (argv[i], "--force") == 0)
+	    {
+		force = 1;
+		continue;
+	    }
 	  fprintf (stderr, "unknown argument: %s\n", argv[i]);
 	  error = 1;
       }
@@ -1598,15 +2469,25 @@ main (int argc, char *argv[])
 	  fprintf (stderr, "did you forget setting the --in-path argument ?\n");
 	  error = 1;
       }
+    if (threads < 1)
+      {
+	  fprintf (stderr, "invalid --threads argument: expected 1 or more\n");
+	  error = 1;
+      }
     if (error)
       {
 	  do_help ();
 	  return -1;
       }
-    if (analyze)
+    if (rebuild_shx)
+      {
+	  if (!do_rebuild_shx (in_path, force))
+	      return -1;
+      }
+    else if (analyze)
       {
 	  if (bare_dbf)
-	      do_analyze_dbf (in_path);
+	      do_analyze_dbf (in_path, threads);
 	  else if (ignore_shx)
 	      do_analyze_no_shx (in_path, ignore_shape, ignore_extent);
 	  else
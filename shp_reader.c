@@ -0,0 +1,535 @@
+/*
+/ shp_reader.c
+/
+/ memory-mapped SHX/SHP/DBF reader shared by shp_doctor and shp_sanitize
+/
+/    This program is free software: you can redistribute it and/or modify
+/    it under the terms of the GNU General Public License as published by
+/    the Free Software Foundation, either version 3 of the License, or
+/    (at your option) any later version.
+/
+/    This program is distributed in the hope that it will be useful,
+/    but WITHOUT ANY WARRANTY; without even the implied warranty of
+/    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/    GNU General Public License for more details.
+/
+/    You should have received a copy of the GNU General Public License
+/    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+/
+*/
+
+#if defined(_WIN32) && !defined(__MINGW32__)
+/* MSVC strictly requires this include [off_t] */
+#include <sys/types.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(_WIN32) && !defined(__MINGW32__)
+#include "config-msvc.h"
+#else
+#include "config.h"
+#endif
+
+#ifdef SPATIALITE_AMALGAMATION
+#include <spatialite/sqlite3.h>
+#else
+#include <sqlite3.h>
+#endif
+
+#include <spatialite/gaiageo.h>
+
+#include "shp_reader.h"
+
+int
+shp_map_file (struct shp_mapped_file *map, FILE * fl)
+{
+/* mapping a whole (already opened) file into memory */
+#if defined(_WIN32)
+    HANDLE hfile;
+    LARGE_INTEGER sz;
+#else
+    struct stat st;
+    void *base;
+#endif
+
+    map->base = NULL;
+    map->size = 0;
+#if defined(_WIN32)
+    map->mapping = NULL;
+    hfile = (HANDLE) _get_osfhandle (_fileno (fl));
+    if (hfile == INVALID_HANDLE_VALUE)
+	return 0;
+    if (!GetFileSizeEx (hfile, &sz))
+	return 0;
+    if (sz.QuadPart == 0)
+	return 1;		/* an empty file: nothing to be mapped */
+    if ((unsigned long long) sz.QuadPart > SIZE_MAX)
+	return 0;
+    map->mapping = CreateFileMapping (hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map->mapping == NULL)
+	return 0;
+    map->base = MapViewOfFile (map->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (map->base == NULL)
+      {
+	  CloseHandle (map->mapping);
+	  map->mapping = NULL;
+	  return 0;
+      }
+    map->size = (size_t) sz.QuadPart;
+#else
+    if (fstat (fileno (fl), &st) != 0)
+	return 0;
+    if (st.st_size == 0)
+	return 1;		/* an empty file: nothing to be mapped */
+    if ((unsigned long long) st.st_size > SIZE_MAX)
+	return 0;
+    base =
+	mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fileno (fl),
+	      0);
+    if (base == MAP_FAILED)
+	return 0;
+#ifdef MADV_SEQUENTIAL
+/* entities are usually scanned in row order */
+    madvise (base, (size_t) st.st_size, MADV_SEQUENTIAL);
+#endif
+    map->base = base;
+    map->size = (size_t) st.st_size;
+#endif
+    return 1;
+}
+
+void
+shp_unmap_file (struct shp_mapped_file *map)
+{
+/* releasing a mapped file */
+#if defined(_WIN32)
+    if (map->base != NULL)
+	UnmapViewOfFile (map->base);
+    if (map->mapping != NULL)
+	CloseHandle (map->mapping);
+    map->mapping = NULL;
+#else
+    if (map->base != NULL)
+	munmap ((void *) (map->base), map->size);
+#endif
+    map->base = NULL;
+    map->size = 0;
+}
+
+const unsigned char *
+shp_mapped_ptr (const struct shp_mapped_file *map, size_t offset,
+		size_t length)
+{
+/*
+ * returning a pointer to LENGTH bytes starting at OFFSET
+ * or NULL if this range is not fully contained in the file
+*/
+    if (map->base == NULL)
+	return NULL;
+    if (offset > map->size || length > map->size - offset)
+	return NULL;
+    return map->base + offset;
+}
+
+int
+shp_reader_open (struct shp_reader *reader, FILE * fl_shx, FILE * fl_shp,
+		 FILE * fl_dbf, int dbf_hdsz, int dbf_reclen)
+{
+/* mapping the three files of some Shapefile */
+    memset (reader, 0, sizeof (struct shp_reader));
+    reader->dbf_hdsz = dbf_hdsz;
+    reader->dbf_reclen = dbf_reclen;
+    reader->endian_arch = gaiaEndianArch ();
+    if (!shp_map_file (&(reader->shx), fl_shx))
+	goto error;
+    if (!shp_map_file (&(reader->shp), fl_shp))
+	goto error;
+    if (!shp_map_file (&(reader->dbf), fl_dbf))
+	goto error;
+    return 1;
+
+  error:
+    shp_reader_close (reader);
+    return 0;
+}
+
+void
+shp_reader_close (struct shp_reader *reader)
+{
+/* unmapping all files */
+    shp_unmap_file (&(reader->shx));
+    shp_unmap_file (&(reader->shp));
+    shp_unmap_file (&(reader->dbf));
+}
+
+int
+shp_reader_shx_offset (const struct shp_reader *reader, int row,
+		       size_t *offset)
+{
+/*
+ * fetching the SHP offset (in bytes) from the SHX index
+ * returns 0 if there is no such row [EOF]
+*/
+    const unsigned char *p;
+    if (row < 0)
+	return 0;
+    /* 100 bytes for the header + current row displacement; each SHX row = 8 bytes */
+    p = shp_mapped_ptr (&(reader->shx), 100 + ((size_t) row * 8), 8);
+    if (p == NULL)
+	return 0;
+    *offset =
+	(size_t) ((unsigned int)
+		  gaiaImport32 (p, GAIA_BIG_ENDIAN, reader->endian_arch)) * 2;
+    return 1;
+}
+
+int
+shp_reader_record (const struct shp_reader *reader, size_t offset,
+		   const unsigned char **record, int *length)
+{
+/*
+ * locating the SHP record starting at OFFSET
+ * on success RECORD points to the record's content [the shape-type
+ * comes first], the 8 bytes record header being already skipped
+ * returns 0 if the record doesn't fit within the SHP file
+*/
+    const unsigned char *p;
+    int sz;
+    p = shp_mapped_ptr (&(reader->shp), offset, 8);
+    if (p == NULL)
+	return 0;
+    sz = gaiaImport32 (p + 4, GAIA_BIG_ENDIAN, reader->endian_arch);
+    if (sz < 0 || sz > (INT32_MAX / 2))
+	return 0;
+    p = shp_mapped_ptr (&(reader->shp), offset + 8, (size_t) sz * 2);
+    if (p == NULL)
+	return 0;
+    *record = p;
+    *length = sz * 2;
+    return 1;
+}
+
+const unsigned char *
+shp_reader_dbf_record (const struct shp_reader *reader, int row)
+{
+/* returning the DBF record of ROW, or NULL if it's out of bounds */
+    if (row < 0 || reader->dbf_reclen <= 0)
+	return NULL;
+    return shp_mapped_ptr (&(reader->dbf),
+			   (size_t) reader->dbf_hdsz +
+			   ((size_t) row * reader->dbf_reclen),
+			   reader->dbf_reclen);
+}
+
+static int
+shp_valid_shape (int shape)
+{
+/* testing for a known shape-type */
+    switch (shape)
+      {
+      case 0:			/* NULL */
+      case 1:			/* POINT */
+      case 3:			/* POLYLINE */
+      case 5:			/* POLYGON */
+      case 8:			/* MULTIPOINT */
+      case 11:			/* POINT Z */
+      case 13:			/* POLYLINE Z */
+      case 15:			/* POLYGON Z */
+      case 18:			/* MULTIPOINT Z */
+      case 21:			/* POINT M */
+      case 23:			/* POLYLINE M */
+      case 25:			/* POLYGON M */
+      case 28:			/* MULTIPOINT M */
+      case 31:			/* MULTIPATCH */
+	  return 1;
+      };
+    return 0;
+}
+
+static void
+shp_update_range (double *min, double *max, double value, int init)
+{
+/* expanding some range [X, Y, Z or M] */
+    if (!init)
+      {
+	  *min = value;
+	  *max = value;
+	  return;
+      }
+    if (value < *min)
+	*min = value;
+    if (value > *max)
+	*max = value;
+}
+
+static void
+shp_update_m_range (struct shp_index_summary *summary, double m_min,
+		    double m_max, int *init)
+{
+/* expanding the M range, "no data" values being ignored */
+    if (m_min < -1e38 || m_max < -1e38)
+	return;
+    shp_update_range (&(summary->minm), &(summary->maxm), m_min, *init);
+    shp_update_range (&(summary->minm), &(summary->maxm), m_max, 1);
+    *init = 1;
+}
+
+static void
+shp_record_extent (struct shp_index_summary *summary, const unsigned char *p,
+		   int length, int endian_arch, int *init_xy, int *init_z,
+		   int *init_m)
+{
+/*
+ * expanding the layer extent so to include some record
+ *
+ * only the record's own bounding box and Z/M ranges are read,
+ * there is no need at all for parsing the geometry
+*/
+    int shape = gaiaImport32 (p, GAIA_LITTLE_ENDIAN, endian_arch);
+    double x;
+    double y;
+    int n_parts;
+    int n_points;
+    size_t zoff = 0;
+    size_t moff = 0;
+
+    if (shape == 1 || shape == 11 || shape == 21)
+      {
+	  /* POINT: there is no bounding box */
+	  if (length < 20)
+	      return;
+	  x = gaiaImport64 (p + 4, GAIA_LITTLE_ENDIAN, endian_arch);
+	  y = gaiaImport64 (p + 12, GAIA_LITTLE_ENDIAN, endian_arch);
+	  shp_update_range (&(summary->minx), &(summary->maxx), x, *init_xy);
+	  shp_update_range (&(summary->miny), &(summary->maxy), y, *init_xy);
+	  *init_xy = 1;
+	  if (shape == 11 && length >= 28)
+	    {
+		x = gaiaImport64 (p + 20, GAIA_LITTLE_ENDIAN, endian_arch);
+		shp_update_range (&(summary->minz), &(summary->maxz), x,
+				  *init_z);
+		*init_z = 1;
+	    }
+	  if (shape == 11 && length >= 36)
+	    {
+		x = gaiaImport64 (p + 28, GAIA_LITTLE_ENDIAN, endian_arch);
+		shp_update_m_range (summary, x, x, init_m);
+	    }
+	  if (shape == 21 && length >= 28)
+	    {
+		x = gaiaImport64 (p + 20, GAIA_LITTLE_ENDIAN, endian_arch);
+		shp_update_m_range (summary, x, x, init_m);
+	    }
+	  return;
+      }
+    if (shape == 0 || length < 36)
+	return;
+
+/* any other shape starts with its own bounding box */
+    x = gaiaImport64 (p + 4, GAIA_LITTLE_ENDIAN, endian_arch);
+    y = gaiaImport64 (p + 12, GAIA_LITTLE_ENDIAN, endian_arch);
+    shp_update_range (&(summary->minx), &(summary->maxx), x, *init_xy);
+    shp_update_range (&(summary->miny), &(summary->maxy), y, *init_xy);
+    x = gaiaImport64 (p + 20, GAIA_LITTLE_ENDIAN, endian_arch);
+    y = gaiaImport64 (p + 28, GAIA_LITTLE_ENDIAN, endian_arch);
+    shp_update_range (&(summary->minx), &(summary->maxx), x, 1);
+    shp_update_range (&(summary->miny), &(summary->maxy), y, 1);
+    *init_xy = 1;
+
+/* locating the Z and M ranges [if any] */
+    if (length < 40)
+	return;
+    switch (shape)
+      {
+      case 13:
+      case 15:
+      case 23:
+      case 25:
+	  if (length < 44)
+	      return;
+	  n_parts = gaiaImport32 (p + 36, GAIA_LITTLE_ENDIAN, endian_arch);
+	  n_points = gaiaImport32 (p + 40, GAIA_LITTLE_ENDIAN, endian_arch);
+	  if (n_parts < 0 || n_points < 0)
+	      return;
+	  zoff = 44 + ((size_t) n_parts * 4) + ((size_t) n_points * 16);
+	  break;
+      case 31:
+	  if (length < 44)
+	      return;
+	  n_parts = gaiaImport32 (p + 36, GAIA_LITTLE_ENDIAN, endian_arch);
+	  n_points = gaiaImport32 (p + 40, GAIA_LITTLE_ENDIAN, endian_arch);
+	  if (n_parts < 0 || n_points < 0)
+	      return;
+	  zoff = 44 + ((size_t) n_parts * 8) + ((size_t) n_points * 16);
+	  break;
+      case 18:
+      case 28:
+	  n_points = gaiaImport32 (p + 36, GAIA_LITTLE_ENDIAN, endian_arch);
+	  if (n_points < 0)
+	      return;
+	  zoff = 40 + ((size_t) n_points * 16);
+	  break;
+      default:
+	  return;
+      };
+    if (shape == 23 || shape == 25 || shape == 28)
+      {
+	  /* M types: the M range comes just after the points */
+	  moff = zoff;
+	  zoff = 0;
+      }
+    else
+	moff = zoff + 16 + ((size_t) n_points * 8);
+    if (zoff > 0 && zoff + 16 <= (size_t) length)
+      {
+	  x = gaiaImport64 (p + zoff, GAIA_LITTLE_ENDIAN, endian_arch);
+	  y = gaiaImport64 (p + zoff + 8, GAIA_LITTLE_ENDIAN, endian_arch);
+	  shp_update_range (&(summary->minz), &(summary->maxz), x, *init_z);
+	  shp_update_range (&(summary->minz), &(summary->maxz), y, 1);
+	  *init_z = 1;
+      }
+    if (moff + 16 <= (size_t) length)
+      {
+	  /* the M range is optional in Z types */
+	  x = gaiaImport64 (p + moff, GAIA_LITTLE_ENDIAN, endian_arch);
+	  y = gaiaImport64 (p + moff + 8, GAIA_LITTLE_ENDIAN, endian_arch);
+	  shp_update_m_range (summary, x, y, init_m);
+      }
+}
+
+static void
+shp_export_header (unsigned char *hdr, const struct shp_index_summary *summary,
+		   size_t length, int endian_arch)
+{
+/* preparing a 100 bytes SHP/SHX header */
+    memset (hdr, 0, 100);
+    gaiaExport32 (hdr, 9994, GAIA_BIG_ENDIAN, endian_arch);	/* SHP magic number */
+    gaiaExport32 (hdr + 24, (int) (length / 2), GAIA_BIG_ENDIAN, endian_arch);	/* file length [16-bit words] */
+    gaiaExport32 (hdr + 28, 1000, GAIA_LITTLE_ENDIAN, endian_arch);	/* version */
+    gaiaExport32 (hdr + 32, summary->shape, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 36, summary->minx, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 44, summary->miny, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 52, summary->maxx, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 60, summary->maxy, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 68, summary->minz, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 76, summary->maxz, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 84, summary->minm, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 92, summary->maxm, GAIA_LITTLE_ENDIAN, endian_arch);
+}
+
+int
+shp_rebuild_index (const struct shp_mapped_file *shp, FILE * out_shx,
+		   unsigned char *shp_header, struct shp_index_summary *summary)
+{
+/*
+ * rebuilding the SHX index by sequentially walking the SHP records
+ *
+ * the fresh SHX is written into OUT_SHX [positioned at the start
+ * of an empty file], and SHP_HEADER receives the corrected 100 bytes
+ * SHP header [file length and extent]; the walk stops on the first
+ * record not fitting into the file or having an unexpected shape,
+ * so that any trailing garbage will be excluded
+ * returns 0 on failure
+*/
+    unsigned char block[8192];
+    int block_len = 0;
+    const unsigned char *p;
+    size_t offset = 100;
+    size_t length;
+    int shape;
+    int init_xy = 0;
+    int init_z = 0;
+    int init_m = 0;
+    int endian_arch = gaiaEndianArch ();
+
+    memset (summary, 0, sizeof (struct shp_index_summary));
+    p = shp_mapped_ptr (shp, 0, 100);
+    if (p == NULL)
+	return 0;
+    summary->shape = gaiaImport32 (p + 32, GAIA_LITTLE_ENDIAN, endian_arch);
+    if (summary->shape == 0 || !shp_valid_shape (summary->shape))
+	summary->shape = -1;	/* to be taken from the first record */
+
+/* reserving room for the SHX header */
+    memset (block, 0, 100);
+    if (fwrite (block, 1, 100, out_shx) != 100)
+	return 0;
+    while (1)
+      {
+	  p = shp_mapped_ptr (shp, offset, 12);
+	  if (p == NULL)
+	      break;
+	  length =
+	      (size_t) ((unsigned int)
+			gaiaImport32 (p + 4, GAIA_BIG_ENDIAN,
+				      endian_arch)) * 2;
+	  if (length < 4 || length > 0x7ffffffe
+	      || shp_mapped_ptr (shp, offset + 8, length) == NULL)
+	      break;
+	  shape = gaiaImport32 (p + 8, GAIA_LITTLE_ENDIAN, endian_arch);
+	  if (shape != 0)
+	    {
+		if (summary->shape < 0 && shp_valid_shape (shape))
+		    summary->shape = shape;
+		if (shape != summary->shape)
+		    break;
+	    }
+	  if (offset / 2 > 0x7fffffff)
+	      break;		/* can't be addressed by any SHX */
+	  if (shape == 0)
+	      summary->null_shapes += 1;
+	  else
+	      shp_record_extent (summary, p + 8, (int) length, endian_arch,
+				 &init_xy, &init_z, &init_m);
+
+	  /* appending the SHX entry */
+	  if (block_len == sizeof (block))
+	    {
+		if (fwrite (block, 1, block_len, out_shx) != (size_t) block_len)
+		    return 0;
+		block_len = 0;
+	    }
+	  gaiaExport32 (block + block_len, (int) (offset / 2), GAIA_BIG_ENDIAN,
+			endian_arch);
+	  gaiaExport32 (block + block_len + 4, (int) (length / 2),
+			GAIA_BIG_ENDIAN, endian_arch);
+	  block_len += 8;
+	  summary->records += 1;
+	  offset += 8 + length;
+      }
+    if (block_len > 0)
+      {
+	  if (fwrite (block, 1, block_len, out_shx) != (size_t) block_len)
+	      return 0;
+      }
+    if (summary->shape < 0)
+	summary->shape = 0;	/* only NULL shapes */
+    summary->content_length = offset;
+    summary->trailing = shp->size - offset;
+
+/* writing both headers */
+    shp_export_header (shp_header, summary, offset, endian_arch);
+    shp_export_header (block, summary,
+		       100 + ((size_t) summary->records * 8), endian_arch);
+    if (fseek (out_shx, 0, SEEK_SET) != 0)
+	return 0;
+    if (fwrite (block, 1, 100, out_shx) != 100)
+	return 0;
+    if (fflush (out_shx) != 0)
+	return 0;
+    return 1;
+}
@@ -0,0 +1,96 @@
+/*
+/ shp_reader.h
+/
+/ memory-mapped SHX/SHP/DBF reader shared by shp_doctor and shp_sanitize
+/
+/    This program is free software: you can redistribute it and/or modify
+/    it under the terms of the GNU General Public License as published by
+/    the Free Software Foundation, either version 3 of the License, or
+/    (at your option) any later version.
+/
+/    This program is distributed in the hope that it will be useful,
+/    but WITHOUT ANY WARRANTY; without even the implied warranty of
+/    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/    GNU General Public License for more details.
+/
+/    You should have received a copy of the GNU General Public License
+/    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+/
+*/
+
+#ifndef _SHP_READER_H
+#define _SHP_READER_H
+
+struct shp_mapped_file
+{
+/* a read-only file mapped into memory */
+    const unsigned char *base;
+    size_t size;
+#if defined(_WIN32)
+    void *mapping;
+#endif
+};
+
+struct shp_reader
+{
+/*
+ * a zero-copy Shapefile reader
+ *
+ * all three files are mapped into memory, so that SHX entries,
+ * SHP records and DBF records are simply pointers into the mapped
+ * pages; every access is bounds-checked against the file size
+*/
+    struct shp_mapped_file shx;
+    struct shp_mapped_file shp;
+    struct shp_mapped_file dbf;
+    int dbf_hdsz;
+    int dbf_reclen;
+    int endian_arch;
+};
+
+struct shp_index_summary
+{
+/* what has been found while rebuilding some SHX index */
+    int shape;
+    int records;
+    int null_shapes;
+    size_t content_length;	/* valid SHP bytes, header included */
+    size_t trailing;		/* unusable bytes at the end of the SHP */
+    double minx;
+    double miny;
+    double maxx;
+    double maxy;
+    double minz;
+    double maxz;
+    double minm;
+    double maxm;
+};
+
+extern int shp_map_file (struct shp_mapped_file *map, FILE * fl);
+
+extern void shp_unmap_file (struct shp_mapped_file *map);
+
+extern const unsigned char *shp_mapped_ptr (const struct shp_mapped_file
+					    *map, size_t offset,
+					    size_t length);
+
+extern int shp_reader_open (struct shp_reader *reader, FILE * fl_shx,
+			    FILE * fl_shp, FILE * fl_dbf, int dbf_hdsz,
+			    int dbf_reclen);
+
+extern void shp_reader_close (struct shp_reader *reader);
+
+extern int shp_reader_shx_offset (const struct shp_reader *reader, int row,
+				  size_t *offset);
+
+extern int shp_reader_record (const struct shp_reader *reader, size_t offset,
+			      const unsigned char **record, int *length);
+
+extern const unsigned char *shp_reader_dbf_record (const struct shp_reader
+						   *reader, int row);
+
+extern int shp_rebuild_index (const struct shp_mapped_file *shp,
+			      FILE * out_shx, unsigned char *shp_header,
+			      struct shp_index_summary *summary);
+
+#endif /* _SHP_READER_H */
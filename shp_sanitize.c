@@ -26,6 +26,7 @@
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <pthread.h>
 #endif
 
 #if defined(_WIN32) && !defined(__MINGW32__)
@@ -36,10 +37,16 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
 #include <float.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#if defined(_WIN32)
+#include <sys/timeb.h>
+#else
+#include <sys/time.h>
+#endif
 
 #include <sys/types.h>
 #if defined(_WIN32) && !defined(__MINGW32__)
@@ -64,9 +71,14 @@
 #include <spatialite/gaiageo.h>
 #include <spatialite.h>
 
+#include "shp_reader.h"
+
 #define ARG_NONE		0
 #define ARG_IN_DIR		1
 #define ARG_OUT_DIR		2
+#define ARG_THREADS		3
+#define ARG_JOBS		4
+#define ARG_REPORT		5
 
 #define SUFFIX_DISCARD	0
 #define SUFFIX_SHP		1
@@ -75,6 +87,27 @@
 
 #define SHAPEFILE_NO_DATA 1e-38
 
+#define SHP_RTREE_FANOUT	16
+#define SHP_RTREE_MIN_RINGS	8
+#define SHP_PIP_MIN_POINTS	64
+
+#define ENTITY_EMPTY	0
+#define ENTITY_READY	1
+#define ENTITY_DONE		2
+
+#define CLASS_VALID		0
+#define CLASS_DELETED	1
+#define CLASS_NULL		2
+#define CLASS_UNPARSABLE	3
+#define CLASS_BBOX		4
+#define CLASS_INVALID	5
+
+#define REPAIR_NONE		0
+#define REPAIR_UNCHANGED	1
+#define REPAIR_REPAIRED	2
+#define REPAIR_FAILED	3
+#define REPAIR_DROPPED	4
+
 #if defined(_WIN32) && !defined(__MINGW32__)
 #define strcasecmp	_stricmp
 #endif /* not WIN32 */
@@ -87,6 +120,11 @@ struct shp_entry
     int has_shp;
     int has_shx;
     int has_dbf;
+    sqlite3_int64 size;		/* SHP + SHX + DBF size [bytes] */
+    int tested;
+    int invalid;
+    int repaired;
+    int repair_failed;
     struct shp_entry *next;
 };
 
@@ -132,7 +170,7 @@ free_shp_list (struct shp_list *list)
 
 static void
 do_add_shapefile (struct shp_list *list, char *base_name, char *file_name,
-		  int suffix)
+		  int suffix, sqlite3_int64 size)
 {
 /* adding a possible SHP to the list */
     struct shp_entry *pi;
@@ -157,6 +195,7 @@ do_add_shapefile (struct shp_list *list, char *base_name, char *file_name,
 		      pi->has_dbf = 1;
 		      break;
 		  };
+		pi->size += size;
 		sqlite3_free (base_name);
 		sqlite3_free (file_name);
 		return;
@@ -171,6 +210,11 @@ do_add_shapefile (struct shp_list *list, char *base_name, char *file_name,
     pi->has_shp = 0;
     pi->has_shx = 0;
     pi->has_dbf = 0;
+    pi->size = size;
+    pi->tested = 0;
+    pi->invalid = 0;
+    pi->repaired = 0;
+    pi->repair_failed = 0;
     pi->next = NULL;
 
     switch (suffix)
@@ -194,11 +238,13 @@ do_add_shapefile (struct shp_list *list, char *base_name, char *file_name,
 }
 
 static int
-test_valid_shp (struct shp_entry *p)
+test_valid_shp (struct shp_entry *p, int rebuild_shx)
 {
 /* testing for a valid SHP candidate */
     if (p == NULL)
 	return 0;
+    if (rebuild_shx && p->has_shp && p->has_dbf)
+	return 1;		/* the SHX could be missing */
     if (p->has_shp && p->has_shx && p->has_dbf)
 	return 1;
     return 0;
@@ -262,7 +308,7 @@ freeShapefile (gaiaShapefilePtr shp)
 
 static void
 openShpRead (gaiaShapefilePtr shp, const char *path, double *MinX, double *MinY,
-	     double *MaxX, double *MaxY, int *mismatching)
+	     double *MaxX, double *MaxY, int *mismatching, FILE * log)
 {
 /* trying to open the shapefile and initial checkings */
     FILE *fl_shx = NULL;
@@ -346,7 +392,7 @@ openShpRead (gaiaShapefilePtr shp, const char *path, double *MinX, double *MinY,
     *mismatching = 0;
     if (*MinX != minx || *MinY != miny || *MaxX != maxx || *MaxY != maxy)
       {
-	  fprintf (stderr,
+	  fprintf (log,
 		   "\t\tHEADERS: found mismatching BBOX between .shx and .shp\n");
 	  *mismatching = 1;
       }
@@ -416,7 +462,7 @@ openShpRead (gaiaShapefilePtr shp, const char *path, double *MinX, double *MinY,
 		memcpy (field_name, bf, 11);
 		field_name[11] = '\0';
 		off_dbf += *(bf + 16);
-		fprintf (stderr,
+		fprintf (log,
 			 "WARNING: column \"%s\" is of the MEMO type and will be ignored\n",
 			 field_name);
 		continue;
@@ -580,93 +626,64 @@ openShpRead (gaiaShapefilePtr shp, const char *path, double *MinX, double *MinY,
 }
 
 static int
-readShpEntity (gaiaShapefilePtr shp, int current_row, int *shplen, double *minx,
+readShpEntity (gaiaShapefilePtr shp, const struct shp_reader *reader,
+	       int current_row, const unsigned char **bufshp,
+	       const unsigned char **bufdbf, int *shplen, double *minx,
 	       double *miny, double *maxx, double *maxy)
 {
-/* trying to read an entity from shapefile */
-    unsigned char buf[512];
+/*
+ * trying to read an entity from shapefile
+ * BUFSHP and BUFDBF will point directly into the mapped files
+*/
     int len;
-    int rd;
-    int skpos;
-    int offset;
-    int off_shp;
-    int sz;
+    size_t off_shp;
     char errMsg[1024];
     int shape;
-    int endian_arch = gaiaEndianArch ();
+    const unsigned char *p_shp;
+    const unsigned char *p_dbf;
+    int endian_arch = reader->endian_arch;
 
-/* positioning and reading the SHX file */
-    offset = 100 + (current_row * 8);	/* 100 bytes for the header + current row displacement; each SHX row = 8 bytes */
-    skpos = fseek (shp->flShx, offset, SEEK_SET);
-    if (skpos != 0)
+/* fetching the SHX index entry */
+    if (!shp_reader_shx_offset (reader, current_row, &off_shp))
 	goto eof;
-    rd = fread (buf, sizeof (unsigned char), 8, shp->flShx);
-    if (rd != 8)
-	goto eof;
-    off_shp = gaiaImport32 (buf, GAIA_BIG_ENDIAN, shp->endian_arch);
-/* positioning and reading the DBF file */
-    offset = shp->DbfHdsz + (current_row * shp->DbfReclen);
-    skpos = fseek (shp->flDbf, offset, SEEK_SET);
-    if (skpos != 0)
-	goto error;
-    rd = fread (shp->BufDbf, sizeof (unsigned char), shp->DbfReclen,
-		shp->flDbf);
-    if (rd != shp->DbfReclen)
+/* fetching the DBF record */
+    p_dbf = shp_reader_dbf_record (reader, current_row);
+    if (p_dbf == NULL)
 	goto error;
-    if (*(shp->BufDbf) == '*')
+    *bufdbf = p_dbf;
+    if (*p_dbf == '*')
 	goto dbf_deleted;
-/* positioning and reading corresponding SHP entity - geometry */
-    offset = off_shp * 2;
-    skpos = fseek (shp->flShp, offset, SEEK_SET);
-    if (skpos != 0)
+/* fetching the corresponding SHP entity - geometry */
+    if (!shp_reader_record (reader, off_shp, &p_shp, shplen))
 	goto error;
-    rd = fread (buf, sizeof (unsigned char), 8, shp->flShp);
-    if (rd != 8)
-	goto error;
-    sz = gaiaImport32 (buf + 4, GAIA_BIG_ENDIAN, shp->endian_arch);
-    if ((sz * 2) > shp->ShpBfsz)
-      {
-	  /* current buffer is too small; we need to allocate a bigger buffer */
-	  free (shp->BufShp);
-	  shp->ShpBfsz = sz * 2;
-	  shp->BufShp = malloc (sizeof (unsigned char) * shp->ShpBfsz);
-      }
-    /* reading the raw Geometry */
-    rd = fread (shp->BufShp, sizeof (unsigned char), sz * 2, shp->flShp);
-    if (rd != sz * 2)
-	goto error;
-    *shplen = rd;
+    *bufshp = p_shp;
 
 /* retrieving the feature's BBOX */
-    shape = gaiaImport32 (shp->BufShp + 0, GAIA_LITTLE_ENDIAN, endian_arch);
     *minx = DBL_MAX;
     *miny = DBL_MAX;
     *maxx = DBL_MAX;
     *maxy = DBL_MAX;
-    if (shape == GAIA_SHP_POINT || shape == GAIA_SHP_POINTZ
-	|| shape == GAIA_SHP_POINTM)
+    if (*shplen < 4)
+	return 1;
+    shape = gaiaImport32 (p_shp + 0, GAIA_LITTLE_ENDIAN, endian_arch);
+    if ((shape == GAIA_SHP_POINT || shape == GAIA_SHP_POINTZ
+	 || shape == GAIA_SHP_POINTM) && *shplen >= 20)
       {
-	  *minx =
-	      gaiaImport64 (shp->BufShp + 4, GAIA_LITTLE_ENDIAN, endian_arch);
+	  *minx = gaiaImport64 (p_shp + 4, GAIA_LITTLE_ENDIAN, endian_arch);
 	  *maxx = *minx;
-	  *miny =
-	      gaiaImport64 (shp->BufShp + 12, GAIA_LITTLE_ENDIAN, endian_arch);
+	  *miny = gaiaImport64 (p_shp + 12, GAIA_LITTLE_ENDIAN, endian_arch);
 	  *maxy = *miny;
       }
-    if (shape == GAIA_SHP_POLYLINE || shape == GAIA_SHP_POLYLINEZ
-	|| shape == GAIA_SHP_POLYLINEM || shape == GAIA_SHP_POLYGON
-	|| shape == GAIA_SHP_POLYGONZ || shape == GAIA_SHP_POLYGONM
-	|| shape == GAIA_SHP_MULTIPOINT || shape == GAIA_SHP_MULTIPOINTZ
-	|| shape == GAIA_SHP_MULTIPOINTM)
+    if ((shape == GAIA_SHP_POLYLINE || shape == GAIA_SHP_POLYLINEZ
+	 || shape == GAIA_SHP_POLYLINEM || shape == GAIA_SHP_POLYGON
+	 || shape == GAIA_SHP_POLYGONZ || shape == GAIA_SHP_POLYGONM
+	 || shape == GAIA_SHP_MULTIPOINT || shape == GAIA_SHP_MULTIPOINTZ
+	 || shape == GAIA_SHP_MULTIPOINTM) && *shplen >= 36)
       {
-	  *minx =
-	      gaiaImport64 (shp->BufShp + 4, GAIA_LITTLE_ENDIAN, endian_arch);
-	  *miny =
-	      gaiaImport64 (shp->BufShp + 12, GAIA_LITTLE_ENDIAN, endian_arch);
-	  *maxx =
-	      gaiaImport64 (shp->BufShp + 20, GAIA_LITTLE_ENDIAN, endian_arch);
-	  *maxy =
-	      gaiaImport64 (shp->BufShp + 28, GAIA_LITTLE_ENDIAN, endian_arch);
+	  *minx = gaiaImport64 (p_shp + 4, GAIA_LITTLE_ENDIAN, endian_arch);
+	  *miny = gaiaImport64 (p_shp + 12, GAIA_LITTLE_ENDIAN, endian_arch);
+	  *maxx = gaiaImport64 (p_shp + 20, GAIA_LITTLE_ENDIAN, endian_arch);
+	  *maxy = gaiaImport64 (p_shp + 28, GAIA_LITTLE_ENDIAN, endian_arch);
       }
     return 1;
 
@@ -695,7 +712,8 @@ struct shp_ring_item
 /* a RING item [to be reassembled into a (Multi)Polygon] */
     gaiaRingPtr Ring;
     int IsExterior;
-    gaiaRingPtr Mother;
+    struct shp_ring_item *Mother;
+    gaiaPolygonPtr Polygon;
     struct shp_ring_item *Next;
 };
 
@@ -706,6 +724,54 @@ struct shp_ring_collection
     struct shp_ring_item *Last;
 };
 
+struct shp_ring_index
+{
+/*
+ * an exterior Ring prepared for repeated point-in-ring tests
+ *
+ * the edges are distributed into horizontal buckets, so that a test
+ * only has to visit the edges crossing the point's Y band
+*/
+    int Count;
+    double *X;
+    double *Y;
+    double MinX;
+    double MinY;
+    double MaxX;
+    double MaxY;
+    int Buckets;
+    int *Offsets;
+    int *Edges;
+};
+
+struct shp_rtree_node
+{
+/* a node of the STR-packed R-tree indexing exterior Rings */
+    double MinX;
+    double MinY;
+    double MaxX;
+    double MaxY;
+    int First;			/* first child: a node or an exterior Ring */
+    int Count;
+    int IsLeaf;
+};
+
+struct shp_rtree
+{
+/* an STR-packed R-tree on the MBRs of exterior Rings */
+    struct shp_rtree_node *Nodes;
+    int Root;
+    int *Rings;			/* exterior Ring indices in STR order */
+};
+
+struct shp_str_item
+{
+/* an exterior Ring to be sorted by the STR packing */
+    int Index;
+    double CX;
+    double CY;
+};
+
 static void
 shp_free_rings (struct shp_ring_collection *ringsColl)
 {
@@ -734,6 +800,7 @@ shp_add_ring (struct shp_ring_collection *ringsColl, gaiaRingPtr ring)
 /* accordingly to SHP rules interior/exterior depends on direction */
     p->IsExterior = ring->Clockwise;
     p->Mother = NULL;
+    p->Polygon = NULL;
     p->Next = NULL;
 /* updating the linked list */
     if (ringsColl->First == NULL)
@@ -743,60 +810,220 @@ shp_add_ring (struct shp_ring_collection *ringsColl, gaiaRingPtr ring)
     ringsColl->Last = p;
 }
 
-static int
-shp_check_rings (gaiaRingPtr exterior, gaiaRingPtr candidate)
+static void
+shp_ring_vertex (gaiaRingPtr ring, int iv, double *x, double *y)
 {
-/* 
-/ speditively checks if the candidate could be an interior Ring
-/ contained into the exterior Ring
-*/
+/* fetching the X,Y coords of some Ring vertex */
     double z;
     double m;
-    double x0;
-    double y0;
-    double x1;
-    double y1;
-    int mid;
-    int ret0;
-    int ret1;
-    if (candidate->DimensionModel == GAIA_XY_Z)
+    if (ring->DimensionModel == GAIA_XY_Z)
       {
-	  gaiaGetPointXYZ (candidate->Coords, 0, &x0, &y0, &z);
+	  gaiaGetPointXYZ (ring->Coords, iv, x, y, &z);
       }
-    else if (candidate->DimensionModel == GAIA_XY_M)
+    else if (ring->DimensionModel == GAIA_XY_M)
       {
-	  gaiaGetPointXYM (candidate->Coords, 0, &x0, &y0, &m);
+	  gaiaGetPointXYM (ring->Coords, iv, x, y, &m);
       }
-    else if (candidate->DimensionModel == GAIA_XY_Z_M)
+    else if (ring->DimensionModel == GAIA_XY_Z_M)
       {
-	  gaiaGetPointXYZM (candidate->Coords, 0, &x0, &y0, &z, &m);
+	  gaiaGetPointXYZM (ring->Coords, iv, x, y, &z, &m);
       }
     else
       {
-	  gaiaGetPoint (candidate->Coords, 0, &x0, &y0);
+	  gaiaGetPoint (ring->Coords, iv, x, y);
       }
-    mid = candidate->Points / 2;
-    if (candidate->DimensionModel == GAIA_XY_Z)
+}
+
+static int
+shp_ring_bucket (const struct shp_ring_index *index, double y)
+{
+/* returning the bucket containing Y [monotonic in Y] */
+    int b;
+    if (index->Buckets <= 1 || !(y > index->MinY))
+	return 0;
+    if (!(y < index->MaxY))
+	return index->Buckets - 1;
+    b = (int) (((y - index->MinY) / (index->MaxY - index->MinY)) *
+	       index->Buckets);
+    if (b >= index->Buckets)
+	b = index->Buckets - 1;
+    return b;
+}
+
+static void
+shp_ring_edge_buckets (const struct shp_ring_index *index, int i, int *b0,
+		       int *b1)
+{
+/* the range of buckets crossed by the edge ending at vertex I */
+    int j = (i == 0) ? index->Count - 1 : i - 1;
+    if (index->Y[i] <= index->Y[j])
       {
-	  gaiaGetPointXYZ (candidate->Coords, mid, &x1, &y1, &z);
+	  *b0 = shp_ring_bucket (index, index->Y[i]);
+	  *b1 = shp_ring_bucket (index, index->Y[j]);
       }
-    else if (candidate->DimensionModel == GAIA_XY_M)
+    else
       {
-	  gaiaGetPointXYM (candidate->Coords, mid, &x1, &y1, &m);
+	  *b0 = shp_ring_bucket (index, index->Y[j]);
+	  *b1 = shp_ring_bucket (index, index->Y[i]);
       }
-    else if (candidate->DimensionModel == GAIA_XY_Z_M)
+}
+
+static struct shp_ring_index *
+shp_alloc_ring_index (gaiaRingPtr ring)
+{
+/* preparing an exterior Ring for fast point-in-ring tests */
+    int i;
+    int b;
+    int b0;
+    int b1;
+    int total;
+    int *next;
+    struct shp_ring_index *index = malloc (sizeof (struct shp_ring_index));
+    index->Count = ring->Points - 1;	/* ignoring the closing vertex */
+    index->X = NULL;
+    index->Y = NULL;
+    index->Offsets = NULL;
+    index->Edges = NULL;
+    index->Buckets = 1;
+    if (index->Count < 2)
+	return index;
+
+    index->X = malloc (sizeof (double) * index->Count);
+    index->Y = malloc (sizeof (double) * index->Count);
+    index->MinX = DBL_MAX;
+    index->MinY = DBL_MAX;
+    index->MaxX = -DBL_MAX;
+    index->MaxY = -DBL_MAX;
+    for (i = 0; i < index->Count; i++)
       {
-	  gaiaGetPointXYZM (candidate->Coords, mid, &x1, &y1, &z, &m);
+	  shp_ring_vertex (ring, i, index->X + i, index->Y + i);
+	  if (index->X[i] < index->MinX)
+	      index->MinX = index->X[i];
+	  if (index->X[i] > index->MaxX)
+	      index->MaxX = index->X[i];
+	  if (index->Y[i] < index->MinY)
+	      index->MinY = index->Y[i];
+	  if (index->Y[i] > index->MaxY)
+	      index->MaxY = index->Y[i];
       }
-    else
+
+/* small Rings simply get a single bucket containing all edges */
+    if (index->Count >= SHP_PIP_MIN_POINTS)
+      {
+	  index->Buckets = index->Count / 8;
+	  total = 0;
+	  for (i = 0; i < index->Count; i++)
+	    {
+		shp_ring_edge_buckets (index, i, &b0, &b1);
+		total += b1 - b0 + 1;
+		if (total > index->Count * 16)
+		  {
+		      /* too many long edges: not worth */
+		      index->Buckets = 1;
+		      break;
+		  }
+	    }
+      }
+
+    index->Offsets = calloc (index->Buckets + 1, sizeof (int));
+    for (i = 0; i < index->Count; i++)
+      {
+	  shp_ring_edge_buckets (index, i, &b0, &b1);
+	  for (b = b0; b <= b1; b++)
+	      index->Offsets[b + 1] += 1;
+      }
+    for (b = 0; b < index->Buckets; b++)
+	index->Offsets[b + 1] += index->Offsets[b];
+    index->Edges = malloc (sizeof (int) * index->Offsets[index->Buckets]);
+    next = malloc (sizeof (int) * index->Buckets);
+    memcpy (next, index->Offsets, sizeof (int) * index->Buckets);
+    for (i = 0; i < index->Count; i++)
+      {
+	  shp_ring_edge_buckets (index, i, &b0, &b1);
+	  for (b = b0; b <= b1; b++)
+	      index->Edges[next[b]++] = i;
+      }
+    free (next);
+    return index;
+}
+
+static void
+shp_free_ring_index (struct shp_ring_index *index)
+{
+/* memory cleanup: Ring index */
+    if (index == NULL)
+	return;
+    if (index->X)
+	free (index->X);
+    if (index->Y)
+	free (index->Y);
+    if (index->Offsets)
+	free (index->Offsets);
+    if (index->Edges)
+	free (index->Edges);
+    free (index);
+}
+
+static int
+shp_point_in_ring (const struct shp_ring_index *index, double pt_x,
+		   double pt_y)
+{
+/*
+ * tests if a POINT falls inside a RING
+ * [the same crossing rule of gaiaIsPointOnRingSurface(), but only
+ * visiting the edges of the point's bucket]
+*/
+    int isInternal = 0;
+    int k;
+    int i;
+    int j;
+    int b;
+    const double *vert_x = index->X;
+    const double *vert_y = index->Y;
+    if (index->Count < 2)
+	return 0;
+    if (pt_x < index->MinX || pt_x > index->MaxX)
+	return 0;		/* outside the bounding box (x axis) */
+    if (pt_y < index->MinY || pt_y > index->MaxY)
+	return 0;		/* outside the bounding box (y axis) */
+    b = shp_ring_bucket (index, pt_y);
+    for (k = index->Offsets[b]; k < index->Offsets[b + 1]; k++)
       {
-	  gaiaGetPoint (candidate->Coords, mid, &x1, &y1);
+	  i = index->Edges[k];
+	  j = (i == 0) ? index->Count - 1 : i - 1;
+	  if ((((vert_y[i] <= pt_y) && (pt_y < vert_y[j]))
+	       || ((vert_y[j] <= pt_y) && (pt_y < vert_y[i])))
+	      && (pt_x <
+		  (vert_x[j] - vert_x[i]) * (pt_y - vert_y[i]) / (vert_y[j] -
+								  vert_y[i]) +
+		  vert_x[i]))
+	      isInternal = !isInternal;
       }
+    return isInternal;
+}
+
+static int
+shp_check_rings (const struct shp_ring_index *exterior, gaiaRingPtr candidate)
+{
+/*
+/ speditively checks if the candidate could be an interior Ring
+/ contained into the exterior Ring
+*/
+    double x0;
+    double y0;
+    double x1;
+    double y1;
+    int mid;
+    int ret0;
+    int ret1;
+    shp_ring_vertex (candidate, 0, &x0, &y0);
+    mid = candidate->Points / 2;
+    shp_ring_vertex (candidate, mid, &x1, &y1);
 
 /* testing if the first point falls on the exterior ring surface */
-    ret0 = gaiaIsPointOnRingSurface (exterior, x0, y0);
+    ret0 = shp_point_in_ring (exterior, x0, y0);
 /* testing if the second point falls on the exterior ring surface */
-    ret1 = gaiaIsPointOnRingSurface (exterior, x1, y1);
+    ret1 = shp_point_in_ring (exterior, x1, y1);
     if (ret0 || ret1)
 	return 1;
     return 0;
@@ -823,37 +1050,294 @@ shp_mbr_contains (gaiaRingPtr r1, gaiaRingPtr r2)
     return 0;
 }
 
+static int
+cmp_str_x (const void *p1, const void *p2)
+{
+/* STR packing: sorting by X center */
+    const struct shp_str_item *i1 = (const struct shp_str_item *) p1;
+    const struct shp_str_item *i2 = (const struct shp_str_item *) p2;
+    if (i1->CX < i2->CX)
+	return -1;
+    if (i1->CX > i2->CX)
+	return 1;
+    return i1->Index - i2->Index;
+}
+
+static int
+cmp_str_y (const void *p1, const void *p2)
+{
+/* STR packing: sorting by Y center */
+    const struct shp_str_item *i1 = (const struct shp_str_item *) p1;
+    const struct shp_str_item *i2 = (const struct shp_str_item *) p2;
+    if (i1->CY < i2->CY)
+	return -1;
+    if (i1->CY > i2->CY)
+	return 1;
+    return i1->Index - i2->Index;
+}
+
+static int
+cmp_ring_index (const void *p1, const void *p2)
+{
+/* sorting candidate exterior Rings in their original order */
+    return *((const int *) p1) - *((const int *) p2);
+}
+
+static void
+shp_rtree_node_mbr (struct shp_rtree_node *node, double minx, double miny,
+		    double maxx, double maxy)
+{
+/* expanding the MBR of some R-tree node */
+    if (minx < node->MinX)
+	node->MinX = minx;
+    if (miny < node->MinY)
+	node->MinY = miny;
+    if (maxx > node->MaxX)
+	node->MaxX = maxx;
+    if (maxy > node->MaxY)
+	node->MaxY = maxy;
+}
+
+static struct shp_rtree *
+shp_build_rtree (struct shp_ring_item **exteriors, int count)
+{
+/* building an STR-packed R-tree on the exterior Rings MBRs */
+    int i;
+    int k;
+    int s;
+    int leaves;
+    int slices;
+    int slice_size;
+    int max_nodes;
+    int num_nodes;
+    int level_start;
+    int level_count;
+    struct shp_str_item *items;
+    struct shp_rtree *tree = malloc (sizeof (struct shp_rtree));
+
+/* STR: sorting by X into vertical slices, then by Y within each slice */
+    items = malloc (sizeof (struct shp_str_item) * count);
+    for (i = 0; i < count; i++)
+      {
+	  gaiaRingPtr ring = exteriors[i]->Ring;
+	  items[i].Index = i;
+	  items[i].CX = (ring->MinX + ring->MaxX) / 2.0;
+	  items[i].CY = (ring->MinY + ring->MaxY) / 2.0;
+      }
+    qsort (items, count, sizeof (struct shp_str_item), cmp_str_x);
+    leaves = (count + SHP_RTREE_FANOUT - 1) / SHP_RTREE_FANOUT;
+    slices = 1;
+    while (slices * slices < leaves)
+	slices++;
+    slice_size = slices * SHP_RTREE_FANOUT;
+    for (s = 0; s < count; s += slice_size)
+      {
+	  int n = (count - s < slice_size) ? count - s : slice_size;
+	  qsort (items + s, n, sizeof (struct shp_str_item), cmp_str_y);
+      }
+    tree->Rings = malloc (sizeof (int) * count);
+    for (i = 0; i < count; i++)
+	tree->Rings[i] = items[i].Index;
+    free (items);
+
+    max_nodes = 0;
+    k = count;
+    do
+      {
+	  k = (k + SHP_RTREE_FANOUT - 1) / SHP_RTREE_FANOUT;
+	  max_nodes += k;
+      }
+    while (k > 1);
+    tree->Nodes = malloc (sizeof (struct shp_rtree_node) * max_nodes);
+
+/* packing the leaves */
+    num_nodes = 0;
+    for (i = 0; i < count; i += SHP_RTREE_FANOUT)
+      {
+	  struct shp_rtree_node *node = tree->Nodes + num_nodes++;
+	  node->First = i;
+	  node->Count = (count - i < SHP_RTREE_FANOUT) ? count - i :
+	      SHP_RTREE_FANOUT;
+	  node->IsLeaf = 1;
+	  node->MinX = DBL_MAX;
+	  node->MinY = DBL_MAX;
+	  node->MaxX = -DBL_MAX;
+	  node->MaxY = -DBL_MAX;
+	  for (k = 0; k < node->Count; k++)
+	    {
+		gaiaRingPtr ring = exteriors[tree->Rings[i + k]]->Ring;
+		shp_rtree_node_mbr (node, ring->MinX, ring->MinY, ring->MaxX,
+				    ring->MaxY);
+	    }
+      }
+/* packing the upper levels */
+    level_start = 0;
+    level_count = num_nodes;
+    while (level_count > 1)
+      {
+	  int next_start = num_nodes;
+	  for (i = 0; i < level_count; i += SHP_RTREE_FANOUT)
+	    {
+		struct shp_rtree_node *node = tree->Nodes + num_nodes++;
+		node->First = level_start + i;
+		node->Count =
+		    (level_count - i <
+		     SHP_RTREE_FANOUT) ? level_count - i : SHP_RTREE_FANOUT;
+		node->IsLeaf = 0;
+		node->MinX = DBL_MAX;
+		node->MinY = DBL_MAX;
+		node->MaxX = -DBL_MAX;
+		node->MaxY = -DBL_MAX;
+		for (k = 0; k < node->Count; k++)
+		  {
+		      struct shp_rtree_node *child =
+			  tree->Nodes + node->First + k;
+		      shp_rtree_node_mbr (node, child->MinX, child->MinY,
+					  child->MaxX, child->MaxY);
+		  }
+	    }
+	  level_start = next_start;
+	  level_count = num_nodes - next_start;
+      }
+    tree->Root = num_nodes - 1;
+    return tree;
+}
+
+static void
+shp_free_rtree (struct shp_rtree *tree)
+{
+/* memory cleanup: R-tree */
+    if (tree == NULL)
+	return;
+    free (tree->Nodes);
+    free (tree->Rings);
+    free (tree);
+}
+
+static void
+shp_rtree_query (const struct shp_rtree *tree, int node_index,
+		 struct shp_ring_item **exteriors, gaiaRingPtr ring,
+		 int *found, int *count)
+{
+/* searching all exterior Rings whose MBR contains the given Ring MBR */
+    int k;
+    const struct shp_rtree_node *node = tree->Nodes + node_index;
+    if (ring->MinX < node->MinX || ring->MaxX > node->MaxX
+	|| ring->MinY < node->MinY || ring->MaxY > node->MaxY)
+	return;
+    for (k = 0; k < node->Count; k++)
+      {
+	  if (node->IsLeaf)
+	    {
+		int idx = tree->Rings[node->First + k];
+		if (shp_mbr_contains (exteriors[idx]->Ring, ring))
+		    found[(*count)++] = idx;
+	    }
+	  else
+	      shp_rtree_query (tree, node->First + k, exteriors, ring, found,
+			       count);
+      }
+}
+
 static void
 shp_arrange_rings (struct shp_ring_collection *ringsColl)
 {
-/* 
+/*
 / arranging Rings so to associate any interior ring
 / to the containing exterior ring
+/
+/ each interior ring goes to the first exterior ring (in SHP order)
+/ containing it; candidate exteriors are found through an R-tree
+/ when there are many of them
 */
+    int i;
+    int n_ext = 0;
+    int n_int = 0;
+    int count;
+    int *found;
+    struct shp_ring_item **exteriors;
+    struct shp_ring_index **indices;
+    struct shp_rtree *tree = NULL;
     struct shp_ring_item *pInt;
     struct shp_ring_item *pExt;
+
     pExt = ringsColl->First;
     while (pExt != NULL)
       {
-	  /* looping on Exterior Rings */
 	  if (pExt->IsExterior)
+	      n_ext++;
+	  else
+	      n_int++;
+	  pExt = pExt->Next;
+      }
+    if (n_int == 0)
+	return;			/* nothing to be arranged */
+
+    if (n_ext > 0)
+      {
+	  exteriors = malloc (sizeof (struct shp_ring_item *) * n_ext);
+	  indices = calloc (n_ext, sizeof (struct shp_ring_index *));
+	  found = malloc (sizeof (int) * n_ext);
+	  i = 0;
+	  pExt = ringsColl->First;
+	  while (pExt != NULL)
 	    {
-		pInt = ringsColl->First;
-		while (pInt != NULL)
+		if (pExt->IsExterior)
+		    exteriors[i++] = pExt;
+		pExt = pExt->Next;
+	    }
+	  if (n_ext > SHP_RTREE_MIN_RINGS)
+	      tree = shp_build_rtree (exteriors, n_ext);
+
+	  pInt = ringsColl->First;
+	  while (pInt != NULL)
+	    {
+		/* looping on Interior Rings */
+		if (pInt->IsExterior)
+		  {
+		      pInt = pInt->Next;
+		      continue;
+		  }
+		count = 0;
+		if (tree != NULL)
+		  {
+		      shp_rtree_query (tree, tree->Root, exteriors, pInt->Ring,
+				       found, &count);
+		      qsort (found, count, sizeof (int), cmp_ring_index);
+		  }
+		else
+		  {
+		      for (i = 0; i < n_ext; i++)
+			{
+			    if (shp_mbr_contains
+				(exteriors[i]->Ring, pInt->Ring))
+				found[count++] = i;
+			}
+		  }
+		for (i = 0; i < count; i++)
 		  {
-		      /* looping on Interior Rings */
-		      if (pInt->IsExterior == 0 && pInt->Mother == NULL
-			  && shp_mbr_contains (pExt->Ring, pInt->Ring))
+		      int idx = found[i];
+		      if (indices[idx] == NULL)
+			  indices[idx] =
+			      shp_alloc_ring_index (exteriors[idx]->Ring);
+		      if (shp_check_rings (indices[idx], pInt->Ring))
 			{
 			    /* ok, matches */
-			    if (shp_check_rings (pExt->Ring, pInt->Ring))
-				pInt->Mother = pExt->Ring;
+			    pInt->Mother = exteriors[idx];
+			    break;
 			}
-		      pInt = pInt->Next;
 		  }
+		pInt = pInt->Next;
 	    }
-	  pExt = pExt->Next;
+
+	  for (i = 0; i < n_ext; i++)
+	      shp_free_ring_index (indices[i]);
+	  shp_free_rtree (tree);
+	  free (indices);
+	  free (exteriors);
+	  free (found);
       }
+
     pExt = ringsColl->First;
     while (pExt != NULL)
       {
@@ -870,7 +1354,6 @@ static void
 shp_build_area (struct shp_ring_collection *ringsColl, gaiaGeomCollPtr geom)
 {
 /* building the final (Multi)Polygon Geometry */
-    gaiaPolygonPtr polyg;
     struct shp_ring_item *pExt;
     struct shp_ring_item *pInt;
     pExt = ringsColl->First;
@@ -879,24 +1362,24 @@ shp_build_area (struct shp_ring_collection *ringsColl, gaiaGeomCollPtr geom)
 	  if (pExt->IsExterior)
 	    {
 		/* creating a new Polygon */
-		polyg = gaiaInsertPolygonInGeomColl (geom, pExt->Ring);
-		pInt = ringsColl->First;
-		while (pInt != NULL)
-		  {
-		      if (pExt->Ring == pInt->Mother)
-			{
-			    /* adding an interior ring to current POLYGON */
-			    gaiaAddRingToPolyg (polyg, pInt->Ring);
-			    /* releasing Ring ownership */
-			    pInt->Ring = NULL;
-			}
-		      pInt = pInt->Next;
-		  }
+		pExt->Polygon = gaiaInsertPolygonInGeomColl (geom, pExt->Ring);
 		/* releasing Ring ownership */
 		pExt->Ring = NULL;
 	    }
 	  pExt = pExt->Next;
       }
+    pInt = ringsColl->First;
+    while (pInt != NULL)
+      {
+	  if (pInt->IsExterior == 0 && pInt->Mother != NULL)
+	    {
+		/* adding an interior ring to its POLYGON */
+		gaiaAddRingToPolyg (pInt->Mother->Polygon, pInt->Ring);
+		/* releasing Ring ownership */
+		pInt->Ring = NULL;
+	    }
+	  pInt = pInt->Next;
+      }
 }
 
 static gaiaGeomCollPtr
@@ -1646,218 +2129,18 @@ do_parse_geometry (const unsigned char *bufshp, int buflen, int eff_dims,
     return NULL;
 }
 
-static int
-do_read_shp (const void *cache, const char *shp_path, int validate, int esri,
-	     int *invalid)
+static void
+do_clen_files (const char *out_path, const char *name)
 {
-/* reading some Shapefile and testing for validity */
-    int current_row;
-    gaiaShapefilePtr shp = NULL;
-    int ret;
-    double minx;
-    double miny;
-    double maxx;
-    double maxy;
-    double MinX = DBL_MAX;
-    double MinY = DBL_MAX;
-    double MaxX = 0.0 - DBL_MAX;
-    double MaxY = 0.0 - DBL_MAX;
-    double hMinX;
-    double hMinY;
-    double hMaxX;
-    double hMaxY;
-    int mismatching;
+/* removing an invalid Shapefile (not properly repaired) */
+    char path[1024];
 
-    *invalid = 0;
-    shp = allocShapefile ();
-    openShpRead (shp, shp_path, &hMinX, &hMinY, &hMaxX, &hMaxY, &mismatching);
-    if (!(shp->Valid))
-      {
-	  char extra[512];
-	  *extra = '\0';
-	  if (shp->LastError)
-	      sprintf (extra, "\n\tcause: %s\n", shp->LastError);
-	  fprintf (stderr,
-		   "\terror: cannot open shapefile '%s'%s", shp_path, extra);
-	  freeShapefile (shp);
-	  return 0;
-      }
-    if (mismatching)
-	*invalid += 1;
-
-    current_row = 0;
-    while (1)
-      {
-	  /* reading rows from shapefile */
-	  int shplen;
-	  ret =
-	      readShpEntity (shp, current_row, &shplen, &minx, &miny, &maxx,
-			     &maxy);
-	  if (ret < 0)
-	    {
-		/* found a DBF deleted record */
-		fprintf (stderr, "\t\trow #%d: logical deletion found\n",
-			 current_row);
-		current_row++;
-		*invalid += 1;
-		continue;
-	    }
-	  if (!ret)
-	    {
-		if (!(shp->LastError))	/* normal SHP EOF */
-		    break;
-		fprintf (stderr, "\tERROR: %s\n", shp->LastError);
-		goto stop;
-	    }
-
-	  if (validate)
-	    {
-		int nullshape;
-		gaiaGeomCollPtr geom =
-		    do_parse_geometry (shp->BufShp, shplen, shp->EffectiveDims,
-				       shp->EffectiveType, &nullshape);
-		if (nullshape)
-		    ;
-		else
-		  {
-		      if (geom == NULL)
-			{
-			    fprintf (stderr,
-				     "\t\trow #%d: unable to get a Geometry\n",
-				     current_row);
-			    *invalid += 1;
-			}
-		      else
-			{
-			    if (geom->MinX != minx || geom->MinY != miny
-				|| geom->MaxX != maxx || geom->MaxY != maxy)
-			      {
-				  fprintf (stderr,
-					   "\t\trow #%d: mismatching BBOX\n",
-					   current_row);
-				  *invalid += 1;
-			      }
-			    if (esri)
-			      {
-				  /* checking invalid geometries in ESRI mode */
-				  gaiaGeomCollPtr detail;
-				  detail =
-				      gaiaIsValidDetailEx_r (cache, geom, 1);
-				  if (detail == NULL)
-				    {
-					/* extra checks */
-					int extra = 0;
-					if (gaiaIsToxic_r (cache, geom))
-					    extra = 1;
-					if (gaiaIsNotClosedGeomColl_r
-					    (cache, geom))
-					    extra = 1;
-					if (extra)
-					  {
-					      char *reason =
-						  gaiaIsValidReason_r (cache,
-								       geom);
-					      if (reason == NULL)
-						  fprintf (stderr,
-							   "\t\trow #%d: invalid Geometry (unknown reason)\n",
-							   current_row);
-					      else
-						{
-						    fprintf (stderr,
-							     "\t\trow #%d: %s\n",
-							     current_row,
-							     reason);
-						    free (reason);
-						}
-					      *invalid += 1;
-					  }
-				    }
-				  else
-				    {
-					char *reason =
-					    gaiaIsValidReason_r (cache, geom);
-					if (reason == NULL)
-					    fprintf (stderr,
-						     "\t\trow #%d: invalid Geometry (unknown reason)\n",
-						     current_row);
-					else
-					  {
-					      fprintf (stderr,
-						       "\t\trow #%d: %s\n",
-						       current_row, reason);
-					      free (reason);
-					  }
-					*invalid += 1;
-					gaiaFreeGeomColl (detail);
-				    }
-			      }
-			    else
-			      {
-				  /* checking invalid geometries in ISO/OGC mode */
-				  if (gaiaIsValid_r (cache, geom) != 1)
-				    {
-					char *reason =
-					    gaiaIsValidReason_r (cache, geom);
-					if (reason == NULL)
-					    fprintf (stderr,
-						     "\t\trow #%d: invalid Geometry (unknown reason)\n",
-						     current_row);
-					else
-					  {
-					      fprintf (stderr,
-						       "\t\trow #%d: %s\n",
-						       current_row, reason);
-					      free (reason);
-					  }
-					*invalid += 1;
-				    }
-			      }
-			    gaiaFreeGeomColl (geom);
-			}
-		  }
-	    }
-	  if (minx != DBL_MAX && miny != DBL_MAX && maxx != DBL_MAX
-	      && maxy != DBL_MAX)
-	    {
-		if (minx < MinX)
-		    MinX = minx;
-		if (miny < MinY)
-		    MinY = miny;
-		if (maxx > MaxX)
-		    MaxX = maxx;
-		if (maxy > MaxY)
-		    MaxY = maxy;
-	    }
-	  current_row++;
-      }
-    freeShapefile (shp);
-
-    if (MinX != hMinX || MinY != hMinY || MaxX != hMaxX || MaxY != hMaxY)
-      {
-	  fprintf (stderr, "\t\tHEADERS: found invalid BBOX\n");
-	  *invalid += 1;
-      }
-
-    return 1;
-
-  stop:
-    freeShapefile (shp);
-    fprintf (stderr, "\tMalformed shapefile: quitting\n");
-    return 0;
-}
-
-static void
-do_clen_files (const char *out_path, const char *name)
-{
-/* removing an invalid Shapefile (not properly repaired) */
-    char path[1024];
-
-    sprintf (path, "%s/%s.shx", out_path, name);
-#ifdef _WIN32
-    _unlink (path);
-#else
-    unlink (path);
-#endif
+    sprintf (path, "%s/%s.shx", out_path, name);
+#ifdef _WIN32
+    _unlink (path);
+#else
+    unlink (path);
+#endif
 
     sprintf (path, "%s/%s.shp", out_path, name);
 #ifdef _WIN32
@@ -3669,280 +3952,1616 @@ do_export_geometry (gaiaGeomCollPtr geom, unsigned char **bufshp, int *buflen,
     return 0;
 }
 
-static int
-do_repair_shapefile (const void *cache, const char *shp_path,
-		     const char *out_path, int validate, int esri, int force,
-		     int *repair_failed)
+struct shp_entity
 {
-/* repairing some Shapefile */
-    int current_row;
-    gaiaShapefilePtr shp_in = NULL;
-    gaiaShapefilePtr shp_out = NULL;
-    int ret;
-    gaiaDbfListPtr dbf_list = NULL;
-    gaiaDbfFieldPtr in_fld;
+/* a SHP entity travelling through the validation pipeline */
+    int row;
+    int deleted;
+    const unsigned char *bufshp;	/* pointing into the mapped SHP */
+    int shplen;
+    const unsigned char *bufdbf;	/* pointing into the mapped DBF */
     double minx;
     double miny;
     double maxx;
     double maxy;
-    double hMinX;
-    double hMinY;
-    double hMaxX;
-    double hMaxY;
-    int mismatching;
+    unsigned char *outshp;
+    int outlen;
+    int invalid;
+    int repair_failed;
+    int fatal;
+    char *messages;
+    int error_class;
+    int repair;
+    char *detail;		/* for the machine-readable report */
+    double seconds;
+    int status;
+};
 
-    *repair_failed = 0;
+struct shp_pipeline
+{
+/*
+ * the reader / workers / writer pipeline
+ *
+ * the slots are a circular reorder buffer: the reader fills them
+ * in row order, the worker threads validate/repair them concurrently
+ * and the writer always gets them back in their original row order
+*/
+    gaiaShapefilePtr shp_in;
+    struct shp_reader reader;
+    const void *cache;
+    FILE *log;
+    int repair;
+    int validate;
+    int esri;
+    int process;
+    int out_dims;
+    int current_row;
+    int eof;
+    int error;
+    struct shp_entity *slots;
+    int size;
+    int head;
+    int tail;
+    int next;
+    int count;
+    int to_claim;
+    int quit;
+    int count_threads;
+#ifndef _WIN32
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_ready;
+    pthread_cond_t cond_done;
+#endif
+};
 
-/* opening the INPUT SHP */
-    shp_in = allocShapefile ();
-    openShpRead (shp_in, shp_path, &hMinX, &hMinY, &hMaxX, &hMaxY,
-		 &mismatching);
-    if (!(shp_in->Valid))
+static double
+entity_time (void)
+{
+/* wall-clock time in seconds [timing the entities] */
+#if defined(_WIN32)
+    struct _timeb tb;
+    _ftime (&tb);
+    return (double) tb.time + ((double) tb.millitm / 1000.0);
+#else
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (double) tv.tv_sec + ((double) tv.tv_usec / 1000000.0);
+#endif
+}
+
+static void
+entity_message (struct shp_entity *ent, const char *fmt, ...)
+{
+/* appending a message to be printed when the entity will be written */
+    char *msg;
+    char *prev = ent->messages;
+    va_list ap;
+
+    va_start (ap, fmt);
+    msg = sqlite3_vmprintf (fmt, ap);
+    va_end (ap);
+    if (prev == NULL)
+	ent->messages = msg;
+    else
       {
-	  char extra[512];
-	  *extra = '\0';
-	  if (shp_in->LastError)
-	      sprintf (extra, "\n\t\tcause: %s\n", shp_in->LastError);
-	  fprintf (stderr,
-		   "\t\terror: cannot open shapefile '%s'%s", shp_path, extra);
-	  freeShapefile (shp_in);
-	  return 0;
+	  ent->messages = sqlite3_mprintf ("%s%s", prev, msg);
+	  sqlite3_free (prev);
+	  sqlite3_free (msg);
       }
+}
 
-/* preparing the DBF fields list - OUTPUT */
-    dbf_list = gaiaAllocDbfList ();
-    in_fld = shp_in->Dbf->First;
-    while (in_fld)
+static void
+entity_class (struct shp_entity *ent, int error_class, const char *detail)
+{
+/* classifying the entity [only the first error found is retained] */
+    if (ent->error_class != CLASS_VALID)
+	return;
+    ent->error_class = error_class;
+    if (detail != NULL)
+	ent->detail = sqlite3_mprintf ("%s", detail);
+}
+
+static void
+entity_detail (struct shp_entity *ent, const char *fmt, ...)
+{
+/* explaining why the entity couldn't be repaired */
+    va_list ap;
+
+    sqlite3_free (ent->detail);
+    va_start (ap, fmt);
+    ent->detail = sqlite3_vmprintf (fmt, ap);
+    va_end (ap);
+}
+
+static void
+entity_invalid_reason (const void *cache, struct shp_entity *ent,
+		       gaiaGeomCollPtr geom)
+{
+/* reporting why some entity is invalid */
+    char *reason = gaiaIsValidReason_r (cache, geom);
+    if (reason == NULL)
+	entity_message (ent,
+			"\t\trow #%d: invalid Geometry (unknown reason)\n",
+			ent->row);
+    else
+	entity_message (ent, "\t\trow #%d: %s\n", ent->row, reason);
+    entity_class (ent, CLASS_INVALID, reason);
+    if (reason != NULL)
+	free (reason);
+    ent->invalid += 1;
+}
+
+static void
+do_check_entity (const void *cache, struct shp_pipeline *pipeline,
+		 struct shp_entity *ent)
+{
+/* testing a single entity for validity */
+    int nullshape;
+    gaiaShapefilePtr shp = pipeline->shp_in;
+    gaiaGeomCollPtr geom =
+	do_parse_geometry (ent->bufshp, ent->shplen, shp->EffectiveDims,
+			   shp->EffectiveType, &nullshape);
+    if (nullshape)
       {
-	  /* adding a DBF field - OUTPUT */
-	  gaiaAddDbfField (dbf_list, in_fld->Name, in_fld->Type, in_fld->Offset,
-			   in_fld->Length, in_fld->Decimals);
-	  in_fld = in_fld->Next;
+	  entity_class (ent, CLASS_NULL, NULL);
+	  return;
       }
-
-/* creating the OUTPUT SHP */
-    shp_out = allocShapefile ();
-    openShpWrite (shp_out, out_path, shp_in->Shape, dbf_list);
-    if (!(shp_out->Valid))
+    if (geom == NULL)
       {
-	  char extra[512];
-	  *extra = '\0';
-	  if (shp_out->LastError)
-	      sprintf (extra, "\n\t\tcause: %s\n", shp_out->LastError);
-	  fprintf (stderr,
-		   "\t\terror: cannot open shapefile '%s'%s", out_path, extra);
-	  freeShapefile (shp_in);
-	  freeShapefile (shp_out);
-	  gaiaFreeDbfList (dbf_list);
-	  return 0;
+	  entity_message (ent, "\t\trow #%d: unable to get a Geometry\n",
+			  ent->row);
+	  entity_class (ent, CLASS_UNPARSABLE, NULL);
+	  ent->invalid += 1;
+	  return;
       }
 
-    current_row = 0;
-    while (1)
+    if (geom->MinX != ent->minx || geom->MinY != ent->miny
+	|| geom->MaxX != ent->maxx || geom->MaxY != ent->maxy)
       {
-	  /* reading rows from shapefile */
-	  int shplen;
-	  ret =
-	      readShpEntity (shp_in, current_row, &shplen, &minx, &miny, &maxx,
-			     &maxy);
-	  if (ret < 0)
+	  entity_message (ent, "\t\trow #%d: mismatching BBOX\n", ent->row);
+	  entity_class (ent, CLASS_BBOX, NULL);
+	  ent->invalid += 1;
+      }
+    if (pipeline->esri)
+      {
+	  /* checking invalid geometries in ESRI mode */
+	  gaiaGeomCollPtr detail;
+	  detail = gaiaIsValidDetailEx_r (cache, geom, 1);
+	  if (detail == NULL)
 	    {
-		/* found a DBF deleted record */
-		current_row++;
-		continue;
+		/* extra checks */
+		int extra = 0;
+		if (gaiaIsToxic_r (cache, geom))
+		    extra = 1;
+		if (gaiaIsNotClosedGeomColl_r (cache, geom))
+		    extra = 1;
+		if (extra)
+		    entity_invalid_reason (cache, ent, geom);
 	    }
-	  if (!ret)
+	  else
 	    {
-		if (!(shp_in->LastError))	/* normal SHP EOF */
-		    break;
-		fprintf (stderr, "\t\tERROR: %s\n", shp_in->LastError);
-		goto stop;
+		entity_invalid_reason (cache, ent, geom);
+		gaiaFreeGeomColl (detail);
 	    }
-	  if (validate || force)
+      }
+    else
+      {
+	  /* checking invalid geometries in ISO/OGC mode */
+	  if (gaiaIsValid_r (cache, geom) != 1)
+	      entity_invalid_reason (cache, ent, geom);
+      }
+    gaiaFreeGeomColl (geom);
+}
+
+static void
+do_repair_entity (const void *cache, struct shp_pipeline *pipeline,
+		  struct shp_entity *ent)
+{
+/* attempting to rearrange a single entity */
+    int nullshape;
+    gaiaShapefilePtr shp_in = pipeline->shp_in;
+    gaiaGeomCollPtr geom =
+	do_parse_geometry (ent->bufshp, ent->shplen, shp_in->EffectiveDims,
+			   shp_in->EffectiveType, &nullshape);
+    if (nullshape)
+      {
+	  entity_class (ent, CLASS_NULL, NULL);
+	  goto default_null;
+      }
+    if (geom == NULL)
+      {
+	  entity_message (ent, "\t\tinput row #%d: unexpected NULL geometry\n",
+			  ent->row);
+	  entity_class (ent, CLASS_UNPARSABLE, NULL);
+	  ent->repair = REPAIR_FAILED;
+	  ent->repair_failed = 1;
+	  goto default_null;
+      }
+
+    if (pipeline->validate)
+      {
+	  /* testing for invalid Geometries */
+	  int is_invalid = 0;
+	  if (pipeline->esri)
 	    {
-		/* attempting to rearrange geometries */
-		unsigned char *bufshp;
-		int buflen;
-		int nullshape;
-		gaiaGeomCollPtr geom =
-		    do_parse_geometry (shp_in->BufShp, shplen,
-				       shp_in->EffectiveDims,
-				       shp_in->EffectiveType, &nullshape);
-		if (nullshape)
-		    goto default_null;
-		if (geom == NULL)
+		/* checking invalid geometries in ESRI mode */
+		gaiaGeomCollPtr detail;
+		detail = gaiaIsValidDetailEx_r (cache, geom, 1);
+		if (detail == NULL)
 		  {
-		      fprintf (stderr,
-			       "\t\tinput row #%d: unexpected NULL geometry\n",
-			       current_row);
-		      *repair_failed = 1;
-		      goto default_null;
+		      /* extra checks */
+		      int extra = 0;
+		      if (gaiaIsToxic_r (cache, geom))
+			  extra = 1;
+		      if (gaiaIsNotClosedGeomColl_r (cache, geom))
+			  extra = 1;
+		      if (extra)
+			  is_invalid = 1;
 		  }
-
-		if (validate)
+		else
 		  {
-		      /* testing for invalid Geometries */
-		      int is_invalid = 0;
-		      if (esri)
-			{
-			    /* checking invalid geometries in ESRI mode */
-			    gaiaGeomCollPtr detail;
-			    detail = gaiaIsValidDetailEx_r (cache, geom, 1);
-			    if (detail == NULL)
-			      {
-				  /* extra checks */
-				  int extra = 0;
-				  if (gaiaIsToxic_r (cache, geom))
-				      extra = 1;
-				  if (gaiaIsNotClosedGeomColl_r (cache, geom))
-				      extra = 1;
-				  if (extra)
-				      is_invalid = 1;
-			      }
-			    else
-			      {
-				  is_invalid = 1;
-				  gaiaFreeGeomColl (detail);
-			      }
-			}
-		      else
-			{
-			    /* checking invalid geometries in ISO/OGC mode */
-			    if (gaiaIsValid_r (cache, geom) != 1)
-				is_invalid = 1;
-			}
+		      is_invalid = 1;
+		      gaiaFreeGeomColl (detail);
+		  }
+	    }
+	  else
+	    {
+		/* checking invalid geometries in ISO/OGC mode */
+		if (gaiaIsValid_r (cache, geom) != 1)
+		    is_invalid = 1;
+	    }
 
+	  if (is_invalid)
+	      entity_class (ent, CLASS_INVALID, NULL);
 #ifdef ENABLE_RTTOPO		/* only if RTTOPO is enabled */
-		      if (is_invalid)
-			{
-			    /* attempting to repair an invalid Geometry */
-			    char *expected;
-			    char *actual;
-			    gaiaGeomCollPtr discarded;
-			    gaiaGeomCollPtr result =
-				gaiaMakeValid (cache, geom);
-			    if (result == NULL)
-			      {
-				  fprintf (stderr,
-					   "\t\tinput row #%d: unexpected MakeValid failure\n",
-					   current_row);
-				  gaiaFreeGeomColl (geom);
-				  *repair_failed = 1;
-				  goto default_null;
-			      }
-			    discarded = gaiaMakeValidDiscarded (cache, geom);
-			    if (discarded != NULL)
-			      {
-				  fprintf (stderr,
-					   "\t\tinput row #%d: MakeValid reports discarded elements\n",
-					   current_row);
-				  gaiaFreeGeomColl (result);
-				  gaiaFreeGeomColl (discarded);
-				  gaiaFreeGeomColl (geom);
-				  *repair_failed = 1;
-				  goto default_null;
-			      }
-			    if (!check_geometry_verbose
-				(result, shp_in->Shape, &expected, &actual))
-			      {
-				  fprintf (stderr,
-					   "\t\tinput row #%d: MakeValid returned an invalid SHAPE (expected %s, got %s)\n",
-					   current_row, expected, actual);
-				  free (expected);
-				  free (actual);
-				  gaiaFreeGeomColl (result);
-				  gaiaFreeGeomColl (geom);
-				  *repair_failed = 1;
-				  goto default_null;
-			      }
-			    gaiaFreeGeomColl (geom);
-			    geom = result;
-			}
-#endif /* end RTTOPO conditional */
-
-		      if (!do_export_geometry
-			  (geom, &bufshp, &buflen, shp_in->Shape,
-			   current_row, shp_out->EffectiveDims))
-			{
-			    gaiaFreeGeomColl (geom);
-			    goto stop;
-			}
+	  if (is_invalid)
+	    {
+		/* attempting to repair an invalid Geometry */
+		char *expected;
+		char *actual;
+		gaiaGeomCollPtr discarded;
+		gaiaGeomCollPtr result = gaiaMakeValid (cache, geom);
+		if (result == NULL)
+		  {
+		      entity_message (ent,
+				      "\t\tinput row #%d: unexpected MakeValid failure\n",
+				      ent->row);
+		      entity_detail (ent, "unexpected MakeValid failure");
 		      gaiaFreeGeomColl (geom);
+		      ent->repair = REPAIR_FAILED;
+		      ent->repair_failed = 1;
+		      goto default_null;
 		  }
-		else
+		discarded = gaiaMakeValidDiscarded (cache, geom);
+		if (discarded != NULL)
 		  {
-		      if (!do_export_geometry
-			  (geom, &bufshp, &buflen, shp_in->Shape,
-			   current_row, shp_out->EffectiveDims))
-			{
-			    gaiaFreeGeomColl (geom);
-			    goto stop;
-			}
+		      entity_message (ent,
+				      "\t\tinput row #%d: MakeValid reports discarded elements\n",
+				      ent->row);
+		      entity_detail (ent,
+				     "MakeValid reports discarded elements");
+		      ent->repair = REPAIR_FAILED;
+		      gaiaFreeGeomColl (result);
+		      gaiaFreeGeomColl (discarded);
+		      gaiaFreeGeomColl (geom);
+		      ent->repair_failed = 1;
+		      goto default_null;
+		  }
+		if (!check_geometry_verbose
+		    (result, shp_in->Shape, &expected, &actual))
+		  {
+		      entity_message (ent,
+				      "\t\tinput row #%d: MakeValid returned an invalid SHAPE (expected %s, got %s)\n",
+				      ent->row, expected, actual);
+		      entity_detail (ent,
+				     "MakeValid returned an invalid SHAPE (expected %s, got %s)",
+				     expected, actual);
+		      ent->repair = REPAIR_FAILED;
+		      free (expected);
+		      free (actual);
+		      gaiaFreeGeomColl (result);
 		      gaiaFreeGeomColl (geom);
+		      ent->repair_failed = 1;
+		      goto default_null;
 		  }
-		goto ok_geom;
-
-	      default_null:
-		/* exporting a NULL shape */
-		do_export_geometry
-		    (NULL, &bufshp, &buflen, shp_in->Shape,
-		     current_row, shp_out->EffectiveDims);
-
-	      ok_geom:
-		ret = writeShpEntity
-		    (shp_out, bufshp, buflen, shp_in->BufDbf,
-		     shp_in->DbfReclen);
-		free (bufshp);
-		if (!ret)
-		    goto stop;
-	    }
-	  else
-	    {
-		/* passing geometries exactly as they were */
-		if (!writeShpEntity
-		    (shp_out, shp_in->BufShp, shplen, shp_in->BufDbf,
-		     shp_in->DbfReclen))
-		    goto stop;
+		gaiaFreeGeomColl (geom);
+		geom = result;
+		ent->repair = REPAIR_REPAIRED;
 	    }
-	  current_row++;
+#endif /* end RTTOPO conditional */
       }
-    gaiaFlushShpHeaders (shp_out);
-    freeShapefile (shp_in);
-    freeShapefile (shp_out);
-    return 1;
 
-  stop:
-    freeShapefile (shp_in);
-    freeShapefile (shp_out);
-    fprintf (stderr,
-	     "\t\tMalformed shapefile, impossible to repair: quitting\n");
-    return 0;
+    if (!do_export_geometry
+	(geom, &(ent->outshp), &(ent->outlen), shp_in->Shape, ent->row,
+	 pipeline->out_dims))
+      {
+	  ent->repair = REPAIR_FAILED;
+	  ent->fatal = 1;
+      }
+    gaiaFreeGeomColl (geom);
+    return;
+
+  default_null:
+    /* exporting a NULL shape */
+    do_export_geometry (NULL, &(ent->outshp), &(ent->outlen), shp_in->Shape,
+			ent->row, pipeline->out_dims);
 }
 
-static int
-do_test_shapefile (const void *cache, const char *shp_path, int validate,
-		   int esri, int *invalid)
+static void
+do_process_entity (const void *cache, struct shp_pipeline *pipeline,
+		   struct shp_entity *ent)
 {
-/* testing a Shapefile for validity */
-    int n_invalid;
-
-    fprintf (stderr, "\nVerifying %s.shp\n", shp_path);
-    *invalid = 0;
-    if (!do_read_shp (cache, shp_path, validate, esri, &n_invalid))
-	return 0;
-    if (n_invalid)
-      {
-	  fprintf (stderr, "\tfound %d invalidit%s: cleaning required.\n",
-		   n_invalid, (n_invalid > 1) ? "ies" : "y");
-	  *invalid = 1;
-      }
+/* validating or repairing a single entity */
+    double start;
+    if (ent->deleted || !(pipeline->process))
+	return;
+    start = entity_time ();
+    if (pipeline->repair)
+	do_repair_entity (cache, pipeline, ent);
     else
-	fprintf (stderr, "\tfound to be already valid.\n");
-    return 1;
+	do_check_entity (cache, pipeline, ent);
+    ent->seconds = entity_time () - start;
 }
 
-static int
-check_extension (const char *file_name)
+#ifndef _WIN32
+static void *
+shp_pipeline_worker (void *arg)
+{
+/* worker thread: processing entities until the pipeline quits */
+    struct shp_pipeline *pipeline = (struct shp_pipeline *) arg;
+    const void *cache = spatialite_alloc_connection ();
+    spatialite_set_silent_mode (cache);
+
+    while (1)
+      {
+	  struct shp_entity *ent;
+	  pthread_mutex_lock (&(pipeline->mutex));
+	  while (!(pipeline->quit) && pipeline->to_claim == 0)
+	      pthread_cond_wait (&(pipeline->cond_ready), &(pipeline->mutex));
+	  if (pipeline->quit)
+	    {
+		pthread_mutex_unlock (&(pipeline->mutex));
+		break;
+	    }
+	  /* claiming the next entity in row order */
+	  ent = pipeline->slots + pipeline->next;
+	  pipeline->next = (pipeline->next + 1) % pipeline->size;
+	  pipeline->to_claim -= 1;
+	  pthread_mutex_unlock (&(pipeline->mutex));
+
+	  do_process_entity (cache, pipeline, ent);
+
+	  pthread_mutex_lock (&(pipeline->mutex));
+	  ent->status = ENTITY_DONE;
+	  pthread_cond_signal (&(pipeline->cond_done));
+	  pthread_mutex_unlock (&(pipeline->mutex));
+      }
+
+    spatialite_cleanup_ex (cache);
+    return NULL;
+}
+#endif
+
+static struct shp_pipeline *
+alloc_shp_pipeline (gaiaShapefilePtr shp_in, const void *cache, int repair,
+		    int validate, int esri, int force, int out_dims,
+		    int threads, FILE * log)
+{
+/* creating the validation pipeline [and starting the worker threads] */
+    int i;
+    struct shp_pipeline *pipeline = malloc (sizeof (struct shp_pipeline));
+    if (!shp_reader_open
+	(&(pipeline->reader), shp_in->flShx, shp_in->flShp, shp_in->flDbf,
+	 shp_in->DbfHdsz, shp_in->DbfReclen))
+      {
+	  fprintf (log, "\t\terror: unable to map '%s' into memory\n",
+		   shp_in->Path);
+	  free (pipeline);
+	  return NULL;
+      }
+    pipeline->shp_in = shp_in;
+    pipeline->cache = cache;
+    pipeline->log = log;
+    pipeline->repair = repair;
+    pipeline->validate = validate;
+    pipeline->esri = esri;
+    if (repair)
+	pipeline->process = (validate || force) ? 1 : 0;
+    else
+	pipeline->process = validate;
+    pipeline->out_dims = out_dims;
+    pipeline->current_row = 0;
+    pipeline->eof = 0;
+    pipeline->error = 0;
+    pipeline->head = 0;
+    pipeline->tail = 0;
+    pipeline->next = 0;
+    pipeline->count = 0;
+    pipeline->to_claim = 0;
+    pipeline->quit = 0;
+    pipeline->count_threads = 0;
+#ifdef _WIN32
+    threads = 1;
+#endif
+    if (!(pipeline->process))
+	threads = 1;		/* nothing worth to be done in parallel */
+    pipeline->size = (threads > 1) ? threads * 16 : 1;
+    pipeline->slots = malloc (sizeof (struct shp_entity) * pipeline->size);
+    for (i = 0; i < pipeline->size; i++)
+      {
+	  struct shp_entity *ent = pipeline->slots + i;
+	  ent->row = -1;
+	  ent->deleted = 0;
+	  ent->bufshp = NULL;
+	  ent->shplen = 0;
+	  ent->bufdbf = NULL;
+	  ent->outshp = NULL;
+	  ent->outlen = 0;
+	  ent->messages = NULL;
+	  ent->detail = NULL;
+	  ent->status = ENTITY_EMPTY;
+      }
+
+#ifndef _WIN32
+    pipeline->threads = NULL;
+    if (threads > 1)
+      {
+	  pthread_mutex_init (&(pipeline->mutex), NULL);
+	  pthread_cond_init (&(pipeline->cond_ready), NULL);
+	  pthread_cond_init (&(pipeline->cond_done), NULL);
+	  pipeline->threads = malloc (sizeof (pthread_t) * threads);
+	  for (i = 0; i < threads; i++)
+	    {
+		if (pthread_create
+		    (pipeline->threads + i, NULL, shp_pipeline_worker,
+		     pipeline) != 0)
+		    break;
+		pipeline->count_threads += 1;
+	    }
+	  /* if no thread could be started the main thread will do all the work */
+      }
+#endif
+    return pipeline;
+}
+
+static void
+free_shp_pipeline (struct shp_pipeline *pipeline)
+{
+/* stopping the worker threads and destroying the pipeline */
+    int i;
+    if (pipeline == NULL)
+	return;
+
+#ifndef _WIN32
+    if (pipeline->threads != NULL)
+      {
+	  pthread_mutex_lock (&(pipeline->mutex));
+	  pipeline->quit = 1;
+	  pthread_cond_broadcast (&(pipeline->cond_ready));
+	  pthread_mutex_unlock (&(pipeline->mutex));
+	  for (i = 0; i < pipeline->count_threads; i++)
+	      pthread_join (pipeline->threads[i], NULL);
+	  free (pipeline->threads);
+	  pthread_cond_destroy (&(pipeline->cond_ready));
+	  pthread_cond_destroy (&(pipeline->cond_done));
+	  pthread_mutex_destroy (&(pipeline->mutex));
+      }
+#endif
+
+    for (i = 0; i < pipeline->size; i++)
+      {
+	  struct shp_entity *ent = pipeline->slots + i;
+	  if (ent->outshp != NULL)
+	      free (ent->outshp);
+	  sqlite3_free (ent->messages);
+      }
+    free (pipeline->slots);
+    shp_reader_close (&(pipeline->reader));
+    free (pipeline);
+}
+
+static int
+do_read_entity (struct shp_pipeline *pipeline, struct shp_entity *ent)
+{
+/* reading the next row from the input shapefile into a free slot */
+    int ret;
+    gaiaShapefilePtr shp = pipeline->shp_in;
+
+    ret =
+	readShpEntity (shp, &(pipeline->reader), pipeline->current_row,
+		       &(ent->bufshp), &(ent->bufdbf), &(ent->shplen),
+		       &(ent->minx), &(ent->miny), &(ent->maxx), &(ent->maxy));
+    if (!ret)
+      {
+	  pipeline->eof = 1;
+	  if (shp->LastError)
+	      pipeline->error = 1;
+	  return 0;
+      }
+
+    ent->row = pipeline->current_row;
+    ent->invalid = 0;
+    ent->repair_failed = 0;
+    ent->fatal = 0;
+    ent->outshp = NULL;
+    ent->outlen = 0;
+    ent->messages = NULL;
+    ent->deleted = (ret < 0) ? 1 : 0;
+    if (ent->deleted)
+      {
+	  /* no SHP record has been read */
+	  ent->bufshp = NULL;
+	  ent->shplen = 0;
+      }
+    ent->error_class = ent->deleted ? CLASS_DELETED : CLASS_VALID;
+    if (pipeline->repair)
+	ent->repair = ent->deleted ? REPAIR_DROPPED : REPAIR_UNCHANGED;
+    else
+	ent->repair = REPAIR_NONE;
+    ent->detail = NULL;
+    ent->seconds = 0.0;
+    pipeline->current_row += 1;
+    return 1;
+}
+
+static struct shp_entity *
+next_shp_entity (struct shp_pipeline *pipeline)
+{
+/*
+ * returning the next processed entity in row order, reading ahead
+ * as many rows as the reorder buffer can hold
+ * NULL means EOF [or a read error, if pipeline->error is set]
+*/
+    struct shp_entity *ent;
+
+    while (!(pipeline->eof) && pipeline->count < pipeline->size)
+      {
+	  ent = pipeline->slots + pipeline->tail;
+	  if (!do_read_entity (pipeline, ent))
+	      break;
+#ifndef _WIN32
+	  if (pipeline->count_threads > 0)
+	    {
+		/* handing over the entity to the worker threads */
+		pthread_mutex_lock (&(pipeline->mutex));
+		ent->status = ENTITY_READY;
+		pipeline->to_claim += 1;
+		pthread_cond_signal (&(pipeline->cond_ready));
+		pthread_mutex_unlock (&(pipeline->mutex));
+	    }
+#endif
+	  if (pipeline->count_threads == 0)
+	      ent->status = ENTITY_READY;
+	  pipeline->tail = (pipeline->tail + 1) % pipeline->size;
+	  pipeline->count += 1;
+      }
+    if (pipeline->count == 0)
+	return NULL;
+
+    ent = pipeline->slots + pipeline->head;
+#ifndef _WIN32
+    if (pipeline->count_threads > 0)
+      {
+	  /* waiting until the oldest entity has been processed */
+	  pthread_mutex_lock (&(pipeline->mutex));
+	  while (ent->status != ENTITY_DONE)
+	      pthread_cond_wait (&(pipeline->cond_done), &(pipeline->mutex));
+	  pthread_mutex_unlock (&(pipeline->mutex));
+      }
+#endif
+    if (ent->status != ENTITY_DONE)
+      {
+	  do_process_entity (pipeline->cache, pipeline, ent);
+	  ent->status = ENTITY_DONE;
+      }
+    if (ent->messages != NULL)
+	fprintf (pipeline->log, "%s", ent->messages);
+    return ent;
+}
+
+static void
+release_shp_entity (struct shp_pipeline *pipeline, struct shp_entity *ent)
+{
+/* the writer is done with the oldest entity: freeing its slot */
+    if (ent->outshp != NULL)
+	free (ent->outshp);
+    ent->outshp = NULL;
+    sqlite3_free (ent->messages);
+    ent->messages = NULL;
+    sqlite3_free (ent->detail);
+    ent->detail = NULL;
+    ent->status = ENTITY_EMPTY;
+    pipeline->head = (pipeline->head + 1) % pipeline->size;
+    pipeline->count -= 1;
+}
+
+struct shp_report
+{
+/* the machine-readable validation report [CSV or JSON lines] */
+    FILE *out;
+    int json;
+#ifndef _WIN32
+    pthread_mutex_t mutex;
+#endif
+};
+
+struct shp_report_buffer
+{
+/*
+ * the report lines of a single Shapefile
+ *
+ * lines are accumulated by the writer and appended to the report
+ * in large blocks, so that concurrent jobs never mix their lines
+*/
+    struct shp_report *report;
+    char *path;
+    const char *phase;		/* "check" or "repair" */
+    char *buf;
+    int len;
+    int size;
+};
+
+static const char *
+report_class_name (int error_class)
+{
+/* returning the name of some error class */
+    switch (error_class)
+      {
+      case CLASS_DELETED:
+	  return "deleted";
+      case CLASS_NULL:
+	  return "null_shape";
+      case CLASS_UNPARSABLE:
+	  return "unparsable";
+      case CLASS_BBOX:
+	  return "bbox_mismatch";
+      case CLASS_INVALID:
+	  return "invalid_geometry";
+      };
+    return "valid";
+}
+
+static const char *
+report_repair_name (int repair)
+{
+/* returning the name of some repair outcome */
+    switch (repair)
+      {
+      case REPAIR_UNCHANGED:
+	  return "unchanged";
+      case REPAIR_REPAIRED:
+	  return "repaired";
+      case REPAIR_FAILED:
+	  return "failed";
+      case REPAIR_DROPPED:
+	  return "dropped";
+      };
+    return "";
+}
+
+static const char *
+report_shape_name (int shape)
+{
+/* returning the name of some SHP shape type */
+    switch (shape)
+      {
+      case GAIA_SHP_NULL:
+	  return "Null";
+      case GAIA_SHP_POINT:
+	  return "Point";
+      case GAIA_SHP_POINTZ:
+	  return "PointZ";
+      case GAIA_SHP_POINTM:
+	  return "PointM";
+      case GAIA_SHP_POLYLINE:
+	  return "PolyLine";
+      case GAIA_SHP_POLYLINEZ:
+	  return "PolyLineZ";
+      case GAIA_SHP_POLYLINEM:
+	  return "PolyLineM";
+      case GAIA_SHP_POLYGON:
+	  return "Polygon";
+      case GAIA_SHP_POLYGONZ:
+	  return "PolygonZ";
+      case GAIA_SHP_POLYGONM:
+	  return "PolygonM";
+      case GAIA_SHP_MULTIPOINT:
+	  return "MultiPoint";
+      case GAIA_SHP_MULTIPOINTZ:
+	  return "MultiPointZ";
+      case GAIA_SHP_MULTIPOINTM:
+	  return "MultiPointM";
+      };
+    return "Unknown";
+}
+
+static int
+report_vertices (const unsigned char *bufshp, int shplen, int shape,
+		 int endian_arch)
+{
+/* counting the vertices declared by some SHP record */
+    int count = 0;
+    switch (shape)
+      {
+      case GAIA_SHP_POINT:
+      case GAIA_SHP_POINTZ:
+      case GAIA_SHP_POINTM:
+	  return 1;
+      case GAIA_SHP_MULTIPOINT:
+      case GAIA_SHP_MULTIPOINTZ:
+      case GAIA_SHP_MULTIPOINTM:
+	  if (shplen >= 40)
+	      count = gaiaImport32 (bufshp + 36, GAIA_LITTLE_ENDIAN,
+				    endian_arch);
+	  break;
+      case GAIA_SHP_POLYLINE:
+      case GAIA_SHP_POLYLINEZ:
+      case GAIA_SHP_POLYLINEM:
+      case GAIA_SHP_POLYGON:
+      case GAIA_SHP_POLYGONZ:
+      case GAIA_SHP_POLYGONM:
+	  if (shplen >= 44)
+	      count = gaiaImport32 (bufshp + 40, GAIA_LITTLE_ENDIAN,
+				    endian_arch);
+	  break;
+      };
+    return (count < 0) ? 0 : count;
+}
+
+static int
+open_report (struct shp_report *report, const char *path)
+{
+/* creating the report file [the format depends on the suffix] */
+    int len = strlen (path);
+    report->json = 0;
+    if (len > 5 && strcasecmp (path + len - 5, ".json") == 0)
+	report->json = 1;
+    if (len > 6 && strcasecmp (path + len - 6, ".jsonl") == 0)
+	report->json = 1;
+    report->out = fopen (path, "wb");
+    if (report->out == NULL)
+	return 0;
+    if (!(report->json))
+	fprintf (report->out,
+		 "file,phase,row,shape_type,error_class,vertices,repair,microseconds,detail\n");
+#ifndef _WIN32
+    pthread_mutex_init (&(report->mutex), NULL);
+#endif
+    return 1;
+}
+
+static void
+close_report (struct shp_report *report)
+{
+/* finalizing the report file */
+    fclose (report->out);
+#ifndef _WIN32
+    pthread_mutex_destroy (&(report->mutex));
+#endif
+}
+
+static void
+report_append (struct shp_report_buffer *rb, const char *str, int len)
+{
+/* appending some text to the report buffer */
+    if (rb->len + len > rb->size)
+      {
+	  int size = rb->size * 2;
+	  if (size < 65536)
+	      size = 65536;
+	  while (size < rb->len + len)
+	      size *= 2;
+	  rb->buf = realloc (rb->buf, size);
+	  rb->size = size;
+      }
+    memcpy (rb->buf + rb->len, str, len);
+    rb->len += len;
+}
+
+static void
+report_append_json (struct shp_report_buffer *rb, const char *str)
+{
+/* appending a JSON string [quoted and escaped] */
+    char hex[8];
+    const char *p;
+    report_append (rb, "\"", 1);
+    for (p = str; *p != '\0'; p++)
+      {
+	  unsigned char c = (unsigned char) *p;
+	  if (c == '"' || c == '\\')
+	    {
+		hex[0] = '\\';
+		hex[1] = c;
+		report_append (rb, hex, 2);
+	    }
+	  else if (c < 0x20)
+	    {
+		sprintf (hex, "\\u%04x", c);
+		report_append (rb, hex, 6);
+	    }
+	  else
+	      report_append (rb, p, 1);
+      }
+    report_append (rb, "\"", 1);
+}
+
+static void
+report_flush (struct shp_report_buffer *rb)
+{
+/* writing the buffered lines into the report file */
+    if (rb->report == NULL || rb->len == 0)
+	return;
+#ifndef _WIN32
+    pthread_mutex_lock (&(rb->report->mutex));
+#endif
+    fwrite (rb->buf, 1, rb->len, rb->report->out);
+#ifndef _WIN32
+    pthread_mutex_unlock (&(rb->report->mutex));
+#endif
+    rb->len = 0;
+}
+
+static void
+init_report_buffer (struct shp_report_buffer *rb, struct shp_report *report,
+		    const char *shp_path, const char *phase)
+{
+/* preparing to report the entities of some Shapefile */
+    rb->report = report;
+    rb->path = NULL;
+    rb->phase = phase;
+    if (report != NULL)
+	rb->path = sqlite3_mprintf ("%s.shp", shp_path);
+    rb->buf = NULL;
+    rb->len = 0;
+    rb->size = 0;
+}
+
+static void
+free_report_buffer (struct shp_report_buffer *rb)
+{
+/* flushing and releasing the report buffer */
+    report_flush (rb);
+    sqlite3_free (rb->path);
+    if (rb->buf != NULL)
+	free (rb->buf);
+}
+
+static void
+report_entity (struct shp_report_buffer *rb,
+	       const struct shp_pipeline *pipeline,
+	       const struct shp_entity *ent)
+{
+/* adding the outcome of some entity to the report */
+    char *line;
+    int shape;
+    const char *shape_name = NULL;	/* no SHP record [deleted] */
+    int vertices = 0;
+    int endian_arch = pipeline->reader.endian_arch;
+    sqlite3_int64 usec;
+    const char *detail = (ent->detail != NULL) ? ent->detail : "";
+
+    if (rb->report == NULL)
+	return;
+    if (ent->bufshp != NULL && ent->shplen >= 4)
+      {
+	  shape = gaiaImport32 (ent->bufshp, GAIA_LITTLE_ENDIAN, endian_arch);
+	  shape_name = report_shape_name (shape);
+	  vertices =
+	      report_vertices (ent->bufshp, ent->shplen, shape, endian_arch);
+      }
+    usec = (sqlite3_int64) (ent->seconds * 1000000.0 + 0.5);
+    if (rb->report->json)
+      {
+	  report_append (rb, "{\"file\":", 8);
+	  report_append_json (rb, rb->path);
+	  line =
+	      sqlite3_mprintf (",\"phase\":\"%s\",\"row\":%d,\"shape_type\":",
+			       rb->phase, ent->row);
+	  report_append (rb, line, strlen (line));
+	  sqlite3_free (line);
+	  if (shape_name == NULL)
+	      report_append (rb, "null", 4);
+	  else
+	      report_append_json (rb, shape_name);
+	  line =
+	      sqlite3_mprintf (",\"error_class\":\"%s\",\"vertices\":%d,"
+			       "\"repair\":",
+			       report_class_name (ent->error_class), vertices);
+	  report_append (rb, line, strlen (line));
+	  sqlite3_free (line);
+	  if (ent->repair == REPAIR_NONE)
+	      report_append (rb, "null", 4);
+	  else
+	      report_append_json (rb, report_repair_name (ent->repair));
+	  line = sqlite3_mprintf (",\"microseconds\":%lld,\"detail\":", usec);
+	  report_append (rb, line, strlen (line));
+	  sqlite3_free (line);
+	  if (ent->detail == NULL)
+	      report_append (rb, "null", 4);
+	  else
+	      report_append_json (rb, ent->detail);
+	  report_append (rb, "}\n", 2);
+      }
+    else
+      {
+	  /* CSV: text values are quoted, inner quotes doubled */
+	  line =
+	      sqlite3_mprintf ("\"%w\",%s,%d,%s,%s,%d,%s,%lld,\"%w\"\n",
+			       rb->path, rb->phase, ent->row,
+			       (shape_name != NULL) ? shape_name : "",
+			       report_class_name (ent->error_class), vertices,
+			       report_repair_name (ent->repair), usec, detail);
+	  report_append (rb, line, strlen (line));
+	  sqlite3_free (line);
+      }
+    if (rb->len >= 65536)
+	report_flush (rb);
+}
+
+static int
+do_read_shp (const void *cache, const char *shp_path, int validate, int esri,
+	     int threads, int *invalid, struct shp_report *report, FILE * log)
+{
+/* reading some Shapefile and testing for validity */
+    gaiaShapefilePtr shp = NULL;
+    struct shp_pipeline *pipeline = NULL;
+    struct shp_entity *ent;
+    struct shp_report_buffer rb;
+    double MinX = DBL_MAX;
+    double MinY = DBL_MAX;
+    double MaxX = 0.0 - DBL_MAX;
+    double MaxY = 0.0 - DBL_MAX;
+    double hMinX;
+    double hMinY;
+    double hMaxX;
+    double hMaxY;
+    int mismatching;
+
+    *invalid = 0;
+    shp = allocShapefile ();
+    openShpRead (shp, shp_path, &hMinX, &hMinY, &hMaxX, &hMaxY, &mismatching, log);
+    if (!(shp->Valid))
+      {
+	  char extra[512];
+	  *extra = '\0';
+	  if (shp->LastError)
+	      sprintf (extra, "\n\tcause: %s\n", shp->LastError);
+	  fprintf (log,
+		   "\terror: cannot open shapefile '%s'%s", shp_path, extra);
+	  freeShapefile (shp);
+	  return 0;
+      }
+    if (mismatching)
+	*invalid += 1;
+
+    init_report_buffer (&rb, report, shp_path, "check");
+    pipeline = alloc_shp_pipeline (shp, cache, 0, validate, esri, 0, 0,
+				   threads, log);
+    if (pipeline == NULL)
+	goto stop;
+    while (1)
+      {
+	  /* reading rows from shapefile */
+	  ent = next_shp_entity (pipeline);
+	  if (ent == NULL)
+	    {
+		if (!(pipeline->error))	/* normal SHP EOF */
+		    break;
+		fprintf (log, "\tERROR: %s\n", shp->LastError);
+		goto stop;
+	    }
+	  if (ent->deleted)
+	    {
+		/* found a DBF deleted record */
+		fprintf (log, "\t\trow #%d: logical deletion found\n",
+			 ent->row);
+		*invalid += 1;
+		report_entity (&rb, pipeline, ent);
+		release_shp_entity (pipeline, ent);
+		continue;
+	    }
+	  *invalid += ent->invalid;
+	  if (ent->minx != DBL_MAX && ent->miny != DBL_MAX
+	      && ent->maxx != DBL_MAX && ent->maxy != DBL_MAX)
+	    {
+		if (ent->minx < MinX)
+		    MinX = ent->minx;
+		if (ent->miny < MinY)
+		    MinY = ent->miny;
+		if (ent->maxx > MaxX)
+		    MaxX = ent->maxx;
+		if (ent->maxy > MaxY)
+		    MaxY = ent->maxy;
+	    }
+	  report_entity (&rb, pipeline, ent);
+	  release_shp_entity (pipeline, ent);
+      }
+    free_shp_pipeline (pipeline);
+    free_report_buffer (&rb);
+    freeShapefile (shp);
+
+    if (MinX != hMinX || MinY != hMinY || MaxX != hMaxX || MaxY != hMaxY)
+      {
+	  fprintf (log, "\t\tHEADERS: found invalid BBOX\n");
+	  *invalid += 1;
+      }
+
+    return 1;
+
+  stop:
+    free_shp_pipeline (pipeline);
+    free_report_buffer (&rb);
+    freeShapefile (shp);
+    fprintf (log, "\tMalformed shapefile: quitting\n");
+    return 0;
+}
+
+static int
+do_repair_shapefile (const void *cache, const char *shp_path,
+		     const char *out_path, int validate, int esri, int force,
+		     int threads, int *repair_failed, struct shp_report *report,
+		     FILE * log)
+{
+/* repairing some Shapefile */
+    gaiaShapefilePtr shp_in = NULL;
+    gaiaShapefilePtr shp_out = NULL;
+    struct shp_pipeline *pipeline = NULL;
+    struct shp_entity *ent;
+    struct shp_report_buffer rb;
+    int ret;
+    gaiaDbfListPtr dbf_list = NULL;
+    gaiaDbfFieldPtr in_fld;
+    double hMinX;
+    double hMinY;
+    double hMaxX;
+    double hMaxY;
+    int mismatching;
+
+    *repair_failed = 0;
+
+/* opening the INPUT SHP */
+    shp_in = allocShapefile ();
+    openShpRead (shp_in, shp_path, &hMinX, &hMinY, &hMaxX, &hMaxY,
+		 &mismatching, log);
+    if (!(shp_in->Valid))
+      {
+	  char extra[512];
+	  *extra = '\0';
+	  if (shp_in->LastError)
+	      sprintf (extra, "\n\t\tcause: %s\n", shp_in->LastError);
+	  fprintf (log,
+		   "\t\terror: cannot open shapefile '%s'%s", shp_path, extra);
+	  freeShapefile (shp_in);
+	  return 0;
+      }
+
+/* preparing the DBF fields list - OUTPUT */
+    dbf_list = gaiaAllocDbfList ();
+    in_fld = shp_in->Dbf->First;
+    while (in_fld)
+      {
+	  /* adding a DBF field - OUTPUT */
+	  gaiaAddDbfField (dbf_list, in_fld->Name, in_fld->Type, in_fld->Offset,
+			   in_fld->Length, in_fld->Decimals);
+	  in_fld = in_fld->Next;
+      }
+
+/* creating the OUTPUT SHP */
+    shp_out = allocShapefile ();
+    openShpWrite (shp_out, out_path, shp_in->Shape, dbf_list);
+    if (!(shp_out->Valid))
+      {
+	  char extra[512];
+	  *extra = '\0';
+	  if (shp_out->LastError)
+	      sprintf (extra, "\n\t\tcause: %s\n", shp_out->LastError);
+	  fprintf (log,
+		   "\t\terror: cannot open shapefile '%s'%s", out_path, extra);
+	  freeShapefile (shp_in);
+	  freeShapefile (shp_out);
+	  gaiaFreeDbfList (dbf_list);
+	  return 0;
+      }
+
+    init_report_buffer (&rb, report, shp_path, "repair");
+    pipeline =
+	alloc_shp_pipeline (shp_in, cache, 1, validate, esri, force,
+			    shp_out->EffectiveDims, threads, log);
+    if (pipeline == NULL)
+	goto stop;
+    while (1)
+      {
+	  /* writing rows in their original order */
+	  ent = next_shp_entity (pipeline);
+	  if (ent == NULL)
+	    {
+		if (!(pipeline->error))	/* normal SHP EOF */
+		    break;
+		fprintf (log, "\t\tERROR: %s\n", shp_in->LastError);
+		goto stop;
+	    }
+	  report_entity (&rb, pipeline, ent);
+	  if (ent->deleted)
+	    {
+		/* found a DBF deleted record */
+		release_shp_entity (pipeline, ent);
+		continue;
+	    }
+	  if (ent->fatal)
+	      goto stop;
+	  if (ent->repair_failed)
+	      *repair_failed = 1;
+	  if (pipeline->process)
+	      ret =
+		  writeShpEntity (shp_out, ent->outshp, ent->outlen,
+				  ent->bufdbf, shp_in->DbfReclen);
+	  else
+	    {
+		/* passing geometries exactly as they were */
+		ret =
+		    writeShpEntity (shp_out, ent->bufshp, ent->shplen,
+				    ent->bufdbf, shp_in->DbfReclen);
+	    }
+	  release_shp_entity (pipeline, ent);
+	  if (!ret)
+	      goto stop;
+      }
+    free_shp_pipeline (pipeline);
+    free_report_buffer (&rb);
+    gaiaFlushShpHeaders (shp_out);
+    freeShapefile (shp_in);
+    freeShapefile (shp_out);
+    return 1;
+
+  stop:
+    free_shp_pipeline (pipeline);
+    free_report_buffer (&rb);
+    freeShapefile (shp_in);
+    freeShapefile (shp_out);
+    fprintf (log,
+	     "\t\tMalformed shapefile, impossible to repair: quitting\n");
+    return 0;
+}
+
+static int
+do_test_shapefile (const void *cache, const char *shp_path, int validate,
+		   int esri, int threads, int *invalid, struct shp_report *report,
+		   FILE * log)
+{
+/* testing a Shapefile for validity */
+    int n_invalid;
+
+    fprintf (log, "\nVerifying %s.shp\n", shp_path);
+    *invalid = 0;
+    if (!do_read_shp
+	(cache, shp_path, validate, esri, threads, &n_invalid, report, log))
+	return 0;
+    if (n_invalid)
+      {
+	  fprintf (log, "\tfound %d invalidit%s: cleaning required.\n",
+		   n_invalid, (n_invalid > 1) ? "ies" : "y");
+	  *invalid = 1;
+      }
+    else
+	fprintf (log, "\tfound to be already valid.\n");
+    return 1;
+}
+
+static int
+copy_mapped_file (const struct shp_mapped_file *map, size_t offset,
+		  size_t length, FILE * out)
+{
+/* copying a mapped region into some output file */
+    if (length == 0)
+	return 1;
+    if (shp_mapped_ptr (map, offset, length) == NULL)
+	return 0;
+    if (fwrite (map->base + offset, 1, length, out) != length)
+	return 0;
+    return 1;
+}
+
+static int
+do_rebuild_shapefile (const char *shp_path, const char *out_path, int force,
+		      int *invalid, FILE * log)
+{
+/*
+ * fast path: rebuilding the SHX index [and the SHP header]
+ *
+ * the SHP is sequentially walked just once and then copied as it is,
+ * no geometry being parsed at all; the DBF is copied unchanged
+ *
+ * dropping trailing bytes, finding no record at all or not matching
+ * the DBF marks the Shapefile as INVALID and is a failure, unless FORCE
+*/
+    char path[1024];
+    unsigned char header[100];
+    struct shp_mapped_file map_shp;
+    struct shp_mapped_file map_dbf;
+    struct shp_index_summary summary;
+    FILE *fl_shp = NULL;
+    FILE *fl_dbf = NULL;
+    FILE *out = NULL;
+    int dbf_recno;
+    int doubtful = 0;
+    int ret = 0;
+    map_shp.base = NULL;
+    map_dbf.base = NULL;
+    *invalid = 1;
+
+    fprintf (log, "\nRebuilding the SHX index of %s.shp\n", shp_path);
+    sprintf (path, "%s.shp", shp_path);
+    fl_shp = fopen (path, "rb");
+    if (fl_shp == NULL || !shp_map_file (&map_shp, fl_shp))
+	goto stop;
+    sprintf (path, "%s.dbf", shp_path);
+    fl_dbf = fopen (path, "rb");
+    if (fl_dbf == NULL || !shp_map_file (&map_dbf, fl_dbf))
+	goto stop;
+    if (map_shp.size < 100 || map_dbf.size < 32)
+	goto stop;
+
+/* writing the fresh SHX */
+    sprintf (path, "%s.shx", out_path);
+    out = fopen (path, "wb");
+    if (out == NULL)
+	goto stop;
+    if (!shp_rebuild_index (&map_shp, out, header, &summary))
+	goto stop;
+    if (fclose (out) != 0)
+      {
+	  out = NULL;
+	  goto stop;
+      }
+
+/* copying the SHP, fixing its header */
+    sprintf (path, "%s.shp", out_path);
+    out = fopen (path, "wb");
+    if (out == NULL)
+	goto stop;
+    if (fwrite (header, 1, 100, out) != 100)
+	goto stop;
+    if (!copy_mapped_file
+	(&map_shp, 100, summary.content_length - 100, out))
+	goto stop;
+    if (fclose (out) != 0)
+      {
+	  out = NULL;
+	  goto stop;
+      }
+
+/* copying the DBF */
+    sprintf (path, "%s.dbf", out_path);
+    out = fopen (path, "wb");
+    if (out == NULL)
+	goto stop;
+    if (!copy_mapped_file (&map_dbf, 0, map_dbf.size, out))
+	goto stop;
+    if (fclose (out) != 0)
+      {
+	  out = NULL;
+	  goto stop;
+      }
+    out = NULL;
+
+    fprintf (log, "\tfound %d record%s [%d NULL shape%s]\n",
+	     summary.records, (summary.records > 1) ? "s" : "",
+	     summary.null_shapes, (summary.null_shapes > 1) ? "s" : "");
+    if (summary.trailing > 0)
+      {
+	  fprintf (log,
+		   "\tWARNING: %llu trailing bytes not containing any valid record have been dropped\n",
+		   (unsigned long long) (summary.trailing));
+	  doubtful = 1;
+      }
+    if (summary.records == 0)
+      {
+	  fprintf (log, "\tWARNING: no valid SHP record found\n");
+	  doubtful = 1;
+      }
+    dbf_recno =
+	gaiaImport32 (map_dbf.base + 4, GAIA_LITTLE_ENDIAN, gaiaEndianArch ());
+    if (dbf_recno != summary.records)
+      {
+	  fprintf (log, "\tWARNING: the DBF contains %d entities\n", dbf_recno);
+	  doubtful = 1;
+      }
+    *invalid = doubtful;
+    if (doubtful && !force)
+	fprintf (log, "\tthe rebuilt Shapefile is not reliable "
+		 "[use -force to keep it anyway]\n");
+    else
+	ret = 1;
+
+  stop:
+    if (out != NULL)
+	fclose (out);
+    shp_unmap_file (&map_shp);
+    shp_unmap_file (&map_dbf);
+    if (fl_shp != NULL)
+	fclose (fl_shp);
+    if (fl_dbf != NULL)
+	fclose (fl_dbf);
+    return ret;
+}
+
+static int
+do_check_shapefile (const void *cache, struct shp_entry *p_shp,
+		    const char *out_dir, int validate, int esri, int force,
+		    int rebuild_shx, int threads, struct shp_report *report,
+		    FILE * log)
+{
+/* testing [and possibly repairing] a single Shapefile */
+    int invalid;
+    if (rebuild_shx)
+      {
+	  /* just rebuilding the SHX, no geometry being checked */
+	  char *out_path = sqlite3_mprintf ("%s/%s", out_dir,
+					    p_shp->file_name);
+	  p_shp->tested = 1;
+	  if (do_rebuild_shapefile
+	      (p_shp->base_name, out_path, force, &invalid, log))
+	    {
+		p_shp->repaired = 1;
+		fprintf (log, "\tOK, SHX successfully rebuilt: %s.shx\n",
+			 out_path);
+	    }
+	  else
+	    {
+		do_clen_files (out_dir, p_shp->file_name);
+		p_shp->repair_failed = 1;
+		fprintf (log, "\tFAILURE: unable to rebuild the SHX.\n");
+	    }
+	  p_shp->invalid = invalid;
+	  sqlite3_free (out_path);
+	  return 1;
+      }
+    if (!do_test_shapefile
+	(cache, p_shp->base_name, validate, esri, threads, &invalid, report,
+	 log))
+	return 0;
+    p_shp->tested = 1;
+    p_shp->invalid = invalid;
+    if ((invalid || force) && out_dir != NULL)
+      {
+	  /* attempting to repair */
+	  int repair_failed;
+	  int ret;
+	  char *out_path = sqlite3_mprintf ("%s/%s", out_dir,
+					    p_shp->file_name);
+	  fprintf (log, "\tAttempting to repair: %s.shp\n", out_path);
+	  ret =
+	      do_repair_shapefile (cache, p_shp->base_name, out_path,
+				   validate, esri, force, threads,
+				   &repair_failed, report, log);
+	  sqlite3_free (out_path);
+	  if (!ret)
+	      return 0;
+	  if (repair_failed)
+	    {
+		do_clen_files (out_dir, p_shp->base_name);
+		p_shp->repair_failed = 1;
+		fprintf (log,
+			 "\tFAILURE: automatic repair is impossible, manual repair required.\n");
+	    }
+	  else
+	    {
+		p_shp->repaired = 1;
+		fprintf (log, "\tOK, successfully repaired.\n");
+	    }
+      }
+    return 1;
+}
+
+#ifndef _WIN32
+struct shp_jobs
+{
+/*
+ * the queue of Shapefiles shared by the job threads
+ *
+ * the queue is sorted by decreasing size, so that the largest files
+ * are started first and can't end up being the tail of the whole run;
+ * each idle job simply claims the next Shapefile in the queue
+*/
+    struct shp_entry **queue;
+    int count;
+    int next;
+    int quit;
+    const char *out_dir;
+    int validate;
+    int esri;
+    int force;
+    int rebuild_shx;
+    int threads;
+    struct shp_report *report;
+    pthread_mutex_t mutex;
+};
+
+static int
+cmp_shp_size (const void *p1, const void *p2)
+{
+/* sorting Shapefiles by decreasing size */
+    const struct shp_entry *e1 = *((const struct shp_entry **) p1);
+    const struct shp_entry *e2 = *((const struct shp_entry **) p2);
+    if (e1->size > e2->size)
+	return -1;
+    if (e1->size < e2->size)
+	return 1;
+    return 0;
+}
+
+static void *
+shp_jobs_worker (void *arg)
+{
+/* a job thread: checking Shapefiles until the queue is exhausted */
+    struct shp_jobs *jobs = (struct shp_jobs *) arg;
+    struct shp_entry *p_shp;
+    FILE *log;
+    char *report;
+    size_t report_len;
+    int ret;
+    void *cache = spatialite_alloc_connection ();
+    spatialite_set_silent_mode (cache);
+
+    while (1)
+      {
+	  p_shp = NULL;
+	  pthread_mutex_lock (&(jobs->mutex));
+	  if (!(jobs->quit) && jobs->next < jobs->count)
+	    {
+		p_shp = jobs->queue[jobs->next];
+		jobs->next += 1;
+	    }
+	  pthread_mutex_unlock (&(jobs->mutex));
+	  if (p_shp == NULL)
+	      break;
+
+	  /* buffering the report, so that it can't interleave with others */
+	  report = NULL;
+	  report_len = 0;
+	  log = open_memstream (&report, &report_len);
+	  ret =
+	      do_check_shapefile (cache, p_shp, jobs->out_dir, jobs->validate,
+				  jobs->esri, jobs->force, jobs->rebuild_shx,
+				  jobs->threads,
+				  jobs->report, (log != NULL) ? log : stderr);
+	  if (log != NULL)
+	      fclose (log);
+
+	  pthread_mutex_lock (&(jobs->mutex));
+	  if (report != NULL)
+	      fprintf (stderr, "%s", report);
+	  if (!ret)
+	      jobs->quit = 1;
+	  pthread_mutex_unlock (&(jobs->mutex));
+	  free (report);
+      }
+
+    spatialite_cleanup_ex (cache);
+    return NULL;
+}
+#endif
+
+static int
+do_check_shapefiles (const void *cache, struct shp_list *list,
+		     const char *out_dir, int validate, int esri, int force,
+		     int rebuild_shx, int threads, int jobs,
+		     struct shp_report *report)
+{
+/* checking all Shapefiles found in the input directory */
+    struct shp_entry *p_shp;
+    int count = 0;
+
+    p_shp = list->first;
+    while (p_shp != NULL)
+      {
+	  if (test_valid_shp (p_shp, rebuild_shx))
+	      count++;
+	  p_shp = p_shp->next;
+      }
+    if (jobs > count)
+	jobs = count;
+
+#ifndef _WIN32
+    if (jobs > 1)
+      {
+	  /* checking many Shapefiles at once */
+	  struct shp_jobs queue;
+	  pthread_t *workers;
+	  int started = 0;
+	  int i;
+	  queue.queue = malloc (sizeof (struct shp_entry *) * count);
+	  queue.count = 0;
+	  p_shp = list->first;
+	  while (p_shp != NULL)
+	    {
+		if (test_valid_shp (p_shp, rebuild_shx))
+		    queue.queue[queue.count++] = p_shp;
+		p_shp = p_shp->next;
+	    }
+	  qsort (queue.queue, queue.count, sizeof (struct shp_entry *),
+		 cmp_shp_size);
+	  queue.next = 0;
+	  queue.quit = 0;
+	  queue.out_dir = out_dir;
+	  queue.validate = validate;
+	  queue.esri = esri;
+	  queue.force = force;
+	  queue.rebuild_shx = rebuild_shx;
+	  queue.threads = threads;
+	  queue.report = report;
+	  pthread_mutex_init (&(queue.mutex), NULL);
+	  workers = malloc (sizeof (pthread_t) * jobs);
+	  for (i = 0; i < jobs; i++)
+	    {
+		if (pthread_create
+		    (workers + started, NULL, shp_jobs_worker, &queue) != 0)
+		    break;
+		started++;
+	    }
+	  if (started == 0)
+	    {
+		/* unable to start any thread: doing all the work here */
+		shp_jobs_worker (&queue);
+	    }
+	  for (i = 0; i < started; i++)
+	      pthread_join (workers[i], NULL);
+	  free (workers);
+	  pthread_mutex_destroy (&(queue.mutex));
+	  free (queue.queue);
+	  return queue.quit ? 0 : 1;
+      }
+#endif
+
+    p_shp = list->first;
+    while (p_shp != NULL)
+      {
+	  if (test_valid_shp (p_shp, rebuild_shx))
+	    {
+		if (!do_check_shapefile
+		    (cache, p_shp, out_dir, validate, esri, force,
+		     rebuild_shx, threads, report, stderr))
+		    return 0;
+	    }
+	  p_shp = p_shp->next;
+      }
+    return 1;
+}
+
+static void
+do_print_summary (struct shp_list *list)
+{
+/*
+ * printing the outcome of each Shapefile in directory order
+ * [the individual reports of concurrent jobs come in completion order]
+*/
+    struct shp_entry *p_shp;
+    const char *outcome;
+
+    fprintf (stderr, "\n===========================================\n");
+    fprintf (stderr, "Summary:\n");
+    p_shp = list->first;
+    while (p_shp != NULL)
+      {
+	  if (p_shp->tested)
+	    {
+		if (p_shp->repair_failed)
+		    outcome = "manual repair required";
+		else if (p_shp->repaired)
+		    outcome = "repaired";
+		else if (p_shp->invalid)
+		    outcome = "cleaning required";
+		else
+		    outcome = "valid";
+		fprintf (stderr, "\t%s.shp: %s\n", p_shp->file_name, outcome);
+	    }
+	  p_shp = p_shp->next;
+      }
+}
+
+static int
+check_extension (const char *file_name)
 {
 /* checks the file extension */
     const char *mark = NULL;
@@ -3969,7 +5588,8 @@ check_extension (const char *file_name)
 static int
 do_scan_dir (const void *cache, const char *in_dir, const char *out_dir,
 	     int *n_shp, int *r_shp, int *x_shp, int validate, int esri,
-	     int force)
+	     int force, int rebuild_shx, int threads, int jobs,
+	     struct shp_report *report)
 {
 /* scanning a directory and searching for Shapefiles to be checked */
     struct shp_entry *p_shp;
@@ -3998,7 +5618,8 @@ do_scan_dir (const void *cache, const char *in_dir, const char *out_dir,
 		      len = strlen (name);
 		      name[len - 4] = '\0';
 		      path = sqlite3_mprintf ("%s/%s", in_dir, name);
-		      do_add_shapefile (list, path, name, SUFFIX_SHP);
+		      do_add_shapefile (list, path, name, SUFFIX_SHP,
+					c_file.size);
 		  }
 		if (_findnext (hFile, &c_file) != 0)
 		    break;
@@ -4017,7 +5638,8 @@ do_scan_dir (const void *cache, const char *in_dir, const char *out_dir,
 			    len = strlen (name);
 			    name[len - 4] = '\0';
 			    path = sqlite3_mprintf ("%s/%s", in_dir, name);
-			    do_add_shapefile (list, path, name, SUFFIX_SHX);
+			    do_add_shapefile (list, path, name, SUFFIX_SHX,
+					      c_file.size);
 			}
 		      if (_findnext (hFile, &c_file) != 0)
 			  break;
@@ -4038,7 +5660,7 @@ do_scan_dir (const void *cache, const char *in_dir, const char *out_dir,
 				  path =
 				      sqlite3_mprintf ("%s/%s", in_dir, name);
 				  do_add_shapefile (list, path, name,
-						    SUFFIX_DBF);
+						    SUFFIX_DBF, c_file.size);
 			      }
 			    if (_findnext (hFile, &c_file) != 0)
 				break;
@@ -4052,6 +5674,8 @@ do_scan_dir (const void *cache, const char *in_dir, const char *out_dir,
     char *path;
     char *name;
     struct dirent *entry;
+    struct stat st;
+    sqlite3_int64 size;
     int len;
     int suffix;
     DIR *dir = opendir (in_dir);
@@ -4067,59 +5691,40 @@ do_scan_dir (const void *cache, const char *in_dir, const char *out_dir,
 	  if (suffix == SUFFIX_DISCARD)
 	      continue;
 	  path = sqlite3_mprintf ("%s/%s", in_dir, entry->d_name);
+	  size = 0;
+	  if (stat (path, &st) == 0)
+	      size = st.st_size;
 	  len = strlen (path);
 	  path[len - 4] = '\0';
 	  name = sqlite3_mprintf ("%s", entry->d_name);
 	  len = strlen (name);
 	  name[len - 4] = '\0';
-	  do_add_shapefile (list, path, name, suffix);
+	  do_add_shapefile (list, path, name, suffix, size);
       }
     closedir (dir);
 #endif
 
+    if (!do_check_shapefiles
+	(cache, list, out_dir, validate, esri, force, rebuild_shx, threads,
+	 jobs, report))
+	goto error;
+
+/* collecting the results */
     p_shp = list->first;
     while (p_shp != NULL)
       {
-	  if (test_valid_shp (p_shp))
+	  if (p_shp->tested)
 	    {
-		int invalid;
-		if (!do_test_shapefile
-		    (cache, p_shp->base_name, validate, esri, &invalid))
-		    goto error;
 		*n_shp += 1;
-		if (invalid)
+		if (p_shp->invalid)
 		    *x_shp += 1;
-		if ((invalid || force) && out_dir != NULL)
-		  {
-		      /* attempting to repair */
-		      int repair_failed;
-		      int ret;
-		      char *out_path = sqlite3_mprintf ("%s/%s", out_dir,
-							p_shp->file_name);
-		      fprintf (stderr, "\tAttempting to repair: %s.shp\n",
-			       out_path);
-		      ret =
-			  do_repair_shapefile (cache, p_shp->base_name,
-					       out_path, validate, esri, force,
-					       &repair_failed);
-		      sqlite3_free (out_path);
-		      if (!ret)
-			  goto error;
-		      if (repair_failed)
-			{
-			    do_clen_files (out_dir, p_shp->base_name);
-			    fprintf (stderr,
-				     "\tFAILURE: automatic repair is impossible, manual repair required.\n");
-			}
-		      else
-			{
-			    *r_shp += 1;
-			    fprintf (stderr, "\tOK, successfully repaired.\n");
-			}
-		  }
+		if (p_shp->repaired)
+		    *r_shp += 1;
 	    }
 	  p_shp = p_shp->next;
       }
+    if (jobs > 1)
+	do_print_summary (list);
 
     free_shp_list (list);
     return 1;
@@ -4163,7 +5768,19 @@ do_help ()
 	     "======================= optional args ===========================\n"
 	     "-geom or --invalid-geoms          checks for invalid Geometries\n"
 	     "-esri or --esri-flag              tolerates ESRI-like inner holes\n"
-	     "-force or --force-repair          unconditionally repair\n\n");
+	     "-force or --force-repair          unconditionally repair\n"
+	     "-shx or --rebuild-shx             just rebuilding the SHX index\n"
+	     "                                  [and fixing the SHP header]\n"
+	     "                                  without checking geometries\n"
+	     "-threads or --threads  num        validating/repairing geometries\n"
+	     "                                  by using <num> parallel threads\n"
+	     "-jobs or --jobs        num        checking up to <num> Shapefiles\n"
+	     "                                  at the same time\n"
+	     "-report or --report    path       writing a per-entity report:\n"
+	     "                                  JSON lines if <path> ends by\n"
+	     "                                  .json or .jsonl, CSV otherwise;\n"
+	     "                                  a repaired Shapefile is reported\n"
+	     "                                  twice [phase: check, repair]\n\n");
 }
 
 int
@@ -4178,9 +5795,14 @@ main (int argc, char *argv[])
     int validate = 0;
     int esri = 0;
     int force = 0;
+    int rebuild_shx = 0;
     int n_shp = 0;
     int r_shp = 0;
     int x_shp = 0;
+    int threads = 1;
+    int jobs = 1;
+    const char *report_path = NULL;
+    struct shp_report report;
     const void *cache;
 
     for (i = 1; i < argc; i++)
@@ -4196,6 +5818,15 @@ main (int argc, char *argv[])
 		  case ARG_OUT_DIR:
 		      out_dir = argv[i];
 		      break;
+		  case ARG_THREADS:
+		      threads = atoi (argv[i]);
+		      break;
+		  case ARG_JOBS:
+		      jobs = atoi (argv[i]);
+		      break;
+		  case ARG_REPORT:
+		      report_path = argv[i];
+		      break;
 		  };
 		next_arg = ARG_NONE;
 		continue;
@@ -4224,6 +5855,24 @@ main (int argc, char *argv[])
 		next_arg = ARG_OUT_DIR;
 		continue;
 	    }
+	  if (strcasecmp (argv[i], "-threads") == 0
+	      || strcasecmp (argv[i], "--threads") == 0)
+	    {
+		next_arg = ARG_THREADS;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "-jobs") == 0
+	      || strcasecmp (argv[i], "--jobs") == 0)
+	    {
+		next_arg = ARG_JOBS;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "-report") == 0
+	      || strcasecmp (argv[i], "--report") == 0)
+	    {
+		next_arg = ARG_REPORT;
+		continue;
+	    }
 	  if (strcasecmp (argv[i], "-geom") == 0
 	      || strcasecmp (argv[i], "--invalid-geoms") == 0)
 	    {
@@ -4242,6 +5891,12 @@ main (int argc, char *argv[])
 		force = 1;
 		continue;
 	    }
+	  if (strcasecmp (argv[i], "-shx") == 0
+	      || strcasecmp (argv[i], "--rebuild-shx") == 0)
+	    {
+		rebuild_shx = 1;
+		continue;
+	    }
 	  fprintf (stderr, "unknown argument: %s\n", argv[i]);
 	  error = 1;
       }
@@ -4256,6 +5911,22 @@ main (int argc, char *argv[])
 	  fprintf (stderr, "did you forget setting the --in-dir argument ?\n");
 	  error = 1;
       }
+    if (threads < 1)
+      {
+	  fprintf (stderr, "invalid --threads argument: expected 1 or more\n");
+	  error = 1;
+      }
+    if (jobs < 1)
+      {
+	  fprintf (stderr, "invalid --jobs argument: expected 1 or more\n");
+	  error = 1;
+      }
+    if (rebuild_shx && !out_dir)
+      {
+	  fprintf (stderr,
+		   "the --rebuild-shx option requires the --out-dir argument\n");
+	  error = 1;
+      }
     if (error)
       {
 	  do_help ();
@@ -4286,6 +5957,16 @@ main (int argc, char *argv[])
 		return -1;
 	    }
       }
+    if (report_path != NULL)
+      {
+	  if (!open_report (&report, report_path))
+	    {
+		fprintf (stderr,
+			 "ERROR: unable to create the report file\n%s\n%s\n\n",
+			 report_path, strerror (errno));
+		return -1;
+	    }
+      }
 
     cache = spatialite_alloc_connection ();
     spatialite_set_silent_mode (cache);
@@ -4293,7 +5974,10 @@ main (int argc, char *argv[])
     if (out_dir != NULL)
       {
 	  fprintf (stderr, "Output dir: %s\n", out_dir);
-	  if (force)
+	  if (rebuild_shx)
+	      fprintf (stderr,
+		       "Only rebuilding the SHX index of all Shapefiles\n");
+	  else if (force)
 	      fprintf (stderr, "Unconditionally repairing all Shapefiles\n");
       }
     else
@@ -4303,15 +5987,44 @@ main (int argc, char *argv[])
 	  fprintf (stderr, "Checking for invalid geometries (%s mode)\n",
 		   esri ? "ESRI" : "ISO/OGC");
       }
+#ifdef _WIN32
+    if (threads > 1)
+      {
+	  fprintf (stderr,
+		   "the --threads option will be ignored on this platform\n");
+	  threads = 1;
+      }
+    if (jobs > 1)
+      {
+	  fprintf (stderr,
+		   "the --jobs option will be ignored on this platform\n");
+	  jobs = 1;
+      }
+#endif
+    if (threads > 1 && (validate || (force && out_dir != NULL)))
+	fprintf (stderr, "Processing geometries by using %d threads\n",
+		 threads);
+    if (jobs > 1)
+	fprintf (stderr, "Checking up to %d Shapefiles at the same time\n",
+		 jobs);
 
     if (!do_scan_dir
-	(cache, in_dir, out_dir, &n_shp, &r_shp, &x_shp, validate, esri, force))
+	(cache, in_dir, out_dir, &n_shp, &r_shp, &x_shp, validate, esri, force,
+	 rebuild_shx, threads, jobs, (report_path != NULL) ? &report : NULL))
       {
 	  fprintf (stderr,
 		   "\n... quitting ... some unexpected error occurred\n");
+	  if (report_path != NULL)
+	      close_report (&report);
 	  spatialite_cleanup_ex (cache);
 	  return -1;
       }
+    if (report_path != NULL)
+      {
+	  close_report (&report);
+	  fprintf (stderr, "Per-entity report written into: %s\n",
+		   report_path);
+      }
 
     fprintf (stderr, "\n===========================================\n");
     fprintf (stderr, "%d Shapefil%s ha%s been inspected.\n", n_shp,
@@ -36,8 +36,17 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <float.h>
 #include <sys/time.h>
 #include <time.h>
+#include <zlib.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
 
 #if defined(_WIN32) && !defined(__MINGW32__)
 #include "config-msvc.h"
@@ -81,6 +90,11 @@
 #define ARG_FETCHZ_Y		11
 #define ARG_FETCHZ_XY		12
 #define ARG_DEFAULT_SRID		13
+#define ARG_INTERPOLATION_DEM		14
+#define ARG_CACHE_SIZE_DEM		15
+#define ARG_THREADS		16
+#define ARG_FETCHZ_FILE		17
+#define ARG_PROFILE		18
 // -- -- ---------------------------------- --
 #define CMD_DEM_SNIFF		100
 #define CMD_DEM_FETCHZ		101
@@ -91,6 +105,53 @@
 #define CONF_TYPE_DEM		1
 #define CONF_TYPE_SOURCE	2
 // -- -- ---------------------------------- --
+#define DEM_INTERPOLATION_NEAREST		0
+#define DEM_INTERPOLATION_BILINEAR		1
+#define DEM_INTERPOLATION_BICUBIC		2
+// -- -- ---------------------------------- --
+// Dem-Grid: no data marker and size limit [1 GB of float32]
+// -- -- ---------------------------------- --
+#define DEM_GRID_NODATA		(-FLT_MAX)
+#define DEM_GRID_MAX_CELLS		268435456
+// -- -- ---------------------------------- --
+// Dem-Store: tile size [cells] and default
+//  memory budget [MB] of the Dem-Grid
+// -- -- ---------------------------------- --
+#define DEM_TILE_SIZE		256
+#define DEM_CACHE_SIZE_DEFAULT		512
+// -- -- ---------------------------------- --
+// Parallel Z-update: geometries per batch and
+//  changed geometries per Transaction
+// -- -- ---------------------------------- --
+#define DEM_UPDATE_BATCH_SIZE		256
+#define DEM_UPDATE_COMMIT_ROWS		100000
+// -- -- ---------------------------------- --
+// Import of xyz files: size of a POINT Z BLOB,
+//  points per block/Transaction and blocks
+//  queued by each parsing thread
+// -- -- ---------------------------------- --
+#define DEM_POINTZ_BLOB_SIZE		68
+#define DEM_XYZ_BLOCK_POINTS		100000
+#define DEM_XYZ_QUEUE_BLOCKS		4
+// -- -- ---------------------------------- --
+// Dem-Raster: max. columns or rows and max. ratio
+//  of grid cells to points [otherwise not a grid]
+// -- -- ---------------------------------- --
+#define DEM_RASTER_MAX_SIZE		1048576
+#define DEM_RASTER_MAX_EMPTY		4
+// -- -- ---------------------------------- --
+// Profiling [-profile]: the phases being timed
+// -- -- ---------------------------------- --
+#define DEM_PHASE_SETUP		0
+#define DEM_PHASE_LOAD		1
+#define DEM_PHASE_READ		2
+#define DEM_PHASE_LOOKUP		3
+#define DEM_PHASE_REBUILD		4
+#define DEM_PHASE_WRITE		5
+#define DEM_PHASE_INDEX		6
+#define DEM_PHASE_WAIT		7
+#define DEM_PHASE_COUNT		8
+// -- -- ---------------------------------- --
 // Definitions used for dem-conf
 // -- -- ---------------------------------- --
 #define MAXBUF 1024
@@ -198,6 +259,7 @@ struct config_dem
  char *schema;
  double fetchz_x;
  double fetchz_y;
+ char fetchz_file[MAXBUF]; // -fetchz_file: one point for each line ['-' for stdin]
  double dem_z;
  double dem_m;
  int has_z;
@@ -208,7 +270,268 @@ struct config_dem
  unsigned int id_rowid; // For debugging
  unsigned int count_points; // For debugging
  unsigned int count_points_nr; // For debugging
+ int interpolation; // DEM_INTERPOLATION_*
+ int cache_size; // MB, memory budget of the Dem-Grid
+ int threads; // -updatez worker threads
+ int is_raster; // Dem-Raster: the points are only stored as tiles
+ struct dem_grid *dem_grid; // NULL: SQL queries will be used
+ struct dem_profile *profile; // -profile: NULL when not profiling
+};
+// -- -- ---------------------------------- --
+// Dem-Store tile, cached in a LRU list
+// -- -- ---------------------------------- --
+struct dem_tile
+{
+ int tile_x;
+ int tile_y;
+ float *zz; // NULL when the tile has no data
+ float *mm;
+ int bytes;
+ int count_cells; // Dem-Raster import: cells with data
+ struct dem_tile *prev;
+ struct dem_tile *next;
+ struct dem_tile *hash_next;
+};
+struct dem_tile_cache
+{
+ sqlite3_stmt *stmt;
+ int tiles_x;
+ int tile_bytes;
+ sqlite3_int64 bytes_max;
+ sqlite3_int64 bytes_used;
+ struct dem_tile *first; // most recently used
+ struct dem_tile *last; // least recently used
+ struct dem_tile *current;
+ struct dem_tile **hash;
+ int hash_size;
+ int count_loaded;
+ int count_evicted;
+};
+// -- -- ---------------------------------- --
+// In-memory Dem-Grid structure
+// -- -- ---------------------------------- --
+struct dem_grid
+{
+ double origin_x;
+ double origin_y;
+ double step_x;
+ double step_y;
+ int columns;
+ int rows;
+ float *zz;
+ float *mm; // NULL when the Dem has no m-values
+ int has_m;
+ int interpolation;
+ struct dem_tile_cache *tiles; // NULL: zz/mm hold the whole grid
+};
+// -- -- ---------------------------------- --
+// Profiling of a command [-profile]
+// - the wall-clock time is always charged to
+//   one phase, switching with dem_profile_switch
+// - with -threads, the workers time lookup/rebuild
+//   in their own dem_profile, added when finished
+//   to worker_seconds [summed over the threads]
+//   and not to the phases of the main thread
+// - written as a JSON summary when the command ends
+// -- -- ---------------------------------- --
+struct dem_profile
+{
+ char json_path[MAXBUF]; // '-' for stderr [stdout holds the -fetchz_file results]
+ const char *command;
+ int phase; // DEM_PHASE_* being timed
+ double time_phase; // start of the phase being timed
+ double time_start;
+ double phase_seconds[DEM_PHASE_COUNT];
+ double worker_seconds[DEM_PHASE_COUNT]; // -threads: busy time of the workers
+ sqlite3_int64 rows_read;
+ sqlite3_int64 rows_written;
+ sqlite3_int64 vertices_lookup;
+ sqlite3_int64 lookup_misses;
+ sqlite3_int64 count_transactions;
+ int threads;
+ int is_started;
 };
+static const char *dem_phase_names[DEM_PHASE_COUNT] = {"setup", "dem_load", "read", "lookup", "rebuild", "write", "index", "wait"};
+static double
+get_dem_profile_time()
+{
+ struct timeval time_now;
+ gettimeofday(&time_now, 0);
+ return (double)time_now.tv_sec + ((double)time_now.tv_usec / 1000000.0);
+}
+static void
+init_dem_profile(struct dem_profile *profile, int phase)
+{
+ memset(profile, 0, sizeof (struct dem_profile));
+ profile->phase = phase;
+ profile->time_start = get_dem_profile_time();
+ profile->time_phase = profile->time_start;
+}
+// -- -- ---------------------------------- --
+// Charging the time since the last switch to the
+//  current phase, returning it [to switch back]
+// - without -profile [NULL] nothing is done
+// -- -- ---------------------------------- --
+static int
+dem_profile_switch(struct dem_profile *profile, int phase)
+{
+ double time_now=0.0;
+ int phase_previous=phase;
+ if (profile == NULL)
+ {
+  return phase;
+ }
+ time_now = get_dem_profile_time();
+ profile->phase_seconds[profile->phase] += time_now - profile->time_phase;
+ profile->time_phase = time_now;
+ phase_previous = profile->phase;
+ profile->phase = phase;
+ return phase_previous;
+}
+static void
+add_dem_profile(struct dem_profile *profile, struct dem_profile *worker_profile)
+{// the time and counters of a worker thread
+ int i=0;
+ dem_profile_switch(worker_profile, worker_profile->phase);
+ for (i=0; i<DEM_PHASE_COUNT; i++)
+ {
+  if (i != DEM_PHASE_WAIT)
+  {// the idle time of the workers is not added
+   profile->worker_seconds[i] += worker_profile->phase_seconds[i];
+  }
+ }
+ profile->rows_read += worker_profile->rows_read;
+ profile->rows_written += worker_profile->rows_written;
+ profile->vertices_lookup += worker_profile->vertices_lookup;
+ profile->lookup_misses += worker_profile->lookup_misses;
+}
+static int
+dem_profile_commit(void *arg)
+{// sqlite3_commit_hook: counting the Transactions
+ struct dem_profile *profile = (struct dem_profile *)arg;
+ profile->count_transactions++;
+ return 0; // 0: the COMMIT goes ahead
+}
+static void
+start_dem_profile(struct dem_profile *profile, sqlite3 *db_handle)
+{// once the Database is open
+ int current=0;
+ int highwater=0;
+ if ((profile == NULL) || (db_handle == NULL) || (profile->is_started))
+ {
+  return;
+ }
+ profile->is_started = 1;
+ sqlite3_commit_hook(db_handle, dem_profile_commit, profile);
+#ifdef SQLITE_DBSTATUS_CACHE_WRITE
+ sqlite3_db_status(db_handle, SQLITE_DBSTATUS_CACHE_WRITE, &current, &highwater, 1);
+#endif
+}
+static void
+print_json_string(FILE *fp, const char *value)
+{
+ fputc('"', fp);
+ for (; (value) && (*value); value++)
+ {
+  if ((*value == '"') || (*value == '\\'))
+  {
+   fprintf(fp, "\\%c", *value);
+  }
+  else if ((unsigned char)*value < 0x20)
+  {
+   fprintf(fp, "\\u%04x", (unsigned char)*value);
+  }
+  else
+  {
+   fputc(*value, fp);
+  }
+ }
+ fputc('"', fp);
+}
+// -- -- ---------------------------------- --
+// Writing the JSON summary
+// - db_bytes_written: the pages written to the
+//   Database-files [main and attached] since start
+// -- -- ---------------------------------- --
+static int
+write_dem_profile(struct dem_profile *profile, sqlite3 *db_handle, struct config_dem *dem_config, int exit_code, int verbose)
+{
+ FILE *fp = NULL;
+ int i=0;
+ int current=0;
+ int highwater=0;
+ sqlite3_int64 bytes_written=0;
+ sqlite3_stmt *stmt = NULL;
+ if (profile == NULL)
+ {
+  return 0;
+ }
+ dem_profile_switch(profile, profile->phase);
+ if (db_handle)
+ {
+  sqlite3_commit_hook(db_handle, NULL, NULL);
+#ifdef SQLITE_DBSTATUS_CACHE_WRITE
+  if (sqlite3_db_status(db_handle, SQLITE_DBSTATUS_CACHE_WRITE, &current, &highwater, 0) == SQLITE_OK)
+  {
+   if (sqlite3_prepare_v2(db_handle, "PRAGMA main.page_size", -1, &stmt, NULL) == SQLITE_OK)
+   {
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+     bytes_written = (sqlite3_int64)current * sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+   }
+  }
+#endif
+ }
+ if (strcmp(profile->json_path, "-") == 0)
+ {
+  fp = stderr;
+ }
+ else
+ {
+  fp = fopen(profile->json_path, "w");
+ }
+ if (fp == NULL)
+ {
+  if (verbose)
+  {
+   fprintf(stderr, "-E-> write_dem_profile: cannot create [%s]\n",profile->json_path);
+  }
+  return 0;
+ }
+ fprintf(fp, "{\n \"command\": ");
+ print_json_string(fp, profile->command);
+ fprintf(fp, ",\n \"status\": \"%s\",\n \"dem_path\": ", (exit_code == 0) ? "ok" : "error");
+ print_json_string(fp, dem_config->dem_path);
+ fprintf(fp, ",\n \"dem_table\": ");
+ print_json_string(fp, dem_config->dem_table);
+ fprintf(fp, ",\n \"dem_rows_count\": %u,\n \"threads\": %d,\n", dem_config->dem_rows_count, profile->threads);
+ fprintf(fp, " \"seconds_total\": %.6f,\n \"phases\": {", profile->time_phase - profile->time_start);
+ for (i=0; i<DEM_PHASE_COUNT; i++)
+ {
+  fprintf(fp, "%s\n  \"%s\": %.6f", (i > 0) ? "," : "", dem_phase_names[i], profile->phase_seconds[i]);
+ }
+ fprintf(fp, "\n },\n \"worker_seconds\": {");
+ fprintf(fp, "\n  \"%s\": %.6f,", dem_phase_names[DEM_PHASE_LOOKUP], profile->worker_seconds[DEM_PHASE_LOOKUP]);
+ fprintf(fp, "\n  \"%s\": %.6f", dem_phase_names[DEM_PHASE_REBUILD], profile->worker_seconds[DEM_PHASE_REBUILD]);
+ fprintf(fp, "\n },\n \"counters\": {\n");
+ fprintf(fp, "  \"rows_read\": %lld,\n", (long long)profile->rows_read);
+ fprintf(fp, "  \"rows_written\": %lld,\n", (long long)profile->rows_written);
+ fprintf(fp, "  \"vertices_lookup\": %lld,\n", (long long)profile->vertices_lookup);
+ fprintf(fp, "  \"lookup_misses\": %lld,\n", (long long)profile->lookup_misses);
+ fprintf(fp, "  \"transactions\": %lld,\n", (long long)profile->count_transactions);
+ fprintf(fp, "  \"db_bytes_written\": %lld\n }\n}\n", (long long)bytes_written);
+ if (fp == stderr)
+ {
+  fflush(fp);
+ }
+ else
+ {
+  fclose(fp);
+ }
+ return 1;
+}
 // -- -- ---------------------------------- --
 // Reading dem-conf
 // Environment var 'SPATIALITE_DEM'
@@ -249,6 +572,7 @@ struct config_dem get_demconfig(char *conf_filename, int verbose)
 // -- -- ---------------------------------- --
  config_struct.fetchz_x=0.0;
  config_struct.fetchz_y=0.0;
+ strcpy(config_struct.fetchz_file,"");
  config_struct.dem_z=0.0;
  config_struct.dem_m=0.0;
  config_struct.has_z=0;
@@ -260,6 +584,12 @@ struct config_dem get_demconfig(char *conf_filename, int verbose)
  config_struct.id_rowid=0; // For debugging
  config_struct.count_points=0; // For debugging
  config_struct.count_points_nr=0; // For debugging
+ config_struct.interpolation=DEM_INTERPOLATION_NEAREST;
+ config_struct.cache_size=DEM_CACHE_SIZE_DEFAULT;
+ config_struct.threads=1;
+ config_struct.is_raster=0;
+ config_struct.dem_grid=NULL;
+ config_struct.profile=NULL;
 // -- -- ---------------------------------- --
  if ((conf_filename) && (strlen(conf_filename) > 0) )
  {
@@ -403,1846 +733,4762 @@ int write_demconfig(char *conf_filename, struct config_dem config_struct)
  return rc;
 }
 // -- -- ---------------------------------- --
-// From a given point, build area around it by 'resolution_dem'
-// - utm 0.999 meters, Solder Berlin 1.0375644 meters
-// (resolution_dem/2) could also be done
-// - but to insure that at least 1 point is returned, left as is
-// The nearest point will always be retrieved, or none at all.
+// Encoding a POINT Z as SpatiaLite BLOB-Geometry
+// - the same result as MakePointZ(x,y,z,srid),
+//   without calling the SQL function for each point
+// -- -- ---------------------------------- --
+static void
+encode_point_z_blob(unsigned char *blob, double x, double y, double z, int srid, int endian_arch)
+{
+ blob[0] = GAIA_MARK_START;
+ blob[1] = GAIA_LITTLE_ENDIAN;
+ gaiaExport32(blob + 2, srid, GAIA_LITTLE_ENDIAN, endian_arch);
+ gaiaExport64(blob + 6, x, GAIA_LITTLE_ENDIAN, endian_arch); // MBR: min x
+ gaiaExport64(blob + 14, y, GAIA_LITTLE_ENDIAN, endian_arch); // MBR: min y
+ gaiaExport64(blob + 22, x, GAIA_LITTLE_ENDIAN, endian_arch); // MBR: max x
+ gaiaExport64(blob + 30, y, GAIA_LITTLE_ENDIAN, endian_arch); // MBR: max y
+ blob[38] = GAIA_MARK_MBR;
+ gaiaExport32(blob + 39, GAIA_POINTZ, GAIA_LITTLE_ENDIAN, endian_arch);
+ gaiaExport64(blob + 43, x, GAIA_LITTLE_ENDIAN, endian_arch);
+ gaiaExport64(blob + 51, y, GAIA_LITTLE_ENDIAN, endian_arch);
+ gaiaExport64(blob + 59, z, GAIA_LITTLE_ENDIAN, endian_arch);
+ blob[67] = GAIA_MARK_END;
+}
+// -- -- ---------------------------------- --
+// Inserting a block of xyz points [x,y,z interleaved]
+// - as a single Transaction, using the prepared
+//   INSERT statement of import_xyz
 // -- -- ---------------------------------- --
 static int
-insert_dem_points(sqlite3 *db_handle, struct config_dem *dem_config, double *xx_source, double *yy_source, double *zz_source, int verbose)
+insert_dem_points(sqlite3 *db_handle, struct config_dem *dem_config, sqlite3_stmt *stmt, const double *xyz, int count_points, int verbose)
 {
- /* checking for 3D geometries - version 4 */
  int ret=0;
  int ret_insert=SQLITE_OK;
  int i=0;
- char *sql_statement = NULL;
- sqlite3_stmt *stmt = NULL;
+ int endian_arch=gaiaEndianArch();
+ unsigned char blob[DEM_POINTZ_BLOB_SIZE];
  char *sql_err = NULL;
- if (zz_source)
+ if (sqlite3_exec(db_handle, "BEGIN", NULL, NULL, &sql_err) == SQLITE_OK)
  {
-  sql_statement = sqlite3_mprintf("INSERT INTO \"%s\" (point_x,point_y, point_z,\"%s\") "
-                                  "VALUES(?,?,?,MakePointZ(?,?,?,%d)) ",dem_config->dem_table,dem_config->dem_geometry,dem_config->dem_srid);
-  ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &stmt, NULL );
-  if ( ret == SQLITE_OK )
+  for (i=0; i<count_points; i++)
   {
-   sqlite3_free(sql_statement);
-   if (sqlite3_exec(db_handle, "BEGIN", NULL, NULL, &sql_err) == SQLITE_OK)
+   encode_point_z_blob(blob, xyz[i*3], xyz[(i*3)+1], xyz[(i*3)+2], dem_config->dem_srid, endian_arch);
+   sqlite3_reset(stmt);
+   sqlite3_clear_bindings(stmt);
+   // Note: sqlite3_bind_* index is 1-based, os apposed to sqlite3_column_* that is 0-based.
+   sqlite3_bind_double(stmt, 1, xyz[i*3]);
+   sqlite3_bind_double(stmt, 2, xyz[(i*3)+1]);
+   sqlite3_bind_double(stmt, 3, xyz[(i*3)+2]);
+   sqlite3_bind_blob(stmt, 4, blob, DEM_POINTZ_BLOB_SIZE, SQLITE_STATIC);
+   dem_config->count_points_nr=i;
+   ret_insert = sqlite3_step( stmt );
+   if ( ret_insert != SQLITE_DONE && ret_insert != SQLITE_ROW )
    {
-    for (i=0; i<(int)(dem_config->count_points); i++)
-    {
-     if (ret_insert != SQLITE_ABORT )
-     {
-      // Note: sqlite3_bind_* index is 1-based, os apposed to sqlite3_column_* that is 0-based.
-      sqlite3_bind_double(stmt, 1, xx_source[i]);
-      sqlite3_bind_double(stmt, 2, yy_source[i]);
-      sqlite3_bind_double(stmt, 3, zz_source[i]);
-      sqlite3_bind_double(stmt, 4, xx_source[i]);
-      sqlite3_bind_double(stmt, 5, yy_source[i]);
-      sqlite3_bind_double(stmt, 6, zz_source[i]);
-      dem_config->count_points_nr=i;
-      ret_insert = sqlite3_step( stmt );
-      if ( ret_insert == SQLITE_DONE || ret_insert == SQLITE_ROW )
-      {
-       ret_insert=SQLITE_OK;
-      }
-      else
-      {
-       ret_insert=SQLITE_ABORT;
-      }
-     }
-     sqlite3_reset(stmt);
-     sqlite3_clear_bindings(stmt);
-     xx_source[i]=0.0;
-     yy_source[i]=0.0;
-     zz_source[i]=0.0;
-    }
-    ret=0;
-    if (ret_insert == SQLITE_ABORT )
-    {
-     if (sqlite3_exec(db_handle, "ROLLBACK", NULL, NULL, &sql_err) == SQLITE_OK)
-     {
-      ret=0;
-     }
-    }
-    else
+    if (verbose)
     {
-     if (sqlite3_exec(db_handle, "COMMIT", NULL, NULL, &sql_err) == SQLITE_OK)
-     {
-      ret = 1;
-      dem_config->dem_rows_count+=dem_config->count_points;
-      dem_config->count_points=0;
-      dem_config->count_points_nr=0;
-     }
+     fprintf(stderr, "-W-> insert_dem_points: %s\n",sqlite3_errmsg(db_handle));
     }
+    ret_insert=SQLITE_ABORT;
+    break;
    }
-   sqlite3_finalize( stmt );
-   if (sql_err)
-   {
-    sqlite3_free(sql_err);
-   }
+  }
+  sqlite3_reset(stmt);
+  if (ret_insert == SQLITE_ABORT )
+  {
+   sqlite3_exec(db_handle, "ROLLBACK", NULL, NULL, NULL);
   }
   else
   {
-   if (verbose)
+   if (sqlite3_exec(db_handle, "COMMIT", NULL, NULL, &sql_err) == SQLITE_OK)
    {
-    fprintf(stderr, "-W-> insert_dem_points: rc=%d sql[%s]\n",ret,sql_statement);
+    ret = 1;
+    dem_config->dem_rows_count+=count_points;
+    dem_config->count_points=0;
+    dem_config->count_points_nr=0;
    }
-   sqlite3_free(sql_statement);
   }
  }
+ if (sql_err)
+ {
+  sqlite3_free(sql_err);
+ }
  return ret;
 }
 // -- -- ---------------------------------- --
-// From a given point, build area around it by 'resolution_dem'
-// - utm 0.999 meters, Solder Berlin 1.0375644 meters
-// (resolution_dem/2) could also be done
-// - but to insure that at least 1 point is returned, left as is
-// The nearest point will always be retrieved, or none at all.
+// In-memory Dem-Grid
+// - the Dem points are loaded once per run into
+//   a regular grid of float32 z-values
+// - columns/rows are the count of distinct x/y values,
+//   origin the lower-left point
+// - if any point is not placed on that grid, NULL is returned
+//   and the SQL-based lookup will be used instead
+// - when the grid does not fit into the memory budget (-cdem),
+//   the cells are read from the tiled Dem-Store instead
+// -- -- ---------------------------------- --
+static void
+free_dem_tile(struct dem_tile *tile)
+{
+ if (tile->zz)
+ {
+  free(tile->zz);
+ }
+ if (tile->mm)
+ {
+  free(tile->mm);
+ }
+ free(tile);
+}
+static void
+free_dem_tile_cache(struct dem_tile_cache *cache, int verbose)
+{
+ struct dem_tile *tile = NULL;
+ struct dem_tile *tile_next = NULL;
+ if (cache)
+ {
+  if (verbose)
+  {
+   fprintf(stderr, "-I-> Dem-Store: tiles loaded[%d] evicted[%d]\n",cache->count_loaded,cache->count_evicted);
+  }
+  tile = cache->first;
+  while (tile)
+  {
+   tile_next = tile->next;
+   free_dem_tile(tile);
+   tile = tile_next;
+  }
+  if (cache->hash)
+  {
+   free(cache->hash);
+  }
+  if (cache->stmt)
+  {
+   sqlite3_finalize(cache->stmt);
+  }
+  free(cache);
+ }
+}
+static void
+free_dem_grid(struct dem_grid *grid)
+{
+ if (grid)
+ {
+  if (grid->zz)
+  {
+   free(grid->zz);
+  }
+  if (grid->mm)
+  {
+   free(grid->mm);
+  }
+  free_dem_tile_cache(grid->tiles, 0);
+  free(grid);
+ }
+}
+// -- -- ---------------------------------- --
+// Tiled Dem-Store
+// - '<dem_table>_tiles': one row for each tile of
+//   DEM_TILE_SIZE x DEM_TILE_SIZE cells holding data,
+//   the float32 z/m values stored as compressed BLOBs
+// - '<dem_table>_tiles_layout': the grid layout, written
+//   last, so that only a complete Store will be reused
+// - the Store is reused as long as row_count and extent
+//   of the Dem are unchanged
+// - for a Dem-Raster [is_raster=1] the Store is the Dem
 // -- -- ---------------------------------- --
 static int
-retrieve_dem_points(sqlite3 *db_handle, struct config_dem *dem_config, int count_points, double *xx_source, double *yy_source, double *zz, double *mm, int *count_z, int *count_m, int verbose)
+is_little_endian()
+{
+ union
+ {
+  unsigned char bytes[2];
+  short value;
+ } endian_test;
+ endian_test.value = 1;
+ return endian_test.bytes[0];
+}
+// -- -- ---------------------------------- --
+// Compressing the float32 values of a tile
+// - the bytes are shuffled (all first bytes, then
+//   all second bytes ...) before deflating,
+//   since neighbouring heights share most bytes
+// - stored uncompressed when that is not smaller,
+//   which the reader recognizes by the BLOB size
+// -- -- ---------------------------------- --
+static unsigned char *
+compress_dem_tile(const float *values, int *blob_bytes)
 {
- /* checking for 3D geometries - version 4 */
- int ret=0;
  int i=0;
- char *sql_statement = NULL;
- sqlite3_stmt *stmt = NULL;
- int has_m = 0;
- double x_source=0.0;
- double y_source=0.0;
- double z_source=0.0;
- double m_source=0.0;
- *count_z=0;
- *count_m=0;
- if (mm)
+ int j=0;
+ int tile_bytes=sizeof (float) * DEM_TILE_SIZE * DEM_TILE_SIZE;
+ const unsigned char *bytes = (const unsigned char *)values;
+ unsigned char *shuffled = malloc(tile_bytes);
+ uLongf compressed_bytes = compressBound(tile_bytes);
+ unsigned char *blob = malloc(compressed_bytes);
+ for (i=0; i<(DEM_TILE_SIZE * DEM_TILE_SIZE); i++)
  {
-  has_m = 1;
+  for (j=0; j<(int)sizeof (float); j++)
+  {
+   shuffled[(j * DEM_TILE_SIZE * DEM_TILE_SIZE) + i] = bytes[(i * sizeof (float)) + j];
+  }
  }
- if (zz)
+ if ((compress2(blob, &compressed_bytes, shuffled, tile_bytes, Z_DEFAULT_COMPRESSION) == Z_OK) &&
+     (compressed_bytes < (uLongf)tile_bytes))
  {
-  for (i=0; i<count_points; i++)
+  *blob_bytes = (int)compressed_bytes;
+ }
+ else
+ {
+  memcpy(blob, values, tile_bytes);
+  *blob_bytes = tile_bytes;
+ }
+ free(shuffled);
+ return blob;
+}
+static int
+uncompress_dem_tile(const unsigned char *blob, int blob_bytes, float *values)
+{
+ int i=0;
+ int j=0;
+ int ret=0;
+ int tile_bytes=sizeof (float) * DEM_TILE_SIZE * DEM_TILE_SIZE;
+ unsigned char *bytes = (unsigned char *)values;
+ unsigned char *shuffled = NULL;
+ uLongf uncompressed_bytes = tile_bytes;
+ if (blob_bytes == tile_bytes)
+ {// stored uncompressed
+  memcpy(values, blob, tile_bytes);
+  return 1;
+ }
+ shuffled = malloc(tile_bytes);
+ if ((uncompress(shuffled, &uncompressed_bytes, blob, blob_bytes) == Z_OK) &&
+     (uncompressed_bytes == (uLongf)tile_bytes))
+ {
+  for (i=0; i<(DEM_TILE_SIZE * DEM_TILE_SIZE); i++)
   {
-   dem_config->count_points_nr=i;
-   x_source=xx_source[i];
-   y_source=yy_source[i];
-   /* checking the GEOMETRY_COLUMNS table */
-   if (has_m)
+   for (j=0; j<(int)sizeof (float); j++)
    {
-    sql_statement = sqlite3_mprintf("SELECT ST_Z(\"%s\"), ST_M(\"%s\") "
-                                    "FROM '%s'.'%s' WHERE (ROWID IN ( "
-                                    "SELECT ROWID FROM SpatialIndex WHERE ( "
-                                    "(f_table_name = 'DB=%s.%s') AND "
-                                    "(f_geometry_column = '%s') AND "
-                                    "(search_frame = ST_Buffer(MakePoint(%2.7f,%2.7f,%d),%2.7f)))) AND "
-                                    "(ST_ClosestPoint(%s, MakePoint(%2.7f,%2.7f,%d)) IS NOT Null) ) "
-                                    "ORDER BY ST_Distance(%s,MakePoint(%2.7f,%2.7f,%d)) ASC LIMIT 1"
-                                    ,dem_config->dem_geometry,dem_config->dem_geometry,dem_config->schema,dem_config->dem_table,dem_config->schema,dem_config->dem_table
-                                    ,dem_config->dem_geometry,x_source,y_source,dem_config->dem_srid,dem_config->dem_resolution
-                                    ,dem_config->dem_geometry,x_source,y_source,dem_config->dem_srid,dem_config->dem_geometry,x_source,y_source,dem_config->dem_srid);
-   }
-   else
-   {
-    sql_statement = sqlite3_mprintf("SELECT ST_Z(\"%s\") "
-                                    "FROM '%s'.'%s' WHERE (ROWID IN ( "
-                                    "SELECT ROWID FROM SpatialIndex WHERE ("
-                                    "(f_table_name = 'DB=%s.%s') AND "
-                                    "(f_geometry_column = '%s') AND "
-                                    "(search_frame = ST_Buffer(MakePoint(%2.7f,%2.7f,%d),%2.7f)))) AND "
-                                    "(ST_ClosestPoint(%s, MakePoint(%2.7f,%2.7f,%d)) IS NOT Null) ) "
-                                    "ORDER BY ST_Distance(%s,MakePoint(%2.7f,%2.7f,%d)) ASC LIMIT 1"
-                                    ,dem_config->dem_geometry,dem_config->schema,dem_config->dem_table,dem_config->schema,dem_config->dem_table
-                                    ,dem_config->dem_geometry,x_source,y_source,dem_config->dem_srid,dem_config->dem_resolution
-                                    ,dem_config->dem_geometry,x_source,y_source,dem_config->dem_srid,dem_config->dem_geometry,x_source,y_source,dem_config->dem_srid);
-   }
-   ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &stmt, NULL );
-#if 0
-   if ((dem_config->id_rowid == 354) && (dem_config->count_points == 207))
-   {
-    fprintf(stderr, "-III-> [EXTERIOR RING] -1a- cnt[%d,%d,%d] sql[%s] id_rowid[%d]\n",dem_config->count_points,dem_config->count_points_nr,ret,sql_statement,dem_config->id_rowid);
-   }
-#endif
-   if ( ret == SQLITE_OK )
-   {
-    sqlite3_free(sql_statement);
-    while ( sqlite3_step( stmt ) == SQLITE_ROW )
-    {
-     if ( sqlite3_column_type( stmt, 0 ) != SQLITE_NULL )
-     {
-      z_source = sqlite3_column_double (stmt, 0);
-      if ( (z_source != 0.0 ) && (zz[i] != z_source ) )
-      {// Do not force an update if everything is 0 or has not otherwise changed
-       zz[i] = z_source;
-       *count_z += 1;
-      }
-     }
-     if ( sqlite3_column_type( stmt, 1 ) != SQLITE_NULL )
-     {
-      m_source = sqlite3_column_double (stmt, 1);
-      if ( (m_source != 0.0 ) && (mm[i] != m_source ) )
-      {// Do not force an update if everything is 0 or has not otherwise changed
-       mm[i] = m_source;
-       *count_m += 1;
-      }
-      mm[i] = sqlite3_column_double (stmt, 1);
-     }
-    }
-    sqlite3_finalize( stmt );
-   }
-   else
-   {
-    if (verbose)
-    {
-     fprintf(stderr, "-W-> retrieve_dem_points: rc=%d sql[%s]\n",ret,sql_statement);
-    }
-    sqlite3_free(sql_statement);
+    bytes[(i * sizeof (float)) + j] = shuffled[(j * DEM_TILE_SIZE * DEM_TILE_SIZE) + i];
    }
   }
+  ret = 1;
  }
-// printf("-I-> retrieve_dem_points: total[%d] not 0.0: z[%d] m[%d]\n",count_points,*count_z,*count_m);
- if (*count_z > 0)
-  return 1;
- return 0;
+ free(shuffled);
+ return ret;
 }
 // -- -- ---------------------------------- --
-//
+// Creating the (empty) tables of the Dem-Store
+// - is_raster=1: the Dem points are only stored
+//   as tiles [-create_dem -raster]
 // -- -- ---------------------------------- --
 static int
-callFetchZ(sqlite3 *db_handle, struct config_dem *dem_config, int verbose)
+create_dem_tiles_tables(sqlite3 *db_handle, struct config_dem *dem_config, int verbose)
 {
  int ret=0;
  char *sql_statement = NULL;
- sqlite3_stmt *stmt = NULL;
- int i_count_z=0;
- int i_count_m=0;
- double *xx_use = NULL;
- double *yy_use = NULL;
- double *mm_use = NULL;
- double *zz = NULL;
-// -- -- ---------------------------------- --
- dem_config->dem_z=0;;
- dem_config->dem_m=0;
-// -- -- ---------------------------------- --
- if (dem_config->dem_srid != dem_config->default_srid )
+ char *sql_err = NULL;
+ sql_statement = sqlite3_mprintf("DROP TABLE IF EXISTS '%s'.'%s_tiles_layout'; "
+                                 "DROP TABLE IF EXISTS '%s'.'%s_tiles'; "
+                                 "CREATE TABLE '%s'.'%s_tiles' ("
+                                 "tile_x INTEGER NOT NULL, "
+                                 "tile_y INTEGER NOT NULL, "
+                                 "z_values BLOB NOT NULL, "
+                                 "m_values BLOB, "
+                                 "PRIMARY KEY (tile_x, tile_y)); "
+                                 "CREATE TABLE '%s'.'%s_tiles_layout' ("
+                                 "origin_x DOUBLE, origin_y DOUBLE, step_x DOUBLE, step_y DOUBLE, "
+                                 "columns INTEGER, rows INTEGER, tile_size INTEGER, has_m INTEGER, little_endian INTEGER, "
+                                 "count_points INTEGER, dem_rows_count INTEGER, "
+                                 "extent_minx DOUBLE, extent_miny DOUBLE, extent_maxx DOUBLE, extent_maxy DOUBLE, "
+                                 "srid INTEGER, is_raster INTEGER)",
+                                 dem_config->schema,dem_config->dem_table,dem_config->schema,dem_config->dem_table,
+                                 dem_config->schema,dem_config->dem_table,dem_config->schema,dem_config->dem_table);
+ ret = sqlite3_exec(db_handle, sql_statement, NULL, NULL, &sql_err);
+ sqlite3_free(sql_statement);
+ if (ret != SQLITE_OK)
  {
-  sql_statement = sqlite3_mprintf("SELECT ST_X(ST_Transform(MakePoint(%2.7f,%2.7f,%d),%d)),  "
-                                  "ST_Y(ST_Transform(MakePoint(%2.7f,%2.7f,%d),%d))"
-                                  ,dem_config->fetchz_x, dem_config->fetchz_y, dem_config->default_srid,dem_config->dem_srid
-                                  ,dem_config->fetchz_x, dem_config->fetchz_y, dem_config->default_srid,dem_config->dem_srid);
-  ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &stmt, NULL );
-  if ( ret == SQLITE_OK )
+  if (verbose)
   {
-   sqlite3_free(sql_statement);
-   while ( sqlite3_step( stmt ) == SQLITE_ROW )
-   {
-    if (( sqlite3_column_type( stmt, 0 ) != SQLITE_NULL ) &&
-        ( sqlite3_column_type( stmt, 1 ) != SQLITE_NULL ) )
-    {
-     dem_config->fetchz_x = sqlite3_column_double(stmt, 0);
-     dem_config->fetchz_y = sqlite3_column_double(stmt, 1);
-    }
-   }
-   sqlite3_finalize( stmt );
+   fprintf(stderr, "-W-> create_dem_tiles_tables: CREATE TABLE error: %s\n", sql_err);
   }
-  else
+  sqlite3_free(sql_err);
+  return 0;
+ }
+ return 1;
+}
+static int
+insert_dem_tiles_layout(sqlite3 *db_handle, struct config_dem *dem_config, struct dem_grid *grid, int count_points, int is_raster, int verbose)
+{
+ int ret=0;
+ char *sql_statement = NULL;
+ char *sql_err = NULL;
+ sql_statement = sqlite3_mprintf("INSERT INTO '%s'.'%s_tiles_layout' VALUES "
+                                 "(%.17g, %.17g, %.17g, %.17g, %d, %d, %d, %d, %d, %d, %u, %.17g, %.17g, %.17g, %.17g, %d, %d)",
+                                 dem_config->schema,dem_config->dem_table,
+                                 grid->origin_x,grid->origin_y,grid->step_x,grid->step_y,grid->columns,grid->rows,
+                                 DEM_TILE_SIZE,grid->has_m,is_little_endian(),count_points,dem_config->dem_rows_count,
+                                 dem_config->dem_extent_minx,dem_config->dem_extent_miny,dem_config->dem_extent_maxx,dem_config->dem_extent_maxy,
+                                 dem_config->dem_srid,is_raster);
+ ret = sqlite3_exec(db_handle, sql_statement, NULL, NULL, &sql_err);
+ sqlite3_free(sql_statement);
+ if (ret != SQLITE_OK)
+ {
+  if (verbose)
   {
-   if (verbose)
-   {
-    fprintf(stderr, "-W-> callFetchZ : rc=%d sql[%s]\n",ret,sql_statement);
-   }
-   sqlite3_free(sql_statement);
+   fprintf(stderr, "-W-> insert_dem_tiles_layout: INSERT layout error: %s\n", sql_err);
   }
+  sqlite3_free(sql_err);
+  return 0;
  }
-// -- -- ---------------------------------- --
- ret=0;
- if ((dem_config->fetchz_x >= dem_config->dem_extent_minx) && (dem_config->fetchz_x <= dem_config->dem_extent_maxx) &&
-     (dem_config->fetchz_y >= dem_config->dem_extent_miny) && (dem_config->fetchz_y <= dem_config->dem_extent_maxy ) )
+ return 1;
+}
+static int
+load_dem_tiles_layout(sqlite3 *db_handle, struct config_dem *dem_config, struct dem_grid *grid, int *count_points)
+{
+ int ret=0;
+ int is_valid=0;
+ char *sql_statement = NULL;
+ sqlite3_stmt *stmt = NULL;
+ sql_statement = sqlite3_mprintf("SELECT origin_x, origin_y, step_x, step_y, columns, rows, tile_size, has_m, little_endian, "
+                                 "count_points, dem_rows_count, extent_minx, extent_miny, extent_maxx, extent_maxy, is_raster "
+                                 "FROM '%s'.'%s_tiles_layout'",
+                                 dem_config->schema,dem_config->dem_table);
+ ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &stmt, NULL );
+ sqlite3_free(sql_statement);
+ if ( ret != SQLITE_OK )
+ {// no Dem-Store
+  return 0;
+ }
+ while ( sqlite3_step( stmt ) == SQLITE_ROW )
  {
-  xx_use = malloc(sizeof (double) * 1);
-  yy_use = malloc(sizeof (double) * 1);
-  zz = malloc(sizeof (double) * 1);
-  mm_use = malloc(sizeof (double) * 1);
-  xx_use[0] = dem_config->fetchz_x;
-  yy_use[0] = dem_config->fetchz_y;
-  zz[0] = dem_config->dem_z;
-  mm_use[0] = dem_config->dem_m;
-  dem_config->count_points=1;
-  if (retrieve_dem_points(db_handle, dem_config, 1, xx_use, yy_use,zz,mm_use,&i_count_z, &i_count_m,verbose))
+  if ((sqlite3_column_int(stmt, 6) == DEM_TILE_SIZE) &&
+      ((sqlite3_column_int(stmt, 7) == 1) || (!dem_config->has_m)) &&
+      (sqlite3_column_int(stmt, 8) == is_little_endian()) &&
+      ((sqlite3_column_int(stmt, 15) == 1) ||
+       (((unsigned int)sqlite3_column_int64(stmt, 10) == dem_config->dem_rows_count) &&
+        (sqlite3_column_double(stmt, 11) == dem_config->dem_extent_minx) &&
+        (sqlite3_column_double(stmt, 12) == dem_config->dem_extent_miny) &&
+        (sqlite3_column_double(stmt, 13) == dem_config->dem_extent_maxx) &&
+        (sqlite3_column_double(stmt, 14) == dem_config->dem_extent_maxy))))
   {
-   ret=1;
-   dem_config->dem_z=zz[0];
-   dem_config->dem_m=mm_use[0];
+   grid->origin_x = sqlite3_column_double(stmt, 0);
+   grid->origin_y = sqlite3_column_double(stmt, 1);
+   grid->step_x = sqlite3_column_double(stmt, 2);
+   grid->step_y = sqlite3_column_double(stmt, 3);
+   grid->columns = sqlite3_column_int(stmt, 4);
+   grid->rows = sqlite3_column_int(stmt, 5);
+   *count_points = sqlite3_column_int(stmt, 9);
+   is_valid = 1;
   }
-  free(xx_use);
-  free(yy_use);
-  free(zz);
-  free(mm_use);
-  xx_use = NULL;
-  yy_use = NULL;
-  mm_use = NULL;
-  zz = NULL;
  }
-// -- -- ---------------------------------- --
- return ret;
+ sqlite3_finalize( stmt );
+ return is_valid;
 }
 // -- -- ---------------------------------- --
-// GNU libc (Linux, and FreeBSD)
-// - sys/param.h
-// -- -- ---------------------------------- --
-#define MIN(a,b) (((a)<(b))?(a):(b))
-#define MAX(a,b) (((a)>(b))?(a):(b))
-// -- -- ---------------------------------- --
-// Based on gg_transform.c gaiaTransformCommon
-// if the source geometry is out of range of the dem area, NULL is returned
-// if the if the z or m values have not changed, NULL is returned
-// - in both cases no update should be done and is not an error
-// if the Dem-Database Geometry-Column uses a different Srid
-// - a second Geometry will be sent with the transfored values
-// --> those x,y values will be sent to retrieve_dem_points
-//       to retrieve the nearst point
-// The retrieved z,m values will be copied WITHOUT any changes
+// Placing the Dem points found with sql_where into
+//  a block of the grid, starting at column/row offset
+// - points outside the block are ignored
+//   (the SpatialIndex uses rounded float32 values)
+// - returns the count of points placed,
+//   -1 if any point is not placed on the grid
 // -- -- ---------------------------------- --
-static gaiaGeomCollPtr
-getDemCollect(sqlite3 *db_handle, gaiaGeomCollPtr source_geom, gaiaGeomCollPtr dem_geom, struct config_dem *dem_config,
-              int *count_points_total, int *count_z_total, int *count_m_total, int verbose)
+static int
+fill_dem_grid(sqlite3 *db_handle, struct config_dem *dem_config, struct dem_grid *grid, const char *sql_where,
+              int column_offset, int row_offset, int columns, int rows, float *zz, float *mm, int verbose)
 {
-// creates a new GEOMETRY replacing found z-points from the original one
- int ib=0;
- int cnt=0;
+ int ret=0;
  int i=0;
- double *xx = NULL;
- double *yy = NULL;
- double *xx_dem = NULL;
- double *yy_dem = NULL;
- double *zz = NULL;
- double *mm = NULL;
- double *xx_use = NULL;
- double *yy_use = NULL;
- double *mm_use = NULL;
- int count_z=0;
- int count_m=0;
- int i_count_z=0;
- int i_count_m=0;
- double x = 0.0;
- double y = 0.0;
- double z = 0.0;
- double m = 0.0;
- double extent_minx=0.0;
- double extent_miny=0.0;
- double extent_maxx=0.0;
- double extent_maxy=0.0;
- int error = 0;
- int isExtentWithin=0;
- gaiaPointPtr pt = NULL;
- gaiaPointPtr pt_dem = NULL;
- gaiaLinestringPtr ln = NULL;
- gaiaLinestringPtr ln_dem = NULL;
- gaiaLinestringPtr dst_ln = NULL;
- gaiaPolygonPtr pg = NULL;
- gaiaPolygonPtr pg_dem = NULL;
- gaiaPolygonPtr dst_pg = NULL;
- gaiaRingPtr rng = NULL;
- gaiaRingPtr rng_dem = NULL;
- gaiaRingPtr dst_rng = NULL;
- gaiaGeomCollPtr dst = NULL;
- if (source_geom->DimensionModel == GAIA_XY_Z)
-  dst = gaiaAllocGeomCollXYZ();
- else if (source_geom->DimensionModel == GAIA_XY_M)
-  dst = gaiaAllocGeomCollXYM();
- else if (source_geom->DimensionModel == GAIA_XY_Z_M)
-  dst = gaiaAllocGeomCollXYZM();
- else
-  dst = gaiaAllocGeomColl ();
- cnt = 0;
- dst->Srid = source_geom->Srid;
- pt = source_geom->FirstPoint;
- extent_minx=source_geom->MinX;
- extent_miny=source_geom->MinY;
- extent_maxx=source_geom->MaxX;
- extent_maxy=source_geom->MaxY;
- if (dem_geom)
+ int count_points=0;
+ char *sql_statement = NULL;
+ sqlite3_stmt *stmt = NULL;
+ for (i=0; i<(columns * rows); i++)
  {
-  extent_minx=dem_geom->MinX;
-  extent_miny=dem_geom->MinY;
-  extent_maxx=dem_geom->MaxX;
-  extent_maxy=dem_geom->MaxY;
+  zz[i] = DEM_GRID_NODATA;
+  if (mm)
+  {
+   mm[i] = DEM_GRID_NODATA;
+  }
  }
-// -- -- ---------------------------------- --
-// Touches (partially within)
-// -- -- ---------------------------------- --
- int left_x = MAX(extent_minx, dem_config->dem_extent_minx);
- int right_x = MIN(extent_maxx, dem_config->dem_extent_maxx);
- int bottom_y = MAX(extent_miny, dem_config->dem_extent_miny);
- int top_y = MIN(extent_maxy, dem_config->dem_extent_maxy);
- if ((right_x > left_x) && (top_y > bottom_y))
+ if (mm)
  {
-  isExtentWithin=1;
+  sql_statement = sqlite3_mprintf("SELECT ST_X(\"%s\"), ST_Y(\"%s\"), ST_Z(\"%s\"), ST_M(\"%s\") FROM '%s'.'%s' %s",
+                                  dem_config->dem_geometry,dem_config->dem_geometry,dem_config->dem_geometry,dem_config->dem_geometry,
+                                  dem_config->schema,dem_config->dem_table,sql_where);
  }
- else if ((right_x == left_x) && (top_y == bottom_y))
+ else
  {
-  // This is a point
-  isExtentWithin=1;
+  sql_statement = sqlite3_mprintf("SELECT ST_X(\"%s\"), ST_Y(\"%s\"), ST_Z(\"%s\") FROM '%s'.'%s' %s",
+                                  dem_config->dem_geometry,dem_config->dem_geometry,dem_config->dem_geometry,
+                                  dem_config->schema,dem_config->dem_table,sql_where);
  }
-// -- -- ---------------------------------- --
-#if 0
- if (verbose)
+ ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &stmt, NULL );
+ if ( ret != SQLITE_OK )
  {
-  fprintf(stderr, "-I-> getDemCollect: isExtentWithin[%d]  left_x[%d]  right_x[%d] bottom_y[%d]  top_y[%d]\n",isExtentWithin,left_x,right_x,bottom_y,top_y);
+  if (verbose)
+  {
+   fprintf(stderr, "-W-> fill_dem_grid: rc=%d sql[%s]\n",ret,sql_statement);
+  }
+  sqlite3_free(sql_statement);
+  return -1;
  }
-#endif
- if (!isExtentWithin)
+ sqlite3_free(sql_statement);
+ while ( sqlite3_step( stmt ) == SQLITE_ROW )
  {
-  error=1;
-  goto stop;
- }
-// -- -- ---------------------------------- --
-// Call only if geometry is partially within the Dem extent
-// -- -- ---------------------------------- --
-// Points
-// -- -- ---------------------------------- --
- while (pt)
+  double col_x=0.0;
+  double row_y=0.0;
+  int column=0;
+  int row=0;
+  if (( sqlite3_column_type( stmt, 0 ) == SQLITE_NULL ) ||
+      ( sqlite3_column_type( stmt, 2 ) == SQLITE_NULL ))
+  {
+   continue;
+  }
+  col_x = (sqlite3_column_double(stmt, 0) - grid->origin_x) / grid->step_x;
+  row_y = (sqlite3_column_double(stmt, 1) - grid->origin_y) / grid->step_y;
+  column = (int)floor(col_x + 0.5);
+  row = (int)floor(row_y + 0.5);
+  if ((fabs(col_x - column) > 0.25) || (fabs(row_y - row) > 0.25))
+  {// not a regular grid
+   count_points = -1;
+   break;
+  }
+  column -= column_offset;
+  row -= row_offset;
+  if ((column < 0) || (column >= columns) || (row < 0) || (row >= rows))
+  {
+   continue;
+  }
+  zz[(row * columns) + column] = (float)sqlite3_column_double(stmt, 2);
+  if ((mm) && ( sqlite3_column_type( stmt, 3 ) != SQLITE_NULL ))
+  {
+   mm[(row * columns) + column] = (float)sqlite3_column_double(stmt, 3);
+  }
+  count_points++;
+ }
+ sqlite3_finalize( stmt );
+ return count_points;
+}
+// -- -- ---------------------------------- --
+// Building the tiled Dem-Store
+// - each tile is filled from the SpatialIndex,
+//   only one tile is held in memory
+// -- -- ---------------------------------- --
+static int
+build_dem_tiles(sqlite3 *db_handle, struct config_dem *dem_config, struct dem_grid *grid, int count_points, int verbose)
+{
+ int ret=0;
+ int is_valid=0;
+ int tiles_x=(grid->columns + DEM_TILE_SIZE - 1) / DEM_TILE_SIZE;
+ int tiles_y=(grid->rows + DEM_TILE_SIZE - 1) / DEM_TILE_SIZE;
+ int tile_x=0;
+ int tile_y=0;
+ int count_tiles=0;
+ int count_tile_points=0;
+ int tile_bytes=sizeof (float) * DEM_TILE_SIZE * DEM_TILE_SIZE;
+ int blob_bytes=0;
+ unsigned char *blob = NULL;
+ char *sql_statement = NULL;
+ char *sql_where = NULL;
+ char *sql_err = NULL;
+ sqlite3_stmt *stmt = NULL;
+ float *zz = NULL;
+ float *mm = NULL;
+// -- -- ---------------------------------- --
+ if (verbose)
  {
-  // counting POINTs
-  cnt++;
-  pt = pt->Next;
+  fprintf(stderr, "-I-> Dem-Store: building %d x %d tiles of [%s]\n",tiles_x,tiles_y,dem_config->dem_table);
  }
- if (cnt)
+ if (sqlite3_exec(db_handle, "BEGIN", NULL, NULL, &sql_err) != SQLITE_OK)
  {
-  // reprojecting POINTs
-  xx = malloc(sizeof (double) * cnt);
-  yy = malloc(sizeof (double) * cnt);
-  if (dem_geom)
-  {
-   xx_dem = malloc(sizeof (double) * cnt);
-   yy_dem = malloc(sizeof (double) * cnt);
-   xx_use = xx_dem;
-   yy_use = yy_dem;
-  }
-  else
+  if (verbose)
   {
-   xx_use = xx;
-   yy_use = yy;
+   fprintf(stderr, "-W-> build_dem_tiles: BEGIN TRANSACTION error: %s\n", sql_err);
   }
-  zz = malloc(sizeof (double) * cnt);
-  if (source_geom->DimensionModel == GAIA_XY_M || source_geom->DimensionModel == GAIA_XY_Z_M)
-   mm = malloc(sizeof (double) * cnt);
-  i = 0;
-  pt = source_geom->FirstPoint;
-  if (dem_geom)
+  sqlite3_free(sql_err);
+  return 0;
+ }
+ if (!create_dem_tiles_tables(db_handle, dem_config, verbose))
+ {
+  goto stop;
+ }
+ sql_statement = sqlite3_mprintf("INSERT INTO '%s'.'%s_tiles' (tile_x, tile_y, z_values, m_values) VALUES (?, ?, ?, ?)",
+                                 dem_config->schema,dem_config->dem_table);
+ ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &stmt, NULL );
+ if ( ret != SQLITE_OK )
+ {
+  if (verbose)
   {
-   pt_dem = dem_geom->FirstPoint;
+   fprintf(stderr, "-W-> build_dem_tiles: rc=%d sql[%s]\n",ret,sql_statement);
   }
-  while (pt)
+  sqlite3_free(sql_statement);
+  goto stop;
+ }
+ sqlite3_free(sql_statement);
+ zz = malloc(tile_bytes);
+ if (dem_config->has_m)
+ {
+  mm = malloc(tile_bytes);
+ }
+ for (tile_y=0; tile_y<tiles_y; tile_y++)
+ {
+  for (tile_x=0; tile_x<tiles_x; tile_x++)
   {
-   // inserting points to be converted in temporary arrays
-   xx[i] = pt->X;
-   yy[i] = pt->Y;
-   if (source_geom->DimensionModel == GAIA_XY_Z || source_geom->DimensionModel == GAIA_XY_Z_M)
-    zz[i] = pt->Z;
-   else
-    zz[i] = 0.0;
-   if (source_geom->DimensionModel == GAIA_XY_M || source_geom->DimensionModel == GAIA_XY_Z_M)
-    mm[i] = pt->M;
-   if (pt_dem)
+   // the tile cells, extended by half a cell
+   double minx=grid->origin_x + (((tile_x * DEM_TILE_SIZE) - 0.5) * grid->step_x);
+   double miny=grid->origin_y + (((tile_y * DEM_TILE_SIZE) - 0.5) * grid->step_y);
+   double maxx=minx + (DEM_TILE_SIZE * grid->step_x);
+   double maxy=miny + (DEM_TILE_SIZE * grid->step_y);
+   sql_where = sqlite3_mprintf("WHERE ROWID IN (SELECT ROWID FROM SpatialIndex WHERE "
+                               "f_table_name = 'DB=%s.%s' AND f_geometry_column = '%s' AND "
+                               "search_frame = BuildMbr(%2.7f,%2.7f,%2.7f,%2.7f,%d))",
+                               dem_config->schema,dem_config->dem_table,dem_config->dem_geometry,
+                               minx,miny,maxx,maxy,dem_config->dem_srid);
+   count_tile_points = fill_dem_grid(db_handle, dem_config, grid, sql_where, tile_x * DEM_TILE_SIZE, tile_y * DEM_TILE_SIZE,
+                                     DEM_TILE_SIZE, DEM_TILE_SIZE, zz, mm, verbose);
+   sqlite3_free(sql_where);
+   if (count_tile_points < 0)
    {
-    xx_dem[i] = pt_dem->X;
-    yy_dem[i] = pt_dem->Y;
+    if (verbose)
+    {
+     fprintf(stderr, "-W-> build_dem_tiles: the Dem points are not a regular grid, using SQL queries\n");
+    }
+    goto stop;
    }
-   i++;
-   // -- -- ---------------------------------- --
-   // MultiPoints, next
-   // -- -- ---------------------------------- --
-   pt = pt->Next;
-   if (dem_geom)
+   if (count_tile_points == 0)
+   {// nothing to store
+    continue;
+   }
+   sqlite3_reset(stmt);
+   sqlite3_clear_bindings(stmt);
+   sqlite3_bind_int(stmt, 1, tile_x);
+   sqlite3_bind_int(stmt, 2, tile_y);
+   blob = compress_dem_tile(zz, &blob_bytes);
+   sqlite3_bind_blob(stmt, 3, blob, blob_bytes, free);
+   if (mm)
    {
-    pt_dem =pt_dem->Next;
+    blob = compress_dem_tile(mm, &blob_bytes);
+    sqlite3_bind_blob(stmt, 4, blob, blob_bytes, free);
+   }
+   ret = sqlite3_step(stmt);
+   if ((ret != SQLITE_DONE) && (ret != SQLITE_ROW))
+   {
+    if (verbose)
+    {
+     fprintf(stderr, "-W-> build_dem_tiles: INSERT error: %s\n", sqlite3_errmsg(db_handle));
+    }
+    goto stop;
+   }
+   count_tiles++;
+   if (dem_config->profile)
+   {
+    dem_config->profile->rows_written++;
    }
   }
-  if ((dem_config->has_m) && (mm) )
-  {
-   mm_use = mm;
-  }
-  // searching for nearest point
-  *count_points_total+=cnt;
-  i_count_z=0;
-  i_count_m=0;
-  dem_config->count_points=cnt;
-  if (retrieve_dem_points(db_handle, dem_config, cnt, xx_use, yy_use,zz,mm_use,&i_count_z, &i_count_m,verbose))
-  {
-   *count_z_total+=i_count_z;
-   *count_m_total+=i_count_m;
-   count_z+=i_count_z;
-   count_m+=i_count_m;
-  }
-  xx_use = NULL;
-  yy_use = NULL;
-  mm_use = NULL;
-  // inserting the reprojected POINTs in the new GEOMETRY
-  for (i = 0; i < cnt; i++)
-  {
-   x = xx[i];
-   y = yy[i];
-   if (source_geom->DimensionModel == GAIA_XY_Z || source_geom->DimensionModel == GAIA_XY_Z_M)
-    z = zz[i];
-   else
-    z = 0.0;
-   if (source_geom->DimensionModel == GAIA_XY_M || source_geom->DimensionModel == GAIA_XY_Z_M)
-    m = mm[i];
-   else
-    m = 0.0;
-   if (dst->DimensionModel == GAIA_XY_Z)
-    gaiaAddPointToGeomCollXYZ(dst, x, y, z);
-   else if (dst->DimensionModel == GAIA_XY_M)
-    gaiaAddPointToGeomCollXYM(dst, x, y, m);
-   else if (dst->DimensionModel == GAIA_XY_Z_M)
-    gaiaAddPointToGeomCollXYZM(dst, x, y, z, m);
-   else
-    gaiaAddPointToGeomColl(dst, x, y);
+  if (verbose)
+  {// overwrite the previous message [\r]
+   fprintf(stderr, "\r tile rows[%d/%d] tiles stored[%d] ",tile_y+1,tiles_y,count_tiles);
   }
-  free(xx);
-  free(yy);
+ }
+ if (verbose)
+ {// new line after last message [\n]
+  fprintf(stderr, "\n");
+ }
+ if (!insert_dem_tiles_layout(db_handle, dem_config, grid, count_points, 0, verbose))
+ {
+  goto stop;
+ }
+ is_valid = 1;
+// -- -- ---------------------------------- --
+stop:
+ if (stmt)
+ {
+  sqlite3_finalize( stmt );
+ }
+ if (zz)
+ {
   free(zz);
-  xx = NULL;
-  yy = NULL;
-  zz = NULL;
-  if (xx_dem)
+ }
+ if (mm)
+ {
+  free(mm);
+ }
+ if (is_valid)
+ {
+  if (sqlite3_exec(db_handle, "COMMIT", NULL, NULL, &sql_err) != SQLITE_OK)
   {
-   free(xx_dem);
-   xx_dem = NULL;
-   free(yy_dem);
-   yy_dem = NULL;
+   if (verbose)
+   {
+    fprintf(stderr, "-W-> build_dem_tiles: COMMIT TRANSACTION error: %s\n", sql_err);
+   }
+   sqlite3_free(sql_err);
+   is_valid = 0;
   }
-  if (source_geom->DimensionModel == GAIA_XY_M || source_geom->DimensionModel == GAIA_XY_Z_M)
+ }
+ else
+ {
+  sqlite3_exec(db_handle, "ROLLBACK", NULL, NULL, NULL);
+ }
+ return is_valid;
+}
+// -- -- ---------------------------------- --
+// Opening the LRU tile cache of the Dem-Store
+// - the most recently used tile is always the first one
+// -- -- ---------------------------------- --
+static struct dem_tile_cache *
+open_dem_tiles(sqlite3 *db_handle, struct config_dem *dem_config, struct dem_grid *grid, int verbose)
+{
+ int ret=0;
+ char *sql_statement = NULL;
+ struct dem_tile_cache *cache = NULL;
+ sqlite3_int64 count_tiles=0;
+ cache = malloc(sizeof (struct dem_tile_cache));
+ cache->stmt = NULL;
+ cache->tiles_x = (grid->columns + DEM_TILE_SIZE - 1) / DEM_TILE_SIZE;
+ cache->tile_bytes = sizeof (float) * DEM_TILE_SIZE * DEM_TILE_SIZE;
+ if (grid->has_m)
+ {
+  cache->tile_bytes *= 2;
+ }
+ cache->bytes_max = (sqlite3_int64)dem_config->cache_size * 1024 * 1024;
+ cache->bytes_used = 0;
+ cache->first = NULL;
+ cache->last = NULL;
+ cache->current = NULL;
+ cache->count_loaded = 0;
+ cache->count_evicted = 0;
+ count_tiles = cache->bytes_max / cache->tile_bytes;
+ cache->hash_size = 64;
+ while ((cache->hash_size < count_tiles) && (cache->hash_size < 16777216))
+ {
+  cache->hash_size *= 2;
+ }
+ cache->hash = calloc(cache->hash_size, sizeof (struct dem_tile *));
+ sql_statement = sqlite3_mprintf("SELECT z_values, m_values FROM '%s'.'%s_tiles' WHERE tile_x = ? AND tile_y = ?",
+                                 dem_config->schema,dem_config->dem_table);
+ ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &cache->stmt, NULL );
+ if ( ret != SQLITE_OK )
+ {
+  if (verbose)
   {
-   free(mm);
-   mm = NULL;
+   fprintf(stderr, "-W-> open_dem_tiles: rc=%d sql[%s]\n",ret,sql_statement);
   }
+  sqlite3_free(sql_statement);
+  free_dem_tile_cache(cache, 0);
+  return NULL;
  }
- if (error)
-  goto stop;
+ sqlite3_free(sql_statement);
+ if (verbose)
+ {
+  fprintf(stderr, "-I-> Dem-Store: %d columns x %d rows, step x/y(%2.7f,%2.7f), tile cache of %d MB\n",
+          grid->columns,grid->rows,grid->step_x,grid->step_y,dem_config->cache_size);
+ }
+ return cache;
+}
 // -- -- ---------------------------------- --
-// Linestrings
+// Returns a tile of the Dem-Store
+// - loading it (and evicting the least recently
+//   used tiles) if not already cached
+// - tiles without data are cached with zz=NULL,
+//   so that they are queried only once
 // -- -- ---------------------------------- --
- ln = source_geom->FirstLinestring;
- if (dem_geom)
+static struct dem_tile *
+get_dem_tile(struct dem_tile_cache *cache, int has_m, int tile_x, int tile_y)
+{
+ int key=(int)((((sqlite3_uint64)tile_y * cache->tiles_x) + tile_x) & (cache->hash_size - 1));
+ struct dem_tile *tile = NULL;
+ struct dem_tile **tile_hash = NULL;
+ if ((cache->current) && (cache->current->tile_x == tile_x) && (cache->current->tile_y == tile_y))
  {
-  ln_dem = dem_geom->FirstLinestring;
+  return cache->current;
  }
-// Call only if geometry is inside the Dem extent
- while (ln)
+ tile = cache->hash[key];
+ while ((tile) && ((tile->tile_x != tile_x) || (tile->tile_y != tile_y)))
  {
-  // reprojecting LINESTRINGs
-  cnt = ln->Points;
-  xx = malloc(sizeof (double) * cnt);
-  yy = malloc(sizeof (double) * cnt);
-  if (dem_geom)
+  tile = tile->hash_next;
+ }
+ if (tile)
+ {// moving to the top of the LRU list
+  if (tile->prev)
   {
-   xx_dem = malloc(sizeof (double) * cnt);
-   yy_dem = malloc(sizeof (double) * cnt);
-   xx_use = xx_dem;
-   yy_use = yy_dem;
+   tile->prev->next = tile->next;
+   if (tile->next)
+   {
+    tile->next->prev = tile->prev;
+   }
+   else
+   {
+    cache->last = tile->prev;
+   }
+   tile->prev = NULL;
+   tile->next = cache->first;
+   cache->first->prev = tile;
+   cache->first = tile;
+  }
+  cache->current = tile;
+  return tile;
+ }
+// -- -- ---------------------------------- --
+// evicting the least recently used tiles
+// -- -- ---------------------------------- --
+ while ((cache->last) && (cache->bytes_used + cache->tile_bytes > cache->bytes_max))
+ {
+  struct dem_tile *tile_evict = cache->last;
+  tile_hash = &(cache->hash[(int)((((sqlite3_uint64)tile_evict->tile_y * cache->tiles_x) + tile_evict->tile_x) & (cache->hash_size - 1))]);
+  while (*tile_hash != tile_evict)
+  {
+   tile_hash = &((*tile_hash)->hash_next);
+  }
+  *tile_hash = tile_evict->hash_next;
+  cache->last = tile_evict->prev;
+  if (cache->last)
+  {
+   cache->last->next = NULL;
   }
   else
   {
-   xx_use = xx;
-   yy_use = yy;
+   cache->first = NULL;
   }
-  zz = malloc(sizeof (double) * cnt);
-  if (ln->DimensionModel == GAIA_XY_M || ln->DimensionModel == GAIA_XY_Z_M)
-   mm = malloc(sizeof (double) * cnt);
-  for (i = 0; i < cnt; i++)
+  cache->bytes_used -= tile_evict->bytes;
+  free_dem_tile(tile_evict);
+  cache->count_evicted++;
+ }
+// -- -- ---------------------------------- --
+// loading the tile
+// -- -- ---------------------------------- --
+ tile = malloc(sizeof (struct dem_tile));
+ tile->tile_x = tile_x;
+ tile->tile_y = tile_y;
+ tile->zz = NULL;
+ tile->mm = NULL;
+ tile->bytes = sizeof (struct dem_tile);
+ sqlite3_reset(cache->stmt);
+ sqlite3_clear_bindings(cache->stmt);
+ sqlite3_bind_int(cache->stmt, 1, tile_x);
+ sqlite3_bind_int(cache->stmt, 2, tile_y);
+ while ( sqlite3_step( cache->stmt ) == SQLITE_ROW )
+ {
+  int tile_bytes=sizeof (float) * DEM_TILE_SIZE * DEM_TILE_SIZE;
+  if (sqlite3_column_type( cache->stmt, 0 ) == SQLITE_BLOB)
   {
-   // inserting points to be converted in temporary arrays
-   if (ln->DimensionModel == GAIA_XY_Z)
-   {
-    gaiaGetPointXYZ(ln->Coords, i, &x, &y, &z);
-   }
-   else if (ln->DimensionModel == GAIA_XY_M)
-   {
-    gaiaGetPointXYM(ln->Coords, i, &x, &y, &m);
-   }
-   else if (ln->DimensionModel == GAIA_XY_Z_M)
-   {
-    gaiaGetPointXYZM(ln->Coords, i, &x, &y, &z, &m);
-   }
-   else
+   tile->zz = malloc(tile_bytes);
+   if (!uncompress_dem_tile(sqlite3_column_blob( cache->stmt, 0 ), sqlite3_column_bytes( cache->stmt, 0 ), tile->zz))
    {
-    gaiaGetPoint(ln->Coords, i, &x, &y);
+    free(tile->zz);
+    tile->zz = NULL;
+    continue;
    }
-   xx[i] = x;
-   yy[i] = y;
-   if (ln_dem)
+   tile->bytes += cache->tile_bytes;
+   if ((has_m) && (sqlite3_column_type( cache->stmt, 1 ) == SQLITE_BLOB))
    {
-    if (ln_dem->DimensionModel == GAIA_XY_Z)
+    tile->mm = malloc(tile_bytes);
+    if (!uncompress_dem_tile(sqlite3_column_blob( cache->stmt, 1 ), sqlite3_column_bytes( cache->stmt, 1 ), tile->mm))
     {
-     gaiaGetPointXYZ(ln_dem->Coords, i, &x, &y, &z);
+     free(tile->mm);
+     tile->mm = NULL;
     }
-    else if (ln_dem->DimensionModel == GAIA_XY_M)
-    {
-     gaiaGetPointXYM(ln->Coords, i, &x, &y, &m);
-    }
-    else if (ln_dem->DimensionModel == GAIA_XY_Z_M)
-    {
-     gaiaGetPointXYZM(ln_dem->Coords, i, &x, &y, &z, &m);
-    }
-    else
-    {
-     gaiaGetPoint(ln_dem->Coords, i, &x, &y);
-    }
-    xx_dem[i] = x;
-    yy_dem[i] = y;
    }
-   if (ln->DimensionModel == GAIA_XY_Z || ln->DimensionModel == GAIA_XY_Z_M)
-    zz[i] = z;
-   else
-    zz[i] = 0.0;
-   if (ln->DimensionModel == GAIA_XY_M || ln->DimensionModel == GAIA_XY_Z_M)
-    mm[i] = m;
   }
-  if ((dem_config->has_m) && (mm) )
+ }
+ cache->bytes_used += tile->bytes;
+ cache->count_loaded++;
+ tile->hash_next = cache->hash[key];
+ cache->hash[key] = tile;
+ tile->prev = NULL;
+ tile->next = cache->first;
+ if (cache->first)
+ {
+  cache->first->prev = tile;
+ }
+ cache->first = tile;
+ if (cache->last == NULL)
+ {
+  cache->last = tile;
+ }
+ cache->current = tile;
+ return tile;
+}
+// -- -- ---------------------------------- --
+// Reading the whole Dem-Store into the in-memory grid
+// -- -- ---------------------------------- --
+static int
+read_dem_tiles_grid(sqlite3 *db_handle, struct config_dem *dem_config, struct dem_grid *grid, int verbose)
+{
+ int ret=0;
+ int i=0;
+ int row=0;
+ int tile_x=0;
+ int tile_y=0;
+ int count_columns=0;
+ int count_rows=0;
+ sqlite3_int64 count_cells=(sqlite3_int64)grid->columns * (sqlite3_int64)grid->rows;
+ char *sql_statement = NULL;
+ sqlite3_stmt *stmt = NULL;
+ float *zz = malloc(sizeof (float) * DEM_TILE_SIZE * DEM_TILE_SIZE);
+ float *mm = NULL;
+ if (grid->mm)
+ {
+  mm = malloc(sizeof (float) * DEM_TILE_SIZE * DEM_TILE_SIZE);
+ }
+ for (i=0; i<count_cells; i++)
+ {
+  grid->zz[i] = DEM_GRID_NODATA;
+  if (grid->mm)
   {
-   mm_use = mm;
+   grid->mm[i] = DEM_GRID_NODATA;
   }
-  // searching for nearest point
-  *count_points_total+=cnt;
-  i_count_z=0;
-  i_count_m=0;
-  dem_config->count_points=cnt;
-  if (retrieve_dem_points(db_handle, dem_config, cnt, xx_use, yy_use,zz,mm_use,&i_count_z, &i_count_m,verbose))
+ }
+ sql_statement = sqlite3_mprintf("SELECT tile_x, tile_y, z_values, m_values FROM '%s'.'%s_tiles'",
+                                 dem_config->schema,dem_config->dem_table);
+ ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &stmt, NULL );
+ if ( ret != SQLITE_OK )
+ {
+  if (verbose)
   {
-   *count_z_total+=i_count_z;
-   *count_m_total+=i_count_m;
-   count_z+=i_count_z;
-   count_m+=i_count_m;
+   fprintf(stderr, "-W-> read_dem_tiles_grid: rc=%d sql[%s]\n",ret,sql_statement);
   }
-  xx_use = NULL;
-  yy_use = NULL;
-  mm_use = NULL;
-  // inserting the reprojected LINESTRING in the new GEOMETRY
-  dst_ln = gaiaAddLinestringToGeomColl (dst, cnt);
-  for (i = 0; i < cnt; i++)
+  ret = 0;
+ }
+ else
+ {
+  ret = 1;
+  while ( sqlite3_step( stmt ) == SQLITE_ROW )
   {
-   // setting LINESTRING points
-   x = xx[i];
-   y = yy[i];
-   if (ln->DimensionModel == GAIA_XY_Z || ln->DimensionModel == GAIA_XY_Z_M)
-    z = zz[i];
-   else
-    z = 0.0;
-   if (ln->DimensionModel == GAIA_XY_M || ln->DimensionModel == GAIA_XY_Z_M)
-    m = mm[i];
-   else
-    m = 0.0;
-   if (dst_ln->DimensionModel == GAIA_XY_Z)
+   tile_x = sqlite3_column_int(stmt, 0);
+   tile_y = sqlite3_column_int(stmt, 1);
+   if ((tile_x < 0) || (tile_y < 0) ||
+       ((tile_x * DEM_TILE_SIZE) >= grid->columns) || ((tile_y * DEM_TILE_SIZE) >= grid->rows) ||
+       (!uncompress_dem_tile(sqlite3_column_blob(stmt, 2), sqlite3_column_bytes(stmt, 2), zz)))
    {
-    gaiaSetPointXYZ (dst_ln->Coords, i, x, y, z);
+    ret = 0;
+    break;
    }
-   else if (dst_ln->DimensionModel == GAIA_XY_M)
+   if ((mm) && (sqlite3_column_type( stmt, 3 ) == SQLITE_BLOB))
    {
-    gaiaSetPointXYM(dst_ln->Coords, i, x, y, m);
+    if (!uncompress_dem_tile(sqlite3_column_blob(stmt, 3), sqlite3_column_bytes(stmt, 3), mm))
+    {
+     ret = 0;
+     break;
+    }
    }
-   else if (dst_ln->DimensionModel == GAIA_XY_Z_M)
+   count_columns = grid->columns - (tile_x * DEM_TILE_SIZE);
+   if (count_columns > DEM_TILE_SIZE)
    {
-    gaiaSetPointXYZM(dst_ln->Coords, i, x, y, z, m);
+    count_columns = DEM_TILE_SIZE;
    }
-   else
+   count_rows = grid->rows - (tile_y * DEM_TILE_SIZE);
+   if (count_rows > DEM_TILE_SIZE)
    {
-    gaiaSetPoint(dst_ln->Coords, i, x, y);
+    count_rows = DEM_TILE_SIZE;
+   }
+   for (row=0; row<count_rows; row++)
+   {
+    sqlite3_int64 offset=((sqlite3_int64)((tile_y * DEM_TILE_SIZE) + row) * grid->columns) + (tile_x * DEM_TILE_SIZE);
+    memcpy(grid->zz + offset, zz + (row * DEM_TILE_SIZE), sizeof (float) * count_columns);
+    if ((mm) && (sqlite3_column_type( stmt, 3 ) == SQLITE_BLOB))
+    {
+     memcpy(grid->mm + offset, mm + (row * DEM_TILE_SIZE), sizeof (float) * count_columns);
+    }
    }
   }
-  free(xx);
-  free(yy);
-  xx = NULL;
-  yy = NULL;
-  if (xx_dem)
+  sqlite3_finalize( stmt );
+ }
+ sqlite3_free(sql_statement);
+ free(zz);
+ if (mm)
+ {
+  free(mm);
+ }
+ if ((!ret) && (verbose))
+ {
+  fprintf(stderr, "-W-> read_dem_tiles_grid: invalid tile in [%s_tiles]\n",dem_config->dem_table);
+ }
+ return ret;
+}
+// -- -- ---------------------------------- --
+// Loading the Dem points within the given area
+// - when use_window=0, the whole Dem is loaded
+//   (or the tiled Dem-Store is used, when too big)
+// - otherwise only points within the window (using the SpatialIndex)
+// - a Dem-Raster is always read from its tiles, with
+//   use_window only the needed tiles are read
+// -- -- ---------------------------------- --
+static struct dem_grid *
+load_dem_grid(sqlite3 *db_handle, struct config_dem *dem_config, int use_window, double minx, double miny, double maxx, double maxy, int verbose)
+{
+ int ret=0;
+ char *sql_where = NULL;
+ char *sql_statement = NULL;
+ sqlite3_stmt *stmt = NULL;
+ sqlite3_int64 count_cells=0;
+ sqlite3_int64 count_bytes=0;
+ int count_points=0;
+ int count_x=0;
+ int count_y=0;
+ int has_tiles=0;
+ struct dem_grid *grid = NULL;
+// -- -- ---------------------------------- --
+ if (use_window)
+ {
+  sql_where = sqlite3_mprintf("WHERE ROWID IN (SELECT ROWID FROM SpatialIndex WHERE "
+                              "f_table_name = 'DB=%s.%s' AND f_geometry_column = '%s' AND "
+                              "search_frame = BuildMbr(%2.7f,%2.7f,%2.7f,%2.7f,%d))",
+                              dem_config->schema,dem_config->dem_table,dem_config->dem_geometry,
+                              minx,miny,maxx,maxy,dem_config->dem_srid);
+ }
+ else
+ {
+  sql_where = sqlite3_mprintf("");
+ }
+ grid = malloc(sizeof (struct dem_grid));
+ grid->zz = NULL;
+ grid->mm = NULL;
+ grid->tiles = NULL;
+ grid->columns = 0;
+ grid->rows = 0;
+ grid->has_m = dem_config->has_m;
+ grid->interpolation = dem_config->interpolation;
+ if ((!use_window) || (dem_config->is_raster))
+ {// a valid Dem-Store already contains the layout
+  has_tiles = load_dem_tiles_layout(db_handle, dem_config, grid, &count_points);
+ }
+ if ((!has_tiles) && (dem_config->is_raster))
+ {
+  if (verbose)
   {
-   free(xx_dem);
-   xx_dem = NULL;
-   free(yy_dem);
-   yy_dem = NULL;
+   fprintf(stderr, "-W-> load_dem_grid: the Dem-Raster layout of [%s] was not found\n",dem_config->dem_table);
   }
-  free(zz);
-  zz = NULL;
-  if (ln->DimensionModel == GAIA_XY_M || ln->DimensionModel == GAIA_XY_Z_M)
+  goto stop;
+ }
+ if (!has_tiles)
+ {
+// -- -- ---------------------------------- --
+// first pass: the grid layout
+// -- -- ---------------------------------- --
+  sql_statement = sqlite3_mprintf("SELECT Min(x), Min(y), Max(x), Max(y), Count(*), Count(DISTINCT x), Count(DISTINCT y) "
+                                  "FROM (SELECT ST_X(\"%s\") AS x, ST_Y(\"%s\") AS y FROM '%s'.'%s' %s)",
+                                  dem_config->dem_geometry,dem_config->dem_geometry,dem_config->schema,dem_config->dem_table,sql_where);
+  ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &stmt, NULL );
+  if ( ret != SQLITE_OK )
   {
-   free(mm);
-   mm = NULL;
+   if (verbose)
+   {
+    fprintf(stderr, "-W-> load_dem_grid: rc=%d sql[%s]\n",ret,sql_statement);
+   }
+   goto stop;
   }
-  if (error)
+  while ( sqlite3_step( stmt ) == SQLITE_ROW )
+  {
+   if ( sqlite3_column_type( stmt, 0 ) != SQLITE_NULL )
+   {
+    grid->origin_x = sqlite3_column_double(stmt, 0);
+    grid->origin_y = sqlite3_column_double(stmt, 1);
+    grid->step_x = sqlite3_column_double(stmt, 2) - grid->origin_x;
+    grid->step_y = sqlite3_column_double(stmt, 3) - grid->origin_y;
+    count_points = sqlite3_column_int(stmt, 4);
+    count_x = sqlite3_column_int(stmt, 5);
+    count_y = sqlite3_column_int(stmt, 6);
+   }
+  }
+  sqlite3_finalize( stmt );
+  stmt = NULL;
+  sqlite3_free(sql_statement);
+  sql_statement = NULL;
+  if ((count_points == 0) || (count_x == 0) || (count_y == 0))
+  {
+   goto stop;
+  }
+  if (count_x > 1)
+  {
+   grid->step_x /= (double)(count_x-1);
+  }
+  else
+  {
+   grid->step_x = dem_config->dem_resolution;
+  }
+  if (count_y > 1)
+  {
+   grid->step_y /= (double)(count_y-1);
+  }
+  else
+  {
+   grid->step_y = dem_config->dem_resolution;
+  }
+  if ((grid->step_x <= 0.0) || (grid->step_y <= 0.0))
+  {
+   goto stop;
+  }
+  grid->columns = count_x;
+  grid->rows = count_y;
+ }
+ count_cells = (sqlite3_int64)grid->columns * (sqlite3_int64)grid->rows;
+ count_bytes = count_cells * sizeof (float);
+ if (dem_config->has_m)
+ {
+  count_bytes *= 2;
+ }
+ if (((use_window) && (has_tiles)) ||
+     ((!use_window) && ((count_bytes > (sqlite3_int64)dem_config->cache_size * 1024 * 1024) || (count_cells > DEM_GRID_MAX_CELLS))))
+ {// too big (or only a few cells needed): using the tiled Dem-Store
+  if (!has_tiles)
+  {
+   if (!build_dem_tiles(db_handle, dem_config, grid, count_points, verbose))
+   {
+    goto stop;
+   }
+  }
+  grid->tiles = open_dem_tiles(db_handle, dem_config, grid, verbose);
+  if (grid->tiles == NULL)
+  {
    goto stop;
+  }
+  sqlite3_free(sql_where);
+  return grid;
+ }
+ if (count_cells > DEM_GRID_MAX_CELLS)
+ {
+  goto stop;
+ }
+ grid->zz = malloc(sizeof (float) * count_cells);
+ if (dem_config->has_m)
+ {
+  grid->mm = malloc(sizeof (float) * count_cells);
+ }
+ if ((grid->zz == NULL) || ((dem_config->has_m) && (grid->mm == NULL)))
+ {
+  goto stop;
+ }
 // -- -- ---------------------------------- --
-// MultiLinestrings, next
+// second pass: filling the grid
 // -- -- ---------------------------------- --
-  ln = ln->Next;
-  if (dem_geom)
+ if (has_tiles)
+ {// the Dem-Store is faster to read than the points
+  if (!read_dem_tiles_grid(db_handle, dem_config, grid, verbose))
   {
-   ln_dem = ln_dem->Next;
+   goto stop;
+  }
+ }
+ else if (fill_dem_grid(db_handle, dem_config, grid, sql_where, 0, 0, grid->columns, grid->rows, grid->zz, grid->mm, verbose) < 0)
+ {
+  if (verbose)
+  {
+   fprintf(stderr, "-W-> load_dem_grid: the Dem points are not a regular grid, using SQL queries\n");
   }
+  goto stop;
  }
+ if ((verbose) && (!use_window))
+ {
+  fprintf(stderr, "-I-> Dem-Grid: %d columns x %d rows, step x/y(%2.7f,%2.7f), %d points loaded\n",
+          grid->columns,grid->rows,grid->step_x,grid->step_y,count_points);
+ }
+ sqlite3_free(sql_where);
+ return grid;
 // -- -- ---------------------------------- --
-// Polygons
+stop:
+ if (stmt)
+ {
+  sqlite3_finalize( stmt );
+ }
+ if (sql_statement)
+ {
+  sqlite3_free(sql_statement);
+ }
+ sqlite3_free(sql_where);
+ free_dem_grid(grid);
+ return NULL;
+}
 // -- -- ---------------------------------- --
- pg = source_geom->FirstPolygon;
- if (dem_geom)
+// Returns the value of a Dem-Grid cell
+// - 0 if outside of the grid or without data
+// -- -- ---------------------------------- --
+static int
+get_dem_grid_cell(struct dem_grid *grid, int is_m, int column, int row, double *value)
+{
+ float cell=0.0;
+ struct dem_tile *tile = NULL;
+ if ((column < 0) || (column >= grid->columns) || (row < 0) || (row >= grid->rows))
  {
-  pg_dem = dem_geom->FirstPolygon;
+  return 0;
  }
- while (pg)
+ if (grid->tiles)
  {
-  // -- -- ---------------------------------- --
-  // Polygons-ExteriorRing
-  // -- -- ---------------------------------- --
-  rng = pg->Exterior;
-  cnt = rng->Points;
-  dst_pg = gaiaAddPolygonToGeomColl(dst, cnt, pg->NumInteriors);
-  xx = malloc(sizeof (double) * cnt);
-  yy = malloc(sizeof (double) * cnt);
-  if (dem_geom)
+  tile = get_dem_tile(grid->tiles, grid->has_m, column / DEM_TILE_SIZE, row / DEM_TILE_SIZE);
+  if (is_m)
   {
-   xx_dem = malloc(sizeof (double) * cnt);
-   yy_dem = malloc(sizeof (double) * cnt);
-   rng_dem = pg_dem->Exterior;
-   xx_use = xx_dem;
-   yy_use = yy_dem;
+   if (tile->mm == NULL)
+   {
+    return 0;
+   }
+   cell = tile->mm[((row % DEM_TILE_SIZE) * DEM_TILE_SIZE) + (column % DEM_TILE_SIZE)];
   }
   else
   {
-   xx_use = xx;
-   yy_use = yy;
+   if (tile->zz == NULL)
+   {
+    return 0;
+   }
+   cell = tile->zz[((row % DEM_TILE_SIZE) * DEM_TILE_SIZE) + (column % DEM_TILE_SIZE)];
   }
-  zz = malloc(sizeof (double) * cnt);
-  if (rng->DimensionModel == GAIA_XY_M || rng->DimensionModel == GAIA_XY_Z_M)
-   mm = malloc(sizeof (double) * cnt);
-  for (i = 0; i < cnt; i++)
+ }
+ else if (is_m)
+ {
+  if (grid->mm == NULL)
   {
-   // inserting points to be converted in temporary arrays [EXTERIOR RING]
-   if (rng->DimensionModel == GAIA_XY_Z)
+   return 0;
+  }
+  cell = grid->mm[(row * grid->columns) + column];
+ }
+ else
+ {
+  cell = grid->zz[(row * grid->columns) + column];
+ }
+ if (cell == DEM_GRID_NODATA)
+ {
+  return 0;
+ }
+ *value = cell;
+ return 1;
+}
+// -- -- ---------------------------------- --
+// Nearest Dem-Grid point
+// - as with the SQL query, the nearest point
+//   within 'resolution' distance (i.e. the 3x3
+//   surrounding cells) is used
+// -- -- ---------------------------------- --
+static int
+get_dem_grid_nearest(struct dem_grid *grid, double col_x, double row_y, int *nearest_column, int *nearest_row)
+{
+ int column=(int)floor(col_x + 0.5);
+ int row=(int)floor(row_y + 0.5);
+ int i_column=0;
+ int i_row=0;
+ double value=0.0;
+ double distance=0.0;
+ double distance_min=2.0;
+ int found=0;
+ for (i_row=row-1; i_row<=row+1; i_row++)
+ {
+  for (i_column=column-1; i_column<=column+1; i_column++)
+  {
+   if (get_dem_grid_cell(grid, 0, i_column, i_row, &value))
    {
-    gaiaGetPointXYZ(rng->Coords, i, &x, &y, &z);
+    distance = ((col_x - i_column) * (col_x - i_column) * grid->step_x * grid->step_x) +
+               ((row_y - i_row) * (row_y - i_row) * grid->step_y * grid->step_y);
+    if ((!found) || (distance < distance_min))
+    {
+     distance_min = distance;
+     *nearest_column = i_column;
+     *nearest_row = i_row;
+     found = 1;
+    }
    }
-   else if (rng->DimensionModel == GAIA_XY_M)
-   {
-    gaiaGetPointXYM(rng->Coords, i, &x, &y, &m);
-   }
-   else if (rng->DimensionModel == GAIA_XY_Z_M)
-   {
-    gaiaGetPointXYZM(rng->Coords, i, &x, &y, &z, &m);
-   }
-   else
-   {
-    gaiaGetPoint(rng->Coords, i, &x, &y);
-   }
-   xx[i] = x;
-   yy[i] = y;
-   if (rng_dem)
+  }
+ }
+ return found;
+}
+// -- -- ---------------------------------- --
+// Bilinear interpolation of the 4 surrounding points
+// -- -- ---------------------------------- --
+static int
+get_dem_grid_bilinear(struct dem_grid *grid, double col_x, double row_y, double *z)
+{
+ int column=(int)floor(col_x);
+ int row=(int)floor(row_y);
+ double dx=col_x - column;
+ double dy=row_y - row;
+ double z00=0.0;
+ double z10=0.0;
+ double z01=0.0;
+ double z11=0.0;
+ if ((!get_dem_grid_cell(grid, 0, column, row, &z00)) ||
+     (!get_dem_grid_cell(grid, 0, column+1, row, &z10)) ||
+     (!get_dem_grid_cell(grid, 0, column, row+1, &z01)) ||
+     (!get_dem_grid_cell(grid, 0, column+1, row+1, &z11)))
+ {
+  return 0;
+ }
+ *z = (z00 * (1.0 - dx) * (1.0 - dy)) + (z10 * dx * (1.0 - dy)) +
+      (z01 * (1.0 - dx) * dy) + (z11 * dx * dy);
+ return 1;
+}
+// -- -- ---------------------------------- --
+// Bicubic (Catmull-Rom) interpolation of the 16 surrounding points
+// -- -- ---------------------------------- --
+static double
+dem_cubic(double p0, double p1, double p2, double p3, double t)
+{
+ return p1 + 0.5 * t * (p2 - p0 + t * (2.0 * p0 - 5.0 * p1 + 4.0 * p2 - p3 + t * (3.0 * (p1 - p2) + p3 - p0)));
+}
+static int
+get_dem_grid_bicubic(struct dem_grid *grid, double col_x, double row_y, double *z)
+{
+ int column=(int)floor(col_x);
+ int row=(int)floor(row_y);
+ double dx=col_x - column;
+ double dy=row_y - row;
+ double p[4][4];
+ double r[4];
+ int i=0;
+ int j=0;
+ for (j=0; j<4; j++)
+ {
+  for (i=0; i<4; i++)
+  {
+   if (!get_dem_grid_cell(grid, 0, column-1+i, row-1+j, &p[j][i]))
    {
-    if (rng_dem->DimensionModel == GAIA_XY_Z)
-    {
-     gaiaGetPointXYZ(rng_dem->Coords, i, &x, &y, &z);
-    }
-    else if (rng_dem->DimensionModel == GAIA_XY_M)
-    {
-     gaiaGetPointXYM(rng_dem->Coords, i, &x, &y, &m);
-    }
-    else if (rng_dem->DimensionModel == GAIA_XY_Z_M)
-    {
-     gaiaGetPointXYZM(rng_dem->Coords, i, &x, &y, &z, &m);
-    }
-    else
-    {
-     gaiaGetPoint(rng_dem->Coords, i, &x, &y);
-    }
-    xx_dem[i] = x;
-    yy_dem[i] = y;
+    return 0;
    }
-   if (rng->DimensionModel == GAIA_XY_Z  || rng->DimensionModel == GAIA_XY_Z_M)
-    zz[i] = z;
-   else
-    zz[i] = 0.0;
-   if (rng->DimensionModel == GAIA_XY_M || rng->DimensionModel == GAIA_XY_Z_M)
-    mm[i] = m;
   }
-  if ((dem_config->has_m) && (mm) )
+  r[j] = dem_cubic(p[j][0], p[j][1], p[j][2], p[j][3], dx);
+ }
+ *z = dem_cubic(r[0], r[1], r[2], r[3], dy);
+ return 1;
+}
+// -- -- ---------------------------------- --
+// Retrieving the z (and m) values of a whole
+//  coordinate array from the Dem-Grid
+// - the same rules as retrieve_dem_points apply
+// -- -- ---------------------------------- --
+static int
+retrieve_dem_grid_points(struct dem_grid *grid, int count_points, double *xx_source, double *yy_source, double *zz, double *mm, char *found_z, int *count_z, int *count_m, int *count_missing)
+{
+ int i=0;
+ int column=0;
+ int row=0;
+ double col_x=0.0;
+ double row_y=0.0;
+ double z_source=0.0;
+ double m_source=0.0;
+ int found=0;
+ for (i=0; i<count_points; i++)
+ {
+  col_x = (xx_source[i] - grid->origin_x) / grid->step_x;
+  row_y = (yy_source[i] - grid->origin_y) / grid->step_y;
+  if (!get_dem_grid_nearest(grid, col_x, row_y, &column, &row))
+  {// no point found
+   *count_missing += 1;
+   continue;
+  }
+  found = 0;
+  if (grid->interpolation == DEM_INTERPOLATION_BICUBIC)
   {
-   mm_use = mm;
+   found = get_dem_grid_bicubic(grid, col_x, row_y, &z_source);
   }
-  // searching for nearest point
-  *count_points_total+=cnt;
-  i_count_z=0;
-  i_count_m=0;
-  dem_config->count_points=cnt;
-  if (retrieve_dem_points(db_handle, dem_config, cnt, xx_use, yy_use,zz,mm_use,&i_count_z, &i_count_m,verbose))
+  if ((!found) && (grid->interpolation != DEM_INTERPOLATION_NEAREST))
   {
-   *count_z_total+=i_count_z;
-   *count_m_total+=i_count_m;
-   count_z+=i_count_z;
-   count_m+=i_count_m;
+   found = get_dem_grid_bilinear(grid, col_x, row_y, &z_source);
   }
-  xx_use = NULL;
-  yy_use = NULL;
-  mm_use = NULL;
-  // inserting the reprojected POLYGON in the new GEOMETRY
-  dst_rng = dst_pg->Exterior;
-  for (i = 0; i < cnt; i++)
+  if (!found)
   {
-   // setting EXTERIOR RING points
-   x = xx[i];
-   y = yy[i];
-   if (rng->DimensionModel == GAIA_XY_Z || rng->DimensionModel == GAIA_XY_Z_M)
-    z = zz[i];
-   else
-    z = 0.0;
-   if (rng->DimensionModel == GAIA_XY_M  || rng->DimensionModel == GAIA_XY_Z_M)
-    m = mm[i];
-   else
-    m = 0.0;
-   if (dst_rng->DimensionModel == GAIA_XY_Z)
-   {
-    gaiaSetPointXYZ (dst_rng->Coords, i, x, y, z);
+   get_dem_grid_cell(grid, 0, column, row, &z_source);
+  }
+  if (found_z)
+  {// a z of 0.0 is a valid result
+   found_z[i] = 1;
+  }
+  if ( (z_source != 0.0 ) && (zz[i] != z_source ) )
+  {// Do not force an update if everything is 0 or has not otherwise changed
+   zz[i] = z_source;
+   *count_z += 1;
+  }
+  if ((mm) && (grid->has_m) && (get_dem_grid_cell(grid, 1, column, row, &m_source)))
+  {
+   if ( (m_source != 0.0 ) && (mm[i] != m_source ) )
+   {// Do not force an update if everything is 0 or has not otherwise changed
+    mm[i] = m_source;
+    *count_m += 1;
    }
-   else if (dst_rng->DimensionModel == GAIA_XY_M)
+  }
+ }
+ if (*count_z > 0)
+  return 1;
+ return 0;
+}
+// -- -- ---------------------------------- --
+// From a given point, build area around it by 'resolution_dem'
+// - utm 0.999 meters, Solder Berlin 1.0375644 meters
+// (resolution_dem/2) could also be done
+// - but to insure that at least 1 point is returned, left as is
+// The nearest point will always be retrieved, or none at all.
+// - found_z [when not NULL] is set for each point retrieved,
+//   since a z of 0.0 is never written into zz
+// -- -- ---------------------------------- --
+static int
+retrieve_dem_points(sqlite3 *db_handle, struct config_dem *dem_config, int count_points, double *xx_source, double *yy_source, double *zz, double *mm, char *found_z, int *count_z, int *count_m, int verbose)
+{
+ /* checking for 3D geometries - version 4 */
+ int ret=0;
+ int i=0;
+ char *sql_statement = NULL;
+ sqlite3_stmt *stmt = NULL;
+ int has_m = 0;
+ double x_source=0.0;
+ double y_source=0.0;
+ double z_source=0.0;
+ double m_source=0.0;
+ int is_found=0;
+ int count_missing=0;
+ int phase=dem_profile_switch(dem_config->profile, DEM_PHASE_LOOKUP);
+ *count_z=0;
+ *count_m=0;
+ if (dem_config->dem_grid)
+ {// no SQL queries needed
+  retrieve_dem_grid_points(dem_config->dem_grid, count_points, xx_source, yy_source, zz, mm, found_z, count_z, count_m, &count_missing);
+  goto stop;
+ }
+ if (mm)
+ {
+  has_m = 1;
+ }
+ if (zz)
+ {
+  for (i=0; i<count_points; i++)
+  {
+   dem_config->count_points_nr=i;
+   x_source=xx_source[i];
+   y_source=yy_source[i];
+   /* checking the GEOMETRY_COLUMNS table */
+   if (has_m)
    {
-    gaiaSetPointXYM(dst_rng->Coords, i, x, y, m);
+    sql_statement = sqlite3_mprintf("SELECT ST_Z(\"%s\"), ST_M(\"%s\") "
+                                    "FROM '%s'.'%s' WHERE (ROWID IN ( "
+                                    "SELECT ROWID FROM SpatialIndex WHERE ( "
+                                    "(f_table_name = 'DB=%s.%s') AND "
+                                    "(f_geometry_column = '%s') AND "
+                                    "(search_frame = ST_Buffer(MakePoint(%2.7f,%2.7f,%d),%2.7f)))) AND "
+                                    "(ST_ClosestPoint(%s, MakePoint(%2.7f,%2.7f,%d)) IS NOT Null) ) "
+                                    "ORDER BY ST_Distance(%s,MakePoint(%2.7f,%2.7f,%d)) ASC LIMIT 1"
+                                    ,dem_config->dem_geometry,dem_config->dem_geometry,dem_config->schema,dem_config->dem_table,dem_config->schema,dem_config->dem_table
+                                    ,dem_config->dem_geometry,x_source,y_source,dem_config->dem_srid,dem_config->dem_resolution
+                                    ,dem_config->dem_geometry,x_source,y_source,dem_config->dem_srid,dem_config->dem_geometry,x_source,y_source,dem_config->dem_srid);
    }
-   else if (dst_rng->DimensionModel == GAIA_XY_Z_M)
+   else
    {
-    gaiaSetPointXYZM(dst_rng->Coords, i, x, y, z, m);
+    sql_statement = sqlite3_mprintf("SELECT ST_Z(\"%s\") "
+                                    "FROM '%s'.'%s' WHERE (ROWID IN ( "
+                                    "SELECT ROWID FROM SpatialIndex WHERE ("
+                                    "(f_table_name = 'DB=%s.%s') AND "
+                                    "(f_geometry_column = '%s') AND "
+                                    "(search_frame = ST_Buffer(MakePoint(%2.7f,%2.7f,%d),%2.7f)))) AND "
+                                    "(ST_ClosestPoint(%s, MakePoint(%2.7f,%2.7f,%d)) IS NOT Null) ) "
+                                    "ORDER BY ST_Distance(%s,MakePoint(%2.7f,%2.7f,%d)) ASC LIMIT 1"
+                                    ,dem_config->dem_geometry,dem_config->schema,dem_config->dem_table,dem_config->schema,dem_config->dem_table
+                                    ,dem_config->dem_geometry,x_source,y_source,dem_config->dem_srid,dem_config->dem_resolution
+                                    ,dem_config->dem_geometry,x_source,y_source,dem_config->dem_srid,dem_config->dem_geometry,x_source,y_source,dem_config->dem_srid);
    }
-   else
+   ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &stmt, NULL );
+#if 0
+   if ((dem_config->id_rowid == 354) && (dem_config->count_points == 207))
    {
-    gaiaSetPoint(dst_rng->Coords, i, x, y);
+    fprintf(stderr, "-III-> [EXTERIOR RING] -1a- cnt[%d,%d,%d] sql[%s] id_rowid[%d]\n",dem_config->count_points,dem_config->count_points_nr,ret,sql_statement,dem_config->id_rowid);
    }
-  }
-  free(xx);
-  free(yy);
-  xx = NULL;
-  yy = NULL;
-  if (xx_dem)
-  {
-   free(xx_dem);
-   xx_dem = NULL;
-   free(yy_dem);
-   yy_dem = NULL;
-  }
-  free(zz);
-  zz = NULL;
-  if (rng->DimensionModel == GAIA_XY_M || rng->DimensionModel == GAIA_XY_Z_M)
-  {
-   free(mm);
-   mm = NULL;
-  }
-  if (error)
-   goto stop;
-  // -- -- ---------------------------------- --
-  // Polygons-InteriorRings
-  // -- -- ---------------------------------- --
-  for (ib = 0; ib < pg->NumInteriors; ib++)
-  {
-   // processing INTERIOR RINGS
-   rng = pg->Interiors + ib;
-   cnt = rng->Points;
-   xx = malloc(sizeof (double) * cnt);
-   yy = malloc(sizeof (double) * cnt);
-   if (dem_geom)
+#endif
+   is_found = 0;
+   if ( ret == SQLITE_OK )
    {
-    xx_dem = malloc(sizeof (double) * cnt);
-    yy_dem = malloc(sizeof (double) * cnt);
-    rng_dem = pg_dem->Interiors + ib;
-    xx_use = xx_dem;
-    yy_use = yy_dem;
+    sqlite3_free(sql_statement);
+    while ( sqlite3_step( stmt ) == SQLITE_ROW )
+    {
+     if ( sqlite3_column_type( stmt, 0 ) != SQLITE_NULL )
+     {
+      is_found = 1;
+      if (found_z)
+      {
+       found_z[i] = 1;
+      }
+      z_source = sqlite3_column_double (stmt, 0);
+      if ( (z_source != 0.0 ) && (zz[i] != z_source ) )
+      {// Do not force an update if everything is 0 or has not otherwise changed
+       zz[i] = z_source;
+       *count_z += 1;
+      }
+     }
+     if ( sqlite3_column_type( stmt, 1 ) != SQLITE_NULL )
+     {
+      m_source = sqlite3_column_double (stmt, 1);
+      if ( (m_source != 0.0 ) && (mm[i] != m_source ) )
+      {// Do not force an update if everything is 0 or has not otherwise changed
+       mm[i] = m_source;
+       *count_m += 1;
+      }
+      mm[i] = sqlite3_column_double (stmt, 1);
+     }
+    }
+    sqlite3_finalize( stmt );
    }
    else
    {
-    xx_use = xx;
-    yy_use = yy;
+    if (verbose)
+    {
+     fprintf(stderr, "-W-> retrieve_dem_points: rc=%d sql[%s]\n",ret,sql_statement);
+    }
+    sqlite3_free(sql_statement);
    }
-   zz = malloc(sizeof (double) * cnt);
-   if (rng->DimensionModel == GAIA_XY_M || rng->DimensionModel == GAIA_XY_Z_M)
+   if (!is_found)
+   {
+    count_missing++;
+   }
+  }
+ }
+// printf("-I-> retrieve_dem_points: total[%d] not 0.0: z[%d] m[%d]\n",count_points,*count_z,*count_m);
+stop:
+ if (dem_config->profile)
+ {
+  dem_config->profile->vertices_lookup += count_points;
+  dem_config->profile->lookup_misses += count_missing;
+  dem_profile_switch(dem_config->profile, phase);
+ }
+ if (*count_z > 0)
+  return 1;
+ return 0;
+}
+// -- -- ---------------------------------- --
+//
+// -- -- ---------------------------------- --
+static int
+callFetchZ(sqlite3 *db_handle, struct config_dem *dem_config, int verbose)
+{
+ int ret=0;
+ char *sql_statement = NULL;
+ sqlite3_stmt *stmt = NULL;
+ int i_count_z=0;
+ int i_count_m=0;
+ double *xx_use = NULL;
+ double *yy_use = NULL;
+ double *mm_use = NULL;
+ double *zz = NULL;
+// -- -- ---------------------------------- --
+ dem_config->dem_z=0;;
+ dem_config->dem_m=0;
+// -- -- ---------------------------------- --
+ if (dem_config->dem_srid != dem_config->default_srid )
+ {
+  sql_statement = sqlite3_mprintf("SELECT ST_X(ST_Transform(MakePoint(%2.7f,%2.7f,%d),%d)),  "
+                                  "ST_Y(ST_Transform(MakePoint(%2.7f,%2.7f,%d),%d))"
+                                  ,dem_config->fetchz_x, dem_config->fetchz_y, dem_config->default_srid,dem_config->dem_srid
+                                  ,dem_config->fetchz_x, dem_config->fetchz_y, dem_config->default_srid,dem_config->dem_srid);
+  ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &stmt, NULL );
+  if ( ret == SQLITE_OK )
+  {
+   sqlite3_free(sql_statement);
+   while ( sqlite3_step( stmt ) == SQLITE_ROW )
+   {
+    if (( sqlite3_column_type( stmt, 0 ) != SQLITE_NULL ) &&
+        ( sqlite3_column_type( stmt, 1 ) != SQLITE_NULL ) )
+    {
+     dem_config->fetchz_x = sqlite3_column_double(stmt, 0);
+     dem_config->fetchz_y = sqlite3_column_double(stmt, 1);
+    }
+   }
+   sqlite3_finalize( stmt );
+  }
+  else
+  {
+   if (verbose)
+   {
+    fprintf(stderr, "-W-> callFetchZ : rc=%d sql[%s]\n",ret,sql_statement);
+   }
+   sqlite3_free(sql_statement);
+  }
+ }
+// -- -- ---------------------------------- --
+ ret=0;
+ if ((dem_config->fetchz_x >= dem_config->dem_extent_minx) && (dem_config->fetchz_x <= dem_config->dem_extent_maxx) &&
+     (dem_config->fetchz_y >= dem_config->dem_extent_miny) && (dem_config->fetchz_y <= dem_config->dem_extent_maxy ) )
+ {
+  xx_use = malloc(sizeof (double) * 1);
+  yy_use = malloc(sizeof (double) * 1);
+  zz = malloc(sizeof (double) * 1);
+  mm_use = malloc(sizeof (double) * 1);
+  xx_use[0] = dem_config->fetchz_x;
+  yy_use[0] = dem_config->fetchz_y;
+  zz[0] = dem_config->dem_z;
+  mm_use[0] = dem_config->dem_m;
+  dem_config->count_points=1;
+  if (((dem_config->interpolation != DEM_INTERPOLATION_NEAREST) || (dem_config->is_raster)) && (dem_config->dem_grid == NULL))
+  {// interpolating (or Dem-Raster): loading the surrounding points only
+   dem_config->dem_grid = load_dem_grid(db_handle, dem_config, 1,
+                                        dem_config->fetchz_x-(dem_config->dem_resolution*2.0), dem_config->fetchz_y-(dem_config->dem_resolution*2.0),
+                                        dem_config->fetchz_x+(dem_config->dem_resolution*2.0), dem_config->fetchz_y+(dem_config->dem_resolution*2.0), verbose);
+  }
+  if (retrieve_dem_points(db_handle, dem_config, 1, xx_use, yy_use,zz,mm_use,NULL,&i_count_z, &i_count_m,verbose))
+  {
+   ret=1;
+   dem_config->dem_z=zz[0];
+   dem_config->dem_m=mm_use[0];
+  }
+  if (dem_config->dem_grid)
+  {
+   free_dem_grid(dem_config->dem_grid);
+   dem_config->dem_grid = NULL;
+  }
+  free(xx_use);
+  free(yy_use);
+  free(zz);
+  free(mm_use);
+  xx_use = NULL;
+  yy_use = NULL;
+  mm_use = NULL;
+  zz = NULL;
+ }
+// -- -- ---------------------------------- --
+ return ret;
+}
+// -- -- ---------------------------------- --
+// GNU libc (Linux, and FreeBSD)
+// - sys/param.h
+// -- -- ---------------------------------- --
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+// -- -- ---------------------------------- --
+// Based on gg_transform.c gaiaTransformCommon
+// if the source geometry is out of range of the dem area, NULL is returned
+// if the if the z or m values have not changed, NULL is returned
+// - in both cases no update should be done and is not an error
+// if the Dem-Database Geometry-Column uses a different Srid
+// - a second Geometry will be sent with the transfored values
+// --> those x,y values will be sent to retrieve_dem_points
+//       to retrieve the nearst point
+// The retrieved z,m values will be copied WITHOUT any changes
+// -- -- ---------------------------------- --
+static gaiaGeomCollPtr
+getDemCollect(sqlite3 *db_handle, gaiaGeomCollPtr source_geom, gaiaGeomCollPtr dem_geom, struct config_dem *dem_config,
+              int *count_points_total, int *count_z_total, int *count_m_total, int verbose)
+{
+// creates a new GEOMETRY replacing found z-points from the original one
+ int ib=0;
+ int cnt=0;
+ int i=0;
+ double *xx = NULL;
+ double *yy = NULL;
+ double *xx_dem = NULL;
+ double *yy_dem = NULL;
+ double *zz = NULL;
+ double *mm = NULL;
+ double *xx_use = NULL;
+ double *yy_use = NULL;
+ double *mm_use = NULL;
+ int count_z=0;
+ int count_m=0;
+ int i_count_z=0;
+ int i_count_m=0;
+ double x = 0.0;
+ double y = 0.0;
+ double z = 0.0;
+ double m = 0.0;
+ double extent_minx=0.0;
+ double extent_miny=0.0;
+ double extent_maxx=0.0;
+ double extent_maxy=0.0;
+ int error = 0;
+ int isExtentWithin=0;
+ gaiaPointPtr pt = NULL;
+ gaiaPointPtr pt_dem = NULL;
+ gaiaLinestringPtr ln = NULL;
+ gaiaLinestringPtr ln_dem = NULL;
+ gaiaLinestringPtr dst_ln = NULL;
+ gaiaPolygonPtr pg = NULL;
+ gaiaPolygonPtr pg_dem = NULL;
+ gaiaPolygonPtr dst_pg = NULL;
+ gaiaRingPtr rng = NULL;
+ gaiaRingPtr rng_dem = NULL;
+ gaiaRingPtr dst_rng = NULL;
+ gaiaGeomCollPtr dst = NULL;
+ if (source_geom->DimensionModel == GAIA_XY_Z)
+  dst = gaiaAllocGeomCollXYZ();
+ else if (source_geom->DimensionModel == GAIA_XY_M)
+  dst = gaiaAllocGeomCollXYM();
+ else if (source_geom->DimensionModel == GAIA_XY_Z_M)
+  dst = gaiaAllocGeomCollXYZM();
+ else
+  dst = gaiaAllocGeomColl ();
+ cnt = 0;
+ dst->Srid = source_geom->Srid;
+ pt = source_geom->FirstPoint;
+ extent_minx=source_geom->MinX;
+ extent_miny=source_geom->MinY;
+ extent_maxx=source_geom->MaxX;
+ extent_maxy=source_geom->MaxY;
+ if (dem_geom)
+ {
+  extent_minx=dem_geom->MinX;
+  extent_miny=dem_geom->MinY;
+  extent_maxx=dem_geom->MaxX;
+  extent_maxy=dem_geom->MaxY;
+ }
+// -- -- ---------------------------------- --
+// Touches (partially within)
+// -- -- ---------------------------------- --
+ int left_x = MAX(extent_minx, dem_config->dem_extent_minx);
+ int right_x = MIN(extent_maxx, dem_config->dem_extent_maxx);
+ int bottom_y = MAX(extent_miny, dem_config->dem_extent_miny);
+ int top_y = MIN(extent_maxy, dem_config->dem_extent_maxy);
+ if ((right_x > left_x) && (top_y > bottom_y))
+ {
+  isExtentWithin=1;
+ }
+ else if ((right_x == left_x) && (top_y == bottom_y))
+ {
+  // This is a point
+  isExtentWithin=1;
+ }
+// -- -- ---------------------------------- --
+#if 0
+ if (verbose)
+ {
+  fprintf(stderr, "-I-> getDemCollect: isExtentWithin[%d]  left_x[%d]  right_x[%d] bottom_y[%d]  top_y[%d]\n",isExtentWithin,left_x,right_x,bottom_y,top_y);
+ }
+#endif
+ if (!isExtentWithin)
+ {
+  error=1;
+  goto stop;
+ }
+// -- -- ---------------------------------- --
+// Call only if geometry is partially within the Dem extent
+// -- -- ---------------------------------- --
+// Points
+// -- -- ---------------------------------- --
+ while (pt)
+ {
+  // counting POINTs
+  cnt++;
+  pt = pt->Next;
+ }
+ if (cnt)
+ {
+  // reprojecting POINTs
+  xx = malloc(sizeof (double) * cnt);
+  yy = malloc(sizeof (double) * cnt);
+  if (dem_geom)
+  {
+   xx_dem = malloc(sizeof (double) * cnt);
+   yy_dem = malloc(sizeof (double) * cnt);
+   xx_use = xx_dem;
+   yy_use = yy_dem;
+  }
+  else
+  {
+   xx_use = xx;
+   yy_use = yy;
+  }
+  zz = malloc(sizeof (double) * cnt);
+  if (source_geom->DimensionModel == GAIA_XY_M || source_geom->DimensionModel == GAIA_XY_Z_M)
+   mm = malloc(sizeof (double) * cnt);
+  i = 0;
+  pt = source_geom->FirstPoint;
+  if (dem_geom)
+  {
+   pt_dem = dem_geom->FirstPoint;
+  }
+  while (pt)
+  {
+   // inserting points to be converted in temporary arrays
+   xx[i] = pt->X;
+   yy[i] = pt->Y;
+   if (source_geom->DimensionModel == GAIA_XY_Z || source_geom->DimensionModel == GAIA_XY_Z_M)
+    zz[i] = pt->Z;
+   else
+    zz[i] = 0.0;
+   if (source_geom->DimensionModel == GAIA_XY_M || source_geom->DimensionModel == GAIA_XY_Z_M)
+    mm[i] = pt->M;
+   if (pt_dem)
+   {
+    xx_dem[i] = pt_dem->X;
+    yy_dem[i] = pt_dem->Y;
+   }
+   i++;
+   // -- -- ---------------------------------- --
+   // MultiPoints, next
+   // -- -- ---------------------------------- --
+   pt = pt->Next;
+   if (dem_geom)
+   {
+    pt_dem =pt_dem->Next;
+   }
+  }
+  if ((dem_config->has_m) && (mm) )
+  {
+   mm_use = mm;
+  }
+  // searching for nearest point
+  *count_points_total+=cnt;
+  i_count_z=0;
+  i_count_m=0;
+  dem_config->count_points=cnt;
+  if (retrieve_dem_points(db_handle, dem_config, cnt, xx_use, yy_use,zz,mm_use,NULL,&i_count_z, &i_count_m,verbose))
+  {
+   *count_z_total+=i_count_z;
+   *count_m_total+=i_count_m;
+   count_z+=i_count_z;
+   count_m+=i_count_m;
+  }
+  xx_use = NULL;
+  yy_use = NULL;
+  mm_use = NULL;
+  // inserting the reprojected POINTs in the new GEOMETRY
+  for (i = 0; i < cnt; i++)
+  {
+   x = xx[i];
+   y = yy[i];
+   if (source_geom->DimensionModel == GAIA_XY_Z || source_geom->DimensionModel == GAIA_XY_Z_M)
+    z = zz[i];
+   else
+    z = 0.0;
+   if (source_geom->DimensionModel == GAIA_XY_M || source_geom->DimensionModel == GAIA_XY_Z_M)
+    m = mm[i];
+   else
+    m = 0.0;
+   if (dst->DimensionModel == GAIA_XY_Z)
+    gaiaAddPointToGeomCollXYZ(dst, x, y, z);
+   else if (dst->DimensionModel == GAIA_XY_M)
+    gaiaAddPointToGeomCollXYM(dst, x, y, m);
+   else if (dst->DimensionModel == GAIA_XY_Z_M)
+    gaiaAddPointToGeomCollXYZM(dst, x, y, z, m);
+   else
+    gaiaAddPointToGeomColl(dst, x, y);
+  }
+  free(xx);
+  free(yy);
+  free(zz);
+  xx = NULL;
+  yy = NULL;
+  zz = NULL;
+  if (xx_dem)
+  {
+   free(xx_dem);
+   xx_dem = NULL;
+   free(yy_dem);
+   yy_dem = NULL;
+  }
+  if (source_geom->DimensionModel == GAIA_XY_M || source_geom->DimensionModel == GAIA_XY_Z_M)
+  {
+   free(mm);
+   mm = NULL;
+  }
+ }
+ if (error)
+  goto stop;
+// -- -- ---------------------------------- --
+// Linestrings
+// -- -- ---------------------------------- --
+ ln = source_geom->FirstLinestring;
+ if (dem_geom)
+ {
+  ln_dem = dem_geom->FirstLinestring;
+ }
+// Call only if geometry is inside the Dem extent
+ while (ln)
+ {
+  // reprojecting LINESTRINGs
+  cnt = ln->Points;
+  xx = malloc(sizeof (double) * cnt);
+  yy = malloc(sizeof (double) * cnt);
+  if (dem_geom)
+  {
+   xx_dem = malloc(sizeof (double) * cnt);
+   yy_dem = malloc(sizeof (double) * cnt);
+   xx_use = xx_dem;
+   yy_use = yy_dem;
+  }
+  else
+  {
+   xx_use = xx;
+   yy_use = yy;
+  }
+  zz = malloc(sizeof (double) * cnt);
+  if (ln->DimensionModel == GAIA_XY_M || ln->DimensionModel == GAIA_XY_Z_M)
+   mm = malloc(sizeof (double) * cnt);
+  for (i = 0; i < cnt; i++)
+  {
+   // inserting points to be converted in temporary arrays
+   if (ln->DimensionModel == GAIA_XY_Z)
+   {
+    gaiaGetPointXYZ(ln->Coords, i, &x, &y, &z);
+   }
+   else if (ln->DimensionModel == GAIA_XY_M)
+   {
+    gaiaGetPointXYM(ln->Coords, i, &x, &y, &m);
+   }
+   else if (ln->DimensionModel == GAIA_XY_Z_M)
+   {
+    gaiaGetPointXYZM(ln->Coords, i, &x, &y, &z, &m);
+   }
+   else
+   {
+    gaiaGetPoint(ln->Coords, i, &x, &y);
+   }
+   xx[i] = x;
+   yy[i] = y;
+   if (ln_dem)
+   {
+    if (ln_dem->DimensionModel == GAIA_XY_Z)
+    {
+     gaiaGetPointXYZ(ln_dem->Coords, i, &x, &y, &z);
+    }
+    else if (ln_dem->DimensionModel == GAIA_XY_M)
+    {
+     gaiaGetPointXYM(ln->Coords, i, &x, &y, &m);
+    }
+    else if (ln_dem->DimensionModel == GAIA_XY_Z_M)
+    {
+     gaiaGetPointXYZM(ln_dem->Coords, i, &x, &y, &z, &m);
+    }
+    else
+    {
+     gaiaGetPoint(ln_dem->Coords, i, &x, &y);
+    }
+    xx_dem[i] = x;
+    yy_dem[i] = y;
+   }
+   if (ln->DimensionModel == GAIA_XY_Z || ln->DimensionModel == GAIA_XY_Z_M)
+    zz[i] = z;
+   else
+    zz[i] = 0.0;
+   if (ln->DimensionModel == GAIA_XY_M || ln->DimensionModel == GAIA_XY_Z_M)
+    mm[i] = m;
+  }
+  if ((dem_config->has_m) && (mm) )
+  {
+   mm_use = mm;
+  }
+  // searching for nearest point
+  *count_points_total+=cnt;
+  i_count_z=0;
+  i_count_m=0;
+  dem_config->count_points=cnt;
+  if (retrieve_dem_points(db_handle, dem_config, cnt, xx_use, yy_use,zz,mm_use,NULL,&i_count_z, &i_count_m,verbose))
+  {
+   *count_z_total+=i_count_z;
+   *count_m_total+=i_count_m;
+   count_z+=i_count_z;
+   count_m+=i_count_m;
+  }
+  xx_use = NULL;
+  yy_use = NULL;
+  mm_use = NULL;
+  // inserting the reprojected LINESTRING in the new GEOMETRY
+  dst_ln = gaiaAddLinestringToGeomColl (dst, cnt);
+  for (i = 0; i < cnt; i++)
+  {
+   // setting LINESTRING points
+   x = xx[i];
+   y = yy[i];
+   if (ln->DimensionModel == GAIA_XY_Z || ln->DimensionModel == GAIA_XY_Z_M)
+    z = zz[i];
+   else
+    z = 0.0;
+   if (ln->DimensionModel == GAIA_XY_M || ln->DimensionModel == GAIA_XY_Z_M)
+    m = mm[i];
+   else
+    m = 0.0;
+   if (dst_ln->DimensionModel == GAIA_XY_Z)
+   {
+    gaiaSetPointXYZ (dst_ln->Coords, i, x, y, z);
+   }
+   else if (dst_ln->DimensionModel == GAIA_XY_M)
+   {
+    gaiaSetPointXYM(dst_ln->Coords, i, x, y, m);
+   }
+   else if (dst_ln->DimensionModel == GAIA_XY_Z_M)
+   {
+    gaiaSetPointXYZM(dst_ln->Coords, i, x, y, z, m);
+   }
+   else
+   {
+    gaiaSetPoint(dst_ln->Coords, i, x, y);
+   }
+  }
+  free(xx);
+  free(yy);
+  xx = NULL;
+  yy = NULL;
+  if (xx_dem)
+  {
+   free(xx_dem);
+   xx_dem = NULL;
+   free(yy_dem);
+   yy_dem = NULL;
+  }
+  free(zz);
+  zz = NULL;
+  if (ln->DimensionModel == GAIA_XY_M || ln->DimensionModel == GAIA_XY_Z_M)
+  {
+   free(mm);
+   mm = NULL;
+  }
+  if (error)
+   goto stop;
+// -- -- ---------------------------------- --
+// MultiLinestrings, next
+// -- -- ---------------------------------- --
+  ln = ln->Next;
+  if (dem_geom)
+  {
+   ln_dem = ln_dem->Next;
+  }
+ }
+// -- -- ---------------------------------- --
+// Polygons
+// -- -- ---------------------------------- --
+ pg = source_geom->FirstPolygon;
+ if (dem_geom)
+ {
+  pg_dem = dem_geom->FirstPolygon;
+ }
+ while (pg)
+ {
+  // -- -- ---------------------------------- --
+  // Polygons-ExteriorRing
+  // -- -- ---------------------------------- --
+  rng = pg->Exterior;
+  cnt = rng->Points;
+  dst_pg = gaiaAddPolygonToGeomColl(dst, cnt, pg->NumInteriors);
+  xx = malloc(sizeof (double) * cnt);
+  yy = malloc(sizeof (double) * cnt);
+  if (dem_geom)
+  {
+   xx_dem = malloc(sizeof (double) * cnt);
+   yy_dem = malloc(sizeof (double) * cnt);
+   rng_dem = pg_dem->Exterior;
+   xx_use = xx_dem;
+   yy_use = yy_dem;
+  }
+  else
+  {
+   xx_use = xx;
+   yy_use = yy;
+  }
+  zz = malloc(sizeof (double) * cnt);
+  if (rng->DimensionModel == GAIA_XY_M || rng->DimensionModel == GAIA_XY_Z_M)
+   mm = malloc(sizeof (double) * cnt);
+  for (i = 0; i < cnt; i++)
+  {
+   // inserting points to be converted in temporary arrays [EXTERIOR RING]
+   if (rng->DimensionModel == GAIA_XY_Z)
+   {
+    gaiaGetPointXYZ(rng->Coords, i, &x, &y, &z);
+   }
+   else if (rng->DimensionModel == GAIA_XY_M)
+   {
+    gaiaGetPointXYM(rng->Coords, i, &x, &y, &m);
+   }
+   else if (rng->DimensionModel == GAIA_XY_Z_M)
+   {
+    gaiaGetPointXYZM(rng->Coords, i, &x, &y, &z, &m);
+   }
+   else
+   {
+    gaiaGetPoint(rng->Coords, i, &x, &y);
+   }
+   xx[i] = x;
+   yy[i] = y;
+   if (rng_dem)
+   {
+    if (rng_dem->DimensionModel == GAIA_XY_Z)
+    {
+     gaiaGetPointXYZ(rng_dem->Coords, i, &x, &y, &z);
+    }
+    else if (rng_dem->DimensionModel == GAIA_XY_M)
+    {
+     gaiaGetPointXYM(rng_dem->Coords, i, &x, &y, &m);
+    }
+    else if (rng_dem->DimensionModel == GAIA_XY_Z_M)
+    {
+     gaiaGetPointXYZM(rng_dem->Coords, i, &x, &y, &z, &m);
+    }
+    else
+    {
+     gaiaGetPoint(rng_dem->Coords, i, &x, &y);
+    }
+    xx_dem[i] = x;
+    yy_dem[i] = y;
+   }
+   if (rng->DimensionModel == GAIA_XY_Z  || rng->DimensionModel == GAIA_XY_Z_M)
+    zz[i] = z;
+   else
+    zz[i] = 0.0;
+   if (rng->DimensionModel == GAIA_XY_M || rng->DimensionModel == GAIA_XY_Z_M)
+    mm[i] = m;
+  }
+  if ((dem_config->has_m) && (mm) )
+  {
+   mm_use = mm;
+  }
+  // searching for nearest point
+  *count_points_total+=cnt;
+  i_count_z=0;
+  i_count_m=0;
+  dem_config->count_points=cnt;
+  if (retrieve_dem_points(db_handle, dem_config, cnt, xx_use, yy_use,zz,mm_use,NULL,&i_count_z, &i_count_m,verbose))
+  {
+   *count_z_total+=i_count_z;
+   *count_m_total+=i_count_m;
+   count_z+=i_count_z;
+   count_m+=i_count_m;
+  }
+  xx_use = NULL;
+  yy_use = NULL;
+  mm_use = NULL;
+  // inserting the reprojected POLYGON in the new GEOMETRY
+  dst_rng = dst_pg->Exterior;
+  for (i = 0; i < cnt; i++)
+  {
+   // setting EXTERIOR RING points
+   x = xx[i];
+   y = yy[i];
+   if (rng->DimensionModel == GAIA_XY_Z || rng->DimensionModel == GAIA_XY_Z_M)
+    z = zz[i];
+   else
+    z = 0.0;
+   if (rng->DimensionModel == GAIA_XY_M  || rng->DimensionModel == GAIA_XY_Z_M)
+    m = mm[i];
+   else
+    m = 0.0;
+   if (dst_rng->DimensionModel == GAIA_XY_Z)
+   {
+    gaiaSetPointXYZ (dst_rng->Coords, i, x, y, z);
+   }
+   else if (dst_rng->DimensionModel == GAIA_XY_M)
+   {
+    gaiaSetPointXYM(dst_rng->Coords, i, x, y, m);
+   }
+   else if (dst_rng->DimensionModel == GAIA_XY_Z_M)
+   {
+    gaiaSetPointXYZM(dst_rng->Coords, i, x, y, z, m);
+   }
+   else
+   {
+    gaiaSetPoint(dst_rng->Coords, i, x, y);
+   }
+  }
+  free(xx);
+  free(yy);
+  xx = NULL;
+  yy = NULL;
+  if (xx_dem)
+  {
+   free(xx_dem);
+   xx_dem = NULL;
+   free(yy_dem);
+   yy_dem = NULL;
+  }
+  free(zz);
+  zz = NULL;
+  if (rng->DimensionModel == GAIA_XY_M || rng->DimensionModel == GAIA_XY_Z_M)
+  {
+   free(mm);
+   mm = NULL;
+  }
+  if (error)
+   goto stop;
+  // -- -- ---------------------------------- --
+  // Polygons-InteriorRings
+  // -- -- ---------------------------------- --
+  for (ib = 0; ib < pg->NumInteriors; ib++)
+  {
+   // processing INTERIOR RINGS
+   rng = pg->Interiors + ib;
+   cnt = rng->Points;
+   xx = malloc(sizeof (double) * cnt);
+   yy = malloc(sizeof (double) * cnt);
+   if (dem_geom)
+   {
+    xx_dem = malloc(sizeof (double) * cnt);
+    yy_dem = malloc(sizeof (double) * cnt);
+    rng_dem = pg_dem->Interiors + ib;
+    xx_use = xx_dem;
+    yy_use = yy_dem;
+   }
+   else
+   {
+    xx_use = xx;
+    yy_use = yy;
+   }
+   zz = malloc(sizeof (double) * cnt);
+   if (rng->DimensionModel == GAIA_XY_M || rng->DimensionModel == GAIA_XY_Z_M)
     mm = malloc(sizeof (double) * cnt);
    for (i = 0; i < cnt; i++)
    {
-    // inserting points to be converted in temporary arrays [INTERIOR RING]
-    if (rng->DimensionModel == GAIA_XY_Z)
-    {
-     gaiaGetPointXYZ(rng->Coords, i, &x, &y, &z);
-    }
-    else if (rng->DimensionModel == GAIA_XY_M)
-    {
-     gaiaGetPointXYM(rng->Coords, i, &x, &y, &m);
-    }
-    else if (rng->DimensionModel == GAIA_XY_Z_M)
-    {
-     gaiaGetPointXYZM(rng->Coords, i, &x, &y, &z, &m);
-    }
-    else
-    {
-     gaiaGetPoint(rng->Coords, i, &x, &y);
-    }
-    xx[i] = x;
-    yy[i] = y;
-    if (rng_dem)
+    // inserting points to be converted in temporary arrays [INTERIOR RING]
+    if (rng->DimensionModel == GAIA_XY_Z)
+    {
+     gaiaGetPointXYZ(rng->Coords, i, &x, &y, &z);
+    }
+    else if (rng->DimensionModel == GAIA_XY_M)
+    {
+     gaiaGetPointXYM(rng->Coords, i, &x, &y, &m);
+    }
+    else if (rng->DimensionModel == GAIA_XY_Z_M)
+    {
+     gaiaGetPointXYZM(rng->Coords, i, &x, &y, &z, &m);
+    }
+    else
+    {
+     gaiaGetPoint(rng->Coords, i, &x, &y);
+    }
+    xx[i] = x;
+    yy[i] = y;
+    if (rng_dem)
+    {
+     if (rng_dem->DimensionModel == GAIA_XY_Z)
+     {
+      gaiaGetPointXYZ(rng_dem->Coords, i, &x, &y, &z);
+     }
+     else if (rng_dem->DimensionModel == GAIA_XY_M)
+     {
+      gaiaGetPointXYM(rng_dem->Coords, i, &x, &y, &m);
+     }
+     else if (rng_dem->DimensionModel == GAIA_XY_Z_M)
+     {
+      gaiaGetPointXYZM(rng_dem->Coords, i, &x, &y, &z, &m);
+     }
+     else
+     {
+      gaiaGetPoint(rng_dem->Coords, i, &x, &y);
+     }
+     xx_dem[i] = x;
+     yy_dem[i] = y;
+    }
+    if (rng->DimensionModel == GAIA_XY_Z  || rng->DimensionModel == GAIA_XY_Z_M)
+     zz[i] = z;
+    else
+     zz[i] = 0.0;
+    if (rng->DimensionModel == GAIA_XY_M  || rng->DimensionModel == GAIA_XY_Z_M)
+     mm[i] = m;
+   }
+   if ((dem_config->has_m) && (mm) )
+   {
+    mm_use = mm;
+   }
+   // searching for nearest point
+   *count_points_total+=cnt;
+   i_count_z=0;
+   i_count_m=0;
+   dem_config->count_points=cnt;
+   if (retrieve_dem_points(db_handle, dem_config, cnt, xx_use, yy_use,zz,mm_use,NULL,&i_count_z, &i_count_m,verbose))
+   {
+    *count_z_total+=i_count_z;
+    *count_m_total+=i_count_m;
+    count_z+=i_count_z;
+    count_m+=i_count_m;
+   }
+   xx_use = NULL;
+   yy_use = NULL;
+   mm_use = NULL;
+   // inserting the reprojected POLYGON in the new GEOMETRY
+   dst_rng = gaiaAddInteriorRing(dst_pg, ib, cnt);
+   for (i = 0; i < cnt; i++)
+   {
+    // setting INTERIOR RING points
+    x = xx[i];
+    y = yy[i];
+    if (rng->DimensionModel == GAIA_XY_Z || rng->DimensionModel == GAIA_XY_Z_M)
+     z = zz[i];
+    else
+     z = 0.0;
+    if (rng->DimensionModel == GAIA_XY_M || rng->DimensionModel == GAIA_XY_Z_M)
+     m = mm[i];
+    else
+     m = 0.0;
+    if (dst_rng->DimensionModel == GAIA_XY_Z)
+    {
+     gaiaSetPointXYZ(dst_rng->Coords, i, x, y, z);
+    }
+    else if (dst_rng->DimensionModel == GAIA_XY_M)
+    {
+     gaiaSetPointXYM(dst_rng->Coords, i, x, y, m);
+    }
+    else if (dst_rng->DimensionModel == GAIA_XY_Z_M)
+    {
+     gaiaSetPointXYZM(dst_rng->Coords, i, x, y, z, m);
+    }
+    else
+    {
+     gaiaSetPoint(dst_rng->Coords, i, x, y);
+    }
+   }
+   free(xx);
+   free(yy);
+   xx = NULL;
+   yy = NULL;
+   if (xx_dem)
+   {
+    free(xx_dem);
+    xx_dem = NULL;
+    free(yy_dem);
+    yy_dem = NULL;
+   }
+   free(zz);
+   zz = NULL;
+   if (rng->DimensionModel == GAIA_XY_M || rng->DimensionModel == GAIA_XY_Z_M)
+   {
+    free(mm);
+    mm = NULL;
+   }
+   if (error)
+    goto stop;
+  }
+// -- -- ---------------------------------- --
+// MultiPolygons, next
+// -- -- ---------------------------------- --
+  pg = pg->Next;
+  if (dem_geom)
+  {
+   pg_dem = pg_dem->Next;
+  }
+ }
+// -- -- ---------------------------------- --
+// -end- Geometry types
+// -- -- ---------------------------------- --
+stop:
+ if ((count_z+count_m) == 0)
+ {// Do not force an update if everything is 0 or has not otherwise changed
+  error=1;
+ }
+ if (error)
+ {
+  // some error occurred, or no changes needed
+  gaiaPointPtr pP;
+  gaiaPointPtr pPn;
+  gaiaLinestringPtr pL;
+  gaiaLinestringPtr pLn;
+  gaiaPolygonPtr pA;
+  gaiaPolygonPtr pAn;
+  pP = dst->FirstPoint;
+  while (pP != NULL)
+  {
+   pPn = pP->Next;
+   gaiaFreePoint(pP);
+   pP = pPn;
+  }
+  pL = dst->FirstLinestring;
+  while (pL != NULL)
+  {
+   pLn = pL->Next;
+   gaiaFreeLinestring(pL);
+   pL = pLn;
+  }
+  pA = dst->FirstPolygon;
+  while (pA != NULL)
+  {
+   pAn = pA->Next;
+   gaiaFreePolygon(pA);
+   pA = pAn;
+  }
+  dst->FirstPoint = NULL;
+  dst->LastPoint = NULL;
+  dst->FirstLinestring = NULL;
+  dst->LastLinestring = NULL;
+  dst->FirstPolygon = NULL;
+  dst->LastPolygon = NULL;
+  gaiaFreeGeomColl(dst);
+  dst = NULL;
+  // -- -- ---------------------------------- --
+  // if the source geometry is out of range of the dem area, NULL is returned
+  // -- -- ---------------------------------- --
+  return NULL;
+ }
+ if (dst)
+ {
+  gaiaMbrGeometry(dst);
+  dst->DeclaredType = source_geom->DeclaredType;
+ }
+ return dst;
+}
+// -- -- ---------------------------------- --
+// Hilbert-ordering of the source geometries
+// - when the tiled Dem-Store is used, the geometries
+//   are visited along a Hilbert curve of their Mbr centers,
+//   so that each tile is loaded roughly once
+// -- -- ---------------------------------- --
+struct hilbert_rowid
+{
+ sqlite3_int64 key;
+ sqlite3_int64 rowid;
+};
+static sqlite3_int64
+get_hilbert_key(int x, int y)
+{// position on a Hilbert curve of 65536 x 65536 cells
+ int s=0;
+ int rx=0;
+ int ry=0;
+ int t=0;
+ sqlite3_int64 key=0;
+ for (s=32768; s>0; s/=2)
+ {
+  rx = (x & s) > 0;
+  ry = (y & s) > 0;
+  key += (sqlite3_int64)s * s * ((3 * rx) ^ ry);
+  if (ry == 0)
+  {
+   if (rx == 1)
+   {
+    x = 65535 - x;
+    y = 65535 - y;
+   }
+   t = x;
+   x = y;
+   y = t;
+  }
+ }
+ return key;
+}
+static int
+cmp_hilbert_rowid(const void *p1, const void *p2)
+{
+ const struct hilbert_rowid *r1 = p1;
+ const struct hilbert_rowid *r2 = p2;
+ if (r1->key < r2->key)
+  return -1;
+ if (r1->key > r2->key)
+  return 1;
+ if (r1->rowid < r2->rowid)
+  return -1;
+ if (r1->rowid > r2->rowid)
+  return 1;
+ return 0;
+}
+static struct hilbert_rowid *
+sort_geometries_hilbert(sqlite3 *db_handle, struct config_dem *source_config, int *count_rowids, int verbose)
+{
+ int ret=0;
+ int i=0;
+ int count_max=0;
+ char *sql_statement = NULL;
+ sqlite3_stmt *stmt = NULL;
+ struct hilbert_rowid *rowids = NULL;
+ double *xy = NULL;
+ double minx=0.0;
+ double miny=0.0;
+ double maxx=0.0;
+ double maxy=0.0;
+ *count_rowids=0;
+ sql_statement = sqlite3_mprintf("SELECT ROWID, (MbrMinX(\"%s\") + MbrMaxX(\"%s\")) / 2.0, (MbrMinY(\"%s\") + MbrMaxY(\"%s\")) / 2.0 "
+                                 "FROM '%s'.'%s' WHERE \"%s\" IS NOT NULL",
+                                 source_config->dem_geometry,source_config->dem_geometry,source_config->dem_geometry,source_config->dem_geometry,
+                                 source_config->schema,source_config->dem_table,source_config->dem_geometry);
+ ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &stmt, NULL );
+ if ( ret != SQLITE_OK )
+ {
+  if (verbose)
+  {
+   fprintf(stderr, "-W-> sort_geometries_hilbert: rc=%d sql[%s]\n",ret,sql_statement);
+  }
+  sqlite3_free(sql_statement);
+  return NULL;
+ }
+ sqlite3_free(sql_statement);
+ while ( sqlite3_step( stmt ) == SQLITE_ROW )
+ {
+  double x=sqlite3_column_double(stmt, 1);
+  double y=sqlite3_column_double(stmt, 2);
+  if ( sqlite3_column_type( stmt, 1 ) == SQLITE_NULL )
+  {
+   continue;
+  }
+  if (*count_rowids == count_max)
+  {
+   count_max = (count_max == 0) ? 65536 : count_max * 2;
+   rowids = realloc(rowids, sizeof (struct hilbert_rowid) * count_max);
+   xy = realloc(xy, sizeof (double) * 2 * count_max);
+  }
+  if (*count_rowids == 0)
+  {
+   minx = x;
+   miny = y;
+   maxx = x;
+   maxy = y;
+  }
+  minx = MIN(minx, x);
+  miny = MIN(miny, y);
+  maxx = MAX(maxx, x);
+  maxy = MAX(maxy, y);
+  rowids[*count_rowids].rowid = sqlite3_column_int64(stmt, 0);
+  xy[*count_rowids * 2] = x;
+  xy[(*count_rowids * 2) + 1] = y;
+  *count_rowids += 1;
+ }
+ sqlite3_finalize( stmt );
+ for (i=0; i<*count_rowids; i++)
+ {
+  int cell_x=0;
+  int cell_y=0;
+  if (maxx > minx)
+  {
+   cell_x = (int)((xy[i * 2] - minx) / (maxx - minx) * 65535.0);
+  }
+  if (maxy > miny)
+  {
+   cell_y = (int)((xy[(i * 2) + 1] - miny) / (maxy - miny) * 65535.0);
+  }
+  rowids[i].key = get_hilbert_key(cell_x, cell_y);
+ }
+ if (xy)
+ {
+  free(xy);
+ }
+ if (rowids)
+ {
+  qsort(rowids, *count_rowids, sizeof (struct hilbert_rowid), cmp_hilbert_rowid);
+ }
+ return rowids;
+}
+// -- -- ---------------------------------- --
+// Fetching the next source geometry
+// - in table order, or else following the
+//   Hilbert-ordered list of ROWIDs
+// -- -- ---------------------------------- --
+static int
+step_geometries(sqlite3_stmt *stmt, struct hilbert_rowid *rowids, int count_rowids, int *i_rowid)
+{
+ int ret=SQLITE_DONE;
+ if (rowids == NULL)
+ {
+  return sqlite3_step(stmt);
+ }
+ while (*i_rowid < count_rowids)
+ {
+  sqlite3_reset(stmt);
+  sqlite3_bind_int64(stmt, 1, rowids[*i_rowid].rowid);
+  *i_rowid += 1;
+  ret = sqlite3_step(stmt);
+  if (ret != SQLITE_DONE)
+  {// found (or an error)
+   return ret;
+  }
+ }
+ return SQLITE_DONE;
+}
+// -- -- ---------------------------------- --
+// Count of geometries after which the results
+//  will be shown, when verbose
+// -- -- ---------------------------------- --
+static int
+get_report_interval(unsigned int rows_count)
+{
+ double remainder_calc=0.10;
+ if ((rows_count/100) > 1000)
+ {// Display results every 1.25% of total geometries, when verbose
+  remainder_calc=remainder_calc/8;
+ } else if (rows_count > 500)
+ {// Display results every 2.5% of total geometries, when verbose
+  remainder_calc=remainder_calc/4;
+ } else if (rows_count > 100)
+ {// Display results every 5% of total geometries, when verbose
+  remainder_calc=remainder_calc/2;
+ } // else: Display results every 10% of total geometries, when verbose
+ return MAX(1, (int)(rows_count*remainder_calc));
+}
+// -- -- ---------------------------------- --
+// if the source geometry is out of range of the dem area, NULL is returned
+// - no update should be done and is not an error
+// if the source geometry cannot be updated, when changed
+// - this is an error and the loop should stop
+// The source must be a SpatialTable,
+// - since ROWID is used for a (possibly) needed update
+// -- -- ---------------------------------- --
+static int
+retrieve_geometries(sqlite3 *db_handle, struct config_dem *source_config, struct config_dem *dem_config, int *count_total_geometries, int *count_changed_geometries,
+                    int *count_points_total, int *count_z_total, int *count_m_total, int verbose)
+{
+ char *sql_statement = NULL;
+ sqlite3_stmt *stmt = NULL;
+ sqlite3_stmt *stmt_update = NULL;
+ char *sql_err = NULL;
+ unsigned char *blob_value = NULL;
+ int blob_bytes=0;
+ unsigned char *blob_update = NULL;
+ int blob_bytes_update=0;
+ int id_rowid=0;
+ int ret=0;
+ int ret_update=SQLITE_ABORT;
+ unsigned int i_sleep=1; // 1 second
+ int count_geometries_remainder=100;
+ int transaction_update_changed_last=0;
+ int transaction_count_loops=0;
+ double remainder_calc=0.10;
+ gaiaGeomCollPtr source_geom = NULL;
+ gaiaGeomCollPtr geom_dem = NULL;
+ gaiaGeomCollPtr geom_result = NULL;
+ struct hilbert_rowid *rowids = NULL;
+ int count_rowids=0;
+ int i_rowid=0;
+ const char *sql_rowid = "";
+ *count_total_geometries=0;
+ *count_changed_geometries=0;
+ *count_points_total=0;
+ *count_z_total=0;
+ *count_m_total=0;
+// -- -- ---------------------------------- --
+ count_geometries_remainder=get_report_interval(source_config->dem_rows_count);
+// -- -- ---------------------------------- --
+ if (verbose)
+ {
+  fprintf(stderr, "-I-> retrieve_geometries: results will be shown after each group of %d geometries, total[%u] \n",count_geometries_remainder,source_config->dem_rows_count);
+ }
+ if ((dem_config->dem_grid) && (dem_config->dem_grid->tiles))
+ {// tiled Dem-Store: visiting the geometries in Hilbert order
+  rowids = sort_geometries_hilbert(db_handle, source_config, &count_rowids, verbose);
+  if (rowids)
+  {
+   sql_rowid = " AND ROWID = ?";
+  }
+ }
+ if (dem_config->default_srid == dem_config->dem_srid)
+ {
+  sql_statement = sqlite3_mprintf("SELECT ROWID, \"%s\" FROM '%s'.'%s' WHERE \"%s\" IS NOT NULL%s",
+                                  source_config->dem_geometry, source_config->schema,source_config->dem_table, source_config->dem_geometry,sql_rowid);
+ }
+ else
+ {
+  sql_statement = sqlite3_mprintf("SELECT ROWID, \"%s\", ST_Transform(\"%s\",%d) FROM '%s'.'%s' WHERE \"%s\"  IS NOT NULL%s",
+                                  source_config->dem_geometry,source_config->dem_geometry, dem_config->dem_srid, source_config->schema,source_config->dem_table,source_config->dem_geometry,sql_rowid);
+ }
+#if 0
+ if (verbose)
+ {
+  fprintf(stderr, "-I-> retrieve_geometries: sql[%s] \n",sql_statement);
+ }
+#endif
+ ret = sqlite3_prepare_v2(db_handle, sql_statement, -1, &stmt, NULL );
+ if ( ret == SQLITE_OK )
+ {
+  sqlite3_free(sql_statement);
+  dem_profile_switch(dem_config->profile, DEM_PHASE_READ);
+  while ( step_geometries( stmt, rowids, count_rowids, &i_rowid ) == SQLITE_ROW )
+  {
+   if (( sqlite3_column_type( stmt, 0 ) != SQLITE_NULL ) &&
+       ( sqlite3_column_type( stmt, 1 ) != SQLITE_NULL ) )
+   {
+    id_rowid = sqlite3_column_int (stmt, 0);
+    dem_config->id_rowid=id_rowid; // for debugging
+    blob_value = (unsigned char *)sqlite3_column_blob(stmt, 1);
+    blob_bytes = sqlite3_column_bytes(stmt,1);
+    source_geom = gaiaFromSpatiaLiteBlobWkb(blob_value, blob_bytes);
+    *count_total_geometries+=1;
+    if (dem_config->profile)
+    {
+     dem_config->profile->rows_read++;
+    }
+   }
+   if ( sqlite3_column_type( stmt, 2 ) != SQLITE_NULL )
+   {
+    blob_value = (unsigned char *)sqlite3_column_blob(stmt, 2);
+    blob_bytes = sqlite3_column_bytes(stmt,2);
+    geom_dem = gaiaFromSpatiaLiteBlobWkb(blob_value, blob_bytes);
+   }
+   if (source_geom)
+   {
+    // if the source geometry is out of range of the dem area, NULL is returned: this is not an error, but no update
+    dem_profile_switch(dem_config->profile, DEM_PHASE_REBUILD);
+    geom_result=getDemCollect(db_handle, source_geom, geom_dem, dem_config, count_points_total,count_z_total,count_m_total,verbose);
+    gaiaFreeGeomColl(source_geom);
+    source_geom = NULL;
+    if (geom_dem)
+    {
+     gaiaFreeGeomColl(geom_dem);
+     geom_dem = NULL;
+    }
+    ret_update=SQLITE_OK;
+    if (geom_result)
+    {
+     sql_statement = sqlite3_mprintf("UPDATE '%s'.'%s' SET '%s'=? WHERE ROWID=%d",
+                                     source_config->schema,source_config->dem_table,source_config->dem_geometry,id_rowid);
+     ret=sqlite3_prepare_v2(db_handle, sql_statement, -1, &stmt_update, NULL);
+     if ( ret == SQLITE_OK)
+     {
+      sqlite3_free(sql_statement);
+      gaiaToSpatiaLiteBlobWkb(geom_result, &blob_update, &blob_bytes_update);
+      dem_profile_switch(dem_config->profile, DEM_PHASE_WRITE);
+      // Note: sqlite3_bind_* index is 1-based, os apposed to sqlite3_column_* that is 0-based.
+      sqlite3_bind_blob(stmt_update, 1, blob_update, blob_bytes_update, free);
+      ret_update = sqlite3_step( stmt_update );
+      if ( ret_update == SQLITE_DONE || ret_update == SQLITE_ROW )
+      {
+       ret_update=SQLITE_OK;
+       *count_changed_geometries += 1;
+       if (dem_config->profile)
+       {
+        dem_config->profile->rows_written++;
+       }
+      }
+      else
+      {
+       ret_update=SQLITE_ABORT;
+      }
+      sqlite3_finalize( stmt_update );
+     }
+     else
+     {
+      if (verbose)
+      {
+       fprintf(stderr, "-W-> retrieve_geometries [UPDATE]: rc=%d sql[%s]\n",ret,sql_statement);
+      }
+      sqlite3_free(sql_statement);
+     }
+    }
+    gaiaFreeGeomColl(geom_result);
+    geom_result = NULL;
+    if (((*count_total_geometries % count_geometries_remainder) == 0))
+    {
+     if (*count_changed_geometries > transaction_update_changed_last)
+     {// Store results only if something has changed
+      // Note: while testing, this process stopped, with no further updates being reported.
+      // The assumption was that there was a logical error else where, which was not the case.
+      // This saving was build in to get to this point and analyse. [cause: missing Next for Linestrings/Polygon for dem_geom]
+      // Since the logic exists, that UPDATEs are only done after changes have been made
+      // This sporadic COMMIT/BEGIN has been retained. What is done is done.
+      dem_profile_switch(dem_config->profile, DEM_PHASE_WRITE);
+      if (sqlite3_exec(db_handle, "COMMIT", NULL, NULL, &sql_err) == SQLITE_OK)
+      {
+       sleep(i_sleep);
+       if (sqlite3_exec(db_handle, "BEGIN", NULL, NULL, &sql_err) == SQLITE_OK)
+       {
+       }
+      }
+      if (sql_err)
+      {
+       sqlite3_free(sql_err);
+      }
+     }
+     if (verbose)
+     {
+      double procent_diff=(double)(*count_total_geometries)/source_config->dem_rows_count;
+      remainder_calc=procent_diff*100;
+      if (transaction_count_loops == 0)
+      {// Show only once
+       fprintf(stderr,"-I-> converted geometries committed to Database: \n");
+      }
+      transaction_count_loops++;
+      if (dem_config->has_m)
+      {// overwrite the previous message [\r]
+       fprintf(stderr, "\r %02.2f%% total read[%d] changed[%d] ; points total[%d] changed z[%d] changed m[%d] ",remainder_calc,*count_total_geometries,*count_changed_geometries,*count_points_total,*count_z_total,*count_m_total);
+      }
+      else
+      {// overwrite the previous message [\r]
+       fprintf(stderr, "\r %02.2f%% total read[%d] changed[%d] ; points total[%d] changed z[%d] ",remainder_calc,*count_total_geometries,*count_changed_geometries,*count_points_total,*count_z_total);
+      }
+     }
+     transaction_update_changed_last=*count_changed_geometries;
+    }
+   }
+   if (ret_update == SQLITE_ABORT )
+   {
+    break;
+   }
+   dem_profile_switch(dem_config->profile, DEM_PHASE_READ);
+  }
+  sqlite3_finalize( stmt );
+  if (verbose)
+  {// new line after last message [\n]
+   fprintf(stderr, "\n");
+  }
+ }
+ else
+ {
+  if (verbose)
+  {
+   fprintf(stderr, "-W-> retrieve_geometries [SELECT]: rc=%d sql[%s]\n",ret,sql_statement);
+  }
+  sqlite3_free(sql_statement);
+ }
+ if (rowids)
+ {
+  free(rowids);
+ }
+ if (ret_update == SQLITE_ABORT )
+ {
+  return 0;
+ }
+ return 1;
+}
+#ifndef _WIN32
+// -- -- ---------------------------------- --
+// Parallel Z-update [-threads]
+// - the main thread reads the source geometries in
+//   batches and is the only writer of the updates
+// - the worker threads parse the geometries and retrieve
+//   the z/m-values from the in-memory Dem-Grid, which is
+//   shared read-only
+// - batches are written back in the order they were read
+// -- -- ---------------------------------- --
+struct dem_update_item
+{
+ int id_rowid;
+ unsigned char *blob_source;
+ int blob_source_bytes;
+ unsigned char *blob_dem; // NULL when the Srid of the Dem is the same
+ int blob_dem_bytes;
+ unsigned char *blob_update; // NULL when nothing has changed
+ int blob_update_bytes;
+};
+struct dem_update_batch
+{
+ struct dem_update_item items[DEM_UPDATE_BATCH_SIZE];
+ int count_items;
+ int count_points;
+ int count_z;
+ int count_m;
+ int is_done;
+ struct dem_update_batch *next;
+};
+struct dem_update_pool
+{
+ pthread_t *workers;
+ int count_workers;
+ pthread_mutex_t mutex;
+ pthread_cond_t cond;
+ struct dem_update_batch *first; // the next batch to be written
+ struct dem_update_batch *last;
+ struct dem_update_batch *next_todo; // the next batch to be processed
+ int is_stopping;
+ sqlite3 *db_handle;
+ struct config_dem *dem_config;
+ int verbose;
+};
+static void
+free_dem_update_batch(struct dem_update_batch *batch)
+{
+ int i=0;
+ for (i=0; i<batch->count_items; i++)
+ {
+  if (batch->items[i].blob_source)
+  {
+   free(batch->items[i].blob_source);
+  }
+  if (batch->items[i].blob_dem)
+  {
+   free(batch->items[i].blob_dem);
+  }
+  if (batch->items[i].blob_update)
+  {
+   free(batch->items[i].blob_update);
+  }
+ }
+ free(batch);
+}
+static unsigned char *
+copy_geometry_blob(sqlite3_stmt *stmt, int i_column, int *blob_bytes)
+{
+ unsigned char *blob = NULL;
+ *blob_bytes = sqlite3_column_bytes(stmt, i_column);
+ blob = malloc(*blob_bytes);
+ memcpy(blob, sqlite3_column_blob(stmt, i_column), *blob_bytes);
+ return blob;
+}
+static struct dem_update_batch *
+read_dem_update_batch(sqlite3_stmt *stmt, int *is_eof)
+{
+ struct dem_update_batch *batch = malloc(sizeof (struct dem_update_batch));
+ struct dem_update_item *item = NULL;
+ batch->count_items = 0;
+ batch->count_points = 0;
+ batch->count_z = 0;
+ batch->count_m = 0;
+ batch->is_done = 0;
+ batch->next = NULL;
+ while (batch->count_items < DEM_UPDATE_BATCH_SIZE)
+ {
+  if ( sqlite3_step( stmt ) != SQLITE_ROW )
+  {
+   *is_eof = 1;
+   break;
+  }
+  if (( sqlite3_column_type( stmt, 0 ) == SQLITE_NULL ) ||
+      ( sqlite3_column_type( stmt, 1 ) == SQLITE_NULL ) )
+  {
+   continue;
+  }
+  item = &(batch->items[batch->count_items]);
+  item->id_rowid = sqlite3_column_int (stmt, 0);
+  item->blob_source = copy_geometry_blob(stmt, 1, &item->blob_source_bytes);
+  item->blob_dem = NULL;
+  item->blob_update = NULL;
+  if ( sqlite3_column_type( stmt, 2 ) == SQLITE_BLOB )
+  {
+   item->blob_dem = copy_geometry_blob(stmt, 2, &item->blob_dem_bytes);
+  }
+  batch->count_items++;
+ }
+ return batch;
+}
+static void
+process_dem_update_batch(sqlite3 *db_handle, struct dem_update_batch *batch, struct config_dem *dem_config, int verbose)
+{
+ int i=0;
+ struct dem_update_item *item = NULL;
+ gaiaGeomCollPtr source_geom = NULL;
+ gaiaGeomCollPtr geom_dem = NULL;
+ gaiaGeomCollPtr geom_result = NULL;
+ for (i=0; i<batch->count_items; i++)
+ {
+  item = &(batch->items[i]);
+  source_geom = gaiaFromSpatiaLiteBlobWkb(item->blob_source, item->blob_source_bytes);
+  if (item->blob_dem)
+  {
+   geom_dem = gaiaFromSpatiaLiteBlobWkb(item->blob_dem, item->blob_dem_bytes);
+  }
+  if (source_geom)
+  {
+   dem_config->id_rowid=item->id_rowid; // for debugging
+   dem_profile_switch(dem_config->profile, DEM_PHASE_REBUILD);
+   geom_result=getDemCollect(db_handle, source_geom, geom_dem, dem_config, &batch->count_points,&batch->count_z,&batch->count_m,verbose);
+   if (geom_result)
+   {
+    gaiaToSpatiaLiteBlobWkb(geom_result, &item->blob_update, &item->blob_update_bytes);
+    gaiaFreeGeomColl(geom_result);
+   }
+   gaiaFreeGeomColl(source_geom);
+  }
+  if (geom_dem)
+  {
+   gaiaFreeGeomColl(geom_dem);
+   geom_dem = NULL;
+  }
+ }
+}
+static void *
+dem_update_worker(void *arg)
+{
+ struct dem_update_pool *pool = (struct dem_update_pool *)arg;
+ struct dem_update_batch *batch = NULL;
+ // the debugging fields are written by getDemCollect
+ struct config_dem worker_config = *(pool->dem_config);
+ struct dem_profile worker_profile;
+ if (worker_config.profile)
+ {// timed separately, added when finished
+  init_dem_profile(&worker_profile, DEM_PHASE_WAIT);
+  worker_config.profile = &worker_profile;
+ }
+ while (1)
+ {
+  pthread_mutex_lock(&(pool->mutex));
+  while ((pool->next_todo == NULL) && (!pool->is_stopping))
+  {
+   pthread_cond_wait(&(pool->cond), &(pool->mutex));
+  }
+  batch = pool->next_todo;
+  if (batch == NULL)
+  {
+   pthread_mutex_unlock(&(pool->mutex));
+   break;
+  }
+  pool->next_todo = batch->next;
+  pthread_mutex_unlock(&(pool->mutex));
+  process_dem_update_batch(pool->db_handle, batch, &worker_config, pool->verbose);
+  dem_profile_switch(worker_config.profile, DEM_PHASE_WAIT);
+  pthread_mutex_lock(&(pool->mutex));
+  batch->is_done = 1;
+  pthread_cond_broadcast(&(pool->cond));
+  pthread_mutex_unlock(&(pool->mutex));
+ }
+ if (worker_config.profile)
+ {
+  pthread_mutex_lock(&(pool->mutex));
+  add_dem_profile(pool->dem_config->profile, &worker_profile);
+  pthread_mutex_unlock(&(pool->mutex));
+ }
+ return NULL;
+}
+// -- -- ---------------------------------- --
+// Same results as retrieve_geometries
+// - only used with the in-memory Dem-Grid,
+//   since no SQL is then needed by the workers
+// - the updates are committed every
+//   DEM_UPDATE_COMMIT_ROWS changed geometries
+// -- -- ---------------------------------- --
+static int
+retrieve_geometries_parallel(sqlite3 *db_handle, struct config_dem *source_config, struct config_dem *dem_config, int *count_total_geometries, int *count_changed_geometries,
+                             int *count_points_total, int *count_z_total, int *count_m_total, int verbose)
+{
+ char *sql_statement = NULL;
+ sqlite3_stmt *stmt = NULL;
+ sqlite3_stmt *stmt_update = NULL;
+ char *sql_err = NULL;
+ int ret=0;
+ int ret_update=SQLITE_OK;
+ int i=0;
+ int is_eof=0;
+ int count_batches=0;
+ int count_geometries_remainder=0;
+ int count_geometries_report=0;
+ int transaction_update_changed_last=0;
+ struct dem_update_pool pool;
+ struct dem_update_batch *batch = NULL;
+ *count_total_geometries=0;
+ *count_changed_geometries=0;
+ *count_points_total=0;
+ *count_z_total=0;
+ *count_m_total=0;
+// -- -- ---------------------------------- --
+ count_geometries_remainder=get_report_interval(source_config->dem_rows_count);
+ count_geometries_report=count_geometries_remainder;
+ if (dem_config->default_srid == dem_config->dem_srid)
+ {
+  sql_statement = sqlite3_mprintf("SELECT ROWID, \"%s\" FROM '%s'.'%s' WHERE \"%s\" IS NOT NULL",
+                                  source_config->dem_geometry, source_config->schema,source_config->dem_table, source_config->dem_geometry);
+ }
+ else
+ {
+  sql_statement = sqlite3_mprintf("SELECT ROWID, \"%s\", ST_Transform(\"%s\",%d) FROM '%s'.'%s' WHERE \"%s\"  IS NOT NULL",
+                                  source_config->dem_geometry,source_config->dem_geometry, dem_config->dem_srid, source_config->schema,source_config->dem_table,source_config->dem_geometry);
+ }
+ ret = sqlite3_prepare_v2(db_handle, sql_statement, -1, &stmt, NULL );
+ if ( ret != SQLITE_OK )
+ {
+  if (verbose)
+  {
+   fprintf(stderr, "-W-> retrieve_geometries_parallel [SELECT]: rc=%d sql[%s]\n",ret,sql_statement);
+  }
+  sqlite3_free(sql_statement);
+  return 0;
+ }
+ sqlite3_free(sql_statement);
+ sql_statement = sqlite3_mprintf("UPDATE '%s'.'%s' SET '%s'=? WHERE ROWID=?",
+                                 source_config->schema,source_config->dem_table,source_config->dem_geometry);
+ ret = sqlite3_prepare_v2(db_handle, sql_statement, -1, &stmt_update, NULL);
+ if ( ret != SQLITE_OK )
+ {
+  if (verbose)
+  {
+   fprintf(stderr, "-W-> retrieve_geometries_parallel [UPDATE]: rc=%d sql[%s]\n",ret,sql_statement);
+  }
+  sqlite3_free(sql_statement);
+  sqlite3_finalize( stmt );
+  return 0;
+ }
+ sqlite3_free(sql_statement);
+// -- -- ---------------------------------- --
+// starting the workers
+// -- -- ---------------------------------- --
+ pool.count_workers = dem_config->threads;
+ pool.first = NULL;
+ pool.last = NULL;
+ pool.next_todo = NULL;
+ pool.is_stopping = 0;
+ pool.db_handle = db_handle;
+ pool.dem_config = dem_config;
+ pool.verbose = verbose;
+ pthread_mutex_init(&(pool.mutex), NULL);
+ pthread_cond_init(&(pool.cond), NULL);
+ pool.workers = malloc(sizeof (pthread_t) * pool.count_workers);
+ for (i=0; i<pool.count_workers; i++)
+ {
+  if (pthread_create(&(pool.workers[i]), NULL, dem_update_worker, &pool) != 0)
+  {
+   break;
+  }
+ }
+ pool.count_workers = i;
+ if (verbose)
+ {
+  fprintf(stderr, "-I-> retrieve_geometries: %d threads, results will be shown after each group of %d geometries, total[%u] \n",pool.count_workers,count_geometries_remainder,source_config->dem_rows_count);
+ }
+ if (pool.count_workers == 0)
+ {
+  fprintf(stderr, "-E-> retrieve_geometries_parallel: unable to start the threads\n");
+  ret_update=SQLITE_ABORT;
+ }
+// -- -- ---------------------------------- --
+// reading, and writing back in order
+// -- -- ---------------------------------- --
+ while (ret_update != SQLITE_ABORT)
+ {
+  dem_profile_switch(dem_config->profile, DEM_PHASE_READ);
+  while ((!is_eof) && (count_batches < (pool.count_workers * 2)))
+  {
+   batch = read_dem_update_batch(stmt, &is_eof);
+   if (batch->count_items == 0)
+   {
+    free_dem_update_batch(batch);
+    break;
+   }
+   pthread_mutex_lock(&(pool.mutex));
+   if (pool.last)
+   {
+    pool.last->next = batch;
+   }
+   else
+   {
+    pool.first = batch;
+   }
+   pool.last = batch;
+   if (pool.next_todo == NULL)
+   {
+    pool.next_todo = batch;
+   }
+   pthread_cond_broadcast(&(pool.cond));
+   pthread_mutex_unlock(&(pool.mutex));
+   count_batches++;
+  }
+  if (pool.first == NULL)
+  {// all done
+   break;
+  }
+  dem_profile_switch(dem_config->profile, DEM_PHASE_WAIT);
+  pthread_mutex_lock(&(pool.mutex));
+  while (!pool.first->is_done)
+  {
+   pthread_cond_wait(&(pool.cond), &(pool.mutex));
+  }
+  batch = pool.first;
+  pool.first = batch->next;
+  if (pool.first == NULL)
+  {
+   pool.last = NULL;
+  }
+  pthread_mutex_unlock(&(pool.mutex));
+  count_batches--;
+  dem_profile_switch(dem_config->profile, DEM_PHASE_WRITE);
+  for (i=0; i<batch->count_items; i++)
+  {
+   if (batch->items[i].blob_update == NULL)
+   {
+    continue;
+   }
+   sqlite3_reset(stmt_update);
+   sqlite3_clear_bindings(stmt_update);
+   sqlite3_bind_blob(stmt_update, 1, batch->items[i].blob_update, batch->items[i].blob_update_bytes, SQLITE_STATIC);
+   sqlite3_bind_int(stmt_update, 2, batch->items[i].id_rowid);
+   ret = sqlite3_step( stmt_update );
+   if ( ret == SQLITE_DONE || ret == SQLITE_ROW )
+   {
+    *count_changed_geometries += 1;
+    if (dem_config->profile)
+    {
+     dem_config->profile->rows_written++;
+    }
+   }
+   else
+   {
+    if (verbose)
+    {
+     fprintf(stderr, "-W-> retrieve_geometries_parallel [UPDATE]: ROWID=%d %s\n",batch->items[i].id_rowid,sqlite3_errmsg(db_handle));
+    }
+    ret_update=SQLITE_ABORT;
+    break;
+   }
+  }
+  *count_total_geometries += batch->count_items;
+  if (dem_config->profile)
+  {
+   dem_config->profile->rows_read += batch->count_items;
+  }
+  *count_points_total += batch->count_points;
+  *count_z_total += batch->count_z;
+  *count_m_total += batch->count_m;
+  free_dem_update_batch(batch);
+  if ((ret_update != SQLITE_ABORT) && (*count_changed_geometries - transaction_update_changed_last >= DEM_UPDATE_COMMIT_ROWS))
+  {// the Transaction is kept large, but not unlimited
+   sqlite3_reset(stmt_update);
+   if ((sqlite3_exec(db_handle, "COMMIT", NULL, NULL, &sql_err) != SQLITE_OK) ||
+       (sqlite3_exec(db_handle, "BEGIN", NULL, NULL, &sql_err) != SQLITE_OK))
+   {// the caller will ROLLBACK whatever is still pending
+    fprintf(stderr, "-E-> retrieve_geometries_parallel: COMMIT/BEGIN TRANSACTION error: %s\n", sql_err ? sql_err : sqlite3_errmsg(db_handle));
+    ret_update=SQLITE_ABORT;
+   }
+   if (sql_err)
+   {
+    sqlite3_free(sql_err);
+    sql_err = NULL;
+   }
+   transaction_update_changed_last=*count_changed_geometries;
+  }
+  if ((verbose) && (*count_total_geometries >= count_geometries_report))
+  {// overwrite the previous message [\r]
+   double procent_diff=(double)(*count_total_geometries)/source_config->dem_rows_count;
+   count_geometries_report += count_geometries_remainder;
+   if (dem_config->has_m)
+   {
+    fprintf(stderr, "\r %02.2f%% total read[%d] changed[%d] ; points total[%d] changed z[%d] changed m[%d] ",procent_diff*100,*count_total_geometries,*count_changed_geometries,*count_points_total,*count_z_total,*count_m_total);
+   }
+   else
+   {
+    fprintf(stderr, "\r %02.2f%% total read[%d] changed[%d] ; points total[%d] changed z[%d] ",procent_diff*100,*count_total_geometries,*count_changed_geometries,*count_points_total,*count_z_total);
+   }
+  }
+ }
+ if (verbose)
+ {// new line after last message [\n]
+  fprintf(stderr, "\n");
+ }
+// -- -- ---------------------------------- --
+// stopping the workers
+// -- -- ---------------------------------- --
+ pthread_mutex_lock(&(pool.mutex));
+ pool.is_stopping = 1;
+ pool.next_todo = NULL;
+ pthread_cond_broadcast(&(pool.cond));
+ pthread_mutex_unlock(&(pool.mutex));
+ for (i=0; i<pool.count_workers; i++)
+ {
+  pthread_join(pool.workers[i], NULL);
+ }
+ while (pool.first)
+ {// only after an error
+  batch = pool.first;
+  pool.first = batch->next;
+  free_dem_update_batch(batch);
+ }
+ free(pool.workers);
+ pthread_mutex_destroy(&(pool.mutex));
+ pthread_cond_destroy(&(pool.cond));
+ sqlite3_finalize( stmt_update );
+ sqlite3_finalize( stmt );
+ if (ret_update == SQLITE_ABORT )
+ {
+  return 0;
+ }
+ return 1;
+}
+#endif /* not WIN32 */
+// -- -- ---------------------------------- --
+// Retrieve information about given
+// - table and geometry-column
+// -> for Source and Dem geometries
+// Dem
+// - must be a POINTZ or POINTZM
+// - SpatialIndex must exist
+// -  Extent and row_count
+// -> to calculate resolution
+// Source
+// - must have a Z or ZM Dimension
+// Both
+// -  Srid of geometries
+// -- -- ---------------------------------- --
+static int
+check_geometry_dimension(sqlite3 *db_handle, struct config_dem *use_config, int *geometry_type, int verbose)
+{
+ /* checking the table, geometry exists and if the geometry supports z-values */
+ int ret=0;
+ char *sql_statement = NULL;
+ sqlite3_stmt *stmt = NULL;
+ int *srid_default = NULL;
+ use_config->has_z = 0;
+ use_config->has_m = 0;
+ use_config->dem_extent_minx=0.0;
+ use_config->dem_extent_miny=0.0;
+ use_config->dem_extent_maxx=0.0;
+ use_config->dem_extent_maxy=0.0;
+ use_config->has_spatial_index=0;
+ use_config->is_spatial_table=0;
+ if (use_config->config_type == CONF_TYPE_DEM )
+ {
+  srid_default = &use_config->dem_srid;
+ }
+ else
+ {
+  srid_default = &use_config->default_srid;
+ }
+ *geometry_type = 0;
+ *srid_default = 0;
+// 390718.000000	5818887.000000	392757.000000	5820847.000000
+// 392757-390718=2039
+// 5820847-5818887=1960
+// 1960*2039=3996440/4000440=0.99900011 resolution
+ sql_statement = sqlite3_mprintf("SELECT a.geometry_type, a.srid, a.spatial_index_enabled, a.layer_type, "
+                                 "b.extent_min_x, b.extent_min_y, b.extent_max_x, b.extent_max_y, b.row_count "
+                                 "FROM '%s'.vector_layers AS a LEFT JOIN '%s'.vector_layers_statistics AS b "
+                                 "ON a.table_name=b.table_name  AND a.geometry_column=b.geometry_column "
+                                 "WHERE a.table_name='%s' AND a.geometry_column='%s'", use_config->schema, use_config->schema,
+                                 use_config->dem_table, use_config->dem_geometry);
+ ret = sqlite3_prepare_v2(db_handle, sql_statement, -1, &stmt, NULL );
+ if ( ret == SQLITE_OK )
+ {
+  sqlite3_free(sql_statement);
+  while ( sqlite3_step( stmt ) == SQLITE_ROW )
+  {
+   if (( sqlite3_column_type( stmt, 0 ) != SQLITE_NULL ) &&
+       ( sqlite3_column_type( stmt, 1 ) != SQLITE_NULL ) &&
+       ( sqlite3_column_type( stmt, 2 ) != SQLITE_NULL ) &&
+       ( sqlite3_column_type( stmt, 3 ) != SQLITE_NULL ))
+   {
+    *geometry_type = sqlite3_column_int( stmt, 0 );
+    *srid_default = sqlite3_column_int( stmt, 1 );
+    use_config->has_spatial_index = sqlite3_column_int( stmt, 2 );
+    if (strcmp((const char *)sqlite3_column_text( stmt, 3 ),"SpatialTable") == 0)
+    {
+     // The source Database must be in a SpatialTable to be updated [no checking for writable SpatialView's]
+     // will be using ROWID to UPDATE
+     use_config->is_spatial_table = 1;
+    }
+    // printf("-I-> check_geometry_dimension: coord_dimension=%d GAIA_XY_*l[%d,%d,%d]\n",coord_dimension,GAIA_XY_Z,GAIA_XY_Z_M,GAIA_XY_M);
+    switch (*geometry_type)
+    {
+     case GAIA_POINTZ:
+     case GAIA_LINESTRINGZ:
+     case GAIA_POLYGONZ:
+     case GAIA_MULTIPOINTZ:
+     case GAIA_MULTILINESTRINGZ:
+     case GAIA_MULTIPOLYGONZ:
+     case GAIA_GEOMETRYCOLLECTIONZ:
+      use_config->has_z = 1;
+      break;
+    }
+    switch (*geometry_type)
+    {
+     case GAIA_POINTZM:
+     case GAIA_LINESTRINGZM:
+     case GAIA_POLYGONZM:
+     case GAIA_MULTIPOINTZM:
+     case GAIA_MULTILINESTRINGZM:
+     case GAIA_MULTIPOLYGONZM:
+     case GAIA_GEOMETRYCOLLECTIONZM:
+      use_config->has_z = 1;
+      use_config->has_m = 1;
+      break;
+    }
+    switch (*geometry_type)
+    {
+     case GAIA_POINTM:
+     case GAIA_LINESTRINGM:
+     case GAIA_POLYGONM:
+     case GAIA_MULTIPOINTM:
+     case GAIA_MULTILINESTRINGM:
+     case GAIA_MULTIPOLYGONM:
+     case GAIA_GEOMETRYCOLLECTIONM:
+      use_config->has_m = 1;
+      break;
+    }
+   }
+   if (( sqlite3_column_type( stmt, 4 ) != SQLITE_NULL ) &&
+       ( sqlite3_column_type( stmt, 5 ) != SQLITE_NULL ) &&
+       ( sqlite3_column_type( stmt, 6 ) != SQLITE_NULL ) &&
+       ( sqlite3_column_type( stmt, 7 ) != SQLITE_NULL ) &&
+       ( sqlite3_column_type( stmt, 8 ) != SQLITE_NULL ))
+   {
+    use_config->dem_extent_minx = sqlite3_column_double( stmt, 4 );
+    use_config->dem_extent_miny = sqlite3_column_double( stmt, 5 );
+    use_config->dem_extent_maxx = sqlite3_column_double( stmt, 6 );
+    use_config->dem_extent_maxy = sqlite3_column_double( stmt, 7 );
+    use_config->dem_rows_count = sqlite3_column_int64( stmt, 8 );
+   }
+  }
+  sqlite3_finalize( stmt );
+  if ((use_config->is_spatial_table == 1) && (use_config->has_z) && (use_config->dem_rows_count > 0))
+  {
+   ret=1; // Valid for usage
+  }
+ }
+ else
+ {
+  if (verbose)
+  {
+   fprintf(stderr, "-W-> check_geometry_dimension: rc=%d sql[%s]\n",ret,sql_statement);
+  }
+  sqlite3_free(sql_statement);
+ }
+ return ret;
+}
+// -- -- ---------------------------------- --
+// Checking for a Dem-Raster [-create_dem -raster]
+// - the Dem points are then only stored as tiles,
+//   the settings are read from the layout
+// -- -- ---------------------------------- --
+static int
+check_dem_raster(sqlite3 *db_handle, struct config_dem *dem_config, double *resolution, int verbose)
+{
+ int ret=0;
+ char *sql_statement = NULL;
+ sqlite3_stmt *stmt = NULL;
+ dem_config->is_raster = 0;
+ sql_statement = sqlite3_mprintf("SELECT srid, has_m, count_points, extent_minx, extent_miny, extent_maxx, extent_maxy, "
+                                 "step_x, step_y, columns, rows "
+                                 "FROM '%s'.'%s_tiles_layout' WHERE is_raster = 1",
+                                 dem_config->schema,dem_config->dem_table);
+ ret = sqlite3_prepare_v2(db_handle, sql_statement, -1, &stmt, NULL );
+ sqlite3_free(sql_statement);
+ if ( ret != SQLITE_OK )
+ {// no Dem-Store [or an older layout]
+  return 0;
+ }
+ while ( sqlite3_step( stmt ) == SQLITE_ROW )
+ {
+  dem_config->dem_srid = sqlite3_column_int( stmt, 0 );
+  dem_config->has_m = sqlite3_column_int( stmt, 1 );
+  dem_config->dem_rows_count = sqlite3_column_int64( stmt, 2 );
+  dem_config->dem_extent_minx = sqlite3_column_double( stmt, 3 );
+  dem_config->dem_extent_miny = sqlite3_column_double( stmt, 4 );
+  dem_config->dem_extent_maxx = sqlite3_column_double( stmt, 5 );
+  dem_config->dem_extent_maxy = sqlite3_column_double( stmt, 6 );
+  *resolution = MAX(sqlite3_column_double( stmt, 7 ), sqlite3_column_double( stmt, 8 ));
+  dem_config->has_z = 1;
+  dem_config->is_raster = 1;
+  if (verbose)
+  {
+   fprintf(stderr,"Dem: raster %d columns x %d rows, step x/y(%2.7f,%2.7f)\n",
+           sqlite3_column_int( stmt, 9 ),sqlite3_column_int( stmt, 10 ),
+           sqlite3_column_double( stmt, 7 ),sqlite3_column_double( stmt, 8 ));
+  }
+ }
+ sqlite3_finalize( stmt );
+ return dem_config->is_raster;
+}
+static void
+spatialite_autocreate(sqlite3 *db_handle)
+{
+ /* attempting to perform self-initialization for a newly created DB */
+ int ret;
+ char sql[1024];
+ char *err_msg = NULL;
+ int count;
+ int i;
+ char **results;
+ int rows;
+ int columns;
+
+ /* checking if this DB is really empty */
+ strcpy(sql, "SELECT Count(*) from sqlite_master");
+ ret = sqlite3_get_table(db_handle, sql, &results, &rows, &columns, NULL);
+ if (ret != SQLITE_OK)
+  return;
+ if (rows < 1)
+  ;
+ else
+ {
+  for (i = 1; i <= rows; i++)
+   count = atoi (results[(i * columns) + 0]);
+ }
+ sqlite3_free_table(results);
+
+ if (count > 0)
+  return;
+
+ /* all right, it's empty: proceding to initialize */
+ strcpy(sql, "SELECT InitSpatialMetadataFull(1)");
+ ret = sqlite3_exec(db_handle, sql, NULL, NULL, &err_msg);
+ if (ret != SQLITE_OK)
+ {
+  fprintf(stderr, "InitSpatialMetadataFull() error: %s\n", err_msg);
+  sqlite3_free(err_msg);
+  return;
+ }
+}
+// -- -- ---------------------------------- --
+// Collecting a list of Dem-xyz file
+// - with checks on the first record
+// Case 1: a single xyz.file is given
+// -> the file will be checked and added to the list
+// Case 2: a directory is given
+// -> each file will be checked and added to the list
+// Case 3: a single list.file is given
+// - contains a list of single xyz.files to be read
+// -> expected to be inside the given directory
+// -> each file will be checked and added to the list
+// -- -- ---------------------------------- --
+// The list is the TABLE db_memory.xyz_files
+// Goal is to read the files in a specific order:
+// --> y='South to North' and x='West to East'
+// -- -- ---------------------------------- --
+static int
+collect_xyz_files(sqlite3 *db_handle,const char *xyz_filename, int *count_xyz_files, int verbose)
+{
+ int ret=0;
+ int i_count_fields=0;
+ int i_count_fields_check=3;
+ int ret_insert=SQLITE_OK;
+ if (*count_xyz_files < 0)
+ {
+  *count_xyz_files=0;
+ }
+ double point_x=0.0;
+ double point_y=0.0;
+ double point_z=0.0;
+ char *sql_statement = NULL;
+ int result_file_type=0;
+ char *directory_from_filename = NULL;
+// -- -- ---------------------------------- --
+ FILE *xyz_file = fopen(xyz_filename, "rt");
+ if (xyz_file != NULL)
+ {
+  if (verbose)
+  {
+   fprintf(stderr,"-I-> collect_xyz_files:reading xyz_filename[%s] \n", xyz_filename);
+  }
+  char line[MAXBUF];
+  while(fgets(line, sizeof(line), xyz_file) != NULL)
+  {
+   if (strcmp(line, "SQLite format 3") != 0)
+   {
+    line[strcspn(line, "\r\n")] = 0;
+    char *token;
+    char *ptr_strtod;
+    char *saveptr;
+    i_count_fields=0;
+    token = strtok_r(line, " ",&saveptr);
+    point_x=strtod(token, &ptr_strtod);
+    // atof will cause a signal 11 (SIGSEGV), if token does not contain a double
+    if ((int)strlen(ptr_strtod) == 0)
     {
-     if (rng_dem->DimensionModel == GAIA_XY_Z)
+     i_count_fields++;
+     while(token != NULL)
      {
-      gaiaGetPointXYZ(rng_dem->Coords, i, &x, &y, &z);
+      token = strtok_r(NULL," ",&saveptr);
+      switch (i_count_fields)
+      {
+       case 1:
+        point_y=strtod(token, &ptr_strtod);
+        if ((int)strlen(ptr_strtod) == 0)
+        {
+         i_count_fields++;
+        }
+        break;
+       case 2:
+        point_z=strtod(token, &ptr_strtod);
+        if ((int)strlen(ptr_strtod) == 0)
+        {
+         if (point_z < 0.0 || point_z > 0.0)
+         {
+          // suppressing stupid compiler warnings
+          i_count_fields++;
+         }
+        }
+        break;
+      }
      }
-     else if (rng_dem->DimensionModel == GAIA_XY_M)
+    }
+    if (i_count_fields == 0)
+    {
+     // This may be a list of xyz.file-names,
+     // - contained in the same directory
+     // - that should be read [possibly not all of the xyz.files should be read]
+     // - order is not important, will be sorted by point_y ASC, point_x ASC of the first record
+     if (!directory_from_filename)
      {
-      gaiaGetPointXYM(rng_dem->Coords, i, &x, &y, &m);
+      const char *slash = strrchr(xyz_filename,'/');
+      directory_from_filename=malloc(sizeof(char)*((slash-xyz_filename)+1));
+      strncpy(directory_from_filename,xyz_filename,slash-xyz_filename);
+      directory_from_filename[(slash-xyz_filename)]=0;
      }
-     else if (rng_dem->DimensionModel == GAIA_XY_Z_M)
-     {
-      gaiaGetPointXYZM(rng_dem->Coords, i, &x, &y, &z, &m);
+     sql_statement = sqlite3_mprintf("%s/%s", directory_from_filename,token);
+     // the first record will be read. If 3 doubles, seperated by a space, can be created
+     // 1 : will be returned, after adding the path/file-name, point_x and point_y to db_memory.xyz_files
+     result_file_type=collect_xyz_files(db_handle,sql_statement, count_xyz_files, 0);
+     if (result_file_type == 1)
+     {//file_name has been added to db_memory.xyz_files
+      ret=1; // xyz-format
      }
-     else
+     sqlite3_free(sql_statement);
+    }
+    if (i_count_fields == i_count_fields_check)
+    {
+     sql_statement = sqlite3_mprintf("INSERT INTO db_memory.xyz_files (point_x,point_y,file_name) "
+                                     "VALUES(%2.7f,%2.7f,'%s') ",point_x,point_y,xyz_filename);
+     if (db_handle)
      {
-      gaiaGetPoint(rng_dem->Coords, i, &x, &y);
+      if (sqlite3_exec(db_handle, sql_statement, NULL, NULL, NULL) == SQLITE_OK)
+      {
+       *count_xyz_files+=1; // xyz-format
+       result_file_type=1;
+      }
      }
-     xx_dem[i] = x;
-     yy_dem[i] = y;
+     sqlite3_free(sql_statement);
+     ret_insert = SQLITE_ABORT;
+    }
+    if (verbose)
+    {
+     fprintf(stderr,"-I->  collect_xyz_files: i_count_fields[%d] check[%d] count_files[%d]\n", i_count_fields,i_count_fields_check,*count_xyz_files);
     }
-    if (rng->DimensionModel == GAIA_XY_Z  || rng->DimensionModel == GAIA_XY_Z_M)
-     zz[i] = z;
-    else
-     zz[i] = 0.0;
-    if (rng->DimensionModel == GAIA_XY_M  || rng->DimensionModel == GAIA_XY_Z_M)
-     mm[i] = m;
    }
-   if ((dem_config->has_m) && (mm) )
+   else
    {
-    mm_use = mm;
+    result_file_type=2; // Sqlite3-format
    }
-   // searching for nearest point
-   *count_points_total+=cnt;
-   i_count_z=0;
-   i_count_m=0;
-   dem_config->count_points=cnt;
-   if (retrieve_dem_points(db_handle, dem_config, cnt, xx_use, yy_use,zz,mm_use,&i_count_z, &i_count_m,verbose))
+   if (ret_insert == SQLITE_ABORT )
    {
-    *count_z_total+=i_count_z;
-    *count_m_total+=i_count_m;
-    count_z+=i_count_z;
-    count_m+=i_count_m;
+    break;
    }
-   xx_use = NULL;
-   yy_use = NULL;
-   mm_use = NULL;
-   // inserting the reprojected POLYGON in the new GEOMETRY
-   dst_rng = gaiaAddInteriorRing(dst_pg, ib, cnt);
-   for (i = 0; i < cnt; i++)
+   if (ret_insert != SQLITE_ABORT )
    {
-    // setting INTERIOR RING points
-    x = xx[i];
-    y = yy[i];
-    if (rng->DimensionModel == GAIA_XY_Z || rng->DimensionModel == GAIA_XY_Z_M)
-     z = zz[i];
-    else
-     z = 0.0;
-    if (rng->DimensionModel == GAIA_XY_M || rng->DimensionModel == GAIA_XY_Z_M)
-     m = mm[i];
-    else
-     m = 0.0;
-    if (dst_rng->DimensionModel == GAIA_XY_Z)
-    {
-     gaiaSetPointXYZ(dst_rng->Coords, i, x, y, z);
-    }
-    else if (dst_rng->DimensionModel == GAIA_XY_M)
-    {
-     gaiaSetPointXYM(dst_rng->Coords, i, x, y, m);
-    }
-    else if (dst_rng->DimensionModel == GAIA_XY_Z_M)
+    // if this is a list of .xyz files that are being added,
+    // result_file_type will be 1, but not SQLITE_ABORT
+    // - since all entries must be read
+    if (result_file_type != 1)
     {
-     gaiaSetPointXYZM(dst_rng->Coords, i, x, y, z, m);
+     break; // unknown format
     }
-    else
+   }
+  } // End while
+  fclose(xyz_file);
+  if (directory_from_filename)
+  {
+   free(directory_from_filename);
+   directory_from_filename=NULL;
+  }
+ } // Checking for a file
+ else
+ {
+#if defined(_WIN32)
+  /* Visual Studio .NET */
+  struct _finddata_t c_file;
+  intptr_t hFile;
+  char *name;
+  int len;
+  int ret;
+  if (_chdir (xyz_filename) < 0)
+   return ret;
+  if ((hFile = _findfirst ("*.xyz", &c_file)) == -1L)
+   ;
+  else
+  {
+   while (1)
+   {// A directory with .xyz files
+    if ((c_file.attrib & _A_RDONLY) == _A_RDONLY  || (c_file.attrib & _A_NORMAL) == _A_NORMAL)
     {
-     gaiaSetPoint(dst_rng->Coords, i, x, y);
+     sql_statement = sqlite3_mprintf("%s/%s", xyz_filename,c_file.name);
+     if (collect_xyz_files(db_handle,sql_statement, count_xyz_files, 0) == 1)
+     {//file_name has been added to db_memory.xyz_files
+     }
+     sqlite3_free(sql_statement);
     }
+    if (_findnext (hFile, &c_file) != 0)
+     break;
    }
-   free(xx);
-   free(yy);
-   xx = NULL;
-   yy = NULL;
-   if (xx_dem)
-   {
-    free(xx_dem);
-    xx_dem = NULL;
-    free(yy_dem);
-    yy_dem = NULL;
-   }
-   free(zz);
-   zz = NULL;
-   if (rng->DimensionModel == GAIA_XY_M || rng->DimensionModel == GAIA_XY_Z_M)
-   {
-    free(mm);
-    mm = NULL;
-   }
-   if (error)
-    goto stop;
+   _findclose (hFile);
   }
-// -- -- ---------------------------------- --
-// MultiPolygons, next
-// -- -- ---------------------------------- --
-  pg = pg->Next;
-  if (dem_geom)
+#else
+  DIR *xyz_dir = opendir(xyz_filename);
+  struct dirent *dir;
+  if (xyz_dir)
   {
-   pg_dem = pg_dem->Next;
-  }
+   while ((dir = readdir(xyz_dir)) != NULL)
+   {
+    if (dir->d_type == DT_REG)
+    {
+     const char *ext = strrchr(dir->d_name,'.');
+     if ((ext) || (ext != dir->d_name))
+     {
+      if (strcmp(ext, ".xyz") == 0)
+      {// A directory with .xyz files
+       // - order is not important, will be sorted by point_y ASC, point_x ASC of the first record
+       sql_statement = sqlite3_mprintf("%s/%s", xyz_filename,dir->d_name);
+       // the first record will be read. If 3 doubles, seperated by a space, can be created
+       // 1 : will be returned, after adding the path/file-name, point_x and point_y to db_memory.xyz_files
+       result_file_type=collect_xyz_files(db_handle,sql_statement, count_xyz_files, 0);
+       if (result_file_type == 1)
+       {//file_name has been added to db_memory.xyz_files
+       }
+       sqlite3_free(sql_statement);
+      }
+     }
+    }
+   }
+   closedir(xyz_dir);
+  } // Checking for a directory
+#endif
  }
 // -- -- ---------------------------------- --
-// -end- Geometry types
-// -- -- ---------------------------------- --
-stop:
- if ((count_z+count_m) == 0)
- {// Do not force an update if everything is 0 or has not otherwise changed
-  error=1;
+ if (*count_xyz_files > 0)
+ {
+  ret=1; // xyz-format
  }
- if (error)
+ else
  {
-  // some error occurred, or no changes needed
-  gaiaPointPtr pP;
-  gaiaPointPtr pPn;
-  gaiaLinestringPtr pL;
-  gaiaLinestringPtr pLn;
-  gaiaPolygonPtr pA;
-  gaiaPolygonPtr pAn;
-  pP = dst->FirstPoint;
-  while (pP != NULL)
-  {
-   pPn = pP->Next;
-   gaiaFreePoint(pP);
-   pP = pPn;
-  }
-  pL = dst->FirstLinestring;
-  while (pL != NULL)
-  {
-   pLn = pL->Next;
-   gaiaFreeLinestring(pL);
-   pL = pLn;
-  }
-  pA = dst->FirstPolygon;
-  while (pA != NULL)
+  ret=0; // not supported
+  if (verbose)
   {
-   pAn = pA->Next;
-   gaiaFreePolygon(pA);
-   pA = pAn;
+   fprintf(stderr,"-E-> collect_xyz_files: import.xyz file format not found [%s]\n", xyz_filename);
   }
-  dst->FirstPoint = NULL;
-  dst->LastPoint = NULL;
-  dst->FirstLinestring = NULL;
-  dst->LastLinestring = NULL;
-  dst->FirstPolygon = NULL;
-  dst->LastPolygon = NULL;
-  gaiaFreeGeomColl(dst);
-  dst = NULL;
-  // -- -- ---------------------------------- --
-  // if the source geometry is out of range of the dem area, NULL is returned
-  // -- -- ---------------------------------- --
-  return NULL;
- }
- if (dst)
- {
-  gaiaMbrGeometry(dst);
-  dst->DeclaredType = source_geom->DeclaredType;
  }
- return dst;
+// -- -- ---------------------------------- -
+ return ret;
 }
 // -- -- ---------------------------------- --
-// if the source geometry is out of range of the dem area, NULL is returned
-// - no update should be done and is not an error
-// if the source geometry cannot be updated, when changed
-// - this is an error and the loop should stop
-// The source must be a SpatialTable,
-// - since ROWID is used for a (possibly) needed update
+// Fast parsing of a double value
+// - the digits are collected as an integer mantissa:
+//   with at most 15 digits and a decimal exponent within
+//   +/-22 both are exact, as is the final multiplication
+//   or division (i.e. the same value as strtod)
+// - anything else is delegated to strtod
+// - returns the position after the value,
+//   NULL if the field is not a valid double
 // -- -- ---------------------------------- --
+static const double xyz_powers_of_ten[] =
+{
+ 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+ 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 static int
-retrieve_geometries(sqlite3 *db_handle, struct config_dem *source_config, struct config_dem *dem_config, int *count_total_geometries, int *count_changed_geometries,
-                    int *count_points_total, int *count_z_total, int *count_m_total, int verbose)
+is_xyz_separator(char c)
 {
- char *sql_statement = NULL;
- sqlite3_stmt *stmt = NULL;
- sqlite3_stmt *stmt_update = NULL;
- char *sql_err = NULL;
- unsigned char *blob_value = NULL;
- int blob_bytes=0;
- unsigned char *blob_update = NULL;
- int blob_bytes_update=0;
- int id_rowid=0;
- int ret=0;
- int ret_update=SQLITE_ABORT;
- unsigned int i_sleep=1; // 1 second
- int count_geometries_remainder=100;
- int transaction_update_changed_last=0;
- int transaction_count_loops=0;
- double remainder_calc=0.10;
- gaiaGeomCollPtr source_geom = NULL;
- gaiaGeomCollPtr geom_dem = NULL;
- gaiaGeomCollPtr geom_result = NULL;
- *count_total_geometries=0;
- *count_changed_geometries=0;
- *count_points_total=0;
- *count_z_total=0;
- *count_m_total=0;
-// -- -- ---------------------------------- --
- count_geometries_remainder=source_config->dem_rows_count/100;
- if (count_geometries_remainder > 1000)
- {// Display results every 1.25% of total geometries, when verbose
-  remainder_calc=remainder_calc/8;
- } else if (source_config->dem_rows_count > 500)
- {// Display results every 2.5% of total geometries, when verbose
-  remainder_calc=remainder_calc/4;
- } else if (source_config->dem_rows_count > 100)
- {// Display results every 5% of total geometries, when verbose
-  remainder_calc=remainder_calc/2;
- } // else: Display results every 10% of total geometries, when verbose
- count_geometries_remainder=(int)(source_config->dem_rows_count*remainder_calc);
-// -- -- ---------------------------------- --
- if (verbose)
- {
-  fprintf(stderr, "-I-> retrieve_geometries: results will be shown after each group of %d geometries, total[%u] \n",count_geometries_remainder,source_config->dem_rows_count);
- }
- if (dem_config->default_srid == dem_config->dem_srid)
- {
-  sql_statement = sqlite3_mprintf("SELECT ROWID, \"%s\" FROM '%s'.'%s' WHERE \"%s\" IS NOT NULL",
-                                  source_config->dem_geometry, source_config->schema,source_config->dem_table, source_config->dem_geometry);
- }
- else
+ return ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n'));
+}
+static const char *
+parse_xyz_double(const char *ptr, const char *end, double *value)
+{
+ const char *start = ptr;
+ sqlite3_uint64 mantissa=0;
+ int count_digits=0;
+ int exponent=0;
+ int exponent_value=0;
+ int is_negative=0;
+ int is_exponent_negative=0;
+ int has_digits=0;
+ char token[64];
+ char *ptr_strtod = NULL;
+ if ((ptr < end) && ((*ptr == '-') || (*ptr == '+')))
  {
-  sql_statement = sqlite3_mprintf("SELECT ROWID, \"%s\", ST_Transform(\"%s\",%d) FROM '%s'.'%s' WHERE \"%s\"  IS NOT NULL",
-                                  source_config->dem_geometry,source_config->dem_geometry, dem_config->dem_srid, source_config->schema,source_config->dem_table,source_config->dem_geometry);
+  is_negative = (*ptr == '-');
+  ptr++;
  }
-#if 0
- if (verbose)
+ while ((ptr < end) && (*ptr >= '0') && (*ptr <= '9'))
  {
-  fprintf(stderr, "-I-> retrieve_geometries: sql[%s] \n",sql_statement);
+  if ((mantissa > 0) || (*ptr != '0'))
+  {
+   mantissa = (mantissa * 10) + (*ptr - '0');
+   count_digits++;
+  }
+  has_digits = 1;
+  ptr++;
  }
-#endif
- ret = sqlite3_prepare_v2(db_handle, sql_statement, -1, &stmt, NULL );
- if ( ret == SQLITE_OK )
+ if ((ptr < end) && (*ptr == '.'))
  {
-  sqlite3_free(sql_statement);
-  while ( sqlite3_step( stmt ) == SQLITE_ROW )
+  ptr++;
+  while ((ptr < end) && (*ptr >= '0') && (*ptr <= '9'))
   {
-   if (( sqlite3_column_type( stmt, 0 ) != SQLITE_NULL ) &&
-       ( sqlite3_column_type( stmt, 1 ) != SQLITE_NULL ) )
-   {
-    id_rowid = sqlite3_column_int (stmt, 0);
-    dem_config->id_rowid=id_rowid; // for debugging
-    blob_value = (unsigned char *)sqlite3_column_blob(stmt, 1);
-    blob_bytes = sqlite3_column_bytes(stmt,1);
-    source_geom = gaiaFromSpatiaLiteBlobWkb(blob_value, blob_bytes);
-    *count_total_geometries+=1;
-   }
-   if ( sqlite3_column_type( stmt, 2 ) != SQLITE_NULL )
+   if ((mantissa > 0) || (*ptr != '0'))
    {
-    blob_value = (unsigned char *)sqlite3_column_blob(stmt, 2);
-    blob_bytes = sqlite3_column_bytes(stmt,2);
-    geom_dem = gaiaFromSpatiaLiteBlobWkb(blob_value, blob_bytes);
-   }
-   if (source_geom)
-   {
-    // if the source geometry is out of range of the dem area, NULL is returned: this is not an error, but no update
-    geom_result=getDemCollect(db_handle, source_geom, geom_dem, dem_config, count_points_total,count_z_total,count_m_total,verbose);
-    gaiaFreeGeomColl(source_geom);
-    source_geom = NULL;
-    if (geom_dem)
-    {
-     gaiaFreeGeomColl(geom_dem);
-     geom_dem = NULL;
-    }
-    ret_update=SQLITE_OK;
-    if (geom_result)
-    {
-     sql_statement = sqlite3_mprintf("UPDATE '%s'.'%s' SET '%s'=? WHERE ROWID=%d",
-                                     source_config->schema,source_config->dem_table,source_config->dem_geometry,id_rowid);
-     ret=sqlite3_prepare_v2(db_handle, sql_statement, -1, &stmt_update, NULL);
-     if ( ret == SQLITE_OK)
-     {
-      sqlite3_free(sql_statement);
-      gaiaToSpatiaLiteBlobWkb(geom_result, &blob_update, &blob_bytes_update);
-      // Note: sqlite3_bind_* index is 1-based, os apposed to sqlite3_column_* that is 0-based.
-      sqlite3_bind_blob(stmt_update, 1, blob_update, blob_bytes_update, free);
-      ret_update = sqlite3_step( stmt_update );
-      if ( ret_update == SQLITE_DONE || ret_update == SQLITE_ROW )
-      {
-       ret_update=SQLITE_OK;
-       *count_changed_geometries += 1;
-      }
-      else
-      {
-       ret_update=SQLITE_ABORT;
-      }
-      sqlite3_finalize( stmt_update );
-     }
-     else
-     {
-      if (verbose)
-      {
-       fprintf(stderr, "-W-> retrieve_geometries [UPDATE]: rc=%d sql[%s]\n",ret,sql_statement);
-      }
-      sqlite3_free(sql_statement);
-     }
-    }
-    gaiaFreeGeomColl(geom_result);
-    geom_result = NULL;
-    if (((*count_total_geometries % count_geometries_remainder) == 0))
-    {
-     if (*count_changed_geometries > transaction_update_changed_last)
-     {// Store results only if something has changed
-      // Note: while testing, this process stopped, with no further updates being reported.
-      // The assumption was that there was a logical error else where, which was not the case.
-      // This saving was build in to get to this point and analyse. [cause: missing Next for Linestrings/Polygon for dem_geom]
-      // Since the logic exists, that UPDATEs are only done after changes have been made
-      // This sporadic COMMIT/BEGIN has been retained. What is done is done.
-      if (sqlite3_exec(db_handle, "COMMIT", NULL, NULL, &sql_err) == SQLITE_OK)
-      {
-       sleep(i_sleep);
-       if (sqlite3_exec(db_handle, "BEGIN", NULL, NULL, &sql_err) == SQLITE_OK)
-       {
-       }
-      }
-      if (sql_err)
-      {
-       sqlite3_free(sql_err);
-      }
-     }
-     if (verbose)
-     {
-      double procent_diff=(double)(*count_total_geometries)/source_config->dem_rows_count;
-      remainder_calc=procent_diff*100;
-      if (transaction_count_loops == 0)
-      {// Show only once
-       fprintf(stderr,"-I-> converted geometries committed to Database: \n");
-      }
-      transaction_count_loops++;
-      if (dem_config->has_m)
-      {// overwrite the previous message [\r]
-       fprintf(stderr, "\r %02.2f%% total read[%d] changed[%d] ; points total[%d] changed z[%d] changed m[%d] ",remainder_calc,*count_total_geometries,*count_changed_geometries,*count_points_total,*count_z_total,*count_m_total);
-      }
-      else
-      {// overwrite the previous message [\r]
-       fprintf(stderr, "\r %02.2f%% total read[%d] changed[%d] ; points total[%d] changed z[%d] ",remainder_calc,*count_total_geometries,*count_changed_geometries,*count_points_total,*count_z_total);
-      }
-     }
-     transaction_update_changed_last=*count_changed_geometries;
-    }
+    mantissa = (mantissa * 10) + (*ptr - '0');
+    count_digits++;
    }
-   if (ret_update == SQLITE_ABORT )
+   exponent--;
+   has_digits = 1;
+   ptr++;
+  }
+ }
+ if ((has_digits) && (ptr < end) && ((*ptr == 'e') || (*ptr == 'E')))
+ {
+  ptr++;
+  if ((ptr < end) && ((*ptr == '-') || (*ptr == '+')))
+  {
+   is_exponent_negative = (*ptr == '-');
+   ptr++;
+  }
+  if ((ptr >= end) || (*ptr < '0') || (*ptr > '9'))
+  {
+   has_digits = 0;
+  }
+  while ((ptr < end) && (*ptr >= '0') && (*ptr <= '9'))
+  {
+   if (exponent_value < 10000)
    {
-    break;
+    exponent_value = (exponent_value * 10) + (*ptr - '0');
    }
+   ptr++;
   }
-  sqlite3_finalize( stmt );
-  if (verbose)
-  {// new line after last message [\n]
-   fprintf(stderr, "\n");
+  exponent += (is_exponent_negative) ? -exponent_value : exponent_value;
+ }
+ if ((has_digits) && (count_digits <= 15) && (exponent >= -22) && (exponent <= 22) &&
+     ((ptr == end) || (is_xyz_separator(*ptr))))
+ {// fast path
+  *value = (double)mantissa;
+  if (exponent < 0)
+  {
+   *value /= xyz_powers_of_ten[-exponent];
+  }
+  else
+  {
+   *value *= xyz_powers_of_ten[exponent];
+  }
+  if (is_negative)
+  {
+   *value = -*value;
   }
+  return ptr;
+ }
+// -- -- ---------------------------------- --
+// slow path: strtod on a copy of the field
+// -- -- ---------------------------------- --
+ ptr = start;
+ while ((ptr < end) && (!is_xyz_separator(*ptr)))
+ {
+  ptr++;
+ }
+ if (((ptr - start) == 0) || ((ptr - start) >= (int)sizeof(token)))
+ {
+  return NULL;
+ }
+ memcpy(token, start, ptr - start);
+ token[ptr - start] = '\0';
+ *value = strtod(token, &ptr_strtod);
+ if (*ptr_strtod != '\0')
+ {
+  return NULL;
+ }
+ return ptr;
+}
+// -- -- ---------------------------------- --
+// Parsing a line of a xyz-file
+// - the first 3 fields must be valid doubles, any
+//   further field is ignored
+// - returns 1 when valid, 0 when invalid,
+//   -1 for an empty line
+// - ptr is moved to the start of the next line
+// -- -- ---------------------------------- --
+static int
+parse_xyz_line(const char **ptr, const char *end, double *xyz)
+{
+ const char *line = *ptr;
+ const char *line_end = memchr(line, '\n', end - line);
+ int i_count_fields=0;
+ if (line_end == NULL)
+ {
+  line_end = end;
+  *ptr = end;
  }
  else
  {
-  if (verbose)
+  *ptr = line_end + 1;
+ }
+ while (i_count_fields < 3)
+ {
+  while ((line < line_end) && ((*line == ' ') || (*line == '\t') || (*line == '\r')))
   {
-   fprintf(stderr, "-W-> retrieve_geometries [SELECT]: rc=%d sql[%s]\n",ret,sql_statement);
+   line++;
   }
-  sqlite3_free(sql_statement);
+  if (line >= line_end)
+  {
+   break;
+  }
+  line = parse_xyz_double(line, line_end, &xyz[i_count_fields]);
+  if (line == NULL)
+  {
+   return 0;
+  }
+  i_count_fields++;
  }
- if (ret_update == SQLITE_ABORT )
+ if (i_count_fields == 0)
  {
-  return 0;
+  return -1;
  }
- return 1;
+ return (i_count_fields == 3);
 }
 // -- -- ---------------------------------- --
-// Retrieve information about given
-// - table and geometry-column
-// -> for Source and Dem geometries
-// Dem
-// - must be a POINTZ or POINTZM
-// - SpatialIndex must exist
-// -  Extent and row_count
-// -> to calculate resolution
-// Source
-// - must have a Z or ZM Dimension
-// Both
-// -  Srid of geometries
+// Mapping a whole xyz-file into memory
+// - mmap where available, otherwise read
+// -- -- ---------------------------------- --
+static const char *
+map_xyz_file(const char *xyz_path_filename, size_t *xyz_size)
+{
+#ifndef _WIN32
+ struct stat xyz_stat;
+ void *xyz_map = NULL;
+ int xyz_fd = open(xyz_path_filename, O_RDONLY);
+ if (xyz_fd < 0)
+ {
+  return NULL;
+ }
+ if (fstat(xyz_fd, &xyz_stat) != 0)
+ {
+  close(xyz_fd);
+  return NULL;
+ }
+ *xyz_size = xyz_stat.st_size;
+ if (*xyz_size == 0)
+ {// nothing to map
+  close(xyz_fd);
+  return "";
+ }
+ xyz_map = mmap(NULL, *xyz_size, PROT_READ, MAP_PRIVATE, xyz_fd, 0);
+ close(xyz_fd);
+ if (xyz_map == MAP_FAILED)
+ {
+  return NULL;
+ }
+ madvise(xyz_map, *xyz_size, MADV_SEQUENTIAL);
+ return (const char *)xyz_map;
+#else
+ char *xyz_buffer = NULL;
+ long xyz_length = 0;
+ FILE *xyz_file = fopen(xyz_path_filename, "rb");
+ if (xyz_file == NULL)
+ {
+  return NULL;
+ }
+ fseek(xyz_file, 0, SEEK_END);
+ xyz_length = ftell(xyz_file);
+ fseek(xyz_file, 0, SEEK_SET);
+ *xyz_size = 0;
+ if (xyz_length <= 0)
+ {// nothing to read
+  fclose(xyz_file);
+  return "";
+ }
+ xyz_buffer = malloc(xyz_length);
+ if ((xyz_buffer) && (fread(xyz_buffer, 1, xyz_length, xyz_file) != (size_t)xyz_length))
+ {
+  free(xyz_buffer);
+  xyz_buffer = NULL;
+ }
+ fclose(xyz_file);
+ *xyz_size = xyz_length;
+ return xyz_buffer;
+#endif /* not WIN32 */
+}
+static void
+unmap_xyz_file(const char *xyz_map, size_t xyz_size)
+{
+ if (xyz_size == 0)
+ {// an empty file
+  return;
+ }
+#ifndef _WIN32
+ munmap((void *)xyz_map, xyz_size);
+#else
+ free((void *)xyz_map);
+#endif /* not WIN32 */
+}
 // -- -- ---------------------------------- --
+// Dem-Raster [-create_dem -raster]
+// - the xyz-files are read twice:
+// -> first pass: extent and smallest x/y step between
+//    neighbouring points, giving the grid layout
+// -> second pass: each point is stored in the cell of
+//    its tile, the tiles being written to the Dem-Store
+//    when complete (or when the memory budget is used)
+// - a point not placed on the grid aborts the second pass,
+//   the Dem will then be imported as POINT rows
+// -- -- ---------------------------------- --
+struct dem_raster
+{
+ sqlite3 *db_handle;
+ struct config_dem *dem_config;
+ int is_scanning; // first pass
+ unsigned int count_points;
+ double minx;
+ double miny;
+ double maxx;
+ double maxy;
+ double last_x;
+ double last_y;
+ struct dem_grid grid; // the layout only
+ int tiles_x;
+ int tiles_y;
+ sqlite3_stmt *stmt_select;
+ sqlite3_stmt *stmt_insert;
+ sqlite3_int64 bytes_max;
+ sqlite3_int64 bytes_used;
+ struct dem_tile *first; // most recently used
+ struct dem_tile *last; // least recently used
+ struct dem_tile *current;
+ struct dem_tile **hash;
+ int hash_size;
+ unsigned int count_cells; // cells with data
+ int count_tiles;
+ int is_off_grid;
+ int verbose;
+};
 static int
-check_geometry_dimension(sqlite3 *db_handle, struct config_dem *use_config, int *geometry_type, int verbose)
+get_dem_raster_key(struct dem_raster *raster, int tile_x, int tile_y)
+{
+ return (int)((((sqlite3_uint64)tile_y * raster->tiles_x) + tile_x) & (raster->hash_size - 1));
+}
+static int
+get_dem_raster_cells(struct dem_raster *raster, struct dem_tile *tile)
+{// cells of the tile inside the grid
+ int columns=raster->grid.columns - (tile->tile_x * DEM_TILE_SIZE);
+ int rows=raster->grid.rows - (tile->tile_y * DEM_TILE_SIZE);
+ if (columns > DEM_TILE_SIZE)
+ {
+  columns = DEM_TILE_SIZE;
+ }
+ if (rows > DEM_TILE_SIZE)
+ {
+  rows = DEM_TILE_SIZE;
+ }
+ return columns * rows;
+}
+static int
+write_dem_raster_tile(struct dem_raster *raster, struct dem_tile *tile)
 {
- /* checking the table, geometry exists and if the geometry supports z-values */
  int ret=0;
- char *sql_statement = NULL;
- sqlite3_stmt *stmt = NULL;
- int *srid_default = NULL;
- use_config->has_z = 0;
- use_config->has_m = 0;
- use_config->dem_extent_minx=0.0;
- use_config->dem_extent_miny=0.0;
- use_config->dem_extent_maxx=0.0;
- use_config->dem_extent_maxy=0.0;
- use_config->has_spatial_index=0;
- use_config->is_spatial_table=0;
- if (use_config->config_type == CONF_TYPE_DEM )
+ int blob_bytes=0;
+ unsigned char *blob = compress_dem_tile(tile->zz, &blob_bytes);
+ sqlite3_reset(raster->stmt_insert);
+ sqlite3_clear_bindings(raster->stmt_insert);
+ sqlite3_bind_int(raster->stmt_insert, 1, tile->tile_x);
+ sqlite3_bind_int(raster->stmt_insert, 2, tile->tile_y);
+ sqlite3_bind_blob(raster->stmt_insert, 3, blob, blob_bytes, free);
+ ret = sqlite3_step(raster->stmt_insert);
+ if ((ret != SQLITE_DONE) && (ret != SQLITE_ROW))
  {
-  srid_default = &use_config->dem_srid;
+  if (raster->verbose)
+  {
+   fprintf(stderr, "-W-> write_dem_raster_tile: INSERT error: %s\n", sqlite3_errmsg(raster->db_handle));
+  }
+  return 0;
+ }
+ raster->count_tiles++;
+ if (raster->dem_config->profile)
+ {
+  raster->dem_config->profile->rows_written++;
+ }
+ return 1;
+}
+static int
+remove_dem_raster_tile(struct dem_raster *raster, struct dem_tile *tile)
+{// writing the tile, then removing it from memory
+ int ret=0;
+ struct dem_tile **tile_hash = &(raster->hash[get_dem_raster_key(raster, tile->tile_x, tile->tile_y)]);
+ ret = write_dem_raster_tile(raster, tile);
+ while (*tile_hash != tile)
+ {
+  tile_hash = &((*tile_hash)->hash_next);
+ }
+ *tile_hash = tile->hash_next;
+ if (tile->prev)
+ {
+  tile->prev->next = tile->next;
  }
  else
  {
-  srid_default = &use_config->default_srid;
+  raster->first = tile->next;
  }
- *geometry_type = 0;
- *srid_default = 0;
-// 390718.000000	5818887.000000	392757.000000	5820847.000000
-// 392757-390718=2039
-// 5820847-5818887=1960
-// 1960*2039=3996440/4000440=0.99900011 resolution
- sql_statement = sqlite3_mprintf("SELECT a.geometry_type, a.srid, a.spatial_index_enabled, a.layer_type, "
-                                 "b.extent_min_x, b.extent_min_y, b.extent_max_x, b.extent_max_y, b.row_count "
-                                 "FROM '%s'.vector_layers AS a LEFT JOIN '%s'.vector_layers_statistics AS b "
-                                 "ON a.table_name=b.table_name  AND a.geometry_column=b.geometry_column "
-                                 "WHERE a.table_name='%s' AND a.geometry_column='%s'", use_config->schema, use_config->schema,
-                                 use_config->dem_table, use_config->dem_geometry);
- ret = sqlite3_prepare_v2(db_handle, sql_statement, -1, &stmt, NULL );
- if ( ret == SQLITE_OK )
+ if (tile->next)
  {
-  sqlite3_free(sql_statement);
-  while ( sqlite3_step( stmt ) == SQLITE_ROW )
+  tile->next->prev = tile->prev;
+ }
+ else
+ {
+  raster->last = tile->prev;
+ }
+ if (raster->current == tile)
+ {
+  raster->current = NULL;
+ }
+ raster->bytes_used -= tile->bytes;
+ free_dem_tile(tile);
+ return ret;
+}
+static struct dem_tile *
+get_dem_raster_tile(struct dem_raster *raster, int tile_x, int tile_y)
+{
+ int i=0;
+ int key=get_dem_raster_key(raster, tile_x, tile_y);
+ int tile_bytes=sizeof (float) * DEM_TILE_SIZE * DEM_TILE_SIZE;
+ struct dem_tile *tile = NULL;
+ if ((raster->current) && (raster->current->tile_x == tile_x) && (raster->current->tile_y == tile_y))
+ {
+  return raster->current;
+ }
+ tile = raster->hash[key];
+ while ((tile) && ((tile->tile_x != tile_x) || (tile->tile_y != tile_y)))
+ {
+  tile = tile->hash_next;
+ }
+ if (tile)
+ {// moving to the top of the LRU list
+  if (tile->prev)
   {
-   if (( sqlite3_column_type( stmt, 0 ) != SQLITE_NULL ) &&
-       ( sqlite3_column_type( stmt, 1 ) != SQLITE_NULL ) &&
-       ( sqlite3_column_type( stmt, 2 ) != SQLITE_NULL ) &&
-       ( sqlite3_column_type( stmt, 3 ) != SQLITE_NULL ))
+   tile->prev->next = tile->next;
+   if (tile->next)
    {
-    *geometry_type = sqlite3_column_int( stmt, 0 );
-    *srid_default = sqlite3_column_int( stmt, 1 );
-    use_config->has_spatial_index = sqlite3_column_int( stmt, 2 );
-    if (strcmp((const char *)sqlite3_column_text( stmt, 3 ),"SpatialTable") == 0)
+    tile->next->prev = tile->prev;
+   }
+   else
+   {
+    raster->last = tile->prev;
+   }
+   tile->prev = NULL;
+   tile->next = raster->first;
+   raster->first->prev = tile;
+   raster->first = tile;
+  }
+  raster->current = tile;
+  return tile;
+ }
+ while ((raster->last) && (raster->bytes_used + tile_bytes > raster->bytes_max))
+ {// writing the least recently used (incomplete) tiles
+  if (!remove_dem_raster_tile(raster, raster->last))
+  {
+   return NULL;
+  }
+ }
+ tile = malloc(sizeof (struct dem_tile));
+ tile->tile_x = tile_x;
+ tile->tile_y = tile_y;
+ tile->zz = malloc(tile_bytes);
+ tile->mm = NULL;
+ tile->bytes = sizeof (struct dem_tile) + tile_bytes;
+ tile->count_cells = 0;
+ for (i=0; i<(DEM_TILE_SIZE * DEM_TILE_SIZE); i++)
+ {
+  tile->zz[i] = DEM_GRID_NODATA;
+ }
+ // a tile written before, when the memory budget was used
+ sqlite3_reset(raster->stmt_select);
+ sqlite3_clear_bindings(raster->stmt_select);
+ sqlite3_bind_int(raster->stmt_select, 1, tile_x);
+ sqlite3_bind_int(raster->stmt_select, 2, tile_y);
+ while ( sqlite3_step( raster->stmt_select ) == SQLITE_ROW )
+ {
+  if (uncompress_dem_tile(sqlite3_column_blob(raster->stmt_select, 0), sqlite3_column_bytes(raster->stmt_select, 0), tile->zz))
+  {
+   for (i=0; i<(DEM_TILE_SIZE * DEM_TILE_SIZE); i++)
+   {
+    if (tile->zz[i] != DEM_GRID_NODATA)
     {
-     // The source Database must be in a SpatialTable to be updated [no checking for writable SpatialView's]
-     // will be using ROWID to UPDATE
-     use_config->is_spatial_table = 1;
+     tile->count_cells++;
     }
-    // printf("-I-> check_geometry_dimension: coord_dimension=%d GAIA_XY_*l[%d,%d,%d]\n",coord_dimension,GAIA_XY_Z,GAIA_XY_Z_M,GAIA_XY_M);
-    switch (*geometry_type)
+   }
+  }
+ }
+ sqlite3_reset(raster->stmt_select);
+ raster->bytes_used += tile->bytes;
+ tile->hash_next = raster->hash[key];
+ raster->hash[key] = tile;
+ tile->prev = NULL;
+ tile->next = raster->first;
+ if (raster->first)
+ {
+  raster->first->prev = tile;
+ }
+ raster->first = tile;
+ if (raster->last == NULL)
+ {
+  raster->last = tile;
+ }
+ raster->current = tile;
+ return tile;
+}
+// -- -- ---------------------------------- --
+// Adding a block of xyz points [x,y,z interleaved]
+// - first pass: extent and steps only
+// - returns 0 if a point is not on the grid
+// -- -- ---------------------------------- --
+static int
+write_dem_raster_points(struct dem_raster *raster, const double *xyz, int count_points)
+{
+ int i=0;
+ double x=0.0;
+ double y=0.0;
+ double col_x=0.0;
+ double row_y=0.0;
+ int column=0;
+ int row=0;
+ float *cell = NULL;
+ struct dem_tile *tile = NULL;
+ for (i=0; i<count_points; i++)
+ {
+  x = xyz[i*3];
+  y = xyz[(i*3)+1];
+  if (raster->is_scanning)
+  {
+   if (raster->count_points == 0)
+   {
+    raster->minx = x;
+    raster->maxx = x;
+    raster->miny = y;
+    raster->maxy = y;
+   }
+   else
+   {
+    if (x < raster->minx)
     {
-     case GAIA_POINTZ:
-     case GAIA_LINESTRINGZ:
-     case GAIA_POLYGONZ:
-     case GAIA_MULTIPOINTZ:
-     case GAIA_MULTILINESTRINGZ:
-     case GAIA_MULTIPOLYGONZ:
-     case GAIA_GEOMETRYCOLLECTIONZ:
-      use_config->has_z = 1;
-      break;
+     raster->minx = x;
     }
-    switch (*geometry_type)
+    if (x > raster->maxx)
     {
-     case GAIA_POINTZM:
-     case GAIA_LINESTRINGZM:
-     case GAIA_POLYGONZM:
-     case GAIA_MULTIPOINTZM:
-     case GAIA_MULTILINESTRINGZM:
-     case GAIA_MULTIPOLYGONZM:
-     case GAIA_GEOMETRYCOLLECTIONZM:
-      use_config->has_z = 1;
-      use_config->has_m = 1;
-      break;
+     raster->maxx = x;
     }
-    switch (*geometry_type)
+    if (y < raster->miny)
     {
-     case GAIA_POINTM:
-     case GAIA_LINESTRINGM:
-     case GAIA_POLYGONM:
-     case GAIA_MULTIPOINTM:
-     case GAIA_MULTILINESTRINGM:
-     case GAIA_MULTIPOLYGONM:
-     case GAIA_GEOMETRYCOLLECTIONM:
-      use_config->has_m = 1;
-      break;
+     raster->miny = y;
+    }
+    if (y > raster->maxy)
+    {
+     raster->maxy = y;
+    }
+    // the smallest distance to the previous point is the step
+    if ((x != raster->last_x) && ((raster->grid.step_x == 0.0) || (fabs(x - raster->last_x) < raster->grid.step_x)))
+    {
+     raster->grid.step_x = fabs(x - raster->last_x);
+    }
+    if ((y != raster->last_y) && ((raster->grid.step_y == 0.0) || (fabs(y - raster->last_y) < raster->grid.step_y)))
+    {
+     raster->grid.step_y = fabs(y - raster->last_y);
     }
    }
-   if (( sqlite3_column_type( stmt, 4 ) != SQLITE_NULL ) &&
-       ( sqlite3_column_type( stmt, 5 ) != SQLITE_NULL ) &&
-       ( sqlite3_column_type( stmt, 6 ) != SQLITE_NULL ) &&
-       ( sqlite3_column_type( stmt, 7 ) != SQLITE_NULL ) &&
-       ( sqlite3_column_type( stmt, 8 ) != SQLITE_NULL ))
+   raster->last_x = x;
+   raster->last_y = y;
+   raster->count_points++;
+   continue;
+  }
+  col_x = (x - raster->grid.origin_x) / raster->grid.step_x;
+  row_y = (y - raster->grid.origin_y) / raster->grid.step_y;
+  column = (int)floor(col_x + 0.5);
+  row = (int)floor(row_y + 0.5);
+  if ((fabs(col_x - column) > 0.25) || (fabs(row_y - row) > 0.25) ||
+      (column < 0) || (column >= raster->grid.columns) || (row < 0) || (row >= raster->grid.rows))
+  {// not a regular grid
+   raster->is_off_grid = 1;
+   return 0;
+  }
+  tile = get_dem_raster_tile(raster, column / DEM_TILE_SIZE, row / DEM_TILE_SIZE);
+  if (tile == NULL)
+  {
+   return 0;
+  }
+  cell = &(tile->zz[((row % DEM_TILE_SIZE) * DEM_TILE_SIZE) + (column % DEM_TILE_SIZE)]);
+  if (*cell == DEM_GRID_NODATA)
+  {
+   tile->count_cells++;
+   raster->count_cells++;
+  }
+  *cell = (float)xyz[(i*3)+2];
+  raster->count_points++;
+  if (tile->count_cells == get_dem_raster_cells(raster, tile))
+  {// complete
+   if (!remove_dem_raster_tile(raster, tile))
    {
-    use_config->dem_extent_minx = sqlite3_column_double( stmt, 4 );
-    use_config->dem_extent_miny = sqlite3_column_double( stmt, 5 );
-    use_config->dem_extent_maxx = sqlite3_column_double( stmt, 6 );
-    use_config->dem_extent_maxy = sqlite3_column_double( stmt, 7 );
-    use_config->dem_rows_count = sqlite3_column_int64( stmt, 8 );
+    return 0;
    }
   }
-  sqlite3_finalize( stmt );
-  if ((use_config->is_spatial_table == 1) && (use_config->has_z) && (use_config->dem_rows_count > 0))
+ }
+ raster->dem_config->dem_rows_count += count_points;
+ return 1;
+}
+// -- -- ---------------------------------- --
+// Setting the grid layout after the first pass
+// - returns 0 if the points cannot be a regular grid
+// -- -- ---------------------------------- --
+static int
+set_dem_raster_layout(struct dem_raster *raster)
+{
+ double columns=0.0;
+ double rows=0.0;
+ if (raster->count_points == 0)
+ {
+  return 0;
+ }
+ if (raster->grid.step_x == 0.0)
+ {// a single column
+  raster->grid.step_x = (raster->grid.step_y > 0.0) ? raster->grid.step_y : raster->dem_config->dem_resolution;
+ }
+ if (raster->grid.step_y == 0.0)
+ {// a single row
+  raster->grid.step_y = raster->grid.step_x;
+ }
+ if (raster->grid.step_x <= 0.0)
+ {
+  return 0;
+ }
+ // the steps as an exact fraction of the extent
+ columns = floor(((raster->maxx - raster->minx) / raster->grid.step_x) + 0.5);
+ rows = floor(((raster->maxy - raster->miny) / raster->grid.step_y) + 0.5);
+ if (columns > 0.0)
+ {
+  raster->grid.step_x = (raster->maxx - raster->minx) / columns;
+ }
+ if (rows > 0.0)
+ {
+  raster->grid.step_y = (raster->maxy - raster->miny) / rows;
+ }
+ columns += 1.0;
+ rows += 1.0;
+ if ((columns > DEM_RASTER_MAX_SIZE) || (rows > DEM_RASTER_MAX_SIZE) ||
+     ((columns * rows) > ((double)raster->count_points * DEM_RASTER_MAX_EMPTY)))
+ {// mostly empty: the points are not a grid
+  return 0;
+ }
+ raster->grid.origin_x = raster->minx;
+ raster->grid.origin_y = raster->miny;
+ raster->grid.columns = (int)columns;
+ raster->grid.rows = (int)rows;
+ raster->tiles_x = (raster->grid.columns + DEM_TILE_SIZE - 1) / DEM_TILE_SIZE;
+ raster->tiles_y = (raster->grid.rows + DEM_TILE_SIZE - 1) / DEM_TILE_SIZE;
+ return 1;
+}
+// -- -- ---------------------------------- --
+// Importing xyz-files
+// - each file is parsed into blocks of DEM_XYZ_BLOCK_POINTS
+// - with -threads, the files are parsed in parallel,
+//   the blocks being inserted by the main thread only,
+//   in the same order as the files (and lines) are listed
+// -- -- ---------------------------------- --
+struct xyz_block
+{
+ double *xyz; // x,y,z interleaved
+ int count_points;
+ struct xyz_block *next;
+};
+struct xyz_file_job
+{
+ char *xyz_path_filename;
+ struct xyz_block *first;
+ struct xyz_block *last;
+ int count_blocks;
+ int line_error; // the invalid line, 0 if none
+ int is_missing;
+ int is_done;
+};
+struct xyz_import
+{
+ sqlite3 *db_handle;
+ struct config_dem *dem_config;
+ sqlite3_stmt *stmt;
+ struct dem_raster *raster; // NULL: one POINT row for each xyz-point
+ struct xyz_file_job *jobs;
+ int count_jobs;
+ int is_stopping;
+ int verbose;
+ int is_parallel; // 0: no threads, the blocks are inserted while parsing
+ int count_workers;
+#ifndef _WIN32
+ pthread_t *workers;
+ int next_job;
+ pthread_mutex_t mutex;
+ pthread_cond_t cond;
+#endif
+};
+static struct xyz_block *
+alloc_xyz_block()
+{
+ struct xyz_block *block = malloc(sizeof (struct xyz_block));
+ block->xyz = malloc(sizeof (double) * 3 * DEM_XYZ_BLOCK_POINTS);
+ block->count_points = 0;
+ block->next = NULL;
+ return block;
+}
+static void
+free_xyz_block(struct xyz_block *block)
+{
+ free(block->xyz);
+ free(block);
+}
+static int
+write_xyz_block(struct xyz_import *import, struct xyz_block *block)
+{
+ int ret=0;
+ struct dem_profile *profile = import->dem_config->profile;
+ int phase=DEM_PHASE_WRITE;
+ if ((import->raster) && (import->raster->is_scanning))
+ {// first pass of the Dem-Raster: nothing is written
+  phase=DEM_PHASE_READ;
+ }
+ phase=dem_profile_switch(profile, phase);
+ if (import->raster)
+ {
+  ret = write_dem_raster_points(import->raster, block->xyz, block->count_points);
+ }
+ else
+ {
+  ret = insert_dem_points(import->db_handle, import->dem_config, import->stmt, block->xyz, block->count_points, import->verbose);
+  if ((ret) && (profile))
   {
-   ret=1; // Valid for usage
+   profile->rows_written += block->count_points;
   }
  }
+ if (profile)
+ {
+  profile->rows_read += block->count_points;
+ }
+ dem_profile_switch(profile, phase);
+ if ((ret) && (import->verbose))
+ {
+  fprintf(stderr,"\r inserted [%u] ... ", import->dem_config->dem_rows_count);
+ }
+ return ret;
+}
+static int
+push_xyz_block(struct xyz_import *import, struct xyz_file_job *job, struct xyz_block *block)
+{
+ int ret=1;
+ if (!import->is_parallel)
+ {// no threads: inserting now
+  ret = write_xyz_block(import, block);
+  free_xyz_block(block);
+  return ret;
+ }
+#ifndef _WIN32
+ pthread_mutex_lock(&(import->mutex));
+ while ((job->count_blocks >= DEM_XYZ_QUEUE_BLOCKS) && (!import->is_stopping))
+ {// waiting for the writer
+  pthread_cond_wait(&(import->cond), &(import->mutex));
+ }
+ if (import->is_stopping)
+ {
+  free_xyz_block(block);
+  ret = 0;
+ }
  else
  {
-  if (verbose)
+  if (job->last)
   {
-   fprintf(stderr, "-W-> check_geometry_dimension: rc=%d sql[%s]\n",ret,sql_statement);
+   job->last->next = block;
   }
-  sqlite3_free(sql_statement);
+  else
+  {
+   job->first = block;
+  }
+  job->last = block;
+  job->count_blocks++;
+  pthread_cond_broadcast(&(import->cond));
  }
+ pthread_mutex_unlock(&(import->mutex));
+#endif /* not WIN32 */
  return ret;
 }
-static void
-spatialite_autocreate(sqlite3 *db_handle)
+static int
+parse_xyz_file(struct xyz_import *import, struct xyz_file_job *job)
 {
- /* attempting to perform self-initialization for a newly created DB */
- int ret;
- char sql[1024];
- char *err_msg = NULL;
- int count;
- int i;
- char **results;
- int rows;
- int columns;
-
- /* checking if this DB is really empty */
- strcpy(sql, "SELECT Count(*) from sqlite_master");
- ret = sqlite3_get_table(db_handle, sql, &results, &rows, &columns, NULL);
- if (ret != SQLITE_OK)
-  return;
- if (rows < 1)
-  ;
- else
+ int ret=1;
+ int ret_line=0;
+ int i_count_lines=0;
+ size_t xyz_size=0;
+ const char *xyz_map = map_xyz_file(job->xyz_path_filename, &xyz_size);
+ const char *ptr = xyz_map;
+ struct xyz_block *block = NULL;
+ if (xyz_map == NULL)
  {
-  for (i = 1; i <= rows; i++)
-   count = atoi (results[(i * columns) + 0]);
+  job->is_missing = 1;
+  return 0;
  }
- sqlite3_free_table(results);
-
- if (count > 0)
-  return;
-
- /* all right, it's empty: proceding to initialize */
- strcpy(sql, "SELECT InitSpatialMetadataFull(1)");
- ret = sqlite3_exec(db_handle, sql, NULL, NULL, &err_msg);
- if (ret != SQLITE_OK)
+ block = alloc_xyz_block();
+ while (ptr < (xyz_map + xyz_size))
  {
-  fprintf(stderr, "InitSpatialMetadataFull() error: %s\n", err_msg);
-  sqlite3_free(err_msg);
-  return;
+  i_count_lines++;
+  ret_line = parse_xyz_line(&ptr, xyz_map + xyz_size, block->xyz + (block->count_points * 3));
+  if (ret_line < 0)
+  {// empty line
+   continue;
+  }
+  if (ret_line == 0)
+  {
+   job->line_error = i_count_lines;
+   ret = 0;
+   break;
+  }
+  block->count_points++;
+  if (block->count_points == DEM_XYZ_BLOCK_POINTS)
+  {
+   if (!push_xyz_block(import, job, block))
+   {
+    block = NULL;
+    ret = 0;
+    break;
+   }
+   block = alloc_xyz_block();
+  }
+ }
+ unmap_xyz_file(xyz_map, xyz_size);
+ if (block)
+ {// the points before an invalid line are imported as well
+  if (block->count_points > 0)
+  {
+   if (!push_xyz_block(import, job, block))
+   {
+    ret = 0;
+   }
+  }
+  else
+  {
+   free_xyz_block(block);
+  }
  }
+ return ret;
 }
-// -- -- ---------------------------------- --
-// Collecting a list of Dem-xyz file
-// - with checks on the first record
-// Case 1: a single xyz.file is given
-// -> the file will be checked and added to the list
-// Case 2: a directory is given
-// -> each file will be checked and added to the list
-// Case 3: a single list.file is given
-// - contains a list of single xyz.files to be read
-// -> expected to be inside the given directory
-// -> each file will be checked and added to the list
-// -- -- ---------------------------------- --
-// The list is the TABLE db_memory.xyz_files
-// Goal is to read the files in a specific order:
-// --> y='South to North' and x='West to East'
-// -- -- ---------------------------------- --
-static int
-collect_xyz_files(sqlite3 *db_handle,const char *xyz_filename, int *count_xyz_files, int verbose)
+#ifndef _WIN32
+static void *
+xyz_import_worker(void *arg)
 {
- int ret=0;
- int i_count_fields=0;
- int i_count_fields_check=3;
- int ret_insert=SQLITE_OK;
- if (*count_xyz_files < 0)
+ struct xyz_import *import = (struct xyz_import *)arg;
+ struct xyz_file_job *job = NULL;
+ while (1)
  {
-  *count_xyz_files=0;
+  pthread_mutex_lock(&(import->mutex));
+  if ((import->is_stopping) || (import->next_job >= import->count_jobs))
+  {
+   pthread_mutex_unlock(&(import->mutex));
+   break;
+  }
+  job = &(import->jobs[import->next_job++]);
+  pthread_mutex_unlock(&(import->mutex));
+  parse_xyz_file(import, job);
+  pthread_mutex_lock(&(import->mutex));
+  job->is_done = 1;
+  pthread_cond_broadcast(&(import->cond));
+  pthread_mutex_unlock(&(import->mutex));
  }
- double point_x=0.0;
- double point_y=0.0;
- double point_z=0.0;
- char *sql_statement = NULL;
- int result_file_type=0;
- char *directory_from_filename = NULL;
-// -- -- ---------------------------------- --
- FILE *xyz_file = fopen(xyz_filename, "rt");
- if (xyz_file != NULL)
+ return NULL;
+}
+static int
+insert_xyz_file_job(struct xyz_import *import, struct xyz_file_job *job)
+{// the writer: inserting the blocks of a file, as parsed
+ int ret=1;
+ struct xyz_block *block = NULL;
+ while (1)
  {
-  if (verbose)
+  pthread_mutex_lock(&(import->mutex));
+  while ((job->first == NULL) && (!job->is_done))
   {
-   fprintf(stderr,"-I-> collect_xyz_files:reading xyz_filename[%s] \n", xyz_filename);
+   pthread_cond_wait(&(import->cond), &(import->mutex));
   }
-  char line[MAXBUF];
-  while(fgets(line, sizeof(line), xyz_file) != NULL)
+  block = job->first;
+  if (block)
   {
-   if (strcmp(line, "SQLite format 3") != 0)
+   job->first = block->next;
+   if (job->first == NULL)
    {
-    line[strcspn(line, "\r\n")] = 0;
-    char *token;
-    char *ptr_strtod;
-    char *saveptr;
-    i_count_fields=0;
-    token = strtok_r(line, " ",&saveptr);
-    point_x=strtod(token, &ptr_strtod);
-    // atof will cause a signal 11 (SIGSEGV), if token does not contain a double
-    if ((int)strlen(ptr_strtod) == 0)
-    {
-     i_count_fields++;
-     while(token != NULL)
-     {
-      token = strtok_r(NULL," ",&saveptr);
-      switch (i_count_fields)
-      {
-       case 1:
-        point_y=strtod(token, &ptr_strtod);
-        if ((int)strlen(ptr_strtod) == 0)
-        {
-         i_count_fields++;
-        }
-        break;
-       case 2:
-        point_z=strtod(token, &ptr_strtod);
-        if ((int)strlen(ptr_strtod) == 0)
-        {
-         if (point_z < 0.0 || point_z > 0.0)
-         {
-          // suppressing stupid compiler warnings
-          i_count_fields++;
-         }
-        }
-        break;
-      }
-     }
-    }
-    if (i_count_fields == 0)
-    {
-     // This may be a list of xyz.file-names,
-     // - contained in the same directory
-     // - that should be read [possibly not all of the xyz.files should be read]
-     // - order is not important, will be sorted by point_y ASC, point_x ASC of the first record
-     if (!directory_from_filename)
-     {
-      const char *slash = strrchr(xyz_filename,'/');
-      directory_from_filename=malloc(sizeof(char)*((slash-xyz_filename)+1));
-      strncpy(directory_from_filename,xyz_filename,slash-xyz_filename);
-      directory_from_filename[(slash-xyz_filename)]=0;
-     }
-     sql_statement = sqlite3_mprintf("%s/%s", directory_from_filename,token);
-     // the first record will be read. If 3 doubles, seperated by a space, can be created
-     // 1 : will be returned, after adding the path/file-name, point_x and point_y to db_memory.xyz_files
-     result_file_type=collect_xyz_files(db_handle,sql_statement, count_xyz_files, 0);
-     if (result_file_type == 1)
-     {//file_name has been added to db_memory.xyz_files
-      ret=1; // xyz-format
-     }
-     sqlite3_free(sql_statement);
-    }
-    if (i_count_fields == i_count_fields_check)
-    {
-     sql_statement = sqlite3_mprintf("INSERT INTO db_memory.xyz_files (point_x,point_y,file_name) "
-                                     "VALUES(%2.7f,%2.7f,'%s') ",point_x,point_y,xyz_filename);
-     if (db_handle)
-     {
-      if (sqlite3_exec(db_handle, sql_statement, NULL, NULL, NULL) == SQLITE_OK)
-      {
-       *count_xyz_files+=1; // xyz-format
-       result_file_type=1;
-      }
-     }
-     sqlite3_free(sql_statement);
-     ret_insert = SQLITE_ABORT;
-    }
-    if (verbose)
-    {
-     fprintf(stderr,"-I->  collect_xyz_files: i_count_fields[%d] check[%d] count_files[%d]\n", i_count_fields,i_count_fields_check,*count_xyz_files);
-    }
+    job->last = NULL;
    }
-   else
+   job->count_blocks--;
+   pthread_cond_broadcast(&(import->cond));
+  }
+  pthread_mutex_unlock(&(import->mutex));
+  if (block == NULL)
+  {// the file is completed
+   break;
+  }
+  if (ret)
+  {
+   ret = write_xyz_block(import, block);
+  }
+  free_xyz_block(block);
+ }
+ return ret;
+}
+#endif /* not WIN32 */
+// -- -- ---------------------------------- --
+// Read list of Dem-xyz files
+// - from db_memory.xyz_files
+// Goal is to INSERT the points in a specific order:
+// --> y='South to North' and x='West to East'
+// - with raster, the points are passed to the Dem-Raster
+// -- -- ---------------------------------- --
+static int
+import_xyz(sqlite3 *db_handle, struct config_dem *dem_config, struct dem_raster *raster, int count_xyz_files, int verbose)
+{
+ int ret=0;
+ int ret_select=0;
+ int i=0;
+ sqlite3_stmt *stmt = NULL;
+ char *sql_statement = NULL;
+ struct xyz_import import;
+ struct xyz_file_job *job = NULL;
+ struct xyz_block *block = NULL;
+ if (count_xyz_files <= 0)
+ {
+  return 0;
+ }
+ import.db_handle = db_handle;
+ import.dem_config = dem_config;
+ import.stmt = NULL;
+ import.raster = raster;
+ import.jobs = malloc(sizeof (struct xyz_file_job) * count_xyz_files);
+ import.count_jobs = 0;
+ import.is_stopping = 0;
+ import.verbose = verbose;
+ import.is_parallel = 0;
+ import.count_workers = 0;
+#ifndef _WIN32
+ import.workers = NULL;
+#endif /* not WIN32 */
+ // input-files should be sorted from y='South to North' and x='West to East':  sort -n -k2 -k1 input_file.xyz -o output_file.sort.xyz
+ // Select files sorted by y='South to North' and x='West to East'
+ sql_statement = sqlite3_mprintf("SELECT file_name FROM db_memory.xyz_files ORDER BY point_y ASC, point_x ASC");
+ ret_select = sqlite3_prepare_v2(db_handle, sql_statement, -1, &stmt, NULL );
+ sqlite3_free(sql_statement);
+ if ( ret_select == SQLITE_OK )
+ {
+  while (( sqlite3_step( stmt ) == SQLITE_ROW ) && (import.count_jobs < count_xyz_files))
+  {
+   if ( sqlite3_column_type( stmt, 0 ) != SQLITE_NULL )
    {
-    result_file_type=2; // Sqlite3-format
+    job = &(import.jobs[import.count_jobs++]);
+    job->xyz_path_filename = sqlite3_mprintf("%s", (const char *) sqlite3_column_text (stmt, 0));
+    job->first = NULL;
+    job->last = NULL;
+    job->count_blocks = 0;
+    job->line_error = 0;
+    job->is_missing = 0;
+    job->is_done = 0;
    }
-   if (ret_insert == SQLITE_ABORT )
+  }
+  sqlite3_finalize( stmt );
+ }
+ sql_statement = sqlite3_mprintf("INSERT INTO \"%s\" (point_x,point_y, point_z,\"%s\") VALUES(?,?,?,?)",
+                                 dem_config->dem_table,dem_config->dem_geometry);
+ ret_select = sqlite3_prepare_v2( db_handle, sql_statement, -1, &import.stmt, NULL );
+ if ( ret_select != SQLITE_OK )
+ {
+  if (verbose)
+  {
+   fprintf(stderr, "-W-> import_xyz: rc=%d sql[%s]\n",ret_select,sql_statement);
+  }
+  import.stmt = NULL;
+ }
+ sqlite3_free(sql_statement);
+#ifndef _WIN32
+ if ((import.stmt) && (dem_config->threads > 1) && (import.count_jobs > 1))
+ {// parsing in parallel
+  import.next_job = 0;
+  pthread_mutex_init(&(import.mutex), NULL);
+  pthread_cond_init(&(import.cond), NULL);
+  import.workers = malloc(sizeof (pthread_t) * dem_config->threads);
+  import.is_parallel = 1;
+  for (i=0; i<dem_config->threads; i++)
+  {
+   if (pthread_create(&(import.workers[i]), NULL, xyz_import_worker, &import) != 0)
    {
     break;
    }
-   if (ret_insert != SQLITE_ABORT )
-   {
-    // if this is a list of .xyz files that are being added,
-    // result_file_type will be 1, but not SQLITE_ABORT
-    // - since all entries must be read
-    if (result_file_type != 1)
-    {
-     break; // unknown format
-    }
-   }
-  } // End while
-  fclose(xyz_file);
-  if (directory_from_filename)
+   import.count_workers++;
+  }
+  if (import.count_workers == 0)
   {
-   free(directory_from_filename);
-   directory_from_filename=NULL;
+   import.is_parallel = 0;
+   pthread_mutex_destroy(&(import.mutex));
+   pthread_cond_destroy(&(import.cond));
   }
- } // Checking for a file
- else
+ }
+#endif /* not WIN32 */
+ if (verbose)
  {
-#if defined(_WIN32)
-  /* Visual Studio .NET */
-  struct _finddata_t c_file;
-  intptr_t hFile;
-  char *name;
-  int len;
-  int ret;
-  if (_chdir (xyz_filename) < 0)
-   return ret;
-  if ((hFile = _findfirst ("*.xyz", &c_file)) == -1L)
-   ;
+  fprintf(stderr,"import_xyz: reading %d xyz-files with %d threads, in steps of [%d].\n",import.count_jobs,MAX(1, import.count_workers),DEM_XYZ_BLOCK_POINTS);
+ }
+ ret = ((import.stmt) && (import.count_jobs > 0));
+ dem_profile_switch(dem_config->profile, DEM_PHASE_READ);
+ for (i=0; (ret) && (i<import.count_jobs); i++)
+ {
+  job = &(import.jobs[i]);
+  if (verbose)
+  {
+   fprintf(stderr,"import_xyz: reading  xyz_filename[%s]\n (file %d of %d).\n",job->xyz_path_filename,i+1,import.count_jobs);
+  }
+#ifndef _WIN32
+  if (import.count_workers > 0)
+  {
+   if (!insert_xyz_file_job(&import, job))
+   {
+    ret = 0;
+   }
+  }
   else
+#endif /* not WIN32 */
   {
-   while (1)
-   {// A directory with .xyz files
-    if ((c_file.attrib & _A_RDONLY) == _A_RDONLY  || (c_file.attrib & _A_NORMAL) == _A_NORMAL)
-    {
-     sql_statement = sqlite3_mprintf("%s/%s", xyz_filename,c_file.name);
-     if (collect_xyz_files(db_handle,sql_statement, count_xyz_files, 0) == 1)
-     {//file_name has been added to db_memory.xyz_files
-     }
-     sqlite3_free(sql_statement);
-    }
-    if (_findnext (hFile, &c_file) != 0)
-     break;
+   if (!parse_xyz_file(&import, job))
+   {
+    ret = 0;
    }
-   _findclose (hFile);
   }
-#else
-  DIR *xyz_dir = opendir(xyz_filename);
-  struct dirent *dir;
-  if (xyz_dir)
+  if (job->is_missing)
   {
-   while ((dir = readdir(xyz_dir)) != NULL)
+   if (verbose)
    {
-    if (dir->d_type == DT_REG)
-    {
-     const char *ext = strrchr(dir->d_name,'.');
-     if ((ext) || (ext != dir->d_name))
-     {
-      if (strcmp(ext, ".xyz") == 0)
-      {// A directory with .xyz files
-       // - order is not important, will be sorted by point_y ASC, point_x ASC of the first record
-       sql_statement = sqlite3_mprintf("%s/%s", xyz_filename,dir->d_name);
-       // the first record will be read. If 3 doubles, seperated by a space, can be created
-       // 1 : will be returned, after adding the path/file-name, point_x and point_y to db_memory.xyz_files
-       result_file_type=collect_xyz_files(db_handle,sql_statement, count_xyz_files, 0);
-       if (result_file_type == 1)
-       {//file_name has been added to db_memory.xyz_files
-       }
-       sqlite3_free(sql_statement);
-      }
-     }
-    }
+    fprintf(stderr,"-E-> import_xyz: import.xyz file not found [%s]\n", job->xyz_path_filename);
    }
-   closedir(xyz_dir);
-  } // Checking for a directory
-#endif
+   ret = 0;
+  }
+  if (job->line_error > 0)
+  {// an invalid line fails the import: the points read before it are kept
+   fprintf(stderr,"\n-E-> import_xyz: invalid xyz-line %d in [%s]\n", job->line_error, job->xyz_path_filename);
+   ret = 0;
+  }
+  if (!ret)
+  {// aborting
+   break;
+  }
+  if (verbose)
+  {
+   fprintf(stderr,"\r file%d: inserting completed [%u]\n",i+1, dem_config->dem_rows_count);
+  }
  }
-// -- -- ---------------------------------- --
- if (*count_xyz_files > 0)
+#ifndef _WIN32
+ if (import.count_workers > 0)
  {
-  ret=1; // xyz-format
+  pthread_mutex_lock(&(import.mutex));
+  import.is_stopping = 1;
+  pthread_cond_broadcast(&(import.cond));
+  pthread_mutex_unlock(&(import.mutex));
+  for (i=0; i<import.count_workers; i++)
+  {
+   pthread_join(import.workers[i], NULL);
+  }
+  pthread_mutex_destroy(&(import.mutex));
+  pthread_cond_destroy(&(import.cond));
  }
- else
+ if (import.workers)
  {
-  ret=0; // not supported
-  if (verbose)
-  {
-   fprintf(stderr,"-E-> collect_xyz_files: import.xyz file format not found [%s]\n", xyz_filename);
+  free(import.workers);
+ }
+#endif /* not WIN32 */
+ for (i=0; i<import.count_jobs; i++)
+ {
+  job = &(import.jobs[i]);
+  while (job->first)
+  {// only after an abort
+   block = job->first;
+   job->first = block->next;
+   free_xyz_block(block);
   }
+  sqlite3_free(job->xyz_path_filename);
  }
-// -- -- ---------------------------------- -
+ free(import.jobs);
+ if (import.stmt)
+ {
+  sqlite3_finalize(import.stmt);
+ }
+// -- -- ---------------------------------- --
  return ret;
 }
 // -- -- ---------------------------------- --
-// Read list of Dem-xyz files
-// - from db_memory.xyz_files
-// Goal is to INSERT the points in a specific order:
-// --> y='South to North' and x='West to East'
+// Importing the xyz-files as Dem-Raster
+// - returns 1 when stored as Dem-Raster, 0 when the
+//   points are not a regular grid [to be imported
+//   as POINT rows instead], -1 on errors
 // -- -- ---------------------------------- --
 static int
-import_xyz(sqlite3 *db_handle, struct config_dem *dem_config, int count_xyz_files, int verbose)
+import_dem_raster(sqlite3 *db_handle, struct config_dem *dem_config, int count_xyz_files, int verbose)
 {
- int ret=0;
- int ret_select=0;
- sqlite3_stmt *stmt = NULL;
+ int ret=-1;
+ int is_valid=0;
+ sqlite3_int64 count_tiles=0;
  char *sql_statement = NULL;
- int i_count_loop=100000;
- int i_count_fields=0;
- int i_count_fields_check=3;
- int i_count_in_loop=0;
- int i_file_count=0;
- const char *xyz_path_filename;
-// 18.446.744.073.709.551.615
- unsigned int i_sleep=1; // 1 second
- double point_x=0.0;
- double point_y=0.0;
- double point_z=0.0;
- double *xx = NULL;
- double *yy = NULL;
- double *zz = NULL;
- int ret_insert=SQLITE_OK;
- if (count_xyz_files > 0)
- {// input-files should be sorted from y='South to North' and x='West to East':  sort -n -k2 -k1 input_file.xyz -o output_file.sort.xyz
-  // Select files sorted by y='South to North' and x='West to East'
-  sql_statement = sqlite3_mprintf("SELECT file_name FROM db_memory.xyz_files ORDER BY point_y ASC, point_x ASC");
-  ret_select = sqlite3_prepare_v2(db_handle, sql_statement, -1, &stmt, NULL );
-  sqlite3_free(sql_statement);
-  if ( ret_select == SQLITE_OK )
+ char *sql_err = NULL;
+ struct dem_tile *tile = NULL;
+ struct dem_raster raster;
+ memset(&raster, 0, sizeof (struct dem_raster));
+ raster.db_handle = db_handle;
+ raster.dem_config = dem_config;
+ raster.is_scanning = 1;
+ raster.verbose = verbose;
+ if (verbose)
+ {
+  fprintf(stderr,"-I-> import_dem_raster: first pass, checking for a regular grid\n");
+ }
+ if (!import_xyz(db_handle, dem_config, &raster, count_xyz_files, verbose))
+ {
+  return -1;
+ }
+ dem_config->dem_rows_count = 0;
+ if (!set_dem_raster_layout(&raster))
+ {
+  if (verbose)
   {
-   while ( sqlite3_step( stmt ) == SQLITE_ROW )
+   fprintf(stderr,"-W-> import_dem_raster: the points are not a regular grid, importing as POINTs\n");
+  }
+  return 0;
+ }
+ if (verbose)
+ {
+  fprintf(stderr,"-I-> import_dem_raster: %d columns x %d rows, step x/y(%2.7f,%2.7f), second pass\n",
+          raster.grid.columns,raster.grid.rows,raster.grid.step_x,raster.grid.step_y);
+ }
+// -- -- ---------------------------------- --
+// second pass: filling the tiles
+// -- -- ---------------------------------- --
+ raster.is_scanning = 0;
+ raster.count_points = 0;
+ raster.bytes_max = (sqlite3_int64)dem_config->cache_size * 1024 * 1024;
+ count_tiles = raster.bytes_max / (sizeof (float) * DEM_TILE_SIZE * DEM_TILE_SIZE);
+ raster.hash_size = 64;
+ while ((raster.hash_size < count_tiles) && (raster.hash_size < 16777216))
+ {
+  raster.hash_size *= 2;
+ }
+ raster.hash = calloc(raster.hash_size, sizeof (struct dem_tile *));
+ if (sqlite3_exec(db_handle, "BEGIN", NULL, NULL, &sql_err) != SQLITE_OK)
+ {
+  if (verbose)
+  {
+   fprintf(stderr, "-W-> import_dem_raster: BEGIN TRANSACTION error: %s\n", sql_err);
+  }
+  sqlite3_free(sql_err);
+  free(raster.hash);
+  return -1;
+ }
+ if (!create_dem_tiles_tables(db_handle, dem_config, verbose))
+ {
+  goto stop;
+ }
+ sql_statement = sqlite3_mprintf("SELECT z_values FROM '%s'.'%s_tiles' WHERE tile_x = ? AND tile_y = ?",
+                                 dem_config->schema,dem_config->dem_table);
+ ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &raster.stmt_select, NULL );
+ sqlite3_free(sql_statement);
+ if ( ret != SQLITE_OK )
+ {
+  goto stop;
+ }
+ sql_statement = sqlite3_mprintf("INSERT OR REPLACE INTO '%s'.'%s_tiles' (tile_x, tile_y, z_values) VALUES (?, ?, ?)",
+                                 dem_config->schema,dem_config->dem_table);
+ ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &raster.stmt_insert, NULL );
+ sqlite3_free(sql_statement);
+ if ( ret != SQLITE_OK )
+ {
+  goto stop;
+ }
+ if (!import_xyz(db_handle, dem_config, &raster, count_xyz_files, verbose))
+ {
+  goto stop;
+ }
+ while (raster.first)
+ {// the incomplete tiles
+  if (!remove_dem_raster_tile(&raster, raster.first))
+  {
+   goto stop;
+  }
+ }
+ dem_config->dem_rows_count = raster.count_cells;
+ dem_config->dem_extent_minx = raster.grid.origin_x;
+ dem_config->dem_extent_miny = raster.grid.origin_y;
+ dem_config->dem_extent_maxx = raster.grid.origin_x + ((raster.grid.columns - 1) * raster.grid.step_x);
+ dem_config->dem_extent_maxy = raster.grid.origin_y + ((raster.grid.rows - 1) * raster.grid.step_y);
+ if (!insert_dem_tiles_layout(db_handle, dem_config, &raster.grid, raster.count_cells, 1, verbose))
+ {
+  goto stop;
+ }
+ is_valid = 1;
+// -- -- ---------------------------------- --
+stop:
+ while (raster.first)
+ {
+  tile = raster.first;
+  raster.first = tile->next;
+  free_dem_tile(tile);
+ }
+ free(raster.hash);
+ if (raster.stmt_select)
+ {
+  sqlite3_finalize(raster.stmt_select);
+ }
+ if (raster.stmt_insert)
+ {
+  sqlite3_finalize(raster.stmt_insert);
+ }
+ if (is_valid)
+ {
+  if (sqlite3_exec(db_handle, "COMMIT", NULL, NULL, &sql_err) != SQLITE_OK)
+  {
+   if (verbose)
    {
-    if ( sqlite3_column_type( stmt, 0 ) != SQLITE_NULL )
-    {
-     xyz_path_filename=(const char *) sqlite3_column_text (stmt, 0);
-     // -- -- ---------------------------------- --
-     FILE *xyz_file = fopen(xyz_path_filename, "rt");
-     if (xyz_file != NULL)
-     {
-      char line[MAXBUF];
-      i_file_count++;
-      i_count_in_loop=0;
-      if (verbose)
-      {
-       // CPU: 4-11% ; memory 9.3 Ḿib ; normal working with mouse and applications
-       fprintf(stderr,"import_xyz: reading  xyz_filename[%s]\n (file %d of %d) in steps of [%u].\n",xyz_path_filename,i_file_count,count_xyz_files, i_count_loop);
-      }
-      xx = malloc(sizeof (double) * i_count_loop);
-      yy = malloc(sizeof (double) * i_count_loop);
-      zz = malloc(sizeof (double) * i_count_loop);
-      while(fgets(line, sizeof(line), xyz_file) != NULL)
-      {
-       line[strcspn(line, "\r\n")] = 0;
-       char *token;
-       char *ptr_strtod;
-       char *saveptr;
-       i_count_fields=0;
-       token = strtok_r(line, " ",&saveptr);
-       point_x=strtod(token, &ptr_strtod);
-       // atof will cause a signal 11 (SIGSEGV), if token does not contain a double
-       if ((int)strlen(ptr_strtod) == 0)
-       {
-        i_count_fields++;
-        while(token != NULL)
-        {
-         token = strtok_r(NULL," ",&saveptr);
-         switch (i_count_fields)
-         {
-          case 1:
-           point_y=strtod(token, &ptr_strtod);
-           if ((int)strlen(ptr_strtod) == 0)
-           {
-            i_count_fields++;
-           }
-           break;
-          case 2:
-           point_z=strtod(token, &ptr_strtod);
-           if ((int)strlen(ptr_strtod) == 0)
-           {
-            i_count_fields++;
-           }
-           break;
-         }
-        }
-       }
-       if (i_count_fields == i_count_fields_check)
-       {
-        if (i_count_in_loop < i_count_loop)
-        {
-         xx[i_count_in_loop]=point_x;
-         yy[i_count_in_loop]=point_y;
-         zz[i_count_in_loop]=point_z;
-         i_count_in_loop++;
-        }
-        if (i_count_in_loop == i_count_loop)
-        {
-         dem_config->count_points=i_count_in_loop;
-         if (!insert_dem_points(db_handle, dem_config, xx, yy, zz, verbose))
-         {
-          // Inserting failed, abort
-          ret_insert = SQLITE_ABORT;
-         }
-         else
-         {
-          if (verbose)
-          {
-           fprintf(stderr,"\r inserted [%u] ... ", dem_config->dem_rows_count);
-          }
-         }
-         // xx,yy,zz values are reset to 0.0 in insert_dem_points
-         i_count_in_loop=0;
-         sleep(i_sleep);
-        }
-       }
-       else
-       {
-        ret_insert = SQLITE_ABORT;
-       }
-       if (ret_insert == SQLITE_ABORT )
-       {
-        break;
-       }
-      } // End while
-      fclose(xyz_file);
-      // -- -- ---------------------------------- --
-      // Complete what is left over, when no abort
-      // -- -- ---------------------------------- --
-      if (ret_insert != SQLITE_ABORT )
-      {
-       ret=1;
-       if ( i_count_in_loop < i_count_loop)
-       {
-        ret=0;
-        dem_config->count_points=i_count_in_loop;
-        fprintf(stderr,"import_xyz: calling insert_dem_points: i_count_in_loop[%d].\n",dem_config->count_points);
-        if (insert_dem_points(db_handle, dem_config, xx, yy, zz, verbose))
-        {
-         ret=1;
-         if (verbose)
-         {
-          fprintf(stderr,"\r file%d: inserting completed [%u]\n",i_file_count, dem_config->dem_rows_count);
-         }
-        }
-       }
-      }
-      // -- -- ---------------------------------- --
-      // clean up
-      // -- -- ---------------------------------- --
-      if (xx)
-      {
-       free(xx);
-       xx=NULL;
-      }
-      if (yy)
-      {
-       free(yy);
-       yy=NULL;
-      }
-      if (zz)
-      {
-       free(zz);
-       zz=NULL;
-      }
-     }
-     else
-     {
-      if (verbose)
-      {
-       fprintf(stderr,"-E-> import_xyz: import.xyz file not found [%s]\n", xyz_path_filename);
-      }
-     }
-    }
+    fprintf(stderr, "-W-> import_dem_raster: COMMIT TRANSACTION error: %s\n", sql_err);
    }
-   sqlite3_finalize( stmt );
+   sqlite3_free(sql_err);
+   is_valid = 0;
+  }
+ }
+ else
+ {
+  sqlite3_exec(db_handle, "ROLLBACK", NULL, NULL, NULL);
+ }
+ if (is_valid)
+ {
+  if (verbose)
+  {
+   fprintf(stderr,"-I-> import_dem_raster: %u cells stored, %d tiles written\n",raster.count_cells,raster.count_tiles);
   }
+  return 1;
  }
-// -- -- ---------------------------------- --
- return ret;
+ dem_config->dem_rows_count = 0;
+ if (raster.is_off_grid)
+ {
+  if (verbose)
+  {
+   fprintf(stderr,"\n-W-> import_dem_raster: the points are not a regular grid, importing as POINTs\n");
+  }
+  return 0;
+ }
+ return -1;
 }
 // -- -- ---------------------------------- --
 // Recover Dem-Geometry with SpatialIndex
@@ -2504,6 +5750,12 @@ do_help()
  fprintf(stderr, "\t the automatic resolution calculation is based on the row_count\n");
  fprintf(stderr, "\t within the extent, which may not be correct!\n");
  fprintf(stderr, "\t Use '-rdem' to set a realistic value\n");
+ fprintf(stderr, "-idem or --dem-interpolation [nearest (default), bilinear or bicubic]\n");
+ fprintf(stderr, "\t bilinear/bicubic fall back to nearest where the grid has no data\n");
+ fprintf(stderr, "-cdem or --dem-cache-size memory budget in MB of the Dem-Grid [default 512]\n");
+ fprintf(stderr, "\t bigger Dems are read through a tiled Dem-Store, see Notes\n");
+ fprintf(stderr, "-raster or --dem-raster with -create_dem: store a regular grid as Dem-Raster\n");
+ fprintf(stderr, "\t only as compressed tiles, without a POINT row for each point\n");
  fprintf(stderr, "\n  -- -- -------------- Source-Update-Database ----------------- --\n");
  fprintf(stderr, "-d or --db-path pathname to the SpatiaLite DB\n");
  fprintf(stderr, "-t or --table table_name,  must be a SpatialTable\n");
@@ -2513,13 +5765,33 @@ do_help()
  fprintf(stderr, "-mdem or --copy-m [0=no, 1= yes [default] if exists]\n");
  fprintf(stderr, "-default_srid or --srid for use with -fetchz\n");
  fprintf(stderr, "-fetchz_xy x- and y-value for use with -fetchz\n");
+ fprintf(stderr, "-fetchz_file file with an x- and y-value on each line for use with -fetchz ['-' for stdin]\n");
+ fprintf(stderr, "\t a z-value (or 'nan') is returned for each line, in the same order\n");
+ fprintf(stderr, "-threads or --threads N worker threads for -updatez and -import_xyz [default 1]\n");
+ fprintf(stderr, "\t -updatez: with the in-memory Dem-Grid only, -import_xyz: parsing the xyz-files in parallel\n");
  fprintf(stderr, "-v or  --verbose messages during -updatez and -fetchz\n");
+ fprintf(stderr, "-profile or --profile-json file to write a JSON summary of the time used\n");
+ fprintf(stderr, "\t by each phase, with row/vertex counters ['-' for stderr]\n");
  fprintf(stderr, "-save_conf based on active -ddem , -tdem, -gdem and -srid when valid\n");
  fprintf(stderr, "\n  -- -- -------------------- Notes:  ---------------------- --\n");
  fprintf(stderr, "-I-> the Z value will be copied from the nearest point found\n");
+ fprintf(stderr, "\t (or interpolated, see -idem) \n");
+ fprintf(stderr, "-I-> when the Dem points form a regular grid, -updatez loads them\n");
+ fprintf(stderr, "\t once into memory instead of querying the Dem for each point\n");
+ fprintf(stderr, "-I-> when they do not fit into -cdem, the table '<dem_table>_tiles' is built\n");
+ fprintf(stderr, "\t once in the Dem-Database and reused while the Dem is unchanged\n");
+ fprintf(stderr, "\t the geometries are then updated in a tile-friendly (Hilbert) order\n");
+ fprintf(stderr, "-I-> a Dem-Raster is found by its '<dem_table>_tiles_layout', -fetchz and -updatez\n");
+ fprintf(stderr, "\t read the cells directly; xyz-files that are not a regular grid\n");
+ fprintf(stderr, "\t are imported as POINT rows, as without -raster\n");
  fprintf(stderr, "-I-> the Srid of the source Geometry and the Dem-POINT can be different\n");
  fprintf(stderr, "-I-> when -fetchz_xy is used in a bash script, -v should not be used\n");
  fprintf(stderr, "\t the z-value will then be returned as the result\n");
+ fprintf(stderr, "-I-> -profile phases: setup, dem_load, read, lookup, rebuild, write, index and wait\n");
+ fprintf(stderr, "\t the phases of the main thread add up to seconds_total; with -threads\n");
+ fprintf(stderr, "\t the lookup and rebuild time of the workers is summed in worker_seconds\n");
+ fprintf(stderr, "-I-> for many points use -fetchz_file instead of calling -fetchz_xy for each point\n");
+ fprintf(stderr, "\t the Dem-Database is opened once and the points are queried in a spatial order\n");
  fprintf(stderr, "\n  -- -- -------------------- Conf file:  ------------------- --\n");
  fprintf(stderr, "-I-> if 'SPATIALITE_DEM' is set with the path to a file\n");
  fprintf(stderr, "-I--> 'export SPATIALITE_DEM=/long/path/to/file/berlin_dhh92.conf'\n");
@@ -2544,8 +5816,8 @@ do_help()
  fprintf(stderr, "\n=========================== Commands ===========================\n");
  fprintf(stderr, "-sniff   [default] analyse settings without UPDATE of z-values \n");
  fprintf(stderr, "-updatez Perform UPDATE of z-values \n");
- fprintf(stderr, "-fetchz Perform Query of z-values using  -fetchz_x_y and default_srid\n");
- fprintf(stderr, "\t will be assumed when using  -fetchz_x_y\n");
+ fprintf(stderr, "-fetchz Perform Query of z-values using  -fetchz_x_y (or -fetchz_file) and default_srid\n");
+ fprintf(stderr, "\t will be assumed when using  -fetchz_x_y or -fetchz_file\n");
  fprintf(stderr, "-create_dem create Dem-Database using -ddem,-tdem, -gdem and -srid for the Database \n");
  fprintf(stderr, "\t -d as a dem.xyz file \n");
  fprintf(stderr, "-import_xyz import another .xyz file into a Dem-Database created with -create_dem \n");
@@ -2658,7 +5930,21 @@ command_check_dem_db(sqlite3 *db_handle, struct config_dem*dem_config, struct co
 // -- -- ---------------------------------- --
  if ((strlen(dem_config->dem_path) > 0) && (strlen(dem_config->dem_table) > 0) && (strlen(dem_config->dem_geometry) > 0))
  {
-  if (check_geometry_dimension(db_handle,dem_config, &geometry_type, verbose))
+  if (check_dem_raster(db_handle, dem_config, &resolution_calc, verbose))
+  {// Dem-Raster: no Dem-Geometry to check
+   if (verbose)
+   {
+    fprintf(stderr,"Dem: srid %d\n", dem_config->dem_srid);
+    fprintf(stderr,"Dem: extent min x/y(%2.7f,%2.7f)\n\t    max x/y(%2.7f,%2.7f)\n",
+            dem_config->dem_extent_minx,dem_config->dem_extent_miny,
+            dem_config->dem_extent_maxx,dem_config->dem_extent_maxy);
+    fprintf(stderr,"Dem: rows_count(%s_tiles) %u\n",dem_config->dem_table, dem_config->dem_rows_count);
+    fprintf(stderr,"Dem: resolution(%s_tiles) %2.7f\n",dem_config->dem_table, resolution_calc);
+    fprintf(stderr,"Dem '%s'\n", dem_config->dem_path);
+    fprintf(stderr," Dem-Raster TABLE[%s_tiles]\n",dem_config->dem_table);
+   }
+  }
+  else if (check_geometry_dimension(db_handle,dem_config, &geometry_type, verbose))
   {
    if (dem_config->dem_rows_count)
    {
@@ -2858,9 +6144,35 @@ command_updatez_db(sqlite3 *db_handle, struct config_dem*source_config, struct c
   /* ok, going to convert */
   /* the complete operation is handled as an unique SQL Transaction */
   gettimeofday(&time_start, 0);
+  // loading the Dem points once, avoiding a SQL query for each vertex
+  dem_profile_switch(dem_config->profile, DEM_PHASE_LOAD);
+  dem_config->dem_grid = load_dem_grid(db_handle, dem_config, 0, 0.0, 0.0, 0.0, 0.0, verbose);
+  if ((dem_config->is_raster) && (dem_config->dem_grid == NULL))
+  {// a Dem-Raster has no POINTs to query
+   if (verbose)
+   {
+    fprintf(stderr,"-E-> command_updatez_db: the Dem-Raster [%s_tiles] could not be read\n",dem_config->dem_table);
+   }
+   return -1;
+  }
   if (sqlite3_exec(db_handle, "BEGIN", NULL, NULL, &sql_err) == SQLITE_OK)
   {
-   if (retrieve_geometries(db_handle, source_config, dem_config, &count_total_geometries,&count_changed_geometries,&count_points_total,&count_z_total,&count_m_total, verbose) )
+#ifndef _WIN32
+   if ((dem_config->threads > 1) && (dem_config->dem_grid) && (dem_config->dem_grid->tiles == NULL))
+   {// the workers share the in-memory Dem-Grid
+    ret = retrieve_geometries_parallel(db_handle, source_config, dem_config, &count_total_geometries,&count_changed_geometries,&count_points_total,&count_z_total,&count_m_total, verbose);
+   }
+   else
+#endif
+   {
+    if (dem_config->threads > 1)
+    {
+     fprintf(stderr,"-W-> -threads ignored: only supported with the in-memory Dem-Grid\n");
+    }
+    ret = retrieve_geometries(db_handle, source_config, dem_config, &count_total_geometries,&count_changed_geometries,&count_points_total,&count_z_total,&count_m_total, verbose);
+   }
+   dem_profile_switch(dem_config->profile, DEM_PHASE_WRITE);
+   if (ret)
    {
     /* committing the pending SQL Transaction */
     if (sqlite3_exec(db_handle, "COMMIT", NULL, NULL, &sql_err) == SQLITE_OK)
@@ -2898,6 +6210,7 @@ command_updatez_db(sqlite3 *db_handle, struct config_dem*source_config, struct c
      fprintf(stderr, "*** ERROR: conversion failed\n\n");
     }
    }
+   dem_profile_switch(dem_config->profile, DEM_PHASE_SETUP);
    gettimeofday(&time_end, 0);
    timeval_subtract(&time_diff,&time_end,&time_start,&time_message);
    if (ret == 0)
@@ -2906,6 +6219,10 @@ command_updatez_db(sqlite3 *db_handle, struct config_dem*source_config, struct c
     {
      fprintf(stderr,"-I-> geometries total[%d] changed[%d] ; points total[%d] changed z[%d] changed m[%d]\n",count_total_geometries,count_changed_geometries,count_points_total,count_z_total,count_m_total);
      fprintf(stderr,"\tDatabase-file successfully updated found, changed, Z-Values !!!\n");
+     if ((time_diff.tv_sec > 0) || (time_diff.tv_usec > 0))
+     {
+      fprintf(stderr,"-I-> throughput: %2.0f vertices/sec\n",(double)count_points_total/((double)time_diff.tv_sec+((double)time_diff.tv_usec/1000000.0)));
+     }
      fprintf(stderr,"%s\n\n", time_message);
     }
    }
@@ -2931,6 +6248,13 @@ command_updatez_db(sqlite3 *db_handle, struct config_dem*source_config, struct c
    fprintf(stderr,"-E-> command_updatez_db: preconditions failed [%s(%s)] \n",source_config->dem_table, source_config->dem_geometry);
   }
  }
+ if (dem_config->dem_grid)
+ {
+  free_dem_tile_cache(dem_config->dem_grid->tiles, verbose);
+  dem_config->dem_grid->tiles = NULL;
+  free_dem_grid(dem_config->dem_grid);
+  dem_config->dem_grid = NULL;
+ }
 // -- -- ---------------------------------- --
  if (time_message)
  {
@@ -2941,6 +6265,363 @@ command_updatez_db(sqlite3 *db_handle, struct config_dem*source_config, struct c
  return ret;
 }
 // -- -- ---------------------------------- --
+// Reading the points of -fetchz_file
+// - one 'x y' pair for each line [' ', tab, ',' or ';' separated]
+// - lines without a valid pair are kept as NaN,
+//   so that each line receives a result line
+// -- -- ---------------------------------- --
+static int
+read_fetchz_points(FILE *fp, double **xx, double **yy, int verbose)
+{
+ char line[MAXBUF];
+ char *next = NULL;
+ char *end = NULL;
+ double x=0.0;
+ double y=0.0;
+ int count_points=0;
+ int count_max=0;
+ int count_invalid=0;
+ size_t len=0;
+ *xx = NULL;
+ *yy = NULL;
+ while (fgets(line, sizeof (line), fp) != NULL)
+ {
+  len = strlen(line);
+  if ((len == sizeof (line) - 1) && (line[len-1] != '\n'))
+  {// skipping the rest of an overlong line
+   int c;
+   while (((c = fgetc(fp)) != EOF) && (c != '\n'))
+    ;
+  }
+  if (count_points == count_max)
+  {
+   count_max = (count_max == 0) ? 4096 : count_max * 2;
+   *xx = realloc(*xx, sizeof (double) * count_max);
+   *yy = realloc(*yy, sizeof (double) * count_max);
+  }
+  x = strtod(line, &end);
+  next = end;
+  while ((*next == ' ') || (*next == '\t') || (*next == ',') || (*next == ';'))
+  {
+   next++;
+  }
+  if ((end != line) && (next != end))
+  {
+   y = strtod(next, &end);
+  }
+  if ((end == line) || (end == next))
+  {
+   x = NAN;
+   y = NAN;
+   count_invalid++;
+  }
+  (*xx)[count_points] = x;
+  (*yy)[count_points] = y;
+  count_points++;
+ }
+ if ((verbose) && (count_invalid > 0))
+ {
+  fprintf(stderr, "-W-> read_fetchz_points: %d of %d lines without a valid x y pair\n",count_invalid,count_points);
+ }
+ return count_points;
+}
+// -- -- ---------------------------------- --
+// Implementation of command: fetchz, for many points
+// - from -fetchz_file [or '-' for stdin], each line a point
+//   using default_srid
+// - the points are transformed with one prepared statement
+//   and answered in Hilbert order, from a single Dem-Grid
+//   (covering all points) when the Dem is a regular grid
+// --> return point_z value for each line, in input order
+// -- -- ---------------------------------- --
+static int
+command_fetchz_batch(sqlite3 *db_handle, struct config_dem *dem_config, int verbose)
+{
+ int ret=0;
+ int i=0;
+ FILE *fp = NULL;
+ sqlite3_stmt *stmt = NULL;
+ char *sql_statement = NULL;
+ char *time_message = NULL;
+ struct timeval time_start;
+ struct timeval time_end;
+ struct timeval time_diff;
+ double *xx = NULL;
+ double *yy = NULL;
+ double *xx_use = NULL;
+ double *yy_use = NULL;
+ double *zz = NULL;
+ double *mm = NULL;
+ double *zz_use = NULL;
+ double *mm_use = NULL;
+ char *found = NULL;
+ char *found_use = NULL;
+ struct hilbert_rowid *order = NULL;
+ int count_points=0;
+ int count_use=0;
+ int count_found=0;
+ int i_count_z=0;
+ int i_count_m=0;
+ int use_window=1;
+ double minx=0.0;
+ double miny=0.0;
+ double maxx=0.0;
+ double maxy=0.0;
+ double margin=0.0;
+ double window_bytes=0.0;
+// -- -- ---------------------------------- --
+ if ((dem_config->default_srid <= 0) || (dem_config->dem_srid <= 0))
+ {
+  if (verbose)
+  {
+   if ( dem_config->default_srid <= 0)
+   {
+    fprintf(stderr, "did you forget setting the -default_srid argument ?\n");
+   }
+   if ( dem_config->dem_srid <= 0)
+   {
+    fprintf(stderr, "The dem-srid is invalid\n");
+   }
+   fprintf(stderr, "-E command_fetchz_batch: sorry, cowardly quitting\n\n");
+  }
+  return 0;
+ }
+ if (strcmp(dem_config->fetchz_file, "-") == 0)
+ {
+  fp = stdin;
+ }
+ else
+ {
+  fp = fopen(dem_config->fetchz_file, "r");
+ }
+ if (fp == NULL)
+ {
+  if (verbose)
+  {
+   fprintf(stderr, "-E-> command_fetchz_batch: cannot open [%s]\n",dem_config->fetchz_file);
+  }
+  return 0;
+ }
+ gettimeofday(&time_start, 0);
+ count_points = read_fetchz_points(fp, &xx, &yy, verbose);
+ if (fp != stdin)
+ {
+  fclose(fp);
+ }
+ if (count_points == 0)
+ {
+  if (verbose)
+  {
+   fprintf(stderr, "-W-> command_fetchz_batch: no points found in [%s]\n",dem_config->fetchz_file);
+  }
+  return 1;
+ }
+ if (verbose)
+ {
+  fprintf(stderr, "FetchZ modus: with default_srid[%d] points[%d] from [%s] has_m[%d]\n",dem_config->default_srid,count_points,dem_config->fetchz_file,dem_config->has_m);
+ }
+// -- -- ---------------------------------- --
+// transforming all points with the same prepared statement
+// -- -- ---------------------------------- --
+ if (dem_config->dem_srid != dem_config->default_srid )
+ {
+  sql_statement = sqlite3_mprintf("SELECT ST_X(point), ST_Y(point) FROM (SELECT ST_Transform(MakePoint(?,?,%d),%d) AS point)",
+                                  dem_config->default_srid,dem_config->dem_srid);
+  ret = sqlite3_prepare_v2( db_handle, sql_statement, -1, &stmt, NULL );
+  if ( ret != SQLITE_OK )
+  {
+   if (verbose)
+   {
+    fprintf(stderr, "-E-> command_fetchz_batch: rc=%d sql[%s]\n",ret,sql_statement);
+   }
+   sqlite3_free(sql_statement);
+   free(xx);
+   free(yy);
+   return 0;
+  }
+  sqlite3_free(sql_statement);
+  for (i=0; i<count_points; i++)
+  {
+   if (isnan(xx[i]))
+   {
+    continue;
+   }
+   sqlite3_reset(stmt);
+   sqlite3_bind_double(stmt, 1, xx[i]);
+   sqlite3_bind_double(stmt, 2, yy[i]);
+   if (( sqlite3_step( stmt ) == SQLITE_ROW ) &&
+       ( sqlite3_column_type( stmt, 0 ) != SQLITE_NULL ) &&
+       ( sqlite3_column_type( stmt, 1 ) != SQLITE_NULL ) )
+   {
+    xx[i] = sqlite3_column_double(stmt, 0);
+    yy[i] = sqlite3_column_double(stmt, 1);
+   }
+   else
+   {
+    xx[i] = NAN;
+    yy[i] = NAN;
+   }
+  }
+  sqlite3_finalize( stmt );
+  stmt = NULL;
+ }
+// -- -- ---------------------------------- --
+// only the points inside the Dem extent, in Hilbert order
+// -- -- ---------------------------------- --
+ zz = malloc(sizeof (double) * count_points);
+ mm = malloc(sizeof (double) * count_points);
+ found = malloc(sizeof (char) * count_points);
+ order = malloc(sizeof (struct hilbert_rowid) * count_points);
+ for (i=0; i<count_points; i++)
+ {
+  zz[i] = NAN;
+  mm[i] = NAN;
+  found[i] = 0;
+  if ((isnan(xx[i])) ||
+      (xx[i] < dem_config->dem_extent_minx) || (xx[i] > dem_config->dem_extent_maxx) ||
+      (yy[i] < dem_config->dem_extent_miny) || (yy[i] > dem_config->dem_extent_maxy))
+  {
+   continue;
+  }
+  if (count_use == 0)
+  {
+   minx = xx[i];
+   miny = yy[i];
+   maxx = xx[i];
+   maxy = yy[i];
+  }
+  minx = MIN(minx, xx[i]);
+  miny = MIN(miny, yy[i]);
+  maxx = MAX(maxx, xx[i]);
+  maxy = MAX(maxy, yy[i]);
+  order[count_use].rowid = i;
+  count_use++;
+ }
+ for (i=0; i<count_use; i++)
+ {
+  int cell_x=0;
+  int cell_y=0;
+  if (maxx > minx)
+  {
+   cell_x = (int)((xx[order[i].rowid] - minx) / (maxx - minx) * 65535.0);
+  }
+  if (maxy > miny)
+  {
+   cell_y = (int)((yy[order[i].rowid] - miny) / (maxy - miny) * 65535.0);
+  }
+  order[i].key = get_hilbert_key(cell_x, cell_y);
+ }
+ qsort(order, count_use, sizeof (struct hilbert_rowid), cmp_hilbert_rowid);
+ if (count_use > 0)
+ {
+  xx_use = malloc(sizeof (double) * count_use);
+  yy_use = malloc(sizeof (double) * count_use);
+  zz_use = malloc(sizeof (double) * count_use);
+  mm_use = malloc(sizeof (double) * count_use);
+  found_use = malloc(sizeof (char) * count_use);
+  for (i=0; i<count_use; i++)
+  {
+   xx_use[i] = xx[order[i].rowid];
+   yy_use[i] = yy[order[i].rowid];
+   zz_use[i] = NAN;
+   mm_use[i] = NAN;
+   found_use[i] = 0;
+  }
+// -- -- ---------------------------------- --
+// one Dem-Grid for all points: the window around them,
+// - or the whole Dem [Dem-Store when too big]
+//   when the window would not fit into -cdem
+// -- -- ---------------------------------- --
+  margin = dem_config->dem_resolution*2.0;
+  if (dem_config->dem_resolution > 0.0)
+  {
+   window_bytes = ((maxx-minx+(margin*2.0))/dem_config->dem_resolution) * ((maxy-miny+(margin*2.0))/dem_config->dem_resolution) * sizeof (float);
+  }
+  if ((dem_config->is_raster) || (window_bytes > (double)dem_config->cache_size * 1024.0 * 1024.0))
+  {
+   use_window = 0;
+  }
+  dem_config->dem_grid = load_dem_grid(db_handle, dem_config, use_window, minx-margin, miny-margin, maxx+margin, maxy+margin, verbose);
+  if ((dem_config->is_raster) && (dem_config->dem_grid == NULL))
+  {// a Dem-Raster has no POINTs to query
+   if (verbose)
+   {
+    fprintf(stderr,"-E-> command_fetchz_batch: the Dem-Raster [%s_tiles] could not be read\n",dem_config->dem_table);
+   }
+  }
+  else
+  {
+   dem_config->count_points=count_use;
+   retrieve_dem_points(db_handle, dem_config, count_use, xx_use, yy_use, zz_use, mm_use, found_use, &i_count_z, &i_count_m, verbose);
+   for (i=0; i<count_use; i++)
+   {
+    found[order[i].rowid] = found_use[i];
+    if (found_use[i])
+    {// 0.0 is never written by retrieve_dem_points
+     zz[order[i].rowid] = isnan(zz_use[i]) ? 0.0 : zz_use[i];
+    }
+    mm[order[i].rowid] = mm_use[i];
+   }
+  }
+  if (dem_config->dem_grid)
+  {
+   free_dem_tile_cache(dem_config->dem_grid->tiles, verbose);
+   dem_config->dem_grid->tiles = NULL;
+   free_dem_grid(dem_config->dem_grid);
+   dem_config->dem_grid = NULL;
+  }
+  free(xx_use);
+  free(yy_use);
+  free(zz_use);
+  free(mm_use);
+  free(found_use);
+ }
+// -- -- ---------------------------------- --
+// the results in input order, 'nan' when not found
+// -- -- ---------------------------------- --
+ for (i=0; i<count_points; i++)
+ {
+  if (!found[i])
+  {
+   printf("nan\n");
+   continue;
+  }
+  count_found++;
+  if (dem_config->has_m)
+  {
+   printf("%2.7f %2.7f\n", zz[i],isnan(mm[i]) ? 0.0 : mm[i]);
+  }
+  else
+  {
+   printf("%2.7f\n", zz[i]);
+  }
+ }
+ fflush(stdout);
+ gettimeofday(&time_end, 0);
+ timeval_subtract(&time_diff,&time_end,&time_start,&time_message);
+ if (verbose)
+ {
+  fprintf(stderr,"-I-> points total[%d] inside the Dem extent[%d] found[%d]\n",count_points,count_use,count_found);
+  if ((time_diff.tv_sec > 0) || (time_diff.tv_usec > 0))
+  {
+   fprintf(stderr,"-I-> throughput: %2.0f points/sec\n",(double)count_points/((double)time_diff.tv_sec+((double)time_diff.tv_usec/1000000.0)));
+  }
+  fprintf(stderr,"%s\n", time_message);
+ }
+ if (time_message)
+ {
+  sqlite3_free(time_message);
+  time_message = NULL;
+ }
+ free(order);
+ free(xx);
+ free(yy);
+ free(zz);
+ free(mm);
+ free(found);
+ return 1;
+}
+// -- -- ---------------------------------- --
 // Implementation of command: fetchz
 // - from a given srid, point_x,point_y
 // --> return point_z value
@@ -3043,6 +6724,7 @@ command_dem_create(sqlite3 **db_handle, void *cache, struct config_dem *source_c
  struct timeval time_end;
  struct timeval time_diff;
  int count_xyz_files=0;
+ int ret_raster=0;
 // -- -- ---------------------------------- --
  if (cache)
  {
@@ -3059,10 +6741,20 @@ command_dem_create(sqlite3 **db_handle, void *cache, struct config_dem *source_c
     {
      fprintf(stderr,"-I-> command_dem_createt: created [%s] \n", dem_config->dem_path);
     }
+    start_dem_profile(dem_config->profile, *db_handle);
+    dem_profile_switch(dem_config->profile, DEM_PHASE_READ);
     if (collect_xyz_files(*db_handle,source_config->dem_path, &count_xyz_files, 0) == 1)
     {
      dem_config->dem_rows_count=0;
-     if (import_xyz(*db_handle, dem_config,count_xyz_files,verbose))
+     if (dem_config->is_raster)
+     {// stored as Dem-Raster, if the points are a regular grid
+      ret_raster=import_dem_raster(*db_handle, dem_config, count_xyz_files, verbose);
+      if (ret_raster == 0)
+      {
+       dem_config->is_raster=0;
+      }
+     }
+     if ((ret_raster > 0) || ((ret_raster == 0) && (import_xyz(*db_handle, dem_config, NULL, count_xyz_files, verbose))))
      {// Import completed correctly
       gettimeofday(&time_end, 0);
       timeval_subtract(&time_diff,&time_end,&time_start,&time_message);
@@ -3071,6 +6763,7 @@ command_dem_create(sqlite3 **db_handle, void *cache, struct config_dem *source_c
        fprintf(stderr,"%s\n", time_message);
       }
       gettimeofday(&time_start, 0);
+      dem_profile_switch(dem_config->profile, DEM_PHASE_INDEX);
       if (recover_geometry_dem(*db_handle, dem_config,verbose))
       {// Task completed correctly
       }
@@ -3081,6 +6774,7 @@ command_dem_create(sqlite3 **db_handle, void *cache, struct config_dem *source_c
         fprintf(stderr,"-W-> command_dem_created: recover_geometry_dem failed [%s(%s)]  srid[%d]  \n", dem_config->dem_table, dem_config->dem_geometry, dem_config->dem_srid);
        }
       }
+      dem_profile_switch(dem_config->profile, DEM_PHASE_SETUP);
       // Sniff the results, set schema_dem to 'main'
       dem_config->schema=source_config->schema;
       source_config->schema=NULL;
@@ -3177,10 +6871,15 @@ command_import_xyz(sqlite3 *db_handle, struct config_dem *source_config, struct
     {
      fprintf(stderr, "-import_xyz: with srid[%d] .xyz[%s] \n",source_config->default_srid,source_config->dem_path);
     }
-    if (collect_xyz_files(db_handle,source_config->dem_path, &count_xyz_files, 0) == 1)
+    dem_profile_switch(dem_config->profile, DEM_PHASE_READ);
+    if (dem_config->is_raster)
+    {
+     fprintf(stderr, "-E-> -import_xyz: [%s] is a Dem-Raster, create it again with all xyz-files using -create_dem -raster\n",dem_config->dem_table);
+    }
+    else if (collect_xyz_files(db_handle,source_config->dem_path, &count_xyz_files, 0) == 1)
     {
      dem_config->dem_rows_count=0; // Set to 0, just in case
-     if (import_xyz(db_handle, dem_config,count_xyz_files,verbose))
+     if (import_xyz(db_handle, dem_config, NULL, count_xyz_files, verbose))
      {// Import completed correctly
       gettimeofday(&time_end, 0);
       timeval_subtract(&time_diff,&time_end,&time_start,&time_message);
@@ -3193,6 +6892,7 @@ command_import_xyz(sqlite3 *db_handle, struct config_dem *source_config, struct
       {
        fprintf(stderr,"UpdateLayerStatistics:  %s(%s)\n", dem_config->dem_table,dem_config->dem_geometry);
       }
+      dem_profile_switch(dem_config->profile, DEM_PHASE_INDEX);
       sql_statement = sqlite3_mprintf("SELECT UpdateLayerStatistics(%Q, %Q)", dem_config->dem_table,dem_config->dem_geometry);
       int ret_update = sqlite3_exec(db_handle, sql_statement, NULL, NULL, &err_msg);
       sqlite3_free(sql_statement);
@@ -3205,6 +6905,7 @@ command_import_xyz(sqlite3 *db_handle, struct config_dem *source_config, struct
       {
        ret=1;
       }
+      dem_profile_switch(dem_config->profile, DEM_PHASE_SETUP);
       gettimeofday(&time_end, 0);
       timeval_subtract(&time_diff,&time_end,&time_start,&time_message);
       if (verbose)
@@ -3249,6 +6950,7 @@ main(int argc, char *argv[])
  int i_sniff_on=0;
  struct config_dem dem_config;
  struct config_dem source_config;
+ struct dem_profile profile;
  int save_conf=0;
  int exit_code=1; // unix_exit_code: 0=correct, 1=error
  int i=0;
@@ -3270,6 +6972,7 @@ main(int argc, char *argv[])
 // -- -- ---------------------------------- --
 // Warning, if non default, conf is given but not found
 // -- -- ---------------------------------- --
+ init_dem_profile(&profile, DEM_PHASE_SETUP);
  dem_config = get_demconfig(dem_configfile,1);
  dem_config.config_type = CONF_TYPE_DEM; // dem
  dem_config.schema = schema_dem;  // dem
@@ -3340,10 +7043,51 @@ main(int argc, char *argv[])
      dem_config.fetchz_x = atof(argv[i++]);
      dem_config.fetchz_y = atof(argv[i]);
      break;
+    case ARG_FETCHZ_FILE:
+     strcpy(dem_config.fetchz_file,argv[i]);
+     break;
+    case ARG_PROFILE:
+     strcpy(profile.json_path,argv[i]);
+     dem_config.profile = &profile;
+     break;
     case ARG_DEFAULT_SRID:
      source_config.default_srid = atoi(argv[i]);
      dem_config.default_srid = atoi(argv[i]);
      break;
+    case ARG_INTERPOLATION_DEM:
+     if (strcasecmp(argv[i], "nearest") == 0)
+     {
+      dem_config.interpolation = DEM_INTERPOLATION_NEAREST;
+     }
+     else if (strcasecmp(argv[i], "bilinear") == 0)
+     {
+      dem_config.interpolation = DEM_INTERPOLATION_BILINEAR;
+     }
+     else if (strcasecmp(argv[i], "bicubic") == 0)
+     {
+      dem_config.interpolation = DEM_INTERPOLATION_BICUBIC;
+     }
+     else
+     {
+      fprintf(stderr, "unknown interpolation: %s\n", argv[i]);
+      error = 1;
+     }
+     break;
+    case ARG_THREADS:
+     dem_config.threads = atoi(argv[i]);
+     if (dem_config.threads < 1)
+     {
+      dem_config.threads = 1;
+     }
+     break;
+    case ARG_CACHE_SIZE_DEM:
+     dem_config.cache_size = atoi(argv[i]);
+     if (dem_config.cache_size < 1)
+     {
+      fprintf(stderr, "invalid Dem cache size: %s\n", argv[i]);
+      error = 1;
+     }
+     break;
    };
    next_arg = ARG_NONE;
    continue;
@@ -3423,6 +7167,41 @@ main(int argc, char *argv[])
    next_arg = ARG_RESOLUTION_DEM;
    continue;
   }
+  if (strcasecmp (argv[i], "--dem-interpolation") == 0)
+  {
+   next_arg = ARG_INTERPOLATION_DEM;
+   continue;
+  }
+  if (strcmp(argv[i], "-idem") == 0)
+  {
+   next_arg = ARG_INTERPOLATION_DEM;
+   continue;
+  }
+  if ((strcasecmp (argv[i], "--threads") == 0) || (strcmp(argv[i], "-threads") == 0))
+  {
+   next_arg = ARG_THREADS;
+   continue;
+  }
+  if (strcasecmp (argv[i], "--dem-cache-size") == 0)
+  {
+   next_arg = ARG_CACHE_SIZE_DEM;
+   continue;
+  }
+  if (strcmp(argv[i], "-cdem") == 0)
+  {
+   next_arg = ARG_CACHE_SIZE_DEM;
+   continue;
+  }
+  if ((strcasecmp (argv[i], "--dem-raster") == 0) || (strcmp(argv[i], "-raster") == 0))
+  {
+   dem_config.is_raster = 1;
+   continue;
+  }
+  if ((strcasecmp (argv[i], "--profile-json") == 0) || (strcmp(argv[i], "-profile") == 0))
+  {
+   next_arg = ARG_PROFILE;
+   continue;
+  }
   if (strcasecmp (argv[i], "--m-copy") == 0)
   {
    next_arg = ARG_COPY_M;
@@ -3474,6 +7253,11 @@ main(int argc, char *argv[])
    next_arg = ARG_FETCHZ_XY;
    continue;
   }
+  if (strcmp(argv[i], "-fetchz_file") == 0)
+  {
+   next_arg = ARG_FETCHZ_FILE;
+   continue;
+  }
   if ( (strcmp(argv[i], "-default_srid") == 0) ||  (strcmp(argv[i], "--srid") == 0) )
   {
    next_arg = ARG_DEFAULT_SRID;
@@ -3506,7 +7290,7 @@ main(int argc, char *argv[])
  if ( (i_command_type == CMD_DEM_SNIFF) || (i_sniff_on == 1) )
  {
   if ((strlen(dem_config.dem_path) > 0) && (strlen(dem_config.dem_table) > 0) && (strlen(dem_config.dem_geometry) > 0) &&
-      (dem_config.fetchz_x != 0.0) && (dem_config.fetchz_x != dem_config.fetchz_y) )
+      (((dem_config.fetchz_x != 0.0) && (dem_config.fetchz_x != dem_config.fetchz_y)) || (strlen(dem_config.fetchz_file) > 0)) )
   {// -fetchz was intended but forgotten, be tolerant to the lazy user
    i_command_type = CMD_DEM_FETCHZ;
   }
@@ -3545,6 +7329,28 @@ main(int argc, char *argv[])
   return exit_code;
  }
 // -- -- ---------------------------------- --
+// the command being profiled [-profile]
+// -- -- ---------------------------------- --
+ switch (i_command_type)
+ {
+  case CMD_DEM_UPDATEZ:
+   profile.command = "updatez";
+   break;
+  case CMD_DEM_FETCHZ:
+   profile.command = "fetchz";
+   break;
+  case CMD_DEM_CREATE:
+   profile.command = "create_dem";
+   break;
+  case CMD_DEM_IMPORT_XYZ:
+   profile.command = "import_xyz";
+   break;
+  default:
+   profile.command = "sniff";
+   break;
+ };
+ profile.threads = dem_config.threads;
+// -- -- ---------------------------------- --
 // opening the DB
 // - method 1: create a new Database
 // - method 2: input is not a Database, only Dem
@@ -3576,10 +7382,12 @@ main(int argc, char *argv[])
 // -- -- ---------------------------------- --
  if (!db_handle)
  {
+  write_dem_profile(dem_config.profile, NULL, &dem_config, exit_code, verbose);
   spatialite_cleanup_ex(cache);
   cache=NULL;
   return exit_code;
  }
+ start_dem_profile(dem_config.profile, db_handle);
 // -- -- ---------------------------------- --
 // checking the Source-Database
 // -- -- ---------------------------------- --
@@ -3644,7 +7452,14 @@ main(int argc, char *argv[])
   // -- -- ---------------------------------- --
   if (i_command_type == CMD_DEM_FETCHZ)
   {
-   if (command_fetchz(db_handle, &dem_config, verbose) )
+   if (strlen(dem_config.fetchz_file) > 0)
+   {
+    if (command_fetchz_batch(db_handle, &dem_config, verbose) )
+    {
+     exit_code = 0; // correct
+    }
+   }
+   else if (command_fetchz(db_handle, &dem_config, verbose) )
    {
     exit_code = 0; // correct
    }
@@ -3678,6 +7493,7 @@ main(int argc, char *argv[])
 // Close Application
 // - DETACH when needed
 // -- -- ---------------------------------- --
+ write_dem_profile(dem_config.profile, db_handle, &dem_config, exit_code, verbose);
  if (db_handle)
  {
   close_db(db_handle,cache, schema_dem);
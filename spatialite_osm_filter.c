@@ -33,6 +33,12 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <zlib.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 #if defined(_WIN32) && !defined(__MINGW32__)
 #include "config-msvc.h"
 #else
@@ -54,765 +60,1493 @@
 #define ARG_DB_PATH		2
 #define ARG_CACHE_SIZE	3
 #define ARG_MASK_PATH	4
+#define ARG_THREADS	5
+
+#define OSM_NODE	1
+#define OSM_WAY		2
+#define OSM_RELATION	3
 
 #if defined(_WIN32) && !defined(__MINGW32__)
 #define strcasecmp	_stricmp
 #endif /* not WIN32 */
 
-static char *
-clean_xml (const char *in)
+#define XML_WRITER_BUFSZ	(4 * 1024 * 1024)
+
+struct xml_writer
 {
-/* well formatting XML text strings */
-    int len = 0;
+/* a large buffered writer for the OSM-XML output */
+    FILE *out;
     char *buf;
-    char *p_o;
-    const char *p_i = in;
+    int len;
+    int error;
+};
+
+static struct xml_writer *
+alloc_xml_writer (FILE * out)
+{
+/* creating the buffered writer */
+    struct xml_writer *w = malloc (sizeof (struct xml_writer));
+    w->out = out;
+    w->buf = malloc (XML_WRITER_BUFSZ);
+    w->len = 0;
+    w->error = 0;
+    return w;
+}
+
+static void
+xml_writer_flush (struct xml_writer *w)
+{
+/* flushing the buffer into the output file */
+    if (w->len > 0)
+      {
+	  if (fwrite (w->buf, 1, w->len, w->out) != (size_t) (w->len))
+	      w->error = 1;
+      }
+    w->len = 0;
+}
+
+static void
+free_xml_writer (struct xml_writer *w)
+{
+/* destroying the buffered writer */
+    if (w == NULL)
+	return;
+    xml_writer_flush (w);
+    free (w->buf);
+    free (w);
+}
+
+static void
+xml_write (struct xml_writer *w, const char *str, int len)
+{
+/* appending raw bytes */
+    if (w->len + len > XML_WRITER_BUFSZ)
+	xml_writer_flush (w);
+    if (len > XML_WRITER_BUFSZ)
+      {
+	  /* oversized string: directly written */
+	  if (fwrite (str, 1, len, w->out) != (size_t) len)
+	      w->error = 1;
+	  return;
+      }
+    memcpy (w->buf + w->len, str, len);
+    w->len += len;
+}
+
+static void
+xml_write_str (struct xml_writer *w, const char *str)
+{
+/* appending a plain (already well formatted) string */
+    xml_write (w, str, strlen (str));
+}
+
+static void
+xml_write_escaped (struct xml_writer *w, const char *str)
+{
+/* appending a text string, well formatting any XML special char */
+    const char *p_i = str;
+    if (p_i == NULL)
+	return;
     while (*p_i != '\0')
       {
-	  /* calculating the output len */
-	  if (*p_i == '"')
-	    {
-		len += 6;
-		p_i++;
-		continue;
-	    }
-	  if (*p_i == '\'')
-	    {
-		len += 6;
-		p_i++;
-		continue;
-	    }
-	  if (*p_i == '&')
-	    {
-		len += 5;
-		p_i++;
-		continue;
-	    }
-	  if (*p_i == '<')
-	    {
-		len += 4;
-		p_i++;
-		continue;
-	    }
-	  if (*p_i == '>')
+	  const char *entity;
+	  int entity_len;
+	  const char *p_run = p_i;
+	  while (*p_i != '\0' && *p_i != '"' && *p_i != '\'' && *p_i != '&'
+		 && *p_i != '<' && *p_i != '>')
+	      p_i++;
+	  if (p_i > p_run)
+	      xml_write (w, p_run, p_i - p_run);
+	  switch (*p_i)
 	    {
-		len += 4;
-		p_i++;
-		continue;
-	    }
-	  len++;
+	    case '"':
+		entity = "&quot;";
+		entity_len = 6;
+		break;
+	    case '\'':
+		entity = "&apos;";
+		entity_len = 6;
+		break;
+	    case '&':
+		entity = "&amp;";
+		entity_len = 5;
+		break;
+	    case '<':
+		entity = "&lt;";
+		entity_len = 4;
+		break;
+	    case '>':
+		entity = "&gt;";
+		entity_len = 4;
+		break;
+	    default:
+		/* end of string */
+		return;
+	    };
+	  xml_write (w, entity, entity_len);
 	  p_i++;
       }
+}
 
-    buf = malloc (len + 1);
-    p_o = buf;
-    p_i = in;
-    while (*p_i != '\0')
+static void
+xml_write_int64 (struct xml_writer *w, sqlite3_int64 value)
+{
+/* appending an integer value */
+    char buf[32];
+    char *p = buf + sizeof (buf);
+    sqlite3_uint64 v;
+    int negative = 0;
+    if (value < 0)
       {
-	  if (*p_i == '"')
-	    {
-		*p_o++ = '&';
-		*p_o++ = 'q';
-		*p_o++ = 'u';
-		*p_o++ = 'o';
-		*p_o++ = 't';
-		*p_o++ = ';';
-		p_i++;
-		continue;
-	    }
-	  if (*p_i == '\'')
-	    {
-		*p_o++ = '&';
-		*p_o++ = 'a';
-		*p_o++ = 'p';
-		*p_o++ = 'o';
-		*p_o++ = 's';
-		*p_o++ = ';';
-		p_i++;
-		continue;
-	    }
-	  if (*p_i == '&')
-	    {
-		*p_o++ = '&';
-		*p_o++ = 'a';
-		*p_o++ = 'm';
-		*p_o++ = 'p';
-		*p_o++ = ';';
-		p_i++;
-		continue;
-	    }
-	  if (*p_i == '<')
+	  negative = 1;
+	  v = (sqlite3_uint64) (-(value + 1)) + 1;
+      }
+    else
+	v = value;
+    do
+      {
+	  *--p = '0' + (char) (v % 10);
+	  v /= 10;
+      }
+    while (v != 0);
+    if (negative)
+	*--p = '-';
+    xml_write (w, p, (buf + sizeof (buf)) - p);
+}
+
+static void
+xml_write_coord (struct xml_writer *w, double value)
+{
+/* appending a Lat or Lon value */
+    char buf[64];
+    int len = sprintf (buf, "%1.7f", value);
+    xml_write (w, buf, len);
+}
+
+static void
+xml_write_header (struct xml_writer *out, const char *element,
+		  sqlite3_stmt * stmt)
+{
+/* 
+/ appending the common attributes of some Node, Way or Relation
+/ the statement is expected to return:
+/ id, version, timestamp, uid, user, changeset
+*/
+    int version = sqlite3_column_int (stmt, 1);
+    xml_write_str (out, "\t<");
+    xml_write_str (out, element);
+    xml_write_str (out, " id=\"");
+    xml_write_int64 (out, sqlite3_column_int64 (stmt, 0));
+    xml_write_str (out, "\"");
+    if (sqlite3_column_type (stmt, 4) != SQLITE_NULL)
+      {
+	  xml_write_str (out, " user=\"");
+	  xml_write_escaped (out, (const char *) sqlite3_column_text (stmt, 4));
+	  xml_write_str (out, "\"");
+      }
+    if (sqlite3_column_type (stmt, 5) != SQLITE_NULL)
+      {
+	  xml_write_str (out, " changeset=\"");
+	  xml_write_escaped (out, (const char *) sqlite3_column_text (stmt, 5));
+	  xml_write_str (out, "\"");
+      }
+    if (sqlite3_column_type (stmt, 2) != SQLITE_NULL)
+      {
+	  xml_write_str (out, " timestamp=\"");
+	  xml_write_escaped (out, (const char *) sqlite3_column_text (stmt, 2));
+	  xml_write_str (out, "\"");
+      }
+    if (!version)
+	version = 1;
+    xml_write_str (out, " version=\"");
+    xml_write_int64 (out, version);
+    xml_write_str (out, "\"");
+}
+
+static void
+xml_write_tag (struct xml_writer *out, sqlite3_stmt * stmt)
+{
+/* appending a tag - the statement is expected to return: id, k, v */
+    xml_write_str (out, "\t\t<tag k=\"");
+    xml_write_escaped (out, (const char *) sqlite3_column_text (stmt, 1));
+    xml_write_str (out, "\" v=\"");
+    xml_write_escaped (out, (const char *) sqlite3_column_text (stmt, 2));
+    xml_write_str (out, "\"/>\n");
+}
+
+#define PBF_MAX_ENTITIES	8000
+#define PBF_MAX_BLOCK_SIZE	(8 * 1024 * 1024)
+
+#define BLOB_FREE	0
+#define BLOB_PENDING	1
+#define BLOB_RUNNING	2
+#define BLOB_READY	3
+
+struct pbf_buffer
+{
+/* a growable buffer of Protocol Buffers encoded bytes */
+    unsigned char *buf;
+    size_t len;
+    size_t size;
+};
+
+struct pbf_blob_job
+{
+/* a Blob waiting to be compressed and then written */
+    const char *type;
+    struct pbf_buffer data;
+    struct pbf_buffer zbuf;
+    int status;
+    int error;
+};
+
+struct pbf_string_table
+{
+/* the StringTable of the current PrimitiveBlock */
+    char **strings;
+    int *lengths;
+    int count;
+    int alloc;
+    int *hash;
+    int hash_size;
+    size_t bytes;
+};
+
+struct pbf_writer
+{
+/* the OSM-PBF output writer */
+    FILE *out;
+    int error;
+    int kind;
+    int count;
+    struct pbf_string_table strings;
+/* DenseNodes: one buffer for each (packed) column */
+    struct pbf_buffer ids;
+    struct pbf_buffer lats;
+    struct pbf_buffer lons;
+    struct pbf_buffer keys_vals;
+    struct pbf_buffer versions;
+    struct pbf_buffer timestamps;
+    struct pbf_buffer changesets;
+    struct pbf_buffer uids;
+    struct pbf_buffer user_sids;
+    sqlite3_int64 last_id;
+    sqlite3_int64 last_lat;
+    sqlite3_int64 last_lon;
+    sqlite3_int64 last_timestamp;
+    sqlite3_int64 last_changeset;
+    sqlite3_int64 last_uid;
+    sqlite3_int64 last_user_sid;
+/* the current Way or Relation */
+    sqlite3_int64 cur_id;
+    int cur_version;
+    sqlite3_int64 cur_timestamp;
+    sqlite3_int64 cur_changeset;
+    int cur_uid;
+    int cur_user_sid;
+    sqlite3_int64 last_ref;
+    struct pbf_buffer keys;
+    struct pbf_buffer vals;
+    struct pbf_buffer refs;
+    struct pbf_buffer roles;
+    struct pbf_buffer types;
+/* all Ways or Relations already encoded within the current block */
+    struct pbf_buffer group;
+/* work buffers */
+    struct pbf_buffer entity;
+    struct pbf_buffer block;
+    struct pbf_buffer blob;
+    struct pbf_buffer header;
+    struct pbf_buffer zbuf;
+/* the zlib compressors: Blobs are always written in submission order */
+    struct pbf_blob_job *jobs;
+    int n_jobs;
+    int submitted;
+    int written;
+    int n_workers;
+    int quit;
+#ifndef _WIN32
+    pthread_t *workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+};
+
+static void
+pbf_buffer_reserve (struct pbf_buffer *b, size_t len)
+{
+/* ensuring that LEN more bytes could be safely appended */
+    if (b->len + len <= b->size)
+	return;
+    if (b->size == 0)
+	b->size = 1024;
+    while (b->len + len > b->size)
+	b->size *= 2;
+    b->buf = realloc (b->buf, b->size);
+}
+
+static void
+pbf_buffer_free (struct pbf_buffer *b)
+{
+/* memory cleanup - releasing a buffer */
+    if (b->buf != NULL)
+	free (b->buf);
+    b->buf = NULL;
+    b->len = 0;
+    b->size = 0;
+}
+
+static void
+pbf_put_varint (struct pbf_buffer *b, sqlite3_uint64 value)
+{
+/* appending a Base-128 Varint */
+    pbf_buffer_reserve (b, 10);
+    while (value >= 0x80)
+      {
+	  b->buf[b->len++] = (unsigned char) ((value & 0x7f) | 0x80);
+	  value >>= 7;
+      }
+    b->buf[b->len++] = (unsigned char) value;
+}
+
+static void
+pbf_put_sint (struct pbf_buffer *b, sqlite3_int64 value)
+{
+/* appending a ZigZag encoded signed Varint */
+    sqlite3_uint64 zz = ((sqlite3_uint64) value << 1) ^ (value < 0 ? ~0 : 0);
+    pbf_put_varint (b, zz);
+}
+
+static void
+pbf_put_int (struct pbf_buffer *b, int field, sqlite3_int64 value)
+{
+/* appending a Varint field */
+    pbf_put_varint (b, (field << 3) | 0);
+    pbf_put_varint (b, (sqlite3_uint64) value);
+}
+
+static void
+pbf_put_bytes (struct pbf_buffer *b, int field, const void *data, size_t len)
+{
+/* appending a Length-delimited field */
+    pbf_put_varint (b, (field << 3) | 2);
+    pbf_put_varint (b, len);
+    pbf_buffer_reserve (b, len);
+    if (len > 0)
+	memcpy (b->buf + b->len, data, len);
+    b->len += len;
+}
+
+static void
+pbf_put_buffer (struct pbf_buffer *b, int field, struct pbf_buffer *value)
+{
+/* appending a whole buffer as a Length-delimited field */
+    pbf_put_bytes (b, field, value->buf, value->len);
+}
+
+static void
+pbf_put_packed (struct pbf_buffer *b, int field, struct pbf_buffer *value)
+{
+/* appending a Packed Repeated field (omitted if empty) */
+    if (value->len > 0)
+	pbf_put_buffer (b, field, value);
+}
+
+static void
+pbf_reset_strings (struct pbf_string_table *st)
+{
+/*
+/ resetting the StringTable - index #0 always is an unused empty string
+/ (0 terminates the tags of each DenseNode, so it can't be a real key)
+*/
+    int i;
+    for (i = 0; i < st->count; i++)
+	free (st->strings[i]);
+    st->count = 0;
+    st->bytes = 0;
+    for (i = 0; i < st->hash_size; i++)
+	st->hash[i] = -1;
+    st->strings[st->count] = malloc (1);
+    *(st->strings[st->count]) = '\0';
+    st->lengths[st->count] = 0;
+    st->count++;
+}
+
+static unsigned int
+pbf_hash_string (const char *str, int len)
+{
+/* FNV-1a hash */
+    unsigned int h = 2166136261u;
+    int i;
+    for (i = 0; i < len; i++)
+      {
+	  h ^= (unsigned char) str[i];
+	  h *= 16777619u;
+      }
+    return h;
+}
+
+static void
+pbf_rehash_strings (struct pbf_string_table *st)
+{
+/* doubling the size of the StringTable hash */
+    int i;
+    free (st->hash);
+    st->hash_size *= 2;
+    st->hash = malloc (sizeof (int) * st->hash_size);
+    for (i = 0; i < st->hash_size; i++)
+	st->hash[i] = -1;
+    for (i = 1; i < st->count; i++)
+      {
+	  unsigned int slot =
+	      pbf_hash_string (st->strings[i],
+			       st->lengths[i]) & (st->hash_size - 1);
+	  while (st->hash[slot] >= 0)
+	      slot = (slot + 1) & (st->hash_size - 1);
+	  st->hash[slot] = i;
+      }
+}
+
+static int
+pbf_string_id (struct pbf_writer *w, const char *str)
+{
+/*
+/ returning the StringTable index of some string (inserting if new)
+/ an empty [or NULL] string is a real entry as well, never #0
+*/
+    struct pbf_string_table *st = &(w->strings);
+    unsigned int slot;
+    int len;
+    if (str == NULL)
+	str = "";
+    len = strlen (str);
+    slot = pbf_hash_string (str, len) & (st->hash_size - 1);
+    while (st->hash[slot] >= 0)
+      {
+	  int idx = st->hash[slot];
+	  if (st->lengths[idx] == len && memcmp (st->strings[idx], str, len) == 0)
+	      return idx;
+	  slot = (slot + 1) & (st->hash_size - 1);
+      }
+/* inserting a new string */
+    if (st->count == st->alloc)
+      {
+	  st->alloc *= 2;
+	  st->strings = realloc (st->strings, sizeof (char *) * st->alloc);
+	  st->lengths = realloc (st->lengths, sizeof (int) * st->alloc);
+      }
+    st->strings[st->count] = malloc (len + 1);
+    memcpy (st->strings[st->count], str, len + 1);
+    st->lengths[st->count] = len;
+    st->hash[slot] = st->count;
+    st->bytes += len;
+    st->count++;
+    if (st->count * 2 > st->hash_size)
+	pbf_rehash_strings (st);
+    return st->count - 1;
+}
+
+static sqlite3_int64
+pbf_parse_timestamp (const char *timestamp)
+{
+/* converting an OSM timestamp [YYYY-MM-DDTHH:MM:SSZ] into Unix seconds */
+    int year;
+    int month;
+    int day;
+    int hour;
+    int min;
+    int sec;
+    int era;
+    int yoe;
+    int doy;
+    int doe;
+    sqlite3_int64 days;
+    if (timestamp == NULL)
+	return 0;
+    if (sscanf
+	(timestamp, "%d-%d-%dT%d:%d:%d", &year, &month, &day, &hour, &min,
+	 &sec) != 6)
+	return 0;
+    if (month < 1 || month > 12 || day < 1 || day > 31)
+	return 0;
+/* days since 1970-01-01 (proleptic Gregorian calendar) */
+    year -= (month <= 2) ? 1 : 0;
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = year - (era * 400);
+    doy = ((153 * (month + (month > 2 ? -3 : 9))) + 2) / 5 + day - 1;
+    doe = (yoe * 365) + (yoe / 4) - (yoe / 100) + doy;
+    days = ((sqlite3_int64) era * 146097) + doe - 719468;
+    return (days * 86400) + (hour * 3600) + (min * 60) + sec;
+}
+
+static sqlite3_int64
+pbf_coord (double value)
+{
+/* converting a Lat or Lon value into a PBF integer [granularity = 100] */
+    double v = value * 10000000.0;
+    return (sqlite3_int64) (v < 0.0 ? v - 0.5 : v + 0.5);
+}
+
+static void
+pbf_swap_buffers (struct pbf_buffer *a, struct pbf_buffer *b)
+{
+/* exchanging the contents of two buffers (no copy at all) */
+    struct pbf_buffer x = *a;
+    *a = *b;
+    *b = x;
+}
+
+static int
+pbf_compress (struct pbf_buffer *data, struct pbf_buffer *zbuf)
+{
+/* zlib compressing a Blob */
+    uLongf zlen;
+
+    zlen = compressBound (data->len);
+    zbuf->len = 0;
+    pbf_buffer_reserve (zbuf, zlen);
+    if (compress2 (zbuf->buf, &zlen, data->buf, data->len, Z_DEFAULT_COMPRESSION)
+	!= Z_OK)
+	return 0;
+    zbuf->len = zlen;
+    return 1;
+}
+
+static void
+pbf_emit_blob (struct pbf_writer *w, const char *type, size_t raw_len,
+	       struct pbf_buffer *zbuf)
+{
+/* writing a compressed Blob preceded by its BlobHeader */
+    unsigned char size[4];
+
+/* the Blob */
+    w->blob.len = 0;
+    pbf_put_int (&(w->blob), 2, raw_len);
+    pbf_put_buffer (&(w->blob), 3, zbuf);
+
+/* the BlobHeader */
+    w->header.len = 0;
+    pbf_put_bytes (&(w->header), 1, type, strlen (type));
+    pbf_put_int (&(w->header), 3, w->blob.len);
+
+/* BlobHeader length is a 4-bytes Big Endian integer */
+    size[0] = (unsigned char) ((w->header.len >> 24) & 0xff);
+    size[1] = (unsigned char) ((w->header.len >> 16) & 0xff);
+    size[2] = (unsigned char) ((w->header.len >> 8) & 0xff);
+    size[3] = (unsigned char) (w->header.len & 0xff);
+    if (fwrite (size, 1, 4, w->out) != 4)
+	w->error = 1;
+    if (fwrite (w->header.buf, 1, w->header.len, w->out) != w->header.len)
+	w->error = 1;
+    if (fwrite (w->blob.buf, 1, w->blob.len, w->out) != w->blob.len)
+	w->error = 1;
+}
+
+#ifndef _WIN32
+static void *
+pbf_compress_worker (void *arg)
+{
+/* a compressor thread: any pending Blob is compressed in turn */
+    struct pbf_writer *w = (struct pbf_writer *) arg;
+    while (1)
+      {
+	  struct pbf_blob_job *job = NULL;
+	  int i;
+	  int ok;
+	  pthread_mutex_lock (&(w->mutex));
+	  while (1)
 	    {
-		*p_o++ = '&';
-		*p_o++ = 'l';
-		*p_o++ = 't';
-		*p_o++ = ';';
-		p_i++;
-		continue;
+		for (i = w->written; i < w->submitted; i++)
+		  {
+		      if (w->jobs[i % w->n_jobs].status == BLOB_PENDING)
+			{
+			    job = w->jobs + (i % w->n_jobs);
+			    break;
+			}
+		  }
+		if (job != NULL || w->quit)
+		    break;
+		pthread_cond_wait (&(w->cond), &(w->mutex));
 	    }
-	  if (*p_i == '>')
+	  if (job == NULL)
 	    {
-		*p_o++ = '&';
-		*p_o++ = 'g';
-		*p_o++ = 't';
-		*p_o++ = ';';
-		p_i++;
-		continue;
+		pthread_mutex_unlock (&(w->mutex));
+		break;
 	    }
-	  *p_o++ = *p_i++;
+	  job->status = BLOB_RUNNING;
+	  pthread_mutex_unlock (&(w->mutex));
+
+	  ok = pbf_compress (&(job->data), &(job->zbuf));
+
+	  pthread_mutex_lock (&(w->mutex));
+	  job->error = !ok;
+	  job->status = BLOB_READY;
+	  pthread_cond_broadcast (&(w->cond));
+	  pthread_mutex_unlock (&(w->mutex));
+      }
+    return NULL;
+}
+
+static void
+pbf_write_next_job (struct pbf_writer *w)
+{
+/* waiting for the oldest submitted Blob, then writing it */
+    struct pbf_blob_job *job = w->jobs + (w->written % w->n_jobs);
+    pthread_mutex_lock (&(w->mutex));
+    while (job->status != BLOB_READY)
+	pthread_cond_wait (&(w->cond), &(w->mutex));
+    pthread_mutex_unlock (&(w->mutex));
+    if (job->error)
+      {
+	  fprintf (stderr, "PBF: zlib compression error\n");
+	  w->error = 1;
+      }
+    else
+	pbf_emit_blob (w, job->type, job->data.len, &(job->zbuf));
+    pthread_mutex_lock (&(w->mutex));
+    job->status = BLOB_FREE;
+    w->written += 1;
+    pthread_mutex_unlock (&(w->mutex));
+}
+#endif
+
+static void
+pbf_start_compressors (struct pbf_writer *w, int threads)
+{
+/* starting the compressor threads (none at all: compressing inline) */
+#ifndef _WIN32
+    int i;
+    if (threads < 2)
+	return;
+    pthread_mutex_init (&(w->mutex), NULL);
+    pthread_cond_init (&(w->cond), NULL);
+    w->n_jobs = threads * 2;
+    w->jobs = malloc (sizeof (struct pbf_blob_job) * w->n_jobs);
+    memset (w->jobs, 0, sizeof (struct pbf_blob_job) * w->n_jobs);
+    w->workers = malloc (sizeof (pthread_t) * threads);
+    for (i = 0; i < threads; i++)
+      {
+	  if (pthread_create
+	      (w->workers + i, NULL, pbf_compress_worker, w) != 0)
+	      break;
+	  w->n_workers += 1;
+      }
+#endif
+}
+
+static void
+pbf_stop_compressors (struct pbf_writer *w)
+{
+/* writing any pending Blob and stopping the compressor threads */
+#ifndef _WIN32
+    int i;
+    if (w->jobs == NULL)
+	return;
+    while (w->n_workers > 0 && w->written < w->submitted)
+	pbf_write_next_job (w);
+    pthread_mutex_lock (&(w->mutex));
+    w->quit = 1;
+    pthread_cond_broadcast (&(w->cond));
+    pthread_mutex_unlock (&(w->mutex));
+    for (i = 0; i < w->n_workers; i++)
+	pthread_join (w->workers[i], NULL);
+    for (i = 0; i < w->n_jobs; i++)
+      {
+	  pbf_buffer_free (&(w->jobs[i].data));
+	  pbf_buffer_free (&(w->jobs[i].zbuf));
+      }
+    free (w->jobs);
+    free (w->workers);
+    pthread_cond_destroy (&(w->cond));
+    pthread_mutex_destroy (&(w->mutex));
+    w->jobs = NULL;
+    w->workers = NULL;
+    w->n_workers = 0;
+#endif
+}
+
+static void
+pbf_write_blob (struct pbf_writer *w, const char *type,
+		struct pbf_buffer *data)
+{
+/*
+/ writing a zlib compressed Blob
+/
+/ when compressor threads are available the encoded bytes are handed
+/ over to them (DATA is left empty), so that compressing the current
+/ block overlaps with encoding the next ones
+*/
+#ifndef _WIN32
+    struct pbf_blob_job *job;
+    if (w->n_workers > 0)
+      {
+	  if (w->submitted - w->written >= w->n_jobs)
+	      pbf_write_next_job (w);
+	  job = w->jobs + (w->submitted % w->n_jobs);
+	  job->type = type;
+	  job->data.len = 0;
+	  pbf_swap_buffers (&(job->data), data);
+	  pthread_mutex_lock (&(w->mutex));
+	  job->status = BLOB_PENDING;
+	  w->submitted += 1;
+	  pthread_cond_broadcast (&(w->cond));
+	  pthread_mutex_unlock (&(w->mutex));
+	  return;
+      }
+#endif
+    if (!pbf_compress (data, &(w->zbuf)))
+      {
+	  fprintf (stderr, "PBF: zlib compression error\n");
+	  w->error = 1;
+	  return;
+      }
+    pbf_emit_blob (w, type, data->len, &(w->zbuf));
+}
+
+static struct pbf_writer *
+alloc_pbf_writer (FILE * out, int threads)
+{
+/* creating the OSM-PBF writer */
+    int i;
+    struct pbf_writer *w = malloc (sizeof (struct pbf_writer));
+    memset (w, 0, sizeof (struct pbf_writer));
+    w->out = out;
+    w->strings.alloc = 1024;
+    w->strings.strings = malloc (sizeof (char *) * w->strings.alloc);
+    w->strings.lengths = malloc (sizeof (int) * w->strings.alloc);
+    w->strings.hash_size = 4096;
+    w->strings.hash = malloc (sizeof (int) * w->strings.hash_size);
+    for (i = 0; i < w->strings.hash_size; i++)
+	w->strings.hash[i] = -1;
+    w->strings.count = 0;
+    pbf_reset_strings (&(w->strings));
+    pbf_start_compressors (w, threads);
+    return w;
+}
+
+static void
+pbf_write_header (struct pbf_writer *w)
+{
+/* writing the OSMHeader block */
+    struct pbf_buffer hdr;
+    memset (&hdr, 0, sizeof (struct pbf_buffer));
+    pbf_put_bytes (&hdr, 4, "OsmSchema-V0.6", 14);
+    pbf_put_bytes (&hdr, 4, "DenseNodes", 10);
+    pbf_put_bytes (&hdr, 16, "spatialite_osm_filter", 21);
+    pbf_write_blob (w, "OSMHeader", &hdr);
+    pbf_buffer_free (&hdr);
+}
+
+static void
+pbf_flush_block (struct pbf_writer *w)
+{
+/* encoding and writing the current PrimitiveBlock */
+    int i;
+    struct pbf_buffer aux;
+    struct pbf_buffer grp;
+
+    if (w->count == 0)
+	return;
+    memset (&aux, 0, sizeof (struct pbf_buffer));
+    memset (&grp, 0, sizeof (struct pbf_buffer));
+
+/* the StringTable */
+    for (i = 0; i < w->strings.count; i++)
+	pbf_put_bytes (&aux, 1, w->strings.strings[i], w->strings.lengths[i]);
+    w->block.len = 0;
+    pbf_put_buffer (&(w->block), 1, &aux);
+
+/* the PrimitiveGroup */
+    if (w->kind == OSM_NODE)
+      {
+	  struct pbf_buffer dense;
+	  memset (&dense, 0, sizeof (struct pbf_buffer));
+	  aux.len = 0;
+	  pbf_put_packed (&aux, 1, &(w->versions));
+	  pbf_put_packed (&aux, 2, &(w->timestamps));
+	  pbf_put_packed (&aux, 3, &(w->changesets));
+	  pbf_put_packed (&aux, 4, &(w->uids));
+	  pbf_put_packed (&aux, 5, &(w->user_sids));
+	  pbf_put_packed (&dense, 1, &(w->ids));
+	  pbf_put_buffer (&dense, 5, &aux);
+	  pbf_put_packed (&dense, 8, &(w->lats));
+	  pbf_put_packed (&dense, 9, &(w->lons));
+	  pbf_put_packed (&dense, 10, &(w->keys_vals));
+	  pbf_put_buffer (&grp, 2, &dense);
+	  pbf_buffer_free (&dense);
+	  pbf_put_buffer (&(w->block), 2, &grp);
+      }
+    else
+      {
+	  /* Ways and Relations are already encoded */
+	  pbf_put_buffer (&(w->block), 2, &(w->group));
+      }
+    pbf_buffer_free (&aux);
+    pbf_buffer_free (&grp);
+
+    pbf_write_blob (w, "OSMData", &(w->block));
+
+/* resetting the block status */
+    w->count = 0;
+    w->ids.len = 0;
+    w->lats.len = 0;
+    w->lons.len = 0;
+    w->keys_vals.len = 0;
+    w->versions.len = 0;
+    w->timestamps.len = 0;
+    w->changesets.len = 0;
+    w->uids.len = 0;
+    w->user_sids.len = 0;
+    w->group.len = 0;
+    w->last_id = 0;
+    w->last_lat = 0;
+    w->last_lon = 0;
+    w->last_timestamp = 0;
+    w->last_changeset = 0;
+    w->last_uid = 0;
+    w->last_user_sid = 0;
+    pbf_reset_strings (&(w->strings));
+}
+
+static void
+pbf_check_block (struct pbf_writer *w, int kind)
+{
+/* starting a new PrimitiveBlock when required */
+    size_t size;
+    if (w->kind != kind)
+      {
+	  pbf_flush_block (w);
+	  w->kind = kind;
+	  return;
+      }
+    size = w->strings.bytes + w->group.len + w->ids.len + w->lats.len +
+	w->lons.len + w->keys_vals.len + w->timestamps.len +
+	w->changesets.len;
+    if (w->count >= PBF_MAX_ENTITIES || size >= PBF_MAX_BLOCK_SIZE)
+	pbf_flush_block (w);
+}
+
+static void
+pbf_begin_node (struct pbf_writer *w, sqlite3_stmt * stmt)
+{
+/* 
+/ appending a Node to the DenseNodes group
+/ the statement is expected to return:
+/ id, version, timestamp, uid, user, changeset, x, y
+*/
+    sqlite3_int64 id = sqlite3_column_int64 (stmt, 0);
+    int version = sqlite3_column_int (stmt, 1);
+    sqlite3_int64 timestamp =
+	pbf_parse_timestamp ((const char *) sqlite3_column_text (stmt, 2));
+    sqlite3_int64 uid = sqlite3_column_int (stmt, 3);
+    sqlite3_int64 user_sid;
+    sqlite3_int64 changeset = sqlite3_column_int64 (stmt, 5);
+    sqlite3_int64 lon = pbf_coord (sqlite3_column_double (stmt, 6));
+    sqlite3_int64 lat = pbf_coord (sqlite3_column_double (stmt, 7));
+
+    pbf_check_block (w, OSM_NODE);
+/* string indices are only valid within the current block */
+    user_sid = pbf_string_id (w, (const char *) sqlite3_column_text (stmt, 4));
+    if (!version)
+	version = 1;
+    pbf_put_sint (&(w->ids), id - w->last_id);
+    pbf_put_sint (&(w->lats), lat - w->last_lat);
+    pbf_put_sint (&(w->lons), lon - w->last_lon);
+    pbf_put_varint (&(w->versions), version);
+    pbf_put_sint (&(w->timestamps), timestamp - w->last_timestamp);
+    pbf_put_sint (&(w->changesets), changeset - w->last_changeset);
+    pbf_put_sint (&(w->uids), uid - w->last_uid);
+    pbf_put_sint (&(w->user_sids), user_sid - w->last_user_sid);
+    w->last_id = id;
+    w->last_lat = lat;
+    w->last_lon = lon;
+    w->last_timestamp = timestamp;
+    w->last_changeset = changeset;
+    w->last_uid = uid;
+    w->last_user_sid = user_sid;
+    w->count++;
+}
+
+static void
+pbf_begin_entity (struct pbf_writer *w, int kind, sqlite3_stmt * stmt)
+{
+/* 
+/ starting a Way or a Relation
+/ the statement is expected to return:
+/ id, version, timestamp, uid, user, changeset
+*/
+    pbf_check_block (w, kind);
+    w->cur_id = sqlite3_column_int64 (stmt, 0);
+    w->cur_version = sqlite3_column_int (stmt, 1);
+    if (!w->cur_version)
+	w->cur_version = 1;
+    w->cur_timestamp =
+	pbf_parse_timestamp ((const char *) sqlite3_column_text (stmt, 2));
+    w->cur_uid = sqlite3_column_int (stmt, 3);
+    w->cur_user_sid =
+	pbf_string_id (w, (const char *) sqlite3_column_text (stmt, 4));
+    w->cur_changeset = sqlite3_column_int64 (stmt, 5);
+    w->last_ref = 0;
+    w->keys.len = 0;
+    w->vals.len = 0;
+    w->refs.len = 0;
+    w->roles.len = 0;
+    w->types.len = 0;
+}
+
+static void
+pbf_add_tag (struct pbf_writer *w, const char *k, const char *v)
+{
+/* appending a tag to the current Node, Way or Relation */
+    if (w->kind == OSM_NODE)
+      {
+	  pbf_put_varint (&(w->keys_vals), pbf_string_id (w, k));
+	  pbf_put_varint (&(w->keys_vals), pbf_string_id (w, v));
+	  return;
+      }
+    pbf_put_varint (&(w->keys), pbf_string_id (w, k));
+    pbf_put_varint (&(w->vals), pbf_string_id (w, v));
+}
+
+static void
+pbf_add_ref (struct pbf_writer *w, sqlite3_int64 ref)
+{
+/* appending a Node reference to the current Way */
+    pbf_put_sint (&(w->refs), ref - w->last_ref);
+    w->last_ref = ref;
+}
+
+static void
+pbf_add_member (struct pbf_writer *w, int type, sqlite3_int64 ref,
+		const char *role)
+{
+/* appending a member to the current Relation [0=Node, 1=Way, 2=Relation] */
+    pbf_put_varint (&(w->roles), pbf_string_id (w, role));
+    pbf_put_sint (&(w->refs), ref - w->last_ref);
+    pbf_put_varint (&(w->types), type);
+    w->last_ref = ref;
+}
+
+static void
+pbf_end_entity (struct pbf_writer *w)
+{
+/* completing the current Node, Way or Relation */
+    struct pbf_buffer info;
+    if (w->kind == OSM_NODE)
+      {
+	  /* tags of each DenseNode are terminated by a 0 */
+	  pbf_put_varint (&(w->keys_vals), 0);
+	  return;
+      }
+    memset (&info, 0, sizeof (struct pbf_buffer));
+    pbf_put_int (&info, 1, w->cur_version);
+    pbf_put_int (&info, 2, w->cur_timestamp);
+    pbf_put_int (&info, 3, w->cur_changeset);
+    pbf_put_int (&info, 4, w->cur_uid);
+    pbf_put_int (&info, 5, w->cur_user_sid);
+    w->entity.len = 0;
+    pbf_put_int (&(w->entity), 1, w->cur_id);
+    pbf_put_packed (&(w->entity), 2, &(w->keys));
+    pbf_put_packed (&(w->entity), 3, &(w->vals));
+    pbf_put_buffer (&(w->entity), 4, &info);
+    if (w->kind == OSM_WAY)
+      {
+	  pbf_put_packed (&(w->entity), 8, &(w->refs));
+	  pbf_put_buffer (&(w->group), 3, &(w->entity));
+      }
+    else
+      {
+	  pbf_put_packed (&(w->entity), 8, &(w->roles));
+	  pbf_put_packed (&(w->entity), 9, &(w->refs));
+	  pbf_put_packed (&(w->entity), 10, &(w->types));
+	  pbf_put_buffer (&(w->group), 4, &(w->entity));
+      }
+    pbf_buffer_free (&info);
+    w->count++;
+}
+
+static void
+free_pbf_writer (struct pbf_writer *w)
+{
+/* flushing and destroying the OSM-PBF writer */
+    int i;
+    if (w == NULL)
+	return;
+    pbf_flush_block (w);
+    pbf_stop_compressors (w);
+    for (i = 0; i < w->strings.count; i++)
+	free (w->strings.strings[i]);
+    free (w->strings.strings);
+    free (w->strings.lengths);
+    free (w->strings.hash);
+    pbf_buffer_free (&(w->ids));
+    pbf_buffer_free (&(w->lats));
+    pbf_buffer_free (&(w->lons));
+    pbf_buffer_free (&(w->keys_vals));
+    pbf_buffer_free (&(w->versions));
+    pbf_buffer_free (&(w->timestamps));
+    pbf_buffer_free (&(w->changesets));
+    pbf_buffer_free (&(w->uids));
+    pbf_buffer_free (&(w->user_sids));
+    pbf_buffer_free (&(w->keys));
+    pbf_buffer_free (&(w->vals));
+    pbf_buffer_free (&(w->refs));
+    pbf_buffer_free (&(w->roles));
+    pbf_buffer_free (&(w->types));
+    pbf_buffer_free (&(w->group));
+    pbf_buffer_free (&(w->entity));
+    pbf_buffer_free (&(w->block));
+    pbf_buffer_free (&(w->blob));
+    pbf_buffer_free (&(w->header));
+    pbf_buffer_free (&(w->zbuf));
+    free (w);
+}
+
+struct osm_output
+{
+/* the output destination: either OSM-XML or OSM-PBF */
+    struct xml_writer *xml;
+    struct pbf_writer *pbf;
+    const char *element;
+    int pending;
+};
+
+static void
+output_begin (struct osm_output *out, int kind, sqlite3_stmt * stmt)
+{
+/* starting a Node, Way or Relation */
+    if (out->pbf != NULL)
+      {
+	  if (kind == OSM_NODE)
+	      pbf_begin_node (out->pbf, stmt);
+	  else
+	      pbf_begin_entity (out->pbf, kind, stmt);
+	  return;
+      }
+    if (kind == OSM_NODE)
+	out->element = "node";
+    else if (kind == OSM_WAY)
+	out->element = "way";
+    else
+	out->element = "relation";
+    xml_write_header (out->xml, out->element, stmt);
+    if (kind == OSM_NODE)
+      {
+	  xml_write_str (out->xml, " lat=\"");
+	  xml_write_coord (out->xml, sqlite3_column_double (stmt, 7));
+	  xml_write_str (out->xml, "\" lon=\"");
+	  xml_write_coord (out->xml, sqlite3_column_double (stmt, 6));
+	  xml_write_str (out->xml, "\" uid=\"");
+	  xml_write_int64 (out->xml, sqlite3_column_int (stmt, 3));
+	  xml_write_str (out->xml, "\" ");
+	  /* a Node without tags will be closed as an empty element */
+	  out->pending = 1;
+	  return;
+      }
+    xml_write_str (out->xml, " uid=\"");
+    xml_write_int64 (out->xml, sqlite3_column_int (stmt, 3));
+    xml_write_str (out->xml, "\" >\n");
+    out->pending = 0;
+}
+
+static void
+output_tag (struct osm_output *out, sqlite3_stmt * stmt)
+{
+/* appending a tag - the statement is expected to return: id, k, v */
+    if (sqlite3_column_type (stmt, 1) == SQLITE_NULL
+	|| sqlite3_column_type (stmt, 2) == SQLITE_NULL)
+      {
+	  /* just as before, incomplete tags are skipped */
+	  return;
+      }
+    if (out->pbf != NULL)
+      {
+	  pbf_add_tag (out->pbf, (const char *) sqlite3_column_text (stmt, 1),
+		       (const char *) sqlite3_column_text (stmt, 2));
+	  return;
       }
-    *p_o = '\0';
-    return buf;
+    if (out->pending)
+      {
+	  xml_write_str (out->xml, ">\n");
+	  out->pending = 0;
+      }
+    xml_write_tag (out->xml, stmt);
+}
+
+static void
+output_nd_ref (struct osm_output *out, sqlite3_int64 ref)
+{
+/* appending a Node reference to the current Way */
+    if (out->pbf != NULL)
+      {
+	  pbf_add_ref (out->pbf, ref);
+	  return;
+      }
+    xml_write_str (out->xml, "\t\t<nd ref=\"");
+    xml_write_int64 (out->xml, ref);
+    xml_write_str (out->xml, "\"/>\n");
+}
+
+static void
+output_member (struct osm_output *out, const char *type, sqlite3_int64 ref,
+	       const char *role)
+{
+/* appending a member to the current Relation */
+    int kind = OSM_WAY;
+    if (type != NULL && *type == 'N')
+	kind = OSM_NODE;
+    else if (type != NULL && *type == 'R')
+	kind = OSM_RELATION;
+    if (out->pbf != NULL)
+      {
+	  /* PBF member types: 0=Node, 1=Way, 2=Relation */
+	  pbf_add_member (out->pbf, kind - 1, ref, role);
+	  return;
+      }
+    xml_write_str (out->xml, "\t\t<member type=\"");
+    if (kind == OSM_NODE)
+	xml_write_str (out->xml, "node");
+    else if (kind == OSM_RELATION)
+	xml_write_str (out->xml, "relation");
+    else
+	xml_write_str (out->xml, "way");
+    xml_write_str (out->xml, "\" ref=\"");
+    xml_write_int64 (out->xml, ref);
+    xml_write_str (out->xml, "\" role=\"");
+    if (role != NULL)
+	xml_write_escaped (out->xml, role);
+    xml_write_str (out->xml, "\"/>\n");
+}
+
+static void
+output_end (struct osm_output *out)
+{
+/* completing the current Node, Way or Relation */
+    if (out->pbf != NULL)
+      {
+	  pbf_end_entity (out->pbf);
+	  return;
+      }
+    if (out->pending)
+      {
+	  xml_write_str (out->xml, "/>\n");
+	  out->pending = 0;
+	  return;
+      }
+    xml_write_str (out->xml, "\t</");
+    xml_write_str (out->xml, out->element);
+    xml_write_str (out->xml, ">\n");
 }
 
 static int
-do_output_nodes (FILE * out, sqlite3 * handle)
+merge_step (sqlite3 * handle, sqlite3_stmt * stmt, int *valid,
+	    sqlite3_int64 * id)
 {
-/* exporting any OSM node */
-    char sql[1024];
-    int ret;
-    int first;
-    int close_node;
-    sqlite3_stmt *node_query = NULL;
-    sqlite3_stmt *query = NULL;
+/* advancing a merge-join cursor (first column always is the ID) */
+    int ret = sqlite3_step (stmt);
+    if (ret == SQLITE_DONE)
+      {
+	  /* there are no more rows to fetch */
+	  *valid = 0;
+	  return 1;
+      }
+    if (ret == SQLITE_ROW)
+      {
+	  *valid = 1;
+	  *id = sqlite3_column_int64 (stmt, 0);
+	  return 1;
+      }
+/* some unexpected error occurred */
+    fprintf (stderr, "sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+    *valid = 0;
+    return 0;
+}
 
-/* preparing the QUERY filtered-NODES statement */
-    strcpy (sql, "SELECT node_id FROM osm_nodes WHERE filtered = 1");
-    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &node_query, NULL);
-    if (ret != SQLITE_OK)
+static int
+merge_seek (sqlite3 * handle, sqlite3_stmt * stmt, int *valid,
+	    sqlite3_int64 * cur_id, sqlite3_int64 id)
+{
+/* skipping any row belonging to some not exported ID */
+    while (*valid && *cur_id < id)
       {
-	  fprintf (stderr, "SQL error: %s\n%s\n", sql, sqlite3_errmsg (handle));
-	  return 0;
+	  if (!merge_step (handle, stmt, valid, cur_id))
+	      return 0;
       }
+    return 1;
+}
 
-/* preparing the QUERY NODES statement */
-    strcpy (sql, "SELECT n.node_id, n.version, n.timestamp, ");
-    strcat (sql, "n.uid, n.user, n.changeset, ST_X(n.Geometry), ");
-    strcat (sql, "ST_Y(n.Geometry), t.k, t.v ");
-    strcat (sql, "FROM osm_nodes AS n ");
-    strcat (sql, "LEFT JOIN osm_node_tags AS t ON (t.node_id = n.node_id) ");
-    strcat (sql, "WHERE n.node_id = ? ");
-    strcat (sql, "ORDER BY n.node_id, t.sub");
-    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &query, NULL);
+static int
+prepare_output_query (sqlite3 * handle, const char *sql, sqlite3_stmt ** stmt)
+{
+/* preparing one of the output queries */
+    int ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), stmt, NULL);
     if (ret != SQLITE_OK)
       {
 	  fprintf (stderr, "SQL error: %s\n%s\n", sql, sqlite3_errmsg (handle));
-	  goto stop;
+	  *stmt = NULL;
+	  return 0;
       }
+    return 1;
+}
 
+static int
+do_output_nodes (struct osm_output *out, sqlite3 * handle)
+{
+/* 
+/ exporting any OSM node
+/ both NODES and NODE-TAGS are scanned just once in ID order
+*/
+    int ret;
+    int valid;
+    int tag_valid;
+    sqlite3_int64 id;
+    sqlite3_int64 tag_id = 0;
+    sqlite3_stmt *node_query = NULL;
+    sqlite3_stmt *tag_query = NULL;
+
+/* preparing the QUERY filtered-NODES statement */
+    if (!prepare_output_query
+	(handle,
+	 "SELECT node_id, version, timestamp, uid, user, changeset, "
+	 "ST_X(Geometry), ST_Y(Geometry) FROM osm_nodes "
+	 "WHERE filtered = 1 ORDER BY node_id", &node_query))
+	goto stop;
+
+/* preparing the QUERY NODE-TAGS statement */
+    if (!prepare_output_query
+	(handle,
+	 "SELECT node_id, k, v FROM osm_node_tags ORDER BY node_id, sub",
+	 &tag_query))
+	goto stop;
+
+    if (!merge_step (handle, tag_query, &tag_valid, &tag_id))
+	goto stop;
     while (1)
       {
 	  /* scrolling the result set */
-	  ret = sqlite3_step (node_query);
-	  if (ret == SQLITE_DONE)
+	  ret = merge_step (handle, node_query, &valid, &id);
+	  if (!ret)
+	      goto stop;
+	  if (!valid)
 	    {
 		/* there are no more rows to fetch - we can stop looping */
 		break;
 	    }
-	  if (ret == SQLITE_ROW)
-	    {
-		/* ok, we've just fetched a valid row */
-		sqlite3_int64 id = sqlite3_column_int64 (node_query, 0);
-
-		sqlite3_reset (query);
-		sqlite3_clear_bindings (query);
-		sqlite3_bind_int64 (query, 1, id);
-		first = 1;
-		close_node = 0;
-		while (1)
-		  {
-		      /* scrolling the result set */
-		      ret = sqlite3_step (query);
-		      if (ret == SQLITE_DONE)
-			{
-			    /* there are no more rows to fetch - we can stop looping */
-			    break;
-			}
-		      if (ret == SQLITE_ROW)
-			{
-			    /* ok, we've just fetched a valid row */
-			    sqlite3_int64 id = sqlite3_column_int64 (query, 0);
-			    int version = sqlite3_column_int (query, 1);
-			    const char *p_timestamp =
-				(const char *) sqlite3_column_text (query, 2);
-			    int uid = sqlite3_column_int (query, 3);
-			    const char *p_user =
-				(const char *) sqlite3_column_text (query, 4);
-			    const char *p_changeset =
-				(const char *) sqlite3_column_text (query, 5);
-			    double x = sqlite3_column_double (query, 6);
-			    double y = sqlite3_column_double (query, 7);
-			    char *k = NULL;
-			    char *v = NULL;
-			    if (sqlite3_column_type (query, 8) != SQLITE_NULL)
-				k = clean_xml ((const char *)
-					       sqlite3_column_text (query, 8));
-			    if (sqlite3_column_type (query, 9) != SQLITE_NULL)
-				v = clean_xml ((const char *)
-					       sqlite3_column_text (query, 9));
-
-			    if (first)
-			      {
-				  /* first NODE row */
-				  char *timestamp =
-				      p_timestamp ? clean_xml (p_timestamp) :
-				      NULL;
-				  char *changeset =
-				      p_changeset ? clean_xml (p_changeset) :
-				      NULL;
-				  char *user =
-				      p_user ? clean_xml (p_user) : NULL;
-				  first = 0;
-#if defined(_WIN32) || defined(__MINGW32__)
-/* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-				  fprintf (out, "\t<node id=\"%I64d\"", id);
-#else
-				  fprintf (out, "\t<node id=\"%lld\"", id);
-#endif
-				  if (user)
-				    {
-					fprintf (out, " user=\"%s\"", user);
-					free (user);
-				    }
-				  if (changeset)
-				    {
-					fprintf (out, " changeset=\"%s\"",
-						 changeset);
-					free (changeset);
-				    }
-				  if (timestamp)
-				    {
-					fprintf (out, " timestamp=\"%s\"",
-						 timestamp);
-					free (timestamp);
-				    }
-				  if (!version)
-				      version = 1;
-				  fprintf (out, " version=\"%d\"", version);
-				  fprintf (out,
-					   " lat=\"%1.7f\" lon=\"%1.7f\" uid=\"%d\" ",
-					   y, x, uid);
-				  if (k == NULL && v == NULL)
-				      fprintf (out, "/>\n");
-				  else
-				      fprintf (out, ">\n");
-			      }
-			    if (k != NULL && v != NULL)
-			      {
-				  /* NODE tag */
-				  fprintf (out,
-					   "\t\t<tag k=\"%s\" v=\"%s\"/>\n", k,
-					   v);
-				  close_node = 1;
-			      }
-			    if (k)
-				free (k);
-			    if (v)
-				free (v);
-			}
-		      else
-			{
-			    /* some unexpected error occurred */
-			    fprintf (stderr, "sqlite3_step() error: %s\n",
-				     sqlite3_errmsg (handle));
-			    goto stop;
-			}
-		  }
-		if (close_node)
-		    fprintf (out, "\t</node>\n");
-	    }
-	  else
+
+	  output_begin (out, OSM_NODE, node_query);
+
+	  /* exporting NODE tags */
+	  if (!merge_seek (handle, tag_query, &tag_valid, &tag_id, id))
+	      goto stop;
+	  while (tag_valid && tag_id == id)
 	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (handle));
-		goto stop;
+		output_tag (out, tag_query);
+		if (!merge_step (handle, tag_query, &tag_valid, &tag_id))
+		    goto stop;
 	    }
+	  output_end (out);
       }
     sqlite3_finalize (node_query);
-    sqlite3_finalize (query);
-
+    sqlite3_finalize (tag_query);
     return 1;
 
-  stop:
-    sqlite3_finalize (node_query);
-    if (query)
-	sqlite3_finalize (query);
+  stop:
+    if (node_query)
+	sqlite3_finalize (node_query);
+    if (tag_query)
+	sqlite3_finalize (tag_query);
     return 0;
 }
 
 static int
-do_output_ways (FILE * out, sqlite3 * handle)
+do_output_ways (struct osm_output *out, sqlite3 * handle)
 {
-/* exporting any OSM way */
-    char sql[1024];
+/* 
+/ exporting any OSM way
+/ WAYS, WAY-REFS and WAY-TAGS are scanned just once in ID order
+*/
     int ret;
-    int first;
+    int valid;
+    int ref_valid;
+    int tag_valid;
+    sqlite3_int64 id;
+    sqlite3_int64 ref_id = 0;
+    sqlite3_int64 tag_id = 0;
     sqlite3_stmt *way_query = NULL;
-    sqlite3_stmt *query = NULL;
-    sqlite3_stmt *query_tag = NULL;
+    sqlite3_stmt *ref_query = NULL;
+    sqlite3_stmt *tag_query = NULL;
 
 /* preparing the QUERY filtered-WAYS statement */
-    strcpy (sql, "SELECT way_id FROM osm_ways WHERE filtered = 1");
-    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &way_query, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n%s\n", sql, sqlite3_errmsg (handle));
-	  return 0;
-      }
+    if (!prepare_output_query
+	(handle,
+	 "SELECT way_id, version, timestamp, uid, user, changeset "
+	 "FROM osm_ways WHERE filtered = 1 ORDER BY way_id", &way_query))
+	goto stop;
 
-/* preparing the QUERY WAY/NODES statement */
-    strcpy (sql, "SELECT w.way_id, w.version, w.timestamp, w.uid, ");
-    strcat (sql, "w.user, w.changeset, n.node_id ");
-    strcat (sql, "FROM osm_ways AS w ");
-    strcat (sql, "JOIN osm_way_refs AS n ON (n.way_id = w.way_id) ");
-    strcat (sql, "WHERE w.way_id = ? ");
-    strcat (sql, "ORDER BY w.way_id, n.sub");
-    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &query, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n%s\n", sql, sqlite3_errmsg (handle));
-	  goto stop;
-      }
+/* preparing the QUERY WAY-REFS statement */
+    if (!prepare_output_query
+	(handle,
+	 "SELECT way_id, node_id FROM osm_way_refs ORDER BY way_id, sub",
+	 &ref_query))
+	goto stop;
 
-/* preparing the QUERY WAY/TAGS statement */
-    strcpy (sql, "SELECT t.k, t.v ");
-    strcat (sql, "FROM osm_ways AS w ");
-    strcat (sql, "JOIN osm_way_tags AS t ON (t.way_id = w.way_id) ");
-    strcat (sql, "WHERE w.way_id = ? ");
-    strcat (sql, "ORDER BY w.way_id, t.sub");
-    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &query_tag, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n%s\n", sql, sqlite3_errmsg (handle));
-	  goto stop;
-      }
+/* preparing the QUERY WAY-TAGS statement */
+    if (!prepare_output_query
+	(handle,
+	 "SELECT way_id, k, v FROM osm_way_tags ORDER BY way_id, sub",
+	 &tag_query))
+	goto stop;
 
+    if (!merge_step (handle, ref_query, &ref_valid, &ref_id))
+	goto stop;
+    if (!merge_step (handle, tag_query, &tag_valid, &tag_id))
+	goto stop;
     while (1)
       {
 	  /* scrolling the result set */
-	  ret = sqlite3_step (way_query);
-	  if (ret == SQLITE_DONE)
+	  ret = merge_step (handle, way_query, &valid, &id);
+	  if (!ret)
+	      goto stop;
+	  if (!valid)
 	    {
 		/* there are no more rows to fetch - we can stop looping */
 		break;
 	    }
-	  if (ret == SQLITE_ROW)
-	    {
-		/* ok, we've just fetched a valid row */
-		sqlite3_int64 id = sqlite3_column_int64 (way_query, 0);
 
-		sqlite3_reset (query);
-		sqlite3_clear_bindings (query);
-		sqlite3_bind_int64 (query, 1, id);
-		first = 1;
-		while (1)
-		  {
-		      /* scrolling the result set */
-		      ret = sqlite3_step (query);
-		      if (ret == SQLITE_DONE)
-			{
-			    /* there are no more rows to fetch - we can stop looping */
-			    break;
-			}
-		      if (ret == SQLITE_ROW)
-			{
-			    /* ok, we've just fetched a valid row */
-			    sqlite3_int64 id = sqlite3_column_int64 (query, 0);
-			    int version = sqlite3_column_int (query, 1);
-			    const char *p_timestamp =
-				(const char *) sqlite3_column_text (query, 2);
-			    int uid = sqlite3_column_int (query, 3);
-			    const char *p_user =
-				(const char *) sqlite3_column_text (query, 4);
-			    const char *p_changeset =
-				(const char *) sqlite3_column_text (query, 5);
-			    sqlite3_int64 node_id =
-				sqlite3_column_int64 (query, 6);
-
-			    if (first)
-			      {
-				  /* first WAY row */
-				  char *timestamp =
-				      p_timestamp ? clean_xml (p_timestamp) :
-				      NULL;
-				  char *changeset =
-				      p_changeset ? clean_xml (p_changeset) :
-				      NULL;
-				  char *user = NULL;
-				  if (p_user)
-				      user = clean_xml (p_user);
-				  first = 0;
-#if defined(_WIN32) || defined(__MINGW32__)
-/* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-				  fprintf (out, "\t<way id=\"%I64d\"", id);
-#else
-				  fprintf (out, "\t<way id=\"%lld\"", id);
-#endif
-				  if (user)
-				    {
-					fprintf (out, " user=\"%s\"", user);
-					free (user);
-				    }
-				  if (changeset)
-				    {
-					fprintf (out, " changeset=\"%s\"",
-						 changeset);
-					free (changeset);
-				    }
-				  if (timestamp)
-				    {
-					fprintf (out, " timestamp=\"%s\"",
-						 timestamp);
-					free (timestamp);
-				    }
-				  if (!version)
-				      version = 1;
-				  fprintf (out, " version=\"%d\"", version);
-				  fprintf (out, " uid=\"%d\" >\n", uid);
-			      }
-			    /* NODE REF tag */
-#if defined(_WIN32) || defined(__MINGW32__)
-/* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-			    fprintf (out, "\t\t<nd ref=\"%I64d\"/>\n", node_id);
-#else
-			    fprintf (out, "\t\t<nd ref=\"%lld\"/>\n", node_id);
-#endif
-			}
-		      else
-			{
-			    /* some unexpected error occurred */
-			    fprintf (stderr, "sqlite3_step() error: %s\n",
-				     sqlite3_errmsg (handle));
-			    goto stop;
-			}
-		  }
-		if (!first)
-		  {
-		      /* exporting WAY tags */
-		      sqlite3_reset (query_tag);
-		      sqlite3_clear_bindings (query_tag);
-		      sqlite3_bind_int64 (query_tag, 1, id);
-		      while (1)
-			{
-			    /* scrolling the result set */
-			    ret = sqlite3_step (query_tag);
-			    if (ret == SQLITE_DONE)
-			      {
-				  /* there are no more rows to fetch - we can stop looping */
-				  break;
-			      }
-			    if (ret == SQLITE_ROW)
-			      {
-				  /* ok, we've just fetched a valid row */
-				  char *k =
-				      clean_xml ((const char *)
-						 sqlite3_column_text (query_tag,
-								      0));
-				  char *v =
-				      clean_xml ((const char *)
-						 sqlite3_column_text (query_tag,
-								      1));
-				  fprintf (out,
-					   "\t\t<tag k=\"%s\" v=\"%s\"/>\n", k,
-					   v);
-				  free (k);
-				  free (v);
-			      }
-			    else
-			      {
-				  /* some unexpected error occurred */
-				  fprintf (stderr, "sqlite3_step() error: %s\n",
-					   sqlite3_errmsg (handle));
-				  goto stop;
-			      }
-			}
-		  }
-		fprintf (out, "\t</way>\n");
+	  output_begin (out, OSM_WAY, way_query);
+
+	  /* exporting NODE REF tags */
+	  if (!merge_seek (handle, ref_query, &ref_valid, &ref_id, id))
+	      goto stop;
+	  while (ref_valid && ref_id == id)
+	    {
+		output_nd_ref (out, sqlite3_column_int64 (ref_query, 1));
+		if (!merge_step (handle, ref_query, &ref_valid, &ref_id))
+		    goto stop;
 	    }
-	  else
+
+	  /* exporting WAY tags */
+	  if (!merge_seek (handle, tag_query, &tag_valid, &tag_id, id))
+	      goto stop;
+	  while (tag_valid && tag_id == id)
 	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (handle));
-		goto stop;
+		output_tag (out, tag_query);
+		if (!merge_step (handle, tag_query, &tag_valid, &tag_id))
+		    goto stop;
 	    }
+	  output_end (out);
       }
     sqlite3_finalize (way_query);
-    sqlite3_finalize (query);
-    sqlite3_finalize (query_tag);
-
+    sqlite3_finalize (ref_query);
+    sqlite3_finalize (tag_query);
     return 1;
 
   stop:
-    sqlite3_finalize (way_query);
-    if (query)
-	sqlite3_finalize (query);
-    if (query_tag)
-	sqlite3_finalize (query_tag);
+    if (way_query)
+	sqlite3_finalize (way_query);
+    if (ref_query)
+	sqlite3_finalize (ref_query);
+    if (tag_query)
+	sqlite3_finalize (tag_query);
     return 0;
 }
 
 static int
-do_output_relations (FILE * out, sqlite3 * handle)
+do_output_relations (struct osm_output *out, sqlite3 * handle)
 {
-/* exporting any OSM relation */
-    char sql[1024];
+/* 
+/ exporting any OSM relation
+/ RELATIONS, RELATION-REFS and RELATION-TAGS are scanned just once 
+/ in ID order
+*/
     int ret;
-    int first;
+    int valid;
+    int ref_valid;
+    int tag_valid;
+    sqlite3_int64 id;
+    sqlite3_int64 ref_id = 0;
+    sqlite3_int64 tag_id = 0;
     sqlite3_stmt *rel_query = NULL;
-    sqlite3_stmt *query_nd = NULL;
-    sqlite3_stmt *query_way = NULL;
-    sqlite3_stmt *query_rel = NULL;
-    sqlite3_stmt *query_tag = NULL;
+    sqlite3_stmt *ref_query = NULL;
+    sqlite3_stmt *tag_query = NULL;
 
 /* preparing the QUERY filtered-RELATIONS statement */
-    strcpy (sql, "SELECT rel_id FROM osm_relations WHERE filtered = 1");
-    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &rel_query, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n%s\n", sql, sqlite3_errmsg (handle));
-	  return 0;
-      }
-
-/* preparing the QUERY RELATION/NODES statement */
-    strcpy (sql, "SELECT r.rel_id, r.version, r.timestamp, r.uid, ");
-    strcat (sql, "r.user, r.changeset, n.role, n.ref ");
-    strcat (sql, "FROM osm_relations AS r ");
-    strcat (sql,
-	    "JOIN osm_relation_refs AS n ON (n.type = 'N' AND n.rel_id = r.rel_id) ");
-    strcat (sql, "WHERE r.rel_id = ? ");
-    strcat (sql, "ORDER BY r.rel_id, n.sub");
-    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &query_nd, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n%s\n", sql, sqlite3_errmsg (handle));
-	  goto stop;
-      }
-
-/* preparing the QUERY RELATION/WAYS statement */
-    strcpy (sql, "SELECT r.rel_id, r.version, r.timestamp, r.uid, ");
-    strcat (sql, "r.user, r.changeset, w.role, w.ref ");
-    strcat (sql, "FROM osm_relations AS r ");
-    strcat (sql,
-	    "JOIN osm_relation_refs AS w ON (w.type = 'W' AND w.rel_id = r.rel_id) ");
-    strcat (sql, "WHERE r.rel_id = ? ");
-    strcat (sql, "ORDER BY r.rel_id, w.sub");
-    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &query_way, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n%s\n", sql, sqlite3_errmsg (handle));
-	  goto stop;
-      }
+    if (!prepare_output_query
+	(handle,
+	 "SELECT rel_id, version, timestamp, uid, user, changeset "
+	 "FROM osm_relations WHERE filtered = 1 ORDER BY rel_id", &rel_query))
+	goto stop;
 
-/* preparing the QUERY RELATION/RELATIONS statement */
-    strcpy (sql, "SELECT r.rel_id, r.version, r.timestamp, r.uid, ");
-    strcat (sql, "r.user, r.changeset, x.role, x.ref ");
-    strcat (sql, "FROM osm_relations AS r ");
-    strcat (sql,
-	    "JOIN osm_relation_refs AS x ON (x.type = 'R' AND x.rel_id = r.rel_id) ");
-    strcat (sql, "WHERE r.rel_id = ? ");
-    strcat (sql, "ORDER BY r.rel_id, x.sub");
-    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &query_rel, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n%s\n", sql, sqlite3_errmsg (handle));
-	  goto stop;
-      }
+/* preparing the QUERY RELATION-REFS statement */
+    if (!prepare_output_query
+	(handle,
+	 "SELECT rel_id, type, ref, role FROM osm_relation_refs "
+	 "ORDER BY rel_id, sub", &ref_query))
+	goto stop;
 
-/* preparing the QUERY RELATION/TAGS statement */
-    strcpy (sql, "SELECT t.k, t.v ");
-    strcat (sql, "FROM osm_relations AS r ");
-    strcat (sql, "JOIN osm_relation_tags AS t ON (t.rel_id = r.rel_id) ");
-    strcat (sql, "WHERE r.rel_id = ? ");
-    strcat (sql, "ORDER BY r.rel_id, t.sub");
-    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &query_tag, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n%s\n", sql, sqlite3_errmsg (handle));
-	  goto stop;
-      }
+/* preparing the QUERY RELATION-TAGS statement */
+    if (!prepare_output_query
+	(handle,
+	 "SELECT rel_id, k, v FROM osm_relation_tags ORDER BY rel_id, sub",
+	 &tag_query))
+	goto stop;
 
+    if (!merge_step (handle, ref_query, &ref_valid, &ref_id))
+	goto stop;
+    if (!merge_step (handle, tag_query, &tag_valid, &tag_id))
+	goto stop;
     while (1)
       {
 	  /* scrolling the result set */
-	  ret = sqlite3_step (rel_query);
-	  if (ret == SQLITE_DONE)
+	  ret = merge_step (handle, rel_query, &valid, &id);
+	  if (!ret)
+	      goto stop;
+	  if (!valid)
 	    {
 		/* there are no more rows to fetch - we can stop looping */
 		break;
 	    }
-	  if (ret == SQLITE_ROW)
-	    {
-		/* ok, we've just fetched a valid row */
-		sqlite3_int64 id = sqlite3_column_int64 (rel_query, 0);
 
-		sqlite3_reset (query_way);
-		sqlite3_clear_bindings (query_way);
-		sqlite3_bind_int64 (query_way, 1, id);
-		first = 1;
-		while (1)
-		  {
-		      /* scrolling the result set */
-		      ret = sqlite3_step (query_way);
-		      if (ret == SQLITE_DONE)
-			{
-			    /* there are no more rows to fetch - we can stop looping */
-			    break;
-			}
-		      if (ret == SQLITE_ROW)
-			{
-			    /* ok, we've just fetched a valid row */
-			    sqlite3_int64 id =
-				sqlite3_column_int64 (query_way, 0);
-			    int version = sqlite3_column_int (query_way, 1);
-			    const char *p_timestamp =
-				(const char *) sqlite3_column_text (query_way,
-								    2);
-			    int uid = sqlite3_column_int (query_way, 3);
-			    const char *p_user =
-				(const char *) sqlite3_column_text (query_way,
-								    4);
-			    const char *p_changeset =
-				(const char *) sqlite3_column_text (query_way,
-								    5);
-			    char *role =
-				clean_xml ((const char *)
-					   sqlite3_column_text (query_way, 6));
-			    sqlite3_int64 way_id =
-				sqlite3_column_int64 (query_way, 7);
-
-			    if (first)
-			      {
-				  /* first RELATION row */
-				  char *timestamp =
-				      p_timestamp ? clean_xml (p_timestamp) :
-				      NULL;
-				  char *changeset =
-				      p_changeset ? clean_xml (p_changeset) :
-				      NULL;
-				  char *user = NULL;
-				  if (p_user)
-				      user = clean_xml (p_user);
-				  first = 0;
-#if defined(_WIN32) || defined(__MINGW32__)
-/* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-				  fprintf (out, "\t<relation id=\"%I64d\"", id);
-#else
-				  fprintf (out, "\t<relation id=\"%lld\"", id);
-#endif
-				  if (user)
-				    {
-					fprintf (out, " user=\"%s\"", user);
-					free (user);
-				    }
-				  if (changeset)
-				    {
-					fprintf (out, " changeset=\"%s\"",
-						 changeset);
-					free (changeset);
-				    }
-				  if (timestamp)
-				    {
-					fprintf (out, " timestamp=\"%s\"",
-						 timestamp);
-					free (timestamp);
-				    }
-				  if (!version)
-				      version = 1;
-				  fprintf (out, " version=\"%d\"", version);
-				  fprintf (out, " uid=\"%d\" >\n", uid);
-			      }
-			    /* NODE REF tag */
-#if defined(_WIN32) || defined(__MINGW32__)
-/* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-			    fprintf (out,
-				     "\t\t<member type=\"way\" ref=\"%I64d\" role=\"%s\"/>\n",
-				     way_id, role);
-#else
-			    fprintf (out,
-				     "\t\t<member type = \"way\" ref=\"%lld\" role=\"%s\"/>\n",
-				     way_id, role);
-#endif
-			    free (role);
-			}
-		      else
-			{
-			    /* some unexpected error occurred */
-			    fprintf (stderr, "sqlite3_step() error: %s\n",
-				     sqlite3_errmsg (handle));
-			    goto stop;
-			}
-		  }
-		if (!first)
-		  {
-		      /* exporting WAY tags */
-		      sqlite3_reset (query_tag);
-		      sqlite3_clear_bindings (query_tag);
-		      sqlite3_bind_int64 (query_tag, 1, id);
-		      while (1)
-			{
-			    /* scrolling the result set */
-			    ret = sqlite3_step (query_tag);
-			    if (ret == SQLITE_DONE)
-			      {
-				  /* there are no more rows to fetch - we can stop looping */
-				  break;
-			      }
-			    if (ret == SQLITE_ROW)
-			      {
-				  /* ok, we've just fetched a valid row */
-				  char *k =
-				      clean_xml ((const char *)
-						 sqlite3_column_text (query_tag,
-								      0));
-				  char *v =
-				      clean_xml ((const char *)
-						 sqlite3_column_text (query_tag,
-								      1));
-				  fprintf (out,
-					   "\t\t<tag k=\"%s\" v=\"%s\"/>\n", k,
-					   v);
-				  free (k);
-				  free (v);
-			      }
-			    else
-			      {
-				  /* some unexpected error occurred */
-				  fprintf (stderr, "sqlite3_step() error: %s\n",
-					   sqlite3_errmsg (handle));
-				  goto stop;
-			      }
-			}
-		  }
-		fprintf (out, "\t</relation>\n");
+	  output_begin (out, OSM_RELATION, rel_query);
+
+	  /* exporting MEMBER tags */
+	  if (!merge_seek (handle, ref_query, &ref_valid, &ref_id, id))
+	      goto stop;
+	  while (ref_valid && ref_id == id)
+	    {
+		output_member (out,
+			       (const char *) sqlite3_column_text (ref_query,
+								   1),
+			       sqlite3_column_int64 (ref_query, 2),
+			       (const char *) sqlite3_column_text (ref_query,
+								   3));
+		if (!merge_step (handle, ref_query, &ref_valid, &ref_id))
+		    goto stop;
 	    }
-	  else
+
+	  /* exporting RELATION tags */
+	  if (!merge_seek (handle, tag_query, &tag_valid, &tag_id, id))
+	      goto stop;
+	  while (tag_valid && tag_id == id)
 	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (handle));
-		goto stop;
+		output_tag (out, tag_query);
+		if (!merge_step (handle, tag_query, &tag_valid, &tag_id))
+		    goto stop;
 	    }
+	  output_end (out);
       }
     sqlite3_finalize (rel_query);
-    sqlite3_finalize (query_nd);
-    sqlite3_finalize (query_way);
-    sqlite3_finalize (query_rel);
-    sqlite3_finalize (query_tag);
-
+    sqlite3_finalize (ref_query);
+    sqlite3_finalize (tag_query);
     return 1;
 
   stop:
-    sqlite3_finalize (rel_query);
-    if (query_nd)
-	sqlite3_finalize (query_nd);
-    if (query_way)
-	sqlite3_finalize (query_way);
-    if (query_rel)
-	sqlite3_finalize (query_rel);
-    if (query_tag)
-	sqlite3_finalize (query_tag);
+    if (rel_query)
+	sqlite3_finalize (rel_query);
+    if (ref_query)
+	sqlite3_finalize (ref_query);
+    if (tag_query)
+	sqlite3_finalize (tag_query);
     return 0;
 }
 
@@ -975,8 +1709,317 @@ filter_node_ways (sqlite3 * handle)
     return 1;
 }
 
+#define MASK_CELL_OUTSIDE	0
+#define MASK_CELL_INSIDE	1
+#define MASK_CELL_BOUNDARY	2
+
+struct mask_row
+{
+/* all mask segments crossing a single grid row */
+    int count;
+    int next;
+    double *coords;
+};
+
+struct mask_grid
+{
+/* an uniform grid of cells covering the mask's MBR */
+    double minx;
+    double miny;
+    double maxx;
+    double maxy;
+    double cell_w;
+    double cell_h;
+    int rows;
+    int cols;
+    unsigned char *cells;
+    struct mask_row *row_segs;
+};
+
+static void
+free_mask_grid (struct mask_grid *grid)
+{
+/* memory cleanup - destroying the mask grid */
+    int r;
+    if (grid == NULL)
+	return;
+    if (grid->row_segs != NULL)
+      {
+	  for (r = 0; r < grid->rows; r++)
+	    {
+		if (grid->row_segs[r].coords != NULL)
+		    free (grid->row_segs[r].coords);
+	    }
+	  free (grid->row_segs);
+      }
+    if (grid->cells != NULL)
+	free (grid->cells);
+    free (grid);
+}
+
+static int
+mask_grid_row (struct mask_grid *grid, double y)
+{
+/* computing the grid row containing Y */
+    int r = (int) ((y - grid->miny) / grid->cell_h);
+    if (r < 0)
+	r = 0;
+    if (r >= grid->rows)
+	r = grid->rows - 1;
+    return r;
+}
+
+static int
+mask_grid_col (struct mask_grid *grid, double x)
+{
+/* computing the grid column containing X */
+    int c = (int) ((x - grid->minx) / grid->cell_w);
+    if (c < 0)
+	c = 0;
+    if (c >= grid->cols)
+	c = grid->cols - 1;
+    return c;
+}
+
+static void
+mask_segment_rows (struct mask_grid *grid, double x1, double y1, double x2,
+		   double y2, int fill)
+{
+/* registering a mask segment on every row it crosses */
+    int r;
+    int c;
+    int r1 = mask_grid_row (grid, (y1 < y2) ? y1 : y2);
+    int r2 = mask_grid_row (grid, (y1 > y2) ? y1 : y2);
+    for (r = r1; r <= r2; r++)
+      {
+	  struct mask_row *row = grid->row_segs + r;
+	  double band_min = grid->miny + (grid->cell_h * r);
+	  double band_max = band_min + grid->cell_h;
+	  double sx1 = x1;
+	  double sx2 = x2;
+	  int c1;
+	  int c2;
+	  if (!fill)
+	    {
+		/* first pass: just counting */
+		row->count += 1;
+		continue;
+	    }
+	  row->coords[row->next * 4] = x1;
+	  row->coords[row->next * 4 + 1] = y1;
+	  row->coords[row->next * 4 + 2] = x2;
+	  row->coords[row->next * 4 + 3] = y2;
+	  row->next += 1;
+
+	  /* clipping the segment to the row band so to mark boundary cells */
+	  if (y1 != y2)
+	    {
+		double ya = (band_min > ((y1 < y2) ? y1 : y2)) ? band_min
+		    : ((y1 < y2) ? y1 : y2);
+		double yb = (band_max < ((y1 > y2) ? y1 : y2)) ? band_max
+		    : ((y1 > y2) ? y1 : y2);
+		sx1 = x1 + ((x2 - x1) * ((ya - y1) / (y2 - y1)));
+		sx2 = x1 + ((x2 - x1) * ((yb - y1) / (y2 - y1)));
+	    }
+	  c1 = mask_grid_col (grid, (sx1 < sx2) ? sx1 : sx2);
+	  c2 = mask_grid_col (grid, (sx1 > sx2) ? sx1 : sx2);
+	  /* adding a safety margin against rounding errors */
+	  if (c1 > 0)
+	      c1--;
+	  if (c2 < grid->cols - 1)
+	      c2++;
+	  for (c = c1; c <= c2; c++)
+	      grid->cells[(r * grid->cols) + c] = MASK_CELL_BOUNDARY;
+      }
+}
+
+static void
+mask_ring_segments (struct mask_grid *grid, gaiaRingPtr ring, int fill)
+{
+/* registering all segments of a mask Ring */
+    int iv;
+    double x0;
+    double y0;
+    double x1;
+    double y1;
+    double z;
+    double m;
+    for (iv = 1; iv < ring->Points; iv++)
+      {
+	  if (ring->DimensionModel == GAIA_XY_Z)
+	    {
+		gaiaGetPointXYZ (ring->Coords, iv - 1, &x0, &y0, &z);
+		gaiaGetPointXYZ (ring->Coords, iv, &x1, &y1, &z);
+	    }
+	  else if (ring->DimensionModel == GAIA_XY_M)
+	    {
+		gaiaGetPointXYM (ring->Coords, iv - 1, &x0, &y0, &m);
+		gaiaGetPointXYM (ring->Coords, iv, &x1, &y1, &m);
+	    }
+	  else if (ring->DimensionModel == GAIA_XY_Z_M)
+	    {
+		gaiaGetPointXYZM (ring->Coords, iv - 1, &x0, &y0, &z, &m);
+		gaiaGetPointXYZM (ring->Coords, iv, &x1, &y1, &z, &m);
+	    }
+	  else
+	    {
+		gaiaGetPoint (ring->Coords, iv - 1, &x0, &y0);
+		gaiaGetPoint (ring->Coords, iv, &x1, &y1);
+	    }
+	  mask_segment_rows (grid, x0, y0, x1, y1, fill);
+      }
+}
+
+static void
+mask_all_segments (struct mask_grid *grid, gaiaGeomCollPtr geom, int fill)
+{
+/* registering all segments of every mask Polygon */
+    int ib;
+    gaiaPolygonPtr pg = geom->FirstPolygon;
+    while (pg)
+      {
+	  mask_ring_segments (grid, pg->Exterior, fill);
+	  for (ib = 0; ib < pg->NumInteriors; ib++)
+	      mask_ring_segments (grid, pg->Interiors + ib, fill);
+	  pg = pg->Next;
+      }
+}
+
+static int
+mask_row_contains (struct mask_row *row, double x, double y)
+{
+/* 
+/ even-odd crossing test restricted to the segments of a single row:
+/ an horizontal ray can only cross segments overlapping its own row
+*/
+    int is;
+    int inside = 0;
+    for (is = 0; is < row->count; is++)
+      {
+	  double x1 = row->coords[is * 4];
+	  double y1 = row->coords[is * 4 + 1];
+	  double x2 = row->coords[is * 4 + 2];
+	  double y2 = row->coords[is * 4 + 3];
+	  if ((y1 > y) != (y2 > y))
+	    {
+		if (x < (x1 + ((x2 - x1) * ((y - y1) / (y2 - y1)))))
+		    inside = !inside;
+	    }
+      }
+    return inside;
+}
+
+static struct mask_grid *
+build_mask_grid (gaiaGeomCollPtr geom)
+{
+/* 
+/ building the mask grid:
+/ each cell is classified as INSIDE, OUTSIDE or BOUNDARY,
+/ so that an exact test is only required for BOUNDARY cells
+*/
+    int r;
+    int c;
+    int dim = 16;
+    int n_segs = 0;
+    int ib;
+    struct mask_grid *grid;
+    gaiaPolygonPtr pg;
+
+    if (geom == NULL || geom->FirstPolygon == NULL)
+	return NULL;
+    if (geom->FirstPoint != NULL || geom->FirstLinestring != NULL)
+	return NULL;
+
+/* sizing the grid accordingly to the mask complexity */
+    pg = geom->FirstPolygon;
+    while (pg)
+      {
+	  n_segs += pg->Exterior->Points;
+	  for (ib = 0; ib < pg->NumInteriors; ib++)
+	      n_segs += (pg->Interiors + ib)->Points;
+	  pg = pg->Next;
+      }
+    while (dim < 1024 && (dim * dim) < n_segs)
+	dim *= 2;
+
+    grid = malloc (sizeof (struct mask_grid));
+    gaiaMbrGeometry (geom);
+    grid->minx = geom->MinX;
+    grid->miny = geom->MinY;
+    grid->maxx = geom->MaxX;
+    grid->maxy = geom->MaxY;
+    grid->rows = dim;
+    grid->cols = dim;
+    grid->cell_w = (grid->maxx - grid->minx) / (double) dim;
+    grid->cell_h = (grid->maxy - grid->miny) / (double) dim;
+    if (grid->cell_w <= 0.0 || grid->cell_h <= 0.0)
+      {
+	  /* degenerate mask */
+	  free (grid);
+	  return NULL;
+      }
+    grid->cells = malloc (dim * dim);
+    memset (grid->cells, MASK_CELL_OUTSIDE, dim * dim);
+    grid->row_segs = malloc (sizeof (struct mask_row) * dim);
+    for (r = 0; r < dim; r++)
+      {
+	  grid->row_segs[r].count = 0;
+	  grid->row_segs[r].next = 0;
+	  grid->row_segs[r].coords = NULL;
+      }
+
+/* first pass: counting the segments crossing each row */
+    mask_all_segments (grid, geom, 0);
+    for (r = 0; r < dim; r++)
+      {
+	  if (grid->row_segs[r].count > 0)
+	      grid->row_segs[r].coords =
+		  malloc (sizeof (double) * 4 * grid->row_segs[r].count);
+      }
+/* second pass: storing the segments and marking BOUNDARY cells */
+    mask_all_segments (grid, geom, 1);
+
+/* classifying all remaining cells by testing their center */
+    for (r = 0; r < dim; r++)
+      {
+	  double y = grid->miny + (grid->cell_h * r) + (grid->cell_h / 2.0);
+	  for (c = 0; c < dim; c++)
+	    {
+		double x;
+		unsigned char *cell = grid->cells + (r * dim) + c;
+		if (*cell == MASK_CELL_BOUNDARY)
+		    continue;
+		x = grid->minx + (grid->cell_w * c) + (grid->cell_w / 2.0);
+		if (mask_row_contains (grid->row_segs + r, x, y))
+		    *cell = MASK_CELL_INSIDE;
+	    }
+      }
+    return grid;
+}
+
+static int
+mask_grid_contains (struct mask_grid *grid, double x, double y)
+{
+/* testing if a Point falls within the mask */
+    int r;
+    int c;
+    unsigned char cell;
+    if (x < grid->minx || x > grid->maxx || y < grid->miny || y > grid->maxy)
+	return 0;
+    r = mask_grid_row (grid, y);
+    c = mask_grid_col (grid, x);
+    cell = grid->cells[(r * grid->cols) + c];
+    if (cell == MASK_CELL_INSIDE)
+	return 1;
+    if (cell == MASK_CELL_OUTSIDE)
+	return 0;
+/* BOUNDARY cell: exact test */
+    return mask_row_contains (grid->row_segs + r, x, y);
+}
+
 static int
-filter_nodes (sqlite3 * handle, void *mask, int mask_len)
+filter_nodes (sqlite3 * handle, void *mask, int mask_len,
+	      struct mask_grid *grid)
 {
 /* filtering any NODE to be exported */
     char sql[1024];
@@ -1027,9 +2070,18 @@ filter_nodes (sqlite3 * handle, void *mask, int mask_len)
       }
 
 /* preparing the QUERY NODES statement */
-    strcpy (sql, "SELECT node_id FROM osm_nodes ");
-    strcat (sql, "WHERE MbrIntersects(Geometry, ?) = 1 ");
-    strcat (sql, "AND ST_Intersects(Geometry, ?) = 1");
+    if (grid != NULL)
+      {
+	  /* the exact test will be performed against the mask grid */
+	  strcpy (sql, "SELECT node_id, ST_X(Geometry), ST_Y(Geometry) ");
+	  strcat (sql, "FROM osm_nodes WHERE MbrIntersects(Geometry, ?) = 1");
+      }
+    else
+      {
+	  strcpy (sql, "SELECT node_id, NULL, NULL FROM osm_nodes ");
+	  strcat (sql, "WHERE MbrIntersects(Geometry, ?) = 1 ");
+	  strcat (sql, "AND ST_Intersects(Geometry, ?) = 1");
+      }
     ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &query, NULL);
     if (ret != SQLITE_OK)
       {
@@ -1037,7 +2089,8 @@ filter_nodes (sqlite3 * handle, void *mask, int mask_len)
 	  return 0;
       }
     sqlite3_bind_blob (query, 1, mask, mask_len, SQLITE_STATIC);
-    sqlite3_bind_blob (query, 2, mask, mask_len, SQLITE_STATIC);
+    if (grid == NULL)
+	sqlite3_bind_blob (query, 2, mask, mask_len, SQLITE_STATIC);
 
     while (1)
       {
@@ -1052,6 +2105,13 @@ filter_nodes (sqlite3 * handle, void *mask, int mask_len)
 	    {
 		/* ok, we've just fetched a valid row */
 		sqlite3_int64 id = sqlite3_column_int64 (query, 0);
+		if (grid != NULL)
+		  {
+		      double x = sqlite3_column_double (query, 1);
+		      double y = sqlite3_column_double (query, 2);
+		      if (!mask_grid_contains (grid, x, y))
+			  continue;
+		  }
 
 		/* marking this NODE as filtered */
 		sqlite3_reset (stmt_nodes);
@@ -1129,7 +2189,8 @@ filter_nodes (sqlite3 * handle, void *mask, int mask_len)
 }
 
 static int
-parse_wkt_mask (const char *wkt_path, void **mask, int *mask_len)
+parse_wkt_mask (const char *wkt_path, void **mask, int *mask_len,
+		gaiaGeomCollPtr * mask_geom)
 {
 /* acquiring the WKT mask */
     int cnt = 0;
@@ -1180,7 +2241,7 @@ parse_wkt_mask (const char *wkt_path, void **mask, int *mask_len)
 
 /* converting to Binary Blob */
     gaiaToSpatiaLiteBlobWkb (geom, (unsigned char **) mask, mask_len);
-    gaiaFreeGeomColl (geom);
+    *mask_geom = geom;
     return 1;
 }
 
@@ -1622,7 +2683,11 @@ do_help ()
 	     "-h or --help                    print this help message\n");
     fprintf (stderr, "-v or --version                 print version infos\n");
     fprintf (stderr,
-	     "-o or --osm-path pathname       the OSM-XML [output] file path\n");
+	     "-o or --osm-path pathname       the OSM [output] file path\n");
+    fprintf (stderr,
+	     "                 OSM-ProtoBuf is written when the path\n");
+    fprintf (stderr,
+	     "                 ends by *.pbf, otherwise OSM-XML.\n");
     fprintf (stderr,
 	     "-w or --wkt-mask-path pathname  path of text file [WKT mask]\n");
     fprintf (stderr,
@@ -1634,6 +2699,8 @@ do_help ()
 	     "-m or --in-memory               using IN-MEMORY database\n");
     fprintf (stderr,
 	     "-jo or --journal-off            unsafe [but faster] mode\n");
+    fprintf (stderr,
+	     "-threads or --threads num       PBF compression threads (default 2)\n");
 }
 
 int
@@ -1649,10 +2716,15 @@ main (int argc, char *argv[])
     int in_memory = 0;
     int cache_size = 0;
     int journal_off = 0;
+    int threads = 2;
     int error = 0;
     void *mask = NULL;
     int mask_len = 0;
+    gaiaGeomCollPtr mask_geom = NULL;
+    struct mask_grid *grid = NULL;
     FILE *out = NULL;
+    struct osm_output output;
+    int len;
     char *sql_err = NULL;
     int ret;
     void *cache;
@@ -1676,6 +2748,9 @@ main (int argc, char *argv[])
 		  case ARG_CACHE_SIZE:
 		      cache_size = atoi (argv[i]);
 		      break;
+		  case ARG_THREADS:
+		      threads = atoi (argv[i]);
+		      break;
 		  };
 		next_arg = ARG_NONE;
 		continue;
@@ -1728,6 +2803,12 @@ main (int argc, char *argv[])
 		next_arg = ARG_CACHE_SIZE;
 		continue;
 	    }
+	  if (strcasecmp (argv[i], "--threads") == 0
+	      || strcmp (argv[i], "-threads") == 0)
+	    {
+		next_arg = ARG_THREADS;
+		continue;
+	    }
 	  if (strcasecmp (argv[i], "-m") == 0)
 	    {
 		in_memory = 1;
@@ -1779,6 +2860,12 @@ main (int argc, char *argv[])
 		   "did you forget setting the --wkt-mask-path argument ?\n");
 	  error = 1;
       }
+    if (threads < 1 || threads > 16)
+      {
+	  fprintf (stderr,
+		   "invalid number of compression threads (expected 1 to 16)\n");
+	  error = 1;
+      }
 
     if (error)
       {
@@ -1786,16 +2873,23 @@ main (int argc, char *argv[])
 	  return -1;
       }
 
-    if (!parse_wkt_mask (wkt_path, &mask, &mask_len))
+    if (!parse_wkt_mask (wkt_path, &mask, &mask_len, &mask_geom))
       {
 	  fprintf (stderr,
 		   "ERROR: Invalid WKT mask [not a valid WKT expression]\n");
 	  return -1;
       }
+/* building the mask grid (Polygon masks only) */
+    grid = build_mask_grid (mask_geom);
+    gaiaFreeGeomColl (mask_geom);
 
 /* opening the DB */
     if (in_memory)
 	cache_size = 0;
+    output.xml = NULL;
+    output.pbf = NULL;
+    output.element = NULL;
+    output.pending = 0;
     cache = spatialite_alloc_connection ();
     open_db (db_path, &handle, cache_size, cache);
     if (!handle)
@@ -1842,6 +2936,15 @@ main (int argc, char *argv[])
     out = fopen (osm_path, "wb");
     if (out == NULL)
 	goto stop;
+/* the output format is determined by the file extension */
+    len = strlen (osm_path);
+    if (len > 4 && strcasecmp (osm_path + len - 4, ".pbf") == 0)
+      {
+	  output.pbf = alloc_pbf_writer (out, threads);
+	  fprintf (stderr, "\nexporting OSM-ProtoBuf\n");
+      }
+    else
+	output.xml = alloc_xml_writer (out);
 
     if (journal_off)
       {
@@ -1863,7 +2966,7 @@ main (int argc, char *argv[])
 	goto stop;
 
 /* identifying filtered nodes */
-    if (!filter_nodes (handle, mask, mask_len))
+    if (!filter_nodes (handle, mask, mask_len, grid))
 	goto stop;
 
 /* identifying relations depending on other relations */
@@ -1883,12 +2986,19 @@ main (int argc, char *argv[])
 	goto stop;
 
 /* writing the OSM header */
-    fprintf (out, "<?xml version='1.0' encoding='UTF-8'?>\n");
-    fprintf (out, "<osm version=\"0.6\" generator=\"splite2osm\">\n");
+    if (output.pbf != NULL)
+	pbf_write_header (output.pbf);
+    else
+      {
+	  xml_write_str (output.xml,
+			 "<?xml version='1.0' encoding='UTF-8'?>\n");
+	  xml_write_str (output.xml,
+			 "<osm version=\"0.6\" generator=\"splite2osm\">\n");
+      }
 
     fprintf (stderr, "OutNodes\n");
 /* exporting OSM NODES */
-    if (!do_output_nodes (out, handle))
+    if (!do_output_nodes (&output, handle))
       {
 	  fprintf (stderr, "\nThe output OSM file is corrupted !!!\n");
 	  goto stop;
@@ -1896,7 +3006,7 @@ main (int argc, char *argv[])
 
     fprintf (stderr, "OutWays\n");
 /* exporting OSM WAYS */
-    if (!do_output_ways (out, handle))
+    if (!do_output_ways (&output, handle))
       {
 	  fprintf (stderr, "\nThe output OSM file is corrupted !!!\n");
 	  goto stop;
@@ -1904,17 +3014,33 @@ main (int argc, char *argv[])
 
     fprintf (stderr, "OutRelations\n");
 /* exporting OSM RELATIONS */
-    if (!do_output_relations (out, handle))
+    if (!do_output_relations (&output, handle))
       {
 	  fprintf (stderr, "\nThe output OSM file is corrupted !!!\n");
 	  goto stop;
       }
 
 /* writing the OSM footer */
-    fprintf (out, "</osm>\n");
+    if (output.pbf != NULL)
+      {
+	  pbf_flush_block (output.pbf);
+	  pbf_stop_compressors (output.pbf);
+	  if (output.pbf->error)
+	      fprintf (stderr, "\nThe output OSM file is corrupted !!!\n");
+      }
+    else
+      {
+	  xml_write_str (output.xml, "</osm>\n");
+	  xml_writer_flush (output.xml);
+	  if (output.xml->error)
+	      fprintf (stderr, "\nThe output OSM file is corrupted !!!\n");
+      }
 
   stop:
     free (mask);
+    free_mask_grid (grid);
+    free_xml_writer (output.xml);
+    free_pbf_writer (output.pbf);
     sqlite3_close (handle);
     spatialite_cleanup_ex (cache);
     if (out != NULL)
@@ -40,6 +40,12 @@
 #include <libxml/parser.h>
 #include <libxml/nanohttp.h>
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include <zlib.h>
+
 #include <sqlite3.h>
 #include <spatialite/gaiageo.h>
 #include <spatialite.h>
@@ -53,6 +59,8 @@
 #define ARG_DB_PATH		6
 #define ARG_MODE		7
 #define ARG_CACHE_SIZE	8
+#define ARG_THREADS		9
+#define ARG_CACHE_DIR	10
 
 #define MODE_RAW	1
 #define MODE_MAP	2
@@ -63,6 +71,14 @@
 #define OBJ_WAYS		2
 #define OBJ_RELATIONS	3
 
+#define JOB_PENDING		0
+#define JOB_RUNNING		1
+#define JOB_READY		2
+#define JOB_FAILED		3
+
+#define NODE_RESOLVED	1
+#define NODE_GRAPH	2
+
 #if defined(_WIN32)
 #define atol_64		_atoi64
 #else
@@ -172,6 +188,19 @@ struct tiled_download
     struct download_tile *last;
 };
 
+struct node_coords
+{
+/* in-memory Node table: ID -> coordinates and Way refcount */
+    int count;
+    int max;
+    sqlite3_int64 *ids;
+    double *coords;		/* X,Y interleaved */
+    int *way_count;
+    unsigned char *flags;
+    int hash_size;
+    int *hash;			/* open addressing: index + 1, 0 if empty */
+};
+
 struct aux_params
 {
 /* an auxiliary struct used for XML parsing */
@@ -203,6 +232,7 @@ struct aux_params
     sqlite3_int64 current_rel_id;
     int current_rel_tag_sub;
     int current_rel_ref_sub;
+    struct node_coords nodes;
 };
 
 struct aux_arc
@@ -210,8 +240,6 @@ struct aux_arc
 /* an helper struct used to build Road/Rail arcs */
     sqlite3_int64 node_from;
     sqlite3_int64 node_to;
-    gaiaGeomCollPtr geom_from;
-    gaiaGeomCollPtr geom_to;
     gaiaGeomCollPtr geom;
     struct aux_arc *next;
 };
@@ -223,6 +251,84 @@ struct aux_arc_container
     struct aux_arc *last;
 };
 
+struct ordered_scan
+{
+/* a result set ordered by object ID */
+    sqlite3_stmt *stmt;
+    int valid;
+    sqlite3_int64 id;
+};
+
+struct tag_pivot
+{
+/* all Tags of a single object */
+    sqlite3_int64 id;
+    int count;
+    int max;
+    char **keys;
+    char **values;
+};
+
+struct way_refs
+{
+/* all Node refs of a single Way */
+    int count;
+    int max;
+    sqlite3_int64 *ids;
+};
+
+struct osm_sax_state
+{
+/* the SAX parser current state */
+    struct aux_params *params;
+    int depth;
+    int parent;
+    int error;
+};
+
+struct download_job
+{
+/* a single Overpass request */
+    struct download_tile *tile;
+    int object;
+    char *url;
+    int status;
+    FILE *spool;		/* the raw response, unless cached */
+    char *cache_path;
+    int cache_gzip;
+};
+
+struct payload_sink
+{
+/* the destination of a downloaded payload */
+    FILE *out;
+    gzFile gz_out;
+};
+
+struct download_pool
+{
+/*
+/ a bounded pool of concurrent fetchers
+/
+/ requests are claimed in order by the fetchers, but no more than
+/ "window" requests may be waiting for the (single) writer
+/ so to keep disk usage under control
+*/
+    struct download_job *jobs;
+    int count;
+    int next;
+    int consumed;
+    int window;
+    int abort;
+    int n_workers;
+    int skipped;
+#ifndef _WIN32
+    pthread_t *workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+};
+
 static void
 finalize_map_stmts ()
 {
@@ -283,6 +389,133 @@ downloader_cleanup (struct tiled_download *obj)
       }
 }
 
+static void
+init_node_coords (struct node_coords *nodes)
+{
+/* initializing the in-memory Node table */
+    nodes->count = 0;
+    nodes->max = 0;
+    nodes->ids = NULL;
+    nodes->coords = NULL;
+    nodes->way_count = NULL;
+    nodes->flags = NULL;
+    nodes->hash_size = 0;
+    nodes->hash = NULL;
+}
+
+static void
+free_node_coords (struct node_coords *nodes)
+{
+/* freeing the in-memory Node table */
+    if (nodes->ids != NULL)
+	free (nodes->ids);
+    if (nodes->coords != NULL)
+	free (nodes->coords);
+    if (nodes->way_count != NULL)
+	free (nodes->way_count);
+    if (nodes->flags != NULL)
+	free (nodes->flags);
+    if (nodes->hash != NULL)
+	free (nodes->hash);
+    init_node_coords (nodes);
+}
+
+static int
+node_hash_slot (struct node_coords *nodes, sqlite3_int64 id)
+{
+/* locating the hash slot of some Node ID (linear probing) */
+    sqlite3_uint64 hash = (sqlite3_uint64) id * 0x9e3779b97f4a7c15;
+    int mask = nodes->hash_size - 1;
+    int pos = (int) (hash >> 32) & mask;
+    while (1)
+      {
+	  int idx = nodes->hash[pos];
+	  if (idx == 0)
+	      return pos;
+	  if (nodes->ids[idx - 1] == id)
+	      return pos;
+	  pos = (pos + 1) & mask;
+      }
+}
+
+static void
+rehash_node_coords (struct node_coords *nodes)
+{
+/* doubling the hash table size */
+    int i;
+    if (nodes->hash != NULL)
+	free (nodes->hash);
+    if (nodes->hash_size == 0)
+	nodes->hash_size = 131072;
+    else
+	nodes->hash_size *= 2;
+    nodes->hash = calloc (nodes->hash_size, sizeof (int));
+    for (i = 0; i < nodes->count; i++)
+	nodes->hash[node_hash_slot (nodes, nodes->ids[i])] = i + 1;
+}
+
+static int
+fetch_node_coords (struct node_coords *nodes, sqlite3_int64 id)
+{
+/* returning the Node index, inserting a new unresolved Node if required */
+    int pos;
+    int idx;
+    if ((nodes->count + 1) * 2 > nodes->hash_size)
+	rehash_node_coords (nodes);
+    pos = node_hash_slot (nodes, id);
+    if (nodes->hash[pos] != 0)
+	return nodes->hash[pos] - 1;
+    idx = nodes->count;
+    if (idx == nodes->max)
+      {
+	  /* growing the arrays */
+	  if (nodes->max == 0)
+	      nodes->max = 65536;
+	  else
+	      nodes->max *= 2;
+	  nodes->ids = realloc (nodes->ids, sizeof (sqlite3_int64) * nodes->max);
+	  nodes->coords =
+	      realloc (nodes->coords, sizeof (double) * 2 * nodes->max);
+	  nodes->way_count =
+	      realloc (nodes->way_count, sizeof (int) * nodes->max);
+	  nodes->flags = realloc (nodes->flags, nodes->max);
+      }
+    nodes->ids[idx] = id;
+    nodes->coords[idx * 2] = 0.0;
+    nodes->coords[(idx * 2) + 1] = 0.0;
+    nodes->way_count[idx] = 0;
+    nodes->flags[idx] = 0;
+    nodes->hash[pos] = idx + 1;
+    nodes->count += 1;
+    return idx;
+}
+
+static int
+find_node_coords (struct node_coords *nodes, sqlite3_int64 id)
+{
+/* searching a resolved Node by ID; -1 if not found */
+    int idx;
+    if (nodes->hash == NULL)
+	return -1;
+    idx = nodes->hash[node_hash_slot (nodes, id)] - 1;
+    if (idx < 0)
+	return -1;
+    if ((nodes->flags[idx] & NODE_RESOLVED) == 0)
+	return -1;
+    return idx;
+}
+
+static void
+set_node_coords (struct node_coords *nodes, sqlite3_int64 id, double x,
+		 double y)
+{
+/* storing the coordinates of some Node */
+    int idx = fetch_node_coords (nodes, id);
+    nodes->coords[idx * 2] = x;
+    nodes->coords[(idx * 2) + 1] = y;
+    nodes->flags[idx] |= NODE_RESOLVED;
+}
+
 static int
 insert_node_tag (struct aux_params *params, const char *k, const char *v)
 {
@@ -317,7 +550,15 @@ insert_way_ref (struct aux_params *params, sqlite3_int64 node_id)
     sqlite3_bind_int64 (params->ins_way_refs_stmt, 3, node_id);
     ret = sqlite3_step (params->ins_way_refs_stmt);
     if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-	params->wr_way_refs += 1;
+      {
+	  params->wr_way_refs += 1;
+	  if (params->mode != MODE_RAW)
+	    {
+		/* updating the in-memory Way refcount */
+		int idx = fetch_node_coords (&(params->nodes), node_id);
+		params->nodes.way_count[idx] += 1;
+	    }
+      }
     params->current_way_ref_sub += 1;
     return 1;
 }
@@ -444,7 +685,11 @@ insert_node (struct aux_params *params, sqlite3_int64 id, double x, double y,
       }
     ret = sqlite3_step (params->ins_nodes_stmt);
     if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-	params->wr_nodes += 1;
+      {
+	  params->wr_nodes += 1;
+	  if (params->mode != MODE_RAW)
+	      set_node_coords (&(params->nodes), id, x, y);
+      }
     params->current_node_id = id;
     params->current_node_tag_sub = 0;
     return 1;
@@ -484,430 +729,189 @@ insert_relation (struct aux_params *params, sqlite3_int64 id)
     return 1;
 }
 
-const char *
-parse_attribute_value (xmlNodePtr node)
+static const char *
+sax_attribute (const xmlChar ** atts, const char *name)
 {
-/* parsing a string argument */
-    if (node != NULL)
+/* searching a SAX attribute by name */
+    int i;
+    if (atts == NULL)
+	return NULL;
+    for (i = 0; atts[i] != NULL; i += 2)
       {
-	  if (node->type == XML_TEXT_NODE)
-	      return (const char *) (node->content);
+	  if (strcmp ((const char *) (atts[i]), name) == 0)
+	      return (const char *) (atts[i + 1]);
       }
     return NULL;
 }
 
 static int
-parse_osm_nd_ref (struct _xmlAttr *attr, sqlite3_int64 * node_id)
+parse_osm_node (const xmlChar ** atts, struct aux_params *params)
 {
-/* parsing the OSM <node> attributes */
-    const char *attr_ref = NULL;
-    while (attr != NULL)
-      {
-	  if (attr->name != NULL)
-	    {
-		if (strcmp ((const char *) (attr->name), "ref") == 0)
-		    attr_ref = parse_attribute_value (attr->children);
-	    }
-	  attr = attr->next;
-      }
-    if (attr_ref == NULL)
+/* parsing an OSM <node> item */
+    const char *attr_id = sax_attribute (atts, "id");
+    const char *attr_lon = sax_attribute (atts, "lon");
+    const char *attr_lat = sax_attribute (atts, "lat");
+    const char *attr_version = sax_attribute (atts, "version");
+    const char *attr_uid = sax_attribute (atts, "uid");
+    const char *attr_changeset = sax_attribute (atts, "changeset");
+    int version = -1;
+    int uid = -1;
+    int changeset = -1;
+    if (attr_id == NULL || attr_lon == NULL || attr_lat == NULL)
       {
-	  fprintf (stderr, "Invalid OSM <nd>: ref=%s\n", attr_ref);
+	  fprintf (stderr, "Invalid OSM <node>: id=%s lat=%s lon=%s\n", attr_id,
+		   attr_lon, attr_lat);
 	  return 0;
       }
-    *node_id = atol_64 (attr_ref);
-    return 1;
+    if (attr_version != NULL)
+	version = atoi (attr_version);
+    if (attr_uid != NULL)
+	uid = atoi (attr_uid);
+    if (attr_changeset != NULL)
+	changeset = atoi (attr_changeset);
+    return insert_node (params, atol_64 (attr_id), atof (attr_lon),
+			atof (attr_lat), version, sax_attribute (atts,
+								 "timestamp"),
+			uid, changeset, sax_attribute (atts, "user"));
 }
 
 static int
-parse_osm_member (struct _xmlAttr *attr, const char **type, sqlite3_int64 * ref,
-		  const char **role)
+parse_osm_way (const xmlChar ** atts, struct aux_params *params)
 {
-/* parsing the OSM <member> attributes */
-    const char *attr_type = NULL;
-    const char *attr_ref = NULL;
-    const char *attr_role = NULL;
-    while (attr != NULL)
-      {
-	  if (attr->name != NULL)
-	    {
-		if (strcmp ((const char *) (attr->name), "type") == 0)
-		    attr_type = parse_attribute_value (attr->children);
-		if (strcmp ((const char *) (attr->name), "ref") == 0)
-		    attr_ref = parse_attribute_value (attr->children);
-		if (strcmp ((const char *) (attr->name), "role") == 0)
-		    attr_role = parse_attribute_value (attr->children);
-	    }
-	  attr = attr->next;
-      }
-    if (attr_type == NULL || attr_ref == NULL || attr_role == NULL)
+/* parsing an OSM <way> item */
+    const char *attr_id = sax_attribute (atts, "id");
+    if (attr_id == NULL)
       {
-	  fprintf (stderr, "Invalid OSM <member>: type=%s ref=%s role=%s\n",
-		   attr_type, attr_ref, attr_role);
+	  fprintf (stderr, "Invalid OSM <way>: id=%s\n", attr_id);
 	  return 0;
       }
-    *type = attr_type;
-    *ref = atol_64 (attr_ref);
-    *role = attr_role;
-    return 1;
+    return insert_way (params, atol_64 (attr_id));
 }
 
 static int
-parse_osm_tag (struct _xmlAttr *attr, const char **k, const char **v)
+parse_osm_relation (const xmlChar ** atts, struct aux_params *params)
 {
-/* parsing the OSM <tag> attributes */
-    const char *attr_k = NULL;
-    const char *attr_v = NULL;
-    while (attr != NULL)
-      {
-	  if (attr->name != NULL)
-	    {
-		if (strcmp ((const char *) (attr->name), "k") == 0)
-		    attr_k = parse_attribute_value (attr->children);
-		if (strcmp ((const char *) (attr->name), "v") == 0)
-		    attr_v = parse_attribute_value (attr->children);
-	    }
-	  attr = attr->next;
-      }
-    if (attr_k == NULL || attr_v == NULL)
+/* parsing an OSM <relation> item */
+    const char *attr_id = sax_attribute (atts, "id");
+    if (attr_id == NULL)
       {
-	  fprintf (stderr, "Invalid OSM <tag>: k=%s v=%s\n", attr_k, attr_v);
+	  fprintf (stderr, "Invalid OSM <relation>: id=%s\n", attr_id);
 	  return 0;
       }
-    *k = attr_k;
-    *v = attr_v;
-    return 1;
+    return insert_relation (params, atol_64 (attr_id));
 }
 
 static int
-parse_osm_node_attributes (struct _xmlAttr *attr, sqlite3_int64 * id, double *x,
-			   double *y, int *version, const char **timestamp,
-			   int *uid, int *changeset, const char **user)
+parse_osm_tag (const xmlChar ** atts, struct aux_params *params, int parent)
 {
-/* parsing the OSM <node> attributes */
-    const char *attr_id = NULL;
-    const char *attr_lon = NULL;
-    const char *attr_lat = NULL;
-    const char *attr_version = NULL;
-    const char *attr_timestamp = NULL;
-    const char *attr_uid = NULL;
-    const char *attr_changeset = NULL;
-    const char *attr_user = NULL;
-    while (attr != NULL)
-      {
-	  if (attr->name != NULL)
-	    {
-		if (strcmp ((const char *) (attr->name), "id") == 0)
-		    attr_id = parse_attribute_value (attr->children);
-		if (strcmp ((const char *) (attr->name), "lon") == 0)
-		    attr_lon = parse_attribute_value (attr->children);
-		if (strcmp ((const char *) (attr->name), "lat") == 0)
-		    attr_lat = parse_attribute_value (attr->children);
-		if (strcmp ((const char *) (attr->name), "version") == 0)
-		    attr_version = parse_attribute_value (attr->children);
-		if (strcmp ((const char *) (attr->name), "timestamp") == 0)
-		    attr_timestamp = parse_attribute_value (attr->children);
-		if (strcmp ((const char *) (attr->name), "uid") == 0)
-		    attr_uid = parse_attribute_value (attr->children);
-		if (strcmp ((const char *) (attr->name), "changeset") == 0)
-		    attr_changeset = parse_attribute_value (attr->children);
-		if (strcmp ((const char *) (attr->name), "user") == 0)
-		    attr_user = parse_attribute_value (attr->children);
-	    }
-	  attr = attr->next;
-      }
-    if (attr_id == NULL || attr_lon == NULL || attr_lat == NULL)
+/* parsing an OSM <tag> item */
+    const char *attr_k = sax_attribute (atts, "k");
+    const char *attr_v = sax_attribute (atts, "v");
+    if (attr_k == NULL || attr_v == NULL)
       {
-	  fprintf (stderr, "Invalid OSM <node>: id=%s lat=%s lon=%s\n", attr_id,
-		   attr_lon, attr_lat);
+	  fprintf (stderr, "Invalid OSM <tag>: k=%s v=%s\n", attr_k, attr_v);
 	  return 0;
       }
-    *id = atol_64 (attr_id);
-    *x = atof (attr_lon);
-    *y = atof (attr_lat);
-    if (attr_version == NULL)
-	*version = -1;
-    else
-	*version = atoi (attr_version);
-    *timestamp = attr_timestamp;
-    if (attr_uid == NULL)
-	*uid = -1;
-    else
-	*uid = atoi (attr_uid);
-    if (attr_changeset == NULL)
-	*changeset = -1;
-    else
-	*changeset = atoi (attr_changeset);
-    *user = attr_user;
+    if (parent == OBJ_NODES)
+	return insert_node_tag (params, attr_k, attr_v);
+    if (parent == OBJ_WAYS)
+	return insert_way_tag (params, attr_k, attr_v);
+    if (parent == OBJ_RELATIONS)
+	return insert_relation_tag (params, attr_k, attr_v);
     return 1;
 }
 
 static int
-parse_osm_way_attributes (struct _xmlAttr *attr, sqlite3_int64 * id)
+parse_osm_nd_ref (const xmlChar ** atts, struct aux_params *params)
 {
-/* parsing the OSM <way> attributes */
-    const char *attr_id = NULL;
-    while (attr != NULL)
-      {
-	  if (attr->name != NULL)
-	    {
-		if (strcmp ((const char *) (attr->name), "id") == 0)
-		    attr_id = parse_attribute_value (attr->children);
-	    }
-	  attr = attr->next;
-      }
-    if (attr_id == NULL)
+/* parsing an OSM <way><nd> item */
+    const char *attr_ref = sax_attribute (atts, "ref");
+    if (attr_ref == NULL)
       {
-	  fprintf (stderr, "Invalid OSM <way>: id=%s\n", attr_id);
+	  fprintf (stderr, "Invalid OSM <nd>: ref=%s\n", attr_ref);
 	  return 0;
       }
-    *id = atol_64 (attr_id);
-    return 1;
+    return insert_way_ref (params, atol_64 (attr_ref));
 }
 
 static int
-parse_osm_relation_attributes (struct _xmlAttr *attr, sqlite3_int64 * id)
+parse_osm_member (const xmlChar ** atts, struct aux_params *params)
 {
-/* parsing the OSM <relation> attributes */
-    const char *attr_id = NULL;
-    while (attr != NULL)
-      {
-	  if (attr->name != NULL)
-	    {
-		if (strcmp ((const char *) (attr->name), "id") == 0)
-		    attr_id = parse_attribute_value (attr->children);
-	    }
-	  attr = attr->next;
-      }
-    if (attr_id == NULL)
+/* parsing an OSM <relation><member> item */
+    const char *attr_type = sax_attribute (atts, "type");
+    const char *attr_ref = sax_attribute (atts, "ref");
+    const char *attr_role = sax_attribute (atts, "role");
+    if (attr_type == NULL || attr_ref == NULL || attr_role == NULL)
       {
-	  fprintf (stderr, "Invalid OSM <relation>: id=%s\n", attr_id);
+	  fprintf (stderr, "Invalid OSM <member>: type=%s ref=%s role=%s\n",
+		   attr_type, attr_ref, attr_role);
 	  return 0;
       }
-    *id = atol_64 (attr_id);
-    return 1;
-}
-
-static int
-parse_osm_node_tag (xmlNodePtr node, struct aux_params *params)
-{
-/* recursively parsing an OSM <node><tag> item */
-    const char *k;
-    const char *v;
-    if (!parse_osm_tag (node->properties, &k, &v))
-	return 0;
-    if (!insert_node_tag (params, k, v))
-	return 0;
-    return 1;
-}
-
-static int
-parse_osm_way_tag (xmlNodePtr node, struct aux_params *params)
-{
-/* recursively parsing an OSM <way><tag> item */
-    const char *k;
-    const char *v;
-    if (!parse_osm_tag (node->properties, &k, &v))
-	return 0;
-    if (!insert_way_tag (params, k, v))
-	return 0;
-    return 1;
-}
-
-static int
-parse_osm_relation_tag (xmlNodePtr node, struct aux_params *params)
-{
-/* recursively parsing an OSM <relation><tag> item */
-    const char *k;
-    const char *v;
-    if (!parse_osm_tag (node->properties, &k, &v))
-	return 0;
-    if (!insert_relation_tag (params, k, v))
-	return 0;
-    return 1;
-}
-
-static int
-parse_osm_way_ref (xmlNodePtr node, struct aux_params *params)
-{
-/* recursively parsing an OSM <way><nd> item */
-    sqlite3_int64 node_id;
-    if (!parse_osm_nd_ref (node->properties, &node_id))
-	return 0;
-    if (!insert_way_ref (params, node_id))
-	return 0;
-    return 1;
-}
-
-static int
-parse_osm_relation_member (xmlNodePtr node, struct aux_params *params)
-{
-/* recursively parsing an OSM <relation><member> item */
-    const char *type;
-    sqlite3_int64 ref;
-    const char *role;
-    if (!parse_osm_member (node->properties, &type, &ref, &role))
-	return 0;
-    if (!insert_relation_ref (params, type, ref, role))
-	return 0;
-    return 1;
+    return insert_relation_ref (params, attr_type, atol_64 (attr_ref),
+				attr_role);
 }
 
-static int
-parse_osm_node (xmlNodePtr node, struct aux_params *params)
+static void
+osm_sax_start (void *ctx, const xmlChar * name, const xmlChar ** atts)
 {
-/* recursively parsing an OSM <node> item */
-    xmlNodePtr child;
-    sqlite3_int64 id;
-    double x;
-    double y;
-    int version;
-    const char *timestamp;
-    int uid;
-    int changeset;
-    const char *user;
-    int error = 0;
-
-    if (!parse_osm_node_attributes
-	(node->properties, &id, &x, &y, &version, &timestamp, &uid, &changeset,
-	 &user))
-	return 0;
-    if (!insert_node
-	(params, id, x, y, version, timestamp, uid, changeset, user))
-	return 0;
-    for (child = node->children; child; child = child->next)
+/* SAX callback: an XML element has just been opened */
+    struct osm_sax_state *state = (struct osm_sax_state *) ctx;
+    const char *el = (const char *) name;
+    int ret = 1;
+    state->depth += 1;
+    if (state->depth == 2)
       {
-	  if (child->type == XML_ELEMENT_NODE)
+	  /* top-level OSM items */
+	  state->parent = 0;
+	  if (strcmp (el, "node") == 0)
 	    {
-		const char *name = (const char *) (child->name);
-		if (name != NULL)
-		  {
-		      int ret = 1;
-		      if (strcmp (name, "tag") == 0)
-			  ret = parse_osm_node_tag (child, params);
-		      if (!ret)
-			  error = 1;
-		  }
+		state->parent = OBJ_NODES;
+		ret = parse_osm_node (atts, state->params);
 	    }
-      }
-    if (error)
-	return 0;
-    return 1;
-}
-
-static int
-parse_osm_way (xmlNodePtr node, struct aux_params *params)
-{
-/* recursively parsing an OSM <way> item */
-    xmlNodePtr child;
-    sqlite3_int64 id;
-    int error = 0;
-
-    if (!parse_osm_way_attributes (node->properties, &id))
-	return 0;
-    if (!insert_way (params, id))
-	return 0;
-    for (child = node->children; child; child = child->next)
-      {
-	  if (child->type == XML_ELEMENT_NODE)
+	  else if (strcmp (el, "way") == 0)
 	    {
-		const char *name = (const char *) (child->name);
-		if (name != NULL)
-		  {
-		      int ret = 1;
-		      if (strcmp (name, "nd") == 0)
-			  ret = parse_osm_way_ref (child, params);
-		      if (strcmp (name, "tag") == 0)
-			  ret = parse_osm_way_tag (child, params);
-		      if (!ret)
-			  error = 1;
-		  }
+		state->parent = OBJ_WAYS;
+		ret = parse_osm_way (atts, state->params);
 	    }
-      }
-    if (error)
-	return 0;
-    return 1;
-}
-
-static int
-parse_osm_relation (xmlNodePtr node, struct aux_params *params)
-{
-/* recursively parsing an OSM <relation> item */
-    xmlNodePtr child;
-    sqlite3_int64 id;
-    int error = 0;
-
-    if (!parse_osm_relation_attributes (node->properties, &id))
-	return 0;
-    if (!insert_relation (params, id))
-	return 0;
-    for (child = node->children; child; child = child->next)
-      {
-	  if (child->type == XML_ELEMENT_NODE)
+	  else if (strcmp (el, "relation") == 0)
 	    {
-		const char *name = (const char *) (child->name);
-		if (name != NULL)
-		  {
-		      int ret = 1;
-		      if (strcmp (name, "member") == 0)
-			  ret = parse_osm_relation_member (child, params);
-		      if (strcmp (name, "tag") == 0)
-			  ret = parse_osm_relation_tag (child, params);
-		      if (!ret)
-			  error = 1;
-		  }
+		state->parent = OBJ_RELATIONS;
+		ret = parse_osm_relation (atts, state->params);
 	    }
       }
-    if (error)
-	return 0;
-    return 1;
+    else if (state->depth == 3 && state->parent != 0)
+      {
+	  /* children of some OSM item */
+	  if (strcmp (el, "tag") == 0)
+	      ret = parse_osm_tag (atts, state->params, state->parent);
+	  else if (strcmp (el, "nd") == 0 && state->parent == OBJ_WAYS)
+	      ret = parse_osm_nd_ref (atts, state->params);
+	  else if (strcmp (el, "member") == 0
+		   && state->parent == OBJ_RELATIONS)
+	      ret = parse_osm_member (atts, state->params);
+      }
+    if (!ret)
+	state->error = 1;
 }
 
-static int
-parse_osm_items (xmlNodePtr node, struct aux_params *params)
+static void
+osm_sax_end (void *ctx, const xmlChar * name)
 {
-/* recursively parsing the OSM payload */
-    int error = 0;
-    xmlNodePtr cur_node = NULL;
-
-    for (cur_node = node; cur_node; cur_node = cur_node->next)
-      {
-	  if (cur_node->type == XML_ELEMENT_NODE)
-	    {
-		xmlNodePtr child;
-		for (child = cur_node->children; child; child = child->next)
-		  {
-		      if (child->type == XML_ELEMENT_NODE)
-			{
-			    const char *name = (const char *) (child->name);
-			    if (name != NULL)
-			      {
-				  int ret = 1;
-				  if (strcmp (name, "node") == 0)
-				      ret = parse_osm_node (child, params);
-				  if (strcmp (name, "way") == 0)
-				      ret = parse_osm_way (child, params);
-				  if (strcmp (name, "relation") == 0)
-				      ret = parse_osm_relation (child, params);
-				  if (!ret)
-				      error = 1;
-			      }
-			}
-		  }
-	    }
-      }
-    if (error)
-	return 0;
-    return 1;
+/* SAX callback: an XML element has just been closed */
+    struct osm_sax_state *state = (struct osm_sax_state *) ctx;
+    if (name == NULL)
+	return;
+    if (state->depth == 2)
+	state->parent = 0;
+    state->depth -= 1;
 }
 
-static int
-osm_parse (struct aux_params *params, struct download_tile *tile, int object)
+static char *
+build_osm_url (struct aux_params *params, struct download_tile *tile,
+	       int object)
 {
-    xmlDocPtr xml_doc = NULL;
-    xmlNodePtr root;
+/* building the Overpass request URL for a single tile */
     char *url;
-    int error = 0;
 
     if (params->mode == MODE_ROAD)
       {
@@ -969,34 +973,596 @@ osm_parse (struct aux_params *params, struct download_tile *tile, int object)
 		   params->osm_url, tile->miny, tile->minx, tile->maxy,
 		   tile->maxx);
       }
+    return url;
+}
 
-    xml_doc = xmlReadFile (url, NULL, 0);
-    if (xml_doc == NULL)
+static int
+write_payload (struct payload_sink *sink, const char *buf, int len)
+{
+/* appending a further chunk to the spooled payload */
+    if (sink->gz_out != NULL)
       {
-	  /* parsing error; not a well-formed XML */
-	  fprintf (stderr, "ERROR: unable to download the OSM dataset\n");
-	  error = 1;
-	  goto end;
+	  if (gzwrite (sink->gz_out, buf, len) != len)
+	      return 0;
+	  return 1;
       }
-
-/* parsing the OSM payload */
-    root = xmlDocGetRootElement (xml_doc);
-    if (!parse_osm_items (root, params))
-	error = 1;
-
-  end:
-    sqlite3_free (url);
-    if (xml_doc != NULL)
-	xmlFreeDoc (xml_doc);
-    if (error)
+    if (fwrite (buf, 1, len, sink->out) != (size_t) len)
 	return 0;
     return 1;
 }
 
-static void
-finalize_sql_stmts (struct aux_params *params)
+static int
+download_payload (struct download_job *job, struct payload_sink *sink)
 {
-    int ret;
+/*
+/ downloading the raw response of a single Overpass request
+/
+/ the response is never held in memory: any chunk is immediately
+/ spooled into the sink, a temporary file or the local cache
+/
+/ "file://" endpoints are served from the local filesystem,
+/ the query string being ignored; this is intended for testing
+*/
+    char buf[65536];
+    int len;
+    if (strncmp (job->url, "file://", 7) == 0)
+      {
+	  FILE *in;
+	  char *path = sqlite3_mprintf ("%s", job->url + 7);
+	  char *p = strchr (path, '?');
+	  if (p != NULL)
+	      *p = '\0';
+	  in = fopen (path, "rb");
+	  if (in == NULL)
+	    {
+		fprintf (stderr, "ERROR: unable to open \"%s\"\n", path);
+		sqlite3_free (path);
+		return 0;
+	    }
+	  sqlite3_free (path);
+	  while ((len = fread (buf, 1, sizeof (buf), in)) > 0)
+	    {
+		if (!write_payload (sink, buf, len))
+		  {
+		      fclose (in);
+		      return 0;
+		  }
+	    }
+	  fclose (in);
+      }
+    else
+      {
+	  void *http = xmlNanoHTTPOpen (job->url, NULL);
+	  if (http == NULL)
+	      return 0;
+	  if (xmlNanoHTTPReturnCode (http) != 200)
+	    {
+		fprintf (stderr, "ERROR: HTTP status %d\n",
+			 xmlNanoHTTPReturnCode (http));
+		xmlNanoHTTPClose (http);
+		return 0;
+	    }
+	  while ((len = xmlNanoHTTPRead (http, buf, sizeof (buf))) > 0)
+	    {
+		if (!write_payload (sink, buf, len))
+		  {
+		      xmlNanoHTTPClose (http);
+		      return 0;
+		  }
+	    }
+	  xmlNanoHTTPClose (http);
+	  if (len < 0)
+	      return 0;
+      }
+    return 1;
+}
+
+static void
+release_download_job (struct download_job *job)
+{
+/* releasing the spooled payload of an already parsed request */
+    if (job->spool != NULL)
+	fclose (job->spool);
+    job->spool = NULL;
+}
+
+static char *
+build_cache_path (const char *cache_dir, const char *url)
+{
+/*
+/ building the cache pathname of some Overpass request
+/
+/ the key is a 64 bit FNV-1a hash of the whole request URL,
+/ that already identifies the service, the BBOX and the mode
+*/
+    sqlite3_uint64 hash = 0xcbf29ce484222325;
+    const unsigned char *p = (const unsigned char *) url;
+    while (*p != '\0')
+      {
+	  hash ^= *p++;
+	  hash *= 0x100000001b3;
+      }
+    return sqlite3_mprintf ("%s/%08x%08x.osm", cache_dir,
+			    (unsigned int) (hash >> 32),
+			    (unsigned int) (hash & 0xffffffff));
+}
+
+static gzFile
+open_cached_payload (struct download_job *job)
+{
+/* opening the local cache entry of some request (NULL if missing) */
+    gzFile in;
+    char *path = sqlite3_mprintf ("%s.gz", job->cache_path);
+    in = gzopen (path, "rb");
+    sqlite3_free (path);
+    if (in == NULL)
+      {
+	  /* gzread() transparently reads uncompressed files as well */
+	  in = gzopen (job->cache_path, "rb");
+      }
+    return in;
+}
+
+static void
+remove_cached_payload (struct download_job *job)
+{
+/* discarding a damaged cache entry, whatever its compression */
+    char *path = sqlite3_mprintf ("%s.gz", job->cache_path);
+    remove (path);
+    sqlite3_free (path);
+    remove (job->cache_path);
+}
+
+static int
+check_cached_payload (struct download_job *job)
+{
+/*
+/ checking a cache entry before trusting it: it must be fully
+/ readable (gzip CRC included) and well-formed XML
+/
+/ returns -1 if missing, 0 if damaged, 1 if valid
+*/
+    xmlSAXHandler sax;
+    xmlParserCtxtPtr ctxt;
+    char buf[65536];
+    int len;
+    int ret = 0;
+    gzFile in = open_cached_payload (job);
+    if (in == NULL)
+	return -1;
+    memset (&sax, 0, sizeof (xmlSAXHandler));
+    ctxt = xmlCreatePushParserCtxt (&sax, NULL, NULL, 0, NULL);
+    if (ctxt == NULL)
+      {
+	  gzclose (in);
+	  return 0;
+      }
+    xmlCtxtUseOptions (ctxt, XML_PARSE_NONET);
+    while ((len = gzread (in, buf, sizeof (buf))) > 0)
+      {
+	  ret = xmlParseChunk (ctxt, buf, len, 0);
+	  if (ret != 0)
+	      break;
+      }
+    if (len < 0)
+	ret = -1;
+    if (ret == 0)
+	ret = xmlParseChunk (ctxt, NULL, 0, 1);
+    xmlFreeParserCtxt (ctxt);
+    if (gzclose (in) != Z_OK)
+	ret = -1;
+    return (ret == 0) ? 1 : 0;
+}
+
+static int
+download_cached_payload (struct download_job *job)
+{
+/*
+/ downloading a payload straight into the local cache
+/
+/ the entry is renamed only when complete, so to never expose
+/ truncated files
+*/
+    char *path;
+    char *tmp;
+    int ok = 0;
+    struct payload_sink sink;
+    sink.out = NULL;
+    sink.gz_out = NULL;
+    if (job->cache_gzip)
+	path = sqlite3_mprintf ("%s.gz", job->cache_path);
+    else
+	path = sqlite3_mprintf ("%s", job->cache_path);
+    tmp = sqlite3_mprintf ("%s.tmp", path);
+    if (job->cache_gzip)
+	sink.gz_out = gzopen (tmp, "wb6");
+    else
+	sink.out = fopen (tmp, "wb");
+    if (sink.out == NULL && sink.gz_out == NULL)
+      {
+	  fprintf (stderr, "WARNING: unable to cache \"%s\"\n", path);
+	  sqlite3_free (tmp);
+	  sqlite3_free (path);
+	  return -1;
+      }
+    ok = download_payload (job, &sink);
+    if (sink.gz_out != NULL)
+      {
+	  if (gzclose (sink.gz_out) != Z_OK)
+	      ok = 0;
+      }
+    else
+      {
+	  if (fclose (sink.out) != 0)
+	      ok = 0;
+      }
+    if (ok)
+      {
+	  if (rename (tmp, path) != 0)
+	    {
+		fprintf (stderr, "ERROR: unable to cache \"%s\"\n", path);
+		ok = 0;
+	    }
+      }
+    if (!ok)
+	remove (tmp);
+    sqlite3_free (tmp);
+    sqlite3_free (path);
+    return ok;
+}
+
+static int
+fetch_payload (struct download_job *job)
+{
+/*
+/ fetching a payload: from the local cache if possible, or else
+/ downloading it into the cache or into an anonymous temporary file
+*/
+    struct payload_sink sink;
+    if (job->cache_path != NULL)
+      {
+	  int ret = check_cached_payload (job);
+	  if (ret > 0)
+	    {
+		/* already cached */
+		return 1;
+	    }
+	  if (ret == 0)
+	    {
+		fprintf (stderr,
+			 "WARNING: damaged cache entry \"%s\", downloading it again\n",
+			 job->cache_path);
+		remove_cached_payload (job);
+	    }
+	  ret = download_cached_payload (job);
+	  if (ret >= 0)
+	      return ret;
+      }
+    job->spool = tmpfile ();
+    if (job->spool == NULL)
+      {
+	  fprintf (stderr, "ERROR: unable to create a temporary file\n");
+	  return 0;
+      }
+    sink.out = job->spool;
+    sink.gz_out = NULL;
+    if (!download_payload (job, &sink))
+      {
+	  release_download_job (job);
+	  return 0;
+      }
+    return 1;
+}
+
+#ifndef _WIN32
+static void *
+download_worker (void *arg)
+{
+/* a fetcher thread: downloading requests in order within the window */
+    struct download_pool *pool = (struct download_pool *) arg;
+    while (1)
+      {
+	  struct download_job *job;
+	  int ok;
+	  pthread_mutex_lock (&(pool->mutex));
+	  while (!pool->abort && pool->next < pool->count
+		 && pool->next >= pool->consumed + pool->window)
+	      pthread_cond_wait (&(pool->cond), &(pool->mutex));
+	  if (pool->abort || pool->next >= pool->count)
+	    {
+		pthread_mutex_unlock (&(pool->mutex));
+		break;
+	    }
+	  job = pool->jobs + pool->next;
+	  pool->next += 1;
+	  job->status = JOB_RUNNING;
+	  pthread_mutex_unlock (&(pool->mutex));
+
+	  ok = fetch_payload (job);
+
+	  pthread_mutex_lock (&(pool->mutex));
+	  job->status = ok ? JOB_READY : JOB_FAILED;
+	  pthread_cond_broadcast (&(pool->cond));
+	  pthread_mutex_unlock (&(pool->mutex));
+      }
+    return NULL;
+}
+#endif
+
+static int
+start_download_pool (struct download_pool *pool, int threads)
+{
+/* starting the fetcher threads */
+#ifndef _WIN32
+    int i;
+    pthread_mutex_init (&(pool->mutex), NULL);
+    pthread_cond_init (&(pool->cond), NULL);
+    pool->window = threads * 2;
+    pool->workers = malloc (sizeof (pthread_t) * threads);
+    pool->n_workers = 0;
+    for (i = 0; i < threads; i++)
+      {
+	  if (pthread_create
+	      (pool->workers + i, NULL, download_worker, pool) != 0)
+	      break;
+	  pool->n_workers += 1;
+      }
+    if (pool->n_workers == 0)
+      {
+	  fprintf (stderr, "ERROR: unable to start the download threads\n");
+	  return 0;
+      }
+#else
+    /* no threads: any request will be downloaded on demand */
+    pool->window = 1;
+    pool->n_workers = 0;
+#endif
+    return 1;
+}
+
+static struct download_job *
+wait_download_job (struct download_pool *pool, int index)
+{
+/* waiting until the Nth request has been fully downloaded */
+    struct download_job *job = pool->jobs + index;
+#ifndef _WIN32
+    pthread_mutex_lock (&(pool->mutex));
+    while (job->status != JOB_READY && job->status != JOB_FAILED)
+	pthread_cond_wait (&(pool->cond), &(pool->mutex));
+    pthread_mutex_unlock (&(pool->mutex));
+#else
+    job->status = fetch_payload (job) ? JOB_READY : JOB_FAILED;
+    pool->next += 1;
+#endif
+    if (job->status != JOB_READY)
+	return NULL;
+    return job;
+}
+
+static void
+consume_download_job (struct download_pool *pool, struct download_job *job)
+{
+/* the writer is done with this request: the window may slide forward */
+    release_download_job (job);
+#ifndef _WIN32
+    pthread_mutex_lock (&(pool->mutex));
+    pool->consumed += 1;
+    pthread_cond_broadcast (&(pool->cond));
+    pthread_mutex_unlock (&(pool->mutex));
+#else
+    pool->consumed += 1;
+#endif
+}
+
+static void
+stop_download_pool (struct download_pool *pool)
+{
+/* stopping the fetcher threads and freeing the request list */
+    int i;
+#ifndef _WIN32
+    if (pool->workers != NULL)
+      {
+	  pthread_mutex_lock (&(pool->mutex));
+	  pool->abort = 1;
+	  pthread_cond_broadcast (&(pool->cond));
+	  pthread_mutex_unlock (&(pool->mutex));
+	  for (i = 0; i < pool->n_workers; i++)
+	      pthread_join (pool->workers[i], NULL);
+	  free (pool->workers);
+	  pthread_cond_destroy (&(pool->cond));
+	  pthread_mutex_destroy (&(pool->mutex));
+      }
+#endif
+    for (i = 0; i < pool->count; i++)
+      {
+	  release_download_job (pool->jobs + i);
+	  sqlite3_free (pool->jobs[i].url);
+	  if (pool->jobs[i].cache_path != NULL)
+	      sqlite3_free (pool->jobs[i].cache_path);
+      }
+    if (pool->jobs != NULL)
+	free (pool->jobs);
+}
+
+static int
+prepare_download_pool (struct download_pool *pool, struct aux_params *params,
+		       struct tiled_download *downloader, const char *cache_dir,
+		       int cache_gzip, int resume)
+{
+/* preparing the ordered list of Overpass requests still to be done */
+    struct download_tile *tile;
+    sqlite3_stmt *stmt = NULL;
+    int per_tile = 3;
+    int ret;
+    if (params->mode == MODE_ROAD || params->mode == MODE_RAIL)
+	per_tile = 1;
+    if (resume)
+      {
+	  /* checking the requests already completed by some previous run */
+	  const char *sql = "SELECT url FROM osm_download_tiles WHERE url = ?";
+	  ret =
+	      sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql), &stmt,
+				  NULL);
+	  if (ret != SQLITE_OK)
+	    {
+		fprintf (stderr, "SQL error: %s\n",
+			 sqlite3_errmsg (params->db_handle));
+		return 0;
+	    }
+      }
+    pool->jobs = malloc (sizeof (struct download_job) * downloader->count *
+			 per_tile);
+    pool->count = 0;
+    pool->next = 0;
+    pool->consumed = 0;
+    pool->window = 1;
+    pool->abort = 0;
+    pool->n_workers = 0;
+    pool->skipped = 0;
+#ifndef _WIN32
+    pool->workers = NULL;
+#endif
+    tile = downloader->first;
+    while (tile != NULL)
+      {
+	  int obj;
+	  for (obj = 0; obj < per_tile; obj++)
+	    {
+		struct download_job *job = pool->jobs + pool->count;
+		job->tile = tile;
+		if (per_tile == 1)
+		    job->object = 0;
+		else
+		    job->object = OBJ_NODES + obj;
+		job->url = build_osm_url (params, tile, job->object);
+		if (stmt != NULL)
+		  {
+		      int done = 0;
+		      sqlite3_reset (stmt);
+		      sqlite3_clear_bindings (stmt);
+		      sqlite3_bind_text (stmt, 1, job->url, strlen (job->url),
+					 SQLITE_STATIC);
+		      ret = sqlite3_step (stmt);
+		      if (ret == SQLITE_ROW)
+			  done = 1;
+		      sqlite3_reset (stmt);
+		      if (done)
+			{
+			    /* already completed: skipping */
+			    sqlite3_free (job->url);
+			    pool->skipped += 1;
+			    continue;
+			}
+		  }
+		job->status = JOB_PENDING;
+		job->spool = NULL;
+		job->cache_path = NULL;
+		if (cache_dir != NULL)
+		    job->cache_path = build_cache_path (cache_dir, job->url);
+		job->cache_gzip = cache_gzip;
+		pool->count += 1;
+	    }
+	  tile = tile->next;
+      }
+    if (stmt != NULL)
+	sqlite3_finalize (stmt);
+    return 1;
+}
+
+static int
+osm_parse (struct aux_params *params, struct download_job *job)
+{
+/*
+/ streaming the downloaded payload through the SAX parser
+/
+/ the payload is read back in fixed-size chunks, so that memory
+/ usage doesn't depend on the size of the response
+*/
+    xmlSAXHandler sax;
+    xmlParserCtxtPtr ctxt;
+    struct osm_sax_state state;
+    char buf[65536];
+    int len;
+    int ret = 0;
+    gzFile in = NULL;
+
+    memset (&sax, 0, sizeof (xmlSAXHandler));
+    sax.startElement = osm_sax_start;
+    sax.endElement = osm_sax_end;
+    state.params = params;
+    state.depth = 0;
+    state.parent = 0;
+    state.error = 0;
+
+    if (job->spool != NULL)
+	rewind (job->spool);
+    else
+      {
+	  in = open_cached_payload (job);
+	  if (in == NULL)
+	    {
+		fprintf (stderr,
+			 "ERROR: unable to read the cached OSM dataset\n");
+		return 0;
+	    }
+      }
+    ctxt = xmlCreatePushParserCtxt (&sax, &state, NULL, 0, NULL);
+    if (ctxt == NULL)
+      {
+	  if (in != NULL)
+	      gzclose (in);
+	  return 0;
+      }
+/* no DTD callbacks are set, so only the predefined entities can be expanded */
+    xmlCtxtUseOptions (ctxt, XML_PARSE_NOENT | XML_PARSE_NONET);
+    while (1)
+      {
+	  if (in != NULL)
+	    {
+		len = gzread (in, buf, sizeof (buf));
+		if (len < 0)
+		    ret = -1;
+	    }
+	  else
+	    {
+		len = fread (buf, 1, sizeof (buf), job->spool);
+		if (len == 0 && ferror (job->spool))
+		    ret = -1;
+	    }
+	  if (len <= 0)
+	      break;
+	  ret = xmlParseChunk (ctxt, buf, len, 0);
+	  if (ret != 0 || state.error)
+	      break;
+      }
+    if (ret == 0 && !state.error)
+	ret = xmlParseChunk (ctxt, NULL, 0, 1);
+    xmlFreeParserCtxt (ctxt);
+    if (in != NULL)
+      {
+	  if (gzclose (in) != Z_OK)
+	      ret = -1;
+      }
+    if (ret != 0)
+      {
+	  /* read error, or not a well-formed XML */
+	  fprintf (stderr, "ERROR: unable to parse the OSM dataset\n");
+	  if (in != NULL)
+	    {
+		/* never trusting this cache entry again */
+		remove_cached_payload (job);
+	    }
+	  return 0;
+      }
+    if (state.error)
+	return 0;
+    return 1;
+}
+
+static void
+finalize_sql_stmts (struct aux_params *params)
+{
+    int ret;
     char *sql_err = NULL;
 
     if (params->ins_nodes_stmt != NULL)
@@ -1226,32 +1792,6 @@ create_road_tables (struct aux_params *params)
     char sql[1024];
     char *err_msg = NULL;
 
-/* creating OSM helper nodes */
-    strcpy (sql, "CREATE TABLE osm_helper_nodes (\n");
-    strcat (sql, "node_id INTEGER NOT NULL PRIMARY KEY,\n");
-    strcat (sql, "way_count INTEGER NOT NULL)\n");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "CREATE TABLE 'osm_helper_nodes' error: %s\n",
-		   err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
-/* populating OSM helper nodes */
-    strcpy (sql, "INSERT INTO osm_helper_nodes (node_id, way_count) ");
-    strcat (sql, "SELECT n.node_id, Count(*) FROM osm_nodes AS n ");
-    strcat (sql, "JOIN osm_way_refs AS w ON (w.node_id = n.node_id) ");
-    strcat (sql, "GROUP BY n.node_id");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "INSERT INTO 'osm_helper_nodes' error: %s\n",
-		   err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
-
 /* creating ROAD nodes */
     strcpy (sql, "CREATE TABLE road_nodes (\n");
     strcat (sql, "node_id INTEGER NOT NULL PRIMARY KEY)\n");
@@ -1355,39 +1895,313 @@ create_road_rtrees (struct aux_params *params)
     return 1;
 }
 
-static void
-add_arc (struct aux_arc_container *arcs, sqlite3_int64 nd_first,
-	 sqlite3_int64 nd_last, double x_ini, double y_ini, double x_end,
-	 double y_end, gaiaDynamicLinePtr dyn_line, int count)
+static int
+load_node_coords (struct aux_params *params)
 {
-/* adding a further Arc to the container */
-    int iv;
-    gaiaGeomCollPtr g;
-    gaiaPointPtr pt;
-    gaiaLinestringPtr ln;
-    struct aux_arc *arc = malloc (sizeof (struct aux_arc));
-    arc->node_from = nd_first;
-    arc->node_to = nd_last;
-    g = gaiaAllocGeomColl ();
-    gaiaAddPointToGeomColl (g, x_ini, y_ini);
-    g->Srid = 4326;
-    arc->geom_from = g;
-    g = gaiaAllocGeomColl ();
-    gaiaAddPointToGeomColl (g, x_end, y_end);
-    g->Srid = 4326;
-    arc->geom_to = g;
-    g = gaiaAllocGeomColl ();
-    ln = gaiaAddLinestringToGeomColl (g, count);
-    iv = 0;
-    pt = dyn_line->First;
-    while (pt)
+/*
+/ reloading the in-memory Node table from the raw OSM tables
+/ (only required when resuming an interrupted download)
+*/
+    int ret;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql;
+
+    sql = "SELECT node_id, ST_X(geometry), ST_Y(geometry) FROM osm_nodes";
+    ret =
+	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
       {
-	  /* inserting any POINT into LINESTRING */
-	  gaiaSetPoint (ln->Coords, iv, pt->X, pt->Y);
-	  iv++;
-	  pt = pt->Next;
-      }
-    g->Srid = 4326;
+	  fprintf (stderr, "SQL error: %s\n",
+		   sqlite3_errmsg (params->db_handle));
+	  goto error;
+      }
+    while (1)
+      {
+	  /* scrolling the result set */
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE)
+	    {
+		/* there are no more rows to fetch - we can stop looping */
+		break;
+	    }
+	  if (ret == SQLITE_ROW)
+	    {
+		/* ok, we've just fetched a valid row */
+		if (sqlite3_column_type (stmt, 1) == SQLITE_NULL)
+		    continue;
+		set_node_coords (&(params->nodes),
+				 sqlite3_column_int64 (stmt, 0),
+				 sqlite3_column_double (stmt, 1),
+				 sqlite3_column_double (stmt, 2));
+	    }
+	  else
+	    {
+		/* some unexpected error occurred */
+		fprintf (stderr, "sqlite3_step() error: %s\n",
+			 sqlite3_errmsg (params->db_handle));
+		goto error;
+	    }
+      }
+    sqlite3_finalize (stmt);
+    stmt = NULL;
+
+    sql = "SELECT node_id, Count(*) FROM osm_way_refs GROUP BY node_id";
+    ret =
+	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql), &stmt, NULL);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "SQL error: %s\n",
+		   sqlite3_errmsg (params->db_handle));
+	  goto error;
+      }
+    while (1)
+      {
+	  /* scrolling the result set */
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE)
+	    {
+		/* there are no more rows to fetch - we can stop looping */
+		break;
+	    }
+	  if (ret == SQLITE_ROW)
+	    {
+		/* ok, we've just fetched a valid row */
+		int idx = fetch_node_coords (&(params->nodes),
+					     sqlite3_column_int64 (stmt, 0));
+		params->nodes.way_count[idx] = sqlite3_column_int (stmt, 1);
+	    }
+	  else
+	    {
+		/* some unexpected error occurred */
+		fprintf (stderr, "sqlite3_step() error: %s\n",
+			 sqlite3_errmsg (params->db_handle));
+		goto error;
+	    }
+      }
+    sqlite3_finalize (stmt);
+    return 1;
+
+  error:
+    if (stmt != NULL)
+	sqlite3_finalize (stmt);
+    return 0;
+}
+
+static int
+scan_step (sqlite3 * handle, struct ordered_scan *scan)
+{
+/* advancing an ordered scan by a single row */
+    int ret = sqlite3_step (scan->stmt);
+    if (ret == SQLITE_DONE)
+      {
+	  scan->valid = 0;
+	  return 1;
+      }
+    if (ret == SQLITE_ROW)
+      {
+	  scan->valid = 1;
+	  scan->id = sqlite3_column_int64 (scan->stmt, 0);
+	  return 1;
+      }
+    fprintf (stderr, "sqlite3_step() error: %s\n", sqlite3_errmsg (handle));
+    scan->valid = 0;
+    return 0;
+}
+
+static int
+prepare_ordered_scan (struct aux_params *params, const char *sql,
+		      struct ordered_scan *scan)
+{
+/* preparing an ordered scan, and positioning it on the first row */
+    int ret =
+	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql), &(scan->stmt),
+			    NULL);
+    scan->valid = 0;
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "SQL error: %s\n",
+		   sqlite3_errmsg (params->db_handle));
+	  scan->stmt = NULL;
+	  return 0;
+      }
+    return scan_step (params->db_handle, scan);
+}
+
+static void
+reset_tag_pivot (struct tag_pivot *pivot)
+{
+/* resetting a Tag pivot */
+    int i;
+    for (i = 0; i < pivot->count; i++)
+      {
+	  free (pivot->keys[i]);
+	  free (pivot->values[i]);
+      }
+    pivot->count = 0;
+}
+
+static void
+free_tag_pivot (struct tag_pivot *pivot)
+{
+/* freeing a Tag pivot */
+    reset_tag_pivot (pivot);
+    if (pivot->keys != NULL)
+	free (pivot->keys);
+    if (pivot->values != NULL)
+	free (pivot->values);
+    pivot->keys = NULL;
+    pivot->values = NULL;
+    pivot->max = 0;
+}
+
+static char *
+scan_text (sqlite3_stmt * stmt, int col)
+{
+/* copying a text column (NULL becomes an empty string) */
+    char *txt;
+    int len = sqlite3_column_bytes (stmt, col);
+    const char *p = (const char *) sqlite3_column_text (stmt, col);
+    txt = malloc (len + 1);
+    if (p != NULL)
+	memcpy (txt, p, len);
+    *(txt + len) = '\0';
+    return txt;
+}
+
+static int
+scan_tags (sqlite3 * handle, struct ordered_scan *scan,
+	   struct tag_pivot *pivot)
+{
+/*
+/ pivoting all Tags of the current object
+/ the scan is expected to return: id, k, v ORDER BY id, sub
+*/
+    reset_tag_pivot (pivot);
+    pivot->id = scan->id;
+    while (scan->valid && scan->id == pivot->id)
+      {
+	  if (pivot->count == pivot->max)
+	    {
+		/* growing the arrays */
+		pivot->max += 16;
+		pivot->keys = realloc (pivot->keys, sizeof (char *) * pivot->max);
+		pivot->values =
+		    realloc (pivot->values, sizeof (char *) * pivot->max);
+	    }
+	  pivot->keys[pivot->count] = scan_text (scan->stmt, 1);
+	  pivot->values[pivot->count] = scan_text (scan->stmt, 2);
+	  pivot->count += 1;
+	  if (!scan_step (handle, scan))
+	      return 0;
+      }
+    return 1;
+}
+
+static const char *
+pivot_value (struct tag_pivot *pivot, const char *key)
+{
+/* returning the value of some Tag (NULL if not found) */
+    int i;
+    for (i = 0; i < pivot->count; i++)
+      {
+	  if (strcmp (pivot->keys[i], key) == 0)
+	      return pivot->values[i];
+      }
+    return NULL;
+}
+
+static int
+scan_refs (sqlite3 * handle, struct ordered_scan *scan, sqlite3_int64 id,
+	   struct way_refs *refs)
+{
+/*
+/ merge-joining the Node refs of some Way
+/ the scan is expected to return: way_id, node_id ORDER BY way_id, sub
+*/
+    refs->count = 0;
+    while (scan->valid && scan->id < id)
+      {
+	  /* skipping Ways of no interest */
+	  if (!scan_step (handle, scan))
+	      return 0;
+      }
+    while (scan->valid && scan->id == id)
+      {
+	  if (refs->count == refs->max)
+	    {
+		/* growing the array */
+		refs->max += 1024;
+		refs->ids =
+		    realloc (refs->ids, sizeof (sqlite3_int64) * refs->max);
+	    }
+	  refs->ids[refs->count] = sqlite3_column_int64 (scan->stmt, 1);
+	  refs->count += 1;
+	  if (!scan_step (handle, scan))
+	      return 0;
+      }
+    return 1;
+}
+
+static int
+build_point_blob (struct node_coords *nodes, int idx, unsigned char **blob,
+		  int *blob_size)
+{
+/* building a Point BLOB from the in-memory Node coordinates */
+    gaiaGeomCollPtr g = gaiaAllocGeomColl ();
+    g->Srid = 4326;
+    gaiaAddPointToGeomColl (g, nodes->coords[idx * 2],
+			    nodes->coords[(idx * 2) + 1]);
+    gaiaToSpatiaLiteBlobWkb (g, blob, blob_size);
+    gaiaFreeGeomColl (g);
+    if (*blob == NULL)
+	return 0;
+    return 1;
+}
+
+static void
+bind_pivot_text (sqlite3_stmt * stmt, int pos, const char *value)
+{
+/* binding a pivoted Tag value as TEXT */
+    if (value == NULL)
+	sqlite3_bind_null (stmt, pos);
+    else
+	sqlite3_bind_text (stmt, pos, value, strlen (value), SQLITE_STATIC);
+}
+
+static void
+bind_pivot_int (sqlite3_stmt * stmt, int pos, const char *value)
+{
+/* binding a pivoted Tag value as INTEGER */
+    if (value == NULL)
+	sqlite3_bind_null (stmt, pos);
+    else
+	sqlite3_bind_int (stmt, pos, atoi (value));
+}
+
+static void
+add_arc (struct aux_arc_container *arcs, sqlite3_int64 nd_first,
+	 sqlite3_int64 nd_last, gaiaDynamicLinePtr dyn_line, int count)
+{
+/* adding a further Arc to the container */
+    int iv;
+    gaiaGeomCollPtr g;
+    gaiaPointPtr pt;
+    gaiaLinestringPtr ln;
+    struct aux_arc *arc = malloc (sizeof (struct aux_arc));
+    arc->node_from = nd_first;
+    arc->node_to = nd_last;
+    g = gaiaAllocGeomColl ();
+    ln = gaiaAddLinestringToGeomColl (g, count);
+    iv = 0;
+    pt = dyn_line->First;
+    while (pt)
+      {
+	  /* inserting any POINT into LINESTRING */
+	  gaiaSetPoint (ln->Coords, iv, pt->X, pt->Y);
+	  iv++;
+	  pt = pt->Next;
+      }
+    g->Srid = 4326;
     arc->geom = g;
     arc->next = NULL;
     if (arcs->first == NULL)
@@ -1397,134 +2211,175 @@ add_arc (struct aux_arc_container *arcs, sqlite3_int64 nd_first,
     arcs->last = arc;
 }
 
+static void
+free_aux_arcs (struct aux_arc_container *arcs)
+{
+/* releasing any Arc still pending in the container */
+    struct aux_arc *arc = arcs->first;
+    while (arc != NULL)
+      {
+	  struct aux_arc *arc_n = arc->next;
+	  if (arc->geom != NULL)
+	      gaiaFreeGeomColl (arc->geom);
+	  free (arc);
+	  arc = arc_n;
+      }
+    arcs->first = NULL;
+    arcs->last = NULL;
+}
+
 static int
-build_arc (sqlite3 * sqlite, sqlite3_stmt * query_nodes_stmt, sqlite3_int64 id,
+build_arc (struct node_coords *nodes, struct way_refs *refs,
 	   struct aux_arc_container *arcs)
 {
-/* building an Arc */
-    int ret;
+/*
+/ building an Arc
+/
+/ the Way is split on any Node shared with some other Way; both
+/ end-points of each Arc are flagged as Graph Nodes
+*/
+    int i;
     sqlite3_int64 nd_first;
     sqlite3_int64 nd_last;
+    int idx_first;
+    int idx_last;
     int count = 0;
-    double x_ini;
-    double y_ini;
-    double x_end;
-    double y_end;
     gaiaDynamicLinePtr dyn_line = gaiaAllocDynamicLine ();
 
-    sqlite3_reset (query_nodes_stmt);
-    sqlite3_clear_bindings (query_nodes_stmt);
-    sqlite3_bind_int64 (query_nodes_stmt, 1, id);
-    while (1)
+    for (i = 0; i < refs->count; i++)
       {
-	  /* scrolling the main result set */
-	  ret = sqlite3_step (query_nodes_stmt);
-	  if (ret == SQLITE_DONE)
+	  /* looping on Node refs */
+	  sqlite3_int64 node_id = refs->ids[i];
+	  double x;
+	  double y;
+	  int idx = find_node_coords (nodes, node_id);
+	  if (idx < 0)
 	    {
-		/* there are no more rows to fetch - we can stop looping */
-		break;
+		/* unresolved Node: skipping */
+		continue;
 	    }
-	  if (ret == SQLITE_ROW)
+	  x = nodes->coords[idx * 2];
+	  y = nodes->coords[(idx * 2) + 1];
+	  gaiaAppendPointToDynamicLine (dyn_line, x, y);
+	  count++;
+	  if (count == 1)
 	    {
-		/* ok, we've just fetched a valid row */
-		sqlite3_int64 node_id =
-		    sqlite3_column_int64 (query_nodes_stmt, 0);
-		double x = sqlite3_column_double (query_nodes_stmt, 1);
-		double y = sqlite3_column_double (query_nodes_stmt, 2);
-		int way_count = sqlite3_column_int (query_nodes_stmt, 3);
-		if (count == 0)
-		  {
-		      nd_first = node_id;
-		      x_ini = x;
-		      y_ini = y;
-		      count++;
-		      gaiaAppendPointToDynamicLine (dyn_line, x, y);
-		  }
-		else
-		  {
-		      nd_last = node_id;
-		      x_end = x;
-		      y_end = y;
-		      count++;
-		      gaiaAppendPointToDynamicLine (dyn_line, x, y);
-		      if (way_count > 1)
-			{
-			    /* break: splitting the current arc on some junction */
-			    add_arc (arcs, nd_first, nd_last, x_ini, y_ini,
-				     x_end, y_end, dyn_line, count);
-			    /* beginning a new arc */
-			    gaiaFreeDynamicLine (dyn_line);
-			    dyn_line = gaiaAllocDynamicLine ();
-			    count = 1;
-			    nd_first = node_id;
-			    x_ini = x;
-			    y_ini = y;
-			    gaiaAppendPointToDynamicLine (dyn_line, x, y);
-			}
-		  }
+		nd_first = node_id;
+		idx_first = idx;
+		continue;
 	    }
-	  else
+	  nd_last = node_id;
+	  idx_last = idx;
+	  if (nodes->way_count[idx] > 1)
 	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (sqlite));
-		return 0;
+		/* break: splitting the current arc on some junction */
+		add_arc (arcs, nd_first, node_id, dyn_line, count);
+		nodes->flags[idx_first] |= NODE_GRAPH;
+		nodes->flags[idx] |= NODE_GRAPH;
+		/* beginning a new arc */
+		gaiaFreeDynamicLine (dyn_line);
+		dyn_line = gaiaAllocDynamicLine ();
+		count = 1;
+		nd_first = node_id;
+		idx_first = idx;
+		gaiaAppendPointToDynamicLine (dyn_line, x, y);
 	    }
       }
     if (count > 1)
-	add_arc (arcs, nd_first, nd_last, x_ini, y_ini, x_end, y_end, dyn_line,
-		 count);
+      {
+	  add_arc (arcs, nd_first, nd_last, dyn_line, count);
+	  nodes->flags[idx_first] |= NODE_GRAPH;
+	  nodes->flags[idx_last] |= NODE_GRAPH;
+      }
     gaiaFreeDynamicLine (dyn_line);
     return 1;
 }
 
+static int
+insert_graph_nodes (struct aux_params *params, sqlite3_stmt * ins_nodes_stmt,
+		    int *cnt_nodes)
+{
+/* inserting all Graph Nodes in a single pass */
+    int ret;
+    int i;
+    unsigned char *blob;
+    int blob_size;
+    struct node_coords *nodes = &(params->nodes);
+
+    for (i = 0; i < nodes->count; i++)
+      {
+	  if ((nodes->flags[i] & NODE_GRAPH) == 0)
+	      continue;
+	  nodes->flags[i] &= ~NODE_GRAPH;
+	  if (!build_point_blob (nodes, i, &blob, &blob_size))
+	      continue;
+	  sqlite3_reset (ins_nodes_stmt);
+	  sqlite3_clear_bindings (ins_nodes_stmt);
+	  sqlite3_bind_int64 (ins_nodes_stmt, 1, nodes->ids[i]);
+	  sqlite3_bind_blob (ins_nodes_stmt, 2, blob, blob_size, free);
+	  ret = sqlite3_step (ins_nodes_stmt);
+	  if (ret == SQLITE_DONE || ret == SQLITE_ROW)
+	      *cnt_nodes += 1;
+	  else
+	    {
+#if defined(_WIN32) || defined(__MINGW32__)
+		/* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
+		fprintf (stderr, "ERROR: unable to insert NODE id=%I64d: %s\n",
+			 nodes->ids[i], sqlite3_errmsg (params->db_handle));
+#else
+		fprintf (stderr, "ERROR: unable to insert NODE id=%lld: %s\n",
+			 nodes->ids[i], sqlite3_errmsg (params->db_handle));
+#endif
+		return 0;
+	    }
+      }
+    return 1;
+}
+
 static int
 populate_road_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs)
 {
-/* populating the ROAD tables */
+/*
+/ populating the ROAD tables
+/
+/ all Way Tags are read by a single ordered scan and pivoted
+/ in memory; Node refs are merge-joined by a second ordered scan
+/ and resolved against the in-memory Node coordinates
+*/
     int ret;
-    sqlite3_stmt *query_main_stmt = NULL;
-    sqlite3_stmt *query_nodes_stmt = NULL;
+    struct ordered_scan tags_scan;
+    struct ordered_scan refs_scan;
+    struct tag_pivot pivot;
+    struct way_refs refs;
+    struct aux_arc_container arcs;
+    struct node_coords *nodes = &(params->nodes);
     sqlite3_stmt *ins_nodes_stmt = NULL;
     sqlite3_stmt *ins_arcs_stmt = NULL;
     const char *sql;
     char *sql_err = NULL;
 
-/* main SQL query extracting all Arcs */
-    sql = "SELECT w1.way_id AS osm_id, w1.v AS class, w2.v AS name, "
-	"w3.v AS lanes, w4.v AS maxspeed, w5.v AS onewway, w6.v AS roundabout "
-	"FROM osm_way_tags AS w1 "
-	"LEFT JOIN osm_way_tags AS w2 ON (w2.way_id = w1.way_id AND w2.k = 'name') "
-	"LEFT JOIN osm_way_tags AS w3 ON (w3.way_id = w1.way_id AND w3.k = 'lanes') "
-	"LEFT JOIN osm_way_tags AS w4 ON (w4.way_id = w1.way_id AND w4.k = 'maxspeed') "
-	"LEFT JOIN osm_way_tags AS w5 ON (w5.way_id = w1.way_id AND w5.k = 'oneway') "
-	"LEFT JOIN osm_way_tags AS w6 ON (w6.way_id = w1.way_id AND w6.k = 'junction') "
-	"WHERE w1.k = 'highway'";
-    ret =
-	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_main_stmt, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n",
-		   sqlite3_errmsg (params->db_handle));
-	  goto error;
-      }
-
-/* aux SQL query extracting Node refs */
-    sql = "SELECT w.node_id, ST_X(n.geometry), ST_Y(n.geometry), h.way_count "
-	"FROM osm_way_refs AS w "
-	"JOIN osm_nodes AS n ON (n.node_id = w.node_id) "
-	"JOIN osm_helper_nodes AS h ON (n.node_id = h.node_id) "
-	"WHERE w.way_id = ? ORDER BY w.sub";
-    ret =
-	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_nodes_stmt, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n",
-		   sqlite3_errmsg (params->db_handle));
-	  goto error;
-      }
+    tags_scan.stmt = NULL;
+    refs_scan.stmt = NULL;
+    pivot.count = 0;
+    pivot.max = 0;
+    pivot.keys = NULL;
+    pivot.values = NULL;
+    refs.count = 0;
+    refs.max = 0;
+    refs.ids = NULL;
+    arcs.first = NULL;
+    arcs.last = NULL;
+
+/* ordered scans on Way Tags and Way Refs */
+    if (!prepare_ordered_scan
+	(params, "SELECT way_id, k, v FROM osm_way_tags ORDER BY way_id, sub",
+	 &tags_scan))
+	goto error;
+    if (!prepare_ordered_scan
+	(params,
+	 "SELECT way_id, node_id FROM osm_way_refs ORDER BY way_id, sub",
+	 &refs_scan))
+	goto error;
 
 /* INSERT INTO nodes statement */
     sql = "INSERT INTO road_nodes (node_id, geometry) VALUES (?, ?)";
@@ -1561,200 +2416,117 @@ populate_road_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs)
 	  goto error;
       }
 
-    while (1)
+    while (tags_scan.valid)
       {
-	  /* scrolling the main result set */
-	  ret = sqlite3_step (query_main_stmt);
-	  if (ret == SQLITE_DONE)
+	  /* looping on Ways */
+	  struct aux_arc *arc;
+	  struct aux_arc *arc_n;
+	  unsigned char *blob;
+	  int blob_size;
+	  sqlite3_int64 id;
+	  const char *p_class;
+	  const char *p_oneway;
+	  const char *p_roundabout;
+	  if (!scan_tags (params->db_handle, &tags_scan, &pivot))
+	      goto rollback;
+	  id = pivot.id;
+	  p_class = pivot_value (&pivot, "highway");
+	  if (p_class == NULL)
+	      continue;
+	  if (!scan_refs (params->db_handle, &refs_scan, id, &refs))
+	      goto rollback;
+	  if (!build_arc (nodes, &refs, &arcs))
 	    {
-		/* there are no more rows to fetch - we can stop looping */
-		break;
+#if defined(_WIN32) || defined(__MINGW32__)
+		/* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
+		fprintf (stderr, "ERROR: unable to resolve ROAD id=%I64d\n", id);
+#else
+		fprintf (stderr, "ERROR: unable to resolve ROAD id=%lld\n", id);
+#endif
+		goto rollback;
 	    }
-	  if (ret == SQLITE_ROW)
+	  p_oneway = pivot_value (&pivot, "oneway");
+	  if (p_oneway == NULL)
+	      p_oneway = "";
+	  p_roundabout = pivot_value (&pivot, "junction");
+	  if (p_roundabout == NULL)
+	      p_roundabout = "";
+	  arc = arcs.first;
+	  while (arc != NULL)
 	    {
-		/* ok, we've just fetched a valid row */
-		struct aux_arc_container arcs;
-		struct aux_arc *arc;
-		struct aux_arc *arc_n;
-		unsigned char *blob;
-		int blob_size;
-		sqlite3_int64 id = sqlite3_column_int64 (query_main_stmt, 0);
-		arcs.first = NULL;
-		arcs.last = NULL;
-		if (!build_arc (params->db_handle, query_nodes_stmt, id, &arcs))
+		int oneway_ft = 1;
+		int oneway_tf = 1;
+		/* looping on split arcs */
+		arc_n = arc->next;
+		/* inserting the Arc itself */
+		sqlite3_reset (ins_arcs_stmt);
+		sqlite3_clear_bindings (ins_arcs_stmt);
+		sqlite3_bind_int64 (ins_arcs_stmt, 1, id);
+		sqlite3_bind_int64 (ins_arcs_stmt, 2, arc->node_from);
+		sqlite3_bind_int64 (ins_arcs_stmt, 3, arc->node_to);
+		bind_pivot_text (ins_arcs_stmt, 4, p_class);
+		bind_pivot_text (ins_arcs_stmt, 5, pivot_value (&pivot, "name"));
+		bind_pivot_int (ins_arcs_stmt, 6, pivot_value (&pivot, "lanes"));
+		bind_pivot_int (ins_arcs_stmt, 7,
+				pivot_value (&pivot, "maxspeed"));
+		if (strcmp (p_roundabout, "roundabout") == 0)
+		  {
+		      /* all roundabouts are always implicitly oneway */
+		      oneway_ft = 1;
+		      oneway_tf = 0;
+		  }
+		if (strcmp (p_class, "motorway") == 0)
+		  {
+		      /* all motorways are always implicitly oneway */
+		      oneway_ft = 1;
+		      oneway_tf = 0;
+		  }
+		if (strcmp (p_oneway, "1") == 0 || strcmp (p_oneway, "yes") == 0)
+		  {
+		      /* declared to be oneway From -> To */
+		      oneway_ft = 1;
+		      oneway_tf = 0;
+		  }
+		if (strcmp (p_oneway, "-1") == 0
+		    || strcmp (p_oneway, "reverse") == 0)
+		  {
+		      /* declared to be oneway To -> From */
+		      oneway_ft = 0;
+		      oneway_tf = 1;
+		  }
+		sqlite3_bind_int (ins_arcs_stmt, 8, oneway_ft);
+		sqlite3_bind_int (ins_arcs_stmt, 9, oneway_tf);
+		gaiaToSpatiaLiteBlobWkb (arc->geom, &blob, &blob_size);
+		gaiaFreeGeomColl (arc->geom);
+		arc->geom = NULL;
+		sqlite3_bind_blob (ins_arcs_stmt, 10, blob, blob_size, free);
+		ret = sqlite3_step (ins_arcs_stmt);
+		if (ret == SQLITE_DONE || ret == SQLITE_ROW)
+		    *cnt_arcs += 1;
+		else
 		  {
 #if defined(_WIN32) || defined(__MINGW32__)
 		      /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
 		      fprintf (stderr,
-			       "ERROR: unable to resolve ROAD id=%I64d\n", id);
+			       "ERROR: unable to insert ROAD id=%I64d: %s\n",
+			       id, sqlite3_errmsg (params->db_handle));
 #else
 		      fprintf (stderr,
-			       "ERROR: unable to resolve ROAD id=%lld\n", id);
-#endif
-		      goto error;
-		  }
-		arc = arcs.first;
-		while (arc != NULL)
-		  {
-		      int oneway_ft = 1;
-		      int oneway_tf = 1;
-		      const char *p_oneway = "";
-		      const char *p_roundabout = "";
-		      const char *p_motorway = "";
-		      /* looping on split arcs */
-		      arc_n = arc->next;
-		      /* inserting NODE From */
-		      sqlite3_reset (ins_nodes_stmt);
-		      sqlite3_clear_bindings (ins_nodes_stmt);
-		      sqlite3_bind_int64 (ins_nodes_stmt, 1, arc->node_from);
-		      gaiaToSpatiaLiteBlobWkb (arc->geom_from, &blob,
-					       &blob_size);
-		      gaiaFreeGeomColl (arc->geom_from);
-		      sqlite3_bind_blob (ins_nodes_stmt, 2, blob, blob_size,
-					 free);
-		      ret = sqlite3_step (ins_nodes_stmt);
-		      if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-			  *cnt_nodes += 1;
-		      /* inserting NODE To */
-		      sqlite3_reset (ins_nodes_stmt);
-		      sqlite3_clear_bindings (ins_nodes_stmt);
-		      sqlite3_bind_int64 (ins_nodes_stmt, 1, arc->node_to);
-		      gaiaToSpatiaLiteBlobWkb (arc->geom_to, &blob, &blob_size);
-		      gaiaFreeGeomColl (arc->geom_to);
-		      sqlite3_bind_blob (ins_nodes_stmt, 2, blob, blob_size,
-					 free);
-		      ret = sqlite3_step (ins_nodes_stmt);
-		      if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-			  *cnt_nodes += 1;
-		      /* inserting the Arc itself */
-		      sqlite3_reset (ins_arcs_stmt);
-		      sqlite3_clear_bindings (ins_arcs_stmt);
-		      sqlite3_bind_int64 (ins_arcs_stmt, 1, id);
-		      sqlite3_bind_int64 (ins_arcs_stmt, 2, arc->node_from);
-		      sqlite3_bind_int64 (ins_arcs_stmt, 3, arc->node_to);
-		      if (sqlite3_column_type (query_main_stmt, 1) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 4);
-		      else
-			  sqlite3_bind_text (ins_arcs_stmt, 4,
-					     (const char *)
-					     sqlite3_column_text
-					     (query_main_stmt, 1),
-					     sqlite3_column_bytes
-					     (query_main_stmt, 1),
-					     SQLITE_STATIC);
-		      if (sqlite3_column_type (query_main_stmt, 2) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 5);
-		      else
-			  sqlite3_bind_text (ins_arcs_stmt, 5,
-					     (const char *)
-					     sqlite3_column_text
-					     (query_main_stmt, 2),
-					     sqlite3_column_bytes
-					     (query_main_stmt, 2),
-					     SQLITE_STATIC);
-		      if (sqlite3_column_type (query_main_stmt, 3) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 6);
-		      else
-			  sqlite3_bind_int (ins_arcs_stmt, 6,
-					    sqlite3_column_int (query_main_stmt,
-								3));
-		      if (sqlite3_column_type (query_main_stmt, 4) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 7);
-		      else
-			  sqlite3_bind_int (ins_arcs_stmt, 7,
-					    sqlite3_column_int (query_main_stmt,
-								4));
-		      if (sqlite3_column_type (query_main_stmt, 5) !=
-			  SQLITE_NULL)
-			  p_oneway =
-			      (const char *)
-			      sqlite3_column_text (query_main_stmt, 5);
-		      if (sqlite3_column_type (query_main_stmt, 6) !=
-			  SQLITE_NULL)
-			  p_roundabout =
-			      (const char *)
-			      sqlite3_column_text (query_main_stmt, 6);
-		      if (sqlite3_column_type (query_main_stmt, 1) !=
-			  SQLITE_NULL)
-			  p_motorway =
-			      (const char *)
-			      sqlite3_column_text (query_main_stmt, 1);
-		      if (strcmp (p_roundabout, "roundabout") == 0)
-			{
-			    /* all roundabouts are always implicitly oneway */
-			    oneway_ft = 1;
-			    oneway_tf = 0;
-			}
-		      if (strcmp (p_motorway, "motorway") == 0)
-			{
-			    /* all motorways are always implicitly oneway */
-			    oneway_ft = 1;
-			    oneway_tf = 0;
-			}
-		      if (strcmp (p_oneway, "1") == 0
-			  || strcmp (p_oneway, "yes") == 0)
-			{
-			    /* declared to be oneway From -> To */
-			    oneway_ft = 1;
-			    oneway_tf = 0;
-			}
-		      if (strcmp (p_oneway, "-1") == 0
-			  || strcmp (p_oneway, "reverse") == 0)
-			{
-			    /* declared to be oneway To -> From */
-			    oneway_ft = 0;
-			    oneway_tf = 1;
-			}
-		      sqlite3_bind_int (ins_arcs_stmt, 8, oneway_ft);
-		      sqlite3_bind_int (ins_arcs_stmt, 9, oneway_tf);
-		      gaiaToSpatiaLiteBlobWkb (arc->geom, &blob, &blob_size);
-		      gaiaFreeGeomColl (arc->geom);
-		      sqlite3_bind_blob (ins_arcs_stmt, 10, blob, blob_size,
-					 free);
-		      ret = sqlite3_step (ins_arcs_stmt);
-		      if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-			  *cnt_arcs += 1;
-		      else
-			{
-#if defined(_WIN32) || defined(__MINGW32__)
-			    /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-			    fprintf (stderr,
-				     "ERROR: unable to insert ROAD id=%I64d: %s\n",
-				     id, sqlite3_errmsg (params->db_handle));
-#else
-			    fprintf (stderr,
-				     "ERROR: unable to insert ROAD id=%lld: %s\n",
-				     id, sqlite3_errmsg (params->db_handle));
+			       "ERROR: unable to insert ROAD id=%lld: %s\n",
+			       id, sqlite3_errmsg (params->db_handle));
 #endif
-			}
-		      free (arc);
-		      arc = arc_n;
-		  }
-	    }
-	  else
-	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (params->db_handle));
-		/* ROLLBACK */
-		ret =
-		    sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL,
-				  &sql_err);
-		if (ret != SQLITE_OK)
-		  {
-		      fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n",
-			       sql_err);
-		      sqlite3_free (sql_err);
-		      goto error;
 		  }
-		goto error;
+		arcs.first = arc_n;
+		free (arc);
+		arc = arc_n;
 	    }
+	  arcs.last = NULL;
       }
 
+/* inserting all Graph Nodes */
+    if (!insert_graph_nodes (params, ins_nodes_stmt, cnt_nodes))
+	goto rollback;
+
 /* committing the still pending SQL Transaction */
     ret = sqlite3_exec (params->db_handle, "COMMIT", NULL, NULL, &sql_err);
     if (ret != SQLITE_OK)
@@ -1764,22 +2536,36 @@ populate_road_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs)
 	  goto error;
       }
 
-    sqlite3_finalize (query_main_stmt);
-    sqlite3_finalize (query_nodes_stmt);
+    sqlite3_finalize (tags_scan.stmt);
+    sqlite3_finalize (refs_scan.stmt);
     sqlite3_finalize (ins_nodes_stmt);
     sqlite3_finalize (ins_arcs_stmt);
-
+    free_tag_pivot (&pivot);
+    if (refs.ids != NULL)
+	free (refs.ids);
     return 1;
 
+  rollback:
+    ret = sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL, &sql_err);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n", sql_err);
+	  sqlite3_free (sql_err);
+      }
+
   error:
-    if (query_main_stmt != NULL)
-	sqlite3_finalize (query_main_stmt);
-    if (query_nodes_stmt != NULL)
-	sqlite3_finalize (query_nodes_stmt);
+    free_aux_arcs (&arcs);
+    if (tags_scan.stmt != NULL)
+	sqlite3_finalize (tags_scan.stmt);
+    if (refs_scan.stmt != NULL)
+	sqlite3_finalize (refs_scan.stmt);
     if (ins_nodes_stmt != NULL)
 	sqlite3_finalize (ins_nodes_stmt);
     if (ins_arcs_stmt != NULL)
 	sqlite3_finalize (ins_arcs_stmt);
+    free_tag_pivot (&pivot);
+    if (refs.ids != NULL)
+	free (refs.ids);
     return 0;
 }
 
@@ -1792,32 +2578,6 @@ create_rail_tables (struct aux_params *params)
     char sql[1024];
     char *err_msg = NULL;
 
-/* creating OSM helper nodes */
-    strcpy (sql, "CREATE TABLE osm_helper_nodes (\n");
-    strcat (sql, "node_id INTEGER NOT NULL PRIMARY KEY,\n");
-    strcat (sql, "way_count INTEGER NOT NULL)\n");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "CREATE TABLE 'osm_helper_nodes' error: %s\n",
-		   err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
-/* populating OSM helper nodes */
-    strcpy (sql, "INSERT INTO osm_helper_nodes (node_id, way_count) ");
-    strcat (sql, "SELECT n.node_id, Count(*) FROM osm_nodes AS n ");
-    strcat (sql, "JOIN osm_way_refs AS w ON (w.node_id = n.node_id) ");
-    strcat (sql, "GROUP BY n.node_id");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "INSERT INTO 'osm_helper_nodes' error: %s\n",
-		   err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
-
 /* creating RAIL nodes */
     strcpy (sql, "CREATE TABLE rail_nodes (\n");
     strcat (sql, "node_id INTEGER NOT NULL PRIMARY KEY)\n");
@@ -1957,72 +2717,54 @@ static int
 populate_rail_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs,
 		       int *cnt_stations)
 {
-/* populating the RAIL tables */
+/*
+/ populating the RAIL tables
+/
+/ same as ROAD: ordered scans on Way Tags and Way Refs; Stations
+/ come from a further ordered scan on Node Tags
+*/
     int ret;
-    sqlite3_stmt *query_main_stmt = NULL;
-    sqlite3_stmt *query_nodes_stmt = NULL;
-    sqlite3_stmt *query_stations_stmt = NULL;
+    struct ordered_scan tags_scan;
+    struct ordered_scan refs_scan;
+    struct ordered_scan node_tags_scan;
+    struct tag_pivot pivot;
+    struct way_refs refs;
+    struct aux_arc_container arcs;
+    struct node_coords *nodes = &(params->nodes);
     sqlite3_stmt *ins_nodes_stmt = NULL;
     sqlite3_stmt *ins_arcs_stmt = NULL;
-    sqlite3_stmt *ins_stations_stmt = NULL;
-    const char *sql;
-    char *sql_err = NULL;
-
-/* main SQL query extracting all Arcs */
-    sql =
-	"SELECT w1.way_id AS osm_id, w1.v AS class, w2.v AS name, w3.v AS gauge, "
-	"w4.v AS tracks, w5.v AS electrified, w6.v AS voltage, w7.v AS operator "
-	"FROM osm_way_tags AS w1 "
-	"LEFT JOIN osm_way_tags AS w2 ON (w2.way_id = w1.way_id AND w2.k = 'name') "
-	"LEFT JOIN osm_way_tags AS w3 ON (w3.way_id = w1.way_id AND w3.k = 'gauge') "
-	"LEFT JOIN osm_way_tags AS w4 ON (w4.way_id = w1.way_id AND w4.k = 'tracks') "
-	"LEFT JOIN osm_way_tags AS w5 ON (w5.way_id = w1.way_id AND w5.k = 'electrified') "
-	"LEFT JOIN osm_way_tags AS w6 ON (w6.way_id = w1.way_id AND w6.k = 'voltage') "
-	"LEFT JOIN osm_way_tags AS w7 ON (w7.way_id = w1.way_id AND w7.k = 'operator') "
-	"WHERE w1.k = 'railway'";
-    ret =
-	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_main_stmt, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n",
-		   sqlite3_errmsg (params->db_handle));
-	  goto error;
-      }
-
-/* aux SQL query extracting Node refs */
-    sql = "SELECT w.node_id, ST_X(n.geometry), ST_Y(n.geometry), h.way_count "
-	"FROM osm_way_refs AS w "
-	"JOIN osm_nodes AS n ON (n.node_id = w.node_id) "
-	"JOIN osm_helper_nodes AS h ON (n.node_id = h.node_id) "
-	"WHERE w.way_id = ? ORDER BY w.sub";
-    ret =
-	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_nodes_stmt, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n",
-		   sqlite3_errmsg (params->db_handle));
-	  goto error;
-      }
+    sqlite3_stmt *ins_stations_stmt = NULL;
+    const char *sql;
+    char *sql_err = NULL;
 
-/* main SQL query extracting all Stations */
-    sql =
-	"SELECT n1.node_id AS osm_id, n2.v AS name, n3.v AS operator, g.geometry "
-	"FROM osm_node_tags AS n1 "
-	"JOIN osm_nodes AS g ON (g.node_id = n1.node_id) "
-	"LEFT JOIN osm_node_tags AS n2 ON (n2.node_id = n1.node_id AND n2.k = 'name') "
-	"LEFT JOIN osm_node_tags AS n3 ON (n3.node_id = n1.node_id AND n3.k = 'operator') "
-	"WHERE n1.k = 'railway' AND n1.v = 'station'";
-    ret =
-	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_stations_stmt, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n",
-		   sqlite3_errmsg (params->db_handle));
-	  goto error;
-      }
+    tags_scan.stmt = NULL;
+    refs_scan.stmt = NULL;
+    node_tags_scan.stmt = NULL;
+    pivot.count = 0;
+    pivot.max = 0;
+    pivot.keys = NULL;
+    pivot.values = NULL;
+    refs.count = 0;
+    refs.max = 0;
+    refs.ids = NULL;
+    arcs.first = NULL;
+    arcs.last = NULL;
+
+/* ordered scans on Way Tags, Way Refs and Node Tags */
+    if (!prepare_ordered_scan
+	(params, "SELECT way_id, k, v FROM osm_way_tags ORDER BY way_id, sub",
+	 &tags_scan))
+	goto error;
+    if (!prepare_ordered_scan
+	(params,
+	 "SELECT way_id, node_id FROM osm_way_refs ORDER BY way_id, sub",
+	 &refs_scan))
+	goto error;
+    if (!prepare_ordered_scan
+	(params,
+	 "SELECT node_id, k, v FROM osm_node_tags ORDER BY node_id, sub",
+	 &node_tags_scan))
+	goto error;
 
 /* INSERT INTO nodes statement */
     sql = "INSERT INTO rail_nodes (node_id, geometry) VALUES (?, ?)";
@@ -2073,258 +2815,129 @@ populate_rail_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs,
 	  goto error;
       }
 
-    while (1)
+    while (tags_scan.valid)
       {
-	  /* scrolling the main result set */
-	  ret = sqlite3_step (query_main_stmt);
-	  if (ret == SQLITE_DONE)
-	    {
-		/* there are no more rows to fetch - we can stop looping */
-		break;
-	    }
-	  if (ret == SQLITE_ROW)
+	  /* looping on Ways */
+	  struct aux_arc *arc;
+	  struct aux_arc *arc_n;
+	  unsigned char *blob;
+	  int blob_size;
+	  sqlite3_int64 id;
+	  const char *p_class;
+	  if (!scan_tags (params->db_handle, &tags_scan, &pivot))
+	      goto rollback;
+	  id = pivot.id;
+	  p_class = pivot_value (&pivot, "railway");
+	  if (p_class == NULL)
+	      continue;
+	  if (!scan_refs (params->db_handle, &refs_scan, id, &refs))
+	      goto rollback;
+	  if (!build_arc (nodes, &refs, &arcs))
 	    {
-		/* ok, we've just fetched a valid row */
-		struct aux_arc_container arcs;
-		struct aux_arc *arc;
-		struct aux_arc *arc_n;
-		unsigned char *blob;
-		int blob_size;
-		sqlite3_int64 id = sqlite3_column_int64 (query_main_stmt, 0);
-		arcs.first = NULL;
-		arcs.last = NULL;
-		if (!build_arc (params->db_handle, query_nodes_stmt, id, &arcs))
-		  {
-#if defined(_WIN32) || defined(__MINGW32__)
-		      /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-		      fprintf (stderr,
-			       "ERROR: unable to resolve RAIL id=%I64d\n", id);
-#else
-		      fprintf (stderr,
-			       "ERROR: unable to resolve RAIL id=%lld\n", id);
-#endif
-		      goto error;
-		  }
-		arc = arcs.first;
-		while (arc != NULL)
-		  {
-		      /* looping on split arcs */
-		      arc_n = arc->next;
-		      /* inserting NODE From */
-		      sqlite3_reset (ins_nodes_stmt);
-		      sqlite3_clear_bindings (ins_nodes_stmt);
-		      sqlite3_bind_int64 (ins_nodes_stmt, 1, arc->node_from);
-		      gaiaToSpatiaLiteBlobWkb (arc->geom_from, &blob,
-					       &blob_size);
-		      gaiaFreeGeomColl (arc->geom_from);
-		      sqlite3_bind_blob (ins_nodes_stmt, 2, blob, blob_size,
-					 free);
-		      ret = sqlite3_step (ins_nodes_stmt);
-		      if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-			  *cnt_nodes += 1;
-		      /* inserting NODE To */
-		      sqlite3_reset (ins_nodes_stmt);
-		      sqlite3_clear_bindings (ins_nodes_stmt);
-		      sqlite3_bind_int64 (ins_nodes_stmt, 1, arc->node_to);
-		      gaiaToSpatiaLiteBlobWkb (arc->geom_to, &blob, &blob_size);
-		      gaiaFreeGeomColl (arc->geom_to);
-		      sqlite3_bind_blob (ins_nodes_stmt, 2, blob, blob_size,
-					 free);
-		      ret = sqlite3_step (ins_nodes_stmt);
-		      if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-			  *cnt_nodes += 1;
-		      /* inserting the Arc itself */
-		      sqlite3_reset (ins_arcs_stmt);
-		      sqlite3_clear_bindings (ins_arcs_stmt);
-		      sqlite3_bind_int64 (ins_arcs_stmt, 1, id);
-		      sqlite3_bind_int64 (ins_arcs_stmt, 2, arc->node_from);
-		      sqlite3_bind_int64 (ins_arcs_stmt, 3, arc->node_to);
-		      if (sqlite3_column_type (query_main_stmt, 1) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 4);
-		      else
-			  sqlite3_bind_text (ins_arcs_stmt, 4,
-					     (const char *)
-					     sqlite3_column_text
-					     (query_main_stmt, 1),
-					     sqlite3_column_bytes
-					     (query_main_stmt, 1),
-					     SQLITE_STATIC);
-		      if (sqlite3_column_type (query_main_stmt, 2) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 5);
-		      else
-			  sqlite3_bind_text (ins_arcs_stmt, 5,
-					     (const char *)
-					     sqlite3_column_text
-					     (query_main_stmt, 2),
-					     sqlite3_column_bytes
-					     (query_main_stmt, 2),
-					     SQLITE_STATIC);
-		      if (sqlite3_column_type (query_main_stmt, 3) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 6);
-		      else
-			  sqlite3_bind_int (ins_arcs_stmt, 6,
-					    sqlite3_column_int (query_main_stmt,
-								3));
-		      if (sqlite3_column_type (query_main_stmt, 4) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 7);
-		      else
-			  sqlite3_bind_int (ins_arcs_stmt, 7,
-					    sqlite3_column_int (query_main_stmt,
-								4));
-		      if (sqlite3_column_type (query_main_stmt, 5) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 8);
-		      else
-			  sqlite3_bind_text (ins_arcs_stmt, 8,
-					     (const char *)
-					     sqlite3_column_text
-					     (query_main_stmt, 5),
-					     sqlite3_column_bytes
-					     (query_main_stmt, 5),
-					     SQLITE_STATIC);
-		      if (sqlite3_column_type (query_main_stmt, 6) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 9);
-		      else
-			  sqlite3_bind_int (ins_arcs_stmt, 9,
-					    sqlite3_column_int (query_main_stmt,
-								6));
-		      if (sqlite3_column_type (query_main_stmt, 6) ==
-			  SQLITE_NULL)
-			  sqlite3_bind_null (ins_arcs_stmt, 10);
-		      else
-			  sqlite3_bind_text (ins_arcs_stmt, 10,
-					     (const char *)
-					     sqlite3_column_text
-					     (query_main_stmt, 7),
-					     sqlite3_column_bytes
-					     (query_main_stmt, 7),
-					     SQLITE_STATIC);
-		      gaiaToSpatiaLiteBlobWkb (arc->geom, &blob, &blob_size);
-		      gaiaFreeGeomColl (arc->geom);
-		      sqlite3_bind_blob (ins_arcs_stmt, 11, blob, blob_size,
-					 free);
-		      ret = sqlite3_step (ins_arcs_stmt);
-		      if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-			  *cnt_arcs += 1;
-		      else
-			{
 #if defined(_WIN32) || defined(__MINGW32__)
-			    /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-			    fprintf (stderr,
-				     "ERROR: unable to insert RAIL id=%I64d: %s\n",
-				     id, sqlite3_errmsg (params->db_handle));
+		/* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
+		fprintf (stderr, "ERROR: unable to resolve RAIL id=%I64d\n", id);
 #else
-			    fprintf (stderr,
-				     "ERROR: unable to insert RAIL id=%lld: %s\n",
-				     id, sqlite3_errmsg (params->db_handle));
+		fprintf (stderr, "ERROR: unable to resolve RAIL id=%lld\n", id);
 #endif
-			}
-		      free (arc);
-		      arc = arc_n;
-		  }
-	    }
-	  else
-	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (params->db_handle));
-		/* ROLLBACK */
-		ret =
-		    sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL,
-				  &sql_err);
-		if (ret != SQLITE_OK)
-		  {
-		      fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n",
-			       sql_err);
-		      sqlite3_free (sql_err);
-		      goto error;
-		  }
-		goto error;
-	    }
-      }
-
-    while (1)
-      {
-	  /* scrolling the stations result set */
-	  ret = sqlite3_step (query_stations_stmt);
-	  if (ret == SQLITE_DONE)
-	    {
-		/* there are no more rows to fetch - we can stop looping */
-		break;
+		goto rollback;
 	    }
-	  if (ret == SQLITE_ROW)
+	  arc = arcs.first;
+	  while (arc != NULL)
 	    {
-		/* ok, we've just fetched a valid row */
-		sqlite3_int64 id =
-		    sqlite3_column_int64 (query_stations_stmt, 0);
-		sqlite3_reset (ins_stations_stmt);
-		sqlite3_clear_bindings (ins_stations_stmt);
-		sqlite3_bind_int64 (ins_stations_stmt, 1, id);
-		if (sqlite3_column_type (query_stations_stmt, 1) == SQLITE_NULL)
-		    sqlite3_bind_null (ins_stations_stmt, 2);
-		else
-		    sqlite3_bind_text (ins_stations_stmt, 2,
-				       (const char *)
-				       sqlite3_column_text (query_stations_stmt,
-							    1),
-				       sqlite3_column_bytes
-				       (query_stations_stmt, 1), SQLITE_STATIC);
-		if (sqlite3_column_type (query_stations_stmt, 2) == SQLITE_NULL)
-		    sqlite3_bind_null (ins_stations_stmt, 3);
-		else
-		    sqlite3_bind_text (ins_stations_stmt, 3,
-				       (const char *)
-				       sqlite3_column_text (query_stations_stmt,
-							    2),
-				       sqlite3_column_bytes
-				       (query_stations_stmt, 2), SQLITE_STATIC);
-		if (sqlite3_column_type (query_stations_stmt, 3) == SQLITE_NULL)
-		    sqlite3_bind_null (ins_stations_stmt, 4);
-		else
-		    sqlite3_bind_blob (ins_stations_stmt, 4,
-				       sqlite3_column_blob (query_stations_stmt,
-							    3),
-				       sqlite3_column_bytes
-				       (query_stations_stmt, 3), SQLITE_STATIC);
-		ret = sqlite3_step (ins_stations_stmt);
+		/* looping on split arcs */
+		arc_n = arc->next;
+		/* inserting the Arc itself */
+		sqlite3_reset (ins_arcs_stmt);
+		sqlite3_clear_bindings (ins_arcs_stmt);
+		sqlite3_bind_int64 (ins_arcs_stmt, 1, id);
+		sqlite3_bind_int64 (ins_arcs_stmt, 2, arc->node_from);
+		sqlite3_bind_int64 (ins_arcs_stmt, 3, arc->node_to);
+		bind_pivot_text (ins_arcs_stmt, 4, p_class);
+		bind_pivot_text (ins_arcs_stmt, 5, pivot_value (&pivot, "name"));
+		bind_pivot_int (ins_arcs_stmt, 6, pivot_value (&pivot, "gauge"));
+		bind_pivot_int (ins_arcs_stmt, 7, pivot_value (&pivot, "tracks"));
+		bind_pivot_text (ins_arcs_stmt, 8,
+				 pivot_value (&pivot, "electrified"));
+		bind_pivot_int (ins_arcs_stmt, 9,
+				pivot_value (&pivot, "voltage"));
+		bind_pivot_text (ins_arcs_stmt, 10,
+				 pivot_value (&pivot, "operator"));
+		gaiaToSpatiaLiteBlobWkb (arc->geom, &blob, &blob_size);
+		gaiaFreeGeomColl (arc->geom);
+		arc->geom = NULL;
+		sqlite3_bind_blob (ins_arcs_stmt, 11, blob, blob_size, free);
+		ret = sqlite3_step (ins_arcs_stmt);
 		if (ret == SQLITE_DONE || ret == SQLITE_ROW)
-		    *cnt_stations += 1;
+		    *cnt_arcs += 1;
 		else
 		  {
 #if defined(_WIN32) || defined(__MINGW32__)
 		      /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
 		      fprintf (stderr,
-			       "ERROR: unable to insert RAIL station id=%I64d: %s\n",
+			       "ERROR: unable to insert RAIL id=%I64d: %s\n",
 			       id, sqlite3_errmsg (params->db_handle));
 #else
 		      fprintf (stderr,
-			       "ERROR: unable to insert RAIL station id=%lld: %s\n",
+			       "ERROR: unable to insert RAIL id=%lld: %s\n",
 			       id, sqlite3_errmsg (params->db_handle));
 #endif
 		  }
+		arcs.first = arc_n;
+		free (arc);
+		arc = arc_n;
 	    }
+	  arcs.last = NULL;
+      }
+
+/* inserting all Graph Nodes */
+    if (!insert_graph_nodes (params, ins_nodes_stmt, cnt_nodes))
+	goto rollback;
+
+    while (node_tags_scan.valid)
+      {
+	  /* looping on Nodes: searching Stations */
+	  const char *railway;
+	  unsigned char *blob;
+	  int blob_size;
+	  int idx;
+	  sqlite3_int64 id;
+	  if (!scan_tags (params->db_handle, &node_tags_scan, &pivot))
+	      goto rollback;
+	  id = pivot.id;
+	  railway = pivot_value (&pivot, "railway");
+	  if (railway == NULL)
+	      continue;
+	  if (strcmp (railway, "station") != 0)
+	      continue;
+	  idx = find_node_coords (nodes, id);
+	  if (idx < 0)
+	      continue;
+	  sqlite3_reset (ins_stations_stmt);
+	  sqlite3_clear_bindings (ins_stations_stmt);
+	  sqlite3_bind_int64 (ins_stations_stmt, 1, id);
+	  bind_pivot_text (ins_stations_stmt, 2, pivot_value (&pivot, "name"));
+	  bind_pivot_text (ins_stations_stmt, 3,
+			   pivot_value (&pivot, "operator"));
+	  if (build_point_blob (nodes, idx, &blob, &blob_size))
+	      sqlite3_bind_blob (ins_stations_stmt, 4, blob, blob_size, free);
+	  else
+	      sqlite3_bind_null (ins_stations_stmt, 4);
+	  ret = sqlite3_step (ins_stations_stmt);
+	  if (ret == SQLITE_DONE || ret == SQLITE_ROW)
+	      *cnt_stations += 1;
 	  else
 	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (params->db_handle));
-		/* ROLLBACK */
-		ret =
-		    sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL,
-				  &sql_err);
-		if (ret != SQLITE_OK)
-		  {
-		      fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n",
-			       sql_err);
-		      sqlite3_free (sql_err);
-		      goto error;
-		  }
-		goto error;
+#if defined(_WIN32) || defined(__MINGW32__)
+		/* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
+		fprintf (stderr,
+			 "ERROR: unable to insert RAIL station id=%I64d: %s\n",
+			 id, sqlite3_errmsg (params->db_handle));
+#else
+		fprintf (stderr,
+			 "ERROR: unable to insert RAIL station id=%lld: %s\n",
+			 id, sqlite3_errmsg (params->db_handle));
+#endif
 	    }
       }
 
@@ -2337,71 +2950,45 @@ populate_rail_network (struct aux_params *params, int *cnt_nodes, int *cnt_arcs,
 	  goto error;
       }
 
-    sqlite3_finalize (query_main_stmt);
-    sqlite3_finalize (query_nodes_stmt);
+    sqlite3_finalize (tags_scan.stmt);
+    sqlite3_finalize (refs_scan.stmt);
+    sqlite3_finalize (node_tags_scan.stmt);
     sqlite3_finalize (ins_nodes_stmt);
     sqlite3_finalize (ins_arcs_stmt);
-
+    sqlite3_finalize (ins_stations_stmt);
+    free_tag_pivot (&pivot);
+    if (refs.ids != NULL)
+	free (refs.ids);
     return 1;
 
+  rollback:
+    ret = sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL, &sql_err);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n", sql_err);
+	  sqlite3_free (sql_err);
+      }
+
   error:
-    if (query_main_stmt != NULL)
-	sqlite3_finalize (query_main_stmt);
-    if (query_nodes_stmt != NULL)
-	sqlite3_finalize (query_nodes_stmt);
-    if (query_stations_stmt != NULL)
-	sqlite3_finalize (query_stations_stmt);
+    free_aux_arcs (&arcs);
+    if (tags_scan.stmt != NULL)
+	sqlite3_finalize (tags_scan.stmt);
+    if (refs_scan.stmt != NULL)
+	sqlite3_finalize (refs_scan.stmt);
+    if (node_tags_scan.stmt != NULL)
+	sqlite3_finalize (node_tags_scan.stmt);
     if (ins_nodes_stmt != NULL)
 	sqlite3_finalize (ins_nodes_stmt);
     if (ins_arcs_stmt != NULL)
 	sqlite3_finalize (ins_arcs_stmt);
     if (ins_stations_stmt != NULL)
 	sqlite3_finalize (ins_stations_stmt);
+    free_tag_pivot (&pivot);
+    if (refs.ids != NULL)
+	free (refs.ids);
     return 0;
 }
 
-static int
-create_map_indices (struct aux_params *params)
-{
-/* creating the MAP helper indices */
-    sqlite3 *db_handle = params->db_handle;
-    int ret;
-    char sql[1024];
-    char *err_msg = NULL;
-
-/* creating OSM helper idx_node_tags */
-    strcpy (sql, "CREATE INDEX idx_node_tags ON osm_node_tags (k)\n");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "CREATE INDEX 'osm_node_tags' error: %s\n", err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
-
-/* creating OSM helper idx_way_tags */
-    strcpy (sql, "CREATE INDEX idx_way_tags ON osm_node_tags (k)\n");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "CREATE INDEX 'osm_way_tags' error: %s\n", err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
-
-/* creating OSM helper idx_relation_tags */
-    strcpy (sql, "CREATE INDEX idx_relation_tags ON osm_node_tags (k)\n");
-    ret = sqlite3_exec (db_handle, sql, NULL, NULL, &err_msg);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "CREATE INDEX 'osm_relation_tags' error: %s\n",
-		   err_msg);
-	  sqlite3_free (err_msg);
-	  return 0;
-      }
-    return 1;
-}
-
 static void
 do_create_point_table (struct aux_params *params, struct layers *layer)
 {
@@ -2976,12 +3563,11 @@ do_insert_multi_polygon (struct aux_params *params, sqlite3_int64 id,
 }
 
 static int
-build_way_geom (sqlite3 * sqlite, sqlite3_stmt * query_nodes_stmt,
-		sqlite3_int64 id, const char *layer_name, int polygon,
-		gaiaGeomCollPtr * p_geom)
+build_way_geom (struct node_coords *nodes, struct way_refs *refs,
+		const char *layer_name, int polygon, gaiaGeomCollPtr * p_geom)
 {
-/* building a Way Geometry */
-    int ret;
+/* building a Way Geometry (NULL if less than two Nodes are resolved) */
+    int i;
     int areal_layer = 0;
     int is_closed = 0;
     int count = 0;
@@ -2995,8 +3581,9 @@ build_way_geom (sqlite3 * sqlite, sqlite3_stmt * query_nodes_stmt,
     gaiaRingPtr rng;
     int iv;
     gaiaGeomCollPtr geom;
-    gaiaDynamicLinePtr dyn_line = gaiaAllocDynamicLine ();
+    gaiaDynamicLinePtr dyn_line;
 
+    *p_geom = NULL;
     if (layer_name)
       {
 	  /* possible "areal" layers */
@@ -3024,43 +3611,38 @@ build_way_geom (sqlite3 * sqlite, sqlite3_stmt * query_nodes_stmt,
 	      areal_layer = 1;
       }
 
-    sqlite3_reset (query_nodes_stmt);
-    sqlite3_clear_bindings (query_nodes_stmt);
-    sqlite3_bind_int64 (query_nodes_stmt, 1, id);
-    while (1)
+    dyn_line = gaiaAllocDynamicLine ();
+    for (i = 0; i < refs->count; i++)
       {
-	  /* scrolling the main result set */
-	  ret = sqlite3_step (query_nodes_stmt);
-	  if (ret == SQLITE_DONE)
+	  /* looping on Node refs */
+	  double x;
+	  double y;
+	  int idx = find_node_coords (nodes, refs->ids[i]);
+	  if (idx < 0)
 	    {
-		/* there are no more rows to fetch - we can stop looping */
-		break;
+		/* unresolved Node: skipping */
+		continue;
 	    }
-	  if (ret == SQLITE_ROW)
+	  x = nodes->coords[idx * 2];
+	  y = nodes->coords[(idx * 2) + 1];
+	  gaiaAppendPointToDynamicLine (dyn_line, x, y);
+	  if (count == 0)
 	    {
-		/* ok, we've just fetched a valid row */
-		double x = sqlite3_column_double (query_nodes_stmt, 0);
-		double y = sqlite3_column_double (query_nodes_stmt, 1);
-		gaiaAppendPointToDynamicLine (dyn_line, x, y);
-		if (count == 0)
-		  {
-		      x0 = x;
-		      y0 = y;
-		  }
-		else
-		  {
-		      xN = x;
-		      yN = y;
-		  }
-		count++;
+		x0 = x;
+		y0 = y;
 	    }
 	  else
 	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (sqlite));
-		return 0;
+		xN = x;
+		yN = y;
 	    }
+	  count++;
+      }
+    if (count < 2)
+      {
+	  /* not a valid Geometry */
+	  gaiaFreeDynamicLine (dyn_line);
+	  return 1;
       }
 
 /* testing for a closed ring */
@@ -3105,31 +3687,50 @@ build_way_geom (sqlite3 * sqlite, sqlite3_stmt * query_nodes_stmt,
     return 1;
 }
 
+static void
+add_rel_way_line (gaiaGeomCollPtr aggregate_geom, gaiaDynamicLinePtr dyn_line,
+		  int count)
+{
+/* saving a Way Linestring into the aggregate Geometry */
+    gaiaPointPtr pt;
+    gaiaLinestringPtr ln;
+    int iv = 0;
+    if (count < 2)
+	return;
+    ln = gaiaAddLinestringToGeomColl (aggregate_geom, count);
+    pt = dyn_line->First;
+    while (pt)
+      {
+	  /* inserting any POINT into LINESTRING */
+	  gaiaSetPoint (ln->Coords, iv, pt->X, pt->Y);
+	  iv++;
+	  pt = pt->Next;
+      }
+}
+
 static int
 build_rel_way_geom (void *cache, sqlite3 * sqlite,
-		    sqlite3_stmt * query_nodes_stmt, sqlite3_int64 id,
-		    gaiaGeomCollPtr * p_geom)
+		    sqlite3_stmt * query_refs_stmt, struct node_coords *nodes,
+		    sqlite3_int64 id, gaiaGeomCollPtr * p_geom)
 {
-/* building a complex Relation-Way Geometry */
+/* building a complex Relation-Way Geometry (NULL if empty) */
     int ret;
     int count = 0;
-    gaiaPointPtr pt;
-    gaiaLinestringPtr ln;
-    int iv;
     int first = 1;
     sqlite3_int64 current_id;
     gaiaGeomCollPtr geom;
     gaiaDynamicLinePtr dyn_line = gaiaAllocDynamicLine ();
     gaiaGeomCollPtr aggregate_geom = gaiaAllocGeomColl ();
     aggregate_geom->Srid = 4326;
+    *p_geom = NULL;
 
-    sqlite3_reset (query_nodes_stmt);
-    sqlite3_clear_bindings (query_nodes_stmt);
-    sqlite3_bind_int64 (query_nodes_stmt, 1, id);
+    sqlite3_reset (query_refs_stmt);
+    sqlite3_clear_bindings (query_refs_stmt);
+    sqlite3_bind_int64 (query_refs_stmt, 1, id);
     while (1)
       {
 	  /* scrolling the main result set */
-	  ret = sqlite3_step (query_nodes_stmt);
+	  ret = sqlite3_step (query_refs_stmt);
 	  if (ret == SQLITE_DONE)
 	    {
 		/* there are no more rows to fetch - we can stop looping */
@@ -3139,9 +3740,16 @@ build_rel_way_geom (void *cache, sqlite3 * sqlite,
 	    {
 		/* ok, we've just fetched a valid row */
 		sqlite3_int64 way_id =
-		    sqlite3_column_int64 (query_nodes_stmt, 0);
-		double x = sqlite3_column_double (query_nodes_stmt, 1);
-		double y = sqlite3_column_double (query_nodes_stmt, 2);
+		    sqlite3_column_int64 (query_refs_stmt, 0);
+		int idx =
+		    find_node_coords (nodes,
+				      sqlite3_column_int64 (query_refs_stmt,
+							    1));
+		if (idx < 0)
+		  {
+		      /* unresolved Node: skipping */
+		      continue;
+		  }
 		if (first)
 		  {
 		      current_id = way_id;
@@ -3150,22 +3758,14 @@ build_rel_way_geom (void *cache, sqlite3 * sqlite,
 		if (way_id != current_id)
 		  {
 		      /* saving the current Way Linestring */
-		      ln = gaiaAddLinestringToGeomColl (aggregate_geom, count);
-		      iv = 0;
-		      pt = dyn_line->First;
-		      while (pt)
-			{
-			    /* inserting any POINT into LINESTRING */
-			    gaiaSetPoint (ln->Coords, iv, pt->X, pt->Y);
-			    iv++;
-			    pt = pt->Next;
-			}
+		      add_rel_way_line (aggregate_geom, dyn_line, count);
 		      gaiaFreeDynamicLine (dyn_line);
 		      dyn_line = gaiaAllocDynamicLine ();
 		      count = 0;
 		      current_id = way_id;
 		  }
-		gaiaAppendPointToDynamicLine (dyn_line, x, y);
+		gaiaAppendPointToDynamicLine (dyn_line, nodes->coords[idx * 2],
+					      nodes->coords[(idx * 2) + 1]);
 		count++;
 	    }
 	  else
@@ -3173,22 +3773,21 @@ build_rel_way_geom (void *cache, sqlite3 * sqlite,
 		/* some unexpected error occurred */
 		fprintf (stderr, "sqlite3_step() error: %s\n",
 			 sqlite3_errmsg (sqlite));
+		gaiaFreeDynamicLine (dyn_line);
+		gaiaFreeGeomColl (aggregate_geom);
 		return 0;
 	    }
       }
 
 /* saving the last Way Linestring */
-    ln = gaiaAddLinestringToGeomColl (aggregate_geom, count);
-    iv = 0;
-    pt = dyn_line->First;
-    while (pt)
+    add_rel_way_line (aggregate_geom, dyn_line, count);
+    gaiaFreeDynamicLine (dyn_line);
+    if (aggregate_geom->FirstLinestring == NULL)
       {
-	  /* inserting any POINT into LINESTRING */
-	  gaiaSetPoint (ln->Coords, iv, pt->X, pt->Y);
-	  iv++;
-	  pt = pt->Next;
+	  /* empty Geometry */
+	  gaiaFreeGeomColl (aggregate_geom);
+	  return 1;
       }
-    gaiaFreeDynamicLine (dyn_line);
 
 /* attempting to build a MultiPolygon */
     geom = gaiaPolygonize_r (cache, aggregate_geom, 1);
@@ -3219,117 +3818,86 @@ build_rel_way_geom (void *cache, sqlite3 * sqlite,
 }
 
 static int
-populate_map_layers (struct aux_params *params, int *points, int *linestrings,
-		     int *polygons, int *multi_linestrings, int *multi_polygons)
+is_map_layer (const char *name)
 {
-/* populating the MAP layers aka tables */
-    int ret;
-    sqlite3_stmt *query_nodes_stmt = NULL;
-    sqlite3_stmt *query_ways_stmt = NULL;
-    sqlite3_stmt *query_rel_ways_stmt = NULL;
-    sqlite3_stmt *query_way_nodes_stmt = NULL;
-    sqlite3_stmt *query_rel_way_nodes_stmt = NULL;
-    char *layers;
-    char *sql;
-    char *sql_err = NULL;
+/* testing for some well known layer */
     struct layers *layer;
     int i = 0;
-
-/* preparing the list of well known layers */
     while (1)
       {
 	  layer = &(base_layers[i++]);
 	  if (layer->name == NULL)
 	      break;
-	  if (i == 1)
-	      layers = sqlite3_mprintf ("%Q", layer->name);
-	  else
-	    {
-		char *prev = layers;
-		layers = sqlite3_mprintf ("%s, %Q", prev, layer->name);
-		sqlite3_free (prev);
-	    }
-      }
-
-/* main SQL query extracting all relevant Nodes */
-    sql =
-	sqlite3_mprintf ("SELECT n1.node_id, n1.k AS class, n1.v AS subclass, "
-			 "n2.v AS name, g.geometry AS geometry "
-			 "FROM osm_node_tags AS n1 "
-			 "JOIN osm_nodes AS g ON (g.node_id = n1.node_id) "
-			 "LEFT JOIN osm_node_tags AS n2 ON (n2.node_id = n1.node_id AND n2.k = 'name') "
-			 "WHERE n1.k IN (%s)", layers);
-    ret =
-	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_nodes_stmt, NULL);
-    sqlite3_free (sql);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n",
-		   sqlite3_errmsg (params->db_handle));
-	  goto error;
-      }
-
-/* main SQL query extracting all relevant Ways */
-    sql = sqlite3_mprintf ("SELECT w1.way_id, w1.k AS class, w1.v AS subclass, "
-			   "w2.v AS name, w3.v AS polygon "
-			   "FROM osm_way_tags AS w1 "
-			   "LEFT JOIN osm_way_tags AS w2 ON (w2.way_id = w1.way_id AND w2.k = 'name') "
-			   "LEFT JOIN osm_way_tags AS w3 ON (w3.way_id = w1.way_id AND w3.k = 'area') "
-			   "WHERE w1.k IN (%s)", layers);
-    ret =
-	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_ways_stmt, NULL);
-    sqlite3_free (sql);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n",
-		   sqlite3_errmsg (params->db_handle));
-	  goto error;
+	  if (strcmp (layer->name, name) == 0)
+	      return 1;
       }
+    return 0;
+}
 
-/* main SQL query extracting all relevant Relations-Ways */
-    sql = sqlite3_mprintf ("SELECT r1.rel_id, r1.k AS class, r1.v AS subclass, "
-			   "r2.v AS name, count(rr.ref) AS cnt FROM osm_relation_tags AS r1 "
-			   "LEFT JOIN osm_relation_tags AS r2 ON (r2.rel_id = r1.rel_id AND r2.k = 'name') "
-			   "LEFT JOIN osm_relation_refs AS rr ON (rr.rel_id = r1.rel_id AND rr.type = 'way') "
-			   "WHERE r1.k IN (%s) GROUP BY r1.rel_id", layers);
-    ret =
-	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_rel_ways_stmt, NULL);
-    sqlite3_free (sql);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n",
-		   sqlite3_errmsg (params->db_handle));
-	  goto error;
-      }
-    sqlite3_free (layers);
+static int
+populate_map_layers (struct aux_params *params, int *points, int *linestrings,
+		     int *polygons, int *multi_linestrings, int *multi_polygons)
+{
+/*
+/ populating the MAP layers aka tables
+/
+/ Node, Way and Relation Tags are read by ordered scans and pivoted
+/ in memory; Way refs are merge-joined and resolved against the
+/ in-memory Node coordinates
+*/
+    int ret;
+    int i;
+    struct ordered_scan node_tags_scan;
+    struct ordered_scan way_tags_scan;
+    struct ordered_scan rel_tags_scan;
+    struct ordered_scan refs_scan;
+    struct tag_pivot pivot;
+    struct way_refs refs;
+    struct node_coords *nodes = &(params->nodes);
+    sqlite3_stmt *query_rel_way_refs_stmt = NULL;
+    const char *sql;
+    char *sql_err = NULL;
 
-/* aux SQL query extracting Way-Node refs */
-    sql = "SELECT ST_X(n.geometry), ST_Y(n.geometry) "
-	"FROM osm_way_refs AS w "
-	"JOIN osm_nodes AS n ON (n.node_id = w.node_id) "
-	"WHERE w.way_id = ? ORDER BY w.sub";
-    ret =
-	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_way_nodes_stmt, NULL);
-    if (ret != SQLITE_OK)
-      {
-	  fprintf (stderr, "SQL error: %s\n",
-		   sqlite3_errmsg (params->db_handle));
-	  goto error;
-      }
+    node_tags_scan.stmt = NULL;
+    way_tags_scan.stmt = NULL;
+    rel_tags_scan.stmt = NULL;
+    refs_scan.stmt = NULL;
+    pivot.count = 0;
+    pivot.max = 0;
+    pivot.keys = NULL;
+    pivot.values = NULL;
+    refs.count = 0;
+    refs.max = 0;
+    refs.ids = NULL;
+
+/* ordered scans on Node/Way/Relation Tags and Way Refs */
+    if (!prepare_ordered_scan
+	(params,
+	 "SELECT node_id, k, v FROM osm_node_tags ORDER BY node_id, sub",
+	 &node_tags_scan))
+	goto error;
+    if (!prepare_ordered_scan
+	(params, "SELECT way_id, k, v FROM osm_way_tags ORDER BY way_id, sub",
+	 &way_tags_scan))
+	goto error;
+    if (!prepare_ordered_scan
+	(params,
+	 "SELECT rel_id, k, v FROM osm_relation_tags ORDER BY rel_id, sub",
+	 &rel_tags_scan))
+	goto error;
+    if (!prepare_ordered_scan
+	(params,
+	 "SELECT way_id, node_id FROM osm_way_refs ORDER BY way_id, sub",
+	 &refs_scan))
+	goto error;
 
 /* aux SQL query extracting Relation-Way-Node refs */
-    sql = "SELECT w.way_id, ST_X(n.geometry), ST_Y(n.geometry) "
-	"FROM osm_way_refs AS w "
-	"JOIN osm_nodes AS n ON (n.node_id = w.node_id) "
+    sql = "SELECT w.way_id, w.node_id FROM osm_way_refs AS w "
 	"WHERE w.way_id IN (SELECT ref FROM osm_relation_refs "
 	"WHERE rel_id = ? AND type = 'way') " "ORDER BY w.way_id, w.sub";
     ret =
 	sqlite3_prepare_v2 (params->db_handle, sql, strlen (sql),
-			    &query_rel_way_nodes_stmt, NULL);
+			    &query_rel_way_refs_stmt, NULL);
     if (ret != SQLITE_OK)
       {
 	  fprintf (stderr, "SQL error: %s\n",
@@ -3346,227 +3914,154 @@ populate_map_layers (struct aux_params *params, int *points, int *linestrings,
 	  goto error;
       }
 
-    while (1)
+    while (node_tags_scan.valid)
       {
-	  /* scrolling the Nodes result set */
-	  ret = sqlite3_step (query_nodes_stmt);
-	  if (ret == SQLITE_DONE)
-	    {
-		/* there are no more rows to fetch - we can stop looping */
-		break;
-	    }
-	  if (ret == SQLITE_ROW)
-	    {
-		/* ok, we've just fetched a valid row */
-		const char *layer = NULL;
-		const char *type = NULL;
-		const char *name = NULL;
-		const unsigned char *blob = NULL;
-		int blob_size;
-		sqlite3_int64 id = sqlite3_column_int64 (query_nodes_stmt, 0);
-		if (sqlite3_column_type (query_nodes_stmt, 1) != SQLITE_NULL)
-		    layer =
-			(const char *) sqlite3_column_text (query_nodes_stmt,
-							    1);
-		if (sqlite3_column_type (query_nodes_stmt, 2) != SQLITE_NULL)
-		    type =
-			(const char *) sqlite3_column_text (query_nodes_stmt,
-							    2);
-		if (sqlite3_column_type (query_nodes_stmt, 3) != SQLITE_NULL)
-		    name =
-			(const char *) sqlite3_column_text (query_nodes_stmt,
-							    3);
-		if (sqlite3_column_type (query_nodes_stmt, 4) == SQLITE_BLOB)
-		  {
-		      blob =
-			  (const unsigned char *)
-			  sqlite3_column_blob (query_nodes_stmt, 4);
-		      blob_size = sqlite3_column_bytes (query_nodes_stmt, 4);
-		  }
-		if (do_insert_point
-		    (params, id, layer, type, name, blob, blob_size))
-		    *points += 1;
-	    }
-	  else
+	  /* looping on Nodes */
+	  const char *name;
+	  unsigned char *blob = NULL;
+	  int blob_size;
+	  int idx;
+	  if (!scan_tags (params->db_handle, &node_tags_scan, &pivot))
+	      goto rollback;
+	  name = pivot_value (&pivot, "name");
+	  idx = -2;
+	  for (i = 0; i < pivot.count; i++)
 	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (params->db_handle));
-		/* ROLLBACK */
-		ret =
-		    sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL,
-				  &sql_err);
-		if (ret != SQLITE_OK)
+		/* one Point for each well known layer */
+		if (!is_map_layer (pivot.keys[i]))
+		    continue;
+		if (idx == -2)
 		  {
-		      fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n",
-			       sql_err);
-		      sqlite3_free (sql_err);
-		      goto error;
+		      idx = find_node_coords (nodes, pivot.id);
+		      if (idx >= 0)
+			  build_point_blob (nodes, idx, &blob, &blob_size);
 		  }
-		goto error;
+		if (idx < 0)
+		    break;
+		if (do_insert_point
+		    (params, pivot.id, pivot.keys[i], pivot.values[i], name,
+		     blob, blob_size))
+		    *points += 1;
 	    }
-      }
-
-    while (1)
-      {
-	  /* scrolling the Ways result set */
-	  ret = sqlite3_step (query_ways_stmt);
-	  if (ret == SQLITE_DONE)
+	  if (blob != NULL)
+	      free (blob);
+      }
+
+    while (way_tags_scan.valid)
+      {
+	  /* looping on Ways */
+	  const char *name;
+	  const char *area;
+	  int polygon = 0;
+	  int refs_ok = 0;
+	  if (!scan_tags (params->db_handle, &way_tags_scan, &pivot))
+	      goto rollback;
+	  name = pivot_value (&pivot, "name");
+	  area = pivot_value (&pivot, "area");
+	  if (area != NULL)
 	    {
-		/* there are no more rows to fetch - we can stop looping */
-		break;
+		if (strcmp (area, "yes") == 0)
+		    polygon = 1;
 	    }
-	  if (ret == SQLITE_ROW)
+	  for (i = 0; i < pivot.count; i++)
 	    {
-		/* ok, we've just fetched a valid row */
-		const char *layer = NULL;
-		const char *type = NULL;
-		const char *name = NULL;
-		int polygon = 0;
+		/* one Feature for each well known layer */
 		gaiaGeomCollPtr geom = NULL;
-		sqlite3_int64 id = sqlite3_column_int64 (query_ways_stmt, 0);
-		if (sqlite3_column_type (query_ways_stmt, 1) != SQLITE_NULL)
-		    layer =
-			(const char *) sqlite3_column_text (query_ways_stmt, 1);
-		if (sqlite3_column_type (query_ways_stmt, 2) != SQLITE_NULL)
-		    type =
-			(const char *) sqlite3_column_text (query_ways_stmt, 2);
-		if (sqlite3_column_type (query_ways_stmt, 3) != SQLITE_NULL)
-		    name =
-			(const char *) sqlite3_column_text (query_ways_stmt, 3);
-		if (sqlite3_column_type (query_ways_stmt, 4) != SQLITE_NULL)
+		const char *layer = pivot.keys[i];
+		if (!is_map_layer (layer))
+		    continue;
+		if (!refs_ok)
 		  {
-		      if (strcmp
-			  ((const char *)
-			   sqlite3_column_text (query_ways_stmt, 4),
-			   "yes") == 0)
-			  polygon = 1;
+		      if (!scan_refs
+			  (params->db_handle, &refs_scan, pivot.id, &refs))
+			  goto rollback;
+		      refs_ok = 1;
 		  }
-		if (!build_way_geom
-		    (params->db_handle, query_way_nodes_stmt, id, layer,
-		     polygon, &geom))
+		if (!build_way_geom (nodes, &refs, layer, polygon, &geom))
 		  {
 #if defined(_WIN32) || defined(__MINGW32__)
 		      /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
 		      fprintf (stderr,
-			       "ERROR: unable to resolve WAY id=%I64d\n", id);
+			       "ERROR: unable to resolve WAY id=%I64d\n",
+			       pivot.id);
 #else
 		      fprintf (stderr,
-			       "ERROR: unable to resolve WAY id=%lld\n", id);
+			       "ERROR: unable to resolve WAY id=%lld\n",
+			       pivot.id);
 #endif
-		      goto error;
+		      goto rollback;
 		  }
+		if (geom == NULL)
+		    break;
 		if (geom->DeclaredType == GAIA_LINESTRING)
 		  {
 		      if (do_insert_linestring
-			  (params, id, layer, type, name, geom))
+			  (params, pivot.id, layer, pivot.values[i], name, geom))
 			  *linestrings += 1;
 		  }
 		else
 		  {
 		      if (do_insert_polygon
-			  (params, id, layer, type, name, geom))
+			  (params, pivot.id, layer, pivot.values[i], name, geom))
 			  *polygons += 1;
 		  }
 		gaiaFreeGeomColl (geom);
 	    }
-	  else
-	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (params->db_handle));
-		/* ROLLBACK */
-		ret =
-		    sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL,
-				  &sql_err);
-		if (ret != SQLITE_OK)
-		  {
-		      fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n",
-			       sql_err);
-		      sqlite3_free (sql_err);
-		      goto error;
-		  }
-		goto error;
-	    }
       }
-    while (1)
+
+    while (rel_tags_scan.valid)
       {
-	  /* scrolling the Relations-Ways result set */
-	  ret = sqlite3_step (query_rel_ways_stmt);
-	  if (ret == SQLITE_DONE)
+	  /* looping on Relations */
+	  const char *layer = NULL;
+	  const char *type = NULL;
+	  gaiaGeomCollPtr geom = NULL;
+	  if (!scan_tags (params->db_handle, &rel_tags_scan, &pivot))
+	      goto rollback;
+	  for (i = 0; i < pivot.count; i++)
 	    {
-		/* there are no more rows to fetch - we can stop looping */
-		break;
+		/* a single Feature for the first well known layer */
+		if (is_map_layer (pivot.keys[i]))
+		  {
+		      layer = pivot.keys[i];
+		      type = pivot.values[i];
+		      break;
+		  }
 	    }
-	  if (ret == SQLITE_ROW)
+	  if (layer == NULL)
+	      continue;
+	  if (!build_rel_way_geom
+	      (params->cache, params->db_handle, query_rel_way_refs_stmt,
+	       nodes, pivot.id, &geom))
 	    {
-		/* ok, we've just fetched a valid row */
-		const char *layer = NULL;
-		const char *type = NULL;
-		const char *name = NULL;
-		gaiaGeomCollPtr geom = NULL;
-		sqlite3_int64 id =
-		    sqlite3_column_int64 (query_rel_ways_stmt, 0);
-		if (sqlite3_column_type (query_rel_ways_stmt, 1) != SQLITE_NULL)
-		    layer =
-			(const char *) sqlite3_column_text (query_rel_ways_stmt,
-							    1);
-		if (sqlite3_column_type (query_rel_ways_stmt, 2) != SQLITE_NULL)
-		    type =
-			(const char *) sqlite3_column_text (query_rel_ways_stmt,
-							    2);
-		if (sqlite3_column_type (query_rel_ways_stmt, 3) != SQLITE_NULL)
-		    name =
-			(const char *) sqlite3_column_text (query_rel_ways_stmt,
-							    3);
-		if (!build_rel_way_geom
-		    (params->cache, params->db_handle, query_rel_way_nodes_stmt,
-		     id, &geom))
-		  {
 #if defined(_WIN32) || defined(__MINGW32__)
-		      /* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
-		      fprintf (stderr,
-			       "ERROR: unable to resolve RELATION-WAY id=%I64d\n",
-			       id);
+		/* CAVEAT - M$ runtime doesn't supports %lld for 64 bits */
+		fprintf (stderr,
+			 "ERROR: unable to resolve RELATION-WAY id=%I64d\n",
+			 pivot.id);
 #else
-		      fprintf (stderr,
-			       "ERROR: unable to resolve RELATION-WAY id=%lld\n",
-			       id);
+		fprintf (stderr,
+			 "ERROR: unable to resolve RELATION-WAY id=%lld\n",
+			 pivot.id);
 #endif
-		      goto error;
-		  }
-		if (geom->DeclaredType == GAIA_MULTILINESTRING)
-		  {
-		      if (do_insert_multi_linestring
-			  (params, id, layer, type, name, geom))
-			  *multi_linestrings += 1;
-		  }
-		else
-		  {
-		      if (do_insert_multi_polygon
-			  (params, id, layer, type, name, geom))
-			  *multi_polygons += 1;
-		  }
-		gaiaFreeGeomColl (geom);
+		goto rollback;
+	    }
+	  if (geom == NULL)
+	      continue;
+	  if (geom->DeclaredType == GAIA_MULTILINESTRING)
+	    {
+		if (do_insert_multi_linestring
+		    (params, pivot.id, layer, type, pivot_value (&pivot, "name"),
+		     geom))
+		    *multi_linestrings += 1;
 	    }
 	  else
 	    {
-		/* some unexpected error occurred */
-		fprintf (stderr, "sqlite3_step() error: %s\n",
-			 sqlite3_errmsg (params->db_handle));
-		/* ROLLBACK */
-		ret =
-		    sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL,
-				  &sql_err);
-		if (ret != SQLITE_OK)
-		  {
-		      fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n",
-			       sql_err);
-		      sqlite3_free (sql_err);
-		      goto error;
-		  }
-		goto error;
+		if (do_insert_multi_polygon
+		    (params, pivot.id, layer, type, pivot_value (&pivot, "name"),
+		     geom))
+		    *multi_polygons += 1;
 	    }
+	  gaiaFreeGeomColl (geom);
       }
 
 /* committing the still pending SQL Transaction */
@@ -3578,22 +4073,38 @@ populate_map_layers (struct aux_params *params, int *points, int *linestrings,
 	  goto error;
       }
 
-    sqlite3_finalize (query_nodes_stmt);
-    sqlite3_finalize (query_ways_stmt);
-    sqlite3_finalize (query_way_nodes_stmt);
-    sqlite3_finalize (query_rel_way_nodes_stmt);
-
+    sqlite3_finalize (node_tags_scan.stmt);
+    sqlite3_finalize (way_tags_scan.stmt);
+    sqlite3_finalize (rel_tags_scan.stmt);
+    sqlite3_finalize (refs_scan.stmt);
+    sqlite3_finalize (query_rel_way_refs_stmt);
+    free_tag_pivot (&pivot);
+    if (refs.ids != NULL)
+	free (refs.ids);
     return 1;
 
+  rollback:
+    ret = sqlite3_exec (params->db_handle, "ROLLBACK", NULL, NULL, &sql_err);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "ROLLBACK TRANSACTION error: %s\n", sql_err);
+	  sqlite3_free (sql_err);
+      }
+
   error:
-    if (query_nodes_stmt != NULL)
-	sqlite3_finalize (query_nodes_stmt);
-    if (query_ways_stmt != NULL)
-	sqlite3_finalize (query_ways_stmt);
-    if (query_way_nodes_stmt != NULL)
-	sqlite3_finalize (query_way_nodes_stmt);
-    if (query_rel_way_nodes_stmt != NULL)
-	sqlite3_finalize (query_rel_way_nodes_stmt);
+    if (node_tags_scan.stmt != NULL)
+	sqlite3_finalize (node_tags_scan.stmt);
+    if (way_tags_scan.stmt != NULL)
+	sqlite3_finalize (way_tags_scan.stmt);
+    if (rel_tags_scan.stmt != NULL)
+	sqlite3_finalize (rel_tags_scan.stmt);
+    if (refs_scan.stmt != NULL)
+	sqlite3_finalize (refs_scan.stmt);
+    if (query_rel_way_refs_stmt != NULL)
+	sqlite3_finalize (query_rel_way_refs_stmt);
+    free_tag_pivot (&pivot);
+    if (refs.ids != NULL)
+	free (refs.ids);
     return 0;
 }
 
@@ -3603,7 +4114,6 @@ do_clean_roads (struct aux_params *params)
 /* ROAD post-processing: DB cleanup */
     sqlite3 *db_handle = params->db_handle;
     printf ("\nFinal DBMS cleanup\n");
-    sqlite3_exec (db_handle, "DROP TABLE osm_helper_nodes", NULL, NULL, NULL);
     sqlite3_exec (db_handle, "DROP TABLE osm_relation_refs", NULL, NULL, NULL);
     sqlite3_exec (db_handle, "DROP TABLE osm_relation_tags", NULL, NULL, NULL);
     sqlite3_exec (db_handle, "DROP TABLE osm_relations", NULL, NULL, NULL);
@@ -3625,7 +4135,6 @@ do_clean_rails (struct aux_params *params)
 /* ROAD post-processing: DB cleanup */
     sqlite3 *db_handle = params->db_handle;
     printf ("\nFinal DBMS cleanup\n");
-    sqlite3_exec (db_handle, "DROP TABLE osm_helper_nodes", NULL, NULL, NULL);
     sqlite3_exec (db_handle, "DROP TABLE osm_relation_refs", NULL, NULL, NULL);
     sqlite3_exec (db_handle, "DROP TABLE osm_relation_tags", NULL, NULL, NULL);
     sqlite3_exec (db_handle, "DROP TABLE osm_relations", NULL, NULL, NULL);
@@ -3829,6 +4338,219 @@ create_osm_raw_tables (struct aux_params *params)
     return 1;
 }
 
+static char *
+download_signature (int mode, double minx, double miny, double maxx,
+		    double maxy)
+{
+/* identifying a run: the same BBOX and mode always request the same tiles */
+    return sqlite3_mprintf ("mode=%d bbox=%1.7f %1.7f %1.7f %1.7f", mode,
+			    minx, miny, maxx, maxy);
+}
+
+static int
+create_download_table (struct aux_params *params, const char *signature)
+{
+/* creating the tables tracking the completed Overpass requests */
+    int ret;
+    char sql[1024];
+    char *sql2;
+    char *err_msg = NULL;
+
+    strcpy (sql, "CREATE TABLE osm_download_tiles (\n");
+    strcat (sql, "url TEXT NOT NULL PRIMARY KEY,\n");
+    strcat (sql, "tile_no INTEGER NOT NULL)\n");
+    ret = sqlite3_exec (params->db_handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "CREATE TABLE 'osm_download_tiles' error: %s\n",
+		   err_msg);
+	  sqlite3_free (err_msg);
+	  return 0;
+      }
+    strcpy (sql, "CREATE TABLE osm_download_run (\n");
+    strcat (sql, "signature TEXT NOT NULL,\n");
+    strcat (sql, "completed INTEGER NOT NULL)\n");
+    ret = sqlite3_exec (params->db_handle, sql, NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "CREATE TABLE 'osm_download_run' error: %s\n",
+		   err_msg);
+	  sqlite3_free (err_msg);
+	  return 0;
+      }
+    sql2 =
+	sqlite3_mprintf
+	("INSERT INTO osm_download_run (signature, completed) VALUES (%Q, 0)",
+	 signature);
+    ret = sqlite3_exec (params->db_handle, sql2, NULL, NULL, &err_msg);
+    sqlite3_free (sql2);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "INSERT INTO 'osm_download_run' error: %s\n",
+		   err_msg);
+	  sqlite3_free (err_msg);
+	  return 0;
+      }
+    return 1;
+}
+
+static int
+check_resume (sqlite3 * db_handle, const char *signature)
+{
+/*
+/ checking if this DB contains some interrupted download
+/
+/ returns 1 when the same run (BBOX and mode) can be resumed,
+/ 0 when there is nothing to resume and -1 when the tracking
+/ tables belong to some other run
+*/
+    int ret;
+    int i;
+    char **results;
+    int rows;
+    int columns;
+    int tiles = 0;
+    int run = 0;
+    int completed = 0;
+    char *run_signature = NULL;
+    const char *sql =
+	"SELECT name FROM sqlite_master WHERE type = 'table' "
+	"AND name IN ('osm_download_tiles', 'osm_download_run')";
+    ret = sqlite3_get_table (db_handle, sql, &results, &rows, &columns, NULL);
+    if (ret != SQLITE_OK)
+	return 0;
+    for (i = 1; i <= rows; i++)
+      {
+	  if (strcmp (results[(i * columns) + 0], "osm_download_tiles") == 0)
+	      tiles = 1;
+	  else
+	      run = 1;
+      }
+    sqlite3_free_table (results);
+    if (!tiles && !run)
+	return 0;
+    if (run)
+      {
+	  sql = "SELECT signature, completed FROM osm_download_run";
+	  ret =
+	      sqlite3_get_table (db_handle, sql, &results, &rows, &columns,
+				 NULL);
+	  if (ret != SQLITE_OK)
+	      return -1;
+	  for (i = 1; i <= rows; i++)
+	    {
+		if (results[(i * columns) + 0] != NULL)
+		  {
+		      if (run_signature != NULL)
+			  sqlite3_free (run_signature);
+		      run_signature =
+			  sqlite3_mprintf ("%s", results[(i * columns) + 0]);
+		  }
+		if (results[(i * columns) + 1] != NULL)
+		    completed = atoi (results[(i * columns) + 1]);
+	    }
+	  sqlite3_free_table (results);
+      }
+    if (!tiles || run_signature == NULL)
+      {
+	  fprintf (stderr,
+		   "ERROR: this DB contains an unknown download state\n");
+	  ret = -1;
+      }
+    else if (strcmp (run_signature, signature) != 0)
+      {
+	  fprintf (stderr,
+		   "ERROR: this DB contains an interrupted download of some other run\n"
+		   "\t[%s] instead of [%s]\n", run_signature, signature);
+	  ret = -1;
+      }
+    else if (completed)
+      {
+	  fprintf (stderr,
+		   "ERROR: this DB contains a completed download whose final processing was interrupted\n");
+	  ret = -1;
+      }
+    else
+	ret = 1;
+    if (ret < 0)
+	fprintf (stderr, "please use a new DB\n");
+    if (run_signature != NULL)
+	sqlite3_free (run_signature);
+    return ret;
+}
+
+static int
+set_download_completed (struct aux_params *params)
+{
+/* flagging the download as completed: nothing is left to be resumed */
+    int ret;
+    char *sql_err = NULL;
+    ret =
+	sqlite3_exec (params->db_handle,
+		      "UPDATE osm_download_run SET completed = 1", NULL, NULL,
+		      &sql_err);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "UPDATE 'osm_download_run' error: %s\n", sql_err);
+	  sqlite3_free (sql_err);
+	  return 0;
+      }
+    return 1;
+}
+
+static void
+drop_download_tables (struct aux_params *params)
+{
+/* the run succeeded: the tracking tables are no longer needed */
+    sqlite3_exec (params->db_handle, "DROP TABLE osm_download_tiles", NULL,
+		  NULL, NULL);
+    sqlite3_exec (params->db_handle, "DROP TABLE osm_download_run", NULL,
+		  NULL, NULL);
+}
+
+static int
+mark_download_completed (struct aux_params *params, struct download_job *job)
+{
+/*
+/ recording a completed request
+/
+/ the pending Transaction is committed at the same time, so that
+/ the downloaded data and the completion mark are never out of sync
+*/
+    int ret;
+    char *sql;
+    char *sql_err = NULL;
+
+    sql =
+	sqlite3_mprintf
+	("INSERT INTO osm_download_tiles (url, tile_no) VALUES (%Q, %d)",
+	 job->url, job->tile->tile_no);
+    ret = sqlite3_exec (params->db_handle, sql, NULL, NULL, &sql_err);
+    sqlite3_free (sql);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "INSERT INTO 'osm_download_tiles' error: %s\n",
+		   sql_err);
+	  sqlite3_free (sql_err);
+	  return 0;
+      }
+    ret = sqlite3_exec (params->db_handle, "COMMIT", NULL, NULL, &sql_err);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "COMMIT TRANSACTION error: %s\n", sql_err);
+	  sqlite3_free (sql_err);
+	  return 0;
+      }
+    ret = sqlite3_exec (params->db_handle, "BEGIN", NULL, NULL, &sql_err);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "BEGIN TRANSACTION error: %s\n", sql_err);
+	  sqlite3_free (sql_err);
+	  return 0;
+      }
+    return 1;
+}
+
 static void
 open_db (const char *path, sqlite3 ** handle, int cache_size, void *cache)
 {
@@ -4051,6 +4773,12 @@ do_help ()
 	     "                                http://api.openstreetmap.fr/oapi\n");
     fprintf (stderr,
 	     "-mode or --mode       mode      one of: RAW / MAP (default) / ROAD / RAIL\n");
+    fprintf (stderr,
+	     "-threads or --threads num       concurrent downloads (default 2)\n");
+    fprintf (stderr,
+	     "-cache or --cache-dir path      local cache of Overpass responses\n");
+    fprintf (stderr,
+	     "-gz or --cache-gzip             gzip compressing the cached responses\n");
     fprintf (stderr,
 	     "-cs or --cache-size   num       DB cache size (how many pages)\n");
     fprintf (stderr,
@@ -4058,7 +4786,13 @@ do_help ()
     fprintf (stderr,
 	     "-jo or --journal-off            unsafe [but faster] mode\n");
     fprintf (stderr,
-	     "-p or --preserve                skipping final cleanup (preserving OSM tables)\n");
+	     "-p or --preserve                skipping final cleanup (preserving OSM tables)\n\n");
+    fprintf (stderr,
+	     "an interrupted download is resumed when the same DB is used again\n");
+    fprintf (stderr,
+	     "with the same BBOX and mode, skipping all tiles already completed\n");
+    fprintf (stderr,
+	     "(--in-memory saves nothing before the end: it can't be resumed)\n");
 }
 
 #endif /* end LIBXML2 conditional */
@@ -4097,7 +4831,12 @@ main (int argc, char *argv[])
     int preserve_osm_tables = 0;
     struct aux_params params;
     struct tiled_download downloader;
-    struct download_tile *tile;
+    struct download_pool pool;
+    int threads = 2;
+    const char *cache_dir = NULL;
+    int cache_gzip = 0;
+    int resume;
+    char *signature;
     double extent_h;
     double extent_v;
     double step_v;
@@ -4132,6 +4871,7 @@ main (int argc, char *argv[])
     params.wr_rel_tags = 0;
     params.wr_rel_refs = 0;
     params.osm_url = NULL;
+    init_node_coords (&(params.nodes));
 
     for (i = 1; i < argc; i++)
       {
@@ -4149,6 +4889,12 @@ main (int argc, char *argv[])
 		  case ARG_CACHE_SIZE:
 		      cache_size = atoi (argv[i]);
 		      break;
+		  case ARG_THREADS:
+		      threads = atoi (argv[i]);
+		      break;
+		  case ARG_CACHE_DIR:
+		      cache_dir = argv[i];
+		      break;
 		  case ARG_MINX:
 		      minx = atof (argv[i]);
 		      ok_minx = 1;
@@ -4249,6 +4995,24 @@ main (int argc, char *argv[])
 		next_arg = ARG_CACHE_SIZE;
 		continue;
 	    }
+	  if (strcasecmp (argv[i], "--threads") == 0
+	      || strcmp (argv[i], "-threads") == 0)
+	    {
+		next_arg = ARG_THREADS;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--cache-dir") == 0
+	      || strcmp (argv[i], "-cache") == 0)
+	    {
+		next_arg = ARG_CACHE_DIR;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--cache-gzip") == 0
+	      || strcmp (argv[i], "-gz") == 0)
+	    {
+		cache_gzip = 1;
+		continue;
+	    }
 	  if (strcasecmp (argv[i], "-m") == 0)
 	    {
 		in_memory = 1;
@@ -4316,6 +5080,12 @@ main (int argc, char *argv[])
 	  error = 1;
 	  bbox = 0;
       }
+    if (threads < 1 || threads > 16)
+      {
+	  fprintf (stderr,
+		   "invalid number of download threads (expected 1 to 16)\n");
+	  error = 1;
+      }
     if (bbox)
       {
 	  if (!check_bbox (&minx, &miny, &maxx, &maxy))
@@ -4420,74 +5190,111 @@ main (int argc, char *argv[])
     params.osm_url = osm_url;
     params.mode = mode;
 
-/* creating the OSM raw tables */
-    if (!create_osm_raw_tables (&params))
+    signature = download_signature (mode, minx, miny, maxx, maxy);
+    resume = check_resume (handle, signature);
+    if (resume < 0)
       {
+	  sqlite3_free (signature);
 	  sqlite3_close (handle);
 	  return -1;
       }
+    if (in_memory)
+	fprintf (stderr,
+		 "WARNING: --in-memory saves nothing before the end: an interrupted run can't be resumed\n");
+    if (resume)
+      {
+	  printf ("resuming an interrupted download\n");
+	  /* reloading the in-memory Node table */
+	  if (mode != MODE_RAW && !load_node_coords (&params))
+	    {
+		sqlite3_close (handle);
+		return -1;
+	    }
+      }
+    else
+      {
+	  /* creating the OSM raw tables */
+	  if (!create_osm_raw_tables (&params))
+	    {
+		sqlite3_close (handle);
+		return -1;
+	    }
+	  if (!create_download_table (&params, signature))
+	    {
+		sqlite3_free (signature);
+		sqlite3_close (handle);
+		return -1;
+	    }
+      }
+    sqlite3_free (signature);
 /* creating the  SQL prepared statements */
     create_sql_stmts (&params, journal_off);
 
-    tile = downloader.first;
-    while (tile != NULL)
+/* downloading and parsing all tiles: any fetcher thread downloads
+   its own requests, while the main thread acts as the single writer
+   parsing the responses strictly in request order */
+    if (!prepare_download_pool
+	(&pool, &params, &downloader, cache_dir, cache_gzip, resume))
       {
-	  /* downloading and parsing an input OSM dataset (tiled) */
-	  if (mode == MODE_ROAD || mode == MODE_RAIL)
-	    {
-		printf ("Downloading and parsing OSM tile %d of %d\r",
-			tile->tile_no, downloader.count);
-		if (!osm_parse (&params, tile, 0))
-		  {
-		      fprintf (stderr,
-			       "\noperation aborted due to unrecoverable errors\n\n");
-		      finalize_sql_stmts (&params);
-		      sqlite3_close (handle);
-		      return -1;
-		  }
-	    }
+	  finalize_sql_stmts (&params);
+	  sqlite3_close (handle);
+	  return -1;
+      }
+    if (pool.skipped > 0)
+	printf ("skipping %d already completed requests\n", pool.skipped);
+    xmlInitParser ();
+    xmlNanoHTTPInit ();
+    if (!start_download_pool (&pool, threads))
+      {
+	  stop_download_pool (&pool);
+	  finalize_sql_stmts (&params);
+	  sqlite3_close (handle);
+	  return -1;
+      }
+    for (i = 0; i < pool.count; i++)
+      {
+	  struct download_job *job = pool.jobs + i;
+	  if (job->object == OBJ_NODES)
+	      printf
+		  ("Downloading and parsing OSM tile %d of %d - Nodes        \r",
+		   job->tile->tile_no, downloader.count);
+	  else if (job->object == OBJ_WAYS)
+	      printf
+		  ("Downloading and parsing OSM tile %d of %d - Ways          \r",
+		   job->tile->tile_no, downloader.count);
+	  else if (job->object == OBJ_RELATIONS)
+	      printf
+		  ("Downloading and parsing OSM tile %d of %d - Relations     \r",
+		   job->tile->tile_no, downloader.count);
 	  else
+	      printf ("Downloading and parsing OSM tile %d of %d\r",
+		      job->tile->tile_no, downloader.count);
+	  fflush (stdout);
+	  job = wait_download_job (&pool, i);
+	  if (job == NULL)
+	      fprintf (stderr, "ERROR: unable to download the OSM dataset\n");
+	  if (job == NULL || !osm_parse (&params, job)
+	      || !mark_download_completed (&params, job))
 	    {
-		printf
-		    ("Downloading and parsing OSM tile %d of %d - Nodes        \r",
-		     tile->tile_no, downloader.count);
-		if (!osm_parse (&params, tile, OBJ_NODES))
-		  {
-		      fprintf (stderr,
-			       "\noperation aborted due to unrecoverable errors\n\n");
-		      finalize_sql_stmts (&params);
-		      sqlite3_close (handle);
-		      return -1;
-		  }
-		printf
-		    ("Downloading and parsing OSM tile %d of %d - Ways          \r",
-		     tile->tile_no, downloader.count);
-		if (!osm_parse (&params, tile, OBJ_WAYS))
-		  {
-		      fprintf (stderr,
-			       "\noperation aborted due to unrecoverable errors\n\n");
-		      finalize_sql_stmts (&params);
-		      sqlite3_close (handle);
-		      return -1;
-		  }
-		printf
-		    ("Downloading and parsing OSM tile %d of %d - Relations     \r",
-		     tile->tile_no, downloader.count);
-		if (!osm_parse (&params, tile, OBJ_RELATIONS))
-		  {
-		      fprintf (stderr,
-			       "\noperation aborted due to unrecoverable errors\n\n");
-		      finalize_sql_stmts (&params);
-		      sqlite3_close (handle);
-		      return -1;
-		  }
+		fprintf (stderr,
+			 "\noperation aborted due to unrecoverable errors\n\n");
+		stop_download_pool (&pool);
+		finalize_sql_stmts (&params);
+		sqlite3_close (handle);
+		return -1;
 	    }
-	  tile = tile->next;
+	  consume_download_job (&pool, job);
       }
+    stop_download_pool (&pool);
     printf ("Download completed                                        \n");
 
 /* finalizing SQL prepared statements */
     finalize_sql_stmts (&params);
+    if (!set_download_completed (&params))
+      {
+	  sqlite3_close (handle);
+	  return -1;
+      }
 
 /* printing out statistics */
     printf ("inserted %d nodes\n", params.wr_nodes);
@@ -4521,6 +5328,7 @@ main (int argc, char *argv[])
 	    }
 	  printf ("inserted %d ROAD nodes\n", cnt_nodes);
 	  printf ("inserted %d ROAD arcs\n", cnt_arcs);
+	  drop_download_tables (&params);
 	  if (!preserve_osm_tables)
 	      do_clean_roads (&params);
       }
@@ -4549,6 +5357,7 @@ main (int argc, char *argv[])
 	  printf ("inserted %d RAIL nodes\n", cnt_nodes);
 	  printf ("inserted %d RAIL arcs\n", cnt_arcs);
 	  printf ("inserted %d RAIL stations\n", cnt_stations);
+	  drop_download_tables (&params);
 	  if (!preserve_osm_tables)
 	      do_clean_rails (&params);
       }
@@ -4560,11 +5369,6 @@ main (int argc, char *argv[])
 	  int polygons = 0;
 	  int multi_linestrings = 0;
 	  int multi_polygons = 0;
-	  if (!create_map_indices (&params))
-	    {
-		sqlite3_close (handle);
-		return -1;
-	    }
 	  if (!populate_map_layers
 	      (&params, &points, &linestrings, &polygons, &multi_linestrings,
 	       &multi_polygons))
@@ -4578,9 +5382,13 @@ main (int argc, char *argv[])
 	  printf ("inserted %d Polygon Features\n", polygons);
 	  printf ("inserted %d MultiLinestring Features\n", multi_linestrings);
 	  printf ("inserted %d MultiPolygon Features\n", multi_polygons);
+	  drop_download_tables (&params);
 	  if (!preserve_osm_tables)
 	      do_clean_map (&params);
       }
+    else
+	drop_download_tables (&params);
+    free_node_coords (&(params.nodes));
 
     if (in_memory)
       {
@@ -33,6 +33,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#if defined(_WIN32)
+#include <sys/timeb.h>
+#else
+#include <sys/time.h>
+#include <pthread.h>
+#include <iconv.h>
+#endif
 
 #if defined(_WIN32) && !defined(__MINGW32__)
 #include "config-msvc.h"
@@ -65,6 +73,8 @@
 #define ARG_CS			8
 #define ARG_SRID		9
 #define ARG_TYPE		10
+#define ARG_BATCH		11
+#define ARG_THREADS		12
 
 static void
 spatialite_autocreate (sqlite3 * db)
@@ -147,9 +157,438 @@ do_import_dbf (char *db_path, char *dbf_path, char *table, char *charset)
     spatialite_cleanup_ex (cache);
 }
 
+static double
+import_time (void)
+{
+/* wall-clock time in seconds [import throughput] */
+#if defined(_WIN32)
+    struct _timeb tb;
+    _ftime (&tb);
+    return (double) tb.time + ((double) tb.millitm / 1000.0);
+#else
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (double) tv.tv_sec + ((double) tv.tv_usec / 1000000.0);
+#endif
+}
+
+static const char *
+import_geometry_type (int type)
+{
+/* the geometry class of the target column */
+    switch (type)
+      {
+      case GAIA_POINT:
+	  return "POINT";
+      case GAIA_MULTIPOINT:
+	  return "MULTIPOINT";
+      case GAIA_LINESTRING:
+	  return "LINESTRING";
+      case GAIA_POLYGON:
+	  return "POLYGON";
+      case GAIA_MULTILINESTRING:
+	  return "MULTILINESTRING";
+      case GAIA_MULTIPOLYGON:
+	  return "MULTIPOLYGON";
+      };
+    return NULL;
+}
+
+static const char *
+import_dims (int dims)
+{
+/* the dimension model of the target column */
+    switch (dims)
+      {
+      case GAIA_XY_Z:
+	  return "XYZ";
+      case GAIA_XY_M:
+	  return "XYM";
+      case GAIA_XY_Z_M:
+	  return "XYZM";
+      };
+    return "XY";
+}
+
+static int
+create_import_table (sqlite3 * handle, gaiaShapefilePtr shp, char *table,
+		     char *column, int srid, int dims, char ***col_names,
+		     int *n_cols)
+{
+/*
+ * creating the target table and its Geometry column
+ *
+ * DBF field names colliding with PK_UID, the Geometry column or some
+ * other field are renamed as COL_<n>
+*/
+    gaiaDbfFieldPtr fld;
+    char **names;
+    char *sql;
+    char *prev;
+    char *xname;
+    const char *type;
+    char *err_msg = NULL;
+    int count = 0;
+    int i;
+    int ret;
+
+    fld = shp->Dbf->First;
+    while (fld)
+      {
+	  count++;
+	  fld = fld->Next;
+      }
+    names = malloc (sizeof (char *) * (count + 1));
+    *col_names = names;
+    *n_cols = count;
+
+    xname = gaiaDoubleQuotedSql (table);
+    sql =
+	sqlite3_mprintf
+	("CREATE TABLE \"%s\" (\nPK_UID INTEGER PRIMARY KEY AUTOINCREMENT",
+	 xname);
+    free (xname);
+    count = 0;
+    fld = shp->Dbf->First;
+    while (fld)
+      {
+	  names[count] = sqlite3_mprintf ("%s", fld->Name);
+	  if (strcasecmp (names[count], "PK_UID") == 0
+	      || strcasecmp (names[count], column) == 0)
+	    {
+		sqlite3_free (names[count]);
+		names[count] = sqlite3_mprintf ("COL_%d", count + 1);
+	    }
+	  for (i = 0; i < count; i++)
+	    {
+		if (strcasecmp (names[i], names[count]) == 0)
+		  {
+		      sqlite3_free (names[count]);
+		      names[count] = sqlite3_mprintf ("COL_%d", count + 1);
+		      break;
+		  }
+	    }
+	  switch (fld->Type)
+	    {
+	    case 'N':
+		if (fld->Decimals > 0 || fld->Length > 18)
+		    type = "DOUBLE";
+		else
+		    type = "INTEGER";
+		break;
+	    case 'F':
+		type = "DOUBLE";
+		break;
+	    case 'L':
+		type = "INTEGER";
+		break;
+	    default:
+		type = "TEXT";
+		break;
+	    };
+	  xname = gaiaDoubleQuotedSql (names[count]);
+	  prev = sql;
+	  sql = sqlite3_mprintf ("%s,\n\"%s\" %s", prev, xname, type);
+	  sqlite3_free (prev);
+	  free (xname);
+	  count++;
+	  fld = fld->Next;
+      }
+    prev = sql;
+    sql = sqlite3_mprintf ("%s)", prev);
+    sqlite3_free (prev);
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    sqlite3_free (sql);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "CREATE TABLE error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  return 0;
+      }
+    sql =
+	sqlite3_mprintf ("SELECT AddGeometryColumn(%Q, %Q, %d, %Q, %Q)",
+			 table, column, srid,
+			 import_geometry_type (shp->EffectiveType),
+			 import_dims (dims));
+    ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+    sqlite3_free (sql);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "AddGeometryColumn() error: %s\n", err_msg);
+	  sqlite3_free (err_msg);
+	  return 0;
+      }
+    return 1;
+}
+
+static int
+load_shapefile_batched (sqlite3 * handle, char *shp_path, char *table,
+			char *charset, int srid, char *column, int coerce2d,
+			int compressed, int batch_size, int spatial_index,
+			int *rows)
+{
+/*
+ * streaming some SHP into the DB
+ *
+ * entities are read one at a time and committed every BATCH_SIZE
+ * rows; the Spatial Index [if required] is built in a single pass
+ * once all rows have been loaded, so that the R*Tree isn't updated
+ * row by row during the import
+*/
+    gaiaShapefilePtr shp;
+    gaiaDbfFieldPtr fld;
+    gaiaGeomCollPtr geom;
+    gaiaGeomCollPtr geom2d;
+    sqlite3_stmt *stmt = NULL;
+    char **col_names = NULL;
+    int n_cols = 0;
+    char *sql;
+    char *prev;
+    char *xname;
+    char *err_msg = NULL;
+    unsigned char *blob;
+    int blob_size;
+    int dims;
+    int current_row = 0;
+    int pending = 0;
+    int in_transaction = 0;
+    int cnt;
+    int ret;
+    int i;
+    double start;
+    double now;
+    double t_index;
+
+    *rows = 0;
+    if (column == NULL)
+	column = "Geometry";
+    shp = gaiaAllocShapefile ();
+    gaiaOpenShpRead (shp, shp_path, charset, "UTF-8");
+    if (!(shp->Valid))
+      {
+	  fprintf (stderr, "load shapefile error: <%s>\n",
+		   (shp->LastError) ? shp->LastError : "unknown");
+	  gaiaFreeShapefile (shp);
+	  return 0;
+      }
+/*
+ * just as load_shapefile() does, a first pass over the SHP checks
+ * whether all entities are single-part, so that the column will be
+ * declared as LINESTRING or POLYGON and not as MULTI<something>
+*/
+    gaiaShpAnalyze (shp);
+    if (import_geometry_type (shp->EffectiveType) == NULL)
+      {
+	  fprintf (stderr, "load shapefile error: unsupported shape-type %d\n",
+		   shp->Shape);
+	  gaiaFreeShapefile (shp);
+	  return 0;
+      }
+    dims = coerce2d ? GAIA_XY : shp->EffectiveDims;
+
+    start = import_time ();
+    ret = sqlite3_exec (handle, "BEGIN", NULL, NULL, &err_msg);
+    if (ret != SQLITE_OK)
+	goto sql_error;
+    in_transaction = 1;
+    if (!create_import_table
+	(handle, shp, table, column, srid, dims, &col_names, &n_cols))
+	goto error;
+
+/* preparing the INSERT statement */
+    xname = gaiaDoubleQuotedSql (table);
+    sql = sqlite3_mprintf ("INSERT INTO \"%s\" (PK_UID", xname);
+    free (xname);
+    for (i = 0; i < n_cols; i++)
+      {
+	  xname = gaiaDoubleQuotedSql (col_names[i]);
+	  prev = sql;
+	  sql = sqlite3_mprintf ("%s, \"%s\"", prev, xname);
+	  sqlite3_free (prev);
+	  free (xname);
+      }
+    xname = gaiaDoubleQuotedSql (column);
+    prev = sql;
+    sql = sqlite3_mprintf ("%s, \"%s\") VALUES (?", prev, xname);
+    sqlite3_free (prev);
+    free (xname);
+    for (i = 0; i <= n_cols; i++)
+      {
+	  prev = sql;
+	  sql = sqlite3_mprintf ("%s, ?", prev);
+	  sqlite3_free (prev);
+      }
+    prev = sql;
+    sql = sqlite3_mprintf ("%s)", prev);
+    sqlite3_free (prev);
+    ret = sqlite3_prepare_v2 (handle, sql, strlen (sql), &stmt, NULL);
+    sqlite3_free (sql);
+    if (ret != SQLITE_OK)
+      {
+	  fprintf (stderr, "load shapefile error: %s\n",
+		   sqlite3_errmsg (handle));
+	  goto error;
+      }
+
+    while (1)
+      {
+	  /* inserting rows from shapefile */
+	  ret = gaiaReadShpEntity_ex (shp, current_row, srid, 1);
+	  if (!ret)
+	    {
+		if (!(shp->LastError))	/* normal SHP EOF */
+		    break;
+		fprintf (stderr, "\n%s\n", shp->LastError);
+		goto error;
+	    }
+	  current_row++;
+	  if (ret < 0)
+	    {
+		/* found a DBF deleted record */
+		continue;
+	    }
+	  sqlite3_reset (stmt);
+	  sqlite3_clear_bindings (stmt);
+	  sqlite3_bind_int (stmt, 1, current_row);
+	  cnt = 0;
+	  fld = shp->Dbf->First;
+	  while (fld)
+	    {
+		/* binding field values */
+		if (!(fld->Value))
+		    sqlite3_bind_null (stmt, cnt + 2);
+		else
+		  {
+		      switch (fld->Value->Type)
+			{
+			case GAIA_INT_VALUE:
+			    sqlite3_bind_int64 (stmt, cnt + 2,
+						fld->Value->IntValue);
+			    break;
+			case GAIA_DOUBLE_VALUE:
+			    sqlite3_bind_double (stmt, cnt + 2,
+						 fld->Value->DblValue);
+			    break;
+			case GAIA_TEXT_VALUE:
+			    sqlite3_bind_text (stmt, cnt + 2,
+					       fld->Value->TxtValue,
+					       strlen (fld->Value->TxtValue),
+					       SQLITE_STATIC);
+			    break;
+			default:
+			    sqlite3_bind_null (stmt, cnt + 2);
+			    break;
+			}
+		  }
+		cnt++;
+		fld = fld->Next;
+	    }
+	  geom = shp->Dbf->Geometry;
+	  if (geom)
+	    {
+		/* binding the Geometry */
+		geom2d = NULL;
+		if (coerce2d && geom->DimensionModel != GAIA_XY)
+		  {
+		      geom2d = gaiaCastGeomCollToXY (geom);
+		      geom2d->Srid = geom->Srid;
+		      geom2d->DeclaredType = geom->DeclaredType;
+		      geom = geom2d;
+		  }
+		if (compressed)
+		    gaiaToCompressedBlobWkb (geom, &blob, &blob_size);
+		else
+		    gaiaToSpatiaLiteBlobWkb (geom, &blob, &blob_size);
+		sqlite3_bind_blob (stmt, cnt + 2, blob, blob_size, free);
+		if (geom2d)
+		    gaiaFreeGeomColl (geom2d);
+	    }
+	  else
+	      sqlite3_bind_null (stmt, cnt + 2);
+	  ret = sqlite3_step (stmt);
+	  if (ret != SQLITE_DONE && ret != SQLITE_ROW)
+	    {
+		fprintf (stderr, "\nload shapefile error: %s\n",
+			 sqlite3_errmsg (handle));
+		goto error;
+	    }
+	  *rows += 1;
+	  pending++;
+	  if (pending >= batch_size)
+	    {
+		/* committing the current batch */
+		ret = sqlite3_exec (handle, "COMMIT", NULL, NULL, &err_msg);
+		in_transaction = 0;
+		if (ret != SQLITE_OK)
+		    goto sql_error;
+		pending = 0;
+		now = import_time ();
+		fprintf (stderr, "\r%d rows inserted [%1.0f rows/sec]", *rows,
+			 (now > start) ? (double) (*rows) / (now - start) : 0.0);
+		fflush (stderr);
+		ret = sqlite3_exec (handle, "BEGIN", NULL, NULL, &err_msg);
+		if (ret != SQLITE_OK)
+		    goto sql_error;
+		in_transaction = 1;
+	    }
+      }
+    sqlite3_finalize (stmt);
+    stmt = NULL;
+    ret = sqlite3_exec (handle, "COMMIT", NULL, NULL, &err_msg);
+    in_transaction = 0;
+    if (ret != SQLITE_OK)
+	goto sql_error;
+    now = import_time ();
+    fprintf (stderr, "\r%d rows inserted [%1.0f rows/sec] in %1.2f sec\n",
+	     *rows, (now > start) ? (double) (*rows) / (now - start) : 0.0,
+	     now - start);
+
+    if (spatial_index)
+      {
+	  /* building the Spatial Index in a single pass */
+	  t_index = import_time ();
+	  sql =
+	      sqlite3_mprintf ("SELECT CreateSpatialIndex(%Q, %Q)", table,
+			       column);
+	  ret = sqlite3_exec (handle, sql, NULL, NULL, &err_msg);
+	  sqlite3_free (sql);
+	  if (ret != SQLITE_OK)
+	      goto sql_error;
+	  fprintf (stderr, "Spatial Index built in %1.2f sec\n",
+		   import_time () - t_index);
+      }
+
+    for (i = 0; i < n_cols; i++)
+	sqlite3_free (col_names[i]);
+    free (col_names);
+    gaiaFreeShapefile (shp);
+    return 1;
+
+  sql_error:
+    fprintf (stderr, "\nload shapefile error: %s\n", err_msg);
+    sqlite3_free (err_msg);
+  error:
+    if (stmt)
+	sqlite3_finalize (stmt);
+    if (in_transaction)
+	sqlite3_exec (handle, "ROLLBACK", NULL, NULL, NULL);
+    if (*rows - pending > 0)
+	fprintf (stderr, "%d rows had already been committed into '%s'\n",
+		 *rows - pending, table);
+    if (col_names)
+      {
+	  for (i = 0; i < n_cols; i++)
+	      sqlite3_free (col_names[i]);
+	  free (col_names);
+      }
+    gaiaFreeShapefile (shp);
+    return 0;
+}
+
 static void
 do_import_shp (char *db_path, char *shp_path, char *table, char *charset,
-	       int srid, char *column, int coerce2d, int compressed)
+	       int srid, char *column, int coerce2d, int compressed,
+	       int batch_size, int spatial_index)
 {
 /* importing some SHP */
     int ret;
@@ -175,9 +614,17 @@ do_import_shp (char *db_path, char *shp_path, char *table, char *charset,
     cache = spatialite_alloc_connection ();
     spatialite_init_ex (handle, cache, 0);
     spatialite_autocreate (handle);
-    if (load_shapefile
-	(handle, shp_path, table, charset, srid, column, coerce2d, compressed,
-	 0, 0, &rows, NULL))
+    if (batch_size > 0)
+	ret =
+	    load_shapefile_batched (handle, shp_path, table, charset, srid,
+				    column, coerce2d, compressed, batch_size,
+				    spatial_index, &rows);
+    else
+	ret =
+	    load_shapefile (handle, shp_path, table, charset, srid, column,
+			    coerce2d, compressed, 0, spatial_index, &rows,
+			    NULL);
+    if (ret)
 	fprintf (stderr, "Inserted %d rows into '%s' from '%s.shp'\n", rows,
 		 table, shp_path);
     else
@@ -190,9 +637,1393 @@ do_import_shp (char *db_path, char *shp_path, char *table, char *charset,
     spatialite_cleanup_ex (cache);
 }
 
+#ifndef _WIN32
+/* never more chunks [each one holding two temporary files] than this */
+#define EXPORT_MAX_CHUNKS	128
+
+struct export_column
+{
+/* a column of the exported table, and what it actually contains */
+    char *name;
+    int n_int;
+    int n_double;
+    int n_text;
+    int max_digits;
+    int max_len;
+    char type;
+    int length;
+    int decimals;
+    int offset;
+};
+
+struct export_extent
+{
+/* the extent of [some part of] the exported layer */
+    int has_xy;
+    int has_z;
+    int has_m;
+    double minx;
+    double miny;
+    double maxx;
+    double maxy;
+    double minz;
+    double maxz;
+    double minm;
+    double maxm;
+};
+
+struct export_layer
+{
+/* the exported layer, shared by all threads */
+    const char *db_path;
+    const char *charset;
+    int shape;
+    int geom_class;		/* the geometry class being exported */
+    int gaia_type;		/* the same, as a GAIA_xxx[Z|M|ZM] type */
+    int dims;			/* GAIA_XY, GAIA_XY_Z, GAIA_XY_M or GAIA_XY_Z_M */
+    int srid;
+    struct export_column *columns;
+    int n_columns;
+    int dbf_reclen;
+    char *sql;
+};
+
+struct export_chunk
+{
+/*
+ * a ROWID range of the exported table
+ *
+ * the first pass collects the statistics needed for defining the DBF
+ * fields; the second pass encodes SHP records and DBF rows into two
+ * temporary files, later appended in ROWID order to the Shapefile
+*/
+    sqlite3_int64 min_rowid;
+    sqlite3_int64 max_rowid;
+    struct export_column *stats;
+    FILE *shp;
+    FILE *dbf;
+    int rows;
+    int skipped;
+    struct export_extent extent;
+};
+
+struct export_pool
+{
+/* the chunks queue shared by the export threads */
+    struct export_layer *layer;
+    struct export_chunk *chunks;
+    int count;
+    int next;
+    int pass;
+    int quit;
+    pthread_mutex_t mutex;
+};
+
+struct export_buffer
+{
+/* a growable buffer [SHP records] */
+    unsigned char *buf;
+    int size;
+};
+
+static unsigned char *
+export_reserve (struct export_buffer *b, int len)
+{
+/* ensuring the buffer can hold at least LEN bytes */
+    if (b->size < len)
+      {
+	  free (b->buf);
+	  b->size = len + 1024;
+	  b->buf = malloc (b->size);
+      }
+    return b->buf;
+}
+
+static void
+export_range (double *min, double *max, double value, int init)
+{
+/* expanding some range [X, Y, Z or M] */
+    if (!init)
+      {
+	  *min = value;
+	  *max = value;
+	  return;
+      }
+    if (value < *min)
+	*min = value;
+    if (value > *max)
+	*max = value;
+}
+
+static void
+export_vertex (const double *coords, int iv, int dims, double *x, double *y,
+	       double *z, double *m)
+{
+/* fetching a vertex, missing Z and M values being exported as 0 */
+    *z = 0.0;
+    *m = 0.0;
+    switch (dims)
+      {
+      case GAIA_XY_Z:
+	  gaiaGetPointXYZ (coords, iv, x, y, z);
+	  break;
+      case GAIA_XY_M:
+	  gaiaGetPointXYM (coords, iv, x, y, m);
+	  break;
+      case GAIA_XY_Z_M:
+	  gaiaGetPointXYZM (coords, iv, x, y, z, m);
+	  break;
+      default:
+	  gaiaGetPoint (coords, iv, x, y);
+	  break;
+      };
+}
+
+static int
+export_geometry_class (gaiaGeomCollPtr geom)
+{
+/* the Shapefile class of some Geometry, GAIA_UNKNOWN if mixed */
+    int pts = 0;
+    int lns = 0;
+    int pgs = 0;
+    gaiaPointPtr pt;
+    gaiaLinestringPtr ln;
+    gaiaPolygonPtr pg;
+    for (pt = geom->FirstPoint; pt; pt = pt->Next)
+	pts++;
+    for (ln = geom->FirstLinestring; ln; ln = ln->Next)
+	lns++;
+    for (pg = geom->FirstPolygon; pg; pg = pg->Next)
+	pgs++;
+    if (pts == 1 && lns == 0 && pgs == 0)
+	return GAIA_POINT;
+    if (pts > 1 && lns == 0 && pgs == 0)
+	return GAIA_MULTIPOINT;
+    if (pts == 0 && lns > 0 && pgs == 0)
+	return GAIA_LINESTRING;
+    if (pts == 0 && lns == 0 && pgs > 0)
+	return GAIA_POLYGON;
+    return GAIA_UNKNOWN;
+}
+
+static void
+export_part (unsigned char *buf, int base_xy, int base_z, int base_m,
+	     int first, const double *coords, int points, int dims,
+	     int reverse, struct export_extent *ext, double *bbox)
+{
+/* exporting the vertices of a single part */
+    int iv;
+    int k;
+    double x;
+    double y;
+    double z;
+    double m;
+    int endian_arch = gaiaEndianArch ();
+    for (iv = 0; iv < points; iv++)
+      {
+	  export_vertex (coords, reverse ? (points - 1 - iv) : iv, dims, &x,
+			 &y, &z, &m);
+	  k = first + iv;
+	  gaiaExport64 (buf + base_xy + (k * 16), x, GAIA_LITTLE_ENDIAN,
+			endian_arch);
+	  gaiaExport64 (buf + base_xy + (k * 16) + 8, y, GAIA_LITTLE_ENDIAN,
+			endian_arch);
+	  export_range (bbox + 0, bbox + 2, x, k > 0);
+	  export_range (bbox + 1, bbox + 3, y, k > 0);
+	  if (base_z > 0)
+	    {
+		gaiaExport64 (buf + base_z + (k * 8), z, GAIA_LITTLE_ENDIAN,
+			      endian_arch);
+		export_range (&(ext->minz), &(ext->maxz), z, ext->has_z);
+		export_range (bbox + 4, bbox + 5, z, k > 0);
+		ext->has_z = 1;
+	    }
+	  if (base_m > 0)
+	    {
+		gaiaExport64 (buf + base_m + (k * 8), m, GAIA_LITTLE_ENDIAN,
+			      endian_arch);
+		export_range (&(ext->minm), &(ext->maxm), m, ext->has_m);
+		export_range (bbox + 6, bbox + 7, m, k > 0);
+		ext->has_m = 1;
+	    }
+      }
+}
+
+static int
+export_shp_record (gaiaGeomCollPtr geom, int shape, int dims,
+		   struct export_buffer *out, struct export_extent *ext)
+{
+/*
+ * encoding the content of a SHP record [8 bytes header excluded]
+ * returns its length
+ *
+ * Z shapes only carry the optional M section for XYZM layers
+*/
+    unsigned char *buf;
+    gaiaPointPtr pt;
+    gaiaLinestringPtr ln;
+    gaiaPolygonPtr pg;
+    gaiaRingPtr rng;
+    int has_z = 0;
+    int has_m = 0;
+    int n_parts = 0;
+    int n_points = 0;
+    int base_xy;
+    int base_z = 0;
+    int base_m = 0;
+    int len;
+    int part;
+    int first;
+    int ib;
+    double x;
+    double y;
+    double z;
+    double m;
+    double bbox[8];
+    int endian_arch = gaiaEndianArch ();
+
+    if (geom == NULL)
+      {
+	  /* a NULL Shape */
+	  buf = export_reserve (out, 4);
+	  gaiaExport32 (buf, GAIA_SHP_NULL, GAIA_LITTLE_ENDIAN, endian_arch);
+	  return 4;
+      }
+    switch (shape)
+      {
+      case GAIA_SHP_POINTZ:
+      case GAIA_SHP_POLYLINEZ:
+      case GAIA_SHP_POLYGONZ:
+      case GAIA_SHP_MULTIPOINTZ:
+	  has_z = 1;
+	  has_m = (dims == GAIA_XY_Z_M);
+	  break;
+      case GAIA_SHP_POINTM:
+      case GAIA_SHP_POLYLINEM:
+      case GAIA_SHP_POLYGONM:
+      case GAIA_SHP_MULTIPOINTM:
+	  has_m = 1;
+	  break;
+      };
+
+    if (shape == GAIA_SHP_POINT || shape == GAIA_SHP_POINTZ
+	|| shape == GAIA_SHP_POINTM)
+      {
+	  /* a single POINT */
+	  pt = geom->FirstPoint;
+	  len = 20 + (has_z ? 8 : 0) + (has_m ? 8 : 0);
+	  buf = export_reserve (out, len);
+	  gaiaExport32 (buf, shape, GAIA_LITTLE_ENDIAN, endian_arch);
+	  gaiaExport64 (buf + 4, pt->X, GAIA_LITTLE_ENDIAN, endian_arch);
+	  gaiaExport64 (buf + 12, pt->Y, GAIA_LITTLE_ENDIAN, endian_arch);
+	  z = (geom->DimensionModel == GAIA_XY_Z
+	       || geom->DimensionModel == GAIA_XY_Z_M) ? pt->Z : 0.0;
+	  m = (geom->DimensionModel == GAIA_XY_M
+	       || geom->DimensionModel == GAIA_XY_Z_M) ? pt->M : 0.0;
+	  if (has_z)
+	      gaiaExport64 (buf + 20, z, GAIA_LITTLE_ENDIAN, endian_arch);
+	  if (has_m)
+	      gaiaExport64 (buf + len - 8, m, GAIA_LITTLE_ENDIAN, endian_arch);
+	  export_range (&(ext->minx), &(ext->maxx), pt->X, ext->has_xy);
+	  export_range (&(ext->miny), &(ext->maxy), pt->Y, ext->has_xy);
+	  ext->has_xy = 1;
+	  if (has_z)
+	    {
+		export_range (&(ext->minz), &(ext->maxz), z, ext->has_z);
+		ext->has_z = 1;
+	    }
+	  if (has_m)
+	    {
+		export_range (&(ext->minm), &(ext->maxm), m, ext->has_m);
+		ext->has_m = 1;
+	    }
+	  return len;
+      }
+
+/* counting parts and vertices */
+    if (shape == GAIA_SHP_MULTIPOINT || shape == GAIA_SHP_MULTIPOINTZ
+	|| shape == GAIA_SHP_MULTIPOINTM)
+      {
+	  for (pt = geom->FirstPoint; pt; pt = pt->Next)
+	      n_points++;
+	  base_xy = 40;
+      }
+    else
+      {
+	  for (ln = geom->FirstLinestring; ln; ln = ln->Next)
+	    {
+		n_parts++;
+		n_points += ln->Points;
+	    }
+	  for (pg = geom->FirstPolygon; pg; pg = pg->Next)
+	    {
+		n_parts += 1 + pg->NumInteriors;
+		n_points += pg->Exterior->Points;
+		for (ib = 0; ib < pg->NumInteriors; ib++)
+		    n_points += (pg->Interiors + ib)->Points;
+	    }
+	  base_xy = 44 + (n_parts * 4);
+      }
+    len = base_xy + (n_points * 16);
+    if (has_z)
+      {
+	  base_z = len + 16;
+	  len += 16 + (n_points * 8);
+      }
+    if (has_m)
+      {
+	  base_m = len + 16;
+	  len += 16 + (n_points * 8);
+      }
+    buf = export_reserve (out, len);
+    gaiaExport32 (buf, shape, GAIA_LITTLE_ENDIAN, endian_arch);
+
+    if (base_xy == 40)
+      {
+	  /* MULTIPOINT */
+	  gaiaExport32 (buf + 36, n_points, GAIA_LITTLE_ENDIAN, endian_arch);
+	  first = 0;
+	  for (pt = geom->FirstPoint; pt; pt = pt->Next)
+	    {
+		double xyzm[4];
+		xyzm[0] = pt->X;
+		xyzm[1] = pt->Y;
+		xyzm[2] = (geom->DimensionModel == GAIA_XY_M) ? pt->M : pt->Z;
+		xyzm[3] = pt->M;
+		export_part (buf, base_xy, base_z, base_m, first, xyzm, 1,
+			     geom->DimensionModel, 0, ext, bbox);
+		first++;
+	    }
+      }
+    else
+      {
+	  /* POLYLINE or POLYGON: exteriors are clockwise, holes aren't */
+	  gaiaExport32 (buf + 36, n_parts, GAIA_LITTLE_ENDIAN, endian_arch);
+	  gaiaExport32 (buf + 40, n_points, GAIA_LITTLE_ENDIAN, endian_arch);
+	  part = 0;
+	  first = 0;
+	  for (ln = geom->FirstLinestring; ln; ln = ln->Next)
+	    {
+		gaiaExport32 (buf + 44 + (part * 4), first, GAIA_LITTLE_ENDIAN,
+			      endian_arch);
+		export_part (buf, base_xy, base_z, base_m, first, ln->Coords,
+			     ln->Points, ln->DimensionModel, 0, ext, bbox);
+		part++;
+		first += ln->Points;
+	    }
+	  for (pg = geom->FirstPolygon; pg; pg = pg->Next)
+	    {
+		for (ib = -1; ib < pg->NumInteriors; ib++)
+		  {
+		      rng = (ib < 0) ? pg->Exterior : pg->Interiors + ib;
+		      gaiaClockwise (rng);
+		      gaiaExport32 (buf + 44 + (part * 4), first,
+				    GAIA_LITTLE_ENDIAN, endian_arch);
+		      export_part (buf, base_xy, base_z, base_m, first,
+				   rng->Coords, rng->Points, rng->DimensionModel,
+				   (ib < 0) ? !(rng->Clockwise) : rng->Clockwise,
+				   ext, bbox);
+		      part++;
+		      first += rng->Points;
+		  }
+	    }
+      }
+    if (n_points == 0)
+	memset (bbox, 0, sizeof (bbox));
+    for (ib = 0; ib < 4; ib++)
+	gaiaExport64 (buf + 4 + (ib * 8), bbox[ib], GAIA_LITTLE_ENDIAN,
+		      endian_arch);
+    if (has_z)
+      {
+	  gaiaExport64 (buf + base_z - 16, bbox[4], GAIA_LITTLE_ENDIAN,
+			endian_arch);
+	  gaiaExport64 (buf + base_z - 8, bbox[5], GAIA_LITTLE_ENDIAN,
+			endian_arch);
+      }
+    if (has_m)
+      {
+	  gaiaExport64 (buf + base_m - 16, bbox[6], GAIA_LITTLE_ENDIAN,
+			endian_arch);
+	  gaiaExport64 (buf + base_m - 8, bbox[7], GAIA_LITTLE_ENDIAN,
+			endian_arch);
+      }
+    if (n_points > 0)
+      {
+	  x = bbox[0];
+	  y = bbox[1];
+	  export_range (&(ext->minx), &(ext->maxx), x, ext->has_xy);
+	  export_range (&(ext->miny), &(ext->maxy), y, ext->has_xy);
+	  export_range (&(ext->minx), &(ext->maxx), bbox[2], 1);
+	  export_range (&(ext->miny), &(ext->maxy), bbox[3], 1);
+	  ext->has_xy = 1;
+      }
+    return len;
+}
+
+static int
+export_convert (iconv_t cvt, const char *text, int bytes, char *buf)
+{
+/*
+ * converting a text value into the output charset
+ * returns the converted length [at most 1024 bytes, any DBF field
+ * being no longer than 254]
+*/
+    char *p_in = (char *) text;
+    char *p_out = buf;
+    size_t len_in = bytes;
+    size_t len_out = 1024;
+    iconv (cvt, NULL, NULL, NULL, NULL);
+    while (len_in > 0 && len_out > 0)
+      {
+	  if (iconv (cvt, &p_in, &len_in, &p_out, &len_out) != (size_t) (-1))
+	      break;
+	  if (errno != EILSEQ && errno != EINVAL)
+	      break;		/* E2BIG: the field is full anyway */
+	  /* not representable: skipping a single byte */
+	  *p_out++ = '?';
+	  len_out--;
+	  p_in++;
+	  len_in--;
+      }
+    return 1024 - len_out;
+}
+
+static void
+export_text (iconv_t cvt, const char *text, int bytes, char *out, int length)
+{
+/* copying a text value into a CHARACTER field [charset conversion] */
+    char buf[1024];
+    int len;
+    if (cvt == (iconv_t) (-1))
+      {
+	  len = (bytes < length) ? bytes : length;
+	  memcpy (out, text, len);
+	  return;
+      }
+    len = export_convert (cvt, text, bytes, buf);
+    if (len > length)
+	len = length;
+    memcpy (out, buf, len);
+}
+
+static void
+export_dbf_row (sqlite3_stmt * stmt, struct export_layer *layer,
+		iconv_t cvt, unsigned char *row)
+{
+/* encoding a DBF row */
+    struct export_column *col;
+    char num[128];
+    char *out;
+    int len;
+    int i;
+    memset (row, ' ', layer->dbf_reclen);
+    for (i = 0; i < layer->n_columns; i++)
+      {
+	  col = layer->columns + i;
+	  out = (char *) row + col->offset;
+	  switch (sqlite3_column_type (stmt, i))
+	    {
+	    case SQLITE_INTEGER:
+		if (col->type == 'C')
+		    break;
+		if (col->decimals > 0)
+		    sprintf (num, "%*.*f", col->length, col->decimals,
+			     (double) sqlite3_column_int64 (stmt, i));
+		else
+		    sprintf (num, "%*lld", col->length,
+			     (long long) sqlite3_column_int64 (stmt, i));
+		len = strlen (num);
+		if (len <= col->length)
+		    memcpy (out, num, len);
+		continue;
+	    case SQLITE_FLOAT:
+		if (col->type == 'C')
+		    break;
+		len =
+		    snprintf (num, sizeof (num), "%*.*f", col->length,
+			      col->decimals, sqlite3_column_double (stmt, i));
+		if (len > 0 && len <= col->length)
+		    memcpy (out, num, len);
+		continue;
+	    case SQLITE_TEXT:
+		break;
+	    default:
+		continue;	/* NULL or BLOB */
+	    };
+	  export_text (cvt, (const char *) sqlite3_column_text (stmt, i),
+		       sqlite3_column_bytes (stmt, i), out, col->length);
+      }
+}
+
+static void
+export_scan_row (sqlite3_stmt * stmt, struct export_layer *layer,
+		 iconv_t cvt, struct export_column *stats)
+{
+/* collecting DBF statistics about a row [first pass] */
+    struct export_column *st;
+    char num[32];
+    char buf[1024];
+    int len;
+    int i;
+    for (i = 0; i < layer->n_columns; i++)
+      {
+	  st = stats + i;
+	  switch (sqlite3_column_type (stmt, i))
+	    {
+	    case SQLITE_INTEGER:
+		st->n_int++;
+		len =
+		    sprintf (num, "%lld",
+			     (long long) sqlite3_column_int64 (stmt, i));
+		if (len > st->max_digits)
+		    st->max_digits = len;
+		break;
+	    case SQLITE_FLOAT:
+		st->n_double++;
+		break;
+	    case SQLITE_TEXT:
+		st->n_text++;
+		break;
+	    default:
+		continue;	/* NULL or BLOB */
+	    };
+	  /* the length of the value as text */
+	  sqlite3_column_text (stmt, i);
+	  len = sqlite3_column_bytes (stmt, i);
+	  if (len > st->max_len)
+	      st->max_len = len;
+	  if (cvt != (iconv_t) (-1)
+	      && sqlite3_column_type (stmt, i) == SQLITE_TEXT)
+	    {
+		/* the converted text could be even longer */
+		len =
+		    export_convert (cvt,
+				    (const char *) sqlite3_column_text (stmt,
+									i),
+				    sqlite3_column_bytes (stmt, i), buf);
+		if (len > st->max_len)
+		    st->max_len = len;
+	    }
+      }
+}
+
+static int
+export_chunk_rows (sqlite3_stmt * stmt, struct export_layer *layer,
+		   struct export_chunk *chunk, int pass, iconv_t cvt,
+		   struct export_buffer *shp_buf, unsigned char *row)
+{
+/* processing all rows of some chunk */
+    gaiaGeomCollPtr geom;
+    const unsigned char *blob;
+    unsigned char hdr[8];
+    int gcol = layer->n_columns;
+    int len;
+    int ret;
+    int endian_arch = gaiaEndianArch ();
+
+    sqlite3_reset (stmt);
+    sqlite3_clear_bindings (stmt);
+    sqlite3_bind_int64 (stmt, 1, chunk->min_rowid);
+    sqlite3_bind_int64 (stmt, 2, chunk->max_rowid);
+    while (1)
+      {
+	  ret = sqlite3_step (stmt);
+	  if (ret == SQLITE_DONE)
+	      break;
+	  if (ret != SQLITE_ROW)
+	      return 0;
+	  geom = NULL;
+	  if (sqlite3_column_type (stmt, gcol) == SQLITE_BLOB)
+	    {
+		blob = sqlite3_column_blob (stmt, gcol);
+		geom =
+		    gaiaFromSpatiaLiteBlobWkb (blob,
+					       sqlite3_column_bytes (stmt,
+								     gcol));
+	    }
+	  if (geom != NULL)
+	    {
+		ret = export_geometry_class (geom);
+		if (ret == GAIA_POINT && layer->geom_class == GAIA_MULTIPOINT)
+		    ret = GAIA_MULTIPOINT;
+		if (ret != layer->geom_class)
+		  {
+		      /* mismatching geometry class: skipping this row */
+		      gaiaFreeGeomColl (geom);
+		      chunk->skipped++;
+		      continue;
+		  }
+	    }
+	  if (pass == 1)
+	    {
+		export_scan_row (stmt, layer, cvt, chunk->stats);
+		if (geom)
+		    gaiaFreeGeomColl (geom);
+		continue;
+	    }
+
+	  /* second pass: appending the SHP record and the DBF row */
+	  len = export_shp_record (geom, layer->shape, layer->dims, shp_buf,
+			     &(chunk->extent));
+	  if (geom)
+	      gaiaFreeGeomColl (geom);
+	  gaiaExport32 (hdr, chunk->rows + 1, GAIA_BIG_ENDIAN, endian_arch);
+	  gaiaExport32 (hdr + 4, len / 2, GAIA_BIG_ENDIAN, endian_arch);
+	  if (fwrite (hdr, 1, 8, chunk->shp) != 8)
+	      return 0;
+	  if (fwrite (shp_buf->buf, 1, len, chunk->shp) != (size_t) len)
+	      return 0;
+	  export_dbf_row (stmt, layer, cvt, row);
+	  if (fwrite (row, 1, layer->dbf_reclen, chunk->dbf) !=
+	      (size_t) (layer->dbf_reclen))
+	      return 0;
+	  chunk->rows++;
+      }
+    return 1;
+}
+
+static void *
+export_worker (void *arg)
+{
+/* an export thread: processing chunks until the queue is exhausted */
+    struct export_pool *pool = (struct export_pool *) arg;
+    struct export_layer *layer = pool->layer;
+    struct export_chunk *chunk;
+    struct export_buffer shp_buf;
+    sqlite3 *handle = NULL;
+    sqlite3_stmt *stmt = NULL;
+    unsigned char *row = NULL;
+    iconv_t cvt = (iconv_t) (-1);
+    int ok = 0;
+
+    shp_buf.buf = NULL;
+    shp_buf.size = 0;
+    if (sqlite3_open_v2
+	(layer->db_path, &handle, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+	 NULL) != SQLITE_OK)
+	goto stop;
+    if (sqlite3_prepare_v2 (handle, layer->sql, -1, &stmt, NULL) != SQLITE_OK)
+	goto stop;
+    if (pool->pass == 2)
+	row = malloc (layer->dbf_reclen);
+    if (strcasecmp (layer->charset, "UTF-8") != 0
+	&& strcasecmp (layer->charset, "UTF8") != 0)
+      {
+	  cvt = iconv_open (layer->charset, "UTF-8");
+	  if (cvt == (iconv_t) (-1))
+	      goto stop;
+      }
+    ok = 1;
+
+    while (ok)
+      {
+	  chunk = NULL;
+	  pthread_mutex_lock (&(pool->mutex));
+	  if (!(pool->quit) && pool->next < pool->count)
+	    {
+		chunk = pool->chunks + pool->next;
+		pool->next += 1;
+	    }
+	  pthread_mutex_unlock (&(pool->mutex));
+	  if (chunk == NULL)
+	      break;
+	  if (pool->pass == 2)
+	    {
+		chunk->shp = tmpfile ();
+		chunk->dbf = tmpfile ();
+		if (chunk->shp == NULL || chunk->dbf == NULL)
+		  {
+		      ok = 0;
+		      break;
+		  }
+	    }
+	  ok =
+	      export_chunk_rows (stmt, layer, chunk, pool->pass, cvt, &shp_buf,
+				 row);
+      }
+
+  stop:
+    if (!ok)
+      {
+	  pthread_mutex_lock (&(pool->mutex));
+	  pool->quit = 1;
+	  pthread_mutex_unlock (&(pool->mutex));
+      }
+    if (cvt != (iconv_t) (-1))
+	iconv_close (cvt);
+    if (stmt)
+	sqlite3_finalize (stmt);
+    if (handle)
+	sqlite3_close (handle);
+    free (row);
+    free (shp_buf.buf);
+    return NULL;
+}
+
+static int
+export_run_pass (struct export_pool *pool, int pass, int threads)
+{
+/* running a pass on all chunks by using THREADS parallel threads */
+    pthread_t *workers;
+    int started = 0;
+    int i;
+    pool->pass = pass;
+    pool->next = 0;
+    pool->quit = 0;
+    if (threads > pool->count)
+	threads = pool->count;
+    workers = malloc (sizeof (pthread_t) * threads);
+    for (i = 0; i < threads; i++)
+      {
+	  if (pthread_create (workers + started, NULL, export_worker, pool) !=
+	      0)
+	      break;
+	  started++;
+      }
+    if (started == 0)
+      {
+	  /* unable to start any thread: doing all the work here */
+	  export_worker (pool);
+      }
+    for (i = 0; i < started; i++)
+	pthread_join (workers[i], NULL);
+    free (workers);
+    return pool->quit ? 0 : 1;
+}
+
+static void
+export_merge_extent (struct export_extent *ext, const struct export_extent *e)
+{
+/* merging the extent of some chunk */
+    if (e->has_xy)
+      {
+	  export_range (&(ext->minx), &(ext->maxx), e->minx, ext->has_xy);
+	  export_range (&(ext->miny), &(ext->maxy), e->miny, ext->has_xy);
+	  export_range (&(ext->minx), &(ext->maxx), e->maxx, 1);
+	  export_range (&(ext->miny), &(ext->maxy), e->maxy, 1);
+	  ext->has_xy = 1;
+      }
+    if (e->has_z)
+      {
+	  export_range (&(ext->minz), &(ext->maxz), e->minz, ext->has_z);
+	  export_range (&(ext->minz), &(ext->maxz), e->maxz, 1);
+	  ext->has_z = 1;
+      }
+    if (e->has_m)
+      {
+	  export_range (&(ext->minm), &(ext->maxm), e->minm, ext->has_m);
+	  export_range (&(ext->minm), &(ext->maxm), e->maxm, 1);
+	  ext->has_m = 1;
+      }
+}
+
+static void
+export_shp_header (unsigned char *hdr, int shape, size_t length,
+		   const struct export_extent *ext)
+{
+/* preparing a 100 bytes SHP/SHX header */
+    int endian_arch = gaiaEndianArch ();
+    memset (hdr, 0, 100);
+    gaiaExport32 (hdr, 9994, GAIA_BIG_ENDIAN, endian_arch);	/* SHP magic number */
+    gaiaExport32 (hdr + 24, (int) (length / 2), GAIA_BIG_ENDIAN, endian_arch);	/* file length [16-bit words] */
+    gaiaExport32 (hdr + 28, 1000, GAIA_LITTLE_ENDIAN, endian_arch);	/* version */
+    gaiaExport32 (hdr + 32, shape, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 36, ext->minx, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 44, ext->miny, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 52, ext->maxx, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 60, ext->maxy, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 68, ext->minz, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 76, ext->maxz, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 84, ext->minm, GAIA_LITTLE_ENDIAN, endian_arch);
+    gaiaExport64 (hdr + 92, ext->maxm, GAIA_LITTLE_ENDIAN, endian_arch);
+}
+
+static FILE *
+export_create_files (struct export_layer *layer, const char *shp_path)
+{
+/*
+ * creating the Shapefile by gaiaOpenShpWrite(), just as dump_shapefile()
+ * does, so that the DBF header [long column names being truncated by
+ * the library itself] is always the same whatever the number of threads
+ * returns the DBF reopened just after its header, ready for the rows
+*/
+    gaiaShapefilePtr shp;
+    gaiaDbfListPtr list;
+    struct export_column *col;
+    unsigned char hdr[32];
+    char path[1024];
+    FILE *fl;
+    int hdsz;
+    int i;
+    int endian_arch = gaiaEndianArch ();
+
+    list = gaiaAllocDbfList ();
+    for (i = 0; i < layer->n_columns; i++)
+      {
+	  col = layer->columns + i;
+	  gaiaAddDbfField (list, col->name, col->type, col->offset - 1,
+			   col->length, col->decimals);
+      }
+    shp = gaiaAllocShapefile ();
+    gaiaOpenShpWrite (shp, shp_path, layer->gaia_type, list, "UTF-8",
+		      layer->charset);
+    if (!(shp->Valid))
+      {
+	  if (shp->LastError)
+	      fprintf (stderr, "export error: %s\n", shp->LastError);
+	  if (shp->Dbf == NULL)
+	      gaiaFreeDbfList (list);
+	  gaiaFreeShapefile (shp);
+	  return NULL;
+      }
+    gaiaFlushShpHeaders (shp);
+    if (shp->Dbf == NULL)
+	gaiaFreeDbfList (list);	/* not taken over by the Shapefile */
+    gaiaFreeShapefile (shp);
+
+    sprintf (path, "%s.dbf", shp_path);
+    fl = fopen (path, "r+b");
+    if (fl == NULL)
+	return NULL;
+    if (fread (hdr, 1, 32, fl) != 32)
+	goto error;
+    hdsz = gaiaImport16 (hdr + 8, GAIA_LITTLE_ENDIAN, endian_arch);
+    if (gaiaImport16 (hdr + 10, GAIA_LITTLE_ENDIAN, endian_arch) !=
+	layer->dbf_reclen)
+	goto error;
+    if (fseek (fl, hdsz, SEEK_SET) != 0)
+	goto error;
+    return fl;
+  error:
+    fclose (fl);
+    return NULL;
+}
+
+static int
+export_write_prj (sqlite3 * handle, struct export_layer *layer,
+		  const char *shp_path)
+{
+/* exporting the .PRJ file [if the SRID is known] */
+    sqlite3_stmt *stmt = NULL;
+    const char *sql;
+    char path[1024];
+    FILE *out;
+    int ret = 1;
+    if (layer->srid <= 0)
+	return 1;
+    sql = "SELECT srtext FROM spatial_ref_sys WHERE srid = ?";
+    if (sqlite3_prepare_v2 (handle, sql, -1, &stmt, NULL) != SQLITE_OK)
+      {
+	  /* older metadata layout */
+	  sql = "SELECT srs_wkt FROM spatial_ref_sys WHERE srid = ?";
+	  if (sqlite3_prepare_v2 (handle, sql, -1, &stmt, NULL) != SQLITE_OK)
+	      return 1;
+      }
+    sqlite3_bind_int (stmt, 1, layer->srid);
+    if (sqlite3_step (stmt) == SQLITE_ROW
+	&& sqlite3_column_type (stmt, 0) == SQLITE_TEXT)
+      {
+	  sprintf (path, "%s.prj", shp_path);
+	  out = fopen (path, "wb");
+	  if (out == NULL)
+	      ret = 0;
+	  else
+	    {
+		fprintf (out, "%s\r\n", sqlite3_column_text (stmt, 0));
+		if (fclose (out) != 0)
+		    ret = 0;
+	    }
+      }
+    sqlite3_finalize (stmt);
+    return ret;
+}
+
+static int
+export_stitch (struct export_pool *pool, const char *shp_path, int *rows)
+{
+/*
+ * stitching the chunks together in ROWID order
+ *
+ * SHP records are renumbered on the fly, and the SHX is computed
+ * from their offsets; DBF rows are simply appended
+*/
+    struct export_layer *layer = pool->layer;
+    struct export_chunk *chunk;
+    struct export_extent extent;
+    FILE *fl_shp = NULL;
+    FILE *fl_shx = NULL;
+    FILE *fl_dbf = NULL;
+    char path[1024];
+    unsigned char hdr[100];
+    unsigned char *buf = NULL;
+    int buf_size = 0;
+    unsigned char block[8192];
+    size_t offset = 100;
+    size_t rd;
+    int len;
+    int recno = 0;
+    int i;
+    int r;
+    int endian_arch = gaiaEndianArch ();
+
+    memset (&extent, 0, sizeof (struct export_extent));
+    for (i = 0; i < pool->count; i++)
+      {
+	  export_merge_extent (&extent, &(pool->chunks[i].extent));
+	  recno += pool->chunks[i].rows;
+      }
+    *rows = recno;
+    fl_dbf = export_create_files (layer, shp_path);
+    if (fl_dbf == NULL)
+	goto error;
+    sprintf (path, "%s.shp", shp_path);
+    fl_shp = fopen (path, "wb");
+    sprintf (path, "%s.shx", shp_path);
+    fl_shx = fopen (path, "wb");
+    if (fl_shp == NULL || fl_shx == NULL)
+	goto error;
+
+/* appending all chunks */
+    memset (hdr, 0, 100);
+    if (fwrite (hdr, 1, 100, fl_shp) != 100
+	|| fwrite (hdr, 1, 100, fl_shx) != 100)
+	goto error;
+    recno = 0;
+    for (i = 0; i < pool->count; i++)
+      {
+	  chunk = pool->chunks + i;
+	  rewind (chunk->shp);
+	  for (r = 0; r < chunk->rows; r++)
+	    {
+		if (fread (hdr, 1, 8, chunk->shp) != 8)
+		    goto error;
+		len = gaiaImport32 (hdr + 4, GAIA_BIG_ENDIAN, endian_arch) * 2;
+		if (len > buf_size)
+		  {
+		      free (buf);
+		      buf_size = len + 1024;
+		      buf = malloc (buf_size);
+		  }
+		if (fread (buf, 1, len, chunk->shp) != (size_t) len)
+		    goto error;
+		if ((offset + 8 + len) / 2 > 0x7fffffff)
+		  {
+		      fprintf (stderr, "too many data for a Shapefile\n");
+		      goto error;
+		  }
+		recno++;
+		gaiaExport32 (hdr, recno, GAIA_BIG_ENDIAN, endian_arch);
+		if (fwrite (hdr, 1, 8, fl_shp) != 8
+		    || fwrite (buf, 1, len, fl_shp) != (size_t) len)
+		    goto error;
+		gaiaExport32 (block, (int) (offset / 2), GAIA_BIG_ENDIAN,
+			      endian_arch);
+		gaiaExport32 (block + 4, len / 2, GAIA_BIG_ENDIAN, endian_arch);
+		if (fwrite (block, 1, 8, fl_shx) != 8)
+		    goto error;
+		offset += 8 + len;
+	    }
+	  rewind (chunk->dbf);
+	  while ((rd = fread (block, 1, sizeof (block), chunk->dbf)) > 0)
+	    {
+		if (fwrite (block, 1, rd, fl_dbf) != rd)
+		    goto error;
+	    }
+      }
+    block[0] = 0x1a;		/* DBF EOF marker */
+    if (fwrite (block, 1, 1, fl_dbf) != 1)
+	goto error;
+    gaiaExport32 (block, recno, GAIA_LITTLE_ENDIAN, endian_arch);
+    if (fseek (fl_dbf, 4, SEEK_SET) != 0 || fwrite (block, 1, 4, fl_dbf) != 4)
+	goto error;
+
+/* the SHP and SHX headers */
+    export_shp_header (hdr, layer->shape, offset, &extent);
+    if (fseek (fl_shp, 0, SEEK_SET) != 0 || fwrite (hdr, 1, 100, fl_shp) != 100)
+	goto error;
+    export_shp_header (hdr, layer->shape, 100 + ((size_t) recno * 8),
+		       &extent);
+    if (fseek (fl_shx, 0, SEEK_SET) != 0 || fwrite (hdr, 1, 100, fl_shx) != 100)
+	goto error;
+    free (buf);
+    r = 1;
+    if (fclose (fl_shp) != 0)
+	r = 0;
+    if (fclose (fl_shx) != 0)
+	r = 0;
+    if (fclose (fl_dbf) != 0)
+	r = 0;
+    return r;
+
+  error:
+    free (buf);
+    if (fl_shp)
+	fclose (fl_shp);
+    if (fl_shx)
+	fclose (fl_shx);
+    if (fl_dbf)
+	fclose (fl_dbf);
+    return 0;
+}
+
+static int
+export_layer_type (sqlite3 * handle, char *table, char *column, char *type,
+		   struct export_layer *layer)
+{
+/*
+ * determining the Shapefile type from the geometry_columns table
+ * returns 0 if this Geometry can't be exported in parallel
+*/
+    char *sql;
+    char **results;
+    int rows;
+    int columns;
+    int gtype = -1;
+    int dims;
+    int ret;
+    int i;
+
+    sql = sqlite3_mprintf ("SELECT geometry_type, srid FROM geometry_columns "
+			   "WHERE Lower(f_table_name) = Lower(%Q) AND "
+			   "Lower(f_geometry_column) = Lower(%Q)", table,
+			   column);
+    ret = sqlite3_get_table (handle, sql, &results, &rows, &columns, NULL);
+    sqlite3_free (sql);
+    if (ret != SQLITE_OK)
+	return 0;
+    for (i = 1; i <= rows; i++)
+      {
+	  gtype = atoi (results[(i * columns) + 0]);
+	  if (results[(i * columns) + 1] != NULL)
+	      layer->srid = atoi (results[(i * columns) + 1]);
+      }
+    sqlite3_free_table (results);
+    if (gtype < 0)
+	return 0;
+    dims = gtype / 1000;
+    gtype %= 1000;
+    if (type != NULL)
+      {
+	  /* the Shapefile type being explicitly required */
+	  if (strcasecmp (type, "POINT") == 0)
+	      gtype = 1;
+	  else if (strcasecmp (type, "LINESTRING") == 0)
+	      gtype = 2;
+	  else if (strcasecmp (type, "POLYGON") == 0)
+	      gtype = 3;
+	  else if (strcasecmp (type, "MULTIPOINT") == 0)
+	      gtype = 4;
+	  else
+	      return 0;
+      }
+    switch (gtype)
+      {
+      case 1:
+	  layer->geom_class = GAIA_POINT;
+	  layer->shape = (dims == 1
+		    || dims == 3) ? GAIA_SHP_POINTZ : (dims ==
+						       2) ? GAIA_SHP_POINTM :
+	      GAIA_SHP_POINT;
+	  break;
+      case 2:
+      case 5:
+	  layer->geom_class = GAIA_LINESTRING;
+	  layer->shape = (dims == 1
+		    || dims == 3) ? GAIA_SHP_POLYLINEZ : (dims ==
+							  2) ?
+	      GAIA_SHP_POLYLINEM : GAIA_SHP_POLYLINE;
+	  break;
+      case 3:
+      case 6:
+	  layer->geom_class = GAIA_POLYGON;
+	  layer->shape = (dims == 1
+		    || dims == 3) ? GAIA_SHP_POLYGONZ : (dims ==
+							 2) ? GAIA_SHP_POLYGONM
+	      : GAIA_SHP_POLYGON;
+	  break;
+      case 4:
+	  layer->geom_class = GAIA_MULTIPOINT;
+	  layer->shape = (dims == 1
+		    || dims == 3) ? GAIA_SHP_MULTIPOINTZ : (dims ==
+							    2) ?
+	      GAIA_SHP_MULTIPOINTM : GAIA_SHP_MULTIPOINT;
+	  break;
+      default:
+	  /* a generic GEOMETRY: the --type argument is required */
+	  return 0;
+      };
+    /* GAIA_POINTZ = GAIA_POINT + 1000 and so on */
+    layer->gaia_type = layer->geom_class + (dims * 1000);
+    switch (dims)
+      {
+      case 1:
+	  layer->dims = GAIA_XY_Z;
+	  break;
+      case 2:
+	  layer->dims = GAIA_XY_M;
+	  break;
+      case 3:
+	  layer->dims = GAIA_XY_Z_M;
+	  break;
+      default:
+	  layer->dims = GAIA_XY;
+	  break;
+      };
+    return 1;
+}
+
+static int
+export_layer_columns (sqlite3 * handle, char *table, char *column,
+		      struct export_layer *layer)
+{
+/* fetching the table's columns, the Geometry excluded */
+    char *sql;
+    char *xname;
+    char **results;
+    int rows;
+    int columns;
+    int ret;
+    int i;
+    const char *name;
+    struct export_column *col;
+
+    xname = gaiaDoubleQuotedSql (table);
+    sql = sqlite3_mprintf ("PRAGMA table_info(\"%s\")", xname);
+    free (xname);
+    ret = sqlite3_get_table (handle, sql, &results, &rows, &columns, NULL);
+    sqlite3_free (sql);
+    if (ret != SQLITE_OK)
+	return 0;
+    layer->columns = calloc (rows + 1, sizeof (struct export_column));
+    layer->n_columns = 0;
+    for (i = 1; i <= rows; i++)
+      {
+	  name = results[(i * columns) + 1];
+	  if (strcasecmp (name, column) == 0)
+	      continue;
+	  col = layer->columns + layer->n_columns;
+	  col->name = sqlite3_mprintf ("%s", name);
+	  layer->n_columns += 1;
+      }
+    sqlite3_free_table (results);
+
+/* SELECT all columns, the Geometry being the last one */
+    sql = sqlite3_mprintf ("SELECT ");
+    for (i = 0; i < layer->n_columns; i++)
+      {
+	  xname = gaiaDoubleQuotedSql (layer->columns[i].name);
+	  layer->sql = sql;
+	  sql = sqlite3_mprintf ("%s\"%s\", ", layer->sql, xname);
+	  sqlite3_free (layer->sql);
+	  free (xname);
+      }
+    xname = gaiaDoubleQuotedSql (column);
+    layer->sql = sql;
+    sql = sqlite3_mprintf ("%s\"%s\" FROM ", layer->sql, xname);
+    sqlite3_free (layer->sql);
+    free (xname);
+    xname = gaiaDoubleQuotedSql (table);
+    layer->sql = sql;
+    sql =
+	sqlite3_mprintf ("%s\"%s\" WHERE ROWID BETWEEN ? AND ?", layer->sql,
+			 xname);
+    sqlite3_free (layer->sql);
+    free (xname);
+    layer->sql = sql;
+    return 1;
+}
+
+static void
+export_dbf_fields (struct export_layer *layer)
+{
+/* defining the DBF fields from the collected statistics */
+    struct export_column *col;
+    int offset = 1;		/* skipping the deletion flag */
+    int i;
+    for (i = 0; i < layer->n_columns; i++)
+      {
+	  col = layer->columns + i;
+	  if (col->n_text > 0
+	      || (col->n_int == 0 && col->n_double == 0))
+	    {
+		col->type = 'C';
+		col->length = col->max_len;
+		if (col->length < 1)
+		    col->length = 1;
+		if (col->length > 254)
+		    col->length = 254;
+		col->decimals = 0;
+	    }
+	  else if (col->n_double > 0 || col->max_digits > 18)
+	    {
+		col->type = 'N';
+		col->length = 19;
+		col->decimals = 6;
+	    }
+	  else
+	    {
+		col->type = 'N';
+		col->length = col->max_digits;
+		if (col->length < 1)
+		    col->length = 1;
+		col->decimals = 0;
+	    }
+	  col->offset = offset;
+	  offset += col->length;
+      }
+    layer->dbf_reclen = offset;
+}
+
+static int
+dump_shapefile_parallel (sqlite3 * handle, char *db_path, char *table,
+			 char *column, char *shp_path, char *charset,
+			 char *type, int threads, int *rows)
+{
+/*
+ * exporting some SHP by using more than one thread
+ *
+ * the table is split into ROWID ranges, each one being read by its
+ * own read-only connection; SHP records and DBF rows are encoded in
+ * parallel, then stitched together in ROWID order, so that the output
+ * never depends on the number of threads
+ * returns -1 if this table can't be exported this way [e.g. WITHOUT
+ * ROWID], so that the caller falls back to dump_shapefile()
+*/
+    struct export_layer layer;
+    struct export_pool pool;
+    struct export_chunk *chunk;
+    sqlite3_stmt *stmt;
+    char *sql;
+    char *xname;
+    char **results;
+    int n_rows;
+    int n_columns;
+    sqlite3_int64 min_rowid = 0;
+    sqlite3_int64 max_rowid = -1;
+    sqlite3_int64 span;
+    int skipped = 0;
+    int ret = 0;
+    int i;
+    int j;
+
+    *rows = 0;
+    memset (&layer, 0, sizeof (struct export_layer));
+    memset (&pool, 0, sizeof (struct export_pool));
+    if (!export_layer_type (handle, table, column, type, &layer))
+	return -1;
+    if (!export_layer_columns (handle, table, column, &layer))
+	return -1;
+    layer.db_path = db_path;
+    layer.charset = charset;
+    pthread_mutex_init (&(pool.mutex), NULL);
+
+/* checking that the table can be read by ROWID ranges [no WITHOUT ROWID] */
+    if (sqlite3_prepare_v2 (handle, layer.sql, -1, &stmt, NULL) != SQLITE_OK)
+      {
+	  ret = -1;
+	  goto stop;
+      }
+    sqlite3_finalize (stmt);
+
+/* splitting the ROWID range into chunks */
+    xname = gaiaDoubleQuotedSql (table);
+    sql = sqlite3_mprintf ("SELECT Min(ROWID), Max(ROWID) FROM \"%s\"", xname);
+    free (xname);
+    ret =
+	sqlite3_get_table (handle, sql, &results, &n_rows, &n_columns, NULL);
+    sqlite3_free (sql);
+    if (ret != SQLITE_OK)
+      {
+	  ret = -1;
+	  goto stop;
+      }
+    if (n_rows == 1 && results[n_columns + 0] != NULL)
+      {
+	  min_rowid = atoll (results[n_columns + 0]);
+	  max_rowid = atoll (results[n_columns + 1]);
+      }
+    sqlite3_free_table (results);
+    pool.layer = &layer;
+    pool.count = threads * 4;
+    if (pool.count > EXPORT_MAX_CHUNKS)
+	pool.count = EXPORT_MAX_CHUNKS;
+    span = (max_rowid >= min_rowid) ? (max_rowid - min_rowid) / pool.count + 1 : 1;
+    pool.chunks = calloc (pool.count, sizeof (struct export_chunk));
+    for (i = 0; i < pool.count; i++)
+      {
+	  chunk = pool.chunks + i;
+	  chunk->min_rowid = min_rowid + (span * i);
+	  chunk->max_rowid = chunk->min_rowid + span - 1;
+	  chunk->stats = calloc (layer.n_columns + 1,
+				 sizeof (struct export_column));
+      }
+
+/* first pass: defining the DBF fields */
+    if (!export_run_pass (&pool, 1, threads))
+      {
+	  ret = 0;
+	  goto stop;
+      }
+    for (i = 0; i < pool.count; i++)
+      {
+	  chunk = pool.chunks + i;
+	  skipped += chunk->skipped;
+	  chunk->skipped = 0;
+	  for (j = 0; j < layer.n_columns; j++)
+	    {
+		struct export_column *col = layer.columns + j;
+		struct export_column *st = chunk->stats + j;
+		col->n_int += st->n_int;
+		col->n_double += st->n_double;
+		col->n_text += st->n_text;
+		if (st->max_digits > col->max_digits)
+		    col->max_digits = st->max_digits;
+		if (st->max_len > col->max_len)
+		    col->max_len = st->max_len;
+	    }
+      }
+    export_dbf_fields (&layer);
+
+/* second pass: encoding, then stitching */
+    if (!export_run_pass (&pool, 2, threads))
+      {
+	  fprintf (stderr, "export error: unable to read '%s'\n", table);
+	  ret = 0;
+	  goto stop;
+      }
+    ret = export_stitch (&pool, shp_path, rows);
+    if (ret)
+	ret = export_write_prj (handle, &layer, shp_path);
+    if (!ret)
+	fprintf (stderr, "export error: unable to write '%s.shp'\n",
+		 shp_path);
+    if (ret && skipped > 0)
+	fprintf (stderr, "%d rows skipped: mismatching geometry class\n",
+		 skipped);
+
+  stop:
+    pthread_mutex_destroy (&(pool.mutex));
+    for (i = 0; i < pool.count; i++)
+      {
+	  chunk = pool.chunks + i;
+	  free (chunk->stats);
+	  if (chunk->shp)
+	      fclose (chunk->shp);
+	  if (chunk->dbf)
+	      fclose (chunk->dbf);
+      }
+    free (pool.chunks);
+    for (i = 0; i < layer.n_columns; i++)
+	sqlite3_free (layer.columns[i].name);
+    free (layer.columns);
+    sqlite3_free (layer.sql);
+    return ret;
+}
+#endif
+
 static void
 do_export (char *db_path, char *shp_path, char *table, char *column,
-	   char *charset, char *type)
+	   char *charset, char *type, int threads)
 {
 /* exporting some SHP */
     int ret;
@@ -215,8 +2046,22 @@ do_export (char *db_path, char *shp_path, char *table, char *column,
       }
     cache = spatialite_alloc_connection ();
     spatialite_init_ex (handle, cache, 0);
-    if (dump_shapefile
-	(handle, table, column, shp_path, charset, type, 0, &rows, NULL))
+    ret = -1;
+#ifndef _WIN32
+    if (threads > 1)
+	ret =
+	    dump_shapefile_parallel (handle, db_path, table, column, shp_path,
+				     charset, type, threads, &rows);
+    if (ret < 0 && threads > 1)
+	fprintf (stderr,
+		 "unable to export '%s' in parallel: using a single thread\n",
+		 table);
+#endif
+    if (ret < 0)
+	ret =
+	    dump_shapefile (handle, table, column, shp_path, charset, type, 0,
+			    &rows, NULL);
+    if (ret)
 	fprintf (stderr, "Exported %d rows into '%s.shp' from '%s'\n", rows,
 		 shp_path, table);
     else
@@ -277,6 +2122,20 @@ do_help ()
 	     "-2 or --coerce-2d                  coerce to 2D geoms [x,y]\n");
     fprintf (stderr,
 	     "-k or --compressed                 apply geometry compression\n");
+    fprintf (stderr,
+	     "-x or --spatial-index              create the Spatial Index\n");
+    fprintf (stderr,
+	     "-b or --batch-size num             streaming import: committing\n"
+	     "                                   every <num> rows, building\n"
+	     "                                   the Spatial Index at the end;\n"
+	     "                                   on failure the rows already\n"
+	     "                                   committed are left in place\n");
+    fprintf (stderr, "\noptional ARGs for SHP export are:\n");
+    fprintf (stderr, "---------------------------------\n");
+    fprintf (stderr,
+	     "--threads num                      encoding by using <num>\n"
+	     "                                   parallel threads [a single\n"
+	     "                                   thread by default]\n");
     fprintf (stderr, "\nexamples:\n");
     fprintf (stderr, "---------\n");
     fprintf (stderr,
@@ -285,8 +2144,12 @@ do_help ()
 	     "spatialite_tool -i -shp abc -d db.sqlite -t tbl -c CP1252 [-s 4326] [-g geom]\n");
     fprintf (stderr,
 	     "spatialite_tool -i -shp abc -d db.sqlite -t tbl -c CP1252 [-s 4326] [-2] [-k]\n");
+    fprintf (stderr,
+	     "spatialite_tool -i -shp abc -d db.sqlite -t tbl -c CP1252 [-s 4326] -b 100000 [-x]\n");
     fprintf (stderr,
 	     "spatialite_tool -e -shp abc -d db.sqlite -t tbl -g geom -c CP1252 [--type POINT]\n");
+    fprintf (stderr,
+	     "spatialite_tool -e -shp abc -d db.sqlite -t tbl -g geom -c CP1252 --threads 8\n");
 }
 
 int
@@ -309,6 +2172,9 @@ main (int argc, char *argv[])
     int in_dbf = 0;
     int coerce2d = 0;
     int compressed = 0;
+    int batch_size = 0;
+    int spatial_index = 0;
+    int threads = 1;
     int error = 0;
     for (i = 1; i < argc; i++)
       {
@@ -341,6 +2207,12 @@ main (int argc, char *argv[])
 		  case ARG_TYPE:
 		      type = argv[i];
 		      break;
+		  case ARG_BATCH:
+		      batch_size = atoi (argv[i]);
+		      break;
+		  case ARG_THREADS:
+		      threads = atoi (argv[i]);
+		      break;
 		  };
 		next_arg = ARG_NONE;
 		continue;
@@ -455,9 +2327,28 @@ main (int argc, char *argv[])
 		continue;
 	    }
 	  if (strcasecmp (argv[i], "--compressed-geometries") == 0 ||
+	      strcasecmp (argv[i], "--compressed") == 0 ||
 	      strcasecmp (argv[i], "-k") == 0)
 	    {
-		coerce2d = 1;
+		compressed = 1;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--spatial-index") == 0 ||
+	      strcasecmp (argv[i], "-x") == 0)
+	    {
+		spatial_index = 1;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--batch-size") == 0 ||
+	      strcasecmp (argv[i], "-b") == 0)
+	    {
+		next_arg = ARG_BATCH;
+		continue;
+	    }
+	  if (strcasecmp (argv[i], "--threads") == 0 ||
+	      strcasecmp (argv[i], "-threads") == 0)
+	    {
+		next_arg = ARG_THREADS;
 		continue;
 	    }
 	  fprintf (stderr, "unknown argument: %s\n", argv[i]);
@@ -512,6 +2403,12 @@ main (int argc, char *argv[])
 			 "did you forget setting the --charset argument ?\n");
 		error = 1;
 	    }
+	  if (batch_size < 0)
+	    {
+		fprintf (stderr,
+			 "invalid --batch-size argument: expected 1 or more\n");
+		error = 1;
+	    }
       }
     if (export)
       {
@@ -546,6 +2443,12 @@ main (int argc, char *argv[])
 			 "did you forget setting the --charset argument ?\n");
 		error = 1;
 	    }
+	  if (threads < 1)
+	    {
+		fprintf (stderr,
+			 "invalid --threads argument: expected 1 or more\n");
+		error = 1;
+	    }
       }
     if (error)
       {
@@ -556,9 +2459,9 @@ main (int argc, char *argv[])
 	do_import_dbf (db_path, dbf_path, table, charset);
     if (import && in_shp)
 	do_import_shp (db_path, shp_path, table, charset, srid, column,
-		       coerce2d, compressed);
+		       coerce2d, compressed, batch_size, spatial_index);
     if (export)
-	do_export (db_path, shp_path, table, column, charset, type);
+	do_export (db_path, shp_path, table, column, charset, type, threads);
     spatialite_shutdown ();
     return 0;
 }